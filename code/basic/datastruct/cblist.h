@@ -48,7 +48,7 @@ typedef struct cblist {
  *	cblist member name in structure @t is @m.
  */
 #define	CBLIST_GET_TAIL(lh, t, m)			\
-	((lh)->p == (lh) ? NULL : CBLIST_ELEM((lh)->n, t, m))
+	((lh)->p == (lh) ? NULL : CBLIST_ELEM((lh)->p, t, m))
 
 /**
  *	Add cblist @l to head of cblist @lh
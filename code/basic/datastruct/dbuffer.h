@@ -21,7 +21,7 @@
 #define	DBUF_LEN(buf)	((buf)->len)
 
 /* get len in dbuf @buf */
-#define	DBUF_DATA(buf)	((buf)->buf)
+#define	DBUF_DATA(dbuf)	((dbuf)->buf)
 
 #define	DBUF_RESET(buf)	((buf)->len = 0)
 
@@ -91,6 +91,7 @@ dbuf_resize(dbuf_t *buf, u_int32_t max)
 
 	free(buf->buf);
 	buf->buf = p;
+	buf->max = max;
 
 	return 0;
 }
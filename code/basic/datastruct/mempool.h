@@ -16,6 +16,7 @@
 #include "gcc_common.h"
 #include "dbg_common.h"
 
+#include <stdlib.h>
 #include <sys/types.h>
 
 /* memory pool node */
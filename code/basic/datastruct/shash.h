@@ -104,8 +104,9 @@ shash_free(shash_t *h)
 
 				objpool_put(item);
 				b->size--;
+				h->size--;
 			}
-			if (unlikely(h->size))
+			if (unlikely(b->size))
 				ERR("invalid hash size after free\n");
 		}
 		free(h->buckets);
@@ -169,6 +170,8 @@ shash_del(shash_t *h, void *d, u_int32_t hval)
 			CBLIST_DEL(&item->list);
 			data = item->data;
 			objpool_put(item);
+			b->size--;
+			h->size--;
 			return data;
 		}
 	}
@@ -0,0 +1,188 @@
+/**
+ *	@file	spsc_ring.c
+ *
+ *	@brief	SPSC ring buffer implement.
+ *	
+ *	@author	Forrest.zhang	
+ *
+ *	@date
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include "spsc_ring.h"
+
+/**
+ *	Define debug MACRO to print debug information
+ */
+#define _SR_DBG	1
+#ifdef	_SR_DBG
+#define _SR_ERR(fmt, args...)	fprintf(stderr, "%s:%d: "fmt,\
+					__FILE__, __LINE__, ##args)
+#else
+#define _SR_ERR(fmt, args...)
+#endif
+
+#define	_SR_SPIN	1024	/* spin times before sleep */
+#if defined(__x86_64__) || defined(__i386__)
+#define	_SR_PAUSE()	__builtin_ia32_pause()
+#else
+#define	_SR_PAUSE()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+spsc_ring_t * 
+spsc_ring_alloc(u_int32_t size, u_int32_t objsize, int use_evfd)
+{
+	spsc_ring_t *r;
+	u_int32_t n;
+
+	if (size < 1 || size > (1U << 30) || objsize < 1) {
+		_SR_ERR("invalid argument\n");
+		return NULL;
+	}
+
+	/* round up to power of 2 */
+	n = 1;
+	while (n < size)
+		n <<= 1;
+
+	if (posix_memalign((void **)&r, CACHE_LINE_SIZE, sizeof(*r))) {
+		_SR_ERR("alloc memory for spsc_ring failed\n");
+		return NULL;
+	}
+	memset(r, 0, sizeof(*r));
+	r->evfd = -1;
+
+	if (posix_memalign((void **)&r->objs, CACHE_LINE_SIZE, n * objsize)) {
+		_SR_ERR("alloc %u objects for spsc_ring failed\n", n);
+		r->objs = NULL;
+		spsc_ring_free(r);
+		return NULL;
+	}
+
+	r->size = n;
+	r->mask = n - 1;
+	r->objsize = objsize;
+
+	if (use_evfd) {
+		r->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (r->evfd < 0) {
+			_SR_ERR("eventfd failed: %s\n", strerror(errno));
+			spsc_ring_free(r);
+			return NULL;
+		}
+	}
+
+	return r;
+}
+
+void 
+spsc_ring_free(spsc_ring_t *r)
+{
+	if (!r)
+		return;
+
+	if (r->evfd >= 0)
+		close(r->evfd);
+
+	if (r->objs)
+		free(r->objs);
+
+	free(r);
+}
+
+int 
+spsc_ring_notify(spsc_ring_t *r)
+{
+	u_int64_t val = 1;
+
+	if (unlikely(!r))
+		return -1;
+
+	if (r->evfd < 0)
+		return 0;
+
+	/* the @tail store must visible before read @waiting, 
+	 * pair with full barrier in spsc_ring_prepare_wait() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (!__atomic_load_n(&r->waiting, __ATOMIC_RELAXED))
+		return 0;
+
+	r->nnotify++;
+	if (write(r->evfd, &val, sizeof(val)) != sizeof(val) && 
+	    errno != EAGAIN) 
+	{
+		_SR_ERR("write eventfd failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int 
+spsc_ring_prepare_wait(spsc_ring_t *r)
+{
+	__atomic_store_n(&r->waiting, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) != r->head) {
+		__atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+		return 1;
+	}
+
+	return 0;
+}
+
+void 
+spsc_ring_finish_wait(spsc_ring_t *r)
+{
+	u_int64_t val;
+
+	__atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+
+	if (r->evfd >= 0)
+		while (read(r->evfd, &val, sizeof(val)) == sizeof(val))
+			;
+}
+
+int 
+spsc_ring_wait(spsc_ring_t *r, int timeout)
+{
+	int n;
+	struct pollfd pfd;
+
+	if (unlikely(!r || r->evfd < 0))
+		return -1;
+
+	/* spin a while before sleep, avoid eventfd syscall in busy */
+	for (n = 0; n < _SR_SPIN; n++) {
+		if (spsc_ring_count(r) > 0)
+			return 1;
+		_SR_PAUSE();
+	}
+
+	if (spsc_ring_prepare_wait(r))
+		return 1;
+
+	pfd.fd = r->evfd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	n = poll(&pfd, 1, timeout);
+
+	spsc_ring_finish_wait(r);
+
+	if (n < 0 && errno != EINTR) {
+		_SR_ERR("poll eventfd failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return spsc_ring_count(r) > 0 ? 1 : 0;
+}
+
@@ -0,0 +1,204 @@
+/**
+ *	@file	spsc_ring.h
+ *
+ *	@brief	Bounded single-producer/single-consumer lock-free 
+ *		ring buffer, it's used to pass fixed size objects 
+ *		between two threads. The producer index and consumer 
+ *		index are in different cache lines, enqueue/dequeue 
+ *		are batched. The idle consumer can sleep on an eventfd 
+ *		which is waked by producer only when consumer waiting.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#ifndef FZ_SPSC_RING_H
+#define FZ_SPSC_RING_H
+
+#include <sys/types.h>
+#include <string.h>
+
+#include "gcc_common.h"
+
+/**
+ *	SPSC ring, @size is power of 2.
+ */
+typedef struct spsc_ring {
+	/* consumer write */
+	u_int32_t	head __cacheline_aligned;/* consumer position */
+	u_int32_t	tail_cache;	/* cached @tail in consumer */
+	int		waiting;	/* consumer is waiting on @evfd */
+
+	/* producer write */
+	u_int32_t	tail __cacheline_aligned;/* producer position */
+	u_int32_t	head_cache;	/* cached @head in producer */
+	u_int64_t	nnotify;	/* number of wakeup writes */
+
+	/* read only after alloced */
+	u_int32_t	size __cacheline_aligned;/* number of slots */
+	u_int32_t	mask;		/* @size - 1 */
+	u_int32_t	objsize;	/* object size */
+	int		evfd;		/* eventfd for wakeup, -1 if none */
+	char		*objs;		/* object array */
+} spsc_ring_t;
+
+/**
+ *	Alloc a new SPSC ring which can store @size objects, the 
+ *	object size is @objsize. @size is round up to power of 2.
+ *	If @use_evfd is not zero, it'll create a eventfd for 
+ *	consumer wait.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+extern spsc_ring_t * 
+spsc_ring_alloc(u_int32_t size, u_int32_t objsize, int use_evfd);
+
+/**
+ *	Free SPSC ring @r alloced by spsc_ring_alloc().
+ *
+ *	No return.
+ */
+extern void 
+spsc_ring_free(spsc_ring_t *r);
+
+/**
+ *	Return number of objects in ring @r.
+ */
+static inline u_int32_t 
+spsc_ring_count(const spsc_ring_t *r)
+{
+	return __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) - 
+		__atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ *	Put at most @n objects in @objs into ring @r, only the 
+ *	producer thread can call it.
+ *
+ *	Return number of objects enqueued.
+ */
+static inline int 
+spsc_ring_enqueue(spsc_ring_t *r, const void *objs, int n)
+{
+	u_int32_t tail;
+	u_int32_t free;
+	u_int32_t idx;
+	u_int32_t first;
+
+	if (unlikely(n < 1))
+		return 0;
+
+	tail = r->tail;
+	free = r->size - (tail - r->head_cache);
+
+	/* refresh consumer position when cache is not enough */
+	if ((u_int32_t)n > free) {
+		r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		free = r->size - (tail - r->head_cache);
+		if (free == 0)
+			return 0;
+		if ((u_int32_t)n > free)
+			n = free;
+	}
+
+	/* copy objects, maybe wrapped */
+	idx = tail & r->mask;
+	first = r->size - idx;
+	if (first > (u_int32_t)n)
+		first = n;
+	memcpy(r->objs + idx * r->objsize, objs, first * r->objsize);
+	if (first < (u_int32_t)n)
+		memcpy(r->objs, (const char *)objs + first * r->objsize, 
+		       (n - first) * r->objsize);
+
+	__atomic_store_n(&r->tail, tail + n, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+/**
+ *	Get at most @n objects from ring @r into @objs, only the 
+ *	consumer thread can call it.
+ *
+ *	Return number of objects dequeued.
+ */
+static inline int 
+spsc_ring_dequeue(spsc_ring_t *r, void *objs, int n)
+{
+	u_int32_t head;
+	u_int32_t used;
+	u_int32_t idx;
+	u_int32_t first;
+
+	if (unlikely(n < 1))
+		return 0;
+
+	head = r->head;
+	used = r->tail_cache - head;
+
+	/* refresh producer position when cache is not enough */
+	if ((u_int32_t)n > used) {
+		r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		used = r->tail_cache - head;
+		if (used == 0)
+			return 0;
+		if ((u_int32_t)n > used)
+			n = used;
+	}
+
+	idx = head & r->mask;
+	first = r->size - idx;
+	if (first > (u_int32_t)n)
+		first = n;
+	memcpy(objs, r->objs + idx * r->objsize, first * r->objsize);
+	if (first < (u_int32_t)n)
+		memcpy((char *)objs + first * r->objsize, r->objs, 
+		       (n - first) * r->objsize);
+
+	__atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+/**
+ *	Wakeup consumer of ring @r if it's waiting, the producer 
+ *	call it after enqueue a batch of objects.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+spsc_ring_notify(spsc_ring_t *r);
+
+/**
+ *	Consumer prepare to sleep on @r->evfd, it set waiting flag 
+ *	and re-check the ring. The consumer can sleep(poll/epoll) 
+ *	on @r->evfd only when it return 0, and must call 
+ *	spsc_ring_finish_wait() after wakeup.
+ *
+ *	Return 0 if ring is empty, 1 if ring have objects.
+ */
+extern int 
+spsc_ring_prepare_wait(spsc_ring_t *r);
+
+/**
+ *	Consumer finished wait on ring @r, clear waiting flag 
+ *	and drain @r->evfd.
+ *
+ *	No return.
+ */
+extern void 
+spsc_ring_finish_wait(spsc_ring_t *r);
+
+/**
+ *	Consumer wait ring @r have objects at most @timeout 
+ *	milliseconds, it's used when consumer have no other 
+ *	fd to poll.
+ *
+ *	Return 1 if ring have objects, 0 if timeout, -1 on error.
+ */
+extern int 
+spsc_ring_wait(spsc_ring_t *r, int timeout);
+
+#endif /* end of FZ_SPSC_RING_H */
+
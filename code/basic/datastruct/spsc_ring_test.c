@@ -0,0 +1,367 @@
+/**
+ *	@file	spsc_ring_test.c
+ *
+ *	@brief	spsc_ring test program, it's also a benchmark which 
+ *		compare the SPSC ring with mutex protected array 
+ *		swap(the old handoff in pthread proxy).
+ *
+ *	@author	Forrest.zhang
+ *	
+ *	@date
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "spsc_ring.h"
+
+#define	_RING_SIZE	4096
+#define	_BATCH_MAX	256
+
+typedef struct _item {
+	u_int64_t	seq;		/* sequence number */
+	u_int64_t	ts;		/* enqueue timestamp(ns) */
+} _item_t;
+
+/* mutex + array swap queue */
+typedef struct _mqueue {
+	pthread_mutex_t	lock;
+	_item_t		*inq;
+	_item_t		*inq2;
+	int		ninq;
+	int		max;
+} _mqueue_t;
+
+static char _g_optstr[] = ":n:b:mh";
+static u_int64_t _g_count = 1000000;	/* number of objects */
+static int _g_batch = 32;		/* batch size */
+static int _g_mutex;			/* use mutex queue */
+static spsc_ring_t *_g_ring;
+static _mqueue_t _g_mq;
+static u_int64_t *_g_lats;		/* latency of each object */
+static int _g_error;
+
+/**
+ *	Show help message	
+ *	
+ *	No return.
+ */
+static void 
+_usage(void)
+{
+	printf("spsc_ring_test <options>\n");
+	printf("\t-n\tnumber of objects, default is 1000000\n");
+	printf("\t-b\tbatch size(1-%d), default is 32\n", _BATCH_MAX);
+	printf("\t-m\tuse mutex+array swap queue\n");
+	printf("\t-h\tshow help message\n");
+}
+
+/**
+ *	Parse command line argument.	
+ *
+ * 	Return 0 if parse success, -1 on error.
+ */
+static int 
+_parse_cmd(int argc, char **argv)
+{
+	char opt;
+	
+	opterr = 0;
+	while ( (opt = getopt(argc, argv, _g_optstr)) != -1) {
+		
+		switch (opt) {
+			
+		case 'n':
+			_g_count = strtoull(optarg, NULL, 10);
+			if (_g_count < 1)
+				return -1;
+			break;
+
+		case 'b':
+			_g_batch = atoi(optarg);
+			if (_g_batch < 1 || _g_batch > _BATCH_MAX)
+				return -1;
+			break;
+
+		case 'm':
+			_g_mutex = 1;
+			break;
+
+		case 'h':
+			return -1;
+
+		case ':':
+			printf("Option %c missing argument\n", optopt);
+			return -1;
+
+		case '?':
+			printf("Unknowed option %c\n", optopt);
+			return -1;
+		}
+	}
+
+	if (argc != optind)
+		return -1;
+
+	return 0;
+}
+
+static u_int64_t 
+_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *	Init some global resource used in program.	
+ *
+ * 	Return 0 if success, -1 on error.
+ */
+static int 
+_initiate(void)
+{
+	_g_lats = malloc(_g_count * sizeof(u_int64_t));
+	if (!_g_lats)
+		return -1;
+
+	if (_g_mutex) {
+		pthread_mutex_init(&_g_mq.lock, NULL);
+		_g_mq.max = _RING_SIZE;
+		_g_mq.inq = malloc(_RING_SIZE * sizeof(_item_t));
+		_g_mq.inq2 = malloc(_RING_SIZE * sizeof(_item_t));
+		if (!_g_mq.inq || !_g_mq.inq2)
+			return -1;
+	}
+	else {
+		_g_ring = spsc_ring_alloc(_RING_SIZE, sizeof(_item_t), 1);
+		if (!_g_ring)
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ *	Release global resource alloced by _initiate().	
+ *
+ * 	No return.
+ */
+static void 
+_release(void)
+{
+	if (_g_ring)
+		spsc_ring_free(_g_ring);
+	_g_ring = NULL;
+
+	if (_g_mq.inq)
+		free(_g_mq.inq);
+	if (_g_mq.inq2)
+		free(_g_mq.inq2);
+	if (_g_mutex)
+		pthread_mutex_destroy(&_g_mq.lock);
+
+	if (_g_lats)
+		free(_g_lats);
+	_g_lats = NULL;
+}
+
+static int 
+_mq_enqueue(_item_t *items, int n)
+{
+	pthread_mutex_lock(&_g_mq.lock);
+	if (n > _g_mq.max - _g_mq.ninq)
+		n = _g_mq.max - _g_mq.ninq;
+	memcpy(&_g_mq.inq[_g_mq.ninq], items, n * sizeof(_item_t));
+	_g_mq.ninq += n;
+	pthread_mutex_unlock(&_g_mq.lock);
+
+	return n;
+}
+
+static int 
+_mq_dequeue(_item_t **items)
+{
+	_item_t *tmp;
+	int n;
+
+	pthread_mutex_lock(&_g_mq.lock);
+	n = _g_mq.ninq;
+	tmp = _g_mq.inq;
+	_g_mq.inq = _g_mq.inq2;
+	_g_mq.inq2 = tmp;
+	_g_mq.ninq = 0;
+	pthread_mutex_unlock(&_g_mq.lock);
+
+	*items = tmp;
+	return n;
+}
+
+static void * 
+_producer(void *arg)
+{
+	_item_t items[_BATCH_MAX];
+	u_int64_t seq = 0;
+	int i, n, m, off;
+
+	while (seq < _g_count) {
+		n = _g_batch;
+		if (n > _g_count - seq)
+			n = _g_count - seq;
+
+		for (i = 0; i < n; i++) {
+			items[i].seq = seq + i;
+			items[i].ts = _now();
+		}
+
+		off = 0;
+		while (off < n) {
+			if (_g_mutex)
+				m = _mq_enqueue(items + off, n - off);
+			else
+				m = spsc_ring_enqueue(_g_ring, items + off, 
+						      n - off);
+			off += m;
+			if (m == 0)
+				sched_yield();
+		}
+
+		if (!_g_mutex)
+			spsc_ring_notify(_g_ring);
+
+		seq += n;
+	}
+
+	return NULL;
+}
+
+static void * 
+_consumer(void *arg)
+{
+	_item_t buf[_BATCH_MAX];
+	_item_t *items;
+	u_int64_t seq = 0;
+	u_int64_t now;
+	int i, n;
+
+	while (seq < _g_count) {
+		if (_g_mutex) {
+			n = _mq_dequeue(&items);
+			if (n == 0) {
+				/* old proxy thread poll queue by timeout */
+				sched_yield();
+				continue;
+			}
+		}
+		else {
+			items = buf;
+			n = spsc_ring_dequeue(_g_ring, buf, _BATCH_MAX);
+			if (n == 0) {
+				if (spsc_ring_wait(_g_ring, 100) < 0)
+					break;
+				continue;
+			}
+		}
+
+		now = _now();
+		for (i = 0; i < n; i++) {
+			if (items[i].seq != seq) {
+				printf("sequence error: %llu != %llu\n", 
+				       (unsigned long long)items[i].seq, 
+				       (unsigned long long)seq);
+				_g_error = 1;
+				return NULL;
+			}
+			_g_lats[seq++] = now - items[i].ts;
+		}
+	}
+
+	return NULL;
+}
+
+static int 
+_cmp_u64(const void *a, const void *b)
+{
+	u_int64_t x = *(const u_int64_t *)a;
+	u_int64_t y = *(const u_int64_t *)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ *	Run producer/consumer threads and print result.	
+ *
+ * 	Return 0 if success, -1 on error.
+ */
+static int 
+_process(void)
+{
+	pthread_t pid, cid;
+	u_int64_t start, end, sum = 0, i;
+	double secs;
+
+	start = _now();
+	if (pthread_create(&cid, NULL, _consumer, NULL))
+		return -1;
+	if (pthread_create(&pid, NULL, _producer, NULL))
+		return -1;
+	pthread_join(pid, NULL);
+	pthread_join(cid, NULL);
+	end = _now();
+
+	if (_g_error)
+		return -1;
+
+	for (i = 0; i < _g_count; i++)
+		sum += _g_lats[i];
+	qsort(_g_lats, _g_count, sizeof(u_int64_t), _cmp_u64);
+
+	secs = (end - start) / 1e9;
+	printf("mode:       %s\n", _g_mutex ? "mutex" : "spsc_ring");
+	printf("objects:    %llu, batch %d\n", 
+	       (unsigned long long)_g_count, _g_batch);
+	printf("throughput: %.2f Mops/s\n", _g_count / secs / 1e6);
+	printf("latency:    avg %llu ns, p50 %llu ns, p99 %llu ns\n", 
+	       (unsigned long long)(sum / _g_count), 
+	       (unsigned long long)_g_lats[_g_count / 2],
+	       (unsigned long long)_g_lats[_g_count * 99 / 100]);
+	if (_g_ring)
+		printf("notify:     %llu\n", 
+		       (unsigned long long)_g_ring->nnotify);
+
+	return 0;
+}
+
+int 
+main(int argc, char **argv)
+{
+	if (_parse_cmd(argc, argv)) {
+		_usage();
+		return -1;
+	}
+
+	if (_initiate()) {
+		_release();
+		return -1;
+	}
+
+	if (_process()) {
+		printf("spsc_ring test failed\n");
+		_release();
+		return -1;
+	}
+
+	_release();
+
+	return 0;
+}
+
@@ -45,6 +45,15 @@
 #endif
 #endif	/* end of align_num */
 
+/* cache line size and cache line aligned data */
+#ifndef	CACHE_LINE_SIZE
+#define	CACHE_LINE_SIZE	64
+#endif
+
+#ifndef	__cacheline_aligned
+#define	__cacheline_aligned	__attribute__((aligned(CACHE_LINE_SIZE)))
+#endif
+
 #ifndef	rol64
 #define	rol64(w, n)	(((w) << n) | ((w) >> (64 - n)))
 #endif
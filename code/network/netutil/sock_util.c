@@ -8,6 +8,7 @@
 #define	_GNU_SOURCE
 
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netdb.h>
 #include <sys/types.h>
 #include <fcntl.h>
@@ -21,6 +22,7 @@
 #include <netinet/tcp.h>
 #include <assert.h>
 #include <netdb.h>
+#include <linux/errqueue.h>
 
 #include "sock_util.h"
 
@@ -60,6 +62,23 @@
 #define	SO_REUSEPORT	15
 #endif
 
+/* for some old system no ZEROCOPY macro */
+#ifndef	SO_ZEROCOPY
+#define	SO_ZEROCOPY	60
+#endif
+
+#ifndef	MSG_ZEROCOPY
+#define	MSG_ZEROCOPY	0x4000000
+#endif
+
+#ifndef	SO_EE_ORIGIN_ZEROCOPY
+#define	SO_EE_ORIGIN_ZEROCOPY		5
+#endif
+
+#ifndef	SO_EE_CODE_ZEROCOPY_COPIED
+#define	SO_EE_CODE_ZEROCOPY_COPIED	1
+#endif
+
 
 /**
  *	Convert ip_port_t @ip to sk_addr_t address.
@@ -657,19 +676,172 @@ sk_send_all(int fd, const void *buf, size_t len)
 	return m;
 }
 
+int 
+sk_unix_client(const char *unixpath, int type)
+{
+	int fd;
+	struct sockaddr_un addr;
+
+	if (unlikely(!unixpath || strlen(unixpath) >= sizeof(addr.sun_path))) {
+		_SK_ERR("invalid param\n");
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, type, 0);
+	if (fd < 0) {
+		_SK_ERR("socket error: %s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, unixpath);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		_SK_ERR("connect %s error: %s\n", unixpath, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
 int 
 sk_unix_server(const char *unixpath, int type)
 {
+	int fd;
+	struct sockaddr_un addr;
 
-	return 0;
+	if (unlikely(!unixpath || strlen(unixpath) >= sizeof(addr.sun_path))) {
+		_SK_ERR("invalid param\n");
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, type, 0);
+	if (fd < 0) {
+		_SK_ERR("socket error: %s\n", strerror(errno));
+		return -1;
+	}
+
+	/* remove old socket file */
+	unlink(unixpath);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, unixpath);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		_SK_ERR("bind %s error: %s\n", unixpath, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (type == SOCK_STREAM && listen(fd, 16)) {
+		_SK_ERR("listen %s error: %s\n", unixpath, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
 }
 
 int 
-sk_unix_client(const char *unixpath, int type)
+sk_set_zerocopy(int fd, int zerocopy)
 {
+	if (fd < 0)
+		return -1;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &zerocopy, sizeof(zerocopy)))
+		return -1;
+
 	return 0;
 }
 
+int 
+sk_send_zc(int fd, const struct iovec *iov, int niov, int *zc)
+{
+	int n;
+	struct msghdr msg;
+
+	if (unlikely(fd < 0 || !iov || niov < 1 || !zc)) {
+		_SK_ERR("invalid param\n");
+		return -1;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = (struct iovec *)iov;
+	msg.msg_iovlen = niov;
+
+	*zc = 1;
+	n = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_ZEROCOPY);
+
+	/* optmem limit exceed, send it using copy */
+	if (n < 0 && errno == ENOBUFS) {
+		*zc = 0;
+		n = sendmsg(fd, &msg, MSG_DONTWAIT);
+	}
+
+	if (unlikely(n < 0)) {
+		*zc = 0;
+		if (errno != EINTR && errno != EAGAIN) {
+			_SK_ERR("sendmsg error: %s\n", 
+				strerror(errno));
+			return -1;
+		}
+		n = 0;
+	}
+
+	/* no data send, no notification */
+	if (n == 0)
+		*zc = 0;
+
+	return n;
+}
+
+int 
+sk_recv_zc(int fd, u_int32_t *lo, u_int32_t *hi, int *copied)
+{
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct sock_extended_err *serr;
+	char control[128];
+
+	if (unlikely(fd < 0 || !lo || !hi || !copied)) {
+		_SK_ERR("invalid param\n");
+		return -1;
+	}
+
+again:
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+		_SK_ERR("recvmsg(MSG_ERRQUEUE) error: %s\n", 
+			strerror(errno));
+		return -1;
+	}
+
+	for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+		if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+		      (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+			continue;
+
+		serr = (struct sock_extended_err *)CMSG_DATA(cm);
+		if (serr->ee_errno != 0 || 
+		    serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+			continue;
+
+		*lo = serr->ee_info;
+		*hi = serr->ee_data;
+		*copied = (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) ? 1 : 0;
+		return 1;
+	}
+
+	/* not zerocopy notification, skip it */
+	goto again;
+}
+
 int 
 sk_unix_connect(int fd, const char *unixpath)
 {
@@ -12,6 +12,8 @@
 #ifndef FZ_SOCK_UTIL_H
 #define FZ_SOCK_UTIL_H
 
+#include <sys/uio.h>
+
 #include "ip_addr.h"
 
 /**
@@ -191,6 +193,39 @@ sk_send(int fd, const void *buf, size_t len);
 extern int 
 sk_send_all(int fd, const void *buf, size_t len);
 
+/**
+ *	Enable MSG_ZEROCOPY on socket @fd if @zerocopy != 0, 
+ *	disable it if @zerocopy == 0.
+ *
+ *	Return 0 if success, -1 on error(kernel not support).
+ */
+extern int 
+sk_set_zerocopy(int fd, int zerocopy);
+
+/**
+ *	Send data in @iov to socket @fd using MSG_ZEROCOPY, the 
+ *	@iov array have @niov entries. If kernel refused zerocopy 
+ *	(ENOBUFS), it'll send data using normal copy. @zc is set 1 
+ *	if data is sent in zerocopy mode which need wait a completion 
+ *	notification, or set 0 if data is copied.
+ *
+ *	Return send bytes number if success, -1 on error.
+ */
+extern int 
+sk_send_zc(int fd, const struct iovec *iov, int niov, int *zc);
+
+/**
+ *	Read a zerocopy completion notification from error queue 
+ *	of socket @fd. The completed notification id range is 
+ *	[@lo, @hi], @copied is set 1 if kernel copied the data 
+ *	instead of zerocopy.
+ *
+ *	Return 1 if got a notification, 0 if no notification,
+ *	-1 on error.
+ */
+extern int 
+sk_recv_zc(int fd, u_int32_t *lo, u_int32_t *hi, int *copied);
+
 /**
  *	Create a client unix socket and connect to server @path.
  *	socket type @type need to SOCK_STREAM | SOCK_DGRAM
@@ -0,0 +1,193 @@
+/**
+ *	@file	flow_table.c
+ *
+ *	@brief	Open addressing flow table implement.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gcc_common.h"
+#include "dbg_common.h"
+
+#include "flow_table.h"
+
+/**
+ *	Put flow @data into empty slot of @slots, no check.
+ *
+ *	No return.
+ */
+static void 
+_flow_table_put(flow_slot_t *slots, u_int32_t mask, u_int32_t hval,
+		const tcp_flow_key_t *key, void *data)
+{
+	u_int32_t i;
+
+	i = hval & mask;
+	while (slots[i].data)
+		i = (i + 1) & mask;
+
+	slots[i].hval = hval;
+	slots[i].key = *key;
+	slots[i].data = data;
+}
+
+/**
+ *	Double the slots of table @ft.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_flow_table_grow(flow_table_t *ft)
+{
+	u_int32_t i;
+	u_int32_t size;
+	flow_slot_t *slots;
+	flow_slot_t *s;
+
+	size = ft->size * 2;
+	slots = calloc(size, sizeof(flow_slot_t));
+	if (!slots)
+		ERR_RET(-1, "calloc %u slots failed: %s\n", size, ERRSTR);
+
+	/* the hash value is kept in slot, no rehash */
+	for (i = 0; i < ft->size; i++) {
+		s = &ft->slots[i];
+		if (s->data)
+			_flow_table_put(slots, size - 1, s->hval, &s->key,
+					s->data);
+	}
+
+	free(ft->slots);
+	ft->slots = slots;
+	ft->size = size;
+	ft->mask = size - 1;
+
+	return 0;
+}
+
+flow_table_t * 
+flow_table_alloc(u_int32_t size, flow_table_free_func ffunc)
+{
+	u_int32_t n;
+	flow_table_t *ft;
+
+	/* keep load factor below 3/4 */
+	n = FLOW_TABLE_MIN;
+	while (n < size + size / 3 && n < (1U << 31))
+		n *= 2;
+
+	ft = calloc(1, sizeof(flow_table_t));
+	if (!ft)
+		ERR_RET(NULL, "calloc flow table failed: %s\n", ERRSTR);
+
+	ft->slots = calloc(n, sizeof(flow_slot_t));
+	if (!ft->slots) {
+		free(ft);
+		ERR_RET(NULL, "calloc %u slots failed: %s\n", n, ERRSTR);
+	}
+
+	ft->size = n;
+	ft->mask = n - 1;
+	ft->free_func = ffunc;
+
+	return ft;
+}
+
+void 
+flow_table_free(flow_table_t *ft)
+{
+	u_int32_t i;
+
+	if (unlikely(!ft))
+		return;
+
+	if (ft->free_func) {
+		for (i = 0; i < ft->size; i++)
+			if (ft->slots[i].data)
+				ft->free_func(ft->slots[i].data);
+	}
+
+	free(ft->slots);
+	free(ft);
+}
+
+int 
+flow_table_add(flow_table_t *ft, const tcp_flow_key_t *key,
+	       u_int32_t hval, void *data)
+{
+	if (unlikely(!ft || !key || !data))
+		ERR_RET(-1, "invalid argument\n");
+
+	if ((ft->count + 1) * 4 > ft->size * 3 && _flow_table_grow(ft))
+		return -1;
+
+	_flow_table_put(ft->slots, ft->mask, hval, key, data);
+	ft->count++;
+
+	return 0;
+}
+
+void * 
+flow_table_del(flow_table_t *ft, const tcp_flow_key_t *key, u_int32_t hval)
+{
+	u_int32_t i;
+	u_int32_t j;
+	u_int32_t home;
+	void *data;
+	flow_slot_t *s;
+
+	if (unlikely(!ft || !key))
+		ERR_RET(NULL, "invalid argument\n");
+
+	i = hval & ft->mask;
+	while (1) {
+		s = &ft->slots[i];
+		if (!s->data)
+			return NULL;
+		if (s->hval == hval && tcp_flow_key_eq(&s->key, key))
+			break;
+		i = (i + 1) & ft->mask;
+	}
+
+	data = s->data;
+	s->data = NULL;
+	ft->count--;
+
+	/* shift back the slots after @i which can move to @i */
+	j = i;
+	while (1) {
+		j = (j + 1) & ft->mask;
+		s = &ft->slots[j];
+		if (!s->data)
+			break;
+
+		/* @home in (i, j] cyclic, it can't move */
+		home = s->hval & ft->mask;
+		if (((j - home) & ft->mask) < ((j - i) & ft->mask))
+			continue;
+
+		ft->slots[i] = *s;
+		s->data = NULL;
+		i = j;
+	}
+
+	return data;
+}
+
+void 
+flow_table_print(const flow_table_t *ft, const char *prefix)
+{
+	if (unlikely(!ft || !prefix))
+		return;
+
+	printf("%ssize:   %u\n", prefix, ft->size);
+	printf("%scount:  %u\n", prefix, ft->count);
+	printf("%snfind:  %llu\n", prefix, (unsigned long long)ft->nfind);
+	printf("%snprobe: %llu\n", prefix, (unsigned long long)ft->nprobe);
+}
+
@@ -0,0 +1,118 @@
+/**
+ *	@file	flow_table.h
+ *
+ *	@brief	Open addressing hash table of direction-normalized
+ *		flow key, it's used to find TCP stream of packet by
+ *		one hash and one probe. The key and hash are stored
+ *		in slot, the linear probing is used and the deleted
+ *		slot is backward shifted, so no tombstone.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#ifndef FZ_FLOW_TABLE_H
+#define FZ_FLOW_TABLE_H
+
+#include <sys/types.h>
+
+#include "tcp_stream.h"
+
+#define	FLOW_TABLE_MIN		1024	/* min slots */
+
+typedef void (*flow_table_free_func)(void *data);
+
+/**
+ *	The slot of flow table, @data is NULL if it's empty.
+ */
+typedef struct flow_slot {
+	u_int32_t	hval;		/* hash value of @key */
+	tcp_flow_key_t	key;		/* flow key */
+	void		*data;		/* flow data */
+} flow_slot_t;
+
+/**
+ *	The flow table.
+ */
+typedef struct flow_table {
+	flow_slot_t	*slots;		/* slot array */
+	u_int32_t	size;		/* number of slots, power of 2 */
+	u_int32_t	mask;		/* @size - 1 */
+	u_int32_t	count;		/* flows in table */
+	u_int64_t	nprobe;		/* slots probed by find */
+	u_int64_t	nfind;		/* find times */
+	flow_table_free_func free_func;	/* free flow data */
+} flow_table_t;
+
+/**
+ *	Alloc a flow table which can store @size flows without grow,
+ *	the flow data is freed by @ffunc when table freed.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+extern flow_table_t * 
+flow_table_alloc(u_int32_t size, flow_table_free_func ffunc);
+
+/**
+ *	Free flow table @ft and all flow data in it.
+ *
+ *	No return.
+ */
+extern void 
+flow_table_free(flow_table_t *ft);
+
+/**
+ *	Add flow @data which key is @key, hash is @hval into table @ft,
+ *	the key must not in table.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+flow_table_add(flow_table_t *ft, const tcp_flow_key_t *key,
+	       u_int32_t hval, void *data);
+
+/**
+ *	Delete the flow which key is @key from table @ft.
+ *
+ *	Return the flow data if found, NULL if not found.
+ */
+extern void * 
+flow_table_del(flow_table_t *ft, const tcp_flow_key_t *key, u_int32_t hval);
+
+/**
+ *	Find the flow which key is @key in table @ft.
+ *
+ *	Return the flow data if found, NULL if not found.
+ */
+static inline void * 
+flow_table_find(flow_table_t *ft, const tcp_flow_key_t *key, u_int32_t hval)
+{
+	u_int32_t i;
+	flow_slot_t *s;
+
+	ft->nfind++;
+	i = hval & ft->mask;
+	while (1) {
+		s = &ft->slots[i];
+		ft->nprobe++;
+		if (!s->data)
+			return NULL;
+		if (s->hval == hval && tcp_flow_key_eq(&s->key, key))
+			return s->data;
+		i = (i + 1) & ft->mask;
+	}
+
+	return NULL;
+}
+
+/**
+ *	Print the statistic data of table @ft.
+ *
+ *	No return.
+ */
+extern void 
+flow_table_print(const flow_table_t *ft, const char *prefix);
+
+#endif /* end of FZ_FLOW_TABLE_H */
+
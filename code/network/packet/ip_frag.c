@@ -0,0 +1,620 @@
+/**
+ *	@file	ip_frag.c
+ *
+ *	@brief	IPv4/IPv6 fragment reassembly implement.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#include <arpa/inet.h>
+
+#include "gcc_common.h"
+#include "dbg_common.h"
+
+#include "jhash.h"
+#include "packet_ipv4.h"
+#include "packet_ipv6.h"
+#include "ip_frag.h"
+
+/**
+ *	Get the fragment data of @pkt, it's the payload after IPv4
+ *	header or IPv6 fragment header. The @hlen is the header 
+ *	bytes counted in length field of reassembled datagram, it's
+ *	IPv4 header or IPv6 headers after fixed header(include the
+ *	fragment header).
+ *
+ *	Return 0 if success, -1 if invalid or truncated.
+ */
+static int 
+_ip_frag_data(const netpkt_t *pkt, u_int32_t *off, u_int32_t *len,
+	      int *more, u_int8_t **data, u_int32_t *hlen)
+{
+	int n;
+	int end;
+	u_int16_t frag;
+	u_int8_t nexthdr;
+	struct ip6_ext *ext;
+
+	if (pkt->hdr3_type == ETHERTYPE_IP) {
+		frag = ntohs(pkt->hdr3_ipv4->frag_off);
+		*off = IPV4_FRAG_OFF(frag) * 8;
+		*more = IPV4_FRAG_MF(frag);
+		n = pkt->hdr2_len + pkt->hdr3_len;
+		end = pkt->hdr2_len + ntohs(pkt->hdr3_ipv4->tot_len);
+		*hlen = pkt->hdr3_len;
+	}
+	else {
+		*off = IPV6_FRAG_OFF(pkt->frag_off);
+		*more = IPV6_FRAG_MF(pkt->frag_off);
+
+		/* the headers after fragment header is fragmentable */
+		n = pkt->hdr2_len + sizeof(struct ip6_hdr);
+		nexthdr = pkt->hdr3_ipv6->ip6_nxt;
+		while (nexthdr != IPPROTO_FRAGMENT) {
+			if (!IP6HDR_IS_EXT(nexthdr) ||
+			    n >= pkt->hdr2_len + pkt->hdr3_len)
+				return -1;
+			ext = (struct ip6_ext *)(pkt->head + n);
+			nexthdr = ext->ip6e_nxt;
+			n += 8 + (ext->ip6e_len << 3);
+		}
+		n += sizeof(struct ip6_frag);
+		end = pkt->hdr2_len + sizeof(struct ip6_hdr) +
+			ntohs(pkt->hdr3_ipv6->ip6_plen);
+		*hlen = n - pkt->hdr2_len - sizeof(struct ip6_hdr);
+	}
+
+	/* truncated by snaplen or invalid length */
+	if (end > pkt->tail - pkt->head || end <= n)
+		return -1;
+
+	*data = pkt->head + n;
+	*len = end - n;
+
+	/* the fragment except last is multiple of 8 bytes */
+	if (*more && (*len & 7))
+		return -1;
+
+	/* the length field of reassembled datagram can't wrap */
+	if (*hlen >= IP_FRAG_MAXLEN || *off + *len > IP_FRAG_MAXLEN - *hlen)
+		return -1;
+
+	return 0;
+}
+
+/**
+ *	Get the datagram key(src, dst, id, proto) and source key of
+ *	@pkt. The IPv6 datagram is (src, dst, id) as RFC 8200.
+ *
+ *	No return.
+ */
+static void 
+_ip_frag_key(const netpkt_t *pkt, tcp_flow_key_t *key, u_int32_t *hval,
+	     tcp_flow_key_t *skey, u_int32_t *shval)
+{
+	int alen;
+	u_int8_t proto;
+	u_int32_t id;
+	u_int32_t a, b;
+	u_int32_t w[8];
+	const u_int8_t *saddr, *daddr;
+	u_int8_t *p;
+
+	if (pkt->hdr3_type == ETHERTYPE_IP) {
+		saddr = (const u_int8_t *)&pkt->hdr3_ipv4->saddr;
+		daddr = (const u_int8_t *)&pkt->hdr3_ipv4->daddr;
+		alen = 4;
+		id = ntohs(pkt->hdr3_ipv4->id);
+		proto = pkt->hdr3_ipv4->protocol;
+	}
+	else {
+		saddr = pkt->hdr3_ipv6->ip6_src.s6_addr;
+		daddr = pkt->hdr3_ipv6->ip6_dst.s6_addr;
+		alen = 16;
+		id = pkt->frag_id;
+		proto = 0;
+	}
+
+	p = key->data;
+	memcpy(p, saddr, alen);
+	memcpy(p + alen, daddr, alen);
+	p += alen * 2;
+	p[0] = id >> 24;
+	p[1] = id >> 16;
+	p[2] = id >> 8;
+	p[3] = id;
+	p[4] = proto;
+	key->len = alen * 2 + 5;
+
+	memcpy(skey->data, saddr, alen);
+	skey->len = alen;
+
+	memcpy(w, key->data, alen * 2);
+	if (alen == 4) {
+		a = w[0];
+		b = w[1];
+	}
+	else {
+		a = jhash_3words(w[0] ^ w[1], w[2], w[3]);
+		b = jhash_3words(w[4] ^ w[5], w[6], w[7]);
+	}
+	*shval = jhash_3words(a, alen, 0);
+	*hval = jhash_3words(a, b, id ^ ((u_int32_t)proto << 24));
+}
+
+/**
+ *	Delete fragment @f from datagram @d and free it.
+ *
+ *	No return.
+ */
+static void 
+_ip_frag_del(ip_frag_ctx_t *ctx, ip_dgram_t *d, ip_frag_t *f, size_t mem)
+{
+	CBLIST_DEL(&f->list);
+	d->size -= f->len;
+	d->nfrag--;
+
+	d->mem -= mem;
+	d->src->mem -= mem;
+	ctx->mem -= mem;
+
+	if (f->pkt)
+		netpkt_free(f->pkt);
+	free(f);
+}
+
+/**
+ *	Memory of fragment @f.
+ *
+ *	Return the memory size.
+ */
+static inline size_t 
+_ip_frag_mem(const ip_frag_t *f)
+{
+	return sizeof(ip_frag_t) + sizeof(netpkt_t) +
+		(f->pkt->end - f->pkt->start);
+}
+
+/**
+ *	Remove datagram @d from @ctx and free it, the fragments which
+ *	packet is passed to caller are not freed.
+ *
+ *	No return.
+ */
+static void 
+_ip_dgram_free(ip_frag_ctx_t *ctx, ip_dgram_t *d)
+{
+	ip_frag_t *f;
+	ip_frag_src_t *src;
+
+	while (!CBLIST_IS_EMPTY(&d->frags)) {
+		f = CBLIST_GET_HEAD(&d->frags, ip_frag_t *, list);
+		_ip_frag_del(ctx, d, f, f->pkt ? _ip_frag_mem(f) : 0);
+	}
+
+	ctx->mem -= d->mem;
+	d->src->mem -= d->mem;
+
+	flow_table_del(ctx->dgrams, &d->key, d->hval);
+	CBLIST_DEL(&d->list);
+
+	/* the source is freed with its last datagram */
+	src = d->src;
+	src->ndgram--;
+	if (src->ndgram == 0) {
+		flow_table_del(ctx->srcs, &src->key, src->hval);
+		free(src);
+	}
+
+	free(d);
+}
+
+/**
+ *	Alloc a datagram which key is @key, the source key is @skey.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+static ip_dgram_t * 
+_ip_dgram_alloc(ip_frag_ctx_t *ctx, const tcp_flow_key_t *key,
+		u_int32_t hval, const tcp_flow_key_t *skey, u_int32_t shval)
+{
+	ip_dgram_t *d;
+	ip_frag_src_t *src;
+
+	src = flow_table_find(ctx->srcs, skey, shval);
+	if (!src) {
+		src = calloc(1, sizeof(ip_frag_src_t));
+		if (!src)
+			ERR_RET(NULL, "calloc source failed: %s\n", ERRSTR);
+		src->key = *skey;
+		src->hval = shval;
+		if (flow_table_add(ctx->srcs, skey, shval, src)) {
+			free(src);
+			return NULL;
+		}
+	}
+
+	d = calloc(1, sizeof(ip_dgram_t));
+	if (!d) {
+		ERR("calloc datagram failed: %s\n", ERRSTR);
+		goto err_free;
+	}
+
+	if (flow_table_add(ctx->dgrams, key, hval, d)) {
+		free(d);
+		goto err_free;
+	}
+
+	CBLIST_INIT(&d->frags);
+	d->key = *key;
+	d->hval = hval;
+	d->src = src;
+	d->first = ctx->now;
+	CBLIST_ADD_TAIL(&ctx->list, &d->list);
+	src->ndgram++;
+
+	return d;
+
+err_free:
+	if (src->ndgram == 0) {
+		flow_table_del(ctx->srcs, skey, shval);
+		free(src);
+	}
+	return NULL;
+}
+
+/**
+ *	Insert fragment @n into datagram @d, the overlapped bytes are
+ *	resolved by policy, @n is freed if all bytes is received.
+ *
+ *	No return.
+ */
+static void 
+_ip_frag_insert(ip_frag_ctx_t *ctx, ip_dgram_t *d, ip_frag_t *n, size_t mem)
+{
+	u_int32_t m;
+	u_int32_t xend;
+	u_int32_t nend;
+	ip_frag_t *x;
+	cblist_t *pos;
+
+	pos = d->frags.n;
+	while (pos != &d->frags) {
+		x = CBLIST_ELEM(pos, ip_frag_t *, list);
+		pos = pos->n;
+
+		xend = x->off + x->len;
+		nend = n->off + n->len;
+
+		/* @x before @n */
+		if (xend <= n->off)
+			continue;
+
+		/* @x after @n, insert before @x */
+		if (x->off >= nend) {
+			pos = &x->list;
+			break;
+		}
+
+		/* @n inside @x */
+		if (x->off <= n->off && xend >= nend) {
+			ctx->stat.noverlap += n->len;
+			ctx->stat.ndup++;
+			if (ctx->policy == IP_FRAG_LAST)
+				memcpy(x->data + (n->off - x->off), n->data,
+				       n->len);
+			netpkt_free(n->pkt);
+			free(n);
+			return;
+		}
+
+		/* @x inside @n */
+		if (x->off >= n->off && xend <= nend) {
+			ctx->stat.noverlap += x->len;
+			if (ctx->policy == IP_FRAG_FIRST)
+				memcpy(n->data + (x->off - n->off), x->data,
+				       x->len);
+			_ip_frag_del(ctx, d, x, _ip_frag_mem(x));
+			continue;
+		}
+
+		/* @x overlap head of @n */
+		if (x->off < n->off) {
+			m = xend - n->off;
+			ctx->stat.noverlap += m;
+			if (ctx->policy == IP_FRAG_FIRST) {
+				n->data += m;
+				n->off += m;
+				n->len -= m;
+			}
+			else {
+				x->len -= m;
+				d->size -= m;
+			}
+			continue;
+		}
+
+		/* @x overlap tail of @n, insert before @x */
+		m = nend - x->off;
+		ctx->stat.noverlap += m;
+		if (ctx->policy == IP_FRAG_FIRST)
+			n->len -= m;
+		else {
+			x->data += m;
+			x->off += m;
+			x->len -= m;
+			d->size -= m;
+		}
+		pos = &x->list;
+		break;
+	}
+
+	/* add before @pos, it's tail of list if @pos is list head */
+	CBLIST_ADD_TAIL(pos, &n->list);
+	d->size += n->len;
+	d->nfrag++;
+	if (n->off + n->len > d->end)
+		d->end = n->off + n->len;
+
+	d->mem += mem;
+	d->src->mem += mem;
+	ctx->mem += mem;
+}
+
+/**
+ *	The datagram @d is complete, the first fragment chain the
+ *	others, and the length/offset in IP header is updated.
+ *
+ *	Return the first fragment packet.
+ */
+static netpkt_t * 
+_ip_dgram_done(ip_frag_ctx_t *ctx, ip_dgram_t *d)
+{
+	ip_frag_t *f;
+	netpkt_t *pkt;
+	netpkt_t *p;
+	struct iphdr *h4;
+	struct ip6_hdr *h6;
+	struct ip6_frag *fh;
+
+	f = CBLIST_GET_HEAD(&d->frags, ip_frag_t *, list);
+	pkt = f->pkt;
+	pkt->tail = f->data + f->len;
+	f->pkt = NULL;
+
+	if (pkt->hdr3_type == ETHERTYPE_IP) {
+		h4 = pkt->hdr3_ipv4;
+		h4->tot_len = htons(pkt->hdr3_len + d->len);
+		h4->frag_off &= htons(IP_DF);
+		h4->check = 0;
+		h4->check = ipv4_cksum((u_int16_t *)h4, pkt->hdr3_len / 2);
+	}
+	else {
+		/* keep fragment header as atomic fragment */
+		h6 = pkt->hdr3_ipv6;
+		fh = (struct ip6_frag *)(f->data - sizeof(struct ip6_frag));
+		fh->ip6f_offlg = 0;
+		h6->ip6_plen = htons((f->data - (u_int8_t *)h6) -
+				     sizeof(struct ip6_hdr) + d->len);
+		pkt->frag_off = 0;
+	}
+
+	/* other fragments only have data */
+	CBLIST_FOR_EACH(&d->frags, f, list) {
+		p = f->pkt;
+		if (!p)
+			continue;
+		p->head = f->data;
+		p->tail = f->data + f->len;
+		p->hdr2_len = 0;
+		p->hdr3_len = 0;
+		p->hdr4_len = 0;
+		p->eth = NULL;
+		p->hdr3_ipv4 = NULL;
+		p->hdr4_tcp = NULL;
+		CBLIST_ADD_TAIL(&pkt->frags, &p->list);
+		f->pkt = NULL;
+	}
+
+	ctx->stat.ndgram++;
+	_ip_dgram_free(ctx, d);
+
+	return pkt;
+}
+
+ip_frag_ctx_t * 
+ip_frag_alloc(u_int32_t timeout, size_t maxmem, size_t maxsrc, int policy)
+{
+	ip_frag_ctx_t *ctx;
+
+	if (unlikely(policy != IP_FRAG_FIRST && policy != IP_FRAG_LAST))
+		ERR_RET(NULL, "invalid policy %d\n", policy);
+
+	ctx = calloc(1, sizeof(ip_frag_ctx_t));
+	if (!ctx)
+		ERR_RET(NULL, "calloc context failed: %s\n", ERRSTR);
+
+	ctx->dgrams = flow_table_alloc(0, NULL);
+	ctx->srcs = flow_table_alloc(0, NULL);
+	if (!ctx->dgrams || !ctx->srcs) {
+		ip_frag_free(ctx);
+		return NULL;
+	}
+
+	CBLIST_INIT(&ctx->list);
+	ctx->timeout = (u_int64_t)(timeout ? timeout : IP_FRAG_TIMEOUT) *
+		1000000;
+	ctx->maxmem = maxmem ? maxmem : IP_FRAG_MAXMEM;
+	ctx->maxsrc = maxsrc ? maxsrc : IP_FRAG_MAXSRC;
+	ctx->policy = policy;
+
+	return ctx;
+}
+
+void 
+ip_frag_free(ip_frag_ctx_t *ctx)
+{
+	ip_dgram_t *d;
+
+	if (unlikely(!ctx))
+		return;
+
+	if (ctx->dgrams && ctx->srcs) {
+		while (!CBLIST_IS_EMPTY(&ctx->list)) {
+			d = CBLIST_GET_HEAD(&ctx->list, ip_dgram_t *, list);
+			_ip_dgram_free(ctx, d);
+		}
+	}
+
+	flow_table_free(ctx->dgrams);
+	flow_table_free(ctx->srcs);
+	free(ctx);
+}
+
+netpkt_t * 
+ip_frag_add(ip_frag_ctx_t *ctx, const netpkt_t *pkt)
+{
+	int more;
+	size_t mem;
+	u_int32_t off;
+	u_int32_t len;
+	u_int32_t hlen;
+	u_int32_t hval;
+	u_int32_t shval;
+	u_int8_t *data;
+	tcp_flow_key_t key;
+	tcp_flow_key_t skey;
+	ip_dgram_t *d;
+	ip_dgram_t *old;
+	ip_frag_t *f;
+
+	if (unlikely(!ctx || !pkt || !pkt->hdr3_ipv4))
+		ERR_RET(NULL, "invalid argument\n");
+
+	ctx->stat.nfrag++;
+
+	/* the packet time drive timeout */
+	if (pkt->ts > ctx->now)
+		ip_frag_expire(ctx, pkt->ts);
+
+	if (_ip_frag_data(pkt, &off, &len, &more, &data, &hlen)) {
+		ctx->stat.nbad++;
+		return NULL;
+	}
+
+	_ip_frag_key(pkt, &key, &hval, &skey, &shval);
+	d = flow_table_find(ctx->dgrams, &key, hval);
+	if (!d) {
+		d = _ip_dgram_alloc(ctx, &key, hval, &skey, shval);
+		if (!d)
+			return NULL;
+	}
+
+	/* the header of first fragment is used in reassembled 
+	 * datagram, it maybe large than other fragments */
+	if (hlen > d->hlen)
+		d->hlen = hlen;
+
+	/* the length conflict with other fragments */
+	if ((!more && ((d->last && d->len != off + len) || d->end > off + len)) ||
+	    (more && d->last && off + len > d->len) ||
+	    (off + len > IP_FRAG_MAXLEN - d->hlen) ||
+	    (d->end > IP_FRAG_MAXLEN - d->hlen) ||
+	    d->nfrag >= IP_FRAG_MAXFRAG) {
+		ctx->stat.nbad++;
+		_ip_dgram_free(ctx, d);
+		return NULL;
+	}
+
+	if (!more) {
+		d->last = 1;
+		d->len = off + len;
+	}
+
+	/* check memory caps before copy */
+	mem = sizeof(ip_frag_t) + sizeof(netpkt_t) + (pkt->tail - pkt->head);
+	if (d->src->mem + mem > ctx->maxsrc) {
+		ctx->stat.ndrop_src++;
+		_ip_dgram_free(ctx, d);
+		return NULL;
+	}
+	while (ctx->mem + mem > ctx->maxmem) {
+		old = CBLIST_GET_HEAD(&ctx->list, ip_dgram_t *, list);
+		ctx->stat.ndrop_mem++;
+		if (old == d) {
+			_ip_dgram_free(ctx, d);
+			return NULL;
+		}
+		_ip_dgram_free(ctx, old);
+	}
+
+	f = malloc(sizeof(ip_frag_t));
+	if (!f)
+		ERR_RET(NULL, "malloc fragment failed: %s\n", ERRSTR);
+
+	f->pkt = netpkt_clone(pkt);
+	if (!f->pkt) {
+		free(f);
+		ERR_RET(NULL, "clone fragment failed: %s\n", ERRSTR);
+	}
+	f->off = off;
+	f->len = len;
+	f->data = f->pkt->head + (data - pkt->head);
+
+	_ip_frag_insert(ctx, d, f, mem);
+
+	if (d->last && d->size == d->len)
+		return _ip_dgram_done(ctx, d);
+
+	return NULL;
+}
+
+void 
+ip_frag_expire(ip_frag_ctx_t *ctx, u_int64_t now)
+{
+	ip_dgram_t *d;
+
+	if (unlikely(!ctx))
+		return;
+
+	if (now > ctx->now)
+		ctx->now = now;
+
+	/* the list is sorted by first time, only check heads */
+	while (!CBLIST_IS_EMPTY(&ctx->list)) {
+		d = CBLIST_GET_HEAD(&ctx->list, ip_dgram_t *, list);
+		if (d->first + ctx->timeout > ctx->now)
+			break;
+		ctx->stat.ntimeout++;
+		_ip_dgram_free(ctx, d);
+	}
+}
+
+void 
+ip_frag_print(const ip_frag_ctx_t *ctx, const char *prefix)
+{
+	if (unlikely(!ctx || !prefix))
+		return;
+
+	printf("%sfrag:      %llu\n", prefix,
+	       (unsigned long long)ctx->stat.nfrag);
+	printf("%sdgram:     %llu\n", prefix,
+	       (unsigned long long)ctx->stat.ndgram);
+	printf("%soverlap:   %llu\n", prefix,
+	       (unsigned long long)ctx->stat.noverlap);
+	printf("%sdup:       %llu\n", prefix,
+	       (unsigned long long)ctx->stat.ndup);
+	printf("%stimeout:   %llu\n", prefix,
+	       (unsigned long long)ctx->stat.ntimeout);
+	printf("%sdrop_mem:  %llu\n", prefix,
+	       (unsigned long long)ctx->stat.ndrop_mem);
+	printf("%sdrop_src:  %llu\n", prefix,
+	       (unsigned long long)ctx->stat.ndrop_src);
+	printf("%sbad:       %llu\n", prefix,
+	       (unsigned long long)ctx->stat.nbad);
+	printf("%spending:   %u\n", prefix, ctx->dgrams->count);
+	printf("%smem:       %zu\n", prefix, ctx->mem);
+}
+
@@ -1,30 +1,173 @@
 /**
- *	@file
+ *	@file	ip_frag.h
+ *
+ *	@brief	IPv4/IPv6 fragment reassembly. The datagram is found by
+ *		(src, dst, id, proto) in hash table, the fragments are
+ *		kept in list sorted by offset and the overlapped bytes
+ *		are resolved by policy(first/last as spp_frag3.c). The
+ *		datagram is timeout by packet time, the memory is
+ *		limited by source and globally. The complete datagram
+ *		is the first fragment chained other fragments, no data
+ *		copied, use netpkt_pullup() if decoder need linear data.
  *
- *	@brief
- *	
  *	@author	Forrest.zhang
  *
  *	@date
  */
 
-#ifndef FZ_INET_INFO_H
-#define FZ_INET_INFO_H
+#ifndef FZ_IP_FRAG_H
+#define FZ_IP_FRAG_H
+
+#include <sys/types.h>
+
+#include "netpkt.h"
+#include "flow_table.h"
+
+#define	IP_FRAG_TIMEOUT		30		/* default timeout(s) */
+#define	IP_FRAG_MAXMEM		(4 * 1024 * 1024)/* default memory cap */
+#define	IP_FRAG_MAXSRC		(512 * 1024)	/* default memory of source */
+#define	IP_FRAG_MAXFRAG		128		/* max fragments of datagram */
+#define	IP_FRAG_MAXLEN		65535		/* max datagram length */
+
+/**
+ *	Overlap policy.
+ */
+enum {
+	IP_FRAG_FIRST,			/* keep the bytes arrived first */
+	IP_FRAG_LAST,			/* the new bytes overwrite old */
+};
+
+/**
+ *	Fragment reassembly statistic data.
+ */
+typedef struct ip_frag_stat {
+	u_int64_t	nfrag;		/* fragments received */
+	u_int64_t	ndgram;		/* datagrams reassembled */
+	u_int64_t	noverlap;	/* overlapped bytes */
+	u_int64_t	ndup;		/* fragments all bytes received */
+	u_int64_t	ntimeout;	/* datagrams timeout */
+	u_int64_t	ndrop_mem;	/* datagrams dropped by memory cap */
+	u_int64_t	ndrop_src;	/* datagrams dropped by source cap */
+	u_int64_t	nbad;		/* invalid or truncated fragments */
+} ip_frag_stat_t;
+
+/**
+ *	Memory used by one source address.
+ */
+typedef struct ip_frag_src {
+	tcp_flow_key_t	key;		/* source address */
+	u_int32_t	hval;		/* hash value of @key */
+	u_int32_t	ndgram;		/* datagrams of source */
+	size_t		mem;		/* memory of datagrams */
+} ip_frag_src_t;
+
+/**
+ *	One fragment, the data is in @pkt which is a copy of
+ *	captured packet.
+ */
+typedef struct ip_frag {
+	cblist_t	list;		/* in ip_dgram_t @frags */
+	u_int32_t	off;		/* offset in datagram payload */
+	u_int32_t	len;		/* data length */
+	u_int8_t	*data;		/* data in @pkt */
+	netpkt_t	*pkt;		/* packet of fragment */
+} ip_frag_t;
+
+/**
+ *	The datagram in reassembly.
+ */
+typedef struct ip_dgram {
+	cblist_t	list;		/* in ctx list sorted by @first */
+	cblist_t	frags;		/* fragments sorted by offset */
+	tcp_flow_key_t	key;		/* (src, dst, id, proto) */
+	u_int32_t	hval;		/* hash value of @key */
+	ip_frag_src_t	*src;		/* source of datagram */
+	u_int32_t	len;		/* payload length, valid if @last */
+	u_int32_t	size;		/* bytes received */
+	u_int32_t	end;		/* max end offset of fragments */
+	u_int32_t	hlen;		/* max header bytes of fragments */
+	u_int32_t	nfrag;		/* fragments in @frags */
+	size_t		mem;		/* memory of fragments */
+	u_int64_t	first;		/* time of first fragment(usec) */
+	int		last;		/* last fragment received */
+} ip_dgram_t;
+
+/**
+ *	Reassembly context, it's not thread safe.
+ */
+typedef struct ip_frag_ctx {
+	flow_table_t	*dgrams;	/* datagrams in reassembly */
+	flow_table_t	*srcs;		/* source memory */
+	cblist_t	list;		/* datagrams sorted by first time */
+	u_int64_t	timeout;	/* timeout(usec) */
+	size_t		maxmem;		/* max memory of all datagrams */
+	size_t		maxsrc;		/* max memory of one source */
+	size_t		mem;		/* memory of all datagrams */
+	u_int64_t	now;		/* time of latest packet(usec) */
+	int		policy;		/* overlap policy */
+	ip_frag_stat_t	stat;		/* statistic data */
+} ip_frag_ctx_t;
+
+/**
+ *	Check @pkt is a fragment, the layer 3 header is decoded.
+ *
+ *	Return 1 if it's a fragment, 0 if not.
+ */
+static inline int 
+ip_frag_is_frag(const netpkt_t *pkt)
+{
+	if (pkt->hdr3_type == ETHERTYPE_IP)
+		return (ntohs(pkt->hdr3_ipv4->frag_off) &
+			(IP_MF | IP_OFFMASK)) ? 1 : 0;
+	else if (pkt->hdr3_type == ETHERTYPE_IPV6)
+		return pkt->frag_off ? 1 : 0;
 
-typedef inet_frag {
-	ip_addr_t	sip;
-	ip_addr_t	dip;
-	u_int16_t	id;	/* id for defrag. */
-	u_int16_t	fragoff;
-} inet_frag_t; 
+	return 0;
+}
 
-extern inet_ctx_t * 
-inet_alloc_ctx();
+/**
+ *	Alloc a reassembly context, the datagram is dropped after
+ *	@timeout seconds, @maxmem/@maxsrc is the memory cap of all
+ *	datagrams and one source. The 0 value is default.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+extern ip_frag_ctx_t * 
+ip_frag_alloc(u_int32_t timeout, size_t maxmem, size_t maxsrc, int policy);
 
-extern int 
-inet_free_ctx();
+/**
+ *	Free context @ctx and all datagrams in it.
+ *
+ *	No return.
+ */
+extern void 
+ip_frag_free(ip_frag_ctx_t *ctx);
 
+/**
+ *	Add fragment @pkt which layer 3 header is decoded, it's
+ *	copied so it can be a view of capture buffer.
+ *
+ *	Return the complete datagram which is freed by netpkt_free(),
+ *	NULL if not complete or error.
+ */
+extern netpkt_t * 
+ip_frag_add(ip_frag_ctx_t *ctx, const netpkt_t *pkt);
+
+/**
+ *	Drop the datagrams timeout at @now(usec).
+ *
+ *	No return.
+ */
+extern void 
+ip_frag_expire(ip_frag_ctx_t *ctx, u_int64_t now);
 
-#endif /* end of FZ_INET_INFO_H */
+/**
+ *	Print the statistic data of @ctx.
+ *
+ *	No return.
+ */
+extern void 
+ip_frag_print(const ip_frag_ctx_t *ctx, const char *prefix);
 
+#endif /* end of FZ_IP_FRAG_H */
 
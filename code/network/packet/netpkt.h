@@ -14,6 +14,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <net/if_arp.h>
 #include <net/ethernet.h>
@@ -33,9 +34,9 @@
 #define	IPV4_FRAG_MF(off)	(((off) & IP_MF) >> 13)
 #define	IPV4_FRAG_OFF(off)	((off) & IP_OFFMASK)
 
-/* IPv6 fragment macro */
-#define	IPV6_FRAG_MF(off)	((off) & IP6F_MORE_FRAG >> 15)
-#define	IPV6_FRAG_OFF(off)	((off) & IP6F_OFF_MASK)
+/* IPv6 fragment macro, @off is host order, the offset is in bytes */
+#define	IPV6_FRAG_MF(off)	((off) & 0x0001)
+#define	IPV6_FRAG_OFF(off)	((off) & 0xfff8)
 
 #define	NETPKT_HLEN(p)		((p)->hdr2_len + (p)->hdr3_len + (p)->hdr4_len)
 
@@ -82,6 +83,11 @@ typedef struct netpkt {
 	u_int8_t		*end;	/* end of memory */
 	u_int8_t		*head;	/* head of packet data */
 	u_int8_t		*tail;	/* tail of packet data */
+
+	u_int64_t		ts;	/* capture time(usec) */
+
+	/* the data after @tail, netpkt_t of reassembled fragments */
+	cblist_t		frags;
 } netpkt_t;
 
 #define	hdr3_arp	hdr3.arp
@@ -103,6 +109,7 @@ netpkt_init(netpkt_t *pkt, const void *data, size_t size)
 {
 	memset(pkt, 0, sizeof(*pkt));
 	CBLIST_INIT(&pkt->list);
+	CBLIST_INIT(&pkt->frags);
 	pkt->start = (u_int8_t *)data;
 	pkt->end = (u_int8_t *)data + size;
 	pkt->head = (u_int8_t *)data;
@@ -139,19 +146,131 @@ netpkt_alloc(size_t size)
 }
 
 /**
- *	Free @pkt which alloced by @netpkt_alloc().
+ *	Free @pkt which alloced by @netpkt_alloc(), the chained
+ *	fragments are freed too.
  *
  *	No return.
  */
 static inline void 
 netpkt_free(netpkt_t *pkt)
 {
+	netpkt_t *frag;
+
+	while (!CBLIST_IS_EMPTY(&pkt->frags)) {
+		frag = CBLIST_GET_HEAD(&pkt->frags, netpkt_t *, list);
+		netpkt_free(frag);
+	}
+
 	/* delete from list */
 	CBLIST_DEL(&pkt->list);
 
 	free(pkt);
 }
 
+/**
+ *	Get data length of @pkt, include the chained fragments.
+ *
+ *	Return the length.
+ */
+static inline size_t 
+netpkt_len(const netpkt_t *pkt)
+{
+	size_t n;
+	netpkt_t *frag;
+
+	n = pkt->tail - pkt->head;
+	CBLIST_FOR_EACH(&pkt->frags, frag, list)
+		n += frag->tail - frag->head;
+
+	return n;
+}
+
+/**
+ *	Clone the data and decoded headers of @pkt into a new
+ *	netpkt_t, used to keep the packet which is a view of
+ *	memory owned by others(pcap buffer or mmaped ring). The
+ *	chained fragments are copied after data, so the clone is
+ *	linear.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+static inline netpkt_t * 
+netpkt_clone(const netpkt_t *pkt)
+{
+	size_t n;
+	size_t m;
+	u_int8_t *data;
+	netpkt_t *p;
+	netpkt_t *frag;
+
+	n = netpkt_len(pkt);
+	p = malloc(sizeof(*p) + n);
+	if (!p)
+		return NULL;
+
+	memcpy(p, pkt, sizeof(*p));
+	CBLIST_INIT(&p->list);
+	CBLIST_INIT(&p->frags);
+
+	data = (u_int8_t *)p + sizeof(*p);
+	m = pkt->tail - pkt->head;
+	if (m)
+		memcpy(data, pkt->head, m);
+	CBLIST_FOR_EACH(&pkt->frags, frag, list) {
+		memcpy(data + m, frag->head, frag->tail - frag->head);
+		m += frag->tail - frag->head;
+	}
+
+	/* the headers point to new data */
+	if (pkt->eth)
+		p->eth = (struct ether_header *)
+			(data + ((u_int8_t *)pkt->eth - pkt->head));
+	if (pkt->hdr3_ipv4)
+		p->hdr3_ipv4 = (struct iphdr *)
+			(data + ((u_int8_t *)pkt->hdr3_ipv4 - pkt->head));
+	if (pkt->hdr4_tcp)
+		p->hdr4_tcp = (struct tcphdr *)
+			(data + ((u_int8_t *)pkt->hdr4_tcp - pkt->head));
+
+	p->start = data;
+	p->head = data;
+	p->tail = data + n;
+	p->end = data + n;
+
+	return p;
+}
+
+/**
+ *	Make the first @len bytes after layer 3 header of @*pkt in
+ *	the first netpkt_t, so the decoder can read layer 4 header.
+ *	If not, @*pkt is replaced by a linear clone and freed.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static inline int 
+netpkt_pullup(netpkt_t **pkt, size_t len)
+{
+	size_t n;
+	netpkt_t *p;
+
+	p = *pkt;
+	n = p->hdr2_len + p->hdr3_len + len;
+	if (p->tail - p->head >= n)
+		return 0;
+
+	if (CBLIST_IS_EMPTY(&p->frags) || netpkt_len(p) < n)
+		return -1;
+
+	p = netpkt_clone(p);
+	if (!p)
+		return -1;
+
+	netpkt_free(*pkt);
+	*pkt = p;
+
+	return 0;
+}
+
 /**
  *	Get the head room length of @pkt.
  *
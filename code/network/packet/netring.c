@@ -0,0 +1,373 @@
+/**
+ *	@file	netring.c
+ *
+ *	@brief	TPACKET_V3 ring capture implement.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include <pcap/pcap.h>
+
+#include "gcc_common.h"
+#include "dbg_common.h"
+
+#include "netring.h"
+
+#define	_RING_BLOCK(r, i)	\
+	((struct tpacket_block_desc *)((r)->map + (size_t)(i) * (r)->blksize))
+
+/**
+ *	Give the @n blocks before @r->cur back to kernel.
+ *
+ *	No return.
+ */
+static void 
+_netring_release(netring_t *r, u_int32_t n)
+{
+	u_int32_t i;
+	struct tpacket_block_desc *bd;
+
+	if (n == 0)
+		return;
+
+	/* all packets read before block is returned */
+	__sync_synchronize();
+
+	for (i = 0; i < n; i++) {
+		bd = _RING_BLOCK(r, (r->cur + r->nblock - n + i) % r->nblock);
+		bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	}
+
+	r->stat.nrelease++;
+}
+
+/**
+ *	Walk all packets in block @bd and call @cb for each one, or
+ *	call @bcb for every PKT_BATCH packets.
+ *
+ *	Return number of packets walked.
+ */
+static int 
+_netring_walk(netring_t *r, struct tpacket_block_desc *bd,
+	      netring_cb cb, netring_batch_cb bcb, void *arg)
+{
+	int m;
+	u_int32_t i;
+	u_int32_t n;
+	netpkt_t pkt;
+	u_int8_t *data;
+	struct tpacket3_hdr *h;
+	pkt_frame_t frames[PKT_BATCH];
+
+	m = 0;
+	n = bd->hdr.bh1.num_pkts;
+	h = (struct tpacket3_hdr *)((u_int8_t *)bd +
+				    bd->hdr.bh1.offset_to_first_pkt);
+	for (i = 0; i < n; i++) {
+		data = (u_int8_t *)h + h->tp_mac;
+
+		r->stat.npkt++;
+		r->stat.nbyte += h->tp_len;
+
+		/* the frames are passed before block released */
+		if (bcb) {
+			frames[m].data = data;
+			frames[m].caplen = h->tp_snaplen;
+			frames[m].len = h->tp_len;
+			frames[m].ts = (u_int64_t)h->tp_sec * 1000000 + 
+				h->tp_nsec / 1000;
+			if (++m == PKT_BATCH) {
+				bcb(frames, m, arg);
+				m = 0;
+			}
+		}
+		/* the view of ring memory, no copy */
+		else {
+			netpkt_init(&pkt, data, h->tp_snaplen);
+			pkt.tail = pkt.end;
+			pkt.ts = (u_int64_t)h->tp_sec * 1000000 + 
+				h->tp_nsec / 1000;
+			cb(&pkt, arg);
+		}
+
+		h = (struct tpacket3_hdr *)((u_int8_t *)h + h->tp_next_offset);
+	}
+
+	if (m > 0)
+		bcb(frames, m, arg);
+
+	r->stat.nblock++;
+
+	return n;
+}
+
+netring_t * 
+netring_open(const char *intf, u_int32_t blksize, u_int32_t nblock,
+	     int promisc)
+{
+	int ver;
+	int ifindex;
+	netring_t *r;
+	struct tpacket_req3 req;
+	struct sockaddr_ll sll;
+	struct packet_mreq mr;
+
+	if (unlikely(!intf || nblock < 1))
+		ERR_RET(NULL, "invalid argument\n");
+
+	if (blksize < (u_int32_t)getpagesize() ||
+	    blksize % getpagesize())
+		ERR_RET(NULL, "block size %u not times of page size\n",
+			blksize);
+
+	/* "any" is all interfaces */
+	ifindex = 0;
+	if (strcmp(intf, "any")) {
+		ifindex = if_nametoindex(intf);
+		if (ifindex == 0)
+			ERR_RET(NULL, "interface %s not found\n", intf);
+	}
+
+	r = malloc(sizeof(netring_t));
+	if (!r)
+		ERR_RET(NULL, "malloc failed: %s\n", ERRSTR);
+	memset(r, 0, sizeof(*r));
+	r->map = MAP_FAILED;
+	r->blksize = blksize;
+	r->nblock = nblock;
+	r->batch = NETRING_BATCH;
+	if (r->batch > nblock / 2)
+		r->batch = nblock / 2 ? nblock / 2 : 1;
+
+	r->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (r->fd < 0) {
+		ERR("socket failed: %s\n", ERRSTR);
+		goto out_free;
+	}
+
+	ver = TPACKET_V3;
+	if (setsockopt(r->fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver))) {
+		ERR("set TPACKET_V3 failed: %s\n", ERRSTR);
+		goto out_free;
+	}
+
+	/* frame size is not used by V3, but kernel check it */
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = blksize;
+	req.tp_block_nr = nblock;
+	req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+	req.tp_frame_nr = (blksize / req.tp_frame_size) * nblock;
+	req.tp_retire_blk_tov = NETRING_TIMEOUT;
+	req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+	if (setsockopt(r->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))) {
+		ERR("set rx ring failed: %s\n", ERRSTR);
+		goto out_free;
+	}
+
+	r->maplen = (size_t)blksize * nblock;
+	r->map = mmap(NULL, r->maplen, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, r->fd, 0);
+	if (r->map == MAP_FAILED) {
+		ERR("mmap ring failed: %s\n", ERRSTR);
+		goto out_free;
+	}
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = ifindex;
+	if (bind(r->fd, (struct sockaddr *)&sll, sizeof(sll))) {
+		ERR("bind %s failed: %s\n", intf, ERRSTR);
+		goto out_free;
+	}
+
+	if (promisc && ifindex) {
+		memset(&mr, 0, sizeof(mr));
+		mr.mr_ifindex = ifindex;
+		mr.mr_type = PACKET_MR_PROMISC;
+		if (setsockopt(r->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+			       &mr, sizeof(mr)))
+			ERR("set %s promisc failed: %s\n", intf, ERRSTR);
+	}
+
+	return r;
+
+out_free:
+	netring_close(r);
+	return NULL;
+}
+
+void 
+netring_close(netring_t *r)
+{
+	if (unlikely(!r))
+		return;
+
+	if (r->map != MAP_FAILED)
+		munmap(r->map, r->maplen);
+
+	if (r->fd >= 0)
+		close(r->fd);
+
+	free(r);
+}
+
+int 
+netring_fanout(netring_t *r, u_int16_t group)
+{
+	int opt;
+
+	if (unlikely(!r))
+		ERR_RET(-1, "invalid argument\n");
+
+	/* the fragments are defraged before hash */
+	opt = group | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+	if (setsockopt(r->fd, SOL_PACKET, PACKET_FANOUT, &opt, sizeof(opt)))
+		ERR_RET(-1, "join fanout group %u failed: %s\n", group, ERRSTR);
+
+	return 0;
+}
+
+int 
+netring_set_filter(netring_t *r, const char *filter, int snaplen)
+{
+	int ret;
+	pcap_t *pcap;
+	struct bpf_program bpf;
+	struct sock_fprog prog;
+
+	if (unlikely(!r || !filter || snaplen < 1))
+		ERR_RET(-1, "invalid argument\n");
+
+	/* compile filter for ethernet, it return @snaplen */
+	pcap = pcap_open_dead(DLT_EN10MB, snaplen);
+	if (!pcap)
+		ERR_RET(-1, "pcap_open_dead failed\n");
+
+	if (pcap_compile(pcap, &bpf, filter, 1, PCAP_NETMASK_UNKNOWN)) {
+		ERR("compile filter (%s) failed: %s\n",
+		    filter, pcap_geterr(pcap));
+		pcap_close(pcap);
+		return -1;
+	}
+
+	/* struct bpf_insn is same as struct sock_filter */
+	prog.len = bpf.bf_len;
+	prog.filter = (struct sock_filter *)bpf.bf_insns;
+	ret = setsockopt(r->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+			 &prog, sizeof(prog));
+	if (ret)
+		ERR("attach filter (%s) failed: %s\n", filter, ERRSTR);
+
+	pcap_freecode(&bpf);
+	pcap_close(pcap);
+
+	return ret ? -1 : 0;
+}
+
+/**
+ *	Wait ready blocks in ring @r and walk them by @cb or @bcb.
+ *
+ *	Return number of packets walked, -1 on error.
+ */
+static int 
+_netring_dispatch(netring_t *r, int timeout, netring_cb cb,
+		  netring_batch_cb bcb, void *arg)
+{
+	int n;
+	u_int32_t nwalk;
+	struct pollfd pfd;
+	struct tpacket_block_desc *bd;
+
+	bd = _RING_BLOCK(r, r->cur);
+	if (!(bd->hdr.bh1.block_status & TP_STATUS_USER)) {
+		pfd.fd = r->fd;
+		pfd.events = POLLIN | POLLERR;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, timeout) < 0) {
+			if (errno == EINTR)
+				return 0;
+			ERR_RET(-1, "poll failed: %s\n", ERRSTR);
+		}
+	}
+
+	n = 0;
+	nwalk = 0;
+	while (1) {
+		bd = _RING_BLOCK(r, r->cur);
+		if (!(bd->hdr.bh1.block_status & TP_STATUS_USER))
+			break;
+
+		/* block status is read before packets */
+		__sync_synchronize();
+
+		n += _netring_walk(r, bd, cb, bcb, arg);
+		r->cur = (r->cur + 1) % r->nblock;
+		nwalk++;
+
+		if (nwalk == r->batch) {
+			_netring_release(r, nwalk);
+			nwalk = 0;
+		}
+	}
+
+	_netring_release(r, nwalk);
+
+	return n;
+}
+
+int 
+netring_dispatch(netring_t *r, int timeout, netring_cb cb, void *arg)
+{
+	if (unlikely(!r || !cb))
+		ERR_RET(-1, "invalid argument\n");
+
+	return _netring_dispatch(r, timeout, cb, NULL, arg);
+}
+
+int 
+netring_dispatch_batch(netring_t *r, int timeout, netring_batch_cb cb,
+		       void *arg)
+{
+	if (unlikely(!r || !cb))
+		ERR_RET(-1, "invalid argument\n");
+
+	return _netring_dispatch(r, timeout, NULL, cb, arg);
+}
+
+void 
+netring_print(netring_t *r)
+{
+	socklen_t len;
+	struct tpacket_stats_v3 st;
+
+	if (unlikely(!r))
+		return;
+
+	/* the kernel counter is reset after read */
+	len = sizeof(st);
+	if (getsockopt(r->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0) {
+		r->stat.ndrop += st.tp_drops;
+		r->stat.nfreeze += st.tp_freeze_q_cnt;
+	}
+
+	printf("ring %u blocks x %u bytes\n", r->nblock, r->blksize);
+	printf("\tnpkt:     %llu\n", (unsigned long long)r->stat.npkt);
+	printf("\tnbyte:    %llu\n", (unsigned long long)r->stat.nbyte);
+	printf("\tnblock:   %llu\n", (unsigned long long)r->stat.nblock);
+	printf("\tnrelease: %llu\n", (unsigned long long)r->stat.nrelease);
+	printf("\tndrop:    %llu\n", (unsigned long long)r->stat.ndrop);
+	printf("\tnfreeze:  %llu\n", (unsigned long long)r->stat.nfreeze);
+}
+
@@ -0,0 +1,137 @@
+/**
+ *	@file	netring.h
+ *
+ *	@brief	Packet capture using AF_PACKET TPACKET_V3 mmaped ring.
+ *		The kernel fills packets into blocks of ring, the
+ *		packets are walked in place and wrapped as netpkt_t
+ *		without malloc and copy, the walked blocks are given
+ *		back to kernel in batch.
+ *
+ *		The netpkt_t passed to callback is only valid in the
+ *		callback, clone it if need keep the data.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#ifndef FZ_NETRING_H
+#define FZ_NETRING_H
+
+#include <sys/types.h>
+
+#include "netpkt.h"
+#include "packet_batch.h"
+
+#define	NETRING_BLKSIZE		(1 << 20)	/* default block size */
+#define	NETRING_BATCH		8		/* blocks released in batch */
+#define	NETRING_TIMEOUT		10		/* block retire timeout(ms) */
+
+/**
+ *	Ring capture statistic data.
+ */
+typedef struct netring_stat {
+	u_int64_t	npkt;		/* packets walked */
+	u_int64_t	nbyte;		/* bytes walked */
+	u_int64_t	nblock;		/* blocks walked */
+	u_int64_t	nrelease;	/* batch release times */
+	u_int64_t	ndrop;		/* packets dropped by kernel */
+	u_int64_t	nfreeze;	/* ring freeze times by kernel */
+} netring_stat_t;
+
+/**
+ *	The TPACKET_V3 ring object.
+ */
+typedef struct netring {
+	int		fd;		/* AF_PACKET socket */
+	u_int8_t	*map;		/* mmaped ring */
+	size_t		maplen;		/* length of @map */
+	u_int32_t	blksize;	/* block size */
+	u_int32_t	nblock;		/* number of blocks */
+	u_int32_t	cur;		/* next block to walk */
+	u_int32_t	batch;		/* blocks released in batch */
+	netring_stat_t	stat;		/* statistic data */
+} netring_t;
+
+/**
+ *	The callback of netring_dispatch(), @pkt is the view of
+ *	packet data in ring.
+ */
+typedef void (*netring_cb)(netpkt_t *pkt, void *arg);
+
+/**
+ *	The callback of netring_dispatch_batch(), @frames are @n
+ *	packets in ring, at most PKT_BATCH.
+ */
+typedef void (*netring_batch_cb)(const pkt_frame_t *frames, int n, void *arg);
+
+/**
+ *	Open a ring on interface @intf, "any" for all interfaces,
+ *	the ring has @nblock blocks which size is @blksize, @promisc
+ *	set interface into promisc mode.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+extern netring_t * 
+netring_open(const char *intf, u_int32_t blksize, u_int32_t nblock,
+	     int promisc);
+
+/**
+ *	Close the ring @r opened by netring_open().
+ *
+ *	No return.
+ */
+extern void 
+netring_close(netring_t *r);
+
+/**
+ *	Add ring @r into fanout group @group, the packets are
+ *	distributed to the rings in group by flow hash, the two
+ *	directions of a flow go to same ring.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+netring_fanout(netring_t *r, u_int16_t group);
+
+/**
+ *	Set BPF filter @filter on ring @r, the packet is truncated
+ *	to @snaplen bytes by kernel. The empty @filter accept all
+ *	packets.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+netring_set_filter(netring_t *r, const char *filter, int snaplen);
+
+/**
+ *	Wait at most @timeout milliseconds for ready blocks in ring
+ *	@r, call @cb for each packet in ready blocks, the blocks are
+ *	released after every @r->batch blocks walked.
+ *
+ *	Return number of packets walked, -1 on error.
+ */
+extern int 
+netring_dispatch(netring_t *r, int timeout, netring_cb cb, void *arg);
+
+/**
+ *	Same as netring_dispatch(), but call @cb with batch of at
+ *	most PKT_BATCH packets in a block, the frames are valid in
+ *	@cb only.
+ *
+ *	Return number of packets walked, -1 on error.
+ */
+extern int 
+netring_dispatch_batch(netring_t *r, int timeout, netring_batch_cb cb,
+		       void *arg);
+
+/**
+ *	Print the statistic data of ring @r.
+ *
+ *	No return.
+ */
+extern void 
+netring_print(netring_t *r);
+
+#endif /* end of FZ_NETRING_H */
+
@@ -0,0 +1,205 @@
+/**
+ *	@file	packet_batch.c
+ *
+ *	@brief	Batch decode implement.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#include <arpa/inet.h>
+
+#include "gcc_common.h"
+#include "dbg_common.h"
+
+#include "packet_eth.h"
+#include "packet_ipv4.h"
+#include "packet_ipv6.h"
+#include "packet_tcp.h"
+#include "tcp_stream.h"
+#include "packet_batch.h"
+
+/* the min frame of fast path: Ethernet + IPv4 + TCP */
+#define	_FAST_MINLEN	(ETH_HLEN + IPV4_HLEN + sizeof(struct tcphdr))
+
+/* TCP flags are the byte 13 of TCP header */
+#define	_TCP_FLAGS(th)	(((const u_int8_t *)(th))[13])
+
+/**
+ *	Decode the Ethernet(VLAN)/IPv4/TCP frame @f into @d, the
+ *	IPv4 has no option and not a fragment.
+ *
+ *	Return 0 if success, -1 if not the common case.
+ */
+static inline int 
+_pkt_decode_fast(const pkt_frame_t *f, pkt_desc_t *d)
+{
+	u_int32_t off;
+	u_int32_t hlen;
+	u_int32_t iplen;
+	u_int32_t len;
+	u_int16_t type;
+	u_int16_t vlan;
+	const u_int8_t *p;
+	const struct iphdr *ip;
+	const struct tcphdr *th;
+
+	p = f->data;
+	if (unlikely(f->caplen < _FAST_MINLEN))
+		return -1;
+
+	off = ETH_HLEN;
+	vlan = 0;
+	type = (p[12] << 8) | p[13];
+	if (type == ETHERTYPE_VLAN) {
+		if (unlikely(f->caplen < _FAST_MINLEN + 4))
+			return -1;
+		vlan = (p[14] << 8) | p[15];
+		type = (p[16] << 8) | p[17];
+		off += 4;
+	}
+
+	/* IPv4 without option, not fragment, TCP */
+	ip = (const struct iphdr *)(p + off);
+	if (unlikely(type != ETHERTYPE_IP || p[off] != 0x45 ||
+		     (ip->frag_off & htons(IP_MF | IP_OFFMASK)) ||
+		     ip->protocol != IPPROTO_TCP))
+		return -1;
+
+	th = (const struct tcphdr *)(p + off + IPV4_HLEN);
+	hlen = th->doff * 4;
+	iplen = ntohs(ip->tot_len);
+	if (unlikely(hlen < sizeof(struct tcphdr) ||
+		     off + IPV4_HLEN + hlen > f->caplen ||
+		     iplen < IPV4_HLEN + hlen))
+		return -1;
+
+	d->vlan = vlan;
+	d->l3_type = ETHERTYPE_IP;
+	d->l3_off = off;
+	d->l4_off = off + IPV4_HLEN;
+	d->data_off = off + IPV4_HLEN + hlen;
+	d->l4_proto = IPPROTO_TCP;
+
+	/* the ethernet padding is not payload */
+	len = iplen - IPV4_HLEN - hlen;
+	if (len > f->caplen - d->data_off)
+		len = f->caplen - d->data_off;
+	d->data_len = len;
+
+	d->sport = ntohs(th->source);
+	d->dport = ntohs(th->dest);
+	d->seq = ntohl(th->seq);
+	d->ack = ntohl(th->ack_seq);
+	d->tcp_flags = _TCP_FLAGS(th);
+	d->flags = PKT_F_L3 | PKT_F_TCP | PKT_F_FAST |
+		(off > ETH_HLEN ? PKT_F_VLAN : 0);
+
+	return 0;
+}
+
+/**
+ *	Decode other frame @f into @d by netpkt_t decoders.
+ *
+ *	Return 0 if TCP frame, -1 if not.
+ */
+static int 
+_pkt_decode_slow(const pkt_frame_t *f, pkt_desc_t *d)
+{
+	int len;
+	netpkt_t pkt;
+	const u_int8_t *data;
+
+	netpkt_init(&pkt, f->data, f->caplen);
+	pkt.tail = pkt.end;
+
+	if (eth_decode(&pkt))
+		return -1;
+
+	d->l3_off = pkt.hdr2_len;
+	if (pkt.hdr2_len > ETH_HLEN) {
+		d->vlan = (pkt.vlan_pcp << 13) | (pkt.vlan_cfi << 12) |
+			pkt.vlan_vid;
+		d->flags |= PKT_F_VLAN;
+	}
+
+	switch (pkt.hdr3_type) {
+		case ETHERTYPE_IP:
+			if (ipv4_decode(&pkt))
+				return -1;
+			break;
+		case ETHERTYPE_IPV6:
+			if (ipv6_decode(&pkt))
+				return -1;
+			break;
+		default:
+			return -1;
+	}
+
+	d->flags |= PKT_F_L3;
+	d->l3_type = pkt.hdr3_type;
+	d->l4_off = pkt.hdr2_len + pkt.hdr3_len;
+	d->l4_proto = pkt.hdr4_type;
+
+	/* the fragment is decoded after reassembly */
+	if ((pkt.hdr3_type == ETHERTYPE_IP &&
+	     (pkt.hdr3_ipv4->frag_off & htons(IP_MF | IP_OFFMASK))) ||
+	    (pkt.hdr3_type == ETHERTYPE_IPV6 && pkt.frag_off)) {
+		d->flags |= PKT_F_FRAG;
+		return -1;
+	}
+
+	if (pkt.hdr4_type != IPPROTO_TCP || tcp_decode(&pkt))
+		return -1;
+
+	len = tcp_payload(&pkt, &data);
+	d->data_off = NETPKT_HLEN(&pkt);
+	d->data_len = len > 0 ? len : 0;
+	d->sport = ntohs(pkt.hdr4_tcp->source);
+	d->dport = ntohs(pkt.hdr4_tcp->dest);
+	d->seq = ntohl(pkt.hdr4_tcp->seq);
+	d->ack = ntohl(pkt.hdr4_tcp->ack_seq);
+	d->tcp_flags = _TCP_FLAGS(pkt.hdr4_tcp);
+	d->flags |= PKT_F_TCP;
+
+	return 0;
+}
+
+int 
+pkt_decode_batch(const pkt_frame_t *frames, pkt_desc_t *descs, int n)
+{
+	int i;
+	int ntcp;
+	const u_int8_t *next;
+	const pkt_frame_t *f;
+	pkt_desc_t *d;
+
+	if (unlikely(!frames || !descs || n < 1))
+		return 0;
+
+	ntcp = 0;
+	for (i = 0; i < n; i++) {
+		/* the headers are in first 2 cache lines */
+		if (i + PKT_PREFETCH < n) {
+			next = frames[i + PKT_PREFETCH].data;
+			__builtin_prefetch(next);
+			__builtin_prefetch(next + CACHE_LINE_SIZE);
+		}
+
+		f = &frames[i];
+		d = &descs[i];
+		memset(d, 0, sizeof(*d));
+		d->ts = f->ts;
+		d->caplen = f->caplen;
+
+		/* the fast path fill @d only if success */
+		if (likely(_pkt_decode_fast(f, d) == 0))
+			ntcp++;
+		else if (_pkt_decode_slow(f, d) == 0)
+			ntcp++;
+	}
+
+	return ntcp;
+}
+
@@ -0,0 +1,113 @@
+/**
+ *	@file	packet_batch.h
+ *
+ *	@brief	Decode a batch of captured frames into a flat array of
+ *		descriptors. The descriptor is one cache line and keeps
+ *		the header offsets, not pointers, so the array is
+ *		walked without chasing pointers. The Ethernet/VLAN/IPv4
+ *		/TCP frame is decoded by a fast path, others by the
+ *		packet_xxx.c decoders.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#ifndef FZ_PACKET_BATCH_H
+#define FZ_PACKET_BATCH_H
+
+#include <sys/types.h>
+
+#include "gcc_common.h"
+#include "netpkt.h"
+
+#define	PKT_BATCH		32	/* max frames of a batch */
+#define	PKT_PREFETCH		4	/* prefetch frames ahead */
+
+/* descriptor flags */
+#define	PKT_F_L3		0x0001	/* IPv4/IPv6 header decoded */
+#define	PKT_F_TCP		0x0002	/* TCP header decoded */
+#define	PKT_F_FRAG		0x0004	/* IP fragment, need reassembly */
+#define	PKT_F_VLAN		0x0008	/* VLAN tagged */
+#define	PKT_F_FAST		0x0010	/* decoded by fast path */
+
+/**
+ *	The captured frame, @data is owned by capture buffer.
+ */
+typedef struct pkt_frame {
+	const u_int8_t	*data;		/* frame data */
+	u_int32_t	caplen;		/* captured length */
+	u_int32_t	len;		/* length on wire */
+	u_int64_t	ts;		/* capture time(usec) */
+} pkt_frame_t;
+
+/**
+ *	The decoded frame, the offset is from start of frame and the
+ *	numbers are in host order.
+ */
+typedef struct pkt_desc {
+	u_int64_t	ts;		/* capture time(usec) */
+	u_int32_t	caplen;		/* captured length */
+	u_int16_t	flags;		/* PKT_F_XXX */
+	u_int16_t	l3_type;	/* ethernet type of layer 3 */
+	u_int16_t	l3_off;		/* offset of layer 3 header */
+	u_int16_t	l4_off;		/* offset of layer 4 header */
+	u_int16_t	data_off;	/* offset of layer 4 payload */
+	u_int16_t	data_len;	/* captured payload length */
+	u_int16_t	vlan;		/* VLAN TCI */
+	u_int8_t	l4_proto;	/* layer 4 protocol */
+	u_int8_t	tcp_flags;	/* TCP flags */
+	u_int16_t	sport;		/* source port */
+	u_int16_t	dport;		/* destination port */
+	u_int32_t	seq;		/* TCP sequence */
+	u_int32_t	ack;		/* TCP acknowledge */
+} __cacheline_aligned pkt_desc_t;
+
+/**
+ *	Decode @n frames in @frames into @descs, the next frames are
+ *	prefetched while decoding current one.
+ *
+ *	Return number of TCP frames.
+ */
+extern int 
+pkt_decode_batch(const pkt_frame_t *frames, pkt_desc_t *descs, int n);
+
+/**
+ *	Init @pkt as the view of frame @f which decoded into @d, so
+ *	the netpkt_t API can be used on it.
+ *
+ *	No return.
+ */
+static inline void 
+pkt_desc_netpkt(const pkt_desc_t *d, const pkt_frame_t *f, netpkt_t *pkt)
+{
+	u_int8_t *data;
+
+	data = (u_int8_t *)f->data;
+	netpkt_init(pkt, data, f->caplen);
+	pkt->tail = pkt->end;
+	pkt->ts = d->ts;
+
+	pkt->eth = (struct ether_header *)data;
+	pkt->hdr2_len = d->l3_off;
+	pkt->vlan_pcp = (d->vlan >> 13) & 0x7;
+	pkt->vlan_cfi = (d->vlan >> 12) & 0x1;
+	pkt->vlan_vid = d->vlan & 0xfff;
+
+	if (!(d->flags & PKT_F_L3))
+		return;
+
+	pkt->hdr3_type = d->l3_type;
+	pkt->hdr3_ipv4 = (struct iphdr *)(data + d->l3_off);
+	pkt->hdr3_len = d->l4_off - d->l3_off;
+	pkt->hdr4_type = d->l4_proto;
+
+	if (!(d->flags & PKT_F_TCP))
+		return;
+
+	pkt->hdr4_tcp = (struct tcphdr *)(data + d->l4_off);
+	pkt->hdr4_len = d->data_off - d->l4_off;
+}
+
+#endif /* end of FZ_PACKET_BATCH_H */
+
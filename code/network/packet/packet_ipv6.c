@@ -23,6 +23,7 @@ ipv6_decode(netpkt_t *pkt)
 	int m;
 	u_int8_t nexthdr;
 	struct ip6_ext *ext;
+	struct ip6_frag *frag;
 
 	if (unlikely(!pkt))
 		ERR_RET(-1, "invalid argument\n");
@@ -46,18 +47,24 @@ ipv6_decode(netpkt_t *pkt)
 	n = pkt->hdr2_len + pkt->hdr3_len;
 	nexthdr = pkt->hdr3_ipv6->ip6_nxt;
 	while (IP6HDR_IS_EXT(nexthdr)) {
+		if ((pkt->tail - pkt->head) < (n + m + 8))
+			ERR_RET(-1, "invalid IPv6 extension header\n");
+
+		/* @nexthdr is type of current header */
 		ext = (struct ip6_ext *)(pkt->head + n + m);
-		nexthdr = ext->ip6e_nxt;
 
 		/* fragment */
 		if (nexthdr == IPPROTO_FRAGMENT) {
-			pkt->frag_id  = ntohl(*(u_int32_t *)(pkt->head + n + 4));
-			pkt->frag_off = ntohs(*(u_int16_t *)(pkt->head + n + 2));
+			frag = (struct ip6_frag *)ext;
+			pkt->frag_id  = ntohl(frag->ip6f_ident);
+			pkt->frag_off = ntohs(frag->ip6f_offlg);
 			m += 8;
 		}
 		else {
 			m += (8 + (ext->ip6e_len << 3));
 		}
+
+		nexthdr = ext->ip6e_nxt;
 	}
 
 	pkt->hdr3_len += m;
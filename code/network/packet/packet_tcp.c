@@ -28,9 +28,14 @@ tcp_decode(netpkt_t *pkt)
 		ERR_RET(-1, "no data in packet\n");
 
 	n = pkt->hdr2_len + pkt->hdr3_len;
+	if ((pkt->tail - pkt->head) < (n + sizeof(struct tcphdr)))
+		ERR_RET(-1, "invalid TCP header\n");
+
 	pkt->hdr4_tcp = (struct tcphdr *)(pkt->head + n);
 	
 	pkt->hdr4_len = (size_t)pkt->hdr4_tcp->doff * 4;
+	if ((pkt->tail - pkt->head) < (n + pkt->hdr4_len))
+		ERR_RET(-1, "invalid TCP header length\n");
 
 	return 0;
 }
@@ -0,0 +1,388 @@
+/**
+ *	@file	pcap_file.c
+ *
+ *	@brief	pcap/pcapng file reader implement.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <byteswap.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gcc_common.h"
+#include "dbg_common.h"
+
+#include "pcap_file.h"
+
+#define	_PCAP_MAGIC		0xa1b2c3d4	/* usec timestamp */
+#define	_PCAP_MAGIC_NS		0xa1b23c4d	/* nsec timestamp */
+#define	_PCAP_FHDR_LEN		24		/* file header length */
+#define	_PCAP_RHDR_LEN		16		/* record header length */
+
+#define	_PCAPNG_SHB		0x0a0d0d0a	/* section header block */
+#define	_PCAPNG_IDB		0x00000001	/* interface description */
+#define	_PCAPNG_SPB		0x00000003	/* simple packet block */
+#define	_PCAPNG_EPB		0x00000006	/* enhanced packet block */
+#define	_PCAPNG_BOM		0x1a2b3c4d	/* byte order magic */
+#define	_PCAPNG_OPT_TSRESOL	9		/* if_tsresol option */
+
+#define	_LINKTYPE_ETHERNET	1		/* DLT_EN10MB */
+#define	_MAXCAPLEN		262144		/* max record length */
+
+/**
+ *	The interface of pcapng section.
+ */
+typedef struct _pcapng_if {
+	u_int16_t	linktype;	/* link type */
+	u_int8_t	tsresol;	/* if_tsresol, 6 is usec */
+} _pcapng_if_t;
+
+/**
+ *	Get 16/32 bits number at @p, @swap is file byte order is
+ *	not host order.
+ *
+ *	Return the number.
+ */
+static inline u_int16_t 
+_pf_get16(const u_int8_t *p, int swap)
+{
+	u_int16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return swap ? bswap_16(v) : v;
+}
+
+static inline u_int32_t 
+_pf_get32(const u_int8_t *p, int swap)
+{
+	u_int32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return swap ? bswap_32(v) : v;
+}
+
+/**
+ *	Convert pcapng timestamp @ts to usec by if_tsresol @resol,
+ *	the high bit set is power of 2, else power of 10.
+ *
+ *	Return the usec.
+ */
+static u_int64_t 
+_pf_ts_usec(u_int64_t ts, u_int8_t resol)
+{
+	u_int8_t n;
+
+	if (resol & 0x80)
+		return (u_int64_t)((double)ts * 1000000 /
+				   (double)(1ULL << (resol & 0x3f)));
+
+	for (n = resol; n > 6; n--)
+		ts /= 10;
+	for (n = resol; n < 6; n++)
+		ts *= 10;
+
+	return ts;
+}
+
+/**
+ *	Append the frame @data into @pf, the array is doubled when
+ *	it's full.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_pf_add(pcap_file_t *pf, u_int32_t *size, const u_int8_t *data,
+	u_int32_t caplen, u_int32_t len, u_int64_t ts)
+{
+	u_int32_t n;
+	pkt_frame_t *frames;
+	pkt_frame_t *f;
+
+	if (pf->nframe == *size) {
+		n = *size ? *size * 2 : 4096;
+		frames = realloc(pf->frames, n * sizeof(pkt_frame_t));
+		if (!frames)
+			ERR_RET(-1, "realloc frames failed: %s\n", ERRSTR);
+		pf->frames = frames;
+		*size = n;
+	}
+
+	if (pf->nframe == 0)
+		pf->first = ts;
+	pf->last = ts;
+	pf->nbyte += len;
+
+	f = &pf->frames[pf->nframe++];
+	f->data = data;
+	f->caplen = caplen;
+	f->len = len;
+	f->ts = ts;
+
+	return 0;
+}
+
+/**
+ *	Index all records of classic pcap file @pf.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_pf_index_pcap(pcap_file_t *pf)
+{
+	int ns;
+	int swap;
+	u_int32_t magic;
+	u_int32_t size;
+	u_int32_t caplen;
+	u_int32_t len;
+	u_int32_t link;
+	u_int64_t ts;
+	const u_int8_t *p;
+	const u_int8_t *end;
+
+	memcpy(&magic, pf->map, sizeof(magic));
+	swap = (magic == bswap_32(_PCAP_MAGIC) ||
+		magic == bswap_32(_PCAP_MAGIC_NS));
+	magic = swap ? bswap_32(magic) : magic;
+	ns = (magic == _PCAP_MAGIC_NS);
+
+	link = _pf_get32(pf->map + 20, swap);
+	if (link != _LINKTYPE_ETHERNET)
+		ERR_RET(-1, "link type %u is not Ethernet\n", link);
+
+	size = 0;
+	p = pf->map + _PCAP_FHDR_LEN;
+	end = pf->map + pf->size;
+	while (p + _PCAP_RHDR_LEN <= end) {
+		caplen = _pf_get32(p + 8, swap);
+		len = _pf_get32(p + 12, swap);
+		if (caplen > _MAXCAPLEN || p + _PCAP_RHDR_LEN + caplen > end) {
+			pf->nskip++;
+			break;
+		}
+
+		ts = (u_int64_t)_pf_get32(p, swap) * 1000000;
+		ts += ns ? _pf_get32(p + 4, swap) / 1000 :
+			_pf_get32(p + 4, swap);
+
+		if (_pf_add(pf, &size, p + _PCAP_RHDR_LEN, caplen, len, ts))
+			return -1;
+
+		p += _PCAP_RHDR_LEN + caplen;
+	}
+
+	return 0;
+}
+
+/**
+ *	Parse the options of IDB @opt which length is @len, only
+ *	if_tsresol is used.
+ *
+ *	No return.
+ */
+static void 
+_pf_parse_idb(const u_int8_t *opt, u_int32_t len, int swap,
+	      _pcapng_if_t *ifp)
+{
+	u_int16_t code;
+	u_int16_t olen;
+	const u_int8_t *end;
+
+	end = opt + len;
+	while (opt + 4 <= end) {
+		code = _pf_get16(opt, swap);
+		olen = _pf_get16(opt + 2, swap);
+		if (code == 0 || opt + 4 + olen > end)
+			break;
+		if (code == _PCAPNG_OPT_TSRESOL && olen >= 1)
+			ifp->tsresol = opt[4];
+		opt += 4 + ((olen + 3) & ~3);
+	}
+}
+
+/**
+ *	Index all packet blocks of pcapng file @pf, the interfaces
+ *	are reset by each section.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_pf_index_pcapng(pcap_file_t *pf)
+{
+	int swap;
+	u_int32_t type;
+	u_int32_t blen;
+	u_int32_t bom;
+	u_int32_t ifid;
+	u_int32_t nif;
+	u_int32_t size;
+	u_int32_t caplen;
+	u_int32_t len;
+	u_int64_t ts;
+	u_int64_t last;
+	const u_int8_t *p;
+	const u_int8_t *end;
+	_pcapng_if_t ifs[PCAP_FILE_MAXIF];
+
+	swap = 0;
+	nif = 0;
+	size = 0;
+	last = 0;
+	p = pf->map;
+	end = pf->map + pf->size;
+	while (p + 12 <= end) {
+		type = _pf_get32(p, swap);
+
+		/* the byte order is decided by each section */
+		if (type == _PCAPNG_SHB) {
+			memcpy(&bom, p + 8, sizeof(bom));
+			if (bom != _PCAPNG_BOM && bom != bswap_32(_PCAPNG_BOM))
+				ERR_RET(-1, "invalid byte order magic\n");
+			swap = (bom != _PCAPNG_BOM);
+			nif = 0;
+		}
+
+		blen = _pf_get32(p + 4, swap);
+		if (blen < 12 || (blen & 3) || p + blen > end) {
+			pf->nskip++;
+			break;
+		}
+
+		switch (type) {
+			case _PCAPNG_IDB:
+				if (nif >= PCAP_FILE_MAXIF || blen < 20)
+					ERR_RET(-1, "invalid IDB block\n");
+				ifs[nif].linktype = _pf_get16(p + 8, swap);
+				ifs[nif].tsresol = 6;
+				_pf_parse_idb(p + 16, blen - 20, swap,
+					      &ifs[nif]);
+				nif++;
+				break;
+
+			case _PCAPNG_EPB:
+				if (blen < 32) {
+					pf->nskip++;
+					break;
+				}
+				ifid = _pf_get32(p + 8, swap);
+				caplen = _pf_get32(p + 20, swap);
+				len = _pf_get32(p + 24, swap);
+				if (ifid >= nif || caplen > blen - 32 ||
+				    ifs[ifid].linktype != _LINKTYPE_ETHERNET) {
+					pf->nskip++;
+					break;
+				}
+				ts = (u_int64_t)_pf_get32(p + 12, swap) << 32;
+				ts |= _pf_get32(p + 16, swap);
+				last = _pf_ts_usec(ts, ifs[ifid].tsresol);
+				if (_pf_add(pf, &size, p + 28, caplen, len,
+					    last))
+					return -1;
+				break;
+
+			/* no timestamp, use time of previous packet */
+			case _PCAPNG_SPB:
+				if (blen < 16 || nif < 1 ||
+				    ifs[0].linktype != _LINKTYPE_ETHERNET) {
+					pf->nskip++;
+					break;
+				}
+				len = _pf_get32(p + 8, swap);
+				caplen = len < blen - 16 ? len : blen - 16;
+				if (_pf_add(pf, &size, p + 12, caplen, len,
+					    last))
+					return -1;
+				break;
+
+			default:
+				break;
+		}
+
+		p += blen;
+	}
+
+	return 0;
+}
+
+pcap_file_t * 
+pcap_file_open(const char *file)
+{
+	int ret;
+	u_int32_t magic;
+	struct stat st;
+	pcap_file_t *pf;
+
+	if (unlikely(!file))
+		ERR_RET(NULL, "invalid argument\n");
+
+	pf = calloc(1, sizeof(pcap_file_t));
+	if (!pf)
+		ERR_RET(NULL, "calloc pcap file failed: %s\n", ERRSTR);
+	pf->map = MAP_FAILED;
+
+	pf->fd = open(file, O_RDONLY);
+	if (pf->fd < 0) {
+		ERR("open %s failed: %s\n", file, ERRSTR);
+		goto failed;
+	}
+
+	if (fstat(pf->fd, &st) || st.st_size < _PCAP_FHDR_LEN) {
+		ERR("file %s is too small\n", file);
+		goto failed;
+	}
+	pf->size = st.st_size;
+
+	pf->map = mmap(NULL, pf->size, PROT_READ, MAP_PRIVATE, pf->fd, 0);
+	if (pf->map == MAP_FAILED) {
+		ERR("mmap %s failed: %s\n", file, ERRSTR);
+		goto failed;
+	}
+	madvise(pf->map, pf->size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+	memcpy(&magic, pf->map, sizeof(magic));
+	if (magic == _PCAPNG_SHB) {
+		pf->ng = 1;
+		ret = _pf_index_pcapng(pf);
+	}
+	else if (magic == _PCAP_MAGIC || magic == _PCAP_MAGIC_NS ||
+		 magic == bswap_32(_PCAP_MAGIC) ||
+		 magic == bswap_32(_PCAP_MAGIC_NS))
+		ret = _pf_index_pcap(pf);
+	else {
+		ERR("file %s is not pcap/pcapng\n", file);
+		goto failed;
+	}
+
+	if (ret)
+		goto failed;
+
+	return pf;
+
+failed:
+	pcap_file_close(pf);
+	return NULL;
+}
+
+void 
+pcap_file_close(pcap_file_t *pf)
+{
+	if (unlikely(!pf))
+		return;
+
+	if (pf->map != MAP_FAILED)
+		munmap(pf->map, pf->size);
+	if (pf->fd >= 0)
+		close(pf->fd);
+	if (pf->frames)
+		free(pf->frames);
+
+	free(pf);
+}
+
@@ -0,0 +1,58 @@
+/**
+ *	@file	pcap_file.h
+ *
+ *	@brief	Read pcap/pcapng file without libpcap. The file is
+ *		mmaped and all records are indexed into an array of
+ *		pkt_frame_t when opened, the frame data point to the
+ *		mapping, so the packets can be replayed many times
+ *		without I/O and copy. Only Ethernet link is indexed.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#ifndef FZ_PCAP_FILE_H
+#define FZ_PCAP_FILE_H
+
+#include <sys/types.h>
+
+#include "packet_batch.h"
+
+#define	PCAP_FILE_MAXIF		64	/* max interfaces of pcapng */
+
+/**
+ *	The mmaped pcap/pcapng file.
+ */
+typedef struct pcap_file {
+	int		fd;		/* file descriptor */
+	u_int8_t	*map;		/* mmaped file */
+	size_t		size;		/* file size */
+	int		ng;		/* it's pcapng file */
+	pkt_frame_t	*frames;	/* indexed records */
+	u_int32_t	nframe;		/* number of @frames */
+	u_int32_t	nskip;		/* records not Ethernet or invalid */
+	u_int64_t	nbyte;		/* bytes on wire of @frames */
+	u_int64_t	first;		/* time of first frame(usec) */
+	u_int64_t	last;		/* time of last frame(usec) */
+} pcap_file_t;
+
+/**
+ *	Open pcap/pcapng file @file and index all records.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+extern pcap_file_t * 
+pcap_file_open(const char *file);
+
+/**
+ *	Close file @pf opened by pcap_file_open(), the frames are
+ *	invalid after it.
+ *
+ *	No return.
+ */
+extern void 
+pcap_file_close(pcap_file_t *pf);
+
+#endif /* end of FZ_PCAP_FILE_H */
+
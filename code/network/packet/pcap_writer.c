@@ -0,0 +1,568 @@
+/**
+ *	@file	pcap_writer.c
+ *
+ *	@brief	pcap file writer implement.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#ifndef _GNU_SOURCE
+#define	_GNU_SOURCE			/* O_DIRECT, fallocate() */
+#endif
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+
+#include "gcc_common.h"
+#include "dbg_common.h"
+
+#include "pcap_writer.h"
+
+#define	_PCAP_MAGIC		0xa1b2c3d4	/* usec timestamp */
+#define	_PCAP_FHDR_LEN		24		/* file header length */
+#define	_PCAP_RHDR_LEN		16		/* record header length */
+#define	_LINKTYPE_ETHERNET	1		/* DLT_EN10MB */
+
+/**
+ *	The pcap file header.
+ */
+typedef struct _pcap_fhdr {
+	u_int32_t	magic;		/* magic number */
+	u_int16_t	major;		/* major version */
+	u_int16_t	minor;		/* minor version */
+	int32_t		zone;		/* GMT offset */
+	u_int32_t	sigfigs;	/* accuracy of time */
+	u_int32_t	snaplen;	/* max record length */
+	u_int32_t	linktype;	/* link type */
+} _pcap_fhdr_t;
+
+/**
+ *	The pcap record header.
+ */
+typedef struct _pcap_rhdr {
+	u_int32_t	sec;		/* time(second) */
+	u_int32_t	usec;		/* time(microsecond) */
+	u_int32_t	caplen;		/* length in file */
+	u_int32_t	len;		/* length on wire */
+} _pcap_rhdr_t;
+
+/**
+ *	Get monotonic time.
+ *
+ *	Return the nanoseconds.
+ */
+static inline u_int64_t 
+_pw_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ *	Get file name of index @index into @buf.
+ *
+ *	No return.
+ */
+static void 
+_pw_name(const pcap_writer_t *w, u_int32_t index, char *buf, size_t len)
+{
+	if (w->maxsize || w->maxtime)
+		snprintf(buf, len, "%s.%u", w->name, index);
+	else
+		snprintf(buf, len, "%s", w->name);
+}
+
+/**
+ *	Create file of index @index, it's opened by O_DIRECT if the
+ *	file system support it. The rotated file is preallocated.
+ *
+ *	Return the fd if success, -1 on error.
+ */
+static int 
+_pw_create(pcap_writer_t *w, u_int32_t index, int *direct)
+{
+	int fd;
+	u_int64_t size;
+	char name[PATH_MAX + 16];
+
+	_pw_name(w, index, name, sizeof(name));
+
+	*direct = 1;
+	fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	if (fd < 0 && errno == EINVAL) {
+		*direct = 0;
+		fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if (fd < 0)
+		ERR_RET(-1, "open %s failed: %s\n", name, ERRSTR);
+
+	/* no extent allocation when writing, it's truncated at close */
+	if (w->maxsize || w->maxtime) {
+		size = w->maxsize ? w->maxsize : PCAP_WRITER_PREALLOC;
+		if (fallocate(fd, 0, 0, size) == 0)
+			w->stat.nprealloc++;
+	}
+
+	return fd;
+}
+
+/**
+ *	Close current file of writer thread, the padding of last
+ *	O_DIRECT write and preallocated space are truncated.
+ *
+ *	No return.
+ */
+static void 
+_pw_close_file(pcap_writer_t *w)
+{
+	if (w->fd < 0)
+		return;
+
+	if (ftruncate(w->fd, w->off))
+		ERR("truncate file %u failed: %s\n", w->windex, ERRSTR);
+	close(w->fd);
+	w->fd = -1;
+}
+
+/**
+ *	Switch writer thread to file @index, the preallocated next
+ *	file is used if it's ready, then the file after it is
+ *	preallocated.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_pw_switch(pcap_writer_t *w, u_int32_t index)
+{
+	_pw_close_file(w);
+
+	if (w->nfd >= 0 && w->windex + 1 == index) {
+		w->fd = w->nfd;
+		w->direct = w->ndirect;
+		w->nfd = -1;
+	}
+	else {
+		if (w->nfd >= 0) {
+			close(w->nfd);
+			w->nfd = -1;
+		}
+		w->fd = _pw_create(w, index, &w->direct);
+		if (w->fd < 0)
+			return -1;
+	}
+
+	w->windex = index;
+	w->off = 0;
+	w->stat.nfile++;
+
+	if (w->maxsize || w->maxtime)
+		w->nfd = _pw_create(w, index + 1, &w->ndirect);
+
+	return 0;
+}
+
+/**
+ *	Write buffer @b into current file. The O_DIRECT write is
+ *	padded to alignment, only the last buffer of file is not
+ *	full, so the padding is truncated when file is closed.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_pw_write_buf(pcap_writer_t *w, pcap_wbuf_t *b)
+{
+	size_t len;
+	size_t done;
+	ssize_t n;
+	u_int64_t t0;
+	u_int64_t ns;
+
+	if (w->fd < 0) {
+		w->stat.nerror++;
+		return -1;
+	}
+
+	len = b->len;
+	if (w->direct && (len % PCAP_WRITER_ALIGN)) {
+		len = (len + PCAP_WRITER_ALIGN - 1) & ~(PCAP_WRITER_ALIGN - 1);
+		memset(b->data + b->len, 0, len - b->len);
+	}
+
+	t0 = _pw_now_ns();
+	done = 0;
+	while (done < len) {
+		n = pwrite(w->fd, b->data + done, len - done, w->off + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			w->stat.nerror++;
+			ERR_RET(-1, "write file %u failed: %s\n", w->windex,
+				ERRSTR);
+		}
+		done += n;
+	}
+	ns = _pw_now_ns() - t0;
+
+	w->off += b->len;
+	w->stat.nwrite++;
+	w->stat.nwbyte += b->len;
+	w->stat.wns += ns;
+	if (ns > w->stat.maxwns)
+		w->stat.maxwns = ns;
+
+	return 0;
+}
+
+/**
+ *	The writer thread of @arg, it write full buffers into file
+ *	and return them to free ring.
+ *
+ *	Return NULL always.
+ */
+static void * 
+_pw_thread(void *arg)
+{
+	pcap_wbuf_t *b;
+	pcap_writer_t *w = arg;
+
+	while (1) {
+		if (spsc_ring_dequeue(w->full, &b, 1) == 0) {
+			if (__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE) &&
+			    spsc_ring_count(w->full) == 0)
+				break;
+			spsc_ring_wait(w->full, 100);
+			continue;
+		}
+
+		if (b->flags & PCAP_WBUF_NEWFILE)
+			_pw_switch(w, b->index);
+
+		_pw_write_buf(w, b);
+
+		b->len = 0;
+		b->flags = 0;
+		while (spsc_ring_enqueue(w->free, &b, 1) == 0)
+			sched_yield();
+	}
+
+	_pw_close_file(w);
+
+	/* the preallocated file is not used */
+	if (w->nfd >= 0) {
+		char name[PATH_MAX + 16];
+
+		close(w->nfd);
+		w->nfd = -1;
+		_pw_name(w, w->windex + 1, name, sizeof(name));
+		unlink(name);
+	}
+
+	return NULL;
+}
+
+/**
+ *	Get a free buffer for capture thread, it wait writer thread
+ *	if @w is blocked.
+ *
+ *	Return the buffer if success, NULL if no free buffer.
+ */
+static pcap_wbuf_t * 
+_pw_get(pcap_writer_t *w)
+{
+	pcap_wbuf_t *b;
+
+	if (likely(spsc_ring_dequeue(w->free, &b, 1) == 1))
+		return b;
+
+	w->stat.nstall++;
+	if (!w->block)
+		return NULL;
+
+	while (spsc_ring_dequeue(w->free, &b, 1) == 0) {
+		spsc_ring_notify(w->full);
+		sched_yield();
+	}
+
+	return b;
+}
+
+/**
+ *	Pass buffer @b to writer thread.
+ *
+ *	No return.
+ */
+static void 
+_pw_put(pcap_writer_t *w, pcap_wbuf_t *b)
+{
+	u_int32_t n;
+
+	/* the full ring has slots for all buffers */
+	spsc_ring_enqueue(w->full, &b, 1);
+	spsc_ring_notify(w->full);
+
+	n = spsc_ring_count(w->full);
+	if (n > w->stat.maxqueue)
+		w->stat.maxqueue = n;
+}
+
+/**
+ *	Start a new file in buffer @b, the file header is written
+ *	at head of it.
+ *
+ *	No return.
+ */
+static void 
+_pw_new_file(pcap_writer_t *w, pcap_wbuf_t *b, u_int64_t ts)
+{
+	_pcap_fhdr_t *h;
+
+	h = (_pcap_fhdr_t *)(b->data + b->len);
+	h->magic = _PCAP_MAGIC;
+	h->major = 2;
+	h->minor = 4;
+	h->zone = 0;
+	h->sigfigs = 0;
+	h->snaplen = PCAP_WRITER_SNAPLEN;
+	h->linktype = _LINKTYPE_ETHERNET;
+
+	b->len += _PCAP_FHDR_LEN;
+	b->flags |= PCAP_WBUF_NEWFILE;
+	b->index = w->findex;
+	w->fsize = _PCAP_FHDR_LEN;
+	w->fstart = ts;
+}
+
+/**
+ *	Copy @len bytes @data into current buffer, the full buffer
+ *	is passed to writer thread and the reserved one is used.
+ *
+ *	No return.
+ */
+static void 
+_pw_copy(pcap_writer_t *w, const void *data, u_int32_t len)
+{
+	u_int32_t n;
+	pcap_wbuf_t *b;
+
+	while (len > 0) {
+		b = w->cur;
+		n = PCAP_WRITER_BUFSIZE - b->len;
+		if (n > len)
+			n = len;
+		memcpy(b->data + b->len, data, n);
+		b->len += n;
+		data = (const u_int8_t *)data + n;
+		len -= n;
+
+		if (b->len == PCAP_WRITER_BUFSIZE) {
+			_pw_put(w, b);
+			w->cur = w->next;
+			w->next = NULL;
+			w->cur->index = w->findex;
+		}
+	}
+}
+
+pcap_writer_t * 
+pcap_writer_open(const char *name, u_int64_t maxsize, u_int32_t maxtime,
+		 int block)
+{
+	int i;
+	pcap_wbuf_t *b;
+	pcap_writer_t *w;
+
+	if (unlikely(!name || !name[0]))
+		ERR_RET(NULL, "invalid argument\n");
+
+	w = calloc(1, sizeof(pcap_writer_t));
+	if (!w)
+		ERR_RET(NULL, "calloc writer failed: %s\n", ERRSTR);
+
+	strncpy(w->name, name, sizeof(w->name) - 1);
+	w->fd = -1;
+	w->nfd = -1;
+	w->maxsize = maxsize;
+	w->maxtime = (u_int64_t)maxtime * 1000000;
+	w->block = block;
+
+	/* the last write of file may be padded, so one more block */
+	if (posix_memalign((void **)&w->mem, PCAP_WRITER_ALIGN,
+			   (size_t)PCAP_WRITER_NBUF *
+			   (PCAP_WRITER_BUFSIZE + PCAP_WRITER_ALIGN))) {
+		ERR("alloc write buffers failed\n");
+		goto failed;
+	}
+
+	w->free = spsc_ring_alloc(PCAP_WRITER_NBUF, sizeof(pcap_wbuf_t *), 0);
+	w->full = spsc_ring_alloc(PCAP_WRITER_NBUF, sizeof(pcap_wbuf_t *), 1);
+	if (!w->free || !w->full) {
+		ERR("alloc buffer ring failed\n");
+		goto failed;
+	}
+
+	for (i = 0; i < PCAP_WRITER_NBUF; i++) {
+		b = &w->bufs[i];
+		b->data = w->mem + (size_t)i *
+			(PCAP_WRITER_BUFSIZE + PCAP_WRITER_ALIGN);
+		spsc_ring_enqueue(w->free, &b, 1);
+	}
+
+	if (pthread_create(&w->tid, NULL, _pw_thread, w)) {
+		ERR("create writer thread failed\n");
+		goto failed;
+	}
+	w->running = 1;
+
+	return w;
+
+failed:
+	pcap_writer_close(w);
+	return NULL;
+}
+
+int 
+pcap_writer_write(pcap_writer_t *w, const pkt_frame_t *f, u_int32_t snap)
+{
+	u_int32_t caplen;
+	u_int32_t rlen;
+	pcap_wbuf_t *b;
+	_pcap_rhdr_t h;
+
+	if (unlikely(!w || !f))
+		return -1;
+
+	caplen = f->caplen;
+	if (caplen > snap) {
+		caplen = snap;
+		w->stat.ntrunc++;
+	}
+	if (caplen > PCAP_WRITER_SNAPLEN)
+		caplen = PCAP_WRITER_SNAPLEN;
+	rlen = _PCAP_RHDR_LEN + caplen;
+
+	/* rotate by size or time, the new file start in new buffer */
+	if (w->cur && w->fsize > _PCAP_FHDR_LEN &&
+	    ((w->maxsize && w->fsize + rlen > w->maxsize) ||
+	     (w->maxtime && f->ts >= w->fstart + w->maxtime))) {
+		b = w->next ? w->next : _pw_get(w);
+		if (!b) {
+			w->stat.ndrop++;
+			return -1;
+		}
+		w->next = NULL;
+		_pw_put(w, w->cur);
+		w->cur = b;
+		w->findex++;
+		_pw_new_file(w, b, f->ts);
+	}
+
+	if (unlikely(!w->cur)) {
+		w->cur = _pw_get(w);
+		if (!w->cur) {
+			w->stat.ndrop++;
+			return -1;
+		}
+		_pw_new_file(w, w->cur, f->ts);
+	}
+
+	/* the record span buffers, reserve next one before copy */
+	if (w->cur->len + rlen >= PCAP_WRITER_BUFSIZE && !w->next) {
+		w->next = _pw_get(w);
+		if (!w->next) {
+			w->stat.ndrop++;
+			return -1;
+		}
+	}
+
+	h.sec = f->ts / 1000000;
+	h.usec = f->ts % 1000000;
+	h.caplen = caplen;
+	h.len = f->len > caplen ? f->len : caplen;
+
+	_pw_copy(w, &h, sizeof(h));
+	_pw_copy(w, f->data, caplen);
+
+	w->fsize += rlen;
+	w->stat.npkt++;
+	w->stat.nbyte += rlen;
+
+	return 0;
+}
+
+void 
+pcap_writer_stop(pcap_writer_t *w)
+{
+	if (unlikely(!w) || !w->running)
+		return;
+
+	if (w->cur && w->cur->len > 0)
+		_pw_put(w, w->cur);
+	w->cur = NULL;
+
+	__atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+	spsc_ring_notify(w->full);
+	pthread_join(w->tid, NULL);
+	w->running = 0;
+}
+
+void 
+pcap_writer_close(pcap_writer_t *w)
+{
+	if (unlikely(!w))
+		return;
+
+	pcap_writer_stop(w);
+
+	if (w->free)
+		spsc_ring_free(w->free);
+	if (w->full)
+		spsc_ring_free(w->full);
+	if (w->mem)
+		free(w->mem);
+
+	free(w);
+}
+
+void 
+pcap_writer_print(const pcap_writer_t *w, const char *prefix)
+{
+	const pcap_writer_stat_t *s;
+
+	if (unlikely(!w || !prefix))
+		return;
+
+	s = &w->stat;
+	printf("%spcap writer %s:\n", prefix, w->name);
+	printf("%s\tnpkt:        %llu\n", prefix, (unsigned long long)s->npkt);
+	printf("%s\tnbyte:       %llu\n", prefix, (unsigned long long)s->nbyte);
+	printf("%s\tntrunc:      %llu\n", prefix,
+	       (unsigned long long)s->ntrunc);
+	printf("%s\tndrop:       %llu\n", prefix, (unsigned long long)s->ndrop);
+	printf("%s\tnstall:      %llu\n", prefix,
+	       (unsigned long long)s->nstall);
+	printf("%s\tmaxqueue:    %u/%d\n", prefix, s->maxqueue,
+	       PCAP_WRITER_NBUF);
+	printf("%s\tnfile:       %llu\n", prefix, (unsigned long long)s->nfile);
+	printf("%s\tnprealloc:   %llu\n", prefix,
+	       (unsigned long long)s->nprealloc);
+	printf("%s\tnwrite:      %llu\n", prefix,
+	       (unsigned long long)s->nwrite);
+	printf("%s\tnwbyte:      %llu\n", prefix,
+	       (unsigned long long)s->nwbyte);
+	printf("%s\tnerror:      %llu\n", prefix,
+	       (unsigned long long)s->nerror);
+	printf("%s\twrite:       %.1f MB/s, max %.3f ms\n", prefix,
+	       s->wns ? (double)s->nwbyte * 1000 / s->wns : 0.0,
+	       (double)s->maxwns / 1000000);
+}
+
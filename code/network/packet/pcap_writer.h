@@ -0,0 +1,157 @@
+/**
+ *	@file	pcap_writer.h
+ *
+ *	@brief	Write captured frames into pcap files without libpcap.
+ *		The capture thread only copies records into large
+ *		aligned buffers, the full buffers are passed to a
+ *		writer thread by SPSC ring and written by O_DIRECT,
+ *		so the capture thread never does disk I/O. The files
+ *		are rotated by size or packet time, the next file is
+ *		created and preallocated before it's needed. When
+ *		the disk falls behind, the capture thread waits free
+ *		buffer or drops packet, both are counted.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#ifndef FZ_PCAP_WRITER_H
+#define FZ_PCAP_WRITER_H
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <limits.h>
+
+#include "gcc_common.h"
+#include "spsc_ring.h"
+#include "packet_batch.h"
+
+#define	PCAP_WRITER_BUFSIZE	(4 << 20)	/* size of write buffer */
+#define	PCAP_WRITER_NBUF	16		/* number of write buffers */
+#define	PCAP_WRITER_ALIGN	4096		/* O_DIRECT alignment */
+#define	PCAP_WRITER_PREALLOC	(256 << 20)	/* preallocated if no size */
+#define	PCAP_WRITER_SNAPLEN	262144		/* snaplen of file header */
+
+/* buffer flags */
+#define	PCAP_WBUF_NEWFILE	0x1		/* first buffer of file */
+
+/**
+ *	The write buffer, it's owned by capture thread when it's in
+ *	free ring, by writer thread when it's in full ring.
+ */
+typedef struct pcap_wbuf {
+	u_int8_t	*data;		/* aligned data */
+	u_int32_t	len;		/* bytes in @data */
+	u_int32_t	flags;		/* PCAP_WBUF_XXX */
+	u_int32_t	index;		/* file index of @data */
+} pcap_wbuf_t;
+
+/**
+ *	The statistic data, the capture part is updated by capture
+ *	thread, the writer part by writer thread.
+ */
+typedef struct pcap_writer_stat {
+	/* capture thread */
+	u_int64_t	npkt;		/* packets written */
+	u_int64_t	nbyte;		/* record bytes written */
+	u_int64_t	ntrunc;		/* packets truncated by snap length */
+	u_int64_t	ndrop;		/* packets dropped, no free buffer */
+	u_int64_t	nstall;		/* times no free buffer */
+	u_int32_t	maxqueue;	/* peak full buffers queued */
+
+	/* writer thread */
+	u_int64_t	nwrite;		/* write calls */
+	u_int64_t	nwbyte;		/* bytes written to disk */
+	u_int64_t	nfile;		/* files created */
+	u_int64_t	nprealloc;	/* files preallocated */
+	u_int64_t	nerror;		/* write errors */
+	u_int64_t	wns;		/* nanoseconds of write */
+	u_int64_t	maxwns;		/* max nanoseconds of a write */
+} pcap_writer_stat_t;
+
+/**
+ *	The pcap writer, the capture side is used by one thread.
+ */
+typedef struct pcap_writer {
+	/* capture thread */
+	pcap_wbuf_t	*cur;		/* buffer being filled */
+	pcap_wbuf_t	*next;		/* reserved for record spanning */
+	u_int64_t	fsize;		/* bytes of current file */
+	u_int64_t	fstart;		/* time of first packet of file */
+	u_int32_t	findex;		/* index of current file */
+
+	/* writer thread */
+	int		fd;		/* current file */
+	int		nfd;		/* preallocated next file, -1 if none */
+	int		direct;		/* @fd is opened by O_DIRECT */
+	int		ndirect;	/* @nfd is opened by O_DIRECT */
+	u_int64_t	off;		/* write offset of @fd */
+	u_int32_t	windex;		/* index of @fd */
+
+	/* read only after open */
+	char		name[PATH_MAX];	/* file name, or prefix of rotation */
+	u_int64_t	maxsize;	/* rotate size(bytes), 0 disable */
+	u_int64_t	maxtime;	/* rotate time(usec), 0 disable */
+	int		block;		/* wait free buffer, not drop */
+	pcap_wbuf_t	bufs[PCAP_WRITER_NBUF];/* write buffers */
+	u_int8_t	*mem;		/* memory of all buffers */
+	spsc_ring_t	*free;		/* free buffers to capture thread */
+	spsc_ring_t	*full;		/* full buffers to writer thread */
+	pthread_t	tid;		/* writer thread */
+	int		running;	/* writer thread is created */
+	int		stop;		/* stop writer thread */
+
+	pcap_writer_stat_t stat;	/* statistic data */
+} pcap_writer_t;
+
+/**
+ *	Open pcap writer of file @name and start the writer thread.
+ *	If rotate size @maxsize(bytes) or time @maxtime(seconds) is
+ *	not zero, the files are named @name.N. If @block is not zero,
+ *	the capture thread wait free buffer when disk falls behind,
+ *	or else the packet is dropped.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+extern pcap_writer_t * 
+pcap_writer_open(const char *name, u_int64_t maxsize, u_int32_t maxtime,
+		 int block);
+
+/**
+ *	Write frame @f into @w, at most @snap bytes of frame are
+ *	written. Only the capture thread call it.
+ *
+ *	Return 0 if success, -1 if dropped.
+ */
+extern int 
+pcap_writer_write(pcap_writer_t *w, const pkt_frame_t *f, u_int32_t snap);
+
+/**
+ *	Flush the buffered records of @w and stop the writer thread,
+ *	the files are complete after it.
+ *
+ *	No return.
+ */
+extern void 
+pcap_writer_stop(pcap_writer_t *w);
+
+/**
+ *	Stop writer @w if it's running and free it.
+ *
+ *	No return.
+ */
+extern void 
+pcap_writer_close(pcap_writer_t *w);
+
+/**
+ *	Print statistic data of @w, the @prefix is printed before
+ *	each line.
+ *
+ *	No return.
+ */
+extern void 
+pcap_writer_print(const pcap_writer_t *w, const char *prefix);
+
+#endif /* end of FZ_PCAP_WRITER_H */
+
@@ -0,0 +1,740 @@
+/**
+ *	@file	pktbench.c
+ *
+ *	@brief	Replay a pcap/pcapng file from memory through packet
+ *		decode, flow lookup, TCP reassembly and SSL decode,
+ *		the cycles of each stage are measured by rdtsc. The
+ *		file is mmaped and indexed before replay, so no I/O
+ *		in measure except the pcap writer stage.
+ *
+ *	@author	Forrest.zhang
+ */
+
+#define	_GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "gcc_common.h"
+#include "dbg_common.h"
+
+#include "netpkt.h"
+#include "packet_batch.h"
+#include "pcap_file.h"
+#include "pcap_writer.h"
+#include "dssl_util.h"
+#include "tcp_stream.h"
+#include "flow_table.h"
+
+/* the stages measured */
+enum {
+	_ST_DECODE,			/* layer 2-4 decode */
+	_ST_LOOKUP,			/* flow key, find/add/delete */
+	_ST_REASM,			/* TCP state and reassembly */
+	_ST_SSL,			/* SSL decode of reassembled data */
+	_ST_WRITE,			/* copy into pcap writer */
+	_ST_MAX,
+};
+
+static const char	*_g_stname[_ST_MAX] = {
+	"decode", "lookup", "reasm", "ssl", "write",
+};
+
+/* benchmark statistic data */
+typedef struct pktbench_stat {
+	u_int64_t	npkt;		/* packets replayed */
+	u_int64_t	nbyte;		/* bytes on wire replayed */
+	u_int64_t	ntcp;		/* TCP packets */
+	u_int64_t	nother;		/* not TCP or IP fragment */
+	u_int64_t	nstream;	/* TCP streams created */
+	u_int64_t	nclose;		/* TCP streams closed */
+	u_int64_t	nreasm;		/* TCP payload bytes reassembled */
+	u_int64_t	nplain;		/* SSL application bytes decrypted */
+	u_int64_t	cycles[_ST_MAX];/* cycles of stage */
+	u_int64_t	ncall[_ST_MAX];	/* packets/calls of stage */
+	u_int64_t	tsc;		/* cycles of replay */
+	u_int64_t	nsec;		/* nanoseconds of replay */
+	size_t		maxmem;		/* peak memory of flows */
+	u_int32_t	maxflow;	/* peak flows */
+} pktbench_stat_t;
+
+static volatile int	_g_stop;		/* stop variable */
+static pcap_file_t	*_g_pf;			/* replayed file */
+static pcap_writer_t	*_g_writer;		/* write replayed frames */
+static flow_table_t	*_g_flows;		/* TCP streams */
+static tcp_reasm_ctx_t	_g_rctx;		/* TCP reassembly */
+static dssl_ctx_t	*_g_dssl_ctx;		/* SSL decode context */
+static pktbench_stat_t	_g_stat;		/* statistic data */
+static int		_g_loop = 1;		/* replay times */
+static double		_g_speed;		/* time scale, 0 max speed */
+static int		_g_ssl;			/* SSL decode stage */
+static int		_g_nworker;		/* key exchange decrypt threads */
+static int		_g_maxflow = 1024;	/* buffered bytes(KB) of flow */
+static int		_g_maxtotal = 256;	/* buffered bytes(MB) of all flows */
+static int		_g_verbose;		/* verbose level */
+static char		_g_infile[PATH_MAX];
+static char		_g_keyfile[PATH_MAX];
+static char		_g_outfile[PATH_MAX];
+static int		_g_rotsize;		/* rotate size(MB) of output file */
+static int		_g_rottime;		/* rotate time(s) of output file */
+
+/**
+ *	Read the time stamp counter, it's monotonic nanoseconds if
+ *	CPU has no TSC.
+ *
+ *	Return the counter.
+ */
+static inline u_int64_t 
+_rdtsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	u_int32_t lo;
+	u_int32_t hi;
+
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((u_int64_t)hi << 32) | lo;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/**
+ *	Get monotonic time.
+ *
+ *	Return the nanoseconds.
+ */
+static inline u_int64_t 
+_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ *	Show help message
+ *
+ *	No return.
+ */
+static void 
+_usage(void)
+{
+	printf("pktbench <options>\n");
+	printf("\t-r <file>\tpcap/pcapng file replayed\n");
+	printf("\t-l <N>\t\treplay times\n");
+	printf("\t-x <N>\t\ttime scale of packet timestamp, 0 max speed\n");
+	printf("\t-s\t\tdecode SSL of reassembled data\n");
+	printf("\t-k <file>\tprivate key file\n");
+	printf("\t-d <N>\t\tkey exchange decrypt threads, 0 decrypt inline\n");
+	printf("\t-w <file>\twrite frames into file, wait disk if max speed\n");
+	printf("\t-W <N>\t\trotate output file by size(MB), 0 disable\n");
+	printf("\t-G <N>\t\trotate output file by time(s), 0 disable\n");
+	printf("\t-c <N>\t\tout of order bytes(KB) buffered by each flow\n");
+	printf("\t-C <N>\t\tout of order bytes(MB) buffered by all flows\n");
+	printf("\t-v <N>\t\tverbose level\n");
+	printf("\t-h\t\tshow help message\n");
+}
+
+/**
+ *	Parse command line argument.
+ *
+ * 	Return 0 if parse success, -1 on error.
+ */
+static char	_g_optstr[] = ":r:l:x:sk:d:w:W:G:c:C:v:h";
+static int 
+_parse_cmd(int argc, char **argv)
+{
+	char opt;
+
+	opterr = 0;
+	while ( (opt = getopt(argc, argv, _g_optstr)) != -1) {
+
+		switch (opt) {
+
+		case 'r':
+			strncpy(_g_infile, optarg, PATH_MAX - 1);
+			break;
+
+		case 'l':
+			_g_loop = atoi(optarg);
+			if (_g_loop < 1) {
+				printf("Option %c invalid replay times\n",
+					optopt);
+				return -1;
+			}
+			break;
+
+		case 'x':
+			_g_speed = atof(optarg);
+			if (_g_speed < 0) {
+				printf("Option %c invalid time scale\n",
+					optopt);
+				return -1;
+			}
+			break;
+
+		case 's':
+			_g_ssl = 1;
+			break;
+
+		case 'k':
+			strncpy(_g_keyfile, optarg, PATH_MAX - 1);
+			break;
+
+		case 'd':
+			_g_nworker = atoi(optarg);
+			if (_g_nworker < 0) {
+				printf("Option %c invalid thread number\n",
+					optopt);
+				return -1;
+			}
+			break;
+
+		case 'w':
+			strncpy(_g_outfile, optarg, PATH_MAX - 1);
+			break;
+
+		case 'W':
+			_g_rotsize = atoi(optarg);
+			if (_g_rotsize < 0) {
+				printf("Option %c invalid rotate size\n",
+					optopt);
+				return -1;
+			}
+			break;
+
+		case 'G':
+			_g_rottime = atoi(optarg);
+			if (_g_rottime < 0) {
+				printf("Option %c invalid rotate time\n",
+					optopt);
+				return -1;
+			}
+			break;
+
+		case 'c':
+			_g_maxflow = atoi(optarg);
+			if (_g_maxflow < 1) {
+				printf("Option %c invalid flow buffer size\n",
+					optopt);
+				return -1;
+			}
+			break;
+
+		case 'C':
+			_g_maxtotal = atoi(optarg);
+			if (_g_maxtotal < 1) {
+				printf("Option %c invalid total buffer size\n",
+					optopt);
+				return -1;
+			}
+			break;
+
+		case 'v':
+			_g_verbose = atoi(optarg);
+			if (_g_verbose < 0 || _g_verbose > 7) {
+				printf("Option %c invalid range(0-7)\n",
+					optopt);
+				return -1;
+			}
+			break;
+
+		case 'h':
+			return -1;
+
+		case ':':
+			printf("Option %c missing argument\n", optopt);
+			return -1;
+
+		case '?':
+			printf("Unknowed option %c\n", optopt);
+			return -1;
+		}
+	}
+
+	if (argc != optind || !_g_infile[0])
+		return -1;
+
+	return 0;
+}
+
+/**
+ *	Stop signal handler
+ *
+ */
+static void 
+_sig_stop(int signo)
+{
+	printf("\npktbench receive stop signal(%d)\n", signo);
+	_g_stop = 1;
+}
+
+static void 
+_flow_free(void *tcp)
+{
+	int n;
+	int dir;
+	tcp_stream_t *t = tcp;
+
+	if (t->ssl) {
+		/* the records kept for key exchange are decoded */
+		for (dir = 0; dir < 2; dir++) {
+			n = dssl_flush(t->ssl, dir);
+			if (n > 0) {
+				_g_stat.nplain += n;
+				dssl_drop_data(t->ssl, n, dir);
+			}
+		}
+		dssl_free(t->ssl);
+	}
+	tcp_stream_free(t);
+}
+
+/**
+ *	Memory of flows, include the table and buffered bytes.
+ *
+ *	Return the memory size.
+ */
+static inline size_t 
+_flow_mem(void)
+{
+	return (size_t)_g_flows->size * sizeof(flow_slot_t) +
+		(size_t)_g_flows->count * sizeof(tcp_stream_t) +
+		_g_rctx.total;
+}
+
+/**
+ *	The reassembled data of stream @tcp, it's passed to SSL
+ *	decode if SSL stage enabled.
+ *
+ *	No return.
+ */
+static void 
+_tcp_data(void *tcp, int dir, const u_int8_t *data, size_t len, void *arg)
+{
+	int n;
+	u_int64_t t0;
+	tcp_stream_t *t = tcp;
+
+	_g_stat.nreasm += len;
+
+	if (!t->ssl)
+		return;
+
+	t0 = _rdtsc();
+	n = dssl_decode(t->ssl, data, len, dir);
+	if (n > 0) {
+		_g_stat.nplain += n;
+		dssl_drop_data(t->ssl, n, dir);
+	}
+	_g_stat.cycles[_ST_SSL] += _rdtsc() - t0;
+	_g_stat.ncall[_ST_SSL]++;
+}
+
+/**
+ *	Create TCP stream for SYN packet @pkt.
+ *
+ *	Return the stream if success, NULL on error.
+ */
+static tcp_stream_t * 
+_flow_add(const netpkt_t *pkt, const tcp_flow_key_t *key, u_int32_t hval,
+	  int kdir)
+{
+	struct tcphdr *h;
+	tcp_stream_t *t;
+
+	h = pkt->hdr4_tcp;
+	t = tcp_stream_alloc(&_g_rctx);
+	if (!t)
+		ERR_RET(NULL, "tcp stream alloc failed\n");
+
+	t->state = TCP_ST_SYN;
+	t->seqacks[0].seq = ntohl(h->seq);
+	t->seqacks[0].ack = ntohl(h->seq) + 1;
+	tcp_reasm_start(&t->reasm[0], ntohl(h->seq) + 1);
+	t->key = *key;
+	t->hval = hval;
+	t->kdir = kdir;
+	if (tcp_tup_init((tcp_tup_t *)t, pkt, 0) ||
+	    flow_table_add(_g_flows, key, hval, t)) {
+		tcp_stream_free(t);
+		ERR_RET(NULL, "add tcp stream failed\n");
+	}
+
+	if (_g_ssl) {
+		t->ssl = dssl_new(_g_dssl_ctx);
+		if (!t->ssl)
+			ERR("dssl_new failed\n");
+	}
+
+	_g_stat.nstream++;
+	if (_g_flows->count > _g_stat.maxflow)
+		_g_stat.maxflow = _g_flows->count;
+
+	return t;
+}
+
+/**
+ *	Pass TCP packet @pkt to lookup and reassembly stage, the
+ *	cycles of SSL stage is not counted in reassembly.
+ *
+ *	No return.
+ */
+static void 
+_bench_tcp(const netpkt_t *pkt)
+{
+	int dir;
+	int kdir;
+	u_int32_t hval;
+	u_int64_t t0;
+	u_int64_t t1;
+	u_int64_t t2;
+	u_int64_t ssl;
+	size_t mem;
+	struct tcphdr *h;
+	tcp_flow_key_t key;
+	tcp_stream_t *t;
+
+	_g_stat.ntcp++;
+	_g_stat.ncall[_ST_LOOKUP]++;
+
+	t0 = _rdtsc();
+	kdir = tcp_flow_key(pkt, &key, &hval);
+	if (kdir < 0) {
+		_g_stat.cycles[_ST_LOOKUP] += _rdtsc() - t0;
+		return;
+	}
+
+	t = flow_table_find(_g_flows, &key, hval);
+	if (!t) {
+		h = pkt->hdr4_tcp;
+		if (h->syn && !h->ack && !h->fin && !h->psh && !h->rst)
+			_flow_add(pkt, &key, hval, kdir);
+		_g_stat.cycles[_ST_LOOKUP] += _rdtsc() - t0;
+		return;
+	}
+	t1 = _rdtsc();
+	_g_stat.cycles[_ST_LOOKUP] += t1 - t0;
+
+	/* 0 is client packet, 1 is server packet */
+	dir = kdir ^ t->kdir;
+	ssl = _g_stat.cycles[_ST_SSL];
+	tcp_stream_flow(t, pkt, dir);
+	t2 = _rdtsc();
+	_g_stat.cycles[_ST_REASM] += t2 - t1 -
+		(_g_stat.cycles[_ST_SSL] - ssl);
+	_g_stat.ncall[_ST_REASM]++;
+
+	mem = _flow_mem();
+	if (mem > _g_stat.maxmem)
+		_g_stat.maxmem = mem;
+
+	/* FIN or RST seen, free it now */
+	if (t->state == TCP_ST_CLOSE) {
+		flow_table_del(_g_flows, &t->key, t->hval);
+		_flow_free(t);
+		_g_stat.nclose++;
+		_g_stat.cycles[_ST_LOOKUP] += _rdtsc() - t2;
+	}
+}
+
+/**
+ *	Wait the frame @i is due by time scale, the replay of loop
+ *	start at @start(nsec).
+ *
+ *	Return number of frames due in [@i, @i + @n), at least 1.
+ */
+static int 
+_pace(u_int32_t i, int n, u_int64_t start)
+{
+	int k;
+	u_int64_t now;
+	u_int64_t due;
+	const pkt_frame_t *frames;
+
+	frames = _g_pf->frames;
+	due = start + (frames[i].ts - _g_pf->first) * 1000 / _g_speed;
+	while ((now = _now_ns()) < due && !_g_stop)
+		;
+
+	for (k = 1; k < n; k++) {
+		due = start + (frames[i + k].ts - _g_pf->first) * 1000 /
+			_g_speed;
+		if (due > now)
+			break;
+	}
+
+	return k;
+}
+
+/**
+ *	Replay all frames once, the frames are decoded in batch.
+ *
+ *	No return.
+ */
+static void 
+_replay(void)
+{
+	int j;
+	int n;
+	u_int32_t i;
+	u_int64_t t0;
+	u_int64_t t1;
+	u_int64_t start;
+	netpkt_t pkt;
+	const pkt_frame_t *frames;
+	pkt_desc_t descs[PKT_BATCH];
+
+	frames = _g_pf->frames;
+	start = _now_ns();
+	t0 = _rdtsc();
+
+	i = 0;
+	while (i < _g_pf->nframe && !_g_stop) {
+		n = _g_pf->nframe - i;
+		if (n > PKT_BATCH)
+			n = PKT_BATCH;
+		if (_g_speed > 0)
+			n = _pace(i, n, start);
+
+		t1 = _rdtsc();
+		pkt_decode_batch(&frames[i], descs, n);
+		_g_stat.cycles[_ST_DECODE] += _rdtsc() - t1;
+		_g_stat.ncall[_ST_DECODE] += n;
+
+		for (j = 0; j < n; j++) {
+			_g_stat.npkt++;
+			_g_stat.nbyte += frames[i + j].len;
+			if (!(descs[j].flags & PKT_F_TCP)) {
+				_g_stat.nother++;
+				continue;
+			}
+			pkt_desc_netpkt(&descs[j], &frames[i + j], &pkt);
+			_bench_tcp(&pkt);
+		}
+
+		if (_g_writer) {
+			t1 = _rdtsc();
+			for (j = 0; j < n; j++)
+				pcap_writer_write(_g_writer, &frames[i + j],
+						  UINT32_MAX);
+			_g_stat.cycles[_ST_WRITE] += _rdtsc() - t1;
+			_g_stat.ncall[_ST_WRITE] += n;
+		}
+
+		i += n;
+	}
+
+	_g_stat.tsc += _rdtsc() - t0;
+	_g_stat.nsec += _now_ns() - start;
+}
+
+/**
+ *	Init some global resource used in program.
+ *
+ * 	Return 0 if success, -1 on error.
+ */
+static int 
+_initiate(void)
+{
+	signal(SIGINT, _sig_stop);
+
+	_g_pf = pcap_file_open(_g_infile);
+	if (!_g_pf)
+		ERR_RET(-1, "open %s failed\n", _g_infile);
+
+	printf("file %s: %s, nframe %u, nskip %u, nbyte %llu, "
+	       "duration %.3fs\n", _g_infile, _g_pf->ng ? "pcapng" : "pcap",
+	       _g_pf->nframe, _g_pf->nskip,
+	       (unsigned long long)_g_pf->nbyte,
+	       (double)(_g_pf->last - _g_pf->first) / 1000000);
+
+	if (_g_pf->nframe < 1)
+		ERR_RET(-1, "no Ethernet frame in %s\n", _g_infile);
+
+	tcp_reasm_ctx_init(&_g_rctx, (size_t)_g_maxflow * 1024,
+			   (size_t)_g_maxtotal * 1024 * 1024, _tcp_data, NULL);
+
+	_g_dssl_ctx = dssl_ctx_new();
+	if (!_g_dssl_ctx)
+		ERR_RET(-1, "dssl_ctx_new failed\n");
+
+	if (_g_keyfile[0])
+		if (dssl_ctx_load_pkey(_g_dssl_ctx, _g_keyfile, NULL))
+			ERR_RET(-1, "dssl_ctx_set_pkey failed\n");
+
+	if (dssl_ctx_start(_g_dssl_ctx, _g_nworker, 0))
+		ERR_RET(-1, "dssl_ctx_start failed\n");
+
+	/* the paced replay is like live capture, drop if disk is slow */
+	if (_g_outfile[0]) {
+		_g_writer = pcap_writer_open(_g_outfile,
+					     (u_int64_t)_g_rotsize << 20,
+					     _g_rottime, _g_speed == 0);
+		if (!_g_writer)
+			ERR_RET(-1, "open writer %s failed\n", _g_outfile);
+	}
+
+	return 0;
+}
+
+/**
+ *	Release global resource alloced by _initiate().
+ *
+ * 	No Return.
+ */
+static void 
+_release(void)
+{
+	if (_g_flows) {
+		flow_table_free(_g_flows);
+		_g_flows = NULL;
+	}
+
+	if (_g_dssl_ctx) {
+		if (_g_ssl) {
+			printf("ssl:\n");
+			dssl_ctx_print(_g_dssl_ctx, "\t");
+		}
+		dssl_ctx_free(_g_dssl_ctx);
+		_g_dssl_ctx = NULL;
+	}
+
+	if (_g_writer) {
+		pcap_writer_close(_g_writer);
+		_g_writer = NULL;
+	}
+
+	if (_g_pf) {
+		pcap_file_close(_g_pf);
+		_g_pf = NULL;
+	}
+}
+
+/**
+ *	Replay file @_g_loop times, the flows are freed after each
+ *	loop so every loop is same.
+ *
+ * 	Return 0 if success, -1 on error.
+ */
+static int 
+_process(void)
+{
+	int i;
+
+	for (i = 0; i < _g_loop && !_g_stop; i++) {
+		_g_flows = flow_table_alloc(0, _flow_free);
+		if (!_g_flows)
+			ERR_RET(-1, "flow_table_alloc failed\n");
+
+		_replay();
+
+		if (_g_verbose || i == _g_loop - 1) {
+			printf("loop %d:\n", i);
+			flow_table_print(_g_flows, "\t");
+		}
+		flow_table_free(_g_flows);
+		_g_flows = NULL;
+	}
+
+	/* the files are complete before print */
+	if (_g_writer)
+		pcap_writer_stop(_g_writer);
+
+	return 0;
+}
+
+/**
+ *	Print the result of replay.
+ *
+ *	No return.
+ */
+static void 
+_print(void)
+{
+	int i;
+	double sec;
+	u_int64_t total;
+	u_int64_t n;
+
+	tcp_reasm_print(&_g_rctx, "\t");
+
+	if (_g_writer)
+		pcap_writer_print(_g_writer, "");
+
+	printf("npkt %llu, nbyte %llu, ntcp %llu, nother %llu\n",
+	       (unsigned long long)_g_stat.npkt,
+	       (unsigned long long)_g_stat.nbyte,
+	       (unsigned long long)_g_stat.ntcp,
+	       (unsigned long long)_g_stat.nother);
+	printf("nstream %llu, nclose %llu, nreasm %llu, nplain %llu\n",
+	       (unsigned long long)_g_stat.nstream,
+	       (unsigned long long)_g_stat.nclose,
+	       (unsigned long long)_g_stat.nreasm,
+	       (unsigned long long)_g_stat.nplain);
+
+	if (_g_stat.npkt == 0 || _g_stat.nsec == 0)
+		return;
+
+	sec = (double)_g_stat.nsec / 1000000000;
+	printf("elapsed %.3fs, %.0f pps, %.3f Gbit/s, tsc %.3f GHz\n", sec,
+	       _g_stat.npkt / sec, _g_stat.nbyte * 8 / sec / 1000000000,
+	       (double)_g_stat.tsc / _g_stat.nsec);
+
+	total = 0;
+	printf("%-8s %14s %12s %12s\n", "stage", "cycles", "calls",
+	       "cycles/pkt");
+	for (i = 0; i < _ST_MAX; i++) {
+		n = _g_stat.ncall[i];
+		total += _g_stat.cycles[i];
+		printf("%-8s %14llu %12llu %12.1f\n", _g_stname[i],
+		       (unsigned long long)_g_stat.cycles[i],
+		       (unsigned long long)n,
+		       n ? (double)_g_stat.cycles[i] / n : 0.0);
+	}
+	printf("%-8s %14llu %12llu %12.1f\n", "total",
+	       (unsigned long long)total,
+	       (unsigned long long)_g_stat.npkt,
+	       (double)total / _g_stat.npkt);
+
+	printf("peak flows %u, peak memory %zu KB\n",
+	       _g_stat.maxflow, _g_stat.maxmem / 1024);
+}
+
+/**
+ *	The main entry of program.
+ *
+ * 	Return 0 if success, other value on error.
+ */
+int 
+main(int argc, char **argv)
+{
+	if (_parse_cmd(argc, argv)) {
+		_usage();
+		return -1;
+	}
+
+	if (_initiate()) {
+		_release();
+		return -1;
+	}
+
+	_process();
+
+	_print();
+
+	_release();
+
+	return 0;
+}
+
@@ -31,6 +31,9 @@
 #include "packet_icmpv6.h"
 #include "packet_udp.h"
 #include "packet_tcp.h"
+#include "netring.h"
+
+#define	_PCAP_BATCH	64		/* packets of each pcap_dispatch() */
 
 
 /* sniffex statistic data */
@@ -42,6 +45,8 @@ typedef struct sniffex_stat {
 
 static volatile int	_g_stop;		/* stop vairable */
 static pcap_t		*_g_pcap;		/* pcap object */
+static netring_t	*_g_ring;		/* mmaped ring object */
+static int		_g_ringsize = 64;	/* ring size(MB), 0 use pcap */
 static int		_g_verbose;		/* verbose level */
 static int		_g_pcaplen = 1024;
 static char		_g_intf[IFNAMSIZ] = "any";
@@ -62,6 +67,7 @@ _usage(void)
 	printf("\t-i <interface>\tinterface name\n");
 	printf("\t-f <filter>\tfilter string\n");
 	printf("\t-l <N>\t\tpcap packet length\n");
+	printf("\t-m <N>\t\tmmap ring size(MB) for live capture, 0 use pcap\n");
 	printf("\t-r <file>\tread packets from file\n");
 	printf("\t-w <file>\twrite packets into file\n");
 	printf("\t-v <N>\t\tverbose level\n");
@@ -73,7 +79,7 @@ _usage(void)
  *
  * 	Return 0 if parse success, -1 on error.
  */
-static char	_g_optstr[] = ":i:f:l:r:w:v:h";
+static char	_g_optstr[] = ":i:f:l:m:r:w:v:h";
 static int 
 _parse_cmd(int argc, char **argv)
 {
@@ -110,6 +116,15 @@ _parse_cmd(int argc, char **argv)
 			}
 			break;
 
+		case 'm':
+			_g_ringsize = atoi(optarg);
+			if (_g_ringsize < 0) {
+				printf("Option %c invalid ring size\n", 
+					optopt);
+				return -1;
+			}
+			break;
+
 		case 'r':
 			strncpy(_g_infile, optarg, PATH_MAX);
 			break;
@@ -168,6 +183,19 @@ _initiate(void)
 	/* set stop signal */
 	signal(SIGINT, _sig_stop);
 
+	/* live capture using mmaped ring */
+	if (!_g_infile[0] && _g_ringsize > 0) {
+		_g_ring = netring_open(_g_intf, NETRING_BLKSIZE,
+				       (_g_ringsize << 20) / NETRING_BLKSIZE, 1);
+		if (!_g_ring)
+			ERR_RET(-1, "open ring (%s) failed\n", _g_intf);
+
+		if (netring_set_filter(_g_ring, _g_filter, _g_pcaplen))
+			ERR_RET(-1, "set filter (%s) failed\n", _g_filter);
+
+		return 0;
+	}
+
 	/* open device or file */
 	if (!_g_infile[0]) {
 		f = _g_intf;
@@ -207,36 +235,32 @@ _release(void)
 	if (_g_pcap)
 		pcap_close(_g_pcap);
 
+	if (_g_ring) {
+		netring_print(_g_ring);
+		netring_close(_g_ring);
+	}
+
 	return 0;
 }
 
+/**
+ *	Decode and print packet @pkt, it's a view of pcap buffer
+ *	or ring.
+ *
+ *	No return.
+ */
 static void 
-_decode(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes)
+_decode(netpkt_t *pkt, sniffex_stat_t *stat)
 {
-	netpkt_t *pkt;
-	sniffex_stat_t *stat;
-	
-	stat = (sniffex_stat_t *)user;
-
-	pkt = netpkt_alloc(h->len);
-	if (!pkt) {
-		_g_stop = 1;
-		ERR("malloc failed: %s\n", ERRSTR);
-		return;
-	}
-
 	printf("========================================\n");
 
-	if (netpkt_add_data(pkt, bytes, h->len))
-		ERR("add data failed\n");
-
 #if 0
 	printf(">--------netpkt--------<");
 	netpkt_print(pkt, "\t");
 #endif
 
 	if (eth_decode(pkt)) 
-		exit(0);
+		return;
 	
 	printf(">--------eth header--------<\n");
 	eth_print(pkt, "\t");
@@ -245,19 +269,19 @@ _decode(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes)
 	switch (pkt->hdr3_type) {
 		case ETHERTYPE_ARP:
 			if (arp_decode(pkt))
-				goto out_free;
+				return;
 			printf(">--------arp header--------<\n");
 			arp_print(pkt, "\t");
 			break;
 		case ETHERTYPE_IP:
 			if (ipv4_decode(pkt))
-				goto out_free;
+				return;
 			printf(">--------ipv4 header--------<\n");
 			ipv4_print(pkt, "\t");
 			break;
 		case ETHERTYPE_IPV6:
 			if (ipv6_decode(pkt))
-				goto out_free;
+				return;
 			printf(">--------ipv6 header--------<\n");
 			ipv6_print(pkt, "\t");
 			break;
@@ -269,14 +293,14 @@ _decode(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes)
 	switch (pkt->hdr4_type) {
 		case IPPROTO_ICMP:
 			if (icmpv4_decode(pkt))
-				goto out_free;
+				return;
 			printf(">--------icmp header--------<\n");
 			icmpv4_print(pkt, "\t");
 			break;
 	
 		case IPPROTO_ICMPV6:
 			if (icmpv6_decode(pkt))
-				goto out_free;
+				return;
 			printf(">--------icmpv6 header--------<\n");
 			icmpv6_print(pkt, "\t");
 			break;
@@ -284,14 +308,14 @@ _decode(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes)
 
 		case IPPROTO_UDP:
 			if (udp_decode(pkt))
-				goto out_free;
+				return;
 			printf(">--------udp header--------<\n");
 			udp_print(pkt, "\t");
 			break;
 
 		case IPPROTO_TCP:
 			if (tcp_decode(pkt))
-				goto out_free;
+				return;
 			printf(">--------tcp header--------<\n");
 			tcp_print(pkt, "\t");
 			break;
@@ -300,13 +324,24 @@ _decode(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes)
 	}
 
 	stat->npkt++;
-	stat->nbyte += h->len;
+	stat->nbyte += pkt->tail - pkt->head;
+}
 
-out_free:
+static void 
+_pcap_decode(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes)
+{
+	netpkt_t pkt;
 
-	if (pkt)
-		netpkt_free(pkt);
+	netpkt_init(&pkt, bytes, h->caplen);
+	pkt.tail = pkt.end;
 
+	_decode(&pkt, (sniffex_stat_t *)user);
+}
+
+static void 
+_ring_decode(netpkt_t *pkt, void *arg)
+{
+	_decode(pkt, arg);
 }
 
 static int 
@@ -317,9 +352,16 @@ _process(void)
 	
 	memset(&stat, 0, sizeof(stat));
 	while (!_g_stop) {
-		ret = pcap_dispatch(_g_pcap, 1, _decode, (u_char *)&stat);
+		if (_g_ring)
+			ret = netring_dispatch(_g_ring, 100, _ring_decode, &stat);
+		else
+			ret = pcap_dispatch(_g_pcap, _PCAP_BATCH, 
+					    _pcap_decode, (u_char *)&stat);
 		if (ret < 0)
 			break;
+		/* end of input file */
+		if (ret == 0 && _g_infile[0])
+			break;
 	}
 	return 0;
 }
@@ -0,0 +1 @@
+../../basic/datastruct/spsc_ring.c
\ No newline at end of file
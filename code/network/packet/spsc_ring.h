@@ -0,0 +1 @@
+../../basic/datastruct/spsc_ring.h
\ No newline at end of file
@@ -6,12 +6,16 @@
  *	@author	Forrest.zhang
  */
 
+#define	_GNU_SOURCE
+
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <signal.h>
+#include <sched.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <pcap/pcap.h>
@@ -19,7 +23,7 @@
 
 #include "gcc_common.h"
 #include "dbg_common.h"
-#include "shash.h"
+#include "spsc_ring.h"
 
 #include "netpkt.h"
 #include "packet_eth.h"
@@ -32,10 +36,65 @@
 #include "packet_tcp.h"
 #include "dssl_util.h"
 #include "tcp_stream.h"
+#include "ip_frag.h"
+#include "flow_table.h"
+#include "netring.h"
+#include "packet_batch.h"
+#include "pcap_writer.h"
+
+#define	_PCAP_BATCH	64		/* packets of each pcap_dispatch() */
+#define	_MAX_THREAD	64		/* max analysis threads */
+#define	_QUEUE_SIZE	4096		/* packet queue size of thread */
+#define	_QUEUE_BATCH	32		/* packets dequeued in batch */
+
+/* analysis thread statistic data */
+typedef struct ssldump_stat {
+	u_int64_t	npkt;		/* TCP packets analysed */
+	u_int64_t	nbyte;		/* TCP bytes analysed */
+	u_int64_t	nstream;	/* TCP streams created */
+	u_int64_t	ndrop;		/* dropped by pcap reader, queue full */
+	u_int64_t	nreasm;		/* TCP payload bytes reassembled */
+	u_int64_t	nclose;		/* streams closed by FIN/RST */
+	u_int64_t	nidle;		/* streams aged by idle timeout */
+	u_int64_t	nhard;		/* streams aged by hard timeout */
+	u_int64_t	nevict_flow;	/* streams evicted by flow cap */
+	u_int64_t	nevict_mem;	/* streams evicted by memory cap */
+	u_int64_t	nplain;		/* SSL application bytes decrypted */
+} ssldump_stat_t;
+
+/* analysis thread, it own all TCP streams hashed to it */
+typedef struct ssldump_thread {
+	int		index;		/* thread index */
+	pthread_t	tid;		/* thread id */
+	flow_table_t	*flows;		/* TCP streams of this thread */
+	netring_t	*ring;		/* fanout ring for live capture */
+	spsc_ring_t	*queue;		/* packets from pcap reader */
+	ip_frag_ctx_t	*frag;		/* IP fragment reassembly */
+	pcap_writer_t	*writer;	/* write packets into file */
+	u_int32_t	wlen;		/* bytes of current packet written */
+	tcp_reasm_ctx_t	rctx;		/* TCP reassembly of this thread */
+	cblist_t	lru;		/* streams sorted by last packet */
+	cblist_t	age;		/* streams sorted by first packet */
+	u_int64_t	now;		/* time of latest packet(usec) */
+	u_int32_t	maxflow;	/* max streams of this thread */
+	size_t		maxmem;		/* max memory of streams */
+	ssldump_stat_t	stat;		/* statistic data */
+} ssldump_thread_t;
 
 static volatile int	_g_stop;		/* stop vairable */
+static int		_g_eof;			/* pcap reader finished */
 static pcap_t		*_g_pcap;		/* pcap object */
+static int		_g_ringsize = 64;	/* ring size(MB), 0 use pcap */
+static int		_g_nthread = 1;		/* number of analysis threads */
+static ssldump_thread_t	*_g_threads;		/* analysis threads */
+static ip_frag_ctx_t	*_g_frag;		/* fragment reassembly of reader */
 static int		_g_verbose;		/* verbose level */
+static int		_g_maxflow = 1024;	/* buffered bytes(KB) of flow */
+static int		_g_maxtotal = 256;	/* buffered bytes(MB) of all flows */
+static int		_g_idle = 300;		/* idle timeout(s) of flow */
+static int		_g_hard = 3600;		/* hard timeout(s) of flow */
+static int		_g_maxflows = 1000000;	/* max flows of all threads */
+static int		_g_maxmem = 1024;	/* max memory(MB) of all flows */
 static int		_g_pcaplen = 1024;
 static char		_g_intf[IFNAMSIZ] = "any";
 static char		_g_filter[PATH_MAX];
@@ -43,7 +102,11 @@ static char		_g_infile[PATH_MAX];
 static char		_g_outfile[PATH_MAX];
 static char		_g_errbuf[PCAP_ERRBUF_SIZE];
 static char		_g_keyfile[PATH_MAX];
-static shash_t		*_g_tcphash;
+static int		_g_nworker = 2;		/* key exchange decrypt threads */
+static int		_g_maxssn;		/* cached SSL sessions, 0 default */
+static int		_g_rotsize;		/* rotate size(MB) of output file */
+static int		_g_rottime;		/* rotate time(s) of output file */
+static int		_g_snaplen;		/* payload bytes(KB) written of flow */
 static dssl_ctx_t	*_g_dssl_ctx;
 
 /**
@@ -58,9 +121,23 @@ _usage(void)
 	printf("\t-i <interface>\tinterface name\n");
 	printf("\t-f <filter>\tfilter string\n");
 	printf("\t-l <N>\t\tpcap packet length\n");
-	printf("\t-r <file>\tread packets from file\n");
-	printf("\t-w <file>\twrite packets into file\n");
+	printf("\t-m <N>\t\tmmap ring size(MB) of each thread for live capture, 0 use pcap\n");
+	printf("\t-t <N>\t\tanalysis threads(1-%d), flows are hashed to them\n", 
+	       _MAX_THREAD);
+	printf("\t-c <N>\t\tout of order bytes(KB) buffered by each flow\n");
+	printf("\t-C <N>\t\tout of order bytes(MB) buffered by all flows\n");
+	printf("\t-e <N>\t\tidle timeout(s) of flow, 0 disable\n");
+	printf("\t-E <N>\t\thard timeout(s) of flow, 0 disable\n");
+	printf("\t-n <N>\t\tmax flows, the least recently used is evicted\n");
+	printf("\t-M <N>\t\tmax memory(MB) of flows, include buffered bytes\n");
+	printf("\t-r <file>\tread packets from file, no packet is dropped\n");
+	printf("\t-w <file>\twrite packets into file, one file each thread\n");
+	printf("\t-W <N>\t\trotate output file by size(MB), 0 disable\n");
+	printf("\t-G <N>\t\trotate output file by time(s), 0 disable\n");
+	printf("\t-s <N>\t\tpayload bytes(KB) written of each flow, 0 no limit\n");
 	printf("\t-k <file>\tprivate key file\n");
+	printf("\t-d <N>\t\tkey exchange decrypt threads, 0 decrypt in analysis thread\n");
+	printf("\t-S <N>\t\tmax cached SSL sessions for resumption\n");
 	printf("\t-v <N>\t\tverbose level\n");
 	printf("\t-h\t\tshow help message\n");
 }
@@ -70,7 +147,7 @@ _usage(void)
  *
  * 	Return 0 if parse success, -1 on error.
  */
-static char	_g_optstr[] = ":i:f:l:r:w:k:v:h";
+static char	_g_optstr[] = ":i:f:l:m:t:c:C:e:E:n:M:r:w:W:G:s:k:d:S:v:h";
 static int 
 _parse_cmd(int argc, char **argv)
 {
@@ -98,6 +175,78 @@ _parse_cmd(int argc, char **argv)
 			}
 			break;
 
+		case 'm':
+			_g_ringsize = atoi(optarg);
+			if (_g_ringsize < 0) {
+				printf("Option %c invalid ring size\n", 
+					optopt);
+				return -1;
+			}
+			break;
+
+		case 't':
+			_g_nthread = atoi(optarg);
+			if (_g_nthread < 1 || _g_nthread > _MAX_THREAD) {
+				printf("Option %c invalid range(1-%d)\n", 
+					optopt, _MAX_THREAD);
+				return -1;
+			}
+			break;
+
+		case 'c':
+			_g_maxflow = atoi(optarg);
+			if (_g_maxflow < 1) {
+				printf("Option %c invalid flow buffer size\n", 
+					optopt);
+				return -1;
+			}
+			break;
+
+		case 'C':
+			_g_maxtotal = atoi(optarg);
+			if (_g_maxtotal < 1) {
+				printf("Option %c invalid total buffer size\n", 
+					optopt);
+				return -1;
+			}
+			break;
+
+		case 'e':
+			_g_idle = atoi(optarg);
+			if (_g_idle < 0) {
+				printf("Option %c invalid idle timeout\n", 
+					optopt);
+				return -1;
+			}
+			break;
+
+		case 'E':
+			_g_hard = atoi(optarg);
+			if (_g_hard < 0) {
+				printf("Option %c invalid hard timeout\n", 
+					optopt);
+				return -1;
+			}
+			break;
+
+		case 'n':
+			_g_maxflows = atoi(optarg);
+			if (_g_maxflows < 1) {
+				printf("Option %c invalid max flows\n", 
+					optopt);
+				return -1;
+			}
+			break;
+
+		case 'M':
+			_g_maxmem = atoi(optarg);
+			if (_g_maxmem < 1) {
+				printf("Option %c invalid max memory\n", 
+					optopt);
+				return -1;
+			}
+			break;
+
 		case 'r':
 			strncpy(_g_infile, optarg, PATH_MAX);
 			break;
@@ -106,10 +255,55 @@ _parse_cmd(int argc, char **argv)
 			strncpy(_g_outfile, optarg, PATH_MAX);
 			break;
 
+		case 'W':
+			_g_rotsize = atoi(optarg);
+			if (_g_rotsize < 0) {
+				printf("Option %c invalid rotate size\n", 
+					optopt);
+				return -1;
+			}
+			break;
+
+		case 'G':
+			_g_rottime = atoi(optarg);
+			if (_g_rottime < 0) {
+				printf("Option %c invalid rotate time\n", 
+					optopt);
+				return -1;
+			}
+			break;
+
+		case 's':
+			_g_snaplen = atoi(optarg);
+			if (_g_snaplen < 0) {
+				printf("Option %c invalid snap length\n", 
+					optopt);
+				return -1;
+			}
+			break;
+
 		case 'k':
 			strncpy(_g_keyfile, optarg, PATH_MAX);
 			break;
 
+		case 'd':
+			_g_nworker = atoi(optarg);
+			if (_g_nworker < 0 || _g_nworker > _MAX_THREAD) {
+				printf("Option %c invalid range(0-%d)\n", 
+					optopt, _MAX_THREAD);
+				return -1;
+			}
+			break;
+
+		case 'S':
+			_g_maxssn = atoi(optarg);
+			if (_g_maxssn < 1) {
+				printf("Option %c invalid session number\n", 
+					optopt);
+				return -1;
+			}
+			break;
+
 		case 'v':
 			_g_verbose = atoi(optarg);
 			if (_g_verbose < 0 || _g_verbose > 7) {
@@ -159,7 +353,171 @@ _sig_stop(int signo)
 static void 
 _tcp_free(void *tcp)
 {
-	return tcp_stream_free(tcp);
+	tcp_stream_t *t = tcp;
+
+	if (t->ssl)
+		dssl_free(t->ssl);
+
+	return tcp_stream_free(t);
+}
+
+/**
+ *	The reassembled data of stream @tcp, it's decoded as SSL
+ *	records if key is loaded, the plain data is counted and
+ *	dropped.
+ *
+ *	No return.
+ */
+static void 
+_tcp_data(void *tcp, int dir, const u_int8_t *data, size_t len, void *arg)
+{
+	int n;
+	ssldump_thread_t *t = arg;
+	tcp_stream_t *s = tcp;
+
+	t->stat.nreasm += len;
+	if (_g_verbose > 1)
+		printf("<%d>stream(%p) %zu bytes reassembled\n", 
+		       dir, tcp, len);
+
+	if (!s->ssl)
+		return;
+
+	n = dssl_decode(s->ssl, data, len, dir);
+	if (n > 0) {
+		t->stat.nplain += n;
+		dssl_drop_data(s->ssl, n, dir);
+	}
+}
+
+/**
+ *	Decode the SSL records of stream @s in direction @dir which
+ *	are kept for pending key exchange, it's called before stream
+ *	is freed.
+ *
+ *	No return.
+ */
+static void 
+_tcp_data_flush(ssldump_thread_t *t, tcp_stream_t *s, int dir)
+{
+	int n;
+
+	n = dssl_flush(s->ssl, dir);
+	if (n > 0) {
+		t->stat.nplain += n;
+		dssl_drop_data(s->ssl, n, dir);
+	}
+}
+
+/**
+ *	Init analysis thread @t, it open a ring in fanout group 
+ *	@group for live capture, or alloc a queue for pcap reader.
+ *
+ * 	Return 0 if success, -1 on error.
+ */
+static int 
+_thread_init(ssldump_thread_t *t, int index, u_int16_t group)
+{
+	char name[PATH_MAX + 16];
+
+	t->index = index;
+
+	t->frag = ip_frag_alloc(0, 0, 0, IP_FRAG_FIRST);
+	if (!t->frag)
+		ERR_RET(-1, "ip_frag_alloc failed\n");
+
+	/* every thread write own file, the input file wait the disk */
+	if (_g_outfile[0]) {
+		if (_g_nthread > 1)
+			snprintf(name, sizeof(name), "%s.%d", _g_outfile, index);
+		else
+			snprintf(name, sizeof(name), "%s", _g_outfile);
+		t->writer = pcap_writer_open(name, (u_int64_t)_g_rotsize << 20,
+					     _g_rottime, _g_infile[0] != 0);
+		if (!t->writer)
+			ERR_RET(-1, "open writer %s failed\n", name);
+	}
+
+	/* the total buffer is shared by threads */
+	tcp_reasm_ctx_init(&t->rctx, (size_t)_g_maxflow << 10,
+			   ((size_t)_g_maxtotal << 20) / _g_nthread,
+			   _tcp_data, t);
+
+	/* the flow caps are shared by threads too */
+	CBLIST_INIT(&t->lru);
+	CBLIST_INIT(&t->age);
+	t->maxflow = (_g_maxflows + _g_nthread - 1) / _g_nthread;
+	t->maxmem = ((size_t)_g_maxmem << 20) / _g_nthread;
+
+	t->flows = flow_table_alloc(0, _tcp_free);
+	if (!t->flows)
+		ERR_RET(-1, "flow_table_alloc failed\n");
+
+	/* live capture, every thread have a ring in fanout group */
+	if (!_g_infile[0] && _g_ringsize > 0) {
+		t->ring = netring_open(_g_intf, NETRING_BLKSIZE,
+				       (_g_ringsize << 20) / NETRING_BLKSIZE, 1);
+		if (!t->ring)
+			ERR_RET(-1, "open ring (%s) failed\n", _g_intf);
+
+		if (netring_set_filter(t->ring, _g_filter, _g_pcaplen))
+			ERR_RET(-1, "set filter (%s) failed\n", _g_filter);
+
+		if (_g_nthread > 1 && netring_fanout(t->ring, group))
+			return -1;
+
+		return 0;
+	}
+
+	/* pcap reader pass packets to thread */
+	if (_g_nthread > 1) {
+		t->queue = spsc_ring_alloc(_QUEUE_SIZE, sizeof(netpkt_t *), 1);
+		if (!t->queue)
+			ERR_RET(-1, "spsc_ring_alloc failed\n");
+	}
+
+	return 0;
+}
+
+/**
+ *	Release analysis thread @t.
+ *
+ * 	No return.
+ */
+static void 
+_thread_free(ssldump_thread_t *t)
+{
+	int n;
+	netpkt_t *pkt;
+
+	if (t->queue) {
+		while ((n = spsc_ring_dequeue(t->queue, &pkt, 1)) > 0)
+			netpkt_free(pkt);
+		spsc_ring_free(t->queue);
+	}
+
+	if (t->ring) {
+		netring_print(t->ring);
+		netring_close(t->ring);
+	}
+
+	if (t->flows) {
+		flow_table_print(t->flows, "\t");
+		flow_table_free(t->flows);
+	}
+
+	tcp_reasm_print(&t->rctx, "\t");
+
+	if (t->writer) {
+		pcap_writer_stop(t->writer);
+		pcap_writer_print(t->writer, "\t");
+		pcap_writer_close(t->writer);
+	}
+
+	if (t->frag) {
+		ip_frag_print(t->frag, "\t");
+		ip_frag_free(t->frag);
+	}
 }
 
 /**
@@ -170,12 +528,32 @@ _tcp_free(void *tcp)
 static int 
 _initiate(void)
 {
+	int i;
 	char *f;
 	struct bpf_program bpf;
 
 	/* set stop signal */
 	signal(SIGINT, _sig_stop);
 
+	_g_threads = calloc(_g_nthread, sizeof(ssldump_thread_t));
+	if (!_g_threads)
+		ERR_RET(-1, "calloc threads failed: %s\n", ERRSTR);
+
+	for (i = 0; i < _g_nthread; i++)
+		if (_thread_init(&_g_threads[i], i, getpid() & 0xffff))
+			return -1;
+
+	/* live capture using mmaped ring */
+	if (!_g_infile[0] && _g_ringsize > 0)
+		goto out_ssl;
+
+	/* the pcap reader reassemble fragments before shard */
+	if (_g_nthread > 1) {
+		_g_frag = ip_frag_alloc(0, 0, 0, IP_FRAG_FIRST);
+		if (!_g_frag)
+			ERR_RET(-1, "ip_frag_alloc failed\n");
+	}
+
 	/* open device or file */
 	if (!_g_infile[0]) {
 		f = _g_intf;
@@ -201,7 +579,8 @@ _initiate(void)
 		pcap_freecode(&bpf);
 	}
 
-	/* create dssl_ctx */
+out_ssl:
+	/* create dssl_ctx, it's read only in threads */
 	_g_dssl_ctx = dssl_ctx_new();
 	if (!_g_dssl_ctx) 
 		ERR_RET(-1, "dssl_ctx_new failed\n");
@@ -210,9 +589,10 @@ _initiate(void)
 		if (dssl_ctx_load_pkey(_g_dssl_ctx, _g_keyfile, NULL))
 			ERR_RET(-1, "dssl_ctx_set_pkey failed\n");
 
-	_g_tcphash = shash_alloc(1000, tcp_tup_cmp, _tcp_free);
-	if (!_g_tcphash)
-		ERR_RET(-1, "shash_alloc failed\n");
+	/* the RSA key exchange is decrypted out of analysis threads */
+	if (dssl_ctx_start(_g_dssl_ctx, _g_keyfile[0] ? _g_nworker : 0, 
+			   _g_maxssn))
+		ERR_RET(-1, "dssl_ctx_start failed\n");
 
 	return 0;
 }
@@ -225,90 +605,297 @@ _initiate(void)
 static int 
 _release(void)
 {
+	int i;
+	ssldump_thread_t *t;
+
 	if (_g_pcap)
 		pcap_close(_g_pcap);
 
+	if (_g_frag) {
+		printf("reader:\n");
+		ip_frag_print(_g_frag, "\t");
+		ip_frag_free(_g_frag);
+		_g_frag = NULL;
+	}
+
+	if (!_g_threads)
+		goto out_ssl;
+
+	/* print in thread order, same in every run for file */
+	for (i = 0; i < _g_nthread; i++) {
+		t = &_g_threads[i];
+		printf("thread %d: npkt %llu, nbyte %llu, "
+		       "nstream %llu, ndrop %llu, nreasm %llu, nplain %llu\n", 
+		       i, (unsigned long long)t->stat.npkt,
+		       (unsigned long long)t->stat.nbyte,
+		       (unsigned long long)t->stat.nstream,
+		       (unsigned long long)t->stat.ndrop,
+		       (unsigned long long)t->stat.nreasm,
+		       (unsigned long long)t->stat.nplain);
+		printf("\tnclose %llu, nidle %llu, nhard %llu, "
+		       "nevict_flow %llu, nevict_mem %llu\n",
+		       (unsigned long long)t->stat.nclose,
+		       (unsigned long long)t->stat.nidle,
+		       (unsigned long long)t->stat.nhard,
+		       (unsigned long long)t->stat.nevict_flow,
+		       (unsigned long long)t->stat.nevict_mem);
+		_thread_free(t);
+	}
+
+	free(_g_threads);
+	_g_threads = NULL;
+
+out_ssl:
+	/* the sessions hold context, so it's freed after streams */
+	if (_g_dssl_ctx) {
+		printf("ssl:\n");
+		dssl_ctx_print(_g_dssl_ctx, "\t");
+		dssl_ctx_free(_g_dssl_ctx);
+		_g_dssl_ctx = NULL;
+	}
+
 	return 0;
 }
 
+/**
+ *	Delete stream @t from thread @thr and free it, the buffered
+ *	bytes are passed to callback before free.
+ *
+ *	No return.
+ */
+static void 
+_flow_del(ssldump_thread_t *thr, tcp_stream_t *t)
+{
+	flow_table_del(thr->flows, &t->key, t->hval);
+	CBLIST_DEL(&t->lru);
+	CBLIST_DEL(&t->age);
+
+	if (t->state != TCP_ST_CLOSE) {
+		tcp_reasm_flush(t->rctx, &t->reasm[0], t, 0);
+		tcp_reasm_flush(t->rctx, &t->reasm[1], t, 1);
+	}
+
+	/* the records kept for key exchange are decoded */
+	if (t->ssl) {
+		_tcp_data_flush(thr, t, 0);
+		_tcp_data_flush(thr, t, 1);
+	}
+
+	_tcp_free(t);
+}
+
+/**
+ *	Memory of streams in thread @thr, include buffered bytes.
+ *
+ *	Return the memory size.
+ */
+static inline size_t 
+_flow_mem(const ssldump_thread_t *thr)
+{
+	return (size_t)thr->flows->count * sizeof(tcp_stream_t) + 
+		thr->rctx.total;
+}
+
+/**
+ *	Age streams of thread @thr by time of latest packet. The lists
+ *	are sorted by time, only the expired heads are checked, so no
+ *	table scan.
+ *
+ *	No return.
+ */
+static void 
+_flow_expire(ssldump_thread_t *thr)
+{
+	u_int64_t idle;
+	u_int64_t hard;
+	tcp_stream_t *t;
+
+	idle = (u_int64_t)_g_idle * 1000000;
+	hard = (u_int64_t)_g_hard * 1000000;
+
+	while (idle && !CBLIST_IS_EMPTY(&thr->lru)) {
+		t = CBLIST_GET_HEAD(&thr->lru, tcp_stream_t *, lru);
+		if (t->last + idle > thr->now)
+			break;
+		thr->stat.nidle++;
+		_flow_del(thr, t);
+	}
+
+	while (hard && !CBLIST_IS_EMPTY(&thr->age)) {
+		t = CBLIST_GET_HEAD(&thr->age, tcp_stream_t *, age);
+		if (t->first + hard > thr->now)
+			break;
+		thr->stat.nhard++;
+		_flow_del(thr, t);
+	}
+}
+
+/**
+ *	Evict the least recently used streams of thread @thr until
+ *	it's under caps, the new stream need @nflow more slot.
+ *
+ *	No return.
+ */
+static void 
+_flow_evict(ssldump_thread_t *thr, u_int32_t nflow)
+{
+	tcp_stream_t *t;
+
+	while (!CBLIST_IS_EMPTY(&thr->lru)) {
+		t = CBLIST_GET_HEAD(&thr->lru, tcp_stream_t *, lru);
+		if (thr->flows->count + nflow > thr->maxflow)
+			thr->stat.nevict_flow++;
+		else if (_flow_mem(thr) + nflow * sizeof(tcp_stream_t) > 
+			 thr->maxmem)
+			thr->stat.nevict_mem++;
+		else
+			break;
+		_flow_del(thr, t);
+	}
+}
+
+/**
+ *	Decide bytes of TCP packet @pkt of stream @t written into file,
+ *	only the first -s payload bytes of stream are written, the
+ *	headers are always written.
+ *
+ *	No return.
+ */
+static void 
+_flow_snap(ssldump_thread_t *thr, tcp_stream_t *t, const netpkt_t *pkt)
+{
+	int len;
+	u_int64_t max;
+	const u_int8_t *data;
+
+	if (!thr->writer || _g_snaplen < 1)
+		return;
+
+	len = tcp_payload(pkt, &data);
+	if (len < 1)
+		return;
+
+	max = (u_int64_t)_g_snaplen << 10;
+	if (t->nsave + len <= max) {
+		t->nsave += len;
+		return;
+	}
+
+	len = t->nsave < max ? max - t->nsave : 0;
+	t->nsave += len;
+	thr->wlen = data - pkt->start + len;
+}
+
 static int 
-_decode_tcp(const netpkt_t *pkt)
+_decode_tcp(ssldump_thread_t *thr, const netpkt_t *pkt)
 {
 	int n;
-	int m;
 	int dir;
-	tcp_tup_t tup;
+	int kdir;
 	u_int32_t hval;
+	tcp_flow_key_t key;
 	struct tcphdr *h;
 	tcp_stream_t *t = NULL;
 
 	h = pkt->hdr4_tcp;
 
-	/* is server packet ? server packet must in hash */
-	dir = 1;
-	if (tcp_tup_init(&tup, pkt, dir))
-		ERR_RET(-1, "tup init failed\n");
-	if (tcp_tup_hash(&tup, &hval))
-		ERR_RET(-1, "tup hash failed\n");
-	t = shash_find(_g_tcphash, &tup, hval);
-	/* client packet */
-	if (!t) {
-		dir = 0;
-		if (tcp_tup_init(&tup, pkt, dir))
-			return -1;
-		if (tcp_tup_hash(&tup, &hval))
-			return -1;
-		t = shash_find(_g_tcphash, &tup, hval);
-	}
+	thr->stat.npkt++;
+	thr->stat.nbyte += pkt->tail - pkt->head;
+
+	/* the packet time drive aging, so offline file age correctly */
+	if (pkt->ts > thr->now)
+		thr->now = pkt->ts;
+	_flow_expire(thr);
+
+	/* one hash and one probe for both directions */
+	kdir = tcp_flow_key(pkt, &key, &hval);
+	if (kdir < 0)
+		ERR_RET(-1, "flow key failed\n");
+	t = flow_table_find(thr->flows, &key, hval);
 
 	/* already exist TCP stream, parse TCP flow */
 	if (t) {
-		printf("<%d>hval %u find stream (%p)\n", dir, hval, t);
+		/* 0 is client packet, 1 is server packet */
+		dir = kdir ^ t->kdir;
+		if (_g_verbose)
+			printf("<%d>hval %u find stream (%p)\n", dir, hval, t);
+		_flow_snap(thr, t, pkt);
 		n = tcp_stream_flow(t, pkt, dir);
-		if (n > 0) {
+		if (n > 0 && _g_verbose) {
 			printf("tcp flow return %d\n", n);
 		}
 
+		/* FIN or RST seen, free it now */
+		if (t->state == TCP_ST_CLOSE) {
+			thr->stat.nclose++;
+			_flow_del(thr, t);
+			return n;
+		}
+
+		/* move to tail of LRU list */
+		t->last = thr->now;
+		CBLIST_DEL(&t->lru);
+		CBLIST_ADD_TAIL(&thr->lru, &t->lru);
+
+		/* the buffered bytes may exceed memory cap */
+		_flow_evict(thr, 0);
+
 		return n;
 	}
 	else {	
 		/* new tcp stream */
 		if (h->syn && !h->ack && !h->fin && !h->psh && !h->rst) {
-			t = tcp_stream_alloc();
+			_flow_evict(thr, 1);
+			t = tcp_stream_alloc(&thr->rctx);
 			if (!t)
 				ERR_RET(-1, "tcp stream alloc failed\n");
 			t->state = TCP_ST_SYN;
 			t->seqacks[0].seq = ntohl(h->seq);
 			t->seqacks[0].ack = ntohl(h->seq) + 1;
-			if (tcp_tup_init((tcp_tup_t *)t, pkt, dir)) {
+			tcp_reasm_start(&t->reasm[0], ntohl(h->seq) + 1);
+			if (tcp_tup_init((tcp_tup_t *)t, pkt, 0)) {
 				tcp_stream_free(t);
 				ERR_RET(-1, "tcp_tup_init failed\n");
 			}
-			shash_add(_g_tcphash, t, hval, 0);
-			printf("<%d>hval %u add stream (%p)\n", dir, hval, t);
+			t->key = key;
+			t->hval = hval;
+			t->kdir = kdir;
+			if (flow_table_add(thr->flows, &key, hval, t)) {
+				tcp_stream_free(t);
+				ERR_RET(-1, "flow_table_add failed\n");
+			}
+			t->first = thr->now;
+			t->last = thr->now;
+			CBLIST_ADD_TAIL(&thr->lru, &t->lru);
+			CBLIST_ADD_TAIL(&thr->age, &t->age);
+			thr->stat.nstream++;
+
+			/* SSL is decoded only if private key is given */
+			if (_g_keyfile[0]) {
+				t->ssl = dssl_new(_g_dssl_ctx);
+				if (!t->ssl)
+					ERR("dssl_new failed\n");
+			}
+			if (_g_verbose)
+				printf("<0>hval %u add stream (%p)\n", 
+				       hval, t);
 		}
 	}
 
 	return -1;
 }
 
-static void 
-_decode(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes)
+/**
+ *	Decode layer 2-4 header of packet @pkt, the layer 4 header
+ *	of IP fragment is decoded after reassembly.
+ *
+ *	Return 0 if it's TCP packet, 1 if it's IP fragment, -1 if not.
+ */
+static int 
+_decode_hdr(netpkt_t *pkt)
 {
-	netpkt_t *pkt;
-	
-	pkt = netpkt_alloc(h->len);
-	if (!pkt) {
-		_g_stop = 1;
-		ERR("malloc failed: %s\n", ERRSTR);
-		return;
-	}
-
-	if (netpkt_add_data(pkt, bytes, h->len))
-		ERR("add data failed\n");
-
 	if (eth_decode(pkt)) 
-		exit(0);
+		return -1;
 	
 	//printf(">--------eth header--------<\n");
 	//eth_print(pkt, "\t");
@@ -317,52 +904,370 @@ _decode(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes)
 	switch (pkt->hdr3_type) {
 		case ETHERTYPE_IP:
 			if (ipv4_decode(pkt))
-				goto out_free;
+				return -1;
 			//printf(">--------ipv4 header--------<\n");
 			//ipv4_print(pkt, "\t");
 			break;
 		case ETHERTYPE_IPV6:
 			if (ipv6_decode(pkt))
-				goto out_free;
+				return -1;
 			//printf(">--------ipv6 header--------<\n");
 			//ipv6_print(pkt, "\t");
 			break;
 		default:
-			goto out_free;
+			return -1;
 	}
 
+	if (ip_frag_is_frag(pkt))
+		return 1;
+
 	/* layer 4 */
 	switch (pkt->hdr4_type) {
 		case IPPROTO_TCP:
 			if (tcp_decode(pkt))
-				goto out_free;
+				return -1;
 			//printf(">--------tcp header--------<\n");
 			//tcp_print(pkt, "\t");
 			break;
 		default:
-			goto out_free;
+			return -1;
 	}
 
-	_decode_tcp(pkt);
-	return;
+	return 0;
+}
+
+/**
+ *	Add fragment @pkt into @ctx, the TCP header of complete
+ *	datagram is decoded, it's linearized if TCP header is
+ *	not in first fragment.
+ *
+ *	Return the datagram if it's TCP, NULL if not.
+ */
+static netpkt_t * 
+_defrag(ip_frag_ctx_t *ctx, const netpkt_t *pkt)
+{
+	netpkt_t *dgram;
+	struct tcphdr *h;
+
+	dgram = ip_frag_add(ctx, pkt);
+	if (!dgram)
+		return NULL;
 
-out_free:
+	if (dgram->hdr4_type != IPPROTO_TCP ||
+	    netpkt_pullup(&dgram, sizeof(struct tcphdr)))
+		goto err_free;
 
-	if (pkt)
-		netpkt_free(pkt);
+	h = (struct tcphdr *)(dgram->head + dgram->hdr2_len + dgram->hdr3_len);
+	if (netpkt_pullup(&dgram, h->doff * 4) || tcp_decode(dgram))
+		goto err_free;
 
+	return dgram;
+
+err_free:
+	netpkt_free(dgram);
+	return NULL;
+}
+
+/**
+ *	Decode packet @pkt in thread @t, it's a view of pcap buffer 
+ *	or ring, the TCP stream keep a copy if need.
+ *
+ *	No return.
+ */
+static void 
+_decode(ssldump_thread_t *t, netpkt_t *pkt)
+{
+	int ret;
+	netpkt_t *dgram;
+
+	ret = _decode_hdr(pkt);
+	if (ret < 0)
+		return;
+
+	if (ret > 0) {
+		dgram = _defrag(t->frag, pkt);
+		if (dgram) {
+			_decode_tcp(t, dgram);
+			netpkt_free(dgram);
+		}
+		/* the fragment is written whole */
+		t->wlen = UINT32_MAX;
+		return;
+	}
+
+	_decode_tcp(t, pkt);
+}
+
+static void 
+_pcap_decode(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes)
+{
+	netpkt_t pkt;
+	pkt_frame_t f;
+	ssldump_thread_t *t;
+
+	t = (ssldump_thread_t *)user;
+
+	netpkt_init(&pkt, bytes, h->caplen);
+	pkt.tail = pkt.end;
+	pkt.ts = (u_int64_t)h->ts.tv_sec * 1000000 + h->ts.tv_usec;
+
+	t->wlen = UINT32_MAX;
+	_decode(t, &pkt);
+
+	if (t->writer) {
+		f.data = bytes;
+		f.caplen = h->caplen;
+		f.len = h->len;
+		f.ts = pkt.ts;
+		pcap_writer_write(t->writer, &f, t->wlen);
+	}
+}
+
+/**
+ *	The pcap reader decode packet and pass a copy of it to the
+ *	thread which own its flow. The reader wait the queue for
+ *	input file, and drop packet for live capture.
+ *
+ *	No return.
+ */
+static void 
+_pcap_shard(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes)
+{
+	int ret;
+	netpkt_t pkt;
+	netpkt_t *copy;
+	u_int32_t hval;
+	tcp_flow_key_t key;
+	ssldump_thread_t *t;
+
+	netpkt_init(&pkt, bytes, h->caplen);
+	pkt.tail = pkt.end;
+	pkt.ts = (u_int64_t)h->ts.tv_sec * 1000000 + h->ts.tv_usec;
+
+	ret = _decode_hdr(&pkt);
+	if (ret < 0)
+		return;
+
+	/* the ports are in first fragment, reassemble it before shard */
+	copy = NULL;
+	if (ret > 0) {
+		copy = _defrag(_g_frag, &pkt);
+		if (!copy)
+			return;
+	}
+
+	if (tcp_flow_key(copy ? copy : &pkt, &key, &hval) < 0) {
+		if (copy)
+			netpkt_free(copy);
+		return;
+	}
+
+	/* use high bits, the low bits index the flow table */
+	t = &_g_threads[((u_int64_t)hval * _g_nthread) >> 32];
+
+	if (!copy)
+		copy = netpkt_clone(&pkt);
+	if (!copy) {
+		t->stat.ndrop++;
+		return;
+	}
+
+	while (spsc_ring_enqueue(t->queue, &copy, 1) == 0) {
+		if (!_g_infile[0] || _g_stop) {
+			netpkt_free(copy);
+			t->stat.ndrop++;
+			return;
+		}
+		spsc_ring_notify(t->queue);
+		sched_yield();
+	}
+}
+
+/**
+ *	Decode a batch of ring frames into descriptors first, then
+ *	walk the descriptors, the fragment is decoded again for
+ *	reassembly.
+ *
+ *	No return.
+ */
+static void 
+_ring_batch(const pkt_frame_t *frames, int n, void *arg)
+{
+	int i;
+	netpkt_t pkt;
+	ssldump_thread_t *t;
+	pkt_desc_t descs[PKT_BATCH];
+
+	t = arg;
+	pkt_decode_batch(frames, descs, n);
+
+	for (i = 0; i < n; i++) {
+		t->wlen = UINT32_MAX;
+		if (likely(descs[i].flags & PKT_F_TCP)) {
+			pkt_desc_netpkt(&descs[i], &frames[i], &pkt);
+			_decode_tcp(t, &pkt);
+		}
+		else if (descs[i].flags & PKT_F_FRAG) {
+			netpkt_init(&pkt, frames[i].data, frames[i].caplen);
+			pkt.tail = pkt.end;
+			pkt.ts = frames[i].ts;
+			_decode(t, &pkt);
+		}
+
+		if (t->writer)
+			pcap_writer_write(t->writer, &frames[i], t->wlen);
+	}
+}
+
+/**
+ *	Write packet @pkt passed by pcap reader into file of thread
+ *	@t, the wire length is not kept in copy.
+ *
+ *	No return.
+ */
+static void 
+_write_pkt(ssldump_thread_t *t, const netpkt_t *pkt)
+{
+	pkt_frame_t f;
+
+	f.data = pkt->start;
+	f.caplen = pkt->end - pkt->start;
+	f.len = f.caplen;
+	f.ts = pkt->ts;
+	pcap_writer_write(t->writer, &f, t->wlen);
+}
+
+/**
+ *	Bind analysis thread @t to a CPU.
+ *
+ * 	No return.
+ */
+static void 
+_thread_bind(ssldump_thread_t *t)
+{
+	int ncpu;
+	cpu_set_t mask;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu < 2)
+		return;
+
+	CPU_ZERO(&mask);
+	CPU_SET(t->index % ncpu, &mask);
+	if (pthread_setaffinity_np(t->tid, sizeof(mask), &mask))
+		ERR("bind thread %d to cpu %d failed\n", t->index, 
+		    t->index % ncpu);
+}
+
+/**
+ *	The main loop of analysis thread @arg.
+ *
+ * 	Return NULL always.
+ */
+static void * 
+_thread_run(void *arg)
+{
+	int i;
+	int n;
+	netpkt_t *pkts[_QUEUE_BATCH];
+	ssldump_thread_t *t;
+
+	t = arg;
+
+	/* read own ring of fanout group */
+	if (t->ring) {
+		while (!_g_stop)
+			if (netring_dispatch_batch(t->ring, 100, 
+						   _ring_batch, t) < 0)
+				break;
+		return NULL;
+	}
+
+	/* read queue until pcap reader finished and queue is empty */
+	while (1) {
+		n = spsc_ring_dequeue(t->queue, pkts, _QUEUE_BATCH);
+		if (n == 0) {
+			if (__atomic_load_n(&_g_eof, __ATOMIC_ACQUIRE) &&
+			    spsc_ring_count(t->queue) == 0)
+				break;
+			spsc_ring_wait(t->queue, 100);
+			continue;
+		}
+
+		for (i = 0; i < n; i++) {
+			t->wlen = UINT32_MAX;
+			_decode_tcp(t, pkts[i]);
+			if (t->writer)
+				_write_pkt(t, pkts[i]);
+			netpkt_free(pkts[i]);
+		}
+	}
+
+	return NULL;
 }
 
 static int 
 _process(void)
 {
+	int i;
 	int ret;
-	
+	int nrun;
+	ssldump_thread_t *t;
+
+	/* single thread, decode in main thread */
+	if (_g_nthread == 1) {
+		t = &_g_threads[0];
+		while (!_g_stop) {
+			if (t->ring)
+				ret = netring_dispatch_batch(t->ring, 100, 
+							     _ring_batch, t);
+			else
+				ret = pcap_dispatch(_g_pcap, _PCAP_BATCH, 
+						    _pcap_decode, (u_char *)t);
+			if (ret < 0)
+				break;
+			/* end of input file */
+			if (ret == 0 && _g_infile[0])
+				break;
+		}
+		return 0;
+	}
+
+	for (nrun = 0; nrun < _g_nthread; nrun++) {
+		t = &_g_threads[nrun];
+		if (pthread_create(&t->tid, NULL, _thread_run, t)) {
+			ERR("create thread %d failed: %s\n", nrun, ERRSTR);
+			_g_stop = 1;
+			break;
+		}
+		_thread_bind(t);
+	}
+
+	/* main thread is pcap reader, or wait stop for ring */
 	while (!_g_stop) {
-		ret = pcap_dispatch(_g_pcap, 1, _decode, NULL);
+		if (!_g_pcap) {
+			usleep(100000);
+			continue;
+		}
+
+		ret = pcap_dispatch(_g_pcap, _PCAP_BATCH, _pcap_shard, NULL);
+		for (i = 0; i < _g_nthread; i++)
+			spsc_ring_notify(_g_threads[i].queue);
 		if (ret < 0)
 			break;
+		/* end of input file */
+		if (ret == 0 && _g_infile[0])
+			break;
 	}
+
+	__atomic_store_n(&_g_eof, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < nrun; i++) {
+		t = &_g_threads[i];
+		if (t->queue)
+			spsc_ring_notify(t->queue);
+		pthread_join(t->tid, NULL);
+	}
+
 	return 0;
 }
 
@@ -0,0 +1,479 @@
+/**
+ *	@file	tcp_reasm.c
+ *
+ *	@brief	TCP reassembly implement.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gcc_common.h"
+#include "dbg_common.h"
+
+#include "tcp_reasm.h"
+
+/* _tcp_insert() return value when cap reached */
+#define	_REASM_FLOW_FULL	-2
+#define	_REASM_TOTAL_FULL	-3
+
+/**
+ *	Alloc a segment for @data which length is @len, the memory
+ *	is counted in @r and @ctx.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+static tcp_seg_t * 
+_tcp_seg_alloc(tcp_reasm_ctx_t *ctx, tcp_reasm_t *r, u_int32_t seq,
+	       const u_int8_t *data, u_int32_t len)
+{
+	tcp_seg_t *seg;
+
+	seg = malloc(sizeof(tcp_seg_t) + len);
+	if (!seg)
+		ERR_RET(NULL, "malloc segment failed: %s\n", ERRSTR);
+
+	CBLIST_INIT(&seg->list);
+	seg->seq = seq;
+	seg->len = len;
+	seg->off = 0;
+	seg->size = len;
+	memcpy(seg->buf, data, len);
+
+	r->nbyte += len;
+	r->nseg++;
+	ctx->total += len;
+
+	return seg;
+}
+
+/**
+ *	Free segment @seg in @r.
+ *
+ *	No return.
+ */
+static void 
+_tcp_seg_free(tcp_reasm_ctx_t *ctx, tcp_reasm_t *r, tcp_seg_t *seg)
+{
+	CBLIST_DEL(&seg->list);
+
+	r->nbyte -= seg->size;
+	r->nseg--;
+	ctx->total -= seg->size;
+
+	free(seg);
+}
+
+/**
+ *	Add @seg after @prev in @r, @prev is NULL means head.
+ *
+ *	No return.
+ */
+static void 
+_tcp_seg_link(tcp_reasm_t *r, tcp_seg_t *prev, tcp_seg_t *seg)
+{
+	cblist_t *pos;
+
+	pos = prev ? &prev->list : &r->segs;
+	CBLIST_ADD_HEAD(pos, &seg->list);
+}
+
+/**
+ *	Pass @len bytes @data to callback, the @r->next is moved.
+ *
+ *	Return @len.
+ */
+static int 
+_tcp_deliver(tcp_reasm_ctx_t *ctx, tcp_reasm_t *r, void *owner, int dir,
+	     const u_int8_t *data, u_int32_t len)
+{
+	if (len == 0)
+		return 0;
+
+	if (ctx->func)
+		ctx->func(owner, dir, data, len, ctx->arg);
+
+	r->next += len;
+	ctx->stat.nbyte += len;
+
+	return len;
+}
+
+/**
+ *	Pass the buffered segments which continue with @r->next to
+ *	callback and free them.
+ *
+ *	Return bytes passed.
+ */
+static int 
+_tcp_drain(tcp_reasm_ctx_t *ctx, tcp_reasm_t *r, void *owner, int dir)
+{
+	int n = 0;
+	u_int32_t skip;
+	tcp_seg_t *seg;
+
+	while ((seg = CBLIST_GET_HEAD(&r->segs, tcp_seg_t *, list))) {
+		if (TCP_SEQ_GT(seg->seq, r->next))
+			break;
+
+		/* the head of segment maybe passed already */
+		skip = r->next - seg->seq;
+		if (skip < seg->len) {
+			ctx->stat.noverlap += skip;
+			n += _tcp_deliver(ctx, r, owner, dir,
+					  seg->buf + seg->off + skip,
+					  seg->len - skip);
+		}
+		else
+			ctx->stat.noverlap += seg->len;
+
+		_tcp_seg_free(ctx, r, seg);
+	}
+
+	return n;
+}
+
+/**
+ *	Insert bytes [@seq, @seq + @len) after @r->next into @r,
+ *	the old bytes are kept when overlapped.
+ *
+ *	Return 0 if success, < 0 on error.
+ */
+static int 
+_tcp_insert_first(tcp_reasm_ctx_t *ctx, tcp_reasm_t *r, u_int32_t seq,
+		  const u_int8_t *data, u_int32_t len)
+{
+	u_int32_t end;
+	u_int32_t send;
+	u_int32_t n;
+	tcp_seg_t *s, *b;
+	tcp_seg_t *prev;
+	tcp_seg_t *seg;
+
+	end = seq + len;
+
+	/* append to tail is the common case */
+	prev = CBLIST_GET_TAIL(&r->segs, tcp_seg_t *, list);
+	if (prev && TCP_SEQ_LEQ(prev->seq + prev->len, seq))
+		goto out_link;
+
+	/* fill the holes only */
+	prev = NULL;
+	CBLIST_FOR_EACH_SAFE(&r->segs, s, b, list) {
+		send = s->seq + s->len;
+		if (TCP_SEQ_LEQ(send, seq)) {
+			prev = s;
+			continue;
+		}
+		if (TCP_SEQ_GEQ(s->seq, end))
+			break;
+
+		/* bytes before @s */
+		if (TCP_SEQ_LT(seq, s->seq)) {
+			n = s->seq - seq;
+			seg = _tcp_seg_alloc(ctx, r, seq, data, n);
+			if (!seg)
+				return -1;
+			_tcp_seg_link(r, prev, seg);
+			seq += n;
+			data += n;
+		}
+
+		/* bytes overlapped with @s */
+		n = (TCP_SEQ_LT(end, send) ? end : send) - seq;
+		ctx->stat.noverlap += n;
+		seq += n;
+		data += n;
+		if (seq == end)
+			return 0;
+		prev = s;
+	}
+
+out_link:
+	seg = _tcp_seg_alloc(ctx, r, seq, data, end - seq);
+	if (!seg)
+		return -1;
+	_tcp_seg_link(r, prev, seg);
+
+	return 0;
+}
+
+/**
+ *	Insert bytes [@seq, @seq + @len) after @r->next into @r,
+ *	the old bytes are overwritten when overlapped.
+ *
+ *	Return 0 if success, < 0 on error.
+ */
+static int 
+_tcp_insert_last(tcp_reasm_ctx_t *ctx, tcp_reasm_t *r, u_int32_t seq,
+		 const u_int8_t *data, u_int32_t len)
+{
+	u_int32_t end;
+	u_int32_t send;
+	u_int32_t n;
+	tcp_seg_t *s, *b;
+	tcp_seg_t *prev;
+	tcp_seg_t *seg;
+	tcp_seg_t *tail;
+
+	end = seq + len;
+	seg = _tcp_seg_alloc(ctx, r, seq, data, len);
+	if (!seg)
+		return -1;
+
+	prev = NULL;
+	CBLIST_FOR_EACH_SAFE(&r->segs, s, b, list) {
+		send = s->seq + s->len;
+		if (TCP_SEQ_LEQ(send, seq)) {
+			prev = s;
+			continue;
+		}
+		if (TCP_SEQ_GEQ(s->seq, end))
+			break;
+
+		/* @s cover head of new bytes, keep head of @s */
+		if (TCP_SEQ_LT(s->seq, seq)) {
+			/* and cover the tail, split @s */
+			if (TCP_SEQ_GT(send, end)) {
+				n = send - end;
+				tail = _tcp_seg_alloc(ctx, r, end,
+					s->buf + s->off + (end - s->seq), n);
+				if (!tail) {
+					_tcp_seg_free(ctx, r, seg);
+					return -1;
+				}
+				_tcp_seg_link(r, s, tail);
+				b = tail;
+				ctx->stat.noverlap += len;
+			}
+			else
+				ctx->stat.noverlap += send - seq;
+			s->len = seq - s->seq;
+			prev = s;
+			continue;
+		}
+
+		/* @s is covered */
+		if (TCP_SEQ_LEQ(send, end)) {
+			ctx->stat.noverlap += s->len;
+			_tcp_seg_free(ctx, r, s);
+			continue;
+		}
+
+		/* @s cover tail of new bytes, cut head of @s */
+		n = end - s->seq;
+		ctx->stat.noverlap += n;
+		s->seq += n;
+		s->off += n;
+		s->len -= n;
+		break;
+	}
+
+	_tcp_seg_link(r, prev, seg);
+
+	return 0;
+}
+
+/**
+ *	Insert out of order bytes [@seq, @seq + @len) into @r.
+ *
+ *	Return 0 if success, < 0 on error.
+ */
+static int 
+_tcp_insert(tcp_reasm_ctx_t *ctx, tcp_reasm_t *r, u_int32_t seq,
+	    const u_int8_t *data, u_int32_t len)
+{
+	if (r->nbyte + len > ctx->maxflow)
+		return _REASM_FLOW_FULL;
+
+	if (ctx->total + len > ctx->maxtotal)
+		return _REASM_TOTAL_FULL;
+
+	if (ctx->policy == TCP_OVERLAP_LAST)
+		return _tcp_insert_last(ctx, r, seq, data, len);
+
+	return _tcp_insert_first(ctx, r, seq, data, len);
+}
+
+void 
+tcp_reasm_ctx_init(tcp_reasm_ctx_t *ctx, size_t maxflow, size_t maxtotal,
+		   tcp_reasm_func func, void *arg)
+{
+	if (unlikely(!ctx))
+		return;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->maxflow = maxflow ? maxflow : TCP_REASM_MAXFLOW;
+	ctx->maxtotal = maxtotal ? maxtotal : TCP_REASM_MAXTOTAL;
+	ctx->policy = TCP_OVERLAP_FIRST;
+	ctx->func = func;
+	ctx->arg = arg;
+}
+
+void 
+tcp_reasm_init(tcp_reasm_t *r)
+{
+	if (unlikely(!r))
+		return;
+
+	memset(r, 0, sizeof(*r));
+	CBLIST_INIT(&r->segs);
+}
+
+void 
+tcp_reasm_start(tcp_reasm_t *r, u_int32_t seq)
+{
+	if (unlikely(!r))
+		return;
+
+	r->next = seq;
+	r->init = 1;
+}
+
+int 
+tcp_reasm_add(tcp_reasm_ctx_t *ctx, tcp_reasm_t *r, void *owner, int dir,
+	      u_int32_t seq, const u_int8_t *data, size_t len)
+{
+	int n;
+	int ret;
+	u_int32_t end;
+	u_int32_t cut;
+	tcp_seg_t *seg;
+
+	if (unlikely(!ctx || !r || !data))
+		ERR_RET(-1, "invalid argument\n");
+
+	if (len == 0)
+		return 0;
+
+	ctx->stat.nseg++;
+
+	/* capture started in middle of stream */
+	if (!r->init)
+		tcp_reasm_start(r, seq);
+
+	/* all bytes are passed */
+	end = seq + len;
+	if (TCP_SEQ_LEQ(end, r->next)) {
+		ctx->stat.nretrans++;
+		return 0;
+	}
+
+	/* cut the passed bytes */
+	if (TCP_SEQ_LT(seq, r->next)) {
+		cut = r->next - seq;
+		ctx->stat.noverlap += cut;
+		seq += cut;
+		data += cut;
+		len -= cut;
+	}
+
+	n = 0;
+	if (seq == r->next) {
+		/* in order, pass in place. The buffered bytes is kept
+		 * if policy is first */
+		cut = len;
+		seg = CBLIST_GET_HEAD(&r->segs, tcp_seg_t *, list);
+		if (ctx->policy == TCP_OVERLAP_FIRST && seg &&
+		    TCP_SEQ_LT(seg->seq, end))
+			cut = seg->seq - seq;
+
+		ctx->stat.ninplace++;
+		n = _tcp_deliver(ctx, r, owner, dir, data, cut);
+		seq += cut;
+		data += cut;
+		len -= cut;
+		if (len == 0)
+			return n + _tcp_drain(ctx, r, owner, dir);
+	}
+	else
+		ctx->stat.nooo++;
+
+	while (1) {
+		ret = _tcp_insert(ctx, r, seq, data, len);
+		if (ret == 0)
+			break;
+
+		if (ret == _REASM_TOTAL_FULL) {
+			ctx->stat.ndrop_total++;
+			return n ? n : -1;
+		}
+
+		if (ret != _REASM_FLOW_FULL || r->nseg == 0) {
+			ctx->stat.ndrop_flow++;
+			return n ? n : -1;
+		}
+
+		/* flow buffer is full, skip the holes and retry */
+		n += tcp_reasm_flush(ctx, r, owner, dir);
+		if (TCP_SEQ_LEQ(end, r->next))
+			return n;
+		if (TCP_SEQ_LT(seq, r->next)) {
+			cut = r->next - seq;
+			seq += cut;
+			data += cut;
+			len -= cut;
+		}
+		if (seq == r->next)
+			return n + _tcp_deliver(ctx, r, owner, dir, data, len);
+	}
+
+	return n + _tcp_drain(ctx, r, owner, dir);
+}
+
+int 
+tcp_reasm_flush(tcp_reasm_ctx_t *ctx, tcp_reasm_t *r, void *owner, int dir)
+{
+	int n = 0;
+	tcp_seg_t *seg;
+
+	if (unlikely(!ctx || !r))
+		ERR_RET(-1, "invalid argument\n");
+
+	while ((seg = CBLIST_GET_HEAD(&r->segs, tcp_seg_t *, list))) {
+		if (TCP_SEQ_GT(seg->seq, r->next)) {
+			ctx->stat.ngap++;
+			r->next = seg->seq;
+		}
+		n += _tcp_drain(ctx, r, owner, dir);
+	}
+
+	return n;
+}
+
+void 
+tcp_reasm_free(tcp_reasm_ctx_t *ctx, tcp_reasm_t *r)
+{
+	tcp_seg_t *seg, *bak;
+
+	if (unlikely(!ctx || !r))
+		return;
+
+	CBLIST_FOR_EACH_SAFE(&r->segs, seg, bak, list)
+		_tcp_seg_free(ctx, r, seg);
+}
+
+void 
+tcp_reasm_print(const tcp_reasm_ctx_t *ctx, const char *prefix)
+{
+	const tcp_reasm_stat_t *st;
+
+	if (unlikely(!ctx || !prefix))
+		return;
+
+	st = &ctx->stat;
+	printf("%stotal:       %lu\n", prefix, (unsigned long)ctx->total);
+	printf("%snseg:        %llu\n", prefix, (unsigned long long)st->nseg);
+	printf("%sninplace:    %llu\n", prefix, (unsigned long long)st->ninplace);
+	printf("%snooo:        %llu\n", prefix, (unsigned long long)st->nooo);
+	printf("%snretrans:    %llu\n", prefix, (unsigned long long)st->nretrans);
+	printf("%snoverlap:    %llu\n", prefix, (unsigned long long)st->noverlap);
+	printf("%sngap:        %llu\n", prefix, (unsigned long long)st->ngap);
+	printf("%sndrop_flow:  %llu\n", prefix, (unsigned long long)st->ndrop_flow);
+	printf("%sndrop_total: %llu\n", prefix, (unsigned long long)st->ndrop_total);
+	printf("%snbyte:       %llu\n", prefix, (unsigned long long)st->nbyte);
+}
+
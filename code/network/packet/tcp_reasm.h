@@ -0,0 +1,162 @@
+/**
+ *	@file	tcp_reasm.h
+ *
+ *	@brief	TCP stream reassembly of one direction. The segment
+ *		in order is passed to callback in place(the capture
+ *		buffer), only the out of order bytes are copied and
+ *		kept in a list sorted by sequence. The overlapped
+ *		bytes are resolved by policy, the buffered bytes are
+ *		limited by flow cap and total cap of context.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#ifndef FZ_TCP_REASM_H
+#define FZ_TCP_REASM_H
+
+#include <sys/types.h>
+
+#include "cblist.h"
+
+/* sequence compare, wraparound safe */
+#define	TCP_SEQ_LT(a, b)	((int32_t)((u_int32_t)(a) - (u_int32_t)(b)) < 0)
+#define	TCP_SEQ_LEQ(a, b)	((int32_t)((u_int32_t)(a) - (u_int32_t)(b)) <= 0)
+#define	TCP_SEQ_GT(a, b)	TCP_SEQ_LT(b, a)
+#define	TCP_SEQ_GEQ(a, b)	TCP_SEQ_LEQ(b, a)
+
+#define	TCP_REASM_MAXFLOW	(1024 * 1024)		/* default flow cap */
+#define	TCP_REASM_MAXTOTAL	(256 * 1024 * 1024)	/* default total cap */
+
+/**
+ *	Overlap policy.
+ */
+enum {
+	TCP_OVERLAP_FIRST,		/* keep the bytes arrived first */
+	TCP_OVERLAP_LAST,		/* the new bytes overwrite old */
+};
+
+/**
+ *	The callback of reassembled data, @owner and @dir are passed
+ *	to tcp_reasm_add(), the @data is only valid in callback.
+ */
+typedef void (*tcp_reasm_func)(void *owner, int dir, const u_int8_t *data,
+			       size_t len, void *arg);
+
+/**
+ *	Reassembly statistic data.
+ */
+typedef struct tcp_reasm_stat {
+	u_int64_t	nseg;		/* segments have data */
+	u_int64_t	ninplace;	/* segments passed in place */
+	u_int64_t	nooo;		/* segments buffered out of order */
+	u_int64_t	nretrans;	/* segments all bytes passed already */
+	u_int64_t	noverlap;	/* overlapped bytes */
+	u_int64_t	ngap;		/* holes skipped */
+	u_int64_t	ndrop_flow;	/* segments dropped by flow cap */
+	u_int64_t	ndrop_total;	/* segments dropped by total cap */
+	u_int64_t	nbyte;		/* bytes passed to callback */
+} tcp_reasm_stat_t;
+
+/**
+ *	Reassembly context, shared by streams in same thread.
+ */
+typedef struct tcp_reasm_ctx {
+	size_t		maxflow;	/* max buffered bytes of direction */
+	size_t		maxtotal;	/* max buffered bytes of context */
+	size_t		total;		/* buffered bytes of context */
+	int		policy;		/* overlap policy */
+	tcp_reasm_func	func;		/* data callback */
+	void		*arg;		/* callback argument */
+	tcp_reasm_stat_t stat;		/* statistic data */
+} tcp_reasm_ctx_t;
+
+/**
+ *	Out of order segment.
+ */
+typedef struct tcp_seg {
+	cblist_t	list;		/* list in tcp_reasm_t @segs */
+	u_int32_t	seq;		/* sequence of first byte */
+	u_int32_t	len;		/* data length */
+	u_int32_t	off;		/* data offset in @buf */
+	u_int32_t	size;		/* size of @buf */
+	u_int8_t	buf[0];		/* data buffer */
+} tcp_seg_t;
+
+/**
+ *	Reassembly state of one direction.
+ */
+typedef struct tcp_reasm {
+	cblist_t	segs;		/* segments sorted by seq */
+	u_int32_t	next;		/* next sequence expected */
+	u_int32_t	nbyte;		/* buffered bytes */
+	u_int32_t	nseg;		/* buffered segments */
+	int		init;		/* @next is valid */
+} tcp_reasm_t;
+
+/**
+ *	Init context @ctx, @maxflow/@maxtotal is the flow/total cap,
+ *	0 is default, the reassembled data is passed to @func.
+ *
+ *	No return.
+ */
+extern void 
+tcp_reasm_ctx_init(tcp_reasm_ctx_t *ctx, size_t maxflow, size_t maxtotal,
+		   tcp_reasm_func func, void *arg);
+
+/**
+ *	Init reassembly state @r.
+ *
+ *	No return.
+ */
+extern void 
+tcp_reasm_init(tcp_reasm_t *r);
+
+/**
+ *	Set the first sequence @seq of data in @r, the SYN is not
+ *	included.
+ *
+ *	No return.
+ */
+extern void 
+tcp_reasm_start(tcp_reasm_t *r, u_int32_t seq);
+
+/**
+ *	Add segment @data which length is @len, sequence is @seq into
+ *	@r. The data in order is passed to callback with @owner and
+ *	@dir. If @r is not started, it start from @seq.
+ *
+ *	Return bytes passed to callback, -1 if segment dropped.
+ */
+extern int 
+tcp_reasm_add(tcp_reasm_ctx_t *ctx, tcp_reasm_t *r, void *owner, int dir,
+	      u_int32_t seq, const u_int8_t *data, size_t len);
+
+/**
+ *	Pass all buffered bytes in @r to callback, the holes are
+ *	skipped. It's called when stream closed or buffer is full.
+ *
+ *	Return bytes passed to callback.
+ */
+extern int 
+tcp_reasm_flush(tcp_reasm_ctx_t *ctx, tcp_reasm_t *r, void *owner, int dir);
+
+/**
+ *	Free all buffered segments in @r.
+ *
+ *	No return.
+ */
+extern void 
+tcp_reasm_free(tcp_reasm_ctx_t *ctx, tcp_reasm_t *r);
+
+/**
+ *	Print the statistic data of @ctx.
+ *
+ *	No return.
+ */
+extern void 
+tcp_reasm_print(const tcp_reasm_ctx_t *ctx, const char *prefix);
+
+#endif /* end of FZ_TCP_REASM_H */
+
@@ -25,194 +25,13 @@ _tcp_check_seq(tcp_stream_t *t, struct tcphdr *h, int dir)
 	if (sa->seq == 0)
 		return 0;
 
-	/* sequence out of range */
-	if (ntohl(h->seq) <= sa->seq)
+	/* sequence out of range, the SYN is retransmitted */
+	if (TCP_SEQ_LEQ(ntohl(h->seq), sa->seq))
 		return -1;
 
 	return 0;
 }
 
-static int 
-_tcp_pktq_init(tcp_pktq_t *q, int max)
-{
-	tcp_pkt_t *ptr;
-	
-	ptr = realloc(q->pkts, max * sizeof(tcp_pkt_t));
-	if (!ptr)
-		return -1;
-
-	if (q->pkts && q->pkts != ptr)
-		free(q->pkts);
-
-	q->pkts = ptr;
-	return 0;
-}
-
-static void  
-_tcp_pktq_free(tcp_pktq_t *q)
-{
-	int i;
-	netpkt_t *pkt;
-
-	if (!q)
-		return;
-
-	for (i = 0; i < q->npkt; i++) {
-		pkt = q->pkts[i].pkt;
-		if (pkt)
-			free(pkt);
-	}
-
-	if (q->pkts)
-		free(q->pkts);
-}
-
-static int 
-_tcp_pktq_find_pos(tcp_pktq_t *q, u_int32_t seq, u_int32_t size)
-{
-	int l, h, m;
-	tcp_pkt_t *pkt;
-
-	if (q->npkt == 0)
-		return 0;
-
-	l = 0;
-	h = q->npkt;
-	while (1) {
-		m = (l + h) / 2;
-		pkt = &q->pkts[m];
-		/* after @pkt */
-		if (seq > pkt->seq) {
-			/* data overlap, drop it */
-			if (seq < (pkt->seq + pkt->len))
-				return -1;
-			l = m + 1;
-		}
-		/* before @pkt */
-		else if (seq < pkt->seq) {
-			/* data overlap, drop it */
-			if ((seq + size) > pkt->seq)
-				return -1;
-			h = m - 1;
-		}
-		/* seq is same as @pkt, drop packet */
-		else
-			return -1;
-		/* find correct pos */
-		if (l == h)
-			return l;
-	}
-
-	return -1;
-}
-
-static int 
-_tcp_pktq_add(tcp_pktq_t *q, const netpkt_t *pkt)
-{
-	int n;
-	int m;
-	int pos;
-	int size;
-	u_int32_t seq;
-	tcp_pkt_t *tp;
-
-	n = pkt->tail - pkt->head;
-	m = pkt->hdr2_len + pkt->hdr3_len + pkt->hdr4_len;
-
-	size = (n - m);
-
-	if (size < 0)
-		return -1;
-	else if (size == 0)
-		return 0;
-	
-	if (q->npkt >= TCP_PKTQ_MAX)
-		ERR_RET(-1, "too many pkt in frag\n");
-
-	/* increase @q->pkts to store new @pkt */
-	if (q->npkt == q->max && _tcp_pktq_init(q, q->max + TCP_PKTQ_INC))
-		return -1;
-
-	/* get pos which @pkt need insert */
-	seq = ntohl(pkt->hdr4_tcp->seq);
-	pos = _tcp_pktq_find_pos(q, seq, size);
-	/* drop packet */
-	if (pos < 0)
-		return -1;
-
-	tp = &q->pkts[pos];
-
-	/* insert packet into correct pos */
-	m = (q->npkt - pos) * sizeof(tcp_pkt_t);
-	if (m > 0)
-		memmove(tp + 1, tp, m);
-
-	/* set packet value */
-	tp->seq = seq;
-	tp->len = size;
-	tp->pkt = (netpkt_t *)pkt;
-
-	/* check data in sequence */
-	if (q->first_seq == seq) {
-		q->nassembly++;
-		q->len += size;
-		q->first_seq = seq + size;
-	}
-
-	return q->len;
-}
-
-static int 
-_tcp_pktq_get_data(tcp_pktq_t *q, u_int8_t *buf, size_t size)
-{
-	int i;
-	int m;
-	int n;
-	int pos;
-	int off;
-	int len;
-	int nfree;
-	netpkt_t *pkt;
-	u_int8_t *data;
-
-	nfree = 0;
-	pos = 0;
-	m = size;
-	for (i = 0; i < q->nassembly; i++) {
-		pkt = q->pkts[i].pkt;
-		off = q->pkts[i].off;
-		len = q->pkts[i].len - off;
-		if (!pkt)
-			return -1;
-		n = m > len ? len : m;
-		data = pkt->head + NETPKT_HLEN(pkt) + off;
-		memcpy(buf + pos, data, n);
-		pos += len;
-		m -= n;
-		if (m == 0) {
-			if (n == len)
-				nfree++;
-			else
-				q->pkts[i].off += n;
-			break;
-		}
-		nfree++;
-	}
-
-	/* free netpkt and clear all unused slot in q->pkts */
-	if (nfree > 0) {
-		for (i = 0; i < nfree; i++)
-			free(q->pkts[i].pkt);
-		m = (q->npkt - nfree) * sizeof(tcp_pkt_t);
-		if (m > 0)
-			memmove(q->pkts, &q->pkts[nfree], m);
-		q->npkt -= nfree;
-		q->nassembly -= nfree;
-	}
-
-	return size;
-}
-
 int 
 tcp_tup_init(tcp_tup_t *tup, const netpkt_t *pkt, int dir)
 {
@@ -290,6 +109,82 @@ tcp_tup_hash(tcp_tup_t *tup, u_int32_t *hval)
 	return 0;
 }
 
+int 
+tcp_flow_key(const netpkt_t *pkt, tcp_flow_key_t *key, u_int32_t *hval)
+{
+	int dir;
+	int alen;
+	int cmp;
+	u_int32_t a, b;
+	u_int32_t ports;
+	u_int32_t w[8];
+	u_int16_t sport, dport;
+	const u_int8_t *saddr, *daddr;
+	u_int8_t *p;
+
+	if (unlikely(!pkt || !key || !hval))
+		return -1;
+
+	/* TCP and UDP header begin with the ports */
+	if (unlikely(!pkt->hdr4_tcp))
+		return -1;
+
+	if (pkt->hdr3_type == ETHERTYPE_IP) {
+		saddr = (const u_int8_t *)&pkt->hdr3_ipv4->saddr;
+		daddr = (const u_int8_t *)&pkt->hdr3_ipv4->daddr;
+		alen = 4;
+	}
+	else if (pkt->hdr3_type == ETHERTYPE_IPV6) {
+		saddr = pkt->hdr3_ipv6->ip6_src.s6_addr;
+		daddr = pkt->hdr3_ipv6->ip6_dst.s6_addr;
+		alen = 16;
+	}
+	else
+		return -1;
+
+	sport = ntohs(pkt->hdr4_tcp->source);
+	dport = ntohs(pkt->hdr4_tcp->dest);
+
+	/* the smaller endpoint first */
+	cmp = memcmp(saddr, daddr, alen);
+	if (cmp == 0)
+		cmp = (int)sport - (int)dport;
+	dir = cmp > 0 ? 1 : 0;
+
+	p = key->data;
+	if (dir) {
+		memcpy(p, daddr, alen);
+		memcpy(p + alen, saddr, alen);
+		ports = ((u_int32_t)dport << 16) | sport;
+	}
+	else {
+		memcpy(p, saddr, alen);
+		memcpy(p + alen, daddr, alen);
+		ports = ((u_int32_t)sport << 16) | dport;
+	}
+	p += alen * 2;
+	p[0] = ports >> 24;
+	p[1] = ports >> 16;
+	p[2] = ports >> 8;
+	p[3] = ports;
+	p[4] = pkt->hdr4_type;
+	key->len = alen * 2 + 5;
+
+	/* hash the key, not the packet, so it's symmetric */
+	memcpy(w, key->data, alen * 2);
+	if (alen == 4) {
+		a = w[0];
+		b = w[1];
+	}
+	else {
+		a = jhash_3words(w[0] ^ w[1], w[2], w[3]);
+		b = jhash_3words(w[4] ^ w[5], w[6], w[7]);
+	}
+	*hval = jhash_3words(a, b, ports ^ ((u_int32_t)pkt->hdr4_type << 24));
+
+	return dir;
+}
+
 int 
 tcp_tup_cmp(const void *tcp1, const void *tcp2)
 {
@@ -329,15 +224,24 @@ tcp_tup_to_str(const tcp_tup_t *tup, char *buf, size_t len)
 }
 
 tcp_stream_t * 
-tcp_stream_alloc(void)
+tcp_stream_alloc(tcp_reasm_ctx_t *rctx)
 {
 	tcp_stream_t *t;
 
+	if (unlikely(!rctx))
+		ERR_RET(NULL, "invalid argument\n");
+
 	t = malloc(sizeof(tcp_stream_t));
 	if (!t) 
 		ERR_RET(NULL, "malloc failed: %s\n", ERRSTR);
 	memset(t, 0, sizeof(*t));
 
+	t->rctx = rctx;
+	CBLIST_INIT(&t->lru);
+	CBLIST_INIT(&t->age);
+	tcp_reasm_init(&t->reasm[0]);
+	tcp_reasm_init(&t->reasm[1]);
+
 	return t;
 }
 
@@ -347,8 +251,8 @@ tcp_stream_free(tcp_stream_t *t)
 	if (unlikely(!t))
 		return;
 
-	_tcp_pktq_free(&t->pktqs[0]);
-	_tcp_pktq_free(&t->pktqs[1]);
+	tcp_reasm_free(t->rctx, &t->reasm[0]);
+	tcp_reasm_free(t->rctx, &t->reasm[1]);
 
 	free(t);
 }
@@ -370,11 +274,49 @@ tcp_stream_print(void *tcp)
 		t->state);
 }
 
+int 
+tcp_payload(const netpkt_t *pkt, const u_int8_t **data)
+{
+	int hlen;
+	int caplen;
+	int len;
+
+	if (unlikely(!pkt || !data || !pkt->hdr4_tcp))
+		return -1;
+
+	hlen = NETPKT_HLEN(pkt);
+	caplen = (pkt->tail - pkt->head) - hlen;
+
+	/* the ethernet padding is not payload, use length in IP header */
+	if (pkt->hdr3_type == ETHERTYPE_IP)
+		len = ntohs(pkt->hdr3_ipv4->tot_len) - pkt->hdr3_len;
+	else if (pkt->hdr3_type == ETHERTYPE_IPV6)
+		len = ntohs(pkt->hdr3_ipv6->ip6_plen) + 
+			sizeof(struct ip6_hdr) - pkt->hdr3_len;
+	else
+		return -1;
+	len -= pkt->hdr4_len;
+
+	/* the packet is truncated by snaplen */
+	if (len > caplen)
+		len = caplen;
+	if (len < 0)
+		return -1;
+
+	*data = pkt->head + hlen;
+	return len;
+}
+
 int 
 tcp_stream_flow(tcp_stream_t *t, const netpkt_t *pkt, int dir)
 {
+	int n;
+	int len;
 	int ret;
+	u_int32_t seq;
+	const u_int8_t *data;
 	struct tcphdr *h;
+	netpkt_t *frag;
 
 	if (unlikely(!t || !pkt))
 		ERR_RET(-1, "invalid argument\n");
@@ -383,27 +325,32 @@ tcp_stream_flow(tcp_stream_t *t, const netpkt_t *pkt, int dir)
 		ERR_RET(-1, "not decode TCP header\n");
 
 	h = pkt->hdr4_tcp;
+	dir = dir % 2;
+	seq = ntohl(h->seq);
 
 	/* check seq/ack number */
 	if (_tcp_check_seq(t, h, dir))
 		ERR_RET(-1, "invalid seq number\n");
 
-	/* RST packet */
+	/* RST packet, the stream is closed */
 	if (h->rst) {
-		printf("<%d> RST: seq %u, ack %u\n", 
-			dir, ntohl(h->seq), ntohl(h->ack));
+		t->state = TCP_ST_CLOSE;
+		tcp_reasm_flush(t->rctx, &t->reasm[0], t, 0);
+		tcp_reasm_flush(t->rctx, &t->reasm[1], t, 1);
 		return -1;
 	}
 
-	printf("<%d>stream(%p) before state: %d\n", dir, t, t->state);
-
 	/* TCP state */
 	switch (t->state) {
 
 		case TCP_ST_SYN:
-			/* server syn-ack packet */
-			if (dir == 1 && h->syn && h->ack)
+			/* server syn-ack packet, data start after it */
+			if (dir == 1 && h->syn && h->ack) {
 				t->state = TCP_ST_SYN_ACK;
+				t->seqacks[1].seq = seq;
+				t->seqacks[1].ack = seq + 1;
+				tcp_reasm_start(&t->reasm[1], seq + 1);
+			}
 			break;
 		case TCP_ST_SYN_ACK:
 			/* client ACK, establish connection */
@@ -414,64 +361,54 @@ tcp_stream_flow(tcp_stream_t *t, const netpkt_t *pkt, int dir)
 			/* receive Fin */
 			if (h->fin)
 				t->state = TCP_ST_FIN1;
-			if (h->psh) {
-				ret = _tcp_pktq_add(&t->pktqs[dir], pkt);
-			}
 			break;
 		case TCP_ST_FIN1:
 			if (h->ack)
 				t->state = TCP_ST_FIN1_ACK;
 			if (h->fin)
 				t->state = TCP_ST_FIN2;
-			if (h->psh) {
-				ret = _tcp_pktq_add(&t->pktqs[dir], pkt);
-			}
 			break;
 		case TCP_ST_FIN1_ACK:
 			if (h->fin)
 				t->state = TCP_ST_FIN2;
 			break;
 		case TCP_ST_FIN2:
-			if (h->ack) {
+			if (h->ack)
 				t->state = TCP_ST_CLOSE;
-				return 0;
-			}
 			break;
 		default:
 			break;
 	}
 
-	printf("<%d>stream(%p) after state: %d\n", dir, t, t->state);
-
-	return ret;
-}
-
-int 
-tcp_stream_data_len(const tcp_stream_t *t, int dir)
-{
-	if (unlikely(!t))
-		ERR_RET(-1, "invalid argument\n");
-
-	return t->pktqs[dir % 2].len;
-}
-
-int 
-tcp_stream_get_data(tcp_stream_t *t, u_int8_t *buf, size_t size, int dir)
-{
-	int tot;
-	tcp_pktq_t *q;
-
-	if (unlikely(!t || !buf || size < 1))
-		ERR_RET(-1, "invalid argument\n");
-
-	q = &t->pktqs[dir % 2];
+	/* the data of ACK/FIN packet after handshake */
+	ret = 0;
+	len = tcp_payload(pkt, &data);
+	if (len > 0 && t->state >= TCP_ST_EST)
+		ret = tcp_reasm_add(t->rctx, &t->reasm[dir], t, dir,
+				    seq, data, len);
+
+	/* the chained data of reassembled IP datagram */
+	if (len >= 0 && ret >= 0 && t->state >= TCP_ST_EST) {
+		seq += len;
+		CBLIST_FOR_EACH(&pkt->frags, frag, list) {
+			len = frag->tail - frag->head;
+			n = tcp_reasm_add(t->rctx, &t->reasm[dir], t, dir,
+					  seq, frag->head, len);
+			if (n < 0) {
+				ret = -1;
+				break;
+			}
+			ret += n;
+			seq += len;
+		}
+	}
 
-	tot = q->len > size ? size : q->len;
-	if (tot == 0)
-		return 0;
+	/* pass the bytes after holes when closed */
+	if (t->state == TCP_ST_CLOSE) {
+		tcp_reasm_flush(t->rctx, &t->reasm[0], t, 0);
+		tcp_reasm_flush(t->rctx, &t->reasm[1], t, 1);
+	}
 
-	return _tcp_pktq_get_data(q, buf, tot);
+	return ret;
 }
 
-
-
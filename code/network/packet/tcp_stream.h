@@ -14,9 +14,10 @@
 #include "dbuffer.h"
 #include "ip_addr.h"
 #include "netpkt.h"
+#include "tcp_reasm.h"
 
-#define	TCP_PKTQ_MAX	128
-#define	TCP_PKTQ_INC	16
+#define	TCP_FLOW_KEY4_LEN	13	/* IPv4 flow key length */
+#define	TCP_FLOW_KEY6_LEN	37	/* IPv6 flow key length */
 
 /**
  *	TCP state.
@@ -39,6 +40,21 @@ typedef struct tcp_tup {
 	ip_port_t	dst;
 } tcp_tup_t;
 
+/**
+ *	The direction-normalized flow key, the endpoint which
+ *	(address, port) is smaller is first, so the two directions
+ *	of a flow have same key. The @data layout is:
+ *
+ *	lo address(4/16), hi address(4/16), lo port(2), hi port(2),
+ *	protocol(1)
+ *
+ *	all in network order.
+ */
+typedef struct tcp_flow_key {
+	u_int8_t	len;		/* 13 for IPv4, 37 for IPv6 */
+	u_int8_t	data[TCP_FLOW_KEY6_LEN];/* key data */
+} tcp_flow_key_t;
+
 /**
  *	TCP sequence and ack.
  */
@@ -47,28 +63,6 @@ typedef struct tcp_seqack {
 	u_int32_t	ack;
 } tcp_seqack_t;
 
-/**
- *	TCP packet include netpkt_t @pkt.
- */
-typedef struct tcp_pkt {
-	u_int32_t	seq;
-	u_int16_t	len;
-	u_int16_t	off;
-	netpkt_t	*pkt;	
-} tcp_pkt_t;
-
-/**
- *	TCP reassemble struct and data in it.
- */
-typedef struct tcp_pktq {
-	tcp_pkt_t	*pkts;
-	u_int16_t	npkt;
-	u_int16_t	max;		/* max pkts can store in @pkts */
-	u_int32_t	len;		/* length of continuous data */
-	u_int32_t	nassembly;	/* assembly packet number */
-	u_int32_t	first_seq;	/* first seq number for reassemble */
-} tcp_pktq_t;
-
 /**
  *	TCP stream structure.
  */
@@ -77,9 +71,18 @@ typedef struct tcp_stream {
 	ip_port_t	dst;		/* dst address */
 	tcp_seqack_t	seqacks[2];	/* syn ack number */
 	u_int32_t	winfcts[2];	/* window factor for TCP window option */
-	tcp_pktq_t	pktqs[2];	/* PSH packets queue for reassemble */
+	tcp_reasm_t	reasm[2];	/* reassembly of two directions */
+	tcp_reasm_ctx_t	*rctx;		/* reassembly context */
 	int		state;		/* state: see above */
 	void		*ssl;		/* ssl data */
+	tcp_flow_key_t	key;		/* flow key */
+	u_int32_t	hval;		/* hash value of @key */
+	int		kdir;		/* key direction of client */
+	cblist_t	lru;		/* in owner list sorted by @last */
+	cblist_t	age;		/* in owner list sorted by @first */
+	u_int64_t	first;		/* time of first packet(usec) */
+	u_int64_t	last;		/* time of last packet(usec) */
+	u_int64_t	nsave;		/* payload bytes written to file */
 } tcp_stream_t;
 
 extern int 
@@ -91,23 +94,60 @@ tcp_tup_hash(tcp_tup_t *tup, u_int32_t *hval);
 extern int 
 tcp_tup_cmp(const void *tcp1, const void *tcp2);
 
+/**
+ *	Build the direction-normalized flow key of @pkt into @key,
+ *	and the symmetric hash of it into @hval. The two directions
+ *	of a TCP/UDP flow have same key and hash.
+ *
+ *	Return the direction of @pkt in key: 0 if source is the first
+ *	endpoint, 1 if not, -1 on error.
+ */
+extern int 
+tcp_flow_key(const netpkt_t *pkt, tcp_flow_key_t *key, u_int32_t *hval);
+
+/**
+ *	Return 1 if flow key @k1 is same as @k2, 0 if not.
+ */
+static inline int 
+tcp_flow_key_eq(const tcp_flow_key_t *k1, const tcp_flow_key_t *k2)
+{
+	return (k1->len == k2->len && 
+		memcmp(k1->data, k2->data, k1->len) == 0);
+}
+
 extern const char * 
 tcp_tup_to_str(const tcp_tup_t *tup, char *buf, size_t len);
 
+/**
+ *	Alloc a TCP stream, the data is reassembled in @rctx.
+ *
+ *	Return pointer if success, NULL on error.
+ */
 extern tcp_stream_t * 
-tcp_stream_alloc(void); 
+tcp_stream_alloc(tcp_reasm_ctx_t *rctx); 
 
 extern void 
 tcp_stream_free(tcp_stream_t *t);
 
+/**
+ *	Parse packet @pkt of stream @t, @dir is 0 for client packet, 
+ *	1 for server packet. The payload is reassembled and passed 
+ *	to callback of reassembly context. The @t->state is
+ *	TCP_ST_CLOSE after FIN handshake or RST, the owner can
+ *	free it.
+ *
+ *	Return bytes passed to callback, -1 on error.
+ */
 extern int 
 tcp_stream_flow(tcp_stream_t *t, const netpkt_t *pkt, int dir);
 
+/**
+ *	Get the TCP payload of @pkt into @data.
+ *
+ *	Return payload length, -1 on error.
+ */
 extern int 
-tcp_stream_data_len(const tcp_stream_t *t, int dir);
-
-extern int
-tcp_stream_get_data(tcp_stream_t *t, u_int8_t *buf, size_t len, int dir);
+tcp_payload(const netpkt_t *pkt, const u_int8_t **data);
 
 extern void 
 tcp_stream_print(void *tcp);
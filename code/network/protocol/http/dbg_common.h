@@ -0,0 +1 @@
+../../../basic/stdext/dbg_common.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../basic/stdext/gcc_common.h
\ No newline at end of file
@@ -1,9 +1,11 @@
 /**
- *	@file	
+ *	@file	http_buffer.h
  *
- *	@brief
- *	
- *	@author	Forrest.zhang	
+ *	@brief	HTTP buffer, it stores the token which is split by
+ *		two parse buffers. The token in one parse buffer is
+ *		not copied.
+ *
+ *	@author	Forrest.zhang
  *
  *	@date
  */
@@ -11,8 +13,20 @@
 #ifndef	FZ_HTTP_BUFFER_H
 #define	FZ_HTTP_BUFFER_H
 
+#include <sys/types.h>
 
+#define	HTTP_MIN_BUF		1024	/* initiate buffer size */
+#define	HTTP_MAX_BUF		65536	/* max buffer size */
 
+/**
+ *	HTTP buffer, the split token is appended in @data, the
+ *	string refer it by offset because @data may be realloced.
+ */
+typedef struct http_buffer {
+	u_int32_t	len;		/* used bytes in @data */
+	u_int32_t	size;		/* size of @data */
+	char		*data;		/* the space */
+} http_buffer_t;
 
 #endif	/* end of FZ_HTTP_BUFFER_H */
 
@@ -0,0 +1,554 @@
+/**
+ *	file	http_decode.c
+ *	brief	HTTP decode function, the bytes which are not '%' or
+ *		'+' are skipped by SIMD and copied in bulk.
+ *
+ *	author	Forrest.zhang
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define	_DEC_HAVE_X86		1
+#endif
+
+#include "http_decode.h"
+
+#define	_DEC_AGAIN		0x100	/* decode the decoded bytes again */
+#define	_DEC_NEAR		8	/* bytes checked before SIMD */
+#define	_DEC_SEP(c)		((c) == '/' || (c) == '\\')
+
+static int8_t		_dec_hex[256];	/* hex value, -1 if not hex */
+static int		_dec_avx2;	/* AVX2 is usable */
+
+/**
+ *	Init the hex table and detect CPU features, it's called
+ *	before main().
+ *
+ *	No return.
+ */
+__attribute__((constructor)) static void 
+_dec_init(void)
+{
+	int c;
+
+	for (c = 0; c < 256; c++)
+		_dec_hex[c] = -1;
+	for (c = '0'; c <= '9'; c++)
+		_dec_hex[c] = c - '0';
+	for (c = 'a'; c <= 'f'; c++) {
+		_dec_hex[c] = c - 'a' + 10;
+		_dec_hex[c - 'a' + 'A'] = c - 'a' + 10;
+	}
+
+#ifdef	_DEC_HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		_dec_avx2 = 1;
+#endif
+}
+
+#ifdef	_DEC_HAVE_X86
+
+/**
+ *	Find the first '%' (or '+' if @plus) in @p, 16 bytes each
+ *	time by SSE2.
+ *
+ *	Return the position of the byte, or the first byte of the
+ *	last block less than 16 bytes.
+ */
+__attribute__((target("sse2"))) static const u_int8_t * 
+_dec_scan_sse2(const u_int8_t *p, const u_int8_t *end, int plus)
+{
+	__m128i pct, pls, v, m;
+	u_int32_t bits;
+
+	pct = _mm_set1_epi8('%');
+	pls = _mm_set1_epi8(plus ? '+' : '%');
+
+	while (p + 16 <= end) {
+		v = _mm_loadu_si128((const __m128i *)p);
+		m = _mm_or_si128(_mm_cmpeq_epi8(v, pct),
+				 _mm_cmpeq_epi8(v, pls));
+		bits = _mm_movemask_epi8(m);
+		if (bits)
+			return p + __builtin_ctz(bits);
+		p += 16;
+	}
+
+	return p;
+}
+
+/**
+ *	Find the first '%' (or '+' if @plus) in @p, 32 bytes each
+ *	time by AVX2.
+ *
+ *	Return the position of the byte, or the first byte of the
+ *	last block less than 32 bytes.
+ */
+__attribute__((target("avx2"))) static const u_int8_t * 
+_dec_scan_avx2(const u_int8_t *p, const u_int8_t *end, int plus)
+{
+	__m256i pct, pls, v, m;
+	u_int32_t bits;
+
+	pct = _mm256_set1_epi8('%');
+	pls = _mm256_set1_epi8(plus ? '+' : '%');
+
+	while (p + 32 <= end) {
+		v = _mm256_loadu_si256((const __m256i *)p);
+		m = _mm256_or_si256(_mm256_cmpeq_epi8(v, pct),
+				    _mm256_cmpeq_epi8(v, pls));
+		bits = _mm256_movemask_epi8(m);
+		if (bits)
+			return p + __builtin_ctz(bits);
+		p += 32;
+	}
+
+	return p;
+}
+
+#endif	/* end of _DEC_HAVE_X86 */
+
+/**
+ *	Find the first '%' (or '+' if @plus) in @p.
+ *
+ *	Return the position of the byte, @end if not found.
+ */
+static inline const u_int8_t * 
+_dec_scan(const u_int8_t *p, const u_int8_t *end, int plus)
+{
+	const u_int8_t *e;
+
+	/* the escapes are near in dense string, SIMD is slower */
+	e = end - p > _DEC_NEAR ? p + _DEC_NEAR : end;
+	while (p < e && *p != '%' && !(plus && *p == '+'))
+		p++;
+	if (p < e || p == end)
+		return p;
+
+#ifdef	_DEC_HAVE_X86
+	if (_dec_avx2)
+		p = _dec_scan_avx2(p, end, plus);
+	p = _dec_scan_sse2(p, end, plus);
+#endif
+
+	while (p < end && *p != '%' && !(plus && *p == '+'))
+		p++;
+
+	return p;
+}
+
+/**
+ *	Parse the escape %XX or %uXXXX at @p, the value is saved
+ *	in @val.
+ *
+ *	Return the escape length, 0 if it's invalid, -1 if need
+ *	more bytes.
+ */
+static inline int 
+_dec_escape(const u_int8_t *p, const u_int8_t *end, int flags,
+	    u_int32_t *val)
+{
+	u_int32_t v = 0;
+	int len = 3;
+	int i = 1;
+
+	if (end - p < 2)
+		return -1;
+
+	if ((p[1] == 'u' || p[1] == 'U') && (flags & HTTP_DECODE_UNICODE)) {
+		len = 6;
+		i = 2;
+	}
+
+	for (; i < len; i++) {
+		if (p + i >= end)
+			return -1;
+		if (_dec_hex[p[i]] < 0)
+			return 0;
+		v = (v << 4) | _dec_hex[p[i]];
+	}
+
+	*val = v;
+	return len;
+}
+
+/**
+ *	Save unicode @v in @o as UTF-8, the full width ASCII is
+ *	saved as ASCII.
+ *
+ *	Return the saved bytes.
+ */
+static inline int 
+_dec_unicode(u_int8_t *o, u_int32_t v)
+{
+	if (v >= 0xff01 && v <= 0xff5e)
+		v -= 0xfee0;
+
+	if (v < 0x80) {
+		o[0] = v;
+		return 1;
+	}
+
+	if (v < 0x800) {
+		o[0] = 0xc0 | (v >> 6);
+		o[1] = 0x80 | (v & 0x3f);
+		return 2;
+	}
+
+	o[0] = 0xe0 | (v >> 12);
+	o[1] = 0x80 | ((v >> 6) & 0x3f);
+	o[2] = 0x80 | (v & 0x3f);
+	return 3;
+}
+
+/**
+ *	Decode the escapes in decoded bytes [@lo, @o) again, the
+ *	escape may begin at HTTP_DECODE_HOLD - 1 bytes before @lo,
+ *	the '%' after @hi are not checked. The output begin at
+ *	@start.
+ *
+ *	Return the new end of output.
+ */
+static u_int8_t * 
+_dec_again(u_int8_t *start, u_int8_t *lo, u_int8_t *hi, u_int8_t *o,
+	   int flags)
+{
+	u_int8_t *i;
+	u_int32_t v;
+	int loop = 0;
+	int n, m;
+
+	i = lo - start < HTTP_DECODE_HOLD - 1 ? start :
+		lo - (HTTP_DECODE_HOLD - 1);
+
+	while (i < hi && loop < HTTP_DECODE_LOOP) {
+		if (*i == '+' && i >= lo && (flags & HTTP_DECODE_PLUS)) {
+			*i++ = ' ';
+			loop++;
+			continue;
+		}
+
+		if (*i != '%' || (n = _dec_escape(i, o, flags, &v)) <= 0) {
+			i++;
+			continue;
+		}
+
+		if (n == 3) {
+			*i = v;
+			m = 1;
+		}
+		else
+			m = _dec_unicode(i, v);
+
+		memmove(i + m, i + n, o - (i + n));
+		o -= n - m;
+		loop++;
+
+		/* the new bytes may make escape with previous bytes */
+		lo = i;
+		hi = i + m;
+		i = lo - start < HTTP_DECODE_HOLD - 1 ? start :
+			lo - (HTTP_DECODE_HOLD - 1);
+	}
+
+	return o;
+}
+
+/**
+ *	Decode [@p, @end) into @o, the @o can be @p. If @final is
+ *	zero, the incomplete escape at end is not decoded and it's
+ *	position is saved in @rest. The output begin at @start.
+ *
+ *	Return the end of output.
+ */
+static u_int8_t * 
+_dec_run(const u_int8_t *p, const u_int8_t *end, u_int8_t *o,
+	 u_int8_t *start, int flags, int final, const u_int8_t **rest)
+{
+	const u_int8_t *q;
+	u_int8_t *from;
+	u_int32_t v;
+	size_t len;
+	int plus = flags & HTTP_DECODE_PLUS;
+	int n;
+
+	while (p < end) {
+		/* the plain bytes */
+		q = _dec_scan(p, end, plus);
+		if (q > p) {
+			len = q - p;
+			from = o;
+			if (o == p)
+				o += len;
+			else if (len < _DEC_NEAR) {
+				while (p < q)
+					*o++ = *p++;
+			}
+			else {
+				memmove(o, p, len);
+				o += len;
+			}
+			p = q;
+			if ((flags & _DEC_AGAIN) && from > start)
+				o = _dec_again(start, from, from, o, flags);
+			if (p == end)
+				break;
+		}
+
+		from = o;
+		if (*p == '+') {
+			*o++ = ' ';
+			p++;
+			continue;
+		}
+
+		/* the common %XX */
+		if (end - p >= 3 && _dec_hex[p[1]] >= 0 && _dec_hex[p[2]] >= 0 &&
+		    !(flags & _DEC_AGAIN))
+		{
+			*o++ = (_dec_hex[p[1]] << 4) | _dec_hex[p[2]];
+			p += 3;
+			continue;
+		}
+
+		n = _dec_escape(p, end, flags, &v);
+		if (n < 0 && !final) {
+			*rest = p;
+			return o;
+		}
+
+		if (n <= 0) {
+			*o++ = '%';
+			p++;
+		}
+		else if (n == 3) {
+			*o++ = v;
+			p += n;
+		}
+		else {
+			o += _dec_unicode(o, v);
+			p += n;
+		}
+
+		if (flags & _DEC_AGAIN)
+			o = _dec_again(start, from, o, o, flags);
+	}
+
+	*rest = end;
+	return o;
+}
+
+/**
+ *	Remove "//", "/./" and "/../" in URL path @s, the '\' is
+ *	same as '/'.
+ *
+ *	Return the new length.
+ */
+static size_t 
+_dec_path(u_int8_t *s, size_t len)
+{
+	u_int8_t *p = s, *o = s;
+	u_int8_t *end = s + len;
+	size_t n;
+
+	while (p < end) {
+		if (!_DEC_SEP(*p)) {
+			*o++ = *p++;
+			continue;
+		}
+
+		n = end - p;
+
+		/* "/." */
+		if (n >= 2 && p[1] == '.' && (n == 2 || _DEC_SEP(p[2]))) {
+			p += 2;
+			if (n == 2 && (o == s || o[-1] != '/'))
+				*o++ = '/';
+			continue;
+		}
+
+		/* "/..", remove last segment */
+		if (n >= 3 && p[1] == '.' && p[2] == '.' &&
+		    (n == 3 || _DEC_SEP(p[3])))
+		{
+			if (o > s && o[-1] == '/')
+				o--;
+			while (o > s && o[-1] != '/')
+				o--;
+			if (o > s)
+				o--;
+			p += 3;
+			if (n == 3)
+				*o++ = '/';
+			continue;
+		}
+
+		/* "//" */
+		if (o > s && o[-1] == '/') {
+			p++;
+			continue;
+		}
+
+		*o++ = '/';
+		p++;
+	}
+
+	return o - s;
+}
+
+
+int 
+http_decode_str(const char *str, size_t len, char *decstr, size_t *declen)
+{
+	const u_int8_t *rest;
+	u_int8_t *o;
+
+	if (!str || !decstr || !declen)
+		return -1;
+
+	o = _dec_run((const u_int8_t *)str, (const u_int8_t *)str + len,
+		     (u_int8_t *)decstr, (u_int8_t *)decstr,
+		     HTTP_DECODE_PLUS | HTTP_DECODE_UNICODE, 1, &rest);
+	*declen = o - (u_int8_t *)decstr;
+
+	return 0;
+}
+
+
+int 
+http_decode_str2(const char *str, size_t len, char *decstr, size_t *declen)
+{
+	const u_int8_t *rest;
+	u_int8_t *o;
+
+	if (!str || !decstr || !declen)
+		return -1;
+
+	o = _dec_run((const u_int8_t *)str, (const u_int8_t *)str + len,
+		     (u_int8_t *)decstr, (u_int8_t *)decstr,
+		     HTTP_DECODE_PLUS | HTTP_DECODE_UNICODE | _DEC_AGAIN,
+		     1, &rest);
+	*declen = o - (u_int8_t *)decstr;
+
+	return 0;
+}
+
+
+int 
+http_decode_urlpath(const void *buf, size_t len, void *decbuf, size_t *declen)
+{
+	const u_int8_t *rest;
+	u_int8_t *o;
+
+	if (!buf || !decbuf || !declen)
+		return -1;
+
+	o = _dec_run(buf, (const u_int8_t *)buf + len, decbuf, decbuf,
+		     HTTP_DECODE_UNICODE, 1, &rest);
+	*declen = _dec_path(decbuf, o - (u_int8_t *)decbuf);
+
+	return 0;
+}
+
+
+void 
+http_decode_init(http_decode_t *d, int flags)
+{
+	if (!d)
+		return;
+
+	memset(d, 0, sizeof(*d));
+	d->flags = flags & (HTTP_DECODE_PLUS | HTTP_DECODE_UNICODE);
+}
+
+
+int 
+http_decode_update(http_decode_t *d, const char *buf, size_t len,
+		   char *out, size_t *outlen)
+{
+	const u_int8_t *p = (const u_int8_t *)buf;
+	const u_int8_t *end = p + len;
+	const u_int8_t *rest;
+	u_int8_t *o = (u_int8_t *)out;
+	u_int8_t tmp[2 * HTTP_DECODE_HOLD];
+	size_t tlen = 0, used, k;
+	u_int8_t *t;
+
+	if (!d || (!buf && len) || !out || !outlen)
+		return -1;
+
+	/* finish the pending escape by first bytes of @buf */
+	if (d->nhold) {
+		k = HTTP_DECODE_HOLD - d->nhold;
+		if (k > len)
+			k = len;
+		memcpy(tmp, d->hold, d->nhold);
+		memcpy(tmp + d->nhold, p, k);
+
+		t = _dec_run(tmp, tmp + d->nhold + k, tmp, tmp,
+			     d->flags, 0, &rest);
+		used = rest - tmp;
+
+		/* still pending, all bytes are held */
+		if (used < (size_t)d->nhold) {
+			memcpy(d->hold + d->nhold, p, k);
+			d->nhold += k;
+			*outlen = 0;
+			return 0;
+		}
+
+		tlen = t - tmp;
+		p += used - d->nhold;
+		d->nhold = 0;
+
+		/* the output overlap the bytes not decoded */
+		if (o + tlen > p && o < end) {
+			o = _dec_run(p, end, (u_int8_t *)p, (u_int8_t *)p,
+				     d->flags, 0, &rest);
+			d->nhold = end - rest;
+			memcpy(d->hold, rest, d->nhold);
+
+			k = o - p;
+			memmove(out + tlen, p, k);
+			memcpy(out, tmp, tlen);
+			*outlen = tlen + k;
+			return 0;
+		}
+
+		memcpy(o, tmp, tlen);
+		o += tlen;
+	}
+
+	o = _dec_run(p, end, o, o, d->flags, 0, &rest);
+
+	/* the rest is not overwritten, output never pass input */
+	d->nhold = end - rest;
+	memcpy(d->hold, rest, d->nhold);
+	*outlen = o - (u_int8_t *)out;
+
+	return 0;
+}
+
+
+int 
+http_decode_final(http_decode_t *d, char *out, size_t *outlen)
+{
+	const u_int8_t *rest;
+	u_int8_t *o;
+
+	if (!d || !out || !outlen)
+		return -1;
+
+	o = _dec_run((u_int8_t *)d->hold, (u_int8_t *)d->hold + d->nhold,
+		     (u_int8_t *)out, (u_int8_t *)out, d->flags, 1, &rest);
+	*outlen = o - (u_int8_t *)out;
+	d->nhold = 0;
+
+	return 0;
+}
+
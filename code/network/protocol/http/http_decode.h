@@ -1,8 +1,9 @@
 /**
  *	@file	http_decode.h
  *
- *	@brief	HTTP decode function.
- *	
+ *	@brief	HTTP decode function, the plain bytes are skipped by
+ *		SIMD and the output can be the input buffer.
+ *
  *	@author	Forrest.zhang
  *
  *	@date
@@ -11,10 +12,30 @@
 #ifndef FZ_HTTP_DECODE_H
 #define FZ_HTTP_DECODE_H
 
+#include <sys/types.h>
+
+#define	HTTP_DECODE_PLUS	0x01	/* '+' is decoded as space */
+#define	HTTP_DECODE_UNICODE	0x02	/* %uXXXX is decoded */
+
+#define	HTTP_DECODE_HOLD	6	/* max bytes of pending escape */
+#define	HTTP_DECODE_LOOP	8	/* max decode times in str2 */
+
+/**
+ *	The stream decoder, the escape split by two buffers is
+ *	pending in @hold.
+ */
+typedef struct http_decode {
+	int		flags;		/* HTTP_DECODE_XXX */
+	int		nhold;		/* bytes in @hold */
+	char		hold[HTTP_DECODE_HOLD];
+} http_decode_t;
+
 
 /**
- *	Decode a string @str and save it to @decstr
- *	
+ *	Decode a string @str and save it to @decstr, the %XX, %uXXXX
+ *	and '+' are decoded, the invalid escape is kept. The @decstr
+ *	can be @str.
+ *
  *	Return 0 if success, -1 on error.
  */
 extern int 
@@ -22,8 +43,9 @@ http_decode_str(const char *str, size_t len, char *decstr, size_t *declen);
 
 
 /**
- *	Decode a string @str and save it to @decstr, it'll decode again
- *	until no decode found.
+ *	Decode a string @str and save it to @decstr, the escape made
+ *	by decoded bytes is decoded again in same pass, at most
+ *	HTTP_DECODE_LOOP times. The @decstr can be @str.
  *
  * 	Return 0 if success, -1 on error.
  */
@@ -40,7 +62,9 @@ http_decode_amf(const void *buf, size_t len, void *decbuf, size_t *declen);
 
 
 /**
- * 	Decode URL path @buf and save it to @decbuf.
+ * 	Decode URL path @buf and save it to @decbuf, the '+' is not
+ * 	decoded, the '\' is '/', and "//", "/./", "/../" are removed.
+ * 	The @decbuf can be @buf.
  *
  * 	Return 0 if successs, -1 on error.
  */
@@ -48,6 +72,37 @@ extern int
 http_decode_urlpath(const void *buf, size_t len, void *decbuf, size_t *declen);
 
 
+/**
+ *	Init stream decoder @d, the @flags is HTTP_DECODE_XXX.
+ *
+ *	No return.
+ */
+extern void 
+http_decode_init(http_decode_t *d, int flags);
+
+
+/**
+ *	Decode @buf which is next piece of stream @d and save it to
+ *	@out, the escape at end of @buf is pending until next call.
+ *	The @out need @len + HTTP_DECODE_HOLD bytes, it can be @buf.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+http_decode_update(http_decode_t *d, const char *buf, size_t len,
+		   char *out, size_t *outlen);
+
+
+/**
+ *	End the stream @d, the pending escape is saved to @out as
+ *	it's invalid. The @out need HTTP_DECODE_HOLD bytes.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+http_decode_final(http_decode_t *d, char *out, size_t *outlen);
+
+
 #endif /* end of FZ_DECODE_H  */
 
 
@@ -0,0 +1,402 @@
+/*
+ *	file	http_decode_test.c
+ *
+ *	brief	http_decode test program, it checks the decoders with
+ *		random strings against a byte-at-a-time decoder, and
+ *		reports MB/s of both.
+ *
+ *	author	Forrest.zhang
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "http_decode.h"
+
+#define _STR_MAX	256
+
+static int _g_loop_times = 10000;
+static int _g_size = 4096;
+static int _g_percent = 5;
+static int _g_check = 1000;
+
+static void
+_usage(void)
+{
+	printf("http_decode_test <options>\n");
+	printf("\t-t <num> \tloop times (need > 0), default is 10000\n");
+	printf("\t-s <num> \tbench string size, default is 4096\n");
+	printf("\t-p <num> \tpercent of escaped bytes, default is 5\n");
+	printf("\t-c <num> \trandom check times, default is 1000\n");
+	printf("\t-h       \tshow help message\n");
+}
+
+static int
+_parse_cmd(int argc, char **argv)
+{
+	char optstr[] = ":t:s:p:c:h";
+	char opt;
+
+	opterr = 0;
+	while ( (opt = getopt(argc, argv, optstr)) != -1) {
+		switch (opt) {
+
+		case 't':
+			_g_loop_times = atoi(optarg);
+			if (_g_loop_times < 1)
+				return -1;
+			break;
+
+		case 's':
+			_g_size = atoi(optarg);
+			if (_g_size < 1)
+				return -1;
+			break;
+
+		case 'p':
+			_g_percent = atoi(optarg);
+			if (_g_percent < 0 || _g_percent > 100)
+				return -1;
+			break;
+
+		case 'c':
+			_g_check = atoi(optarg);
+			if (_g_check < 0)
+				return -1;
+			break;
+
+		case 'h':
+			return -1;
+
+		case ':':
+			printf("option %c missing argument\n", optopt);
+			return -1;
+
+		case '?':
+			printf("unkowned option %c\n", optopt);
+			return -1;
+		}
+	}
+
+	if (optind != argc)
+		return -1;
+
+	return 0;
+}
+
+static int
+_hex(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/**
+ *	The byte-at-a-time decoder, it's the reference.
+ *
+ *	Return the decoded length.
+ */
+static size_t
+_ref_decode(const u_int8_t *s, size_t len, u_int8_t *o, int flags)
+{
+	size_t i = 0, n = 0;
+	unsigned int v;
+
+	while (i < len) {
+		if (s[i] == '+' && (flags & HTTP_DECODE_PLUS)) {
+			o[n++] = ' ';
+			i++;
+		}
+		else if (s[i] == '%' && i + 5 < len &&
+			 (s[i + 1] == 'u' || s[i + 1] == 'U') &&
+			 (flags & HTTP_DECODE_UNICODE) &&
+			 _hex(s[i + 2]) >= 0 && _hex(s[i + 3]) >= 0 &&
+			 _hex(s[i + 4]) >= 0 && _hex(s[i + 5]) >= 0)
+		{
+			v = _hex(s[i + 2]) << 12 | _hex(s[i + 3]) << 8 |
+				_hex(s[i + 4]) << 4 | _hex(s[i + 5]);
+			if (v >= 0xff01 && v <= 0xff5e)
+				v -= 0xfee0;
+			if (v < 0x80)
+				o[n++] = v;
+			else if (v < 0x800) {
+				o[n++] = 0xc0 | (v >> 6);
+				o[n++] = 0x80 | (v & 0x3f);
+			}
+			else {
+				o[n++] = 0xe0 | (v >> 12);
+				o[n++] = 0x80 | ((v >> 6) & 0x3f);
+				o[n++] = 0x80 | (v & 0x3f);
+			}
+			i += 6;
+		}
+		else if (s[i] == '%' && i + 2 < len &&
+			 !((s[i + 1] == 'u' || s[i + 1] == 'U') &&
+			   (flags & HTTP_DECODE_UNICODE)) &&
+			 _hex(s[i + 1]) >= 0 && _hex(s[i + 2]) >= 0)
+		{
+			o[n++] = _hex(s[i + 1]) << 4 | _hex(s[i + 2]);
+			i += 3;
+		}
+		else
+			o[n++] = s[i++];
+	}
+
+	return n;
+}
+
+/**
+ *	Generate a random string @s of @len bytes, about @percent of
+ *	bytes are escape or '+'.
+ *
+ *	No return.
+ */
+static void
+_gen_str(char *s, int len, int percent)
+{
+	static const char *hex = "0123456789abcdefABCDEF";
+	static const char *pieces[] = {
+		"%25", "%2", "%u", "%uff0", "%uff1c", "%%", "%2b", "%u002",
+		"%5", "%41", "+", "%7",
+	};
+	int i = 0;
+	int r, n;
+
+	while (i < len) {
+		r = rand() % 100;
+		if (r < percent) {
+			if (rand() % 2) {
+				n = snprintf(s + i, len - i + 1, "%s",
+					     pieces[rand() % 12]);
+			}
+			else {
+				n = snprintf(s + i, len - i + 1, "%%%c%c",
+					     hex[rand() % 22],
+					     hex[rand() % 22]);
+			}
+			i += n < len - i ? n : len - i;
+		}
+		else if (r < percent * 2) {
+			s[i++] = hex[rand() % 22];
+		}
+		else {
+			s[i++] = 'a' + rand() % 26;
+		}
+	}
+}
+
+static int
+_check_one(const char *s, size_t len)
+{
+	u_int8_t ref[_STR_MAX * 2], tmp[_STR_MAX * 2];
+	char out[_STR_MAX * 2 + HTTP_DECODE_HOLD];
+	char buf[_STR_MAX * 2 + HTTP_DECODE_HOLD];
+	size_t rlen, olen, n, pos, piece;
+	http_decode_t d;
+	int flags;
+	int i;
+
+	/* str and in place */
+	rlen = _ref_decode((const u_int8_t *)s, len, ref,
+			   HTTP_DECODE_PLUS | HTTP_DECODE_UNICODE);
+	if (http_decode_str(s, len, out, &olen) ||
+	    olen != rlen || memcmp(out, ref, rlen))
+	{
+		printf("str failed: %.*s\n", (int)len, s);
+		return -1;
+	}
+
+	memcpy(buf, s, len);
+	if (http_decode_str(buf, len, buf, &olen) ||
+	    olen != rlen || memcmp(buf, ref, rlen))
+	{
+		printf("str in place failed: %.*s\n", (int)len, s);
+		return -1;
+	}
+
+	/* str2 is same as decode until no change */
+	memcpy(tmp, s, len);
+	n = len;
+	for (i = 0; i < HTTP_DECODE_LOOP; i++) {
+		rlen = _ref_decode(tmp, n, ref,
+				   HTTP_DECODE_PLUS | HTTP_DECODE_UNICODE);
+		if (rlen == n && !memcmp(ref, tmp, n))
+			break;
+		memcpy(tmp, ref, rlen);
+		n = rlen;
+	}
+
+	memcpy(buf, s, len);
+	if (i < HTTP_DECODE_LOOP &&
+	    (http_decode_str2(buf, len, buf, &olen) ||
+	     olen != rlen || memcmp(buf, ref, rlen)))
+	{
+		printf("str2 failed: %.*s => %.*s, %.*s\n", (int)len, s,
+		       (int)olen, buf, (int)rlen, ref);
+		return -1;
+	}
+
+	/* stream in random pieces, in place */
+	flags = rand() % 4;
+	rlen = _ref_decode((const u_int8_t *)s, len, ref, flags);
+	memcpy(buf, s, len);
+	http_decode_init(&d, flags);
+	olen = 0;
+	for (pos = 0; pos < len; pos += piece) {
+		piece = 1 + rand() % 8;
+		if (piece > len - pos)
+			piece = len - pos;
+		memcpy(tmp, s + pos, piece);
+		if (http_decode_update(&d, (char *)tmp, piece,
+				       (char *)tmp, &n))
+			return -1;
+		memcpy(out + olen, tmp, n);
+		olen += n;
+	}
+	http_decode_final(&d, out + olen, &n);
+	olen += n;
+
+	if (olen != rlen || memcmp(out, ref, rlen)) {
+		printf("stream failed(flags %d): %.*s\n", flags,
+		       (int)len, s);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ *	Check the decoders by @_g_check random strings.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int
+_do_check(void)
+{
+	char s[_STR_MAX + 1];
+	int len;
+	int i;
+
+	srand(1);
+	for (i = 0; i < _g_check; i++) {
+		len = 1 + rand() % _STR_MAX;
+		_gen_str(s, len, 10 + rand() % 40);
+		if (_check_one(s, len))
+			return -1;
+	}
+
+	printf("check %d random strings OK\n", _g_check);
+	return 0;
+}
+
+static u_int64_t
+_cputime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *	Decode a @_g_size string @_g_loop_times by the reference
+ *	decoder, str, str2 and stream.
+ *
+ * 	Return 0 if success, -1 on error.
+ */
+static int
+_do_bench(void)
+{
+	static const char *names[] = {"byte", "str", "str2", "stream"};
+	char *s, *out;
+	u_int64_t begin, end;
+	http_decode_t d;
+	size_t olen, n, pos;
+	double sec;
+	int i, k;
+
+	s = malloc(_g_size + 1);
+	out = malloc(_g_size + HTTP_DECODE_HOLD);
+	if (!s || !out) {
+		free(s);
+		free(out);
+		return -1;
+	}
+
+	srand(2);
+	_gen_str(s, _g_size, _g_percent);
+
+	for (k = 0; k < 4; k++) {
+		begin = _cputime();
+		for (i = 0; i < _g_loop_times; i++) {
+			switch (k) {
+			case 0:
+				_ref_decode((u_int8_t *)s, _g_size,
+					    (u_int8_t *)out,
+					    HTTP_DECODE_PLUS |
+					    HTTP_DECODE_UNICODE);
+				break;
+			case 1:
+				http_decode_str(s, _g_size, out, &olen);
+				break;
+			case 2:
+				http_decode_str2(s, _g_size, out, &olen);
+				break;
+			default:
+				/* 1460 bytes each piece like TCP */
+				http_decode_init(&d, HTTP_DECODE_PLUS |
+						 HTTP_DECODE_UNICODE);
+				for (pos = 0; pos < (size_t)_g_size;
+				     pos += n)
+				{
+					n = _g_size - pos;
+					if (n > 1460)
+						n = 1460;
+					http_decode_update(&d, s + pos, n,
+							   out, &olen);
+				}
+				http_decode_final(&d, out, &olen);
+				break;
+			}
+		}
+		end = _cputime();
+
+		sec = (end - begin) / 1000000000.0;
+		printf("%s: decode %d bytes(%d%% escaped) %d times, "
+		       "%.1f MB/s\n", names[k], _g_size, _g_percent,
+		       _g_loop_times,
+		       (double)_g_size * _g_loop_times / sec / 1000000.0);
+	}
+
+	free(s);
+	free(out);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	if (_parse_cmd(argc, argv)) {
+		_usage();
+		return -1;
+	}
+
+	if (_do_check())
+		return -1;
+
+	if (_do_bench())
+		return -1;
+
+	return 0;
+}
+
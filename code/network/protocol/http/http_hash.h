@@ -0,0 +1,77 @@
+/**
+ *	@file	http_hash.h
+ *
+ *	@brief	The perfect hash of HTTP header names and methods,
+ *		the hash table is generated by http_hash_gen from
+ *		http_header.list and http_method.list at build time.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#ifndef	FZ_HTTP_HASH_H
+#define	FZ_HTTP_HASH_H
+
+#include <sys/types.h>
+#include <string.h>
+
+#define	HTTP_HASH_FOLD		0x2020202020202020ULL	/* lower case */
+#define	HTTP_HASH_K1		0x9e3779b97f4a7c15ULL
+#define	HTTP_HASH_K2		0xc2b2ae3d27d4eb4fULL
+
+/**
+ *	The hash table entry, the empty entry have zero @len.
+ */
+typedef struct http_hash_ent {
+	const char	*name;		/* the name */
+	u_int8_t	len;		/* name length */
+	u_int8_t	id;		/* the HTTP_HST_XXX/HTTP_MED_XXX */
+} http_hash_ent_t;
+
+/**
+ *	Hash the string @s, only the first 8 bytes, the last 8 bytes
+ *	and the length are used so it's two 8-byte loads for any name.
+ *	The case is ignored if @fold is HTTP_HASH_FOLD, it's not
+ *	real lower case for non-letter but the name is compared
+ *	after hash.
+ *
+ *	Return the 32 bits hash value.
+ */
+static inline u_int32_t 
+http_hash(const char *s, size_t len, u_int64_t seed, u_int64_t fold)
+{
+	u_int64_t a = 0, b = 0;
+	u_int64_t h;
+
+	if (len >= 8) {
+		memcpy(&a, s, 8);
+		memcpy(&b, s + len - 8, 8);
+	}
+	else {
+		/* avoid the memcpy() call of variable length */
+		switch (len) {
+		case 7: a |= (u_int64_t)(u_int8_t)s[6] << 48;
+		case 6: a |= (u_int64_t)(u_int8_t)s[5] << 40;
+		case 5: a |= (u_int64_t)(u_int8_t)s[4] << 32;
+		case 4: a |= (u_int64_t)(u_int8_t)s[3] << 24;
+		case 3: a |= (u_int64_t)(u_int8_t)s[2] << 16;
+		case 2: a |= (u_int64_t)(u_int8_t)s[1] << 8;
+		case 1: a |= (u_int64_t)(u_int8_t)s[0];
+		}
+		b = a;
+	}
+
+	a |= fold;
+	b |= fold;
+
+	h = (a ^ seed) * HTTP_HASH_K1;
+	h ^= (b + len) * HTTP_HASH_K2;
+	h ^= h >> 29;
+	h *= HTTP_HASH_K1;
+
+	return (u_int32_t)(h >> 32);
+}
+
+#endif	/* end of FZ_HTTP_HASH_H */
+
@@ -0,0 +1,203 @@
+/**
+ *	file	http_hash_gen.c
+ *
+ *	brief	Generate the perfect hash table of http_hash.h from a
+ *		list file, each line of list file is "name id", the
+ *		line start with '#' is comment. The table is printed
+ *		to stdout.
+ *
+ *	author	Forrest.zhang
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "http_hash.h"
+
+#define	_NAME_MAX	64
+#define	_ENT_MAX	255
+#define	_BITS_MAX	12
+#define	_SEED_MAX	100000
+
+typedef struct _ent {
+	char		name[_NAME_MAX];
+	char		id[_NAME_MAX];
+	size_t		len;
+} _ent_t;
+
+static _ent_t _g_ents[_ENT_MAX];
+static int _g_nent;
+
+static void
+_usage(void)
+{
+	printf("http_hash_gen [-i] <prefix> <list file>\n");
+	printf("\t-i\tignore case of name\n");
+}
+
+/**
+ *	Load the list file @file into @_g_ents.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int
+_load_list(const char *file)
+{
+	FILE *fp;
+	char line[256];
+	_ent_t *e;
+	int i;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		fprintf(stderr, "open %s failed\n", file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#')
+			continue;
+
+		if (_g_nent >= _ENT_MAX) {
+			fprintf(stderr, "too many names in %s\n", file);
+			fclose(fp);
+			return -1;
+		}
+
+		e = &_g_ents[_g_nent];
+		if (sscanf(line, "%63s %63s", e->name, e->id) != 2)
+			continue;
+		e->len = strlen(e->name);
+
+		for (i = 0; i < _g_nent; i++) {
+			if (strcasecmp(_g_ents[i].name, e->name) == 0) {
+				fprintf(stderr, "duplicate name %s\n", e->name);
+				fclose(fp);
+				return -1;
+			}
+		}
+
+		_g_nent++;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/**
+ *	Find a seed which map all names into different slot of
+ *	a table with 2^@bits slots.
+ *
+ *	Return 0 if found, -1 if not found.
+ */
+static int
+_find_seed(int bits, u_int64_t fold, u_int64_t *seed, int *slot)
+{
+	u_int64_t s;
+	u_int8_t used[1 << _BITS_MAX];
+	u_int32_t h;
+	int i;
+
+	for (s = 1; s < _SEED_MAX; s++) {
+		memset(used, 0, sizeof(used));
+		for (i = 0; i < _g_nent; i++) {
+			h = http_hash(_g_ents[i].name, _g_ents[i].len,
+				      s * HTTP_HASH_K2, fold) >> (32 - bits);
+			if (used[h])
+				break;
+			used[h] = 1;
+			slot[i] = h;
+		}
+
+		if (i == _g_nent) {
+			*seed = s * HTTP_HASH_K2;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static void
+_print_table(const char *prefix, int bits, u_int64_t seed, u_int64_t fold,
+	     const int *slot, const char *file)
+{
+	char upper[_NAME_MAX];
+	int i, j;
+
+	for (i = 0; prefix[i] && i < _NAME_MAX - 1; i++)
+		upper[i] = toupper(prefix[i]);
+	upper[i] = 0;
+
+	printf("/* generated by http_hash_gen from %s, don't edit */\n", file);
+	printf("#define\tHTTP_HASH_%s_SEED\t0x%016llxULL\n",
+	       upper, (unsigned long long)seed);
+	printf("#define\tHTTP_HASH_%s_FOLD\t0x%016llxULL\n",
+	       upper, (unsigned long long)fold);
+	printf("#define\tHTTP_HASH_%s_BITS\t%d\n\n", upper, bits);
+
+	printf("static const http_hash_ent_t _http_hash_%s[%d] = {\n",
+	       prefix, 1 << bits);
+	for (i = 0; i < (1 << bits); i++) {
+		for (j = 0; j < _g_nent; j++) {
+			if (slot[j] == i)
+				break;
+		}
+		if (j == _g_nent)
+			continue;
+
+		printf("\t[%d] = { \"%s\", %zu, %s },\n", i,
+		       _g_ents[j].name, _g_ents[j].len, _g_ents[j].id);
+	}
+	printf("};\n\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	u_int64_t fold = 0;
+	u_int64_t seed;
+	int slot[_ENT_MAX];
+	int bits;
+	char opt;
+
+	while ( (opt = getopt(argc, argv, "ih")) != -1) {
+		switch (opt) {
+		case 'i':
+			fold = HTTP_HASH_FOLD;
+			break;
+		default:
+			_usage();
+			return -1;
+		}
+	}
+
+	if (optind + 2 != argc) {
+		_usage();
+		return -1;
+	}
+
+	if (_load_list(argv[optind + 1]))
+		return -1;
+
+	/* the smallest table which have a perfect hash */
+	for (bits = 1; (1 << bits) < _g_nent; bits++)
+		;
+	for (; bits <= _BITS_MAX; bits++) {
+		if (_find_seed(bits, fold, &seed, slot) == 0)
+			break;
+	}
+
+	if (bits > _BITS_MAX) {
+		fprintf(stderr, "no perfect hash for %s\n", argv[optind + 1]);
+		return -1;
+	}
+
+	_print_table(argv[optind], bits, seed, fold, slot, argv[optind + 1]);
+
+	return 0;
+}
+
@@ -12,7 +12,14 @@
 #include <stdlib.h>
 #include <assert.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define	_HTTP_HAVE_X86		1
+#endif
+
 #include "http_parse.h"
+#include "http_hash.h"
+#include "http_hash_table.h"
 
 
 /**
@@ -28,11 +35,42 @@
 #endif
 
 
-#define _HTTP_CACHE_CHAR(state, ptr)			\
-	if (state->csize < HTTP_MAX_CACHE - 1) {		\
-		state->cache[state->csize] = *ptr;	\
-		state->csize++;				\
-	}
+/* set error number and return NULL */
+#define	_HTTP_FAIL(state, err)				\
+({							\
+	(state)->error = err;				\
+	NULL;						\
+})
+
+/* the state/buffer of direction @dir */
+#define	_HTTP_DIR_STATE(hi, dir)	\
+	((dir) == HTTP_DIR_REQUEST ? &(hi)->req_state : &(hi)->res_state)
+#define	_HTTP_DIR_BUFFER(hi, dir)	\
+	((dir) == HTTP_DIR_REQUEST ? &(hi)->req_buf : &(hi)->res_buf)
+
+
+/**
+ *	Byte class for fast scan: the byte in class stop the scan,
+ *	all bytes before it are handled in bulk. The @lo/@hi are
+ *	nibble bitmap used by SIMD: byte c is in class if
+ *	(@lo[c & 0xf] & @hi[c >> 4]) != 0.
+ */
+typedef struct _http_class {
+	u_int8_t	stop[256];	/* 1 if the byte stop scan */
+	u_int8_t	lo[16];		/* low nibble bitmap */
+	u_int8_t	hi[16];		/* high nibble bitmap */
+	int		simd;		/* nibble bitmap is usable */
+} _http_class_t;
+
+typedef size_t (*_http_scan_func)(const _http_class_t *cls,
+				  const char *buf, size_t siz);
+
+static _http_class_t	_http_cls_token;/* non-token char */
+static _http_class_t	_http_cls_url;	/* CR, LF, SP, '?', '%' */
+static _http_class_t	_http_cls_line;	/* CR, LF */
+static int		_http_simd_max;	/* max level supported by CPU */
+static int		_http_simd;	/* current level */
+static _http_scan_func	_http_scan;	/* scan function of current level */
 
 
 /**
@@ -71,7 +109,7 @@ _http_is_TOKEN(int c)
  *
  *	Return 1 if @c is a valid URL char, 0 means not.
  */
-static int
+static int 
 _http_is_URL(int c)
 {
 	if (c > 31 && c < 127)
@@ -80,158 +118,473 @@ _http_is_URL(int c)
 		return 0;
 }
 
+static int 
+_http_stop_token(int c)
+{
+	return !_http_is_TOKEN(c);
+}
+
+static int 
+_http_stop_url(int c)
+{
+	return (c == HTTP_CHR_CR || c == HTTP_CHR_LF || c == HTTP_CHR_SP ||
+		c == '?' || c == HTTP_CHR_PERCENT);
+}
+
+static int 
+_http_stop_line(int c)
+{
+	return (c == HTTP_CHR_CR || c == HTTP_CHR_LF);
+}
+
 /**
- *	Detect the content type. the @buf length is @siz.
+ *	Init the byte class @cls, the byte @c stop scan if
+ *	@is_stop(c) return non-zero. The high nibbles which have
+ *	same low nibble set share one bit in nibble bitmap, so
+ *	the class can be scanned by SIMD if no more than 8 kinds
+ *	of low nibble set.
  *
- *	Return the content type defined in http_protocol.h
+ *	No return.
  */
-static u_int8_t 
-_http_CTYPE(const char *buf, size_t siz)
+static void 
+_http_init_class(_http_class_t *cls, int (*is_stop)(int c))
 {
-	assert(buf);
-	assert(siz > 0);
+	int c;
+	int h, l, i;
+	int ngrp = 0;
+	u_int16_t grp[8];
+	u_int16_t set;
+
+	memset(cls, 0, sizeof(*cls));
+
+	for (c = 0; c < 256; c++)
+		cls->stop[c] = is_stop(c) ? 1 : 0;
+
+	for (h = 0; h < 16; h++) {
+		set = 0;
+		for (l = 0; l < 16; l++) {
+			if (cls->stop[(h << 4) | l])
+				set |= 1 << l;
+		}
+		if (!set)
+			continue;
 
-	if (siz >= 9 && strncasecmp(buf, "text/html", 9) == 0) {
-		return HTTP_CTE_TEXT_HTML;
+		for (i = 0; i < ngrp; i++) {
+			if (grp[i] == set)
+				break;
+		}
+		if (i == ngrp) {
+			if (ngrp == 8)
+				return;
+			grp[ngrp++] = set;
+		}
+		cls->hi[h] = 1 << i;
 	}
 
-	if (siz >= 8 && strncasecmp(buf, "text/xml", 8) == 0) {
-		return HTTP_CTE_TEXT_XML;
+	for (i = 0; i < ngrp; i++) {
+		for (l = 0; l < 16; l++) {
+			if (grp[i] & (1 << l))
+				cls->lo[l] |= 1 << i;
+		}
 	}
 
-	if (siz >= 9 && strncasecmp(buf, "text/plain", 10) == 0) {
-		return HTTP_CTE_TEXT_PLAIN;
+	cls->simd = 1;
+}
+
+/**
+ *	Scan @buf by lookup table.
+ *
+ *	Return the number of bytes before first stop byte.
+ */
+static size_t 
+_http_scan_table(const _http_class_t *cls, const char *buf, size_t siz)
+{
+	const u_int8_t *ptr = (const u_int8_t *)buf;
+	size_t i = 0;
+
+	while (i + 4 <= siz) {
+		if (cls->stop[ptr[i]])
+			return i;
+		if (cls->stop[ptr[i + 1]])
+			return i + 1;
+		if (cls->stop[ptr[i + 2]])
+			return i + 2;
+		if (cls->stop[ptr[i + 3]])
+			return i + 3;
+		i += 4;
 	}
 
-	return HTTP_CTE_UNKOWNED;
+	for (; i < siz; i++) {
+		if (cls->stop[ptr[i]])
+			return i;
+	}
+
+	return siz;
 }
 
-static void 
-_http_check_METHOD(http_info_t *info)
+#ifdef	_HTTP_HAVE_X86
+
+/**
+ *	Scan @buf 16 bytes each time by SSSE3 pshufb.
+ *
+ *	Return the number of bytes before first stop byte.
+ */
+__attribute__((target("ssse3"))) static size_t 
+_http_scan_ssse3(const _http_class_t *cls, const char *buf, size_t siz)
 {
-	http_state_t *state;
-	http_request_t *req;
+	size_t i = 0;
+	u_int32_t bits;
+	__m128i lo, hi, mask, zero, v, m;
+
+	if (!cls->simd)
+		return _http_scan_table(cls, buf, siz);
+
+	lo = _mm_loadu_si128((const __m128i *)cls->lo);
+	hi = _mm_loadu_si128((const __m128i *)cls->hi);
+	mask = _mm_set1_epi8(0x0f);
+	zero = _mm_setzero_si128();
+
+	while (i + 16 <= siz) {
+		v = _mm_loadu_si128((const __m128i *)(buf + i));
+		m = _mm_and_si128(
+			_mm_shuffle_epi8(lo, _mm_and_si128(v, mask)),
+			_mm_shuffle_epi8(hi, _mm_and_si128(
+				_mm_srli_epi16(v, 4), mask)));
+		bits = _mm_movemask_epi8(_mm_cmpeq_epi8(m, zero)) ^ 0xffff;
+		if (bits)
+			return i + __builtin_ctz(bits);
+		i += 16;
+	}
 
-	assert(info);
-	
-	req = &info->request;
-	state = &info->req_state;
+	return i + _http_scan_table(cls, buf + i, siz - i);
+}
+
+/**
+ *	Scan @buf 32 bytes each time by AVX2 vpshufb.
+ *
+ *	Return the number of bytes before first stop byte.
+ */
+__attribute__((target("avx2"))) static size_t 
+_http_scan_avx2(const _http_class_t *cls, const char *buf, size_t siz)
+{
+	size_t i = 0;
+	u_int32_t bits;
+	__m256i lo, hi, mask, zero, v, m;
+
+	if (!cls->simd)
+		return _http_scan_table(cls, buf, siz);
+
+	/* short token is common, not worth to load 32 bytes */
+	if (siz < 32)
+		return _http_scan_table(cls, buf, siz);
+
+	lo = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *)cls->lo));
+	hi = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *)cls->hi));
+	mask = _mm256_set1_epi8(0x0f);
+	zero = _mm256_setzero_si256();
+
+	while (i + 32 <= siz) {
+		v = _mm256_loadu_si256((const __m256i *)(buf + i));
+		m = _mm256_and_si256(
+			_mm256_shuffle_epi8(lo, _mm256_and_si256(v, mask)),
+			_mm256_shuffle_epi8(hi, _mm256_and_si256(
+				_mm256_srli_epi16(v, 4), mask)));
+		bits = ~(u_int32_t)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(m, zero));
+		if (bits)
+			return i + __builtin_ctz(bits);
+		i += 32;
+	}
 
-	switch (state->cache[0]) {
-		
-	case 'O':
+	return i + _http_scan_table(cls, buf + i, siz - i);
+}
 
-		if (state->csize != 7 || strncmp(state->cache, "OPTIONS", 7))
-			req->method = HTTP_MED_EXTENSION;
-		else
-			req->method = HTTP_MED_OPTIONS;
-		break;
+#endif	/* end of _HTTP_HAVE_X86 */
 
-	case 'G':
-		
-		if (state->csize != 3 || strncmp(state->cache, "GET", 3))
-			req->method = HTTP_MED_EXTENSION;
-		else
-			req->method = HTTP_MED_GET;
-		break;
+/**
+ *	Init the byte classes and detect CPU features, it's called
+ *	before main().
+ *
+ *	No return.
+ */
+__attribute__((constructor)) static void 
+_http_init_scan(void)
+{
+	_http_init_class(&_http_cls_token, _http_stop_token);
+	_http_init_class(&_http_cls_url, _http_stop_url);
+	_http_init_class(&_http_cls_line, _http_stop_line);
+
+	_http_simd_max = HTTP_SIMD_TABLE;
+#ifdef	_HTTP_HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3"))
+		_http_simd_max = HTTP_SIMD_SSSE3;
+	if (__builtin_cpu_supports("avx2"))
+		_http_simd_max = HTTP_SIMD_AVX2;
+#endif
 
-	case 'H':
+	http_set_simd(_http_simd_max);
+}
 
-		if (state->csize != 4 || strncmp(state->cache, "HEAD", 4))
-			req->method = HTTP_MED_EXTENSION;
-		else
-			req->method = HTTP_MED_HEAD;
+/**
+ *	Append @n bytes in @ptr into buffer @b, the buffer is
+ *	doubled if it's full, but can't exceed HTTP_MAX_BUF.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_http_buf_append(http_buffer_t *b, const char *ptr, size_t n)
+{
+	size_t size;
+	char *data;
+
+	if (b->len + n > b->size) {
+		size = b->size ? b->size : HTTP_MIN_BUF;
+		while (size < b->len + n)
+			size *= 2;
+		if (size > HTTP_MAX_BUF)
+			return -1;
 
-		break;
+		data = realloc(b->data, size);
+		if (!data)
+			return -1;
 
-	case 'P':
-		
-		if (state->csize == 3 && !strncmp(state->cache, "PUT", 3))
-			req->method = HTTP_MED_PUT;
-		else if (state->csize == 4&&!strncmp(state->cache, "POST", 4))
-			req->method = HTTP_MED_POST;
-		else
-			req->method = HTTP_MED_EXTENSION;
-		break;
+		b->data = data;
+		b->size = size;
+	}
 
-	case 'D':
+	memcpy(b->data + b->len, ptr, n);
+	b->len += n;
 
-		if (state->csize != 6 || strncmp(state->cache, "DELETE", 6))
-			req->method = HTTP_MED_EXTENSION;
-		else
-			req->method = HTTP_MED_DELETE;
-		break;
+	return 0;
+}
+
+/**
+ *	Save the unfinished token [@begin, @begin + @n) into @b
+ *	before return to caller, the caller's buffer can't be
+ *	refered after http_parse() returned.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_http_tok_save(http_buffer_t *b, http_state_t *state,
+	       const char *begin, size_t n)
+{
+	if (!state->tokbuf) {
+		state->tokbuf = 1;
+		state->tokoff = b->len;
+	}
 
-	case 'T':
+	return _http_buf_append(b, begin, n);
+}
 
-		if (state->csize != 5 || strncmp(state->cache, "TRACE", 5))
-			req->method = HTTP_MED_EXTENSION;
-		else
-			req->method = HTTP_MED_TRACE;
-		break;
+/**
+ *	Get the finished token, the last part is [@begin, @begin + @n)
+ *	in caller's buffer, the head part is in @b if it's split. The
+ *	token is stored in @tok and @len.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_http_tok_get(http_buffer_t *b, http_state_t *state,
+	      const char *begin, size_t n, const char **tok, size_t *len)
+{
+	if (!state->tokbuf) {
+		*tok = begin;
+		*len = n;
+		return 0;
+	}
+
+	if (_http_buf_append(b, begin, n))
+		return -1;
 
-	case 'C':
+	*tok = b->data + state->tokoff;
+	*len = b->len - state->tokoff;
+	return 0;
+}
 
-		if (state->csize != 7 || strncmp(state->cache, "CONNECT", 7))
-			req->method = HTTP_MED_EXTENSION;
-		else
-			req->method = HTTP_MED_CONNECT;
-		break;
+/**
+ *	Finish the token, the split token in @b is released if
+ *	@keep is zero.
+ *
+ *	No return.
+ */
+static void 
+_http_tok_end(http_buffer_t *b, http_state_t *state, int keep)
+{
+	if (state->tokbuf && !keep)
+		b->len = state->tokoff;
 
-	default:
+	state->tokbuf = 0;
+	state->tokoff = 0;
+}
 
-		req->method = HTTP_MED_EXTENSION;
-		break;
+/**
+ *	Store the finished token @tok:@len into string @s, @tok is
+ *	returned by _http_tok_get().
+ *
+ *	No return.
+ */
+static void 
+_http_tok_store(http_buffer_t *b, http_state_t *state, http_string_t *s,
+		const char *tok, size_t len)
+{
+	if (state->tokbuf) {
+		s->in_buf = 1;
+		s->off = tok - b->data;
+		s->ptr = NULL;
+	}
+	else {
+		s->in_buf = 0;
+		s->off = 0;
+		s->ptr = tok;
+	}
+	s->len = len;
+}
+
+/**
+ *	Get the data pointer of string @s, @b is the buffer of @s.
+ *
+ *	Return the pointer, NULL if @s is empty.
+ */
+static const char * 
+_http_str_ptr(const http_buffer_t *b, const http_string_t *s)
+{
+	if (s->in_buf)
+		return b->data + s->off;
+
+	return s->ptr;
+}
+
+/**
+ *	Detect the content type. the @buf length is @siz.
+ *
+ *	Return the content type defined in http_protocol.h
+ */
+static u_int8_t 
+_http_CTYPE(const char *buf, size_t siz)
+{
+	assert(buf);
+
+	if (siz >= 9 && strncasecmp(buf, "text/html", 9) == 0) {
+		return HTTP_CTE_TEXT_HTML;
+	}
+
+	if (siz >= 8 && strncasecmp(buf, "text/xml", 8) == 0) {
+		return HTTP_CTE_TEXT_XML;
 	}
+
+	if (siz >= 10 && strncasecmp(buf, "text/plain", 10) == 0) {
+		return HTTP_CTE_TEXT_PLAIN;
+	}
+
+	return HTTP_CTE_UNKOWNED;
+}
+
+/**
+ *	Find the name @tok:@len in perfect hash table @tbl which
+ *	generated by http_hash_gen.
+ *
+ *	Return the id if found, -1 if not found.
+ */
+static inline int 
+_http_hash_find(const http_hash_ent_t *tbl, int bits, u_int64_t seed,
+		u_int64_t fold, const char *tok, size_t len)
+{
+	const http_hash_ent_t *e;
+
+	e = &tbl[http_hash(tok, len, seed, fold) >> (32 - bits)];
+	if (e->len != len)
+		return -1;
+
+	if (fold) {
+		if (strncasecmp(e->name, tok, len))
+			return -1;
+	}
+	else {
+		if (memcmp(e->name, tok, len))
+			return -1;
+	}
+
+	return e->id;
+}
+
+static void 
+_http_check_METHOD(http_info_t *info, const char *tok, size_t len)
+{
+	int id;
+
+	assert(info);
+	assert(tok);
+
+	id = _http_hash_find(_http_hash_med, HTTP_HASH_MED_BITS,
+			     HTTP_HASH_MED_SEED, HTTP_HASH_MED_FOLD, tok, len);
+	info->request.method = id < 0 ? HTTP_MED_EXTENSION : id;
 }
 
-/** 
- *	Parse HTTP METHOD, we first store token in req->cache, then if 
- *	whole token is stored or token length is exceed cache size, 
- *	stop cache and eat all other token chars until a SP.
+/**
+ *	Parse HTTP METHOD, the METHOD token is refered in @buf
+ *	directly, it's copied into request buffer only if it's
+ *	split by two @buf.
  *
  *	Return pointer to char after METHOD, NULL on error
  */
-static const char *
+static const char * 
 _http_METHOD(http_info_t *info, const char *buf, size_t siz)
 {
-	int remain;
+	size_t n;
+	size_t remain;
+	size_t len;
 	const char *ptr;
+	const char *begin;
+	const char *tok;
 	http_state_t *state;
-	http_request_t *req;
+	http_buffer_t *b;
 
 	assert(info);
 	assert(buf);
 	assert(siz > 0);
 
-	req = &info->request;
 	state = &info->req_state;
+	b = &info->req_buf;
 
-	state->line = 1;
-	state->col = 1;
-	state->csize = 0;
 	ptr = buf;
+	begin = buf;
 	remain = siz;
 	while (remain) {
-		
+
+		/* eat token chars in bulk */
+		if (state->tstate == HTTP_TST_IN && _http_simd) {
+			n = _http_scan(&_http_cls_token, ptr, remain);
+			ptr += n;
+			remain -= n;
+			state->pos += n;
+			state->col += n;
+			if (!remain)
+				break;
+		}
+
 		switch (state->tstate) {
 
 		case HTTP_TST_BEGIN:
 
-			/* skip space */
-			if (*ptr == HTTP_CHR_SP || *ptr == HTTP_CHR_HT)
+			/* skip space, and empty lines before request 
+			 * line(RFC 7230 3.5) */
+			if (*ptr == HTTP_CHR_SP || *ptr == HTTP_CHR_HT ||
+			    *ptr == HTTP_CHR_CR || *ptr == HTTP_CHR_LF)
 				break;
 
 			/* is token char */
 			if (!_http_is_TOKEN(*ptr)) {
-				_HTTP_ERR("[%u:%u]: invalid token char %u\n", 
+				_HTTP_ERR("[%u:%u]: invalid token char %u\n",
 					  state->line, state->col, *ptr);
-				return NULL;
+				return _HTTP_FAIL(state, HTTP_ERR_METHOD);
 			}
 
-			/* cache char */
-			_HTTP_CACHE_CHAR(state, ptr);
 			state->tstate = HTTP_TST_IN;
+			begin = ptr;
 
 			break;
 
@@ -245,19 +598,16 @@ _http_METHOD(http_info_t *info, const char *buf, size_t siz)
 
 			/* check token char */
 			if (!_http_is_TOKEN(*ptr)) {
-				_HTTP_ERR("[%u:%u]: invalid token char %u\n", 
+				_HTTP_ERR("[%u:%u]: invalid token char %u\n",
 					  state->line, state->col, *ptr);
-				return NULL;
+				return _HTTP_FAIL(state, HTTP_ERR_METHOD);
 			}
 
-			/* cache char if have cache space */
-			_HTTP_CACHE_CHAR(state, ptr);
-
 			break;
 
 		default:
 			_HTTP_ERR("invalide token state %d\n", state->tstate);
-			return NULL;
+			return _HTTP_FAIL(state, HTTP_ERR_METHOD);
 		}
 
 		if (state->tstate == HTTP_TST_FIN)
@@ -270,20 +620,25 @@ _http_METHOD(http_info_t *info, const char *buf, size_t siz)
 	}
 
 	/* token is not finished */
-	if (state->tstate != HTTP_TST_FIN)
+	if (state->tstate != HTTP_TST_FIN) {
+		if (state->tstate == HTTP_TST_IN &&
+		    _http_tok_save(b, state, begin, ptr - begin))
+			return _HTTP_FAIL(state, HTTP_ERR_CACHE_OVERSIZE);
 		return ptr;
+	}
 
 	/* decide method */
-	state->cache[state->csize] = 0;
-	_http_check_METHOD(info);
+	if (_http_tok_get(b, state, begin, ptr - begin, &tok, &len))
+		return _HTTP_FAIL(state, HTTP_ERR_CACHE_OVERSIZE);
+	_http_check_METHOD(info, tok, len);
+	_http_tok_end(b, state, 0);
 
-	_HTTP_STATE("method(%u): %s\n", req->method, state->cache);
+	_HTTP_STATE("method(%u): %.*s\n", info->request.method, (int)len, tok);
 
 	/* change state */
 	state->pstate = state->mstate;
 	state->mstate = HTTP_STE_URL;
 	state->tstate = HTTP_TST_BEGIN;
-	state->csize = 0;
 	state->tokpos = 0;
 
 	return ptr;
@@ -291,60 +646,75 @@ _http_METHOD(http_info_t *info, const char *buf, size_t siz)
 
 
 /**
- *	Parse HTTP request URL.
+ *	Parse HTTP request URL, the URL is a view of @buf if it's
+ *	not split.
  *
  *	Return pointer to char after URL, NULL on error.
  */
-static const char *
+static const char * 
 _http_URL(http_info_t *info, const char *buf, size_t siz)
 {
+	size_t n;
+	size_t remain;
+	size_t len;
 	const char *ptr;
 	const char *begin;
+	const char *tok;
 	http_string_t *url;
-	int remain;
-	size_t ulen = 0;
 	http_state_t *state;
+	http_buffer_t *b;
 
 	assert(info);
 	assert(buf);
 	assert(siz > 0);
 
-	state = &info->reqst;
-	b = &info->buffer;
-	url = &info->para.oriurl;
+	state = &info->req_state;
+	b = &info->req_buf;
+	url = &info->request.oriurl;
 
 	ptr = buf;
 	begin = buf;
 	remain = siz;
 	while (remain) {
 
+		/* eat URL chars in bulk */
+		if (state->tstate == HTTP_TST_IN && _http_simd) {
+			n = _http_scan(&_http_cls_url, ptr, remain);
+			ptr += n;
+			remain -= n;
+			state->pos += n;
+			state->col += n;
+			if (!remain)
+				break;
+		}
+
 		switch (state->tstate) {
 
 		case HTTP_TST_BEGIN:
-			
+
 			/* skip start SPACE */
 			if (*ptr == HTTP_CHR_SP)
 				break;
 
 			/* check first char */
 			if (!_http_is_URL(*ptr)) {
-				_HTTP_ERR("[%u:%u]: invalid url char %u\n", 
-					  info->line, info->col, *ptr);
-				return NULL;
+				_HTTP_ERR("[%u:%u]: invalid url char %u\n",
+					  state->line, state->col, *ptr);
+				return _HTTP_FAIL(state, HTTP_ERR_URL);
 			}
 
 			state->tstate = HTTP_TST_IN;
-			//_http_alloc_memory(b, url);
+			url->ori_start = state->pos;
 			begin = ptr;
-			
+
 			break;
 
 		case HTTP_TST_IN:
-			
+
 			/* end of header line */
-			if (*ptr == HTTP_CHR_CR || 
+			if (*ptr == HTTP_CHR_CR ||
 			    *ptr == HTTP_CHR_LF ||
-			    *ptr == HTTP_CHR_SP) 
+			    *ptr == HTTP_CHR_SP)
 			{
 				state->tstate = HTTP_TST_FIN;
 			}
@@ -352,40 +722,43 @@ _http_URL(http_info_t *info, const char *buf, size_t siz)
 			if (*ptr == '?')
 				url->have_arg = 1;
 
-			if (*ptr == '%')
+			if (*ptr == HTTP_CHR_PERCENT)
 				url->is_encoded = 1;
 
 			break;
 
 		default:
 			_HTTP_ERR("invalid token state %d\n", state->tstate);
-			return NULL;
+			return _HTTP_FAIL(state, HTTP_ERR_URL);
 
 		}
-		
+
 		if (state->tstate == HTTP_TST_FIN)
 			break;
 
-		ulen++;
-		remain --;
-		ptr ++;
-		info->pos++;
-		info->col++;		
+		remain--;
+		ptr++;
+		state->pos++;
+		state->col++;
 	}
 
 	if (state->tstate != HTTP_TST_FIN) {
-		_http_copy_memory(b, url, begin, ulen, 0);
+		if (state->tstate == HTTP_TST_IN &&
+		    _http_tok_save(b, state, begin, ptr - begin))
+			return _HTTP_FAIL(state, HTTP_ERR_CACHE_OVERSIZE);
 		return ptr;
 	}
 
-	_http_copy_memory(b, url, begin, ulen, 1);
+	if (_http_tok_get(b, state, begin, ptr - begin, &tok, &len))
+		return _HTTP_FAIL(state, HTTP_ERR_CACHE_OVERSIZE);
+	_http_tok_store(b, state, url, tok, len);
+	_http_tok_end(b, state, 1);
+
+	_HTTP_STATE("URL: %.*s\n", (int)len, tok);
 
-	//_HTTP_STATE("URL: %s\n", _http_string_ptr(b, url));
-	
 	state->pstate = state->mstate;
 	state->mstate = HTTP_STE_VERSION;
 	state->tstate = HTTP_TST_BEGIN;
-	state->csize = 0;
 	state->tokpos = 0;
 
 	return ptr;
@@ -393,27 +766,28 @@ _http_URL(http_info_t *info, const char *buf, size_t siz)
 
 
 /**
- *	Parse HTTP response code.
+ *	Parse HTTP response code, the 3 digits is accumulated
+ *	in response so it need not be stored.
  *
  *	Return pointer to next char after response code, NULL on error
  */
-static const char *
+static const char * 
 _http_CODE(http_info_t *info, const char *buf, size_t siz)
 {
 	const char *ptr;
-	int remain;
+	size_t remain;
 	http_state_t *state;
 
 	assert(info);
 	assert(buf);
 	assert(siz > 0);
-	
-	state = &info->resst;
+
+	state = &info->res_state;
 
 	ptr = buf;
 	remain = siz;
 	while (remain > 0) {
-		
+
 		switch (state->tstate) {
 
 		case HTTP_TST_BEGIN:
@@ -422,12 +796,12 @@ _http_CODE(http_info_t *info, const char *buf, size_t siz)
 				break;
 
 			if (!isdigit(*ptr)) {
-				_HTTP_ERR("[%u:%u]: invalid token char %u\n", 
-					  info->line, info->col, *ptr);
-				return NULL;
+				_HTTP_ERR("[%u:%u]: invalid token char %u\n",
+					  state->line, state->col, *ptr);
+				return _HTTP_FAIL(state, HTTP_ERR_CODE);
 			}
 
-			_HTTP_CACHE_CHAR(state, ptr);
+			info->response.retcode = *ptr - '0';
 			state->tstate = HTTP_TST_IN;
 			state->tokpos = 1;
 
@@ -435,54 +809,53 @@ _http_CODE(http_info_t *info, const char *buf, size_t siz)
 
 		case HTTP_TST_IN:
 
-			if (*ptr == HTTP_CHR_SP && state->tokpos != 4) {
+			/* the code is 3 digits */
+			if (*ptr == HTTP_CHR_SP || *ptr == HTTP_CHR_HT ||
+			    *ptr == HTTP_CHR_CR || *ptr == HTTP_CHR_LF)
+			{
+				if (state->tokpos != 3) {
+					_HTTP_ERR("[%u:%u]: invalid code\n",
+						  state->line, state->col);
+					return _HTTP_FAIL(state, HTTP_ERR_CODE);
+				}
 				state->tstate = HTTP_TST_FIN;
 				break;
 			}
 
-			if (!isdigit(*ptr)) {
-				_HTTP_ERR("[%u:%u]: invalid token char %u\n", 
-					  info->line, info->col, *ptr);
-				return NULL;
-			}
-
-			if (state->tokpos > 3) {
-				_HTTP_ERR("[%u:%u]: invalid token char %u\n", 
-					  info->line, info->col, *ptr);
-				return NULL;
+			if (!isdigit(*ptr) || state->tokpos >= 3) {
+				_HTTP_ERR("[%u:%u]: invalid token char %u\n",
+					  state->line, state->col, *ptr);
+				return _HTTP_FAIL(state, HTTP_ERR_CODE);
 			}
 
-			_HTTP_CACHE_CHAR(state, ptr);
+			info->response.retcode *= 10;
+			info->response.retcode += *ptr - '0';
 			state->tokpos++;
 
 			break;
 
 		default:
 			_HTTP_ERR("invalid token state %d\n", state->tstate);
-			return NULL;
+			return _HTTP_FAIL(state, HTTP_ERR_CODE);
 		}
 
-		ptr++;
-		remain--;
-		info->pos++;
-		info->col++;
-
 		if (state->tstate == HTTP_TST_FIN)
 			break;
+
+		ptr++;
+		remain--;
+		state->pos++;
+		state->col++;
 	}
 
 	if (state->tstate != HTTP_TST_FIN)
 		return ptr;
 
-	state->cache[state->csize] = 0;
-	info->response.retcode = atoi(state->cache);
-
 	_HTTP_STATE("response code is %d\n", info->response.retcode);
 
 	state->pstate = state->mstate;
 	state->mstate = HTTP_STE_REASON;
 	state->tstate = HTTP_TST_BEGIN;
-	state->csize = 0;
 	state->tokpos = 0;
 
 	return ptr;
@@ -490,59 +863,68 @@ _http_CODE(http_info_t *info, const char *buf, size_t siz)
 
 
 /**
- *	Parse HTTP response reason string
+ *	Parse HTTP response reason string, it's skipped.
  *
  *	Return next char after reasion token, NULL on error.
  */
-static const char *
+static const char * 
 _http_REASON(http_info_t *info, const char *buf, size_t siz)
 {
+	size_t n;
 	const char *ptr;
-	int remain;
+	size_t remain;
 	http_state_t *state;
 
 	assert(info);
 	assert(buf);
 	assert(siz > 0);
 
-	state = &info->resst;
-	
+	state = &info->res_state;
+
 	ptr = buf;
 	remain = siz;
 	while (remain) {
 
+		/* eat reason chars in bulk */
+		if (state->tstate == HTTP_TST_IN && _http_simd) {
+			n = _http_scan(&_http_cls_line, ptr, remain);
+			ptr += n;
+			remain -= n;
+			state->pos += n;
+			state->col += n;
+			if (!remain)
+				break;
+		}
+
 		switch (state->tstate) {
 
 		case HTTP_TST_BEGIN:
-			
+
 			if (*ptr == HTTP_CHR_SP || *ptr == HTTP_CHR_HT)
 				break;
 
+			/* empty reason */
 			if (*ptr == HTTP_CHR_CR || *ptr == HTTP_CHR_LF) {
-				_HTTP_ERR("[%u:%u]: invalid token char %u\n", 
-					  info->line, info->col, *ptr);
-				return NULL;
+				state->tstate = HTTP_TST_FIN;
+				break;
 			}
 
-			_HTTP_CACHE_CHAR(state, ptr);
-			state->tstate = HTTP_TST_IN;			
+			state->tstate = HTTP_TST_IN;
 
 			break;
 
 		case HTTP_TST_IN:
-			
+
 			if (*ptr == HTTP_CHR_CR || *ptr == HTTP_CHR_LF) {
 				state->tstate = HTTP_TST_FIN;
 				break;
 			}
 
-			_HTTP_CACHE_CHAR(state, ptr);
-
 			break;
 
 		default:
 			_HTTP_ERR("invalid token state %d\n", state->tstate);
-			return NULL;
+			return _HTTP_FAIL(state, HTTP_ERR_CODE);
 		}
 
 		/* the last token before CRLF didn't eat CR */
@@ -551,20 +933,18 @@ _http_REASON(http_info_t *info, const char *buf, size_t siz)
 
 		remain --;
 		ptr ++;
-		info->pos++;
-		info->col++;
+		state->pos++;
+		state->col++;
 	}
 
 	if (state->tstate != HTTP_TST_FIN)
 		return ptr;
 
-	state->cache[state->csize] = 0;
-	_HTTP_STATE("response reason: %s\n", state->cache);
+	_HTTP_STATE("response reason finished\n");
 
 	state->pstate = state->mstate;
 	state->mstate = HTTP_STE_CRLF;
 	state->tstate = HTTP_TST_BEGIN;
-	state->csize = 0;
 	state->tokpos = 0;
 
 	return ptr;
@@ -572,77 +952,87 @@ _http_REASON(http_info_t *info, const char *buf, size_t siz)
 
 
 /**
- *	Parse HTTP version token. if req is not zero, the @buf is a 
+ *	Parse HTTP version token. if req is not zero, the @buf is a
  *	request buffer, else it's a response buffer.
  *
- *	Return pointer to char after version token if success, 
+ *	Return pointer to char after version token if success,
  *	NULL on error.
  */
-static const char *
-_http_VERSION(http_info_t *info, const char *buf, size_t siz, http_dir_e dir)
+static const char * 
+_http_VERSION(http_info_t *info, const char *buf, size_t siz, int dir)
 {
 	const char *ptr;
-	int remain;
+	const char *begin;
+	const char *tok;
+	size_t remain;
+	size_t len;
 	http_state_t *state;
+	http_buffer_t *b;
 	u_int8_t *ver;
 
 	assert(info);
 	assert(buf);
 	assert(siz > 0);
-	
 
-	if (dir == HTTP_DIR_REQUEST) {
+	if (dir == HTTP_DIR_REQUEST)
 		ver = &info->request.version;
-		state = &info->reqst;
-	}
-	else {
+	else
 		ver = &info->response.version;
-		state = &info->resst;
-	}
-	
-	info->line = 1;
-	info->col = 1;
+	state = _HTTP_DIR_STATE(info, dir);
+	b = _HTTP_DIR_BUFFER(info, dir);
+
 	ptr = buf;
+	begin = buf;
 	remain = siz;
 	while (remain > 0) {
 
 		switch (state->tstate) {
 
 		case HTTP_TST_BEGIN:
-			
+
 			if (*ptr == HTTP_CHR_SP || *ptr == HTTP_CHR_HT)
 				break;
 
 			if (*ptr != 'H') {
-				_HTTP_ERR("[%u:%u]: invalid token char %u\n", 
-					  info->line, info->col, *ptr);
-				return NULL;
+				_HTTP_ERR("[%u:%u]: invalid token char %u\n",
+					  state->line, state->col, *ptr);
+				return _HTTP_FAIL(state, HTTP_ERR_VERSION);
 			}
 
-			_HTTP_CACHE_CHAR(state, ptr);
-			state->tokpos = 0;
+			state->tokpos = 1;
 			state->tstate = HTTP_TST_IN;
+			begin = ptr;
 			break;
 
 		case HTTP_TST_IN:
 
+			/* version end */
+			if (*ptr == HTTP_CHR_SP || *ptr == HTTP_CHR_HT ||
+			    *ptr == HTTP_CHR_CR || *ptr == HTTP_CHR_LF)
+			{
+				state->tstate = HTTP_TST_FIN;
+				break;
+			}
+
 			/* not match "HTTP/" */
-			if ( ( (state->tokpos == 1 || state->tokpos == 2) 
-			       && *ptr != 'T') 
-			     || ( state->tokpos == 3 && *ptr != 'P') 
-			     || ( state->tokpos == 4 && *ptr != '/')) 
-			{				
-				_HTTP_ERR("[%u:%u]: invalid token char %u\n", 
-					  info->line, info->col, *ptr);
-				return NULL;
+			if ( ( (state->tokpos == 1 || state->tokpos == 2)
+			       && *ptr != 'T')
+			     || ( state->tokpos == 3 && *ptr != 'P')
+			     || ( state->tokpos == 4 && *ptr != '/')
+			     || ( state->tokpos > 4 && !isdigit(*ptr)
+				  && *ptr != '.'))
+			{
+				_HTTP_ERR("[%u:%u]: invalid token char %u\n",
+					  state->line, state->col, *ptr);
+				return _HTTP_FAIL(state, HTTP_ERR_VERSION);
 			}
 
-			_HTTP_CACHE_CHAR(state, ptr);
+			state->tokpos++;
 			break;
-			
+
 		default:
 			_HTTP_ERR("invalid token state %d\n", state->tstate);
-			return NULL;
+			return _HTTP_FAIL(state, HTTP_ERR_VERSION);
 		}
 
 		if (state->tstate == HTTP_TST_FIN)
@@ -650,20 +1040,25 @@ _http_VERSION(http_info_t *info, const char *buf, size_t siz, http_dir_e dir)
 
 		ptr++;
 		remain--;
-		state->tokpos++;
-		info->pos++;
-		info->col++;
+		state->pos++;
+		state->col++;
 	}
-	
-	if (state->tstate != HTTP_TST_FIN)
+
+	if (state->tstate != HTTP_TST_FIN) {
+		if (state->tstate == HTTP_TST_IN &&
+		    _http_tok_save(b, state, begin, ptr - begin))
+			return _HTTP_FAIL(state, HTTP_ERR_CACHE_OVERSIZE);
 		return ptr;
-	
-	state->cache[state->csize] = 0;	
-	if (state->csize == 8 && state->cache[5] == '1') {
-		if (state->cache[7] == '0') {
+	}
+
+	if (_http_tok_get(b, state, begin, ptr - begin, &tok, &len))
+		return _HTTP_FAIL(state, HTTP_ERR_CACHE_OVERSIZE);
+
+	if (len == 8 && tok[5] == '1' && tok[6] == '.') {
+		if (tok[7] == '0') {
 			*ver = HTTP_VER_10;
 		}
-		else if (state->cache[7] == '1') {
+		else if (tok[7] == '1') {
 			*ver = HTTP_VER_11;
 		}
 		else {
@@ -674,14 +1069,14 @@ _http_VERSION(http_info_t *info, const char *buf, size_t siz, http_dir_e dir)
 		*ver = HTTP_VER_UNKOWNED;
 	}
 
-	_HTTP_STATE("version(%d): %s\n", *ver, state->cache);
+	_HTTP_STATE("version(%d): %.*s\n", *ver, (int)len, tok);
+	_http_tok_end(b, state, 0);
 
 	state->pstate = state->mstate;
 	state->tstate = HTTP_TST_BEGIN;
-	state->csize = 0;
 	state->tokpos = 0;
 
-	if (info->msg_type == HTTP_REQUEST)
+	if (dir == HTTP_DIR_REQUEST)
 		state->mstate = HTTP_STE_CRLF;
 	else
 		state->mstate = HTTP_STE_CODE;
@@ -690,34 +1085,103 @@ _http_VERSION(http_info_t *info, const char *buf, size_t siz, http_dir_e dir)
 }
 
 
+/**
+ *	Decide the state after header finished.
+ *
+ *	Return 0 if success, HTTP_ERR_XXX on error.
+ */
+static int 
+_http_header_end(http_info_t *info, int dir)
+{
+	http_state_t *state;
+	u_int64_t clen;
+	int code;
+
+	state = _HTTP_DIR_STATE(info, dir);
+
+	_HTTP_STATE("header finished\n");
+
+	if (dir == HTTP_DIR_REQUEST) {
+		info->request.header_len = state->pos;
+		clen = info->request.content_len;
+
+		/* can't frame the request which last coding isn't 
+		 * chunked, fallback to Content-Length is smuggling */
+		if (state->have_te && !state->chunked)
+			return HTTP_ERR_TE;
+
+		/* request without Content-Length have no body */
+		if (state->chunked)
+			state->mstate = HTTP_STE_BODY;
+		else
+			state->mstate = clen ? HTTP_STE_BODY : HTTP_STE_FIN;
+	}
+	else {
+		info->response.header_len = state->pos;
+		clen = info->response.content_len;
+		code = info->response.retcode;
+
+		/* Transfer-Encoding overrides Content-Length, the
+		 * response which last coding isn't chunked is
+		 * close-delimited */
+		if (state->have_te)
+			state->have_clen = 0;
+
+		/* no body response, or close-delimited body */
+		if ((code >= 100 && code < 200) || code == 204 || code == 304)
+			state->mstate = HTTP_STE_FIN;
+		else if (state->chunked)
+			state->mstate = HTTP_STE_BODY;
+		else if (state->have_clen)
+			state->mstate = clen ? HTTP_STE_BODY : HTTP_STE_FIN;
+		else
+			state->mstate = HTTP_STE_BODY;
+	}
+
+	/* chunked encoding overrides Content-Length */
+	if (state->mstate == HTTP_STE_BODY && state->chunked) {
+		state->bstate = HTTP_BST_CHUNK_SIZE;
+		state->bremain = 0;
+	}
+	else {
+		state->chunked = 0;
+		state->bremain = clen;
+	}
+	state->bstart = state->pos;
+
+	if (info->header_cb)
+		info->header_cb(info, dir, HTTP_HST_END, state->hpos,
+				NULL, 0, info->header_arg);
+
+	return 0;
+}
+
+
 /**
  *	Parse CR-LF at end of each header line
  *
  *	Return pointer to char after CR-LF, NULL on error.
  */
-static const char *
-_http_CRLF(http_info_t *info, const char *buf, size_t siz)
+static const char * 
+_http_CRLF(http_info_t *info, const char *buf, size_t siz, int dir)
 {
-	int remain;
+	size_t remain;
 	const char *ptr;
 	http_state_t *state;
-	int version;
+	u_int16_t *nline;
+	u_int16_t *maxlen;
+	int err;
 
 	assert(info);
 	assert(buf);
 	assert(siz > 0);
 
-	state = &info->state;
-
-	if (info->msg_type == HTTP_REQUEST)
-		version = info->para.req_version;
-	else
-		version = info->para.res_version;
+	state = _HTTP_DIR_STATE(info, dir);
 
 	remain = siz;
 	ptr = buf;
 	while (remain) {
-		
+
 		switch (state->tstate) {
 
 		case HTTP_TST_BEGIN:
@@ -731,20 +1195,20 @@ _http_CRLF(http_info_t *info, const char *buf, size_t siz)
 			}
 
 			if ( *ptr != HTTP_CHR_CR) {
-				_HTTP_ERR("[%u:%u]: invalid CRLF char %u\n", 
-					  info->line, info->col, *ptr);
-				return NULL;
+				_HTTP_ERR("[%u:%u]: invalid CRLF char %u\n",
+					  state->line, state->col, *ptr);
+				return _HTTP_FAIL(state, HTTP_ERR_CRLF);
 			}
 
 			state->tstate = HTTP_TST_IN;
 			break;
 
 		case HTTP_TST_IN:
-			
+
 			if ( *ptr != HTTP_CHR_LF) {
-				_HTTP_ERR("[%u:%u]: invalid CRLF char %i\n", 
-					  info->line, info->col, *ptr);
-				return NULL;
+				_HTTP_ERR("[%u:%u]: invalid CRLF char %i\n",
+					  state->line, state->col, *ptr);
+				return _HTTP_FAIL(state, HTTP_ERR_CRLF);
 			}
 
 			state->tstate = HTTP_TST_FIN;
@@ -752,13 +1216,13 @@ _http_CRLF(http_info_t *info, const char *buf, size_t siz)
 
 		default:
 			_HTTP_ERR("invalid token state: %d\n", state->tstate);
-			return NULL;
+			return _HTTP_FAIL(state, HTTP_ERR_CRLF);
 		}
 
 		ptr++;
 		remain--;
-		info->pos++;
-		info->col++;
+		state->pos++;
+		state->col++;
 
 		if (state->tstate == HTTP_TST_FIN)
 			break;
@@ -768,93 +1232,52 @@ _http_CRLF(http_info_t *info, const char *buf, size_t siz)
 		return ptr;
 
 	_HTTP_STATE("CRLF finished\n");
-	
+
+	if (dir == HTTP_DIR_REQUEST) {
+		nline = &info->request.nheadline;
+		maxlen = &info->request.maxheadlen;
+	}
+	else {
+		nline = &info->response.nheadline;
+		maxlen = &info->response.maxheadlen;
+	}
+
+	if (state->col - 1 > *maxlen)
+		*maxlen = state->col - 1;
+
 	/* body is start */
 	if (state->pstate == HTTP_STE_CRLF) {
-		_HTTP_STATE("header finished\n");
-		state->mstate = HTTP_STE_BODY;
-		if (info->para.blen == 0 && 
-		    version == HTTP_VER_11 && 
-		    info->para.is_svrclosed == 0) 
-		{
-			_HTTP_STATE("message finished\n");
-			state->mstate = HTTP_STE_FIN;
-		}
+		err = _http_header_end(info, dir);
+		if (err)
+			return _HTTP_FAIL(state, err);
 	}
 	else {
-		state->pstate = state->mstate;	
+		if (state->pstate == HTTP_STE_HVALUE)
+			(*nline)++;
+		state->pstate = state->mstate;
 		state->mstate = HTTP_STE_HFIELD;
 	}
 
 	state->tstate = HTTP_TST_BEGIN;
-	state->csize = 0;
 	state->tokpos = 0;
-	info->col = 1;
-	info->line++;
+	state->col = 1;
+	state->line++;
 
 	return ptr;
 }
 
 
 static void 
-_http_check_HFILED(http_info_t *info)
+_http_check_HFILED(http_state_t *state, const char *tok, size_t len)
 {
-	http_state_t *state;
-
-	assert(info);
-	state = &info->state;
+	int id;
 
-	/* check header field name */
-	switch (state->csize) { 
+	assert(state);
+	assert(tok);
 
-	case 4:
-		if (strncasecmp(state->cache, "Host", 4) == 0)
-			state->hstate = HTTP_HST_HOST;
-		break;
-	case 5:
-		break;
-	case 6:
-		if (strncasecmp(state->cache, "Cookie", 6) == 0)
-			state->hstate = HTTP_HST_COOKIE;
-		break;
-	case 7:
-		break;
-	case 8:
-		if (strncasecmp(state->cache, "Loaction", 8) == 0)
-			state->hstate = HTTP_HST_LOCATION;
-		break;
-	case 9:
-		if (strncasecmp(state->cache, "Reference", 9) == 0)
-			state->hstate = HTTP_HST_REFERENCE;
-		break;
-	case 10:
-		if (strncasecmp(state->cache, "Connection", 10) == 0) 
-			state->hstate = HTTP_HST_CONNECTION;
-		else if (strncasecmp(state->cache, "Set-Cookie", 10) == 0)
-			state->hstate = HTTP_HST_SET_COOKIE;
-		else if (strncasecmp(state->cache, "User-Agent", 10) == 0)
-			state->hstate = HTTP_HST_USER_AGENT;
-		break;
-	case 11:
-		break;
-	case 12:
-		if (strncasecmp(state->cache, "Content-Type", 12) == 0) 
-			state->hstate = HTTP_HST_CONTENT_TYPE;
-		break;
-	case 13:
-		break;
-	case 14:
-		if (strncasecmp(state->cache, "Content-Length", 14) == 0) 
-			state->hstate = HTTP_HST_CONTENT_LENGTH;
-		break;
-	case 15:
-		if (strncasecmp(state->cache, "X-Forwarded-For", 15) == 0)
-			state->hstate = HTTP_HST_XFF;
-		break;
-	default:
-		state->hstate = HTTP_HST_EXTENSION;
-		break;
-	}
+	id = _http_hash_find(_http_hash_hdr, HTTP_HASH_HDR_BITS,
+			     HTTP_HASH_HDR_SEED, HTTP_HASH_HDR_FOLD, tok, len);
+	state->hstate = id < 0 ? HTTP_HST_EXTENSION : id;
 }
 
 
@@ -863,34 +1286,54 @@ _http_check_HFILED(http_info_t *info)
  *
  *	No return.
  */
-static const char *
-_http_HFIELD(http_info_t *info, const char *buf, size_t siz)
+static const char * 
+_http_HFIELD(http_info_t *info, const char *buf, size_t siz, int dir)
 {
-	int remain;
+	size_t n;
+	size_t remain;
+	size_t len;
 	const char *ptr;
+	const char *begin;
+	const char *tok;
 	http_state_t *state;
+	http_buffer_t *b;
 
 	assert(info);
 	assert(buf);
 	assert(siz > 0);
 
-	state = &info->state;
+	state = _HTTP_DIR_STATE(info, dir);
+	b = _HTTP_DIR_BUFFER(info, dir);
 
 	remain = siz;
 	ptr = buf;
+	begin = buf;
 	while (remain) {
-		
+
+		/* eat token chars in bulk */
+		if (state->tstate == HTTP_TST_IN && _http_simd) {
+			n = _http_scan(&_http_cls_token, ptr, remain);
+			ptr += n;
+			remain -= n;
+			state->pos += n;
+			state->col += n;
+			if (!remain)
+				break;
+		}
+
 		switch (state->tstate) {
 
 		case HTTP_TST_BEGIN:
 
+			state->hpos = state->pos;
+
 			/* header finished */
 			if (*ptr == HTTP_CHR_CR || *ptr == HTTP_CHR_LF) {
 				state->mstate = HTTP_STE_CRLF;
 				state->tstate = HTTP_TST_BEGIN;
 				return ptr;
 			}
-			
+
 			/* LWS */
 			if (*ptr == HTTP_CHR_SP || *ptr == HTTP_CHR_HT) {
 				state->mstate = HTTP_STE_HVALUE;
@@ -900,20 +1343,20 @@ _http_HFIELD(http_info_t *info, const char *buf, size_t siz)
 
 			if (!_http_is_TOKEN(*ptr)) {
 				_HTTP_ERR("[%u:%u]: invalid hfield char %u\n",
-					  info->line, info->col, *ptr);
-				return NULL;
+					  state->line, state->col, *ptr);
+				return _HTTP_FAIL(state, HTTP_ERR_HNAME);
 			}
-			
-			_HTTP_CACHE_CHAR(state, ptr);
+
 			state->tstate = HTTP_TST_IN;
+			begin = ptr;
 
 			break;
 
 		case HTTP_TST_IN:
 
-			if (*ptr == HTTP_CHR_CR || 
-			    *ptr == HTTP_CHR_LF || 
-			    *ptr == ':') 
+			if (*ptr == HTTP_CHR_CR ||
+			    *ptr == HTTP_CHR_LF ||
+			    *ptr == ':')
 			{
 				state->tstate = HTTP_TST_FIN;
 				break;
@@ -922,17 +1365,15 @@ _http_HFIELD(http_info_t *info, const char *buf, size_t siz)
 
 			if (!_http_is_TOKEN(*ptr)) {
 				_HTTP_ERR("[%u:%u]: invalid hfield char %u\n",
-					  info->line, info->col, *ptr);
-				return NULL;
+					  state->line, state->col, *ptr);
+				return _HTTP_FAIL(state, HTTP_ERR_HNAME);
 			}
 
-			_HTTP_CACHE_CHAR(state, ptr);
-
 			break;
-			
+
 		default:
 			_HTTP_ERR("invalid token state %d\n", state->tstate);
-			return NULL;
+			return _HTTP_FAIL(state, HTTP_ERR_HNAME);
 		}
 
 		if (state->tstate == HTTP_TST_FIN)
@@ -940,379 +1381,308 @@ _http_HFIELD(http_info_t *info, const char *buf, size_t siz)
 
 		ptr++;
 		remain--;
-		info->pos++;
-		info->col++;
+		state->pos++;
+		state->col++;
 	}
 
-	if (state->tstate != HTTP_TST_FIN)
+	if (state->tstate != HTTP_TST_FIN) {
+		if (state->tstate == HTTP_TST_IN &&
+		    _http_tok_save(b, state, begin, ptr - begin))
+			return _HTTP_FAIL(state, HTTP_ERR_CACHE_OVERSIZE);
 		return ptr;
+	}
+
+	if (_http_tok_get(b, state, begin, ptr - begin, &tok, &len))
+		return _HTTP_FAIL(state, HTTP_ERR_CACHE_OVERSIZE);
+	_http_check_HFILED(state, tok, len);
+	_http_tok_end(b, state, 0);
 
-	state->cache[state->csize] = 0;
-	_http_check_HFILED(info);
-	
-	_HTTP_STATE("header field(%d): %s\n", state->hstate, state->cache);
+	_HTTP_STATE("header field(%d): %.*s\n", state->hstate, (int)len, tok);
 
 	state->pstate = state->mstate;
 	state->mstate = HTTP_STE_HVALUE;
 	state->tstate = HTTP_TST_BEGIN;
-	state->csize = 0;
 	state->tokpos = 0;
 
 	return ptr;
 }
 
 
-static http_string_t *  
-_http_get_HVALUE_string(http_info_t *info)
+static http_string_t * 
+_http_get_HVALUE_string(http_info_t *info, int dir)
 {
 	http_state_t *state;
-	http_buffer_t *b;
-	http_string_t *s;
-
-	assert(info);
-	state = &info->state;
-	b = &info->buffer;
-
-	switch (state->hstate) {
-
-	case HTTP_HST_HOST:
-		s = &info->para.host;
-		break;
-	case HTTP_HST_REFERENCE:
-		s = &info->para.reference;
-		break;
-	case HTTP_HST_USER_AGENT:
-		s = &info->para.agent;
-		break;
-	case HTTP_HST_LOCATION:
-		s = &info->para.location;
-		break;
-	case HTTP_HST_COOKIE:
-	case HTTP_HST_SET_COOKIE:
-		s = &info->para.tmp;
-		break;
-	case HTTP_HST_XFF:
-		s = &info->para.xff;
-		break;
-	default:
-		s = NULL;
-	}
-
-#if 0
-	
-	if (s)
-		_http_alloc_memory(b, s);
-
-#endif
-
-	return s;
-}
-
-
-static void 
-_http_decode_cookie(http_info_t *info, http_string_t *s)
-{
-	int ncookie;
-	http_cookie_s_t *cookie;
-	http_string_t *str;
-	char *ptr;
-	int start;
-	int state;
-	int len;
+	http_response_t *res;
 
 	assert(info);
-	assert(s);
-	assert(info->para.ncookie >= 0);
-
-	ncookie = info->para.ncookie;
-	if (ncookie >= HTTP_MAX_COOKIE)
-		return;
-
-	str = NULL;
-	state = 0;
-	len = s->len;
-	start = s->start;
-	ptr = _http_string_ptr(&info->buffer, s);
-	cookie = &info->para.cookies[ncookie];
-	while (len > 0) {
-
-		switch (*ptr) {
-
-		case HTTP_CHR_EQUAL:
-			if (state == 1) {
-				str->len++;
-			}
-			else {
-				*ptr = 0;
-				state = 1;
-				str = NULL;
-			}
-			break;
-
-		case HTTP_CHR_HT:
-		case HTTP_CHR_SP:
-			ncookie++;
-			if (ncookie >= HTTP_MAX_COOKIE)
-				break;
-
-			cookie = &info->para.cookies[ncookie];
-			state = 0;
-			*ptr = 0;
-			str = NULL;
-			break;
-
-		case HTTP_CHR_PERCENT:
-
-			if (str) {
-				str->is_encoded = 1;
-			}
-			break;
+	state = _HTTP_DIR_STATE(info, dir);
 
+	if (dir == HTTP_DIR_REQUEST) {
+		switch (state->hstate) {
+		case HTTP_HST_HOST:
+			return &info->request.host;
+		case HTTP_HST_USER_AGENT:
+			return &info->request.user_agent;
+		case HTTP_HST_XFF:
+			return &info->request.xff;
+		case HTTP_HST_COOKIE:
+			/* too many Cookie is failed in _http_check_HVALUE */
+			if (info->request.ncookie >= HTTP_MAX_COOKIE)
+				return NULL;
+			return &info->request.cookies[info->request.ncookie];
 		default:
-
-			if (str) {
-				str->len++;
-				break;
-			}
-
-			if (state) {
-				str = &cookie->value;
-			}
-			else {
-				str = &cookie->name;
-			}
-			str->start = start;
-			str->len = 1;
-			break;
+			return NULL;
 		}
-
-		if (ncookie >= HTTP_MAX_COOKIE) {
-			break;
+	}
+	else {
+		res = &info->response;
+		switch (state->hstate) {
+		case HTTP_HST_LOCATION:
+			return &res->location;
+		case HTTP_HST_SET_COOKIE:
+			/* the Set-Cookie exceed HTTP_MAX_COOKIE is ignored */
+			if (res->nset_cookie >= HTTP_MAX_COOKIE)
+				return NULL;
+			return &res->set_cookies[res->nset_cookie];
+		default:
+			return NULL;
 		}
-
-		len--;
-		ptr++;
-		start++;
 	}
 
-	info->para.ncookie = ncookie;
+	return NULL;
 }
 
 
-static void 
-_http_check_HVALUE(http_info_t *info, http_string_t *s)
+static int 
+_http_check_HVALUE(http_info_t *info, int dir, const char *tok, size_t len)
 {
 	http_state_t *state;
+	u_int64_t *clen;
 	u_int8_t *ctype;
-	
+	u_int64_t val;
+	size_t i;
+
 	assert(info);
-	state = &info->state;
+	state = _HTTP_DIR_STATE(info, dir);
 
-	if (info->msg_type == HTTP_REQUEST) {
-		ctype = &info->para.req_ctype;
+	if (dir == HTTP_DIR_REQUEST) {
+		clen = &info->request.content_len;
+		ctype = &info->request.content_type;
 	}
 	else {
-		ctype = &info->para.res_ctype;
-	}
-
-	if (s) {
-		_HTTP_STATE("value string is: %s\n", 
-			    _http_string_ptr(&info->buffer, s));
+		clen = &info->response.content_len;
+		ctype = &info->response.content_type;
 	}
 
 	switch(state->hstate) {
-		
+
 	case HTTP_HST_CONTENT_LENGTH:
 
-		info->para.blen = atoi(state->cache);
-		info->bremain = info->para.blen;
+		if (len < 1)
+			return HTTP_ERR_CLEN;
+		val = 0;
+		for (i = 0; i < len; i++) {
+			if (!isdigit(tok[i]))
+				return HTTP_ERR_CLEN;
+			/* overflow of 63 bits */
+			if (val > (0x7fffffffffffffffULL - 9) / 10)
+				return HTTP_ERR_CLEN;
+			val = val * 10 + tok[i] - '0';
+		}
+
+		/* different Content-Length is smuggling, not last one win */
+		if (state->have_clen && *clen != val)
+			return HTTP_ERR_CLEN;
+		*clen = val;
+		state->have_clen = 1;
 		break;
 
 	case HTTP_HST_CONTENT_TYPE:
-		*ctype = _http_CTYPE(state->cache, state->csize);
+		if (ctype)
+			*ctype = _http_CTYPE(tok, len);
 		break;
 
 	case HTTP_HST_CONNECTION:
 
-		if (state->csize == 5 && 
-		    strncasecmp(state->cache, "close", 5) == 0) 
+		if (dir == HTTP_DIR_RESPONSE && len == 5 &&
+		    strncasecmp(tok, "close", 5) == 0)
 		{
-			info->para.is_svrclosed = 1;
+			info->response.server_close = 1;
 		}
 		break;
-		
+
+	case HTTP_HST_TRANSFER_ENCODING:
+
+		/* the last coding of all Transfer-Encoding headers must 
+		 * be chunked, a later header can't be ignored */
+		if (len < 1)
+			break;
+		state->have_te = 1;
+		if (len >= 7 && strncasecmp(tok + len - 7, "chunked", 7) == 0 &&
+		    (len == 7 || tok[len - 8] == ',' ||
+		     tok[len - 8] == HTTP_CHR_SP || tok[len - 8] == HTTP_CHR_HT))
+			state->chunked = 1;
+		else
+			state->chunked = 0;
+		break;
+
 	case HTTP_HST_COOKIE:
-		_http_decode_cookie(info, s);
+
+		/* every Cookie is kept, the overflowed one can't be ignored */
+		if (dir != HTTP_DIR_REQUEST)
+			break;
+		if (info->request.ncookie >= HTTP_MAX_COOKIE)
+			return HTTP_ERR_COOKIE_OVERSIZE;
+		if (len > 0)
+			info->request.ncookie++;
+		break;
+
+	case HTTP_HST_SET_COOKIE:
+
+		if (len > 0 && info->response.nset_cookie < HTTP_MAX_COOKIE)
+			info->response.nset_cookie++;
 		break;
 	}
+
+	return 0;
 }
 
 
 /**
- *	Parse HTTP header value.
+ *	Parse HTTP header value, the value of interested header is
+ *	stored as a view of @buf, it's copied only if it's split.
  *
  *	Return pointer to next char after header value, NULL on error.
  */
-static const char *
-_http_HVALUE(http_info_t *info, const char *buf, size_t siz)
+static const char * 
+_http_HVALUE(http_info_t *info, const char *buf, size_t siz, int dir)
 {
-	int remain;
+	size_t n;
+	size_t remain;
+	size_t len = 0;
 	http_string_t *s;
 	http_buffer_t *b;
 	http_state_t *state;
 	const char *ptr;
-	const char *p;
-	int n;
+	const char *begin;
+	const char *tok = NULL;
+	int err;
 
 	assert(info);
 	assert(buf);
 	assert(siz > 0);
 
-	state = &info->state;
-	b = &info->buffer;
+	state = _HTTP_DIR_STATE(info, dir);
+	b = _HTTP_DIR_BUFFER(info, dir);
+	s = _http_get_HVALUE_string(info, dir);
 
-	p = buf;
-	n = 0;
+	/* the value begin in this piece or in previous pieces */
+	begin = state->tstate == HTTP_TST_IN ? buf : NULL;
 	ptr = buf;
 	remain = siz;
 	while (remain) {
-		
+
+		/* eat value chars in bulk */
+		if (state->tstate == HTTP_TST_IN && _http_simd) {
+			n = _http_scan(&_http_cls_line, ptr, remain);
+			ptr += n;
+			remain -= n;
+			state->pos += n;
+			state->col += n;
+			if (!remain)
+				break;
+		}
+
 		switch (state->tstate) {
 
 		/* token begin */
 		case HTTP_TST_BEGIN:
-			
+
 			/* no header value, just to CRLF */
 			if (*ptr == HTTP_CHR_CR || *ptr == HTTP_CHR_LF) {
-				state->pstate = state->mstate;
-				state->mstate = HTTP_STE_CRLF;
-				state->tstate = HTTP_TST_BEGIN;
+				state->tstate = HTTP_TST_FIN;
 				_HTTP_STATE("field have no value\n");
-				return ptr;
+				break;
 			}
-			
+
 			/* skip lead space and ':' */
-			if (*ptr == HTTP_CHR_SP || 
+			if (*ptr == HTTP_CHR_SP ||
 			    *ptr == HTTP_CHR_HT ||
 			    *ptr == ':')
 				break;
 
 			state->tstate = HTTP_TST_IN;
-			s = _http_get_HVALUE_string(info);
-
-			/* cache it */
-			_HTTP_CACHE_CHAR(state, ptr);
-
-			p = ptr;
-			n = 1;
-
-			/* check quote and slash */
-			if (*ptr == HTTP_CHR_QUOTE || *ptr == '\\') {
-				n--;
-				ptr--;
-			}
+			if (s)
+				s->ori_start = state->pos;
+			begin = ptr;
 
 			break;
 
 		/* in token */
 		case HTTP_TST_IN:
 
-			n++;
-			switch (*ptr) {
-
-			case HTTP_CHR_QUOTE:
-
-				if (state->inquote && !state->inslash)
-					state->inquote = 0;
-				else
-					state->inquote = 1;
-				state->inslash = 0;
-				break;
-
-			case '\\':
-
-				if (state->inquote && !state->inslash)
-					state->inslash = 1;
-				else
-					state->inslash = 0;
+			/* quoted-string can't have CR/LF */
+			if (*ptr == HTTP_CHR_CR || *ptr == HTTP_CHR_LF) {
+				state->tstate = HTTP_TST_FIN;
 				break;
+			}
 
-			case HTTP_CHR_SP:
-			case HTTP_CHR_HT:
-				if (!state->inquote) {
-					state->tstate = HTTP_TST_LWS;
-					_http_copy_memory(b, s, p, n, 0);
-					p = NULL;
-					n = 0;
-				}
-				state->inslash = 0;
-				break;
-				
-			case HTTP_CHR_CR:
-			case HTTP_CHR_LF:
-				
-				if (!state->inquote) {
-					state->tstate = HTTP_TST_FIN;
-					n--;
-				}
-				}
-				state->inslash = 0;
-				break;
+			break;
 
-			default:
-				state->inslash = 0;
-				break;
+		default:
+			_HTTP_ERR("invalid token state %d\n", state->tstate);
+			return _HTTP_FAIL(state, HTTP_ERR_HVALUE);
+		}
 
-			_HTTP_CACHE_CHAR(state, ptr);
-			break;
-
-		case HTTP_TST_LWS:
-
-			switch (*ptr) {
-
-			case HTTP_CHR_SP:
-			case HTTP_CHR_HT:
-				break;
-
-			case HTTP_CHR_CR:
-			case HTTP_CHR_LF:
-				state->tstate = HTTP_TST_FIN;
-				break;
-
-			default:
-				state->tstate = HTTP_TST_IN;
-				p = ptr;
-				n = 1;
-			}
-		}
-
-		if (state->tstate == HTTP_TST_FIN)
+		if (state->tstate == HTTP_TST_FIN)
 			break;
 
 		ptr++;
 		remain--;
-		info->pos++;
-		info->col++;
+		state->pos++;
+		state->col++;
 	}
 
 	if (state->tstate != HTTP_TST_FIN) {
-		_http_copy_memory(b, s, p, n, 0);
+		if (state->tstate == HTTP_TST_IN &&
+		    _http_tok_save(b, state, begin, ptr - begin))
+			return _HTTP_FAIL(state, HTTP_ERR_CACHE_OVERSIZE);
 		return ptr;
 	}
-	else {
-		_http_copy_memory(b, s, p, n, 1);
+
+	/* the value is empty if it's not begin */
+	if (state->tokbuf || begin) {
+		if (_http_tok_get(b, state, begin, ptr - begin, &tok, &len))
+			return _HTTP_FAIL(state, HTTP_ERR_CACHE_OVERSIZE);
+	}
+
+	/* remove tailing space */
+	while (len > 0 && (tok[len - 1] == HTTP_CHR_SP ||
+			   tok[len - 1] == HTTP_CHR_HT))
+		len--;
+
+	/* the last one is used if have same headers */
+	if (s && tok)
+		_http_tok_store(b, state, s, tok, len);
+	_http_tok_end(b, state, s != NULL);
+
+	_HTTP_STATE("value is: %.*s\n", (int)len, tok ? tok : "");
+
+	err = _http_check_HVALUE(info, dir, tok ? tok : "", len);
+	if (err) {
+		_HTTP_ERR("[%u:%u]: invalid value %.*s\n",
+			  state->line, state->col, (int)len, tok);
+		return _HTTP_FAIL(state, err);
 	}
 
-	state->cache[state->csize] = 0;
-	_HTTP_STATE("value is: %s\n", state->cache);
+	if (info->header_cb)
+		info->header_cb(info, dir, state->hstate, state->hpos,
+				tok ? tok : "", len, info->header_arg);
 
-	_http_check_HVALUE(info, s);
-	
 	state->pstate = state->mstate;
 	state->mstate = HTTP_STE_CRLF;
 	state->hstate = HTTP_HST_BEGIN;
 	state->tstate = HTTP_TST_BEGIN;
-	state->csize = 0;
 	state->tokpos = 0;
 
 	return ptr;
@@ -1320,118 +1690,364 @@ _http_HVALUE(http_info_t *info, const char *buf, size_t siz)
 
 
 /**
- *	Parse HTTP body.
+ *	Pass the body data @data:@len to body callback, it's
+ *	part of @buf and not copied.
  *
- *	Return pointer to next char after body, NONE on error.
+ *	No return.
  */
-static const char *
-_http_BODY(http_info_t *info, const char *buf, size_t siz)
+static void 
+_http_body_data(http_info_t *info, int dir, const char *data, size_t len)
+{
+	if (dir == HTTP_DIR_REQUEST)
+		info->request.body_len += len;
+	else
+		info->response.body_len += len;
+
+	if (info->body_cb && len > 0)
+		info->body_cb(info, dir, data, len, info->body_arg);
+}
+
+
+/**
+ *	Convert hex char @c to number.
+ *
+ *	Return the number, -1 if @c is not hex char.
+ */
+static inline int 
+_http_hex(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+
+/**
+ *	Parse chunked body, the chunk data is passed to body
+ *	callback in bulk, the chunk size lines, extensions and
+ *	trailers are parsed byte-at-a-time.
+ *
+ *	Return pointer to next char after body, NULL on error.
+ */
+static const char * 
+_http_CHUNK(http_info_t *info, const char *buf, size_t siz, int dir)
 {
 	const char *ptr;
-	
+	size_t remain;
+	size_t n;
+	http_state_t *state;
+	int h;
+
+	state = _HTTP_DIR_STATE(info, dir);
+
+	ptr = buf;
+	remain = siz;
+	while (remain) {
+
+		/* chunk data in bulk */
+		if (state->bstate == HTTP_BST_CHUNK_DATA) {
+			n = remain < state->bremain ? remain : state->bremain;
+			_http_body_data(info, dir, ptr, n);
+			ptr += n;
+			remain -= n;
+			state->pos += n;
+			state->bremain -= n;
+			if (!state->bremain)
+				state->bstate = HTTP_BST_CHUNK_DATA_CR;
+			continue;
+		}
+
+		switch (state->bstate) {
+
+		case HTTP_BST_CHUNK_SIZE:
+
+			h = _http_hex(*ptr);
+			if (h >= 0) {
+				/* chunk size can't exceed 60 bits */
+				if (state->bremain & 0xff00000000000000ULL) {
+					_HTTP_ERR("chunk size too large\n");
+					return _HTTP_FAIL(state, HTTP_ERR_CHUNK);
+				}
+				state->bremain = (state->bremain << 4) | h;
+				state->tokpos++;
+				break;
+			}
+
+			if (state->tokpos == 0) {
+				_HTTP_ERR("[%lu]: invalid chunk size char %u\n",
+					  state->pos, *ptr);
+				return _HTTP_FAIL(state, HTTP_ERR_CHUNK);
+			}
+
+			if (*ptr == HTTP_CHR_CR)
+				state->bstate = HTTP_BST_CHUNK_SIZE_LF;
+			else if (*ptr == HTTP_CHR_LF)
+				goto size_end;
+			else if (*ptr == ';')
+				state->bstate = HTTP_BST_CHUNK_EXT;
+			else if (*ptr == HTTP_CHR_SP || *ptr == HTTP_CHR_HT)
+				state->bstate = HTTP_BST_CHUNK_BWS;
+			else {
+				_HTTP_ERR("[%lu]: invalid chunk size char %u\n",
+					  state->pos, *ptr);
+				return _HTTP_FAIL(state, HTTP_ERR_CHUNK);
+			}
+			break;
+
+		case HTTP_BST_CHUNK_BWS:
+
+			/* only white space before ';' of extension */
+			if (*ptr == ';')
+				state->bstate = HTTP_BST_CHUNK_EXT;
+			else if (*ptr != HTTP_CHR_SP && *ptr != HTTP_CHR_HT) {
+				_HTTP_ERR("[%lu]: invalid chunk size char %u\n",
+					  state->pos, *ptr);
+				return _HTTP_FAIL(state, HTTP_ERR_CHUNK);
+			}
+			break;
+
+		case HTTP_BST_CHUNK_EXT:
+
+			/* chunk extension is ignored, but no control char */
+			if (*ptr == HTTP_CHR_CR)
+				state->bstate = HTTP_BST_CHUNK_SIZE_LF;
+			else if (*ptr == HTTP_CHR_LF)
+				goto size_end;
+			else if (((unsigned char)*ptr < 0x20 && 
+				  *ptr != HTTP_CHR_HT) || *ptr == 0x7f) {
+				_HTTP_ERR("[%lu]: invalid chunk extension %u\n",
+					  state->pos, *ptr);
+				return _HTTP_FAIL(state, HTTP_ERR_CHUNK);
+			}
+			break;
+
+		case HTTP_BST_CHUNK_SIZE_LF:
+
+			if (*ptr != HTTP_CHR_LF) {
+				_HTTP_ERR("[%lu]: invalid chunk line end %u\n",
+					  state->pos, *ptr);
+				return _HTTP_FAIL(state, HTTP_ERR_CHUNK);
+			}
+size_end:
+			state->tokpos = 0;
+			if (state->bremain)
+				state->bstate = HTTP_BST_CHUNK_DATA;
+			else
+				state->bstate = HTTP_BST_CHUNK_TRAILER;
+			break;
+
+		case HTTP_BST_CHUNK_DATA_CR:
+
+			if (*ptr == HTTP_CHR_CR) {
+				state->bstate = HTTP_BST_CHUNK_DATA_LF;
+				break;
+			}
+			/* fall through, accept bare LF */
+
+		case HTTP_BST_CHUNK_DATA_LF:
+
+			if (*ptr != HTTP_CHR_LF) {
+				_HTTP_ERR("[%lu]: invalid chunk data end %u\n",
+					  state->pos, *ptr);
+				return _HTTP_FAIL(state, HTTP_ERR_CHUNK);
+			}
+			state->bstate = HTTP_BST_CHUNK_SIZE;
+			state->tokpos = 0;
+			break;
+
+		case HTTP_BST_CHUNK_TRAILER:
+
+			/* trailer lines end with an empty line */
+			if (*ptr == HTTP_CHR_LF) {
+				if (state->tokpos == 0) {
+					state->mstate = HTTP_STE_FIN;
+					_HTTP_STATE("chunked message finished\n");
+				}
+				state->tokpos = 0;
+			}
+			else if (*ptr != HTTP_CHR_CR) {
+				state->tokpos++;
+			}
+			break;
+
+		default:
+			_HTTP_ERR("invalid body state %d\n", state->bstate);
+			return _HTTP_FAIL(state, HTTP_ERR_CHUNK);
+		}
+
+		ptr++;
+		remain--;
+		state->pos++;
+
+		if (state->mstate == HTTP_STE_FIN)
+			break;
+	}
+
+	return ptr;
+}
+
+
+/**
+ *	Parse HTTP body, it's framed by Content-Length, chunked
+ *	encoding or connection close. The body data is passed
+ *	to body callback without copy.
+ *
+ *	Return pointer to next char after body, NULL on error.
+ */
+static const char * 
+_http_BODY(http_info_t *info, const char *buf, size_t siz, int dir)
+{
+	http_state_t *state;
+	size_t n;
+
 	assert(info);
 	assert(buf);
 	assert(siz > 0);
 
-	if (info->para.blen > 0) {
-		if (info->bremain > siz) {
-			info->bremain -= siz;
-			ptr = buf + siz;
-			info->pos += siz;
-			_HTTP_STATE("body have %d bytes not fin\n",
-				    info->bremain);
-		}
-		else {
-			ptr = buf + info->bremain;
-			info->state.mstate = HTTP_STE_FIN;
-			info->bremain = 0;
-			info->pos += info->bremain;
-			_HTTP_STATE("request finished\n");
-		}
+	state = _HTTP_DIR_STATE(info, dir);
+
+	if (state->chunked)
+		return _http_CHUNK(info, buf, siz, dir);
+
+	/* close-delimited body, finished by http_parse_eof() */
+	if (dir == HTTP_DIR_RESPONSE && !state->have_clen) {
+		_http_body_data(info, dir, buf, siz);
+		state->pos += siz;
+		return buf + siz;
+	}
+
+	n = siz < state->bremain ? siz : state->bremain;
+	_http_body_data(info, dir, buf, n);
+	state->pos += n;
+	state->bremain -= n;
+
+	if (state->bremain) {
+		_HTTP_STATE("body have %lu bytes not fin\n", state->bremain);
 	}
 	else {
-		ptr = buf + siz;
+		state->mstate = HTTP_STE_FIN;
+		_HTTP_STATE("message finished\n");
 	}
 
-	return ptr;
+	return buf + n;
+}
+
+
+/**
+ *	Clear the parse result of direction @dir for new message.
+ *
+ *	No return.
+ */
+static void 
+_http_reset(http_info_t *info, int dir)
+{
+	if (dir == HTTP_DIR_REQUEST) {
+		memset(&info->req_state, 0, sizeof(info->req_state));
+		memset(&info->request, 0, sizeof(info->request));
+		info->req_buf.len = 0;
+	}
+	else {
+		memset(&info->res_state, 0, sizeof(info->res_state));
+		memset(&info->response, 0, sizeof(info->response));
+		info->res_buf.len = 0;
+	}
 }
 
 
 int 
-_http_parse_request(http_info_t *info, const char *buf, size_t siz, size_t start)
+http_parse(http_info_t *info, int dir, const char *buf, size_t siz)
 {
 	const char *begin, *end;
-	int remain;
+	http_state_t *state;
+	size_t remain;
 
 	if (!info || !buf || siz < 1)
 		return -1;
 
-	if (info->msg_type != HTTP_REQUEST) {
-		memset(info, 0, sizeof(http_info_t));
-		info->msg_type = HTTP_REQUEST;
-	}
+	if (dir != HTTP_DIR_REQUEST && dir != HTTP_DIR_RESPONSE)
+		return -1;
 
-	if (info->state.mstate != HTTP_STE_FIN && 
-	    info->state.mstate != HTTP_STE_BEGIN)
-	{
-//		_HTTP_STATE("pos %u, start %lu\n", info->pos, start);
-	}
+	state = _HTTP_DIR_STATE(info, dir);
+
+	/* error can't be recovered */
+	if (state->error)
+		return -1;
 
 	begin = buf;
 	end = buf;
 	remain = siz;
 	while (remain > 0) {
 
-		if (info->state.mstate == HTTP_STE_FIN) {
-			memset(info, 0, sizeof(http_info_t));
-			info->msg_type = HTTP_REQUEST;
-		}
+		if (state->mstate == HTTP_STE_FIN)
+			_http_reset(info, dir);
 
-		switch (info->state.mstate) {
+		switch (state->mstate) {
 
 		case HTTP_STE_BEGIN:
-			info->pos = start;
-			info->state.mstate = HTTP_STE_METHOD;
+			state->pos = 0;
+			state->line = 1;
+			state->col = 1;
+			if (dir == HTTP_DIR_REQUEST) {
+				info->request.content_type = HTTP_CTE_UNKOWNED;
+				state->mstate = HTTP_STE_METHOD;
+			}
+			else {
+				info->response.content_type = HTTP_CTE_UNKOWNED;
+				state->mstate = HTTP_STE_VERSION;
+			}
 			break;
-			
+
 		case HTTP_STE_METHOD:
 
 			end = _http_METHOD(info, begin, remain);
 			break;
-			
+
 		case HTTP_STE_URL:
-			
+
 			end = _http_URL(info, begin, remain);
 			break;
 
 		case HTTP_STE_VERSION:
-			
-			end = _http_VERSION(info, begin, remain);
+
+			end = _http_VERSION(info, begin, remain, dir);
+			break;
+
+		case HTTP_STE_CODE:
+
+			end = _http_CODE(info, begin, remain);
+			break;
+
+		case HTTP_STE_REASON:
+
+			end = _http_REASON(info, begin, remain);
 			break;
 
 		case HTTP_STE_CRLF:
 
-			end = _http_CRLF(info, begin, remain);
+			end = _http_CRLF(info, begin, remain, dir);
 			break;
 
 		case HTTP_STE_HFIELD:
 
-			end = _http_HFIELD(info, begin, remain);
+			end = _http_HFIELD(info, begin, remain, dir);
 			break;
 
 		case HTTP_STE_HVALUE:
-			
-			end = _http_HVALUE(info, begin, remain);
+
+			end = _http_HVALUE(info, begin, remain, dir);
 			break;
-			
 
 		case HTTP_STE_BODY:
-			
-			end = _http_BODY(info, begin, remain);
+
+			end = _http_BODY(info, begin, remain, dir);
 			break;
 
 		default:
-			_HTTP_ERR("invalid state %d\n", info->state.mstate);
+			_HTTP_ERR("invalid state %d\n", state->mstate);
 			return -1;
 		}
 
@@ -1442,7 +2058,7 @@ _http_parse_request(http_info_t *info, const char *buf, size_t siz, size_t start
 		begin = end;
 		remain = siz - (begin - buf);
 
-		if (info->state.mstate == HTTP_STE_FIN)
+		if (state->mstate == HTTP_STE_FIN)
 			return remain;
 	}
 
@@ -1451,107 +2067,126 @@ _http_parse_request(http_info_t *info, const char *buf, size_t siz, size_t start
 
 
 int 
-_http_parse_response(http_info_t *info, const char *buf, 
-		    size_t siz, size_t start)
+http_parse_eof(http_info_t *info, int dir)
 {
-	const char *begin, *end;
-	int remain;
+	http_state_t *state;
 
-	if (!info || !buf || siz < 1)
+	if (!info)
 		return -1;
 
-	/* init info if need */
-	if (info->msg_type != HTTP_RESPONSE) {
-		memset(info, 0, sizeof(http_info_t));
-		info->msg_type = HTTP_RESPONSE;
-	}
+	if (dir != HTTP_DIR_REQUEST && dir != HTTP_DIR_RESPONSE)
+		return -1;
+
+	state = _HTTP_DIR_STATE(info, dir);
+
+	if (state->error)
+		return -1;
+
+	if (state->mstate == HTTP_STE_BEGIN || state->mstate == HTTP_STE_FIN)
+		return 0;
 
-	if (info->state.mstate != HTTP_STE_FIN && 
-	    info->state.mstate != HTTP_STE_BEGIN) 
+	/* close-delimited body */
+	if (state->mstate == HTTP_STE_BODY && dir == HTTP_DIR_RESPONSE &&
+	    !state->have_clen && !state->chunked)
 	{
-		_HTTP_STATE("pos %u, start %lu\n", info->pos, start);
+		state->mstate = HTTP_STE_FIN;
+		return 0;
 	}
 
-	begin = buf;
-	end = buf;
-	remain = siz;
-	while (remain > 0) {
+	state->error = HTTP_ERR_TRUNCATED;
+	return -1;
+}
 
-		if (info->state.mstate == HTTP_STE_FIN) {
-			memset(info, 0, sizeof(http_info_t) );
-			info->msg_type = HTTP_RESPONSE;
-		}
 
-		switch (info->state.mstate) {
+void 
+http_set_body_cb(http_info_t *info, http_body_cb cb, void *arg)
+{
+	if (!info)
+		return;
 
-		case HTTP_STE_BEGIN:
-			
-			info->pos = start;
-			info->state.mstate = HTTP_STE_VERSION;
-			break;
-			
-		case HTTP_STE_VERSION:
+	info->body_cb = cb;
+	info->body_arg = arg;
+}
 
-			end = _http_VERSION(info, begin, remain);
-			break;
-			
-		case HTTP_STE_CODE:
-			
-			end = _http_CODE(info, begin, remain);
-			break;
 
-		case HTTP_STE_REASON:
-			
-			end = _http_REASON(info, begin, remain);
-			break;
+void 
+http_set_header_cb(http_info_t *info, http_header_cb cb, void *arg)
+{
+	if (!info)
+		return;
 
-		case HTTP_STE_CRLF:
+	info->header_cb = cb;
+	info->header_arg = arg;
+}
 
-			end = _http_CRLF(info, begin, remain);
-			break;
 
-		case HTTP_STE_HFIELD:
+int 
+http_skip_body(http_info_t *info, int dir)
+{
+	http_state_t *state;
 
-			end = _http_HFIELD(info, begin, remain);
-			break;
+	if (!info)
+		return -1;
 
-		case HTTP_STE_HVALUE:
-			
-			end = _http_HVALUE(info, begin, remain);
-			break;
-			
+	if (dir != HTTP_DIR_REQUEST && dir != HTTP_DIR_RESPONSE)
+		return -1;
 
-		case HTTP_STE_BODY:
-			
-			end = _http_BODY(info, begin, remain);
-			break;
+	state = _HTTP_DIR_STATE(info, dir);
+	if (state->mstate != HTTP_STE_BODY && state->mstate != HTTP_STE_FIN)
+		return -1;
 
-		default:
-			_HTTP_ERR("invalid state %u\n", info->state.mstate);
-			return -1;
-		}
+	state->mstate = HTTP_STE_FIN;
+	state->chunked = 0;
+	state->bremain = 0;
 
-		if (end == NULL)
-			return -1;
+	return 0;
+}
 
-		begin = end;
-		remain = siz - (begin - buf);
 
-		if (info->state.mstate == HTTP_STE_FIN)
-			return remain;
+int 
+http_set_simd(int level)
+{
+	if (level < HTTP_SIMD_NONE)
+		level = HTTP_SIMD_NONE;
+	if (level > _http_simd_max)
+		level = _http_simd_max;
+
+	switch (level) {
+#ifdef	_HTTP_HAVE_X86
+	case HTTP_SIMD_AVX2:
+		_http_scan = _http_scan_avx2;
+		break;
+	case HTTP_SIMD_SSSE3:
+		_http_scan = _http_scan_ssse3;
+		break;
+#endif
+	default:
+		_http_scan = _http_scan_table;
+		break;
 	}
 
-	return 0;
+	_http_simd = level;
+
+	return level;
 }
 
+
 int 
-http_parse(http_info_t *info, const char *buf, size_t siz, size_t start)
+http_header2id(const char *name, size_t len)
 {
-	return 0;
+	int id;
+
+	if (!name || len < 1)
+		return HTTP_HST_EXTENSION;
+
+	id = _http_hash_find(_http_hash_hdr, HTTP_HASH_HDR_BITS,
+			     HTTP_HASH_HDR_SEED, HTTP_HASH_HDR_FOLD, name, len);
+
+	return id < 0 ? HTTP_HST_EXTENSION : id;
 }
 
 
-const char *
+const char * 
 http_code2reason(int status_code)
 {
 	switch (status_code) {
@@ -1637,45 +2272,144 @@ http_code2reason(int status_code)
 void 
 http_clear_info(http_info_t *info)
 {
+	if (!info)
+		return;
 
+	_http_reset(info, HTTP_DIR_REQUEST);
+	_http_reset(info, HTTP_DIR_RESPONSE);
+}
+
+
+void 
+http_free_info(http_info_t *info)
+{
+	if (!info)
+		return;
+
+	if (info->req_buf.data)
+		free(info->req_buf.data);
+	if (info->res_buf.data)
+		free(info->res_buf.data);
+	memset(&info->req_buf, 0, sizeof(info->req_buf));
+	memset(&info->res_buf, 0, sizeof(info->res_buf));
+
+	http_clear_info(info);
 }
 
 
 const char * 
-http_get_str(http_info_t *info, int type)
+http_get_str(http_info_t *info, int dir, int type, size_t *len)
 {
+	http_string_t *s = NULL;
+
 	if (!info)
 		return NULL;
-	
-	switch (type) {
 
-	default:
-		break;
+	if (dir == HTTP_DIR_REQUEST) {
+		switch (type) {
+		case HTTP_STR_URL:
+			s = &info->request.oriurl;
+			break;
+		case HTTP_STR_HOST:
+			s = &info->request.host;
+			break;
+		case HTTP_STR_USER_AGENT:
+			s = &info->request.user_agent;
+			break;
+		case HTTP_STR_COOKIE:
+			if (info->request.ncookie < 1)
+				return NULL;
+			s = &info->request.cookies[0];
+			break;
+		default:
+			break;
+		}
+	}
+	else {
+		switch (type) {
+		case HTTP_STR_LOCATION:
+			s = &info->response.location;
+			break;
+		default:
+			break;
+		}
 	}
 
-	return NULL;
+	if (!s || !s->len)
+		return NULL;
+
+	if (len)
+		*len = s->len;
+
+	return _http_str_ptr(_HTTP_DIR_BUFFER(info, dir), s);
 }
 
 
 int 
-http_get_int(http_info_t *info, int type)
+http_get_int(http_info_t *info, int dir, int type)
 {
+	http_state_t *state;
+
 	if (!info)
 		return -1;
 
-	switch(type) {
+	state = _HTTP_DIR_STATE(info, dir);
 
-	case HTTP_INT_REQVER:
-		return info->para.req_version;
+	switch(type) {
 
-	case HTTP_INT_RESVER:
-		return info->para.res_version;
+	case HTTP_INT_VER:
+		if (dir == HTTP_DIR_REQUEST)
+			return info->request.version;
+		else
+			return info->response.version;
 
 	case HTTP_INT_METHOD:
-		return info->para.method;
+		return info->request.method;
 
 	case HTTP_INT_RETCODE:
-		return info->para.retcode;
+		return info->response.retcode;
+
+	case HTTP_INT_HLEN:
+		if (dir == HTTP_DIR_REQUEST)
+			return info->request.header_len;
+		else
+			return info->response.header_len;
+
+	case HTTP_INT_BLEN:
+		if (dir == HTTP_DIR_REQUEST)
+			return info->request.body_len;
+		else
+			return info->response.body_len;
+
+	case HTTP_INT_CLEN:
+		if (dir == HTTP_DIR_REQUEST)
+			return info->request.content_len;
+		else
+			return info->response.content_len;
+
+	case HTTP_INT_HL_MAX:
+		if (dir == HTTP_DIR_REQUEST)
+			return info->request.maxheadlen;
+		else
+			return info->response.maxheadlen;
+
+	case HTTP_INT_DIRECTION:
+		return dir;
+
+	case HTTP_INT_STATE:
+		return state->mstate;
+
+	case HTTP_INT_MLEN:
+		return state->pos;
+
+	case HTTP_INT_CHUNKED:
+		return state->chunked;
+
+	case HTTP_INT_CTYPE:
+		if (dir == HTTP_DIR_REQUEST)
+			return info->request.content_type;
+		else
+			return info->response.content_type;
 
 	default:
 		break;
@@ -1684,44 +2418,225 @@ http_get_int(http_info_t *info, int type)
 	return -1;
 }
 
-int 
-http_get_cookie_count(http_info_t *info)
+
+u_int64_t 
+http_get_len(http_info_t *info, int dir, int type)
 {
+	if (!info)
+		return 0;
+
+	switch (type) {
+
+	case HTTP_INT_HLEN:
+		if (dir == HTTP_DIR_REQUEST)
+			return info->request.header_len;
+		else
+			return info->response.header_len;
+
+	case HTTP_INT_BLEN:
+		if (dir == HTTP_DIR_REQUEST)
+			return info->request.body_len;
+		else
+			return info->response.body_len;
+
+	case HTTP_INT_CLEN:
+		if (dir == HTTP_DIR_REQUEST)
+			return info->request.content_len;
+		else
+			return info->response.content_len;
+
+	case HTTP_INT_MLEN:
+		return _HTTP_DIR_STATE(info, dir)->pos;
+
+	default:
+		break;
+	}
+
 	return 0;
 }
 
+
+int 
+http_get_error(http_info_t *info, int dir)
+{
+	if (!info)
+		return -1;
+
+	return _HTTP_DIR_STATE(info, dir)->error;
+}
+
+
+/**
+ *	Get the next "name=value" pair in [@ptr, @end) and store it
+ *	in @name and @value, the pair is separated by ';'.
+ *
+ *	Return the pointer after pair, NULL if no more pair.
+ */
+static const char * 
+_http_next_pair(const char *ptr, const char *end,
+		http_string_t *name, http_string_t *value)
+{
+	const char *p;
+	const char *eq = NULL;
+
+	/* skip space and empty pair */
+	while (ptr < end && (*ptr == HTTP_CHR_SP || *ptr == HTTP_CHR_HT ||
+			     *ptr == ';'))
+		ptr++;
+	if (ptr == end)
+		return NULL;
+
+	for (p = ptr; p < end && *p != ';'; p++) {
+		if (*p == '=' && !eq)
+			eq = p;
+	}
+
+	memset(name, 0, sizeof(*name));
+	memset(value, 0, sizeof(*value));
+
+	name->ptr = ptr;
+	name->len = (eq ? eq : p) - ptr;
+	while (name->len > 0 && (ptr[name->len - 1] == HTTP_CHR_SP ||
+				 ptr[name->len - 1] == HTTP_CHR_HT))
+		name->len--;
+
+	if (eq) {
+		value->ptr = eq + 1;
+		while (value->ptr < p && (*value->ptr == HTTP_CHR_SP ||
+					  *value->ptr == HTTP_CHR_HT))
+			value->ptr++;
+		value->len = p - value->ptr;
+		while (value->len > 0 &&
+		       (value->ptr[value->len - 1] == HTTP_CHR_SP ||
+			value->ptr[value->len - 1] == HTTP_CHR_HT))
+			value->len--;
+	}
+
+	return p;
+}
+
+
 int 
-http_get_cookie(http_info_t *info, int index, http_cookie_t *cookie)
+http_get_cookie(http_info_t *info, int dir, int index, http_cookie_t *cookie)
 {
-	http_cookie_s_t *cookie1;
+	http_string_t *s;
+	http_string_t name, value;
+	http_buffer_t *b;
+	const char *ptr, *end;
+	int i = 0, j;
+
+	if (!info || !cookie || index < 0)
+		return -1;
+
+	memset(cookie, 0, sizeof(*cookie));
+	b = _HTTP_DIR_BUFFER(info, dir);
+
+	/* the Nth pair in all Cookie headers */
+	if (dir == HTTP_DIR_REQUEST) {
+		for (j = 0; j < info->request.ncookie; j++) {
+			s = &info->request.cookies[j];
+			ptr = _http_str_ptr(b, s);
+			end = ptr + s->len;
+			while ( (ptr = _http_next_pair(ptr, end, &name, &value))) {
+				if (i++ == index) {
+					cookie->name = name;
+					cookie->value = value;
+					return 0;
+				}
+			}
+		}
 
-	if (!info || !cookie)
+		return -1;
+	}
+
+	/* the Nth Set-Cookie header, the first pair is cookie */
+	if (index >= info->response.nset_cookie)
 		return -1;
 
-	if (index >= info->para.ncookie)
+	s = &info->response.set_cookies[index];
+	ptr = _http_str_ptr(b, s);
+	end = ptr + s->len;
+
+	ptr = _http_next_pair(ptr, end, &cookie->name, &cookie->value);
+	if (!ptr)
 		return -1;
 
+	while ( (ptr = _http_next_pair(ptr, end, &name, &value))) {
+		if (name.len == 6 && !strncasecmp(name.ptr, "Domain", 6))
+			cookie->domain = value;
+		else if (name.len == 4 && !strncasecmp(name.ptr, "Path", 4))
+			cookie->path = value;
+		else if (name.len == 7 && !strncasecmp(name.ptr, "Expires", 7))
+			cookie->expire = value;
+	}
+
 	return 0;
 }
 
+
 int 
-http_get_arg_count(http_info_t *info)
+http_get_cookie_count(http_info_t *info, int dir)
 {
-	return 0;
+	http_cookie_t cookie;
+	int n = 0;
+
+	if (!info)
+		return -1;
+
+	if (dir == HTTP_DIR_RESPONSE)
+		return info->response.nset_cookie;
+
+	while (http_get_cookie(info, dir, n, &cookie) == 0)
+		n++;
+
+	return n;
 }
 
 
-int 
-http_get_arg(http_info_t *info, int index, http_arg_t *arg)
+const char * 
+http_get_cookie_header(http_info_t *info, int dir, int index, size_t *len)
 {
-	return 0;
+	http_string_t *s;
+
+	if (!info || !len || index < 0)
+		return NULL;
+
+	if (dir == HTTP_DIR_REQUEST) {
+		if (index >= info->request.ncookie)
+			return NULL;
+		s = &info->request.cookies[index];
+	}
+	else {
+		if (index >= info->response.nset_cookie)
+			return NULL;
+		s = &info->response.set_cookies[index];
+	}
+
+	*len = s->len;
+	return _http_str_ptr(_HTTP_DIR_BUFFER(info, dir), s);
 }
 
 
+int 
+http_get_cookie_header_count(http_info_t *info, int dir)
+{
+	if (!info)
+		return -1;
+
+	if (dir == HTTP_DIR_REQUEST)
+		return info->request.ncookie;
 
-void 
-http_print_info(const http_info_t *info)
+	return info->response.nset_cookie;
+}
+
+
+int 
+http_get_arg(http_info_t *info, int index, http_arg_t *arg)
 {
+	if (!info || !arg || index < 0)
+		return -1;
 
+	/* argument is not stored now */
+	return -1;
 }
 
@@ -12,14 +12,14 @@
 #include <sys/types.h>
 
 #include "mempool.h"
+#include "http_buffer.h"
 
 /* control debug print */
-#define	_HTTP_DEBUG		1
+//#define	_HTTP_DEBUG		1
 
 /**
  *	HTTP limit macro 
  */
-#define HTTP_MAX_CACHE		32	/* http state-machine cache */
 #define HTTP_MAX_METHOD		8	/* the max method */
 #define HTTP_MAX_COOKIE		32	/* the max cookie number */
 #define HTTP_MAX_URLARG		32	/* the max URL argument */
@@ -103,6 +103,7 @@
 #define HTTP_HST_UPGRADE		17
 #define HTTP_HST_VIA		18
 #define HTTP_HST_WARNING		19
+#define HTTP_HST_PROXY_CONNECTION 20
 
 /** 
  *	HTTP header fields: request 
@@ -157,6 +158,7 @@
 #define HTTP_HST_CONTENT_TYPE	88
 #define HTTP_HST_EXPIRES	89
 #define HTTP_HST_LAST_MODIFIED	90
+#define HTTP_HST_END		254	/* header end, see http_header_cb */
 #define HTTP_HST_EXTENSION	255
 
 /**
@@ -168,6 +170,18 @@
 #define	HTTP_BST_FORM_BODY	4
 #define	HTTP_BST_FORM_END	5
 
+/**
+ *	HTTP body chunked state
+ */
+#define	HTTP_BST_CHUNK_SIZE	11	/* chunk size */
+#define	HTTP_BST_CHUNK_EXT	12	/* chunk extension */
+#define	HTTP_BST_CHUNK_SIZE_LF	13	/* LF after chunk size line */
+#define	HTTP_BST_CHUNK_DATA	14	/* chunk data */
+#define	HTTP_BST_CHUNK_DATA_CR	15	/* CR after chunk data */
+#define	HTTP_BST_CHUNK_DATA_LF	16	/* LF after chunk data */
+#define	HTTP_BST_CHUNK_TRAILER	17	/* trailer after last chunk */
+#define	HTTP_BST_CHUNK_BWS	18	/* white space before extension */
+
 /**
  *	HTTP Content-Type 
  */
@@ -198,6 +212,20 @@
 #define	HTTP_ERR_HNAME		-8	/* header name error */
 #define	HTTP_ERR_HVALUE		-9	/* headerr value error */
 #define	HTTP_ERR_CLEN		-10	/* content length error */
+#define	HTTP_ERR_CODE		-11	/* response code error */
+#define	HTTP_ERR_CRLF		-12	/* line end error */
+#define	HTTP_ERR_CHUNK		-13	/* chunked encoding error */
+#define	HTTP_ERR_TRUNCATED	-14	/* message closed before end */
+#define	HTTP_ERR_TE		-15	/* transfer-coding not chunked */
+
+/**
+ *	HTTP fast scan level, the token is scanned in bulk
+ *	instead of byte-at-a-time when it's not NONE.
+ */
+#define	HTTP_SIMD_NONE		0	/* byte-at-a-time */
+#define	HTTP_SIMD_TABLE		1	/* 256 bytes lookup table */
+#define	HTTP_SIMD_SSSE3		2	/* 16 bytes by pshufb */
+#define	HTTP_SIMD_AVX2		3	/* 32 bytes by vpshufb */
 
 /**
  *	HTTP direction: Request/Response
@@ -227,6 +255,7 @@ typedef enum http_str {
 	HTTP_STR_USER,
 	HTTP_STR_PASS,
 	HTTP_STR_WAFSID,
+	HTTP_STR_COOKIE,		/* the first Cookie header */
 } http_str_e;
 
 /**
@@ -245,6 +274,9 @@ typedef enum http_int {
 	HTTP_INT_RANGE_CNT,	/* Range number */
 	HTTP_INT_DIRECTION,	/* HTTP_REQUEST or HTTP_RESPONSE */
 	HTTP_INT_STATE,		/* http state machine state */
+	HTTP_INT_MLEN,		/* message length include header */
+	HTTP_INT_CHUNKED,	/* body is chunked */
+	HTTP_INT_CTYPE,		/* Content-Type, HTTP_CTE_XXX */
 } http_int_e;
 
 /**
@@ -262,17 +294,19 @@ typedef enum http_ctype {
 } http_ctype_e;
 
 /**
- *	HTTP string stored in http_buffer. it only store the start pos
- *	and string length.
+ *	HTTP string, it's a view of parsed data: @ptr point to the
+ *	caller's buffer which passed to http_parse(). The string
+ *	which split by two http_parse() calls is copied into
+ *	http_buffer and @off is the offset in buffer.
  */
 typedef struct http_string {
-	u_int16_t	is_encoded:1;	/* is HTTP encoded ? 1: 0 */
-	u_int16_t	have_arg:1;	/* have args in URL */
-	u_int16_t	not_fin:1;	/* this token is finished or not */
-	u_int16_t	ori_start;	/* start position in origin message */
-	u_int16_t	ori_len;	/* origin length */
-	u_int16_t	len;		/* string length */
-	char		*ptr;		/* data pointer */
+	u_int32_t	is_encoded:1;	/* is HTTP encoded ? 1: 0 */
+	u_int32_t	have_arg:1;	/* have args in URL */
+	u_int32_t	in_buf:1;	/* stored in http_buffer */
+	u_int32_t	ori_start;	/* start position in origin message */
+	u_int32_t	len;		/* string length */
+	u_int32_t	off;		/* offset in http_buffer if @in_buf */
+	const char	*ptr;		/* data pointer if not @in_buf */
 } http_string_t ;
 
 /**
@@ -313,16 +347,15 @@ typedef struct http_request {
 	u_int8_t	method;		/* HTTP method */
 
 	u_int16_t	range;		/* Range */	
-	u_int16_t	ncookie;	/* number of cookies */
 	u_int16_t	nargument;	/* number of argument */
 	u_int16_t	nheadline;	/* number of header line */
 	u_int16_t	arglen;		/* argument length */
 	u_int16_t	urlarglen;	/* url+arg length */
 	u_int16_t	maxheadlen;	/* max head line length */
 
-	u_int32_t	content_len;	/* content length */
+	u_int64_t	content_len;	/* content length */
 	u_int32_t	header_len;	/* header length */
-	u_int32_t	body_len;	/* body length */
+	u_int64_t	body_len;	/* body length */
 
 	http_string_t	oriurl;		/* origin URL */
 	http_string_t	decurl;		/* decoded URL */
@@ -342,8 +375,8 @@ typedef struct http_request {
 	http_arg_t	args;		/* args */
 	int		narg;		/* number of args */
 	int		nurlarg;	/* number of URL args */
-	http_cookie_t	cookies;	/* cookies */
-	int		ncookie;	/* number of cookies */
+	http_string_t	cookies[HTTP_MAX_COOKIE];/* Cookie value */
+	int		ncookie;	/* number of Cookie header */
 	http_upfile_t	*upfile;	/* the uploaded file list */
 	int		nupfile;
 } http_request_t;
@@ -352,14 +385,16 @@ typedef struct http_request {
  *	HTTP response structure
  */
 typedef struct http_response {
+	u_int8_t	version;	/* HTTP version */
+	u_int8_t	content_type;	/* Content-Type */
+	u_int16_t	retcode;	/* status code */
 	u_int16_t	server_close;	/* is server close */	
-	u_int16_t	nset_cookie;	/* number of cookies */
 	u_int16_t	nheadline;	/* number of header line */
 	u_int16_t	maxheadlen;	/* max head line length */
 
-	u_int32_t	content_len;	/* content length */
+	u_int64_t	content_len;	/* content length */
 	u_int32_t	header_len;	/* header length */
-	u_int32_t	body_len;	/* body length */
+	u_int64_t	body_len;	/* body length */
 	
 	http_string_t	location;	/* Location value */
 	http_string_t	location_url;	/* Location URL value */
@@ -368,7 +403,7 @@ typedef struct http_response {
 	http_string_t	aspnet;		/* Asp-Net value */
 	http_string_t	ret_code;	/* Ret-Code string */
 	http_string_t	js_arg;		/* Javascript argument */
-	http_cookie_t	*set_cookies;	/* set-cookie */
+	http_string_t	set_cookies[HTTP_MAX_COOKIE];/* Set-Cookie value */
 	int		nset_cookie;	/* number of set cookie */
 } http_response_t;
 
@@ -386,22 +421,53 @@ typedef struct http_state {
 	u_int8_t	inquote:1;	/* in quoted */
 	u_int8_t	inslash:1;	/* in slash '\' */
 	u_int8_t	encode:1;	/* encoded, need decode */
-	u_int8_t	unused:5;	/* the unused flags */
+	u_int8_t	have_clen:1;	/* have Content-Length */
+	u_int8_t	tokbuf:1;	/* token head is saved in buffer */
+	u_int8_t	chunked:1;	/* chunked body */
+	u_int8_t	have_te:1;	/* have Transfer-Encoding */
+	u_int8_t	unused:1;	/* the unused flags */
+	int8_t		error;		/* error number, HTTP_ERR_XXX */
 
 	/* header position */
-	u_int32_t	pos;		/* the pos in parser string */
+	u_int64_t	pos;		/* the pos in parser string */
+	u_int64_t	hpos;		/* the pos of header line begin */
 	u_int32_t	line;		/* the line number */
 	u_int32_t	col;		/* the column number */	
 
 	/* body infomation */
-	u_int32_t	bstart;		/* body start */
-	u_int32_t	bremain;	/* body remain */
+	u_int64_t	bstart;		/* body start */
+	u_int64_t	bremain;	/* body remain, or chunk remain */
 
-	/* cache some token char for parse */
-	u_int8_t	csize;
-	char		cache[HTTP_MAX_CACHE];
+	/* the token split by parse buffer */
+	u_int32_t	tokoff;		/* token offset in http_buffer */
 } http_state_t;
 
+struct http_info;
+
+/**
+ *	The body callback, the @data is decoded body data of
+ *	direction @dir and length is @len. It point into the
+ *	buffer passed to http_parse(), so it can be forwarded
+ *	without copy. The chunk size lines and trailers are not
+ *	passed.
+ */
+typedef void (*http_body_cb)(struct http_info *hi, int dir,
+			     const char *data, size_t len, void *arg);
+
+/**
+ *	The header callback, it's called for each header line of
+ *	direction @dir after the value is parsed. @id is HTTP_HST_XXX
+ *	(HTTP_HST_BEGIN for folded line), @pos is the position of
+ *	line begin in message, @val/@len is the value without lead
+ *	and tailing space, it's a view like http_get_str(). It's
+ *	called with @id HTTP_HST_END when the header is finished,
+ *	@pos is the begin of the last empty line, it's before any
+ *	body is passed to body callback.
+ */
+typedef void (*http_header_cb)(struct http_info *hi, int dir, int id,
+			       u_int64_t pos, const char *val, size_t len,
+			       void *arg);
+
 /**
  *	HTTP all parsed information structure.
  */
@@ -413,27 +479,91 @@ typedef struct http_info {
 	http_request_t	request;	/* http request argument */
 	http_response_t	response;	/* http response argument */
 
+	http_buffer_t	req_buf;	/* request split tokens */
+	http_buffer_t	res_buf;	/* response split tokens */
+
+	http_body_cb	body_cb;	/* body callback */
+	void		*body_arg;	/* argument of @body_cb */
+	http_header_cb	header_cb;	/* header callback */
+	void		*header_arg;	/* argument of @header_cb */
+
 	mempool_t	*mp;		/* memory pool */
 } http_info_t;
 
 /** 
- *	Parse HTTP request, the data is in @buf, begin with @start, the
- *	@buf length is @siz, the parse result is stored in @req.
+ *	Parse HTTP message of direction @dir(HTTP_DIR_XXX) in @buf,
+ *	the @buf length is @n. The message can be split in any
+ *	position, the parser state is kept in @hi. A new message is
+ *	started after the previous one finished, so the pipelined
+ *	messages are parsed by calling it with the remain bytes.
+ *	The body is framed by Content-Length, chunked encoding or
+ *	connection close, see http_parse_eof().
  *
- *	Return 0 if success, -1 on error and the error number is stored
- *	in @req->errno.
+ *	Return the bytes after the finished message in @buf, 0 if
+ *	need more data(or finished at end of @buf), -1 on error and
+ *	the error number can get by http_get_error().
  */
 extern int 
 http_parse(http_info_t *hi, int dir, const char *buf, size_t n);
 
+/**
+ *	Tell the parser the connection of direction @dir is closed,
+ *	the close-delimited body is finished.
+ *
+ *	Return 0 if the message is finished(or not started), -1 if
+ *	the message is truncated.
+ */
+extern int 
+http_parse_eof(http_info_t *hi, int dir);
+
+/**
+ *	Set the body callback @cb of @hi, the @arg is passed to
+ *	@cb. The @cb is called for each piece of decoded body.
+ *
+ *	No return.
+ */
+extern void 
+http_set_body_cb(http_info_t *hi, http_body_cb cb, void *arg);
+
+/**
+ *	Set the header callback @cb of @hi, the @arg is passed to
+ *	@cb. The @cb is called for each header line and header end.
+ *
+ *	No return.
+ */
+extern void 
+http_set_header_cb(http_info_t *hi, http_header_cb cb, void *arg);
+
+/**
+ *	The message of direction @dir have no body, it's called in
+ *	header callback of HTTP_HST_END, like the response of HEAD
+ *	request. The message is finished at header end.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+http_skip_body(http_info_t *hi, int dir);
+
+/**
+ *	Set the fast scan level @level(HTTP_SIMD_XXX) of parser,
+ *	the level is limited by CPU features.
+ *
+ *	Return the level in use.
+ */
+extern int 
+http_set_simd(int level);
+
 /**
  *	Get the string from @info, the string type is @type.
- *	See macro HTTP_STR_XXXX. 
+ *	See macro HTTP_STR_XXXX. The string is not NUL terminated,
+ *	the length is stored in @len. It point to the buffer passed
+ *	to http_parse() or the internal buffer, so it's valid before
+ *	the buffer is released and before next http_parse() call.
  *
  *	Return string if success, NULL not found.
  */
 extern const char * 
-http_get_str(http_info_t *hi, int dir, int type);
+http_get_str(http_info_t *hi, int dir, int type, size_t *len);
 
 /**
  *	Get the integer value from @info, the type is @type
@@ -444,6 +574,17 @@ http_get_str(http_info_t *hi, int dir, int type);
 extern int 
 http_get_int(http_info_t *hi, int dir, int type);
 
+/**
+ *	Get the 64 bits length from @info, the type is @type, only
+ *	HTTP_INT_HLEN, HTTP_INT_BLEN, HTTP_INT_CLEN and HTTP_INT_MLEN
+ *	are supported. Use it instead of http_get_int() for the body
+ *	which may exceed 2GB.
+ *
+ *	Return the length if success, 0 on error.
+ */
+extern u_int64_t 
+http_get_len(http_info_t *hi, int dir, int type);
+
 /**
  * 	Get the bool value from @info, the type is @type	
  *	See macro HTTP_BOOL_XXX
@@ -461,12 +602,44 @@ http_get_arg(http_info_t *hi, int index, http_arg_t *arg);
 
 /**
  *	Get the Nth cookie and stored in @name:@value. the Nth is @index.
+ *	The request cookie is from Cookie header, the response cookie
+ *	is the Nth Set-Cookie header which have @domain/@path/@expire.
+ *	The strings are views like http_get_str(), @ptr is set and
+ *	@in_buf is 0.
  *
  *	Return 0 if success, -1 on error.
  */
 extern int 
 http_get_cookie(http_info_t *hi, int dir, int index, http_cookie_t *cookie);
 
+/**
+ *	Get the number of cookies of direction @dir.
+ *
+ *	Return the number of cookies, -1 on error.
+ */
+extern int 
+http_get_cookie_count(http_info_t *hi, int dir);
+
+/**
+ *	Get the Nth Cookie header value(request) or Set-Cookie header
+ *	value(response) of direction @dir, the Nth is @index. The
+ *	string is a view like http_get_str(), the length is stored
+ *	in @len.
+ *
+ *	Return string if success, NULL not found.
+ */
+extern const char * 
+http_get_cookie_header(http_info_t *hi, int dir, int index, size_t *len);
+
+/**
+ *	Get the number of Cookie(request) or Set-Cookie(response) 
+ *	headers of direction @dir.
+ *
+ *	Return the number of headers, -1 on error.
+ */
+extern int 
+http_get_cookie_header_count(http_info_t *hi, int dir);
+
 /**
  *	Clear the content information in @info, keep @URL, @method etc.
  *
@@ -475,6 +648,24 @@ http_get_cookie(http_info_t *hi, int dir, int index, http_cookie_t *cookie);
 extern void 
 http_clear_info(http_info_t *hi);
 
+/**
+ *	Free the memory alloced in @hi, it can be used again after
+ *	free.
+ *
+ *	No return.
+ */
+extern void 
+http_free_info(http_info_t *hi);
+
+/**
+ *	Get the header id of header name @name, the length of @name
+ *	is @len and it's case insensitive.
+ *
+ *	Return the HTTP_HST_XXX id, HTTP_HST_EXTENSION if unkowned.
+ */
+extern int 
+http_header2id(const char *name, size_t len);
+
 /**
  *	Return HTTP reponse status code description.
  *
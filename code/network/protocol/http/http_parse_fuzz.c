@@ -0,0 +1,713 @@
+/*
+ *	file	http_parse_fuzz.c
+ *
+ *	brief	http_parse benchmark and differential test program,
+ *		it loads all sample messages in the given files or
+ *		directories, replays them with random split points in
+ *		each fast scan level and checks the result is same as
+ *		byte-at-a-time parse of whole message. The msg/s and
+ *		GB/s of each sample class are reported.
+ *
+ *		Build with -DHTTP_LIBFUZZER -fsanitize=fuzzer to get
+ *		a libFuzzer target which do same check on fuzz input.
+ *
+ *	author	Forrest.zhang
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "http_parse.h"
+
+#define _PATH_MAX	512
+#define _CLASS_MAX	32
+#define _SUM_MAX	8192
+
+typedef struct _sample {
+	char		name[_PATH_MAX];
+	int		class;		/* index of @_g_classes */
+	int		dir;		/* HTTP_DIR_XXX */
+	char		*msg;
+	size_t		len;
+	u_int64_t	hash;		/* result of byte-at-a-time parse */
+} _sample_t;
+
+typedef struct _class {
+	char		name[_PATH_MAX];
+	int		nsample;
+	size_t		bytes;
+} _class_t;
+
+/* the parse result summary */
+typedef struct _sum {
+	char		buf[_SUM_MAX];
+	int		len;
+	u_int64_t	body;		/* FNV hash of body */
+	size_t		blen;
+} _sum_t;
+
+static u_int64_t _g_seed = 1;
+static http_info_t _g_info;
+
+/**
+ *	The xorshift random, it's same in each run of same seed.
+ */
+static u_int32_t
+_rand(void)
+{
+	_g_seed ^= _g_seed << 13;
+	_g_seed ^= _g_seed >> 7;
+	_g_seed ^= _g_seed << 17;
+	return (u_int32_t)_g_seed;
+}
+
+static u_int64_t
+_fnv(u_int64_t h, const void *data, size_t len)
+{
+	const u_int8_t *p = data;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ p[i]) * 1099511628211ULL;
+
+	return h;
+}
+
+static void
+_sum_body(http_info_t *hi, int dir, const char *data, size_t len, void *arg)
+{
+	_sum_t *sum = arg;
+
+	sum->body = _fnv(sum->body, data, len);
+	sum->blen += len;
+}
+
+static void
+_sum_add(_sum_t *sum, const char *name, const char *str, size_t len)
+{
+	int n;
+
+	if (sum->len >= _SUM_MAX)
+		return;
+
+	n = snprintf(sum->buf + sum->len, _SUM_MAX - sum->len, "%s=%.*s\n",
+		     name, (int)len, str ? str : "");
+	sum->len += n;
+}
+
+static void
+_sum_int(_sum_t *sum, const char *name, int val)
+{
+	char buf[16];
+	int n;
+
+	n = snprintf(buf, sizeof(buf), "%d", val);
+	_sum_add(sum, name, buf, n);
+}
+
+static void
+_sum_len(_sum_t *sum, const char *name, u_int64_t val)
+{
+	char buf[24];
+	int n;
+
+	n = snprintf(buf, sizeof(buf), "%lu", (unsigned long)val);
+	_sum_add(sum, name, buf, n);
+}
+
+static void
+_sum_str(_sum_t *sum, const char *name, int dir, int type)
+{
+	const char *str;
+	size_t len = 0;
+
+	str = http_get_str(&_g_info, dir, type, &len);
+	_sum_add(sum, name, str, len);
+}
+
+/**
+ *	Get the summary of parse result, the @ret is return value of
+ *	last http_parse(), the parsed bytes is @end.
+ *
+ *	Return the hash of summary.
+ */
+static u_int64_t
+_summary(_sum_t *sum, int dir, int ret, size_t end)
+{
+	static const int ints[] = {
+		HTTP_INT_VER, HTTP_INT_METHOD, HTTP_INT_RETCODE,
+		HTTP_INT_HL_MAX, HTTP_INT_STATE, HTTP_INT_CHUNKED,
+	};
+	static const int lens[] = {
+		HTTP_INT_HLEN, HTTP_INT_BLEN, HTTP_INT_CLEN, HTTP_INT_MLEN,
+	};
+	http_cookie_t c;
+	const char *ptr;
+	size_t len;
+	unsigned int i;
+
+	_sum_int(sum, "ret", ret < 0 ? ret : 0);
+	_sum_int(sum, "end", end);
+	_sum_int(sum, "error", http_get_error(&_g_info, dir));
+	for (i = 0; i < sizeof(ints) / sizeof(ints[0]); i++)
+		_sum_int(sum, "int", http_get_int(&_g_info, dir, ints[i]));
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+		_sum_len(sum, "len", http_get_len(&_g_info, dir, lens[i]));
+
+	if (dir == HTTP_DIR_REQUEST) {
+		_sum_str(sum, "url", dir, HTTP_STR_URL);
+		_sum_str(sum, "host", dir, HTTP_STR_HOST);
+		_sum_str(sum, "agent", dir, HTTP_STR_USER_AGENT);
+	}
+	else {
+		_sum_str(sum, "location", dir, HTTP_STR_LOCATION);
+	}
+
+	for (i = 0; (ptr = http_get_cookie_header(&_g_info, dir, i, &len)); i++)
+		_sum_add(sum, "cookie", ptr, len);
+
+	for (i = 0; http_get_cookie(&_g_info, dir, i, &c) == 0; i++) {
+		_sum_add(sum, "name", c.name.ptr, c.name.len);
+		_sum_add(sum, "value", c.value.ptr, c.value.len);
+		_sum_add(sum, "path", c.path.ptr, c.path.len);
+		_sum_add(sum, "domain", c.domain.ptr, c.domain.len);
+	}
+
+	_sum_int(sum, "body", sum->blen);
+
+	return _fnv(sum->body, sum->buf, sum->len);
+}
+
+/**
+ *	Parse message @msg in level @level, each piece is random
+ *	1 - @maxsplit bytes, whole message if @maxsplit is 0. The
+ *	summary is saved in @sum.
+ *
+ *	Return the hash of summary.
+ */
+static u_int64_t
+_parse_msg(const char *msg, size_t len, int dir, int level, int maxsplit,
+	   _sum_t *sum)
+{
+	size_t pos = 0;
+	size_t n;
+	int ret = 0;
+
+	memset(sum, 0, sizeof(*sum));
+	sum->body = 14695981039346656037ULL;
+
+	http_set_simd(level);
+	http_clear_info(&_g_info);
+	http_set_body_cb(&_g_info, _sum_body, sum);
+
+	while (pos < len) {
+		n = len - pos;
+		if (maxsplit > 0 && n > (size_t)maxsplit)
+			n = 1 + _rand() % maxsplit;
+		if (n > len - pos)
+			n = len - pos;
+
+		ret = http_parse(&_g_info, dir, msg + pos, n);
+		if (ret < 0)
+			break;
+
+		/* the bytes after message end are not parsed */
+		pos += n - ret;
+		if (ret > 0 || http_get_int(&_g_info, dir, HTTP_INT_STATE) ==
+		    HTTP_STE_FIN)
+			break;
+	}
+
+	/* the close-delimited body end at end of samples */
+	if (ret == 0)
+		ret = http_parse_eof(&_g_info, dir);
+
+	return _summary(sum, dir, ret, ret < 0 ? 0 : pos);
+}
+
+#ifdef	HTTP_LIBFUZZER
+
+/**
+ *	The libFuzzer entry, the first byte select direction and
+ *	max split, the rest is message.
+ *
+ *	Return 0 always, abort if the result is not same.
+ */
+int
+LLVMFuzzerTestOneInput(const u_int8_t *data, size_t size)
+{
+	static _sum_t ref, sum;
+	u_int64_t h1, h2;
+	int dir, maxsplit;
+	int level;
+
+	if (size < 1)
+		return 0;
+
+	dir = (data[0] & 1) ? HTTP_DIR_RESPONSE : HTTP_DIR_REQUEST;
+	maxsplit = 1 + (data[0] >> 1);
+	_g_seed = data[0] + 1;
+
+	h1 = _parse_msg((const char *)data + 1, size - 1, dir,
+			HTTP_SIMD_NONE, 0, &ref);
+	for (level = HTTP_SIMD_NONE; level <= HTTP_SIMD_AVX2; level++) {
+		h2 = _parse_msg((const char *)data + 1, size - 1, dir,
+				level, maxsplit, &sum);
+		if (h1 != h2) {
+			fprintf(stderr, "level %d split %d:\n%.*s\n--\n%.*s\n",
+				level, maxsplit, ref.len, ref.buf,
+				sum.len, sum.buf);
+			abort();
+		}
+	}
+
+	return 0;
+}
+
+#else	/* not HTTP_LIBFUZZER */
+
+static int _g_loop_times = 1000;
+static int _g_replay = 20;
+static int _g_maxsplit = 64;
+static int _g_level = -1;
+static int _g_verbose = 0;
+static _sample_t *_g_samples;
+static int _g_nsample;
+static int _g_maxsample;
+static _class_t _g_classes[_CLASS_MAX];
+static int _g_nclass;
+
+static void
+_usage(void)
+{
+	printf("http_parse_fuzz <options> <files or directories>\n");
+	printf("\t-t <num> \tbench loop times (need > 0), default is 1000\n");
+	printf("\t-r <num> \treplay times of random split, default is 20\n");
+	printf("\t-m <num> \tmax bytes of split piece, default is 64\n");
+	printf("\t-S <num> \tbench fast scan level, default is max level\n");
+	printf("\t-s <num> \trandom seed, default is 1\n");
+	printf("\t-v       \tshow each sample\n");
+	printf("\t-h       \tshow help message\n");
+}
+
+static int
+_parse_cmd(int argc, char **argv)
+{
+	char optstr[] = ":t:r:m:S:s:vh";
+	char opt;
+
+	opterr = 0;
+	while ( (opt = getopt(argc, argv, optstr)) != -1) {
+		switch (opt) {
+
+		case 't':
+			_g_loop_times = atoi(optarg);
+			if (_g_loop_times < 1)
+				return -1;
+			break;
+
+		case 'r':
+			_g_replay = atoi(optarg);
+			if (_g_replay < 0)
+				return -1;
+			break;
+
+		case 'm':
+			_g_maxsplit = atoi(optarg);
+			if (_g_maxsplit < 1)
+				return -1;
+			break;
+
+		case 'S':
+			_g_level = atoi(optarg);
+			if (_g_level < HTTP_SIMD_NONE || _g_level > HTTP_SIMD_AVX2)
+				return -1;
+			break;
+
+		case 's':
+			_g_seed = strtoull(optarg, NULL, 10);
+			if (_g_seed == 0)
+				return -1;
+			break;
+
+		case 'v':
+			_g_verbose = 1;
+			break;
+
+		case 'h':
+			return -1;
+
+		case ':':
+			printf("option %c missing argument\n", optopt);
+			return -1;
+
+		case '?':
+			printf("unkowned option %c\n", optopt);
+			return -1;
+		}
+	}
+
+	if (optind == argc)
+		return -1;
+
+	return 0;
+}
+
+/**
+ *	Read whole file @file into memory.
+ *
+ *	Return the memory if success, NULL on error.
+ */
+static char *
+_read_file(const char *file, size_t *len)
+{
+	int fd;
+	int n;
+	char *buf;
+	struct stat st;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+
+	/* space for start line and Content-Length header */
+	buf = malloc(st.st_size + 128);
+	if (!buf) {
+		close(fd);
+		return NULL;
+	}
+
+	n = read(fd, buf, st.st_size);
+	close(fd);
+	if (n != st.st_size) {
+		free(buf);
+		return NULL;
+	}
+
+	buf[n] = 0;
+	*len = n;
+	return buf;
+}
+
+/**
+ *	Get the class index of sample @path, it's the directory
+ *	of sample.
+ *
+ *	Return the class index.
+ */
+static int
+_get_class(const char *path)
+{
+	char name[_PATH_MAX];
+	char *slash;
+	int i;
+
+	snprintf(name, sizeof(name), "%s", path);
+	slash = strrchr(name, '/');
+	if (slash)
+		*slash = 0;
+	else
+		snprintf(name, sizeof(name), ".");
+
+	for (i = 0; i < _g_nclass; i++) {
+		if (!strcmp(_g_classes[i].name, name))
+			return i;
+	}
+
+	if (_g_nclass == _CLASS_MAX)
+		return _CLASS_MAX - 1;
+
+	snprintf(_g_classes[i].name, sizeof(_g_classes[i].name), "%s", name);
+	_g_nclass++;
+	return i;
+}
+
+/**
+ *	Check the data @buf is a start line.
+ *
+ *	Return 1 if it's request line, 2 status line, 0 not.
+ */
+static int
+_start_line(const char *buf, size_t len)
+{
+	const char *eol;
+
+	if (len > 5 && !memcmp(buf, "HTTP/", 5))
+		return 2;
+
+	eol = memchr(buf, '\n', len);
+	if (!eol)
+		eol = buf + len;
+	if (eol - buf > 9 && (!memcmp(eol - 9, "HTTP/1.", 7) ||
+			      !memcmp(eol - 10, "HTTP/1.", 7)))
+		return 1;
+
+	return 0;
+}
+
+/**
+ *	Add sample file @path, the header only sample get a request
+ *	line, the other sample is a response body.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int
+_add_sample(const char *path)
+{
+	_sample_t *s;
+	char *buf;
+	size_t len;
+	int type;
+	int n;
+
+	buf = _read_file(path, &len);
+	if (!buf)
+		return -1;
+
+	if (_g_nsample == _g_maxsample) {
+		_g_maxsample = _g_maxsample ? _g_maxsample * 2 : 128;
+		s = realloc(_g_samples, _g_maxsample * sizeof(_sample_t));
+		if (!s) {
+			free(buf);
+			return -1;
+		}
+		_g_samples = s;
+	}
+
+	s = &_g_samples[_g_nsample];
+	memset(s, 0, sizeof(*s));
+	snprintf(s->name, sizeof(s->name), "%s", path);
+	s->class = _get_class(path);
+	s->dir = HTTP_DIR_REQUEST;
+
+	type = _start_line(buf, len);
+	if (type == 2)
+		s->dir = HTTP_DIR_RESPONSE;
+
+	if (!type && len > 0 && memchr(buf, ':', len < 256 ? len : 256)) {
+		/* header lines only */
+		n = strlen("GET / HTTP/1.1\r\n");
+		memmove(buf + n, buf, len);
+		memcpy(buf, "GET / HTTP/1.1\r\n", n);
+		len += n;
+		if (len < 2 || memcmp(buf + len - 2, "\n\n", 2))
+			buf[len++] = '\n';
+	}
+	else if (!type) {
+		/* the body */
+		n = snprintf(NULL, 0, "HTTP/1.1 200 OK\r\nContent-Length: "
+			     "%lu\r\n\r\n", (unsigned long)len);
+		memmove(buf + n, buf, len);
+		snprintf(buf, n + 1, "HTTP/1.1 200 OK\r\nContent-Length: "
+			 "%lu\r\n\r\n", (unsigned long)len);
+		buf[n - 1] = '\n';
+		len += n;
+		s->dir = HTTP_DIR_RESPONSE;
+	}
+
+	s->msg = buf;
+	s->len = len;
+	_g_classes[s->class].nsample++;
+	_g_classes[s->class].bytes += len;
+	_g_nsample++;
+
+	return 0;
+}
+
+/**
+ *	Add all samples in @path, it's file or directory.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int
+_load_path(const char *path)
+{
+	char sub[_PATH_MAX];
+	struct dirent *ent;
+	struct stat st;
+	DIR *dir;
+	int ret = 0;
+
+	if (stat(path, &st))
+		return -1;
+
+	if (!S_ISDIR(st.st_mode)) {
+		/* skip the signature files */
+		if (strstr(path, "_rules"))
+			return 0;
+		return _add_sample(path);
+	}
+
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	while ( (ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.')
+			continue;
+		snprintf(sub, sizeof(sub), "%s/%s", path, ent->d_name);
+		if (_load_path(sub))
+			ret = -1;
+	}
+
+	closedir(dir);
+	return ret;
+}
+
+static void
+_release(void)
+{
+	int i;
+
+	for (i = 0; i < _g_nsample; i++)
+		free(_g_samples[i].msg);
+	free(_g_samples);
+
+	http_free_info(&_g_info);
+}
+
+static u_int64_t
+_cputime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *	Replay each sample @_g_replay times with random split in each
+ *	level, the result must be same as byte-at-a-time parse of
+ *	whole message.
+ *
+ *	Return the number of failed replays.
+ */
+static int
+_do_replay(void)
+{
+	static _sum_t ref, sum;
+	_sample_t *s;
+	u_int64_t h;
+	int nfail = 0;
+	int level, i, j;
+
+	for (i = 0; i < _g_nsample; i++) {
+		s = &_g_samples[i];
+		s->hash = _parse_msg(s->msg, s->len, s->dir, HTTP_SIMD_NONE,
+				     0, &ref);
+		if (_g_verbose)
+			printf("%s: error %d, %d bytes, %lu body\n", s->name,
+			       http_get_error(&_g_info, s->dir),
+			       http_get_int(&_g_info, s->dir, HTTP_INT_MLEN),
+			       (unsigned long)ref.blen);
+
+		for (level = HTTP_SIMD_NONE; level <= HTTP_SIMD_AVX2; level++) {
+			for (j = 0; j <= _g_replay; j++) {
+				h = _parse_msg(s->msg, s->len, s->dir, level,
+					       j ? _g_maxsplit : 0, &sum);
+				if (h == s->hash)
+					continue;
+
+				nfail++;
+				printf("%s: level %d replay %d differ:\n"
+				       "%.*s--\n%.*s\n", s->name, level, j,
+				       ref.len, ref.buf, sum.len, sum.buf);
+				break;
+			}
+		}
+	}
+
+	printf("replay %d samples %d times in %d levels, %d failed\n",
+	       _g_nsample, _g_replay, HTTP_SIMD_AVX2 + 1, nfail);
+
+	return nfail;
+}
+
+/**
+ *	Parse the samples of each class @_g_loop_times and report
+ *	msg/s and GB/s.
+ *
+ *	No return.
+ */
+static void
+_do_bench(void)
+{
+	_sample_t *s;
+	u_int64_t begin, end;
+	double sec;
+	int level;
+	int c, i, j;
+
+	level = http_set_simd(_g_level < 0 ? HTTP_SIMD_AVX2 : _g_level);
+
+	for (c = 0; c < _g_nclass; c++) {
+		begin = _cputime();
+		for (i = 0; i < _g_loop_times; i++) {
+			for (j = 0; j < _g_nsample; j++) {
+				s = &_g_samples[j];
+				if (s->class != c)
+					continue;
+				http_clear_info(&_g_info);
+				http_parse(&_g_info, s->dir, s->msg, s->len);
+			}
+		}
+		end = _cputime();
+
+		sec = (end - begin) / 1000000000.0;
+		printf("level %d: %-28s %3d samples %7lu bytes, "
+		       "%10.0f msg/s, %.3f GB/s\n", level,
+		       _g_classes[c].name, _g_classes[c].nsample,
+		       (unsigned long)_g_classes[c].bytes,
+		       (double)_g_classes[c].nsample * _g_loop_times / sec,
+		       (double)_g_classes[c].bytes * _g_loop_times / sec /
+		       1000000000.0);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	int i;
+
+	if (_parse_cmd(argc, argv)) {
+		_usage();
+		return -1;
+	}
+
+	for (i = optind; i < argc; i++) {
+		if (_load_path(argv[i]))
+			printf("load %s failed\n", argv[i]);
+	}
+
+	if (_g_nsample < 1) {
+		_release();
+		return -1;
+	}
+
+	if (_do_replay()) {
+		_release();
+		return -1;
+	}
+
+	_do_bench();
+
+	_release();
+
+	return 0;
+}
+
+#endif	/* end of HTTP_LIBFUZZER */
+
@@ -1,7 +1,9 @@
 /*
  *	file	http_test.c
  *
- *	brief	http_protocol test program
+ *	brief	http_parse test program, it parse the message in
+ *		header/body file many times and report GB/s of each
+ *		fast scan level.
  *
  *	author	Forrest.zhang
  */
@@ -14,35 +16,52 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include <time.h>
 
-#include "http_protocol.h"
+#include "http_parse.h"
 
-#define _FILE_MAX	32
-#define _BUF_MAX	16
+#define _FILE_MAX	256
 #define _SPLIT_MAX	64
+#define _NAME_MAX	256
 
-static int _g_loop_times = 1;
+static int _g_loop_times = 10000;
 static int _g_request = 1;
+static int _g_split = 0;
+static int _g_level = -1;
+static int _g_lookup = 0;
+static int _g_chunk = 0;
+static int _g_pipeline = 1;
 static char _g_header_file[_FILE_MAX];
 static char _g_body_file[_FILE_MAX];
-static int _g_body_len = 0;
-static char _g_split_str[_SPLIT_MAX];
+static char *_g_msg;
+static int _g_msglen;
+static char *_g_body;
+static int _g_bodylen;
+static int _g_bodypos;
+static int _g_bodyerr;
+static http_info_t _g_info;
 
 static void
 _usage(void)
 {
-	printf("http_protocol_test <options>\n");
-	printf("\t-t <num> \tloop times (need > 0)\n");
+	printf("http_parse_test <options>\n");
+	printf("\t-t <num> \tloop times (need > 0), default is 10000\n");
 	printf("\t-s       \tparse response\n");
 	printf("\t-H <file>\thttp header file\n");
 	printf("\t-B <file>\thttp body file\n");
+	printf("\t-b <num> \tbytes in each parse call, default is whole\n");
+	printf("\t-S <num> \tfast scan level: 0 byte-at-a-time, 1 table, "
+	       "2 SSSE3, 3 AVX2, default is 0 and max level\n");
+	printf("\t-c <num> \tsend body in chunks of <num> bytes\n");
+	printf("\t-p <num> \tpipeline <num> messages, default is 1\n");
+	printf("\t-l       \treport header name lookup cost\n");
 	printf("\t-h       \tshow help message\n");
 }
 
 static int
 _parse_cmd(int argc, char **argv)
 {
-	char optstr[] = ":t:H:B:sh";
+	char optstr[] = ":t:H:B:b:S:c:p:slh";
 	char opt;
 
 	opterr = 0;
@@ -70,10 +89,38 @@ _parse_cmd(int argc, char **argv)
 
 			break;
 
+		case 'b':
+			_g_split = atoi(optarg);
+			if (_g_split < 1)
+				return -1;
+			break;
+
+		case 'S':
+			_g_level = atoi(optarg);
+			if (_g_level < HTTP_SIMD_NONE || _g_level > HTTP_SIMD_AVX2)
+				return -1;
+			break;
+
 		case 's':
 			_g_request = 0;
 			break;
 
+		case 'l':
+			_g_lookup = 1;
+			break;
+
+		case 'c':
+			_g_chunk = atoi(optarg);
+			if (_g_chunk < 1)
+				return -1;
+			break;
+
+		case 'p':
+			_g_pipeline = atoi(optarg);
+			if (_g_pipeline < 1)
+				return -1;
+			break;
+
 		case 'h':
 			return -1;
 
@@ -90,27 +137,174 @@ _parse_cmd(int argc, char **argv)
 	if (optind != argc)
 		return -1;
 
+	if (strlen(_g_header_file) < 1)
+		return -1;
 
 	return 0;
 }
 
+/**
+ *	Read whole file @file into memory.
+ *
+ *	Return the memory if success, NULL on error.
+ */
+static char *
+_read_file(const char *file, int *len)
+{
+	int fd;
+	int n;
+	char *buf;
+	struct stat st;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+
+	buf = malloc(st.st_size + 1);
+	if (!buf) {
+		close(fd);
+		return NULL;
+	}
+
+	n = read(fd, buf, st.st_size);
+	close(fd);
+	if (n != st.st_size) {
+		free(buf);
+		return NULL;
+	}
+
+	buf[n] = 0;
+	*len = n;
+	return buf;
+}
+
+/**
+ *	Encode body @body:@blen in chunks of @_g_chunk bytes, a
+ *	trailer is added after last chunk.
+ *
+ *	Return the encoded length, -1 on error.
+ */
+static int
+_chunk_body(char *dst, const char *body, int blen)
+{
+	int len = 0;
+	int pos = 0;
+	int n;
+
+	while (pos < blen) {
+		n = blen - pos;
+		if (n > _g_chunk)
+			n = _g_chunk;
+		len += sprintf(dst + len, "%x;ext=1\r\n", n);
+		memcpy(dst + len, body + pos, n);
+		len += n;
+		memcpy(dst + len, "\r\n", 2);
+		len += 2;
+		pos += n;
+	}
+
+	len += sprintf(dst + len, "0\r\nX-Trailer: end\r\n\r\n");
+
+	return len;
+}
+
+/**
+ *	Build the whole message: start line(if header file have not),
+ *	header file, "Content-Length: N\r\n\r\n"(or chunked encoding)
+ *	and body file. The message is repeated @_g_pipeline times.
+ *
+ * 	Return 0 if success, -1 on error.
+ */
 static int
 _initiate(void)
 {
-	struct stat buf;
+	char *hdr;
+	char *body = NULL;
+	const char *line = "";
+	const char *eol;
+	char split[_SPLIT_MAX];
+	int hlen, blen = 0;
+	int mlen;
+	int n;
+	int i;
+
+	hdr = _read_file(_g_header_file, &hlen);
+	if (!hdr)
+		return -1;
 
 	if (strlen(_g_body_file) > 0) {
-		if (stat(_g_body_file, &buf))
+		body = _read_file(_g_body_file, &blen);
+		if (!body) {
+			free(hdr);
 			return -1;
+		}
+	}
 
-		_g_body_len = buf.st_size;
+	/* remove the empty line, Content-Length is added before it */
+	if (hlen > 1 && hdr[hlen - 1] == '\n' && hdr[hlen - 2] == '\n')
+		hlen--;
+	else if (hlen > 2 && !memcmp(hdr + hlen - 3, "\n\r\n", 3))
+		hlen -= 2;
+
+	/* the header file only have header lines */
+	eol = memchr(hdr, '\n', hlen);
+	if (_g_request) {
+		if (!eol || eol - hdr < 8 ||
+		    (memcmp(eol - 8, "HTTP/1.", 7) &&
+		     memcmp(eol - 9, "HTTP/1.", 7)))
+			line = "GET / HTTP/1.1\r\n";
+	}
+	else {
+		if (strncmp(hdr, "HTTP/", 5))
+			line = "HTTP/1.1 200 OK\r\n";
 	}
+
+	if (_g_chunk)
+		n = snprintf(split, _SPLIT_MAX - 1,
+			     "Transfer-Encoding: chunked\r\n\r\n");
 	else
-		_g_body_len = 0;
+		n = snprintf(split, _SPLIT_MAX - 1,
+			     "Content-Length: %d\r\n\r\n", blen);
+
+	/* chunked body need at most 32 bytes more each chunk */
+	mlen = strlen(line) + hlen + n + blen + 64;
+	if (_g_chunk)
+		mlen += (blen / _g_chunk + 1) * 32;
+
+	_g_msg = malloc(mlen * _g_pipeline);
+	if (!_g_msg) {
+		free(hdr);
+		free(body);
+		return -1;
+	}
+
+	memcpy(_g_msg, line, strlen(line));
+	_g_msglen = strlen(line);
+	memcpy(_g_msg + _g_msglen, hdr, hlen);
+	_g_msglen += hlen;
+	memcpy(_g_msg + _g_msglen, split, n);
+	_g_msglen += n;
+	if (_g_chunk)
+		_g_msglen += _chunk_body(_g_msg + _g_msglen, body, blen);
+	else if (body)
+		memcpy(_g_msg + _g_msglen, body, blen);
+	if (!_g_chunk)
+		_g_msglen += blen;
+
+	mlen = _g_msglen;
+	for (i = 1; i < _g_pipeline; i++) {
+		memcpy(_g_msg + _g_msglen, _g_msg, mlen);
+		_g_msglen += mlen;
+	}
 
-	snprintf(_g_split_str, _SPLIT_MAX - 1, 
-		 "Content-Length: %d\r\n\r\n", 
-		 _g_body_len);
+	free(hdr);
+	_g_body = body;
+	_g_bodylen = blen;
 
 	return 0;
 }
@@ -118,143 +312,261 @@ _initiate(void)
 static void
 _release(void)
 {
+	if (_g_msg)
+		free(_g_msg);
+	_g_msg = NULL;
+
+	if (_g_body)
+		free(_g_body);
+	_g_body = NULL;
+
+	http_free_info(&_g_info);
 }
 
+static u_int64_t
+_cputime(void)
+{
+	struct timespec ts;
 
-static int 
-_do_request(void)
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *	The body callback, check the decoded body is same as
+ *	body file.
+ */
+static void
+_body_cb(http_info_t *hi, int dir, const char *data, size_t len, void *arg)
 {
-	http_info_t req;
-	int n;
-	int pos;
-	char buf[_BUF_MAX + 1];
-	int fd1, fd2;
-	int i;
+	if (_g_bodypos + len > (size_t)_g_bodylen ||
+	    memcmp(_g_body + _g_bodypos, data, len))
+		_g_bodyerr = 1;
 
-	fd1 = open(_g_header_file, O_RDONLY);
-	if (fd1 < 0)
-		return -1;
+	_g_bodypos += len;
+}
 
-	if (strlen(_g_body_file) > 0) {
-		fd2 = open(_g_body_file, O_RDONLY);
-		if (fd2 < 0)
+/**
+ *	Parse the messages once, it's split by @_g_split.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int
+_parse_once(int dir)
+{
+	int n;
+	int pos = 0;
+	int ret;
+	int nmsg = 0;
+
+	while (pos < _g_msglen) {
+		n = _g_msglen - pos;
+		if (_g_split > 0 && n > _g_split)
+			n = _g_split;
+
+		ret = http_parse(&_g_info, dir, _g_msg + pos, n);
+		if (ret < 0) {
+			printf("parse failed at %d, error %d\n", pos,
+			       http_get_error(&_g_info, dir));
 			return -1;
-	}
-	else
-		fd2 = -1;
-
-	for (i = 0; i < _g_loop_times; i++) {
-		lseek(fd1, 0L, SEEK_SET);
-		memset(&req, 0, sizeof(req));
-		pos = 0;
-
-		n = read(fd1, buf, _BUF_MAX);
-		while (n > 0) {
-			buf[n] = 0;
-//			printf("parse: %s\n", buf);
-			if (http_parse_request(&req, buf, n, pos))
-				return -1;
-			
-			pos += n;
-			n = read(fd1, buf, _BUF_MAX);
 		}
 
-		/* add "Content-Length" and "\r\n\r\n" to end of header */
-		if (http_parse_request(&req, _g_split_str, strlen(_g_split_str), pos))
-			return -1;
-		
-		if (fd2 < 0)
+		pos += n - ret;
+
+		if (http_get_int(&_g_info, dir, HTTP_INT_STATE) !=
+		    HTTP_STE_FIN)
 			continue;
 
-		/* parse body */
-		pos += strlen(_g_split_str);
-		lseek(fd2, 0L, SEEK_SET);
-		n = read(fd2, buf, _BUF_MAX);
-		while (n > 0) {
-			buf[n] = 0;
-//			printf("parse: %s\n", buf);
-			if (http_parse_request(&req, buf, n, pos))
-				return -1;
-			
-			pos += n;
-			n = read(fd2, buf, _BUF_MAX);
+		/* message end offset must be the message boundary */
+		nmsg++;
+		if (pos != nmsg * (_g_msglen / _g_pipeline) ||
+		    http_get_int(&_g_info, dir, HTTP_INT_MLEN) !=
+		    _g_msglen / _g_pipeline)
+		{
+			printf("message %d end at %d, length %d\n", nmsg, pos,
+			       http_get_int(&_g_info, dir, HTTP_INT_MLEN));
+			return -1;
 		}
-	}
 
-	printf("Host: %s\n", http_get_string(&req, HTTP_STR_HOST));
+		if (_g_bodyerr || _g_bodypos != _g_bodylen) {
+			printf("message %d body mismatch, %d of %d bytes\n",
+			       nmsg, _g_bodypos, _g_bodylen);
+			return -1;
+		}
+		_g_bodypos = 0;
+	}
 
-	printf("parse %d times success\n", _g_loop_times);
+	if (nmsg != _g_pipeline) {
+		printf("%d of %d messages finished\n", nmsg, _g_pipeline);
+		return -1;
+	}
 
 	return 0;
 }
 
+static void
+_print_str(const char *name, int dir, int type)
+{
+	const char *str;
+	size_t len = 0;
+
+	str = http_get_str(&_g_info, dir, type, &len);
+	printf("%s: %.*s\n", name, (int)len, str ? str : "");
+}
+
+static void
+_print_cookie(int dir)
+{
+	http_cookie_t c;
+	const char *str;
+	size_t len;
+	int i;
+
+	for (i = 0; (str = http_get_cookie_header(&_g_info, dir, i, &len)); i++)
+		printf("%s[%d]: %.*s\n", 
+		       dir == HTTP_DIR_REQUEST ? "Cookie" : "Set-Cookie", 
+		       i, (int)len, str);
+
+	for (i = 0; http_get_cookie(&_g_info, dir, i, &c) == 0; i++) {
+		printf("cookie[%d]: %.*s=%.*s", i,
+		       (int)c.name.len, c.name.ptr,
+		       (int)c.value.len, c.value.ptr ? c.value.ptr : "");
+		if (c.path.len)
+			printf(" path=%.*s", (int)c.path.len, c.path.ptr);
+		if (c.domain.len)
+			printf(" domain=%.*s",
+			       (int)c.domain.len, c.domain.ptr);
+		printf("\n");
+	}
+}
+
+static void
+_print_info(int dir)
+{
+	if (dir == HTTP_DIR_REQUEST) {
+		printf("method %d, version %d\n",
+		       http_get_int(&_g_info, dir, HTTP_INT_METHOD),
+		       http_get_int(&_g_info, dir, HTTP_INT_VER));
+		_print_str("URL", dir, HTTP_STR_URL);
+		_print_str("Host", dir, HTTP_STR_HOST);
+		_print_str("User-Agent", dir, HTTP_STR_USER_AGENT);
+	}
+	else {
+		printf("code %d, version %d\n",
+		       http_get_int(&_g_info, dir, HTTP_INT_RETCODE),
+		       http_get_int(&_g_info, dir, HTTP_INT_VER));
+		_print_str("Location", dir, HTTP_STR_LOCATION);
+	}
+
+	_print_cookie(dir);
+
+	printf("header %lu bytes, max line %d, body %lu bytes%s, "
+	       "message %lu bytes\n",
+	       (unsigned long)http_get_len(&_g_info, dir, HTTP_INT_HLEN),
+	       http_get_int(&_g_info, dir, HTTP_INT_HL_MAX),
+	       (unsigned long)http_get_len(&_g_info, dir, HTTP_INT_BLEN),
+	       http_get_int(&_g_info, dir, HTTP_INT_CHUNKED) ?
+	       "(chunked)" : "",
+	       (unsigned long)http_get_len(&_g_info, dir, HTTP_INT_MLEN));
+}
+
+/**
+ *	Parse the message @_g_loop_times with fast scan level @level.
+ *
+ * 	Return 0 if success, -1 on error.
+ */
 static int
-_do_response(void)
+_do_parse(int level)
 {
-	http_info_t res;
-	int n;
-	int pos;
-	char buf[_BUF_MAX];
-	int fd1, fd2;
 	int i;
+	int dir;
+	u_int64_t begin, end;
+	double sec;
 
-	fd1 = open(_g_header_file, O_RDONLY);
-	if (fd1 < 0)
-		return -1;
+	dir = _g_request ? HTTP_DIR_REQUEST : HTTP_DIR_RESPONSE;
+	level = http_set_simd(level);
 
-	if (strlen(_g_body_file) > 0) {
-		fd2 = open(_g_body_file, O_RDONLY);
-		if (fd2 < 0)
+	http_clear_info(&_g_info);
+	http_set_body_cb(&_g_info, _body_cb, NULL);
+
+	begin = _cputime();
+	for (i = 0; i < _g_loop_times; i++) {
+		if (_parse_once(dir))
 			return -1;
 	}
-	else
-		fd2 = -1;
+	end = _cputime();
 
-	for (i = 0; i < _g_loop_times; i++) {
-		lseek(fd1, 0L, SEEK_SET);
-		memset(&res, 0, sizeof(res));
-		pos = 0;
+	sec = (end - begin) / 1000000000.0;
+	printf("level %d: parse %d bytes %d times, %.3f GB/s, %.0f msg/s\n",
+	       level, _g_msglen, _g_loop_times,
+	       (double)_g_msglen * _g_loop_times / sec / 1000000000.0,
+	       (double)_g_loop_times * _g_pipeline / sec);
 
-		n = read(fd1, buf, _BUF_MAX);
-		while (n > 0) {
-			if (http_parse_response(&res, buf, n, pos))
-				return -1;
-			
-			pos += n;
-			n = read(fd1, buf, _BUF_MAX);
+	return 0;
+}
+
+/**
+ *	Lookup the header names of message @_g_loop_times and
+ *	report the cost of each lookup.
+ *
+ * 	Return 0 if success, -1 on error.
+ */
+static int
+_do_lookup(void)
+{
+	const char *names[_NAME_MAX];
+	size_t lens[_NAME_MAX];
+	const char *ptr, *end, *eol, *colon;
+	int nname = 0, nknown = 0;
+	int i, j;
+	u_int64_t begin, stop;
+	unsigned long sum = 0;
+	double ns;
+
+	/* skip start line, collect name of each header line */
+	ptr = memchr(_g_msg, '\n', _g_msglen);
+	end = _g_msg + _g_msglen;
+	while (ptr && ++ptr < end && nname < _NAME_MAX) {
+		eol = memchr(ptr, '\n', end - ptr);
+		if (!eol || *ptr == '\r' || *ptr == '\n')
+			break;
+
+		colon = memchr(ptr, ':', eol - ptr);
+		if (colon && colon > ptr) {
+			names[nname] = ptr;
+			lens[nname] = colon - ptr;
+			nname++;
 		}
+		ptr = eol;
+	}
 
-		/* add "Content-Length" and "\r\n\r\n" to end of header */
-		if (http_parse_response(&res, _g_split_str, strlen(_g_split_str), pos))
-			return -1;
+	if (nname < 1)
+		return -1;
 
-		if (fd2 < 0)
-			continue;
+	for (i = 0; i < nname; i++) {
+		if (http_header2id(names[i], lens[i]) != HTTP_HST_EXTENSION)
+			nknown++;
+	}
 
-		/* parse body */
-		pos += strlen(_g_split_str);
-		lseek(fd2, 0L, SEEK_SET);
-		n = read(fd2, buf, _BUF_MAX);
-		while (n > 0) {
-			if (http_parse_response(&res, buf, n, pos))
-				return -1;
-			
-			pos += n;
-			n = read(fd2, buf, _BUF_MAX);
-		}
+	begin = _cputime();
+	for (i = 0; i < _g_loop_times; i++) {
+		for (j = 0; j < nname; j++)
+			sum += http_header2id(names[j], lens[j]);
 	}
+	stop = _cputime();
 
-	printf("parse http response %d times success\n", _g_loop_times);
-	
-	close(fd1);
-	close(fd2);
+	ns = (double)(stop - begin) / _g_loop_times / nname;
+	printf("lookup %d header names(%d known) %d times, %.2f ns/header "
+	       "(%lu)\n", nname, nknown, _g_loop_times, ns, sum);
 
 	return 0;
 }
 
-int 
+int
 main(int argc, char **argv)
 {
+	int dir;
+
 	if (_parse_cmd(argc, argv)) {
 		_usage();
 		return -1;
@@ -265,10 +577,29 @@ main(int argc, char **argv)
 		return -1;
 	}
 
-	if (_g_request)
-		_do_request();
-	else
-		_do_response();
+	dir = _g_request ? HTTP_DIR_REQUEST : HTTP_DIR_RESPONSE;
+
+	if (_g_lookup) {
+		if (_do_lookup())
+			printf("no header name found\n");
+		_release();
+		return 0;
+	}
+
+	if (_g_level >= 0) {
+		if (_do_parse(_g_level)) {
+			_release();
+			return -1;
+		}
+	}
+	else {
+		if (_do_parse(HTTP_SIMD_NONE) || _do_parse(HTTP_SIMD_AVX2)) {
+			_release();
+			return -1;
+		}
+	}
+
+	_print_info(dir);
 
 	_release();
 
@@ -0,0 +1,1723 @@
+/**
+ *	file	http_sig.c
+ *	brief	HTTP attack signature engine, the literal prefilter is
+ *		a Aho-Corasick DFA and the candidate is confirmed by
+ *		PCRE.
+ *
+ *	author	Forrest.zhang
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <assert.h>
+#include <pcre.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define	_SIG_HAVE_X86		1
+#endif
+
+#include "http_sig.h"
+
+/**
+ *	Define some macro to print debug message
+ */
+#ifdef	_SIG_DEBUG
+#define _SIG_ERR(fmt, args...)		fprintf(stderr, "sig:%s:%d: " fmt, \
+						__FILE__, __LINE__, ##args)
+#else
+#define	_SIG_ERR(fmt, args...)
+#endif
+
+#define	_LIT_EXACT		1	/* matched string is one of literals */
+#define	_LIT_MATCH		2	/* matched string have one of literals */
+#define	_LIT_ANY		3	/* no literal */
+
+#define	_LIT_EXACT_MAX		16	/* max literals of _LIT_EXACT */
+#define	_LIT_MATCH_MAX		256	/* max literals of _LIT_MATCH */
+#define	_LIT_LEN_MAX		64	/* max literal length */
+#define	_LIT_CLASS_MAX		4	/* max chars of char class */
+
+#define	_SIG_LINE_MAX		8192	/* max line of rule file */
+#define	_SIG_OUT		0x80000000U	/* DFA state have output */
+
+#define	_SIG_CAND		0x01	/* signature is candidate */
+#define	_SIG_MATCHED		0x02	/* signature is matched */
+
+/**
+ *	The literal set of regex node.
+ */
+typedef struct _sig_lits {
+	int		type;		/* _LIT_XXX */
+	int		n;		/* number of literals */
+	int		max;		/* size of @s */
+	char		**s;		/* lower case literals */
+} _sig_lits_t;
+
+typedef struct _sig_rule {
+	char		name[HTTP_SIG_NAMELEN];
+	int		fields;		/* HTTP_SIG_XXX */
+	int		filtered;	/* have literals */
+	char		*regex;		/* the regex string */
+	pcre		*re;		/* compiled regex */
+	pcre_extra	*extra;		/* studied regex */
+	_sig_lits_t	*lits;		/* literals, free after compile */
+} _sig_rule_t;
+
+typedef struct _sig_lit {
+	char		*str;		/* the literal */
+	int		*rules;		/* the signatures have it */
+	int		nrule;
+	int		maxrule;
+} _sig_lit_t;
+
+struct http_sig {
+	_sig_rule_t	*rules;		/* signatures */
+	int		nrule;
+	int		maxrule;
+	int		*unfiltered;	/* signatures have no literal */
+	int		nunfiltered;
+	int		compiled;
+
+	_sig_lit_t	*lits;		/* all literals */
+	int		nlit;
+	int		maxlit;
+
+	/* the DFA, the entry is next state * @nclass | _SIG_OUT */
+	u_int8_t	cls[256];	/* byte class, case folded */
+	int		nclass;
+	int		nstate;
+	u_int32_t	*next;
+	int32_t		*outlit;	/* literal of state, -1 if none */
+	int32_t		*outlink;	/* next state have output in fail chain */
+
+	/* skip bytes can't start a literal in start state */
+	u_int8_t	lo[16];		/* low nibble bitmap */
+	u_int8_t	hi[16];		/* high nibble bitmap */
+	int		can_skip;	/* nibble bitmap is usable */
+	int		skip;		/* skip is enabled */
+
+	u_int64_t	ncandidate;
+	u_int64_t	nmatch;
+};
+
+typedef struct _sig_cand {
+	int		rule;		/* the candidate signature */
+	u_int64_t	hit;		/* stream offset of literal */
+} _sig_cand_t;
+
+struct http_sig_stream {
+	http_sig_t	*sig;
+	u_int32_t	state;		/* DFA state */
+	u_int64_t	off;		/* bytes scanned */
+	u_int8_t	*flags;		/* _SIG_XXX of each signature */
+	int		*touched;	/* signatures have flags */
+	int		ntouched;
+	_sig_cand_t	*cands;		/* candidates wait regex */
+	int		ncand;
+	char		tail[HTTP_SIG_WINDOW];/* tail of previous data */
+	size_t		tlen;
+	char		*wbuf;		/* tail + data for regex */
+	size_t		wsize;
+};
+
+
+/**
+ *	Alloc a literal set of type @type.
+ *
+ *	Return the literal set, NULL on error.
+ */
+static _sig_lits_t * 
+_sig_lits_alloc(int type)
+{
+	_sig_lits_t *l;
+
+	l = calloc(1, sizeof(*l));
+	if (l)
+		l->type = type;
+	return l;
+}
+
+static void 
+_sig_lits_free(_sig_lits_t *l)
+{
+	int i;
+
+	if (!l)
+		return;
+
+	for (i = 0; i < l->n; i++)
+		free(l->s[i]);
+	free(l->s);
+	free(l);
+}
+
+/**
+ *	Add literal @str:@len into @l, it's lower cased.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_sig_lits_add(_sig_lits_t *l, const char *str, size_t len)
+{
+	char **s;
+	char *p;
+	size_t i;
+	int j;
+
+	for (j = 0; j < l->n; j++) {
+		if (strlen(l->s[j]) == len && !memcmp(l->s[j], str, len))
+			return 0;
+	}
+
+	if (l->n == l->max) {
+		l->max = l->max ? l->max * 2 : 8;
+		s = realloc(l->s, l->max * sizeof(char *));
+		if (!s)
+			return -1;
+		l->s = s;
+	}
+
+	p = malloc(len + 1);
+	if (!p)
+		return -1;
+	for (i = 0; i < len; i++)
+		p[i] = tolower((u_int8_t)str[i]);
+	p[len] = 0;
+
+	l->s[l->n++] = p;
+	return 0;
+}
+
+/**
+ *	Get the score of @l, it's the min literal length.
+ *
+ *	Return the score, -1 if @l is useless.
+ */
+static int 
+_sig_lits_score(const _sig_lits_t *l)
+{
+	int min = _LIT_LEN_MAX + 1;
+	int i, n;
+
+	if (l->type == _LIT_ANY || l->n == 0)
+		return -1;
+
+	for (i = 0; i < l->n; i++) {
+		n = strlen(l->s[i]);
+		if (n < min)
+			min = n;
+	}
+
+	return min;
+}
+
+/**
+ *	Convert @l to _LIT_MATCH, it's _LIT_ANY if have empty literal.
+ *
+ *	Return the converted literal set.
+ */
+static _sig_lits_t * 
+_sig_lits_match(_sig_lits_t *l)
+{
+	if (l->type == _LIT_EXACT)
+		l->type = _LIT_MATCH;
+
+	if (l->type == _LIT_MATCH && _sig_lits_score(l) < 1) {
+		_sig_lits_free(l);
+		return _sig_lits_alloc(_LIT_ANY);
+	}
+
+	return l;
+}
+
+/**
+ *	Get the cross product of exact literal set @a and @b, they
+ *	are not freed.
+ *
+ *	Return the new literal set, NULL if it's too large.
+ */
+static _sig_lits_t * 
+_sig_lits_product(const _sig_lits_t *a, const _sig_lits_t *b)
+{
+	_sig_lits_t *l;
+	char buf[2 * _LIT_LEN_MAX];
+	size_t la, lb;
+	int i, j;
+
+	if (a->n * b->n > _LIT_EXACT_MAX)
+		return NULL;
+
+	l = _sig_lits_alloc(_LIT_EXACT);
+	for (i = 0; l && i < a->n; i++) {
+		for (j = 0; j < b->n; j++) {
+			la = strlen(a->s[i]);
+			lb = strlen(b->s[j]);
+			if (la + lb > _LIT_LEN_MAX)
+				goto failed;
+			memcpy(buf, a->s[i], la);
+			memcpy(buf + la, b->s[j], lb);
+			if (_sig_lits_add(l, buf, la + lb))
+				goto failed;
+		}
+	}
+
+	return l;
+
+failed:
+	_sig_lits_free(l);
+	return NULL;
+}
+
+/**
+ *	Get the better one of @a and @b as _LIT_MATCH, the longer
+ *	min literal is better. They are freed.
+ *
+ *	Return the better literal set, NULL on error.
+ */
+static _sig_lits_t * 
+_sig_lits_better(_sig_lits_t *a, _sig_lits_t *b)
+{
+	int sa, sb;
+
+	if (!a || !b) {
+		_sig_lits_free(a);
+		_sig_lits_free(b);
+		return NULL;
+	}
+
+	a = _sig_lits_match(a);
+	b = _sig_lits_match(b);
+	sa = _sig_lits_score(a);
+	sb = _sig_lits_score(b);
+	if (sa > sb || (sa == sb && a->n <= b->n)) {
+		_sig_lits_free(b);
+		return a;
+	}
+
+	_sig_lits_free(a);
+	return b;
+}
+
+/**
+ *	Alternate @a and @b, they are freed.
+ *
+ *	Return the new literal set, NULL on error.
+ */
+static _sig_lits_t * 
+_sig_lits_alt(_sig_lits_t *a, _sig_lits_t *b)
+{
+	int type;
+	int i;
+
+	if (!a || !b) {
+		_sig_lits_free(a);
+		_sig_lits_free(b);
+		return NULL;
+	}
+
+	if (a->type == _LIT_EXACT && b->type == _LIT_EXACT &&
+	    a->n + b->n <= _LIT_EXACT_MAX)
+	{
+		type = _LIT_EXACT;
+	}
+	else {
+		a = _sig_lits_match(a);
+		b = _sig_lits_match(b);
+		type = _LIT_MATCH;
+		if (a->type == _LIT_ANY || b->type == _LIT_ANY ||
+		    a->n + b->n > _LIT_MATCH_MAX)
+			type = _LIT_ANY;
+	}
+
+	if (type == _LIT_ANY) {
+		_sig_lits_free(a);
+		_sig_lits_free(b);
+		return _sig_lits_alloc(_LIT_ANY);
+	}
+
+	for (i = 0; i < b->n; i++) {
+		if (_sig_lits_add(a, b->s[i], strlen(b->s[i]))) {
+			_sig_lits_free(a);
+			_sig_lits_free(b);
+			return NULL;
+		}
+	}
+	a->type = type;
+	_sig_lits_free(b);
+
+	return a;
+}
+
+/**
+ *	Return a _LIT_EXACT literal set of @str:@len.
+ */
+static _sig_lits_t * 
+_sig_lits_exact(const char *str, size_t len)
+{
+	_sig_lits_t *l;
+
+	l = _sig_lits_alloc(_LIT_EXACT);
+	if (l && _sig_lits_add(l, str, len)) {
+		_sig_lits_free(l);
+		return NULL;
+	}
+
+	return l;
+}
+
+static _sig_lits_t *_sig_re_alt(const char **re);
+
+/**
+ *	Parse a char class [...] in regex @re.
+ *
+ *	Return the literal set of class, NULL on error.
+ */
+static _sig_lits_t * 
+_sig_re_class(const char **re)
+{
+	const char *p = *re;
+	char chars[_LIT_CLASS_MAX];
+	int nchar = 0;
+	int any = 0;
+	int c, i;
+	_sig_lits_t *l;
+
+	if (*p == '^') {
+		any = 1;
+		p++;
+	}
+
+	/* the first ']' is char */
+	if (*p == ']') {
+		chars[nchar++] = ']';
+		p++;
+	}
+
+	while (*p && *p != ']') {
+		c = *p++;
+		if (c == '[' && *p == ':') {
+			/* POSIX class [:alpha:] */
+			any = 1;
+			while (*p && !(p[0] == ':' && p[1] == ']'))
+				p++;
+			if (*p)
+				p += 2;
+			continue;
+		}
+
+		if (c == '\\' && *p) {
+			c = *p++;
+			if (isalnum(c) && !strchr("nrtfe", c)) {
+				any = 1;
+				continue;
+			}
+			switch (c) {
+			case 'n': c = '\n'; break;
+			case 'r': c = '\r'; break;
+			case 't': c = '\t'; break;
+			case 'f': c = '\f'; break;
+			case 'e': c = 27; break;
+			}
+		}
+
+		/* range */
+		if (*p == '-' && p[1] && p[1] != ']') {
+			any = 1;
+			p += 2;
+			continue;
+		}
+
+		c = tolower(c);
+		for (i = 0; i < nchar; i++) {
+			if (chars[i] == c)
+				break;
+		}
+		if (i < nchar)
+			continue;
+
+		if (nchar == _LIT_CLASS_MAX)
+			any = 1;
+		else
+			chars[nchar++] = c;
+	}
+
+	if (*p != ']')
+		return NULL;
+	*re = p + 1;
+
+	if (any || nchar == 0)
+		return _sig_lits_alloc(_LIT_ANY);
+
+	l = _sig_lits_alloc(_LIT_EXACT);
+	for (i = 0; l && i < nchar; i++) {
+		if (_sig_lits_add(l, &chars[i], 1)) {
+			_sig_lits_free(l);
+			return NULL;
+		}
+	}
+
+	return l;
+}
+
+/**
+ *	Parse a escape sequence after '\' in @re.
+ *
+ *	Return the literal set, NULL on error.
+ */
+static _sig_lits_t * 
+_sig_re_escape(const char **re)
+{
+	const char *p = *re;
+	const char *end;
+	char c;
+	int v;
+
+	c = *p++;
+	*re = p;
+
+	switch (c) {
+
+	/* zero width */
+	case 'b': case 'B': case 'A': case 'z': case 'Z': case 'G':
+		return _sig_lits_exact("", 0);
+
+	case 'n':
+		return _sig_lits_exact("\n", 1);
+	case 'r':
+		return _sig_lits_exact("\r", 1);
+	case 't':
+		return _sig_lits_exact("\t", 1);
+	case 'f':
+		return _sig_lits_exact("\f", 1);
+
+	case 'x':
+		if (*p == '{') {
+			end = strchr(p, '}');
+			if (!end)
+				return NULL;
+			*re = end + 1;
+			return _sig_lits_alloc(_LIT_ANY);
+		}
+		v = 0;
+		while (isxdigit(*p) && p - *re < 2) {
+			v = v * 16 + (isdigit(*p) ? *p - '0' :
+				      tolower(*p) - 'a' + 10);
+			p++;
+		}
+		*re = p;
+		if (v == 0)
+			return _sig_lits_alloc(_LIT_ANY);
+		c = v;
+		return _sig_lits_exact(&c, 1);
+
+	case 'Q':
+		end = strstr(p, "\\E");
+		if (!end)
+			end = p + strlen(p);
+		*re = *end ? end + 2 : end;
+		if (end - p > _LIT_LEN_MAX)
+			return _sig_lits_alloc(_LIT_ANY);
+		return _sig_lits_exact(p, end - p);
+
+	case 'p': case 'P':
+		if (*p == '{') {
+			end = strchr(p, '}');
+			if (!end)
+				return NULL;
+			*re = end + 1;
+		}
+		else if (*p) {
+			*re = p + 1;
+		}
+		return _sig_lits_alloc(_LIT_ANY);
+
+	case 0:
+		return NULL;
+
+	default:
+		/* \d \w \s, back reference etc */
+		if (isalnum(c))
+			return _sig_lits_alloc(_LIT_ANY);
+		return _sig_lits_exact(&c, 1);
+	}
+}
+
+/**
+ *	Parse a group after '(' in @re.
+ *
+ *	Return the literal set, NULL on error.
+ */
+static _sig_lits_t * 
+_sig_re_group(const char **re)
+{
+	const char *p = *re;
+	_sig_lits_t *l;
+	int zero = 0;
+
+	if (*p == '?') {
+		p++;
+		switch (*p) {
+		case ':': case '>': case '|':
+			p++;
+			break;
+		case '=': case '!':
+			zero = 1;
+			p++;
+			break;
+		case '<':
+			if (p[1] == '=' || p[1] == '!') {
+				zero = 1;
+				p += 2;
+				break;
+			}
+			/* fall through, named group */
+		case 'P': case '\'':
+			while (*p && *p != '>' && *p != '\'' &&
+			       *p != ')' && !(p > *re + 2 && *p == '\''))
+				p++;
+			if (*p == ')') {
+				/* (?P=name) back reference */
+				*re = p + 1;
+				return _sig_lits_alloc(_LIT_ANY);
+			}
+			if (*p)
+				p++;
+			break;
+		case '#':
+			while (*p && *p != ')')
+				p++;
+			if (!*p)
+				return NULL;
+			*re = p + 1;
+			return _sig_lits_exact("", 0);
+		default:
+			/* (?i) option or (?i:...) */
+			while (isalpha(*p) || *p == '-')
+				p++;
+			if (*p == ')') {
+				*re = p + 1;
+				return _sig_lits_exact("", 0);
+			}
+			if (*p != ':')
+				return NULL;
+			p++;
+			break;
+		}
+	}
+
+	l = _sig_re_alt(&p);
+	if (!l || *p != ')') {
+		_sig_lits_free(l);
+		return NULL;
+	}
+	*re = p + 1;
+
+	if (zero) {
+		_sig_lits_free(l);
+		return _sig_lits_exact("", 0);
+	}
+
+	return l;
+}
+
+/**
+ *	Parse the quantifier after atom @l in @re.
+ *
+ *	Return the literal set, NULL on error.
+ */
+static _sig_lits_t * 
+_sig_re_quant(const char **re, _sig_lits_t *l)
+{
+	const char *p = *re;
+	int min = 1, max = 1;
+	char *end;
+
+	switch (*p) {
+	case '*':
+		min = 0;
+		max = -1;
+		p++;
+		break;
+	case '+':
+		max = -1;
+		p++;
+		break;
+	case '?':
+		min = 0;
+		p++;
+		break;
+	case '{':
+		if (!isdigit(p[1]) && p[1] != ',')
+			return l;
+		min = strtol(p + 1, &end, 10);
+		max = min;
+		if (*end == ',') {
+			if (isdigit(end[1]))
+				max = strtol(end + 1, &end, 10);
+			else {
+				max = -1;
+				end++;
+			}
+		}
+		if (*end != '}')
+			return l;
+		p = end + 1;
+		break;
+	default:
+		return l;
+	}
+
+	/* lazy or possessive */
+	if (*p == '?' || *p == '+')
+		p++;
+	*re = p;
+
+	if (min == 1 && max == 1)
+		return l;
+
+	if (min == 0) {
+		if (max == 1 && l->type == _LIT_EXACT &&
+		    l->n < _LIT_EXACT_MAX)
+		{
+			if (_sig_lits_add(l, "", 0)) {
+				_sig_lits_free(l);
+				return NULL;
+			}
+			return l;
+		}
+		_sig_lits_free(l);
+		return _sig_lits_alloc(_LIT_ANY);
+	}
+
+	return _sig_lits_match(l);
+}
+
+/**
+ *	Parse a sequence of atoms in @re until '|' or ')'.
+ *
+ *	Return the literal set, NULL on error.
+ */
+static _sig_lits_t * 
+_sig_re_concat(const char **re)
+{
+	const char *p = *re;
+	_sig_lits_t *run, *best, *a, *l;
+	int exact = 1;
+	char c;
+
+	/* the exact atoms are joined in @run, the inexact atom
+	 * end the run and the best one is kept in @best */
+	run = _sig_lits_exact("", 0);
+	best = _sig_lits_alloc(_LIT_ANY);
+	while (run && best && *p && *p != '|' && *p != ')') {
+		c = *p++;
+		switch (c) {
+		case '(':
+			a = _sig_re_group(&p);
+			break;
+		case '[':
+			a = _sig_re_class(&p);
+			break;
+		case '\\':
+			a = _sig_re_escape(&p);
+			break;
+		case '.':
+			a = _sig_lits_alloc(_LIT_ANY);
+			break;
+		case '^': case '$':
+			a = _sig_lits_exact("", 0);
+			break;
+		default:
+			a = _sig_lits_exact(&c, 1);
+			break;
+		}
+
+		if (a)
+			a = _sig_re_quant(&p, a);
+		if (!a) {
+			_sig_lits_free(run);
+			run = NULL;
+			break;
+		}
+
+		if (a->type == _LIT_EXACT) {
+			l = _sig_lits_product(run, a);
+			if (l) {
+				_sig_lits_free(run);
+				_sig_lits_free(a);
+				run = l;
+				continue;
+			}
+			best = _sig_lits_better(best, run);
+			run = a;
+		}
+		else {
+			best = _sig_lits_better(best, run);
+			best = _sig_lits_better(best, a);
+			run = _sig_lits_exact("", 0);
+		}
+		exact = 0;
+	}
+
+	*re = p;
+	if (!run || !best) {
+		_sig_lits_free(run);
+		_sig_lits_free(best);
+		return NULL;
+	}
+
+	if (exact) {
+		_sig_lits_free(best);
+		return run;
+	}
+
+	return _sig_lits_better(best, run);
+}
+
+/**
+ *	Parse the alternation in @re until ')'.
+ *
+ *	Return the literal set, NULL on error.
+ */
+static _sig_lits_t * 
+_sig_re_alt(const char **re)
+{
+	const char *p = *re;
+	_sig_lits_t *l;
+
+	l = _sig_re_concat(&p);
+	while (l && *p == '|') {
+		p++;
+		l = _sig_lits_alt(l, _sig_re_concat(&p));
+	}
+
+	*re = p;
+	return l;
+}
+
+/**
+ *	Extract the literals of @regex, one of them must be in
+ *	the matched string.
+ *
+ *	Return the literal set, NULL if no literal.
+ */
+static _sig_lits_t * 
+_sig_re_literal(const char *regex)
+{
+	const char *p = regex;
+	_sig_lits_t *l;
+
+	l = _sig_re_alt(&p);
+	if (!l)
+		return NULL;
+
+	if (*p || _sig_lits_score(l) < HTTP_SIG_LITMIN) {
+		_sig_lits_free(l);
+		return NULL;
+	}
+
+	l->type = _LIT_MATCH;
+	return l;
+}
+
+
+http_sig_t * 
+http_sig_alloc(void)
+{
+	return calloc(1, sizeof(http_sig_t));
+}
+
+
+void 
+http_sig_free(http_sig_t *sig)
+{
+	int i;
+
+	if (!sig)
+		return;
+
+	for (i = 0; i < sig->nrule; i++) {
+		free(sig->rules[i].regex);
+		if (sig->rules[i].extra)
+			pcre_free_study(sig->rules[i].extra);
+		if (sig->rules[i].re)
+			pcre_free(sig->rules[i].re);
+		_sig_lits_free(sig->rules[i].lits);
+	}
+	free(sig->rules);
+	free(sig->unfiltered);
+
+	for (i = 0; i < sig->nlit; i++) {
+		free(sig->lits[i].str);
+		free(sig->lits[i].rules);
+	}
+	free(sig->lits);
+
+	free(sig->next);
+	free(sig->outlit);
+	free(sig->outlink);
+	free(sig);
+}
+
+
+int 
+http_sig_add(http_sig_t *sig, const char *name, int fields,
+	     const char *regex)
+{
+	_sig_rule_t *r;
+	const char *error = NULL;
+	int erroff = 0;
+
+	if (!sig || !regex || sig->compiled)
+		return -1;
+
+	if (sig->nrule == sig->maxrule) {
+		sig->maxrule = sig->maxrule ? sig->maxrule * 2 : 64;
+		r = realloc(sig->rules, sig->maxrule * sizeof(*r));
+		if (!r)
+			return -1;
+		sig->rules = r;
+	}
+
+	r = &sig->rules[sig->nrule];
+	memset(r, 0, sizeof(*r));
+	snprintf(r->name, sizeof(r->name), "%s", name ? name : "");
+	r->fields = fields & HTTP_SIG_ALL;
+	if (!r->fields)
+		r->fields = HTTP_SIG_ALL;
+
+	r->re = pcre_compile(regex, PCRE_CASELESS, &error, &erroff, NULL);
+	if (!r->re) {
+		_SIG_ERR("compile %s error at %d: %s\n",
+			 regex, erroff, error);
+		return -1;
+	}
+#ifdef	PCRE_STUDY_JIT_COMPILE
+	r->extra = pcre_study(r->re, PCRE_STUDY_JIT_COMPILE, &error);
+#else
+	r->extra = pcre_study(r->re, 0, &error);
+#endif
+
+	r->regex = strdup(regex);
+	r->lits = _sig_re_literal(regex);
+	r->filtered = r->lits ? 1 : 0;
+	if (!r->filtered)
+		_SIG_ERR("%s have no literal: %s\n", r->name, regex);
+
+	return sig->nrule++;
+}
+
+
+/**
+ *	Convert target string @str of rule file to HTTP_SIG_XXX.
+ *
+ *	Return the fields.
+ */
+static int 
+_sig_fields(const char *str)
+{
+	char buf[_SIG_LINE_MAX];
+	char *tok, *save = NULL, *sub;
+	int fields = 0;
+
+	snprintf(buf, sizeof(buf), "%s", str);
+	for (tok = strtok_r(buf, "|", &save); tok;
+	     tok = strtok_r(NULL, "|", &save))
+	{
+		/* exclusion is not supported */
+		if (*tok == '!')
+			continue;
+
+		sub = strchr(tok, ':');
+		if (sub)
+			*sub++ = 0;
+
+		if (!strcmp(tok, "REQUEST_FILENAME") ||
+		    !strcmp(tok, "REQUEST_URI"))
+			fields |= HTTP_SIG_URL;
+		else if (!strcmp(tok, "ARGS") || !strcmp(tok, "ARGS_NAMES"))
+			fields |= HTTP_SIG_ARGS | HTTP_SIG_BODY;
+		else if (!strcmp(tok, "REQUEST_COOKIES"))
+			fields |= HTTP_SIG_COOKIE;
+		else if (!strcmp(tok, "REQUEST_BODY"))
+			fields |= HTTP_SIG_BODY;
+		else if (!strncmp(tok, "REQUEST_HEADERS", 15)) {
+			fields |= HTTP_SIG_HEADER;
+			if (!sub || !strcasecmp(sub, "Cookie"))
+				fields |= HTTP_SIG_COOKIE;
+		}
+	}
+
+	return fields ? fields : HTTP_SIG_ALL;
+}
+
+
+int 
+http_sig_load(http_sig_t *sig, const char *file)
+{
+	FILE *fp;
+	char *line;
+	char *p, *end;
+	char prefix[HTTP_SIG_NAMELEN];
+	char name[2 * HTTP_SIG_NAMELEN];
+	const char *base;
+	int fields = 0;
+	int state = 0;
+	int n = 0;
+
+	if (!sig || !file)
+		return -1;
+
+	fp = fopen(file, "r");
+	if (!fp)
+		return -1;
+
+	line = malloc(_SIG_LINE_MAX);
+	if (!line) {
+		fclose(fp);
+		return -1;
+	}
+
+	/* the name prefix is file name without "_rules" */
+	base = strrchr(file, '/');
+	base = base ? base + 1 : file;
+	snprintf(prefix, sizeof(prefix), "%s", base);
+	p = strstr(prefix, "_rules");
+	if (p)
+		*p = 0;
+
+	while (fgets(line, _SIG_LINE_MAX, fp)) {
+		p = line;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		end = p + strlen(p);
+		while (end > p && (end[-1] == '\r' || end[-1] == '\n' ||
+				   end[-1] == ' ' || end[-1] == '\t'))
+			*--end = 0;
+
+		if (!*p || !strncmp(p, "/*", 2) || !strncmp(p, "*", 1))
+			continue;
+
+		/* [name] start a signature */
+		if (*p == '[') {
+			end = strchr(p, ']');
+			if (end)
+				*end = 0;
+			snprintf(name, sizeof(name), "%s:%s", prefix, p + 1);
+			state = 1;
+			continue;
+		}
+
+		switch (state) {
+		case 1:
+			fields = _sig_fields(p);
+			state = 2;
+			break;
+
+		case 2:
+			if (http_sig_add(sig, name, fields, p) < 0) {
+				_SIG_ERR("load %s failed\n", name);
+				free(line);
+				fclose(fp);
+				return -1;
+			}
+			n++;
+			state = 0;
+			break;
+
+		default:
+			/* t:xxx transform is ignored */
+			break;
+		}
+	}
+
+	free(line);
+	fclose(fp);
+
+	return n;
+}
+
+
+/**
+ *	Find the literal @str in @sig, add it if not found. The
+ *	@hash is a open address hash table of literal index.
+ *
+ *	Return the literal index, -1 on error.
+ */
+static int 
+_sig_lit_get(http_sig_t *sig, int32_t *hash, u_int32_t mask, const char *str)
+{
+	_sig_lit_t *lit;
+	u_int32_t h = 2166136261U;
+	const char *p;
+
+	for (p = str; *p; p++)
+		h = (h ^ (u_int8_t)*p) * 16777619U;
+
+	for (h &= mask; hash[h] >= 0; h = (h + 1) & mask) {
+		if (!strcmp(sig->lits[hash[h]].str, str))
+			return hash[h];
+	}
+
+	if (sig->nlit == sig->maxlit) {
+		sig->maxlit = sig->maxlit ? sig->maxlit * 2 : 256;
+		lit = realloc(sig->lits, sig->maxlit * sizeof(*lit));
+		if (!lit)
+			return -1;
+		sig->lits = lit;
+	}
+
+	lit = &sig->lits[sig->nlit];
+	memset(lit, 0, sizeof(*lit));
+	lit->str = strdup(str);
+	if (!lit->str)
+		return -1;
+
+	hash[h] = sig->nlit;
+	return sig->nlit++;
+}
+
+static int 
+_sig_lit_add_rule(_sig_lit_t *lit, int rule)
+{
+	int *rules;
+
+	if (lit->nrule == lit->maxrule) {
+		lit->maxrule = lit->maxrule ? lit->maxrule * 2 : 2;
+		rules = realloc(lit->rules, lit->maxrule * sizeof(int));
+		if (!rules)
+			return -1;
+		lit->rules = rules;
+	}
+
+	lit->rules[lit->nrule++] = rule;
+	return 0;
+}
+
+/**
+ *	Collect the literals of all signatures into @sig->lits.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_sig_collect(http_sig_t *sig)
+{
+	_sig_rule_t *r;
+	int32_t *hash;
+	u_int32_t size = 1024;
+	int total = 0;
+	int i, j, k;
+
+	for (i = 0; i < sig->nrule; i++) {
+		if (sig->rules[i].lits)
+			total += sig->rules[i].lits->n;
+	}
+	while (size < (u_int32_t)total * 2)
+		size *= 2;
+
+	hash = malloc(size * sizeof(int32_t));
+	sig->unfiltered = malloc((sig->nrule + 1) * sizeof(int));
+	if (!hash || !sig->unfiltered) {
+		free(hash);
+		return -1;
+	}
+	memset(hash, 0xff, size * sizeof(int32_t));
+
+	for (i = 0; i < sig->nrule; i++) {
+		r = &sig->rules[i];
+		if (!r->filtered) {
+			sig->unfiltered[sig->nunfiltered++] = i;
+			continue;
+		}
+
+		for (j = 0; j < r->lits->n; j++) {
+			k = _sig_lit_get(sig, hash, size - 1, r->lits->s[j]);
+			if (k < 0 || _sig_lit_add_rule(&sig->lits[k], i)) {
+				free(hash);
+				return -1;
+			}
+		}
+
+		_sig_lits_free(r->lits);
+		r->lits = NULL;
+	}
+
+	free(hash);
+	return 0;
+}
+
+/**
+ *	Build the byte class of literals, the bytes not in any
+ *	literal are class 0. The upper case is same as lower case.
+ *
+ *	No return.
+ */
+static void 
+_sig_build_class(http_sig_t *sig)
+{
+	u_int8_t used[256];
+	const char *p;
+	int i, c;
+
+	memset(used, 0, sizeof(used));
+	for (i = 0; i < sig->nlit; i++) {
+		for (p = sig->lits[i].str; *p; p++)
+			used[(u_int8_t)*p] = 1;
+	}
+
+	memset(sig->cls, 0, sizeof(sig->cls));
+	sig->nclass = 1;
+	for (c = 0; c < 256; c++) {
+		if (used[c] && !isupper(c))
+			sig->cls[c] = sig->nclass++;
+	}
+	for (c = 'A'; c <= 'Z'; c++)
+		sig->cls[c] = sig->cls[tolower(c)];
+}
+
+/**
+ *	Build the Aho-Corasick DFA of literals, the failure
+ *	transitions are resolved so each byte is one lookup.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_sig_build_dfa(http_sig_t *sig)
+{
+	int32_t *go = NULL, *fail = NULL, *queue = NULL;
+	int32_t *tmp;
+	int nclass = sig->nclass;
+	int maxstate = 1;
+	int nstate = 1;
+	int head, tail;
+	int i, s, t, c;
+	const char *p;
+
+	for (i = 0; i < sig->nlit; i++)
+		maxstate += strlen(sig->lits[i].str);
+
+	go = malloc((size_t)maxstate * nclass * sizeof(int32_t));
+	fail = malloc(maxstate * sizeof(int32_t));
+	queue = malloc(maxstate * sizeof(int32_t));
+	sig->outlit = malloc(maxstate * sizeof(int32_t));
+	sig->outlink = malloc(maxstate * sizeof(int32_t));
+	if (!go || !fail || !queue || !sig->outlit || !sig->outlink)
+		goto failed;
+
+	memset(go, 0xff, (size_t)maxstate * nclass * sizeof(int32_t));
+	memset(sig->outlit, 0xff, maxstate * sizeof(int32_t));
+	memset(sig->outlink, 0xff, maxstate * sizeof(int32_t));
+
+	/* the trie */
+	for (i = 0; i < sig->nlit; i++) {
+		s = 0;
+		for (p = sig->lits[i].str; *p; p++) {
+			c = sig->cls[(u_int8_t)*p];
+			if (go[s * nclass + c] < 0)
+				go[s * nclass + c] = nstate++;
+			s = go[s * nclass + c];
+		}
+		sig->outlit[s] = i;
+	}
+
+	/* the failure links by BFS */
+	head = tail = 0;
+	fail[0] = 0;
+	for (c = 0; c < nclass; c++) {
+		t = go[c];
+		if (t < 0) {
+			go[c] = 0;
+			continue;
+		}
+		fail[t] = 0;
+		queue[tail++] = t;
+	}
+
+	while (head < tail) {
+		s = queue[head++];
+		for (c = 0; c < nclass; c++) {
+			t = go[s * nclass + c];
+			if (t < 0) {
+				go[s * nclass + c] = go[fail[s] * nclass + c];
+				continue;
+			}
+
+			fail[t] = go[fail[s] * nclass + c];
+			if (sig->outlit[fail[t]] >= 0)
+				sig->outlink[t] = fail[t];
+			else
+				sig->outlink[t] = sig->outlink[fail[t]];
+			queue[tail++] = t;
+		}
+	}
+
+	/* the DFA entry is premultiplied and marked output */
+	sig->next = malloc((size_t)nstate * nclass * sizeof(u_int32_t));
+	if (!sig->next)
+		goto failed;
+
+	for (i = 0; i < nstate * nclass; i++) {
+		t = go[i];
+		sig->next[i] = t * nclass;
+		if (sig->outlit[t] >= 0 || sig->outlink[t] >= 0)
+			sig->next[i] |= _SIG_OUT;
+	}
+	sig->nstate = nstate;
+
+	/* shrink output arrays */
+	tmp = realloc(sig->outlit, nstate * sizeof(int32_t));
+	if (tmp)
+		sig->outlit = tmp;
+	tmp = realloc(sig->outlink, nstate * sizeof(int32_t));
+	if (tmp)
+		sig->outlink = tmp;
+
+	free(go);
+	free(fail);
+	free(queue);
+	return 0;
+
+failed:
+	free(go);
+	free(fail);
+	free(queue);
+	return -1;
+}
+
+/**
+ *	Build the nibble bitmap of bytes which leave the start
+ *	state, it can be used by SIMD if no more than 8 kinds of
+ *	low nibble set like http_parse.
+ *
+ *	No return.
+ */
+static void 
+_sig_build_skip(http_sig_t *sig)
+{
+	u_int8_t start[256];
+	u_int16_t grp[8];
+	u_int16_t set;
+	int ngrp = 0;
+	int c, h, l, i;
+
+	for (c = 0; c < 256; c++)
+		start[c] = (sig->next[sig->cls[c]] & ~_SIG_OUT) ? 1 : 0;
+
+	memset(sig->lo, 0, sizeof(sig->lo));
+	memset(sig->hi, 0, sizeof(sig->hi));
+	for (h = 0; h < 16; h++) {
+		set = 0;
+		for (l = 0; l < 16; l++) {
+			if (start[(h << 4) | l])
+				set |= 1 << l;
+		}
+		if (!set)
+			continue;
+
+		for (i = 0; i < ngrp; i++) {
+			if (grp[i] == set)
+				break;
+		}
+		if (i == ngrp) {
+			if (ngrp == 8)
+				return;
+			grp[ngrp++] = set;
+		}
+		sig->hi[h] = 1 << i;
+	}
+
+	for (i = 0; i < ngrp; i++) {
+		for (l = 0; l < 16; l++) {
+			if (grp[i] & (1 << l))
+				sig->lo[l] |= 1 << i;
+		}
+	}
+
+	sig->can_skip = 1;
+
+#ifdef	_SIG_HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		sig->skip = 1;
+#endif
+}
+
+#ifdef	_SIG_HAVE_X86
+
+/**
+ *	Skip bytes in @buf which can't start a literal, 32 bytes
+ *	each time by AVX2 vpshufb.
+ *
+ *	Return the number of skipped bytes.
+ */
+__attribute__((target("avx2"))) static size_t 
+_sig_skip_avx2(const http_sig_t *sig, const char *buf, size_t siz)
+{
+	size_t i = 0;
+	u_int32_t bits;
+	__m256i lo, hi, mask, zero, v, m;
+
+	lo = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *)sig->lo));
+	hi = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *)sig->hi));
+	mask = _mm256_set1_epi8(0x0f);
+	zero = _mm256_setzero_si256();
+
+	while (i + 32 <= siz) {
+		v = _mm256_loadu_si256((const __m256i *)(buf + i));
+		m = _mm256_and_si256(
+			_mm256_shuffle_epi8(lo, _mm256_and_si256(v, mask)),
+			_mm256_shuffle_epi8(hi, _mm256_and_si256(
+				_mm256_srli_epi16(v, 4), mask)));
+		bits = ~(u_int32_t)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(m, zero));
+		if (bits)
+			return i + __builtin_ctz(bits);
+		i += 32;
+	}
+
+	return i;
+}
+
+#endif	/* end of _SIG_HAVE_X86 */
+
+
+int 
+http_sig_compile(http_sig_t *sig)
+{
+	if (!sig || sig->compiled)
+		return -1;
+
+	if (_sig_collect(sig))
+		return -1;
+
+	_sig_build_class(sig);
+
+	if (_sig_build_dfa(sig))
+		return -1;
+
+	_sig_build_skip(sig);
+
+	sig->compiled = 1;
+	return 0;
+}
+
+
+const char * 
+http_sig_name(http_sig_t *sig, int id)
+{
+	if (!sig || id < 0 || id >= sig->nrule)
+		return NULL;
+
+	return sig->rules[id].name;
+}
+
+
+const char * 
+http_sig_regex(http_sig_t *sig, int id, int *fields)
+{
+	if (!sig || id < 0 || id >= sig->nrule)
+		return NULL;
+
+	if (fields)
+		*fields = sig->rules[id].fields;
+
+	return sig->rules[id].regex;
+}
+
+
+int 
+http_sig_get_stat(http_sig_t *sig, http_sig_stat_t *st)
+{
+	if (!sig || !st)
+		return -1;
+
+	memset(st, 0, sizeof(*st));
+	st->nsig = sig->nrule;
+	st->nfiltered = sig->nrule - sig->nunfiltered;
+	st->nliteral = sig->nlit;
+	st->nstate = sig->nstate;
+	st->nclass = sig->nclass;
+	st->skip = sig->skip;
+	st->ncandidate = sig->ncandidate;
+	st->nmatch = sig->nmatch;
+
+	return 0;
+}
+
+
+int 
+http_sig_set_skip(http_sig_t *sig, int enable)
+{
+	if (!sig || !sig->compiled)
+		return 0;
+
+	sig->skip = 0;
+#ifdef	_SIG_HAVE_X86
+	if (enable && sig->can_skip && __builtin_cpu_supports("avx2"))
+		sig->skip = 1;
+#endif
+
+	return sig->skip;
+}
+
+
+http_sig_stream_t * 
+http_sig_stream_alloc(http_sig_t *sig)
+{
+	http_sig_stream_t *s;
+
+	if (!sig || !sig->compiled)
+		return NULL;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->sig = sig;
+	s->flags = calloc(sig->nrule + 1, 1);
+	s->touched = malloc((sig->nrule + 1) * sizeof(int));
+	s->cands = malloc((sig->nrule + 1) * sizeof(_sig_cand_t));
+	if (!s->flags || !s->touched || !s->cands) {
+		http_sig_stream_free(s);
+		return NULL;
+	}
+
+	return s;
+}
+
+
+void 
+http_sig_stream_reset(http_sig_stream_t *s)
+{
+	int i;
+
+	if (!s)
+		return;
+
+	for (i = 0; i < s->ntouched; i++)
+		s->flags[s->touched[i]] = 0;
+	s->ntouched = 0;
+	s->ncand = 0;
+	s->state = 0;
+	s->off = 0;
+	s->tlen = 0;
+}
+
+
+void 
+http_sig_stream_free(http_sig_stream_t *s)
+{
+	if (!s)
+		return;
+
+	free(s->flags);
+	free(s->touched);
+	free(s->cands);
+	free(s->wbuf);
+	free(s);
+}
+
+
+/**
+ *	Add the signatures of literals in DFA state @state into
+ *	candidates of @s, the literal is end at stream offset @hit.
+ *
+ *	No return.
+ */
+static void 
+_sig_output(http_sig_t *sig, http_sig_stream_t *s, int32_t state,
+	    int field, u_int64_t hit)
+{
+	_sig_lit_t *lit;
+	_sig_cand_t *cand;
+	int i, r;
+
+	if (sig->outlit[state] < 0)
+		state = sig->outlink[state];
+
+	while (state >= 0) {
+		lit = &sig->lits[sig->outlit[state]];
+		for (i = 0; i < lit->nrule; i++) {
+			r = lit->rules[i];
+			if (!(sig->rules[r].fields & field))
+				continue;
+
+			if (s->flags[r] & _SIG_MATCHED)
+				continue;
+
+			/* update the hit offset of candidate */
+			if (s->flags[r] & _SIG_CAND) {
+				cand = s->cands;
+				while (cand->rule != r)
+					cand++;
+				cand->hit = hit;
+				continue;
+			}
+
+			if (!s->flags[r])
+				s->touched[s->ntouched++] = r;
+			s->flags[r] |= _SIG_CAND;
+			s->cands[s->ncand].rule = r;
+			s->cands[s->ncand].hit = hit;
+			s->ncand++;
+		}
+		state = sig->outlink[state];
+	}
+}
+
+/**
+ *	Run regex of signature @r on @buf.
+ *
+ *	Return 1 if matched, 0 not.
+ */
+static int 
+_sig_exec(http_sig_t *sig, int r, const char *buf, size_t len)
+{
+	int ovector[30];
+
+	sig->ncandidate++;
+	if (pcre_exec(sig->rules[r].re, sig->rules[r].extra, buf, len,
+		      0, 0, ovector, 30) < 0)
+		return 0;
+
+	sig->nmatch++;
+	return 1;
+}
+
+/**
+ *	Save the tail of @data into @s for next scan.
+ *
+ *	No return.
+ */
+static void 
+_sig_save_tail(http_sig_stream_t *s, const char *data, size_t len)
+{
+	size_t keep;
+
+	if (len >= HTTP_SIG_WINDOW) {
+		memcpy(s->tail, data + len - HTTP_SIG_WINDOW, HTTP_SIG_WINDOW);
+		s->tlen = HTTP_SIG_WINDOW;
+		return;
+	}
+
+	keep = HTTP_SIG_WINDOW - len;
+	if (keep > s->tlen)
+		keep = s->tlen;
+	memmove(s->tail, s->tail + s->tlen - keep, keep);
+	memcpy(s->tail + keep, data, len);
+	s->tlen = keep + len;
+}
+
+
+int 
+http_sig_scan(http_sig_t *sig, http_sig_stream_t *s, int field,
+	      const char *data, size_t len, http_sig_cb cb, void *arg)
+{
+	const u_int8_t *p, *end;
+	const u_int32_t *next;
+	const u_int8_t *cls;
+	const char *win;
+	size_t wlen;
+	u_int32_t st;
+	char *wbuf;
+	int nmatch = 0;
+	int stop = 0;
+	int i, r;
+
+	if (!sig || !s || s->sig != sig || (!data && len))
+		return -1;
+
+	/* literal prefilter */
+	next = sig->next;
+	cls = sig->cls;
+	st = s->state;
+	p = (const u_int8_t *)data;
+	end = p + len;
+	while (p < end) {
+#ifdef	_SIG_HAVE_X86
+		if (st == 0 && sig->skip) {
+			p += _sig_skip_avx2(sig, (const char *)p, end - p);
+			if (p == end)
+				break;
+		}
+#endif
+		st = next[st + cls[*p]];
+		p++;
+		if (st & _SIG_OUT) {
+			st &= ~_SIG_OUT;
+			_sig_output(sig, s, st / sig->nclass, field,
+				    s->off + (p - (const u_int8_t *)data));
+		}
+	}
+	s->state = st;
+
+	if (!s->ncand && !sig->nunfiltered)
+		goto out;
+
+	/* regex runs on tail of previous data and @data */
+	if (s->tlen) {
+		if (s->wsize < s->tlen + len) {
+			wbuf = realloc(s->wbuf, s->tlen + len);
+			if (!wbuf)
+				return -1;
+			s->wbuf = wbuf;
+			s->wsize = s->tlen + len;
+		}
+		memcpy(s->wbuf, s->tail, s->tlen);
+		memcpy(s->wbuf + s->tlen, data, len);
+		win = s->wbuf;
+		wlen = s->tlen + len;
+	}
+	else {
+		win = data;
+		wlen = len;
+	}
+
+	for (i = 0; i < s->ncand && !stop; ) {
+		r = s->cands[i].rule;
+		if (_sig_exec(sig, r, win, wlen)) {
+			s->flags[r] = _SIG_MATCHED;
+			s->cands[i] = s->cands[--s->ncand];
+			nmatch++;
+			if (cb && cb(r, field, arg))
+				stop = 1;
+			continue;
+		}
+
+		/* the literal is out of window */
+		if (s->off + len - s->cands[i].hit >= HTTP_SIG_WINDOW) {
+			s->flags[r] &= ~_SIG_CAND;
+			s->cands[i] = s->cands[--s->ncand];
+			continue;
+		}
+		i++;
+	}
+
+	for (i = 0; i < sig->nunfiltered && !stop; i++) {
+		r = sig->unfiltered[i];
+		if (!(sig->rules[r].fields & field) ||
+		    (s->flags[r] & _SIG_MATCHED))
+			continue;
+
+		if (_sig_exec(sig, r, win, wlen)) {
+			if (!s->flags[r])
+				s->touched[s->ntouched++] = r;
+			s->flags[r] = _SIG_MATCHED;
+			nmatch++;
+			if (cb && cb(r, field, arg))
+				stop = 1;
+		}
+	}
+
+out:
+	_sig_save_tail(s, data, len);
+	s->off += len;
+
+	return nmatch;
+}
+
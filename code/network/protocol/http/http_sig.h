@@ -0,0 +1,185 @@
+/**
+ *	@file	http_sig.h
+ *
+ *	@brief	HTTP attack signature engine, the signature is a PCRE
+ *		regex. The literals which must appear in the match of
+ *		each regex are extracted and compiled into one
+ *		Aho-Corasick DFA, the regex is only run when one of
+ *		its literals is found. The DFA state is kept in a
+ *		stream so the data can be scanned packet by packet.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#ifndef	FZ_HTTP_SIG_H
+#define	FZ_HTTP_SIG_H
+
+#include <sys/types.h>
+
+/**
+ *	The HTTP field which signature is checked
+ */
+#define	HTTP_SIG_URL		0x01	/* URL path, REQUEST_FILENAME */
+#define	HTTP_SIG_ARGS		0x02	/* URL arguments, ARGS */
+#define	HTTP_SIG_HEADER		0x04	/* header value, REQUEST_HEADERS */
+#define	HTTP_SIG_COOKIE		0x08	/* Cookie value */
+#define	HTTP_SIG_BODY		0x10	/* request body */
+#define	HTTP_SIG_ALL		0x1f
+
+#define	HTTP_SIG_WINDOW		1024	/* bytes kept between packets */
+#define	HTTP_SIG_LITMIN		2	/* min literal length of prefilter */
+#define	HTTP_SIG_NAMELEN	32	/* max signature name length */
+
+typedef struct http_sig http_sig_t;
+typedef struct http_sig_stream http_sig_stream_t;
+
+/**
+ *	The signature statistic
+ */
+typedef struct http_sig_stat {
+	int		nsig;		/* number of signatures */
+	int		nfiltered;	/* signatures have literals */
+	int		nliteral;	/* number of literals */
+	int		nstate;		/* number of DFA states */
+	int		nclass;		/* number of byte classes */
+	int		skip;		/* SIMD start byte skip is used */
+	u_int64_t	ncandidate;	/* regex run by candidate */
+	u_int64_t	nmatch;		/* regex matched */
+} http_sig_stat_t;
+
+/**
+ *	The match callback, the signature @id matched in @field.
+ *
+ *	Return 0 continue scan, else stop scan.
+ */
+typedef int (*http_sig_cb)(int id, int field, void *arg);
+
+/**
+ *	Alloc a empty signature set.
+ *
+ *	Return the signature set if success, NULL on error.
+ */
+extern http_sig_t * 
+http_sig_alloc(void);
+
+/**
+ *	Free signature set @sig.
+ *
+ *	No return.
+ */
+extern void 
+http_sig_free(http_sig_t *sig);
+
+/**
+ *	Add a signature @regex to @sig, it's checked in @fields
+ *	(HTTP_SIG_XXX) and the name is @name. It's case insensitive.
+ *
+ *	Return the signature id if success, -1 on error.
+ */
+extern int 
+http_sig_add(http_sig_t *sig, const char *name, int fields,
+	     const char *regex);
+
+/**
+ *	Load the signatures in rule file @file, the format is same as
+ *	files in intrusion/:
+ *
+ *	[name]
+ *		TARGET|TARGET...
+ *
+ *		regex
+ *
+ *		t:transform,...
+ *
+ *	The transform is not supported and ignored.
+ *
+ *	Return the number of loaded signatures, -1 on error.
+ */
+extern int 
+http_sig_load(http_sig_t *sig, const char *file);
+
+/**
+ *	Compile the signatures in @sig, it can't add signature after
+ *	compiled.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+http_sig_compile(http_sig_t *sig);
+
+/**
+ *	Get the name of signature @id.
+ *
+ *	Return the name, NULL if not found.
+ */
+extern const char * 
+http_sig_name(http_sig_t *sig, int id);
+
+/**
+ *	Get the regex of signature @id, the fields is stored in
+ *	@fields if it's not NULL.
+ *
+ *	Return the regex, NULL if not found.
+ */
+extern const char * 
+http_sig_regex(http_sig_t *sig, int id, int *fields);
+
+/**
+ *	Get the statistic of @sig into @st.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+http_sig_get_stat(http_sig_t *sig, http_sig_stat_t *st);
+
+/**
+ *	Set the SIMD skip of DFA start state used or not, it's
+ *	enabled by default if the CPU support AVX2.
+ *
+ *	Return 1 if it's used, 0 not.
+ */
+extern int 
+http_sig_set_skip(http_sig_t *sig, int enable);
+
+/**
+ *	Alloc a scan stream for compiled signature set @sig.
+ *
+ *	Return the stream if success, NULL on error.
+ */
+extern http_sig_stream_t * 
+http_sig_stream_alloc(http_sig_t *sig);
+
+/**
+ *	Reset the stream @s for a new field or message.
+ *
+ *	No return.
+ */
+extern void 
+http_sig_stream_reset(http_sig_stream_t *s);
+
+/**
+ *	Free the stream @s.
+ *
+ *	No return.
+ */
+extern void 
+http_sig_stream_free(http_sig_stream_t *s);
+
+/**
+ *	Scan the @data of @field, the @data is the next piece of the
+ *	field after the previous scan of @s. The signature is
+ *	reported by @cb once in each stream. The regex which match
+ *	cross packets can be found if the match length is less than
+ *	HTTP_SIG_WINDOW. Each Cookie header is a HTTP_SIG_COOKIE
+ *	field, see http_get_cookie_header().
+ *
+ *	Return the number of matched signatures, -1 on error.
+ */
+extern int 
+http_sig_scan(http_sig_t *sig, http_sig_stream_t *s, int field,
+	      const char *data, size_t len, http_sig_cb cb, void *arg);
+
+#endif	/* end of FZ_HTTP_SIG_H */
+
@@ -0,0 +1,665 @@
+/*
+ *	file	http_sig_test.c
+ *
+ *	brief	http_sig test program, it loads the signature files,
+ *		pads the set with generated signatures, and scans the
+ *		fields of each sample request. It reports MB/s of the
+ *		literal prefilter and the naive regex loop.
+ *
+ *	author	Forrest.zhang
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pcre.h>
+
+#include "http_parse.h"
+#include "http_sig.h"
+
+#define _FILE_MAX	256
+#define _RULE_MAX	16
+#define _FIELD_MAX	(8 + HTTP_MAX_COOKIE)
+#define _WORD_MAX	16
+
+typedef struct _field {
+	int		type;		/* HTTP_SIG_XXX */
+	char		*data;
+	size_t		len;
+} _field_t;
+
+typedef struct _sample {
+	char		name[_FILE_MAX];
+	_field_t	fields[_FIELD_MAX];
+	int		nfield;
+} _sample_t;
+
+static int _g_loop_times = 100;
+static int _g_nsig = 0;
+static int _g_split = 0;
+static int _g_naive = 0;
+static int _g_noskip = 0;
+static int _g_verbose = 0;
+static char *_g_rules[_RULE_MAX];
+static int _g_nrule;
+static _sample_t *_g_samples;
+static int _g_nsample;
+static http_sig_t *_g_sig;
+static http_info_t _g_info;
+static char *_g_body;
+static size_t _g_bodylen;
+
+static void
+_usage(void)
+{
+	printf("http_sig_test <options> <sample files>\n");
+	printf("\t-R <file>\tsignature file, can be repeated\n");
+	printf("\t-n <num> \tpad signatures to <num> by generated "
+	       "signatures\n");
+	printf("\t-t <num> \tloop times (need > 0), default is 100\n");
+	printf("\t-b <num> \tbytes in each scan call, default is whole\n");
+	printf("\t-N       \talso run naive loop of each regex\n");
+	printf("\t-S       \tdisable SIMD skip of DFA start state\n");
+	printf("\t-v       \tprint matched signatures\n");
+	printf("\t-h       \tshow help message\n");
+}
+
+static int
+_parse_cmd(int argc, char **argv)
+{
+	char optstr[] = ":R:n:t:b:NSvh";
+	char opt;
+
+	opterr = 0;
+	while ( (opt = getopt(argc, argv, optstr)) != -1) {
+		switch (opt) {
+
+		case 'R':
+			if (_g_nrule >= _RULE_MAX || access(optarg, R_OK))
+				return -1;
+			_g_rules[_g_nrule++] = optarg;
+			break;
+
+		case 'n':
+			_g_nsig = atoi(optarg);
+			if (_g_nsig < 0)
+				return -1;
+			break;
+
+		case 't':
+			_g_loop_times = atoi(optarg);
+			if (_g_loop_times < 1)
+				return -1;
+			break;
+
+		case 'b':
+			_g_split = atoi(optarg);
+			if (_g_split < 1)
+				return -1;
+			break;
+
+		case 'N':
+			_g_naive = 1;
+			break;
+
+		case 'S':
+			_g_noskip = 1;
+			break;
+
+		case 'v':
+			_g_verbose = 1;
+			break;
+
+		case 'h':
+			return -1;
+
+		case ':':
+			printf("option %c missing argument\n", optopt);
+			return -1;
+
+		case '?':
+			printf("unkowned option %c\n", optopt);
+			return -1;
+		}
+	}
+
+	if (optind == argc)
+		return -1;
+
+	return 0;
+}
+
+/**
+ *	Read whole file @file into memory.
+ *
+ *	Return the memory if success, NULL on error.
+ */
+static char *
+_read_file(const char *file, int *len)
+{
+	int fd;
+	int n;
+	char *buf;
+	struct stat st;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+
+	buf = malloc(st.st_size + 1);
+	if (!buf) {
+		close(fd);
+		return NULL;
+	}
+
+	n = read(fd, buf, st.st_size);
+	close(fd);
+	if (n != st.st_size) {
+		free(buf);
+		return NULL;
+	}
+
+	buf[n] = 0;
+	*len = n;
+	return buf;
+}
+
+static void
+_body_cb(http_info_t *hi, int dir, const char *data, size_t len, void *arg)
+{
+	char *body;
+
+	body = realloc(_g_body, _g_bodylen + len);
+	if (!body)
+		return;
+
+	memcpy(body + _g_bodylen, data, len);
+	_g_body = body;
+	_g_bodylen += len;
+}
+
+static int
+_add_field(_sample_t *s, int type, const char *data, size_t len)
+{
+	_field_t *f;
+
+	if (!data || !len || s->nfield >= _FIELD_MAX)
+		return 0;
+
+	f = &s->fields[s->nfield];
+	f->data = malloc(len);
+	if (!f->data)
+		return -1;
+
+	memcpy(f->data, data, len);
+	f->len = len;
+	f->type = type;
+	s->nfield++;
+
+	return 0;
+}
+
+static int
+_add_str(_sample_t *s, int type, int str)
+{
+	const char *ptr;
+	size_t len = 0;
+
+	ptr = http_get_str(&_g_info, HTTP_DIR_REQUEST, str, &len);
+	return _add_field(s, type, ptr, len);
+}
+
+/**
+ *	Add every Cookie header of request to @s, each one is a field.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int
+_add_cookies(_sample_t *s)
+{
+	const char *ptr;
+	size_t len;
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < http_get_cookie_header_count(&_g_info, HTTP_DIR_REQUEST); i++) {
+		ptr = http_get_cookie_header(&_g_info, HTTP_DIR_REQUEST, i, &len);
+		ret |= _add_field(s, HTTP_SIG_COOKIE, ptr, len);
+	}
+
+	return ret;
+}
+
+/**
+ *	Parse sample @file and split it into fields. The request
+ *	line is sliced directly if the request can't be parsed.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int
+_load_sample(_sample_t *s, const char *file)
+{
+	char *buf;
+	const char *url, *eol, *arg;
+	size_t ulen;
+	int len;
+	int ret = 0;
+
+	buf = _read_file(file, &len);
+	if (!buf)
+		return -1;
+
+	memset(s, 0, sizeof(*s));
+	snprintf(s->name, sizeof(s->name), "%s", file);
+
+	http_clear_info(&_g_info);
+	http_set_body_cb(&_g_info, _body_cb, NULL);
+	_g_bodylen = 0;
+
+	if (http_parse(&_g_info, HTTP_DIR_REQUEST, buf, len) >= 0) {
+		url = http_get_str(&_g_info, HTTP_DIR_REQUEST,
+				   HTTP_STR_URL, &ulen);
+		ret |= _add_str(s, HTTP_SIG_HEADER, HTTP_STR_HOST);
+		ret |= _add_str(s, HTTP_SIG_HEADER, HTTP_STR_USER_AGENT);
+		ret |= _add_cookies(s);
+		ret |= _add_field(s, HTTP_SIG_BODY, _g_body, _g_bodylen);
+	}
+	else {
+		url = memchr(buf, ' ', len);
+		eol = memchr(buf, '\n', len);
+		if (!url || !eol || url > eol) {
+			free(buf);
+			return -1;
+		}
+		url++;
+		ulen = eol - url;
+		if (ulen > 9 && !memcmp(url + ulen - 10, " HTTP/1.", 8))
+			ulen -= 10;
+		else if (ulen > 8 && !memcmp(url + ulen - 9, " HTTP/1.", 8))
+			ulen -= 9;
+	}
+
+	if (url) {
+		arg = memchr(url, '?', ulen);
+		if (arg) {
+			ret |= _add_field(s, HTTP_SIG_URL, url, arg - url);
+			ret |= _add_field(s, HTTP_SIG_ARGS, arg + 1,
+					  ulen - (arg - url) - 1);
+		}
+		else {
+			ret |= _add_field(s, HTTP_SIG_URL, url, ulen);
+		}
+	}
+
+	free(buf);
+	return ret;
+}
+
+/**
+ *	Generate a random lower case word of 4 - 8 letters.
+ *
+ *	No return.
+ */
+static void
+_gen_word(char *word)
+{
+	int len;
+	int i;
+
+	len = 4 + rand() % 5;
+	for (i = 0; i < len; i++)
+		word[i] = 'a' + rand() % 26;
+	word[len] = 0;
+}
+
+/**
+ *	Pad the signature set to @_g_nsig by generated signatures
+ *	like the real signatures, it's same in each run.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int
+_gen_sigs(int n)
+{
+	static const int fields[] = {
+		HTTP_SIG_URL, HTTP_SIG_ARGS | HTTP_SIG_BODY,
+		HTTP_SIG_HEADER | HTTP_SIG_COOKIE, HTTP_SIG_ALL,
+	};
+	char w1[_WORD_MAX], w2[_WORD_MAX], w3[_WORD_MAX];
+	char regex[128];
+	char name[32];
+	int i;
+
+	srand(1);
+	for (i = 0; i < n; i++) {
+		_gen_word(w1);
+		_gen_word(w2);
+		_gen_word(w3);
+		switch (i % 4) {
+		case 0:
+			snprintf(regex, sizeof(regex),
+				 "\\b%s\\s*[=(]\\s*%s", w1, w2);
+			break;
+		case 1:
+			snprintf(regex, sizeof(regex),
+				 "(?:%s|%s|%s)\\.\\w{2,4}\\b", w1, w2, w3);
+			break;
+		case 2:
+			snprintf(regex, sizeof(regex),
+				 "<%s[^>]*%s", w1, w2);
+			break;
+		default:
+			snprintf(regex, sizeof(regex),
+				 "%s(?:_%s)?\\d+", w1, w2);
+			break;
+		}
+
+		snprintf(name, sizeof(name), "gen:%d", i);
+		if (http_sig_add(_g_sig, name, fields[rand() % 4], regex) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+_initiate(int argc, char **argv)
+{
+	http_sig_stat_t st;
+	int n;
+	int i;
+
+	_g_sig = http_sig_alloc();
+	if (!_g_sig)
+		return -1;
+
+	for (i = 0; i < _g_nrule; i++) {
+		n = http_sig_load(_g_sig, _g_rules[i]);
+		if (n < 0) {
+			printf("load %s failed\n", _g_rules[i]);
+			return -1;
+		}
+	}
+
+	http_sig_get_stat(_g_sig, &st);
+	if (_g_nsig > st.nsig && _gen_sigs(_g_nsig - st.nsig))
+		return -1;
+
+	if (http_sig_compile(_g_sig))
+		return -1;
+
+	if (_g_noskip)
+		http_sig_set_skip(_g_sig, 0);
+
+	_g_samples = calloc(argc, sizeof(_sample_t));
+	if (!_g_samples)
+		return -1;
+
+	for (i = 0; i < argc; i++) {
+		if (_load_sample(&_g_samples[_g_nsample], argv[i])) {
+			printf("load sample %s failed\n", argv[i]);
+			continue;
+		}
+		_g_nsample++;
+	}
+
+	http_sig_get_stat(_g_sig, &st);
+	printf("%d signatures, %d filtered, %d literals, %d states, "
+	       "%d classes, skip %d\n", st.nsig, st.nfiltered,
+	       st.nliteral, st.nstate, st.nclass, st.skip);
+
+	return 0;
+}
+
+static void
+_release(void)
+{
+	int i, j;
+
+	for (i = 0; i < _g_nsample; i++) {
+		for (j = 0; j < _g_samples[i].nfield; j++)
+			free(_g_samples[i].fields[j].data);
+	}
+	free(_g_samples);
+	free(_g_body);
+
+	http_sig_free(_g_sig);
+	http_free_info(&_g_info);
+}
+
+static u_int64_t
+_cputime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+_match_cb(int id, int field, void *arg)
+{
+	const char *name = arg;
+
+	printf("%s: field 0x%02x match %s\n", name, field,
+	       http_sig_name(_g_sig, id));
+	return 0;
+}
+
+/**
+ *	Scan the fields of all samples, each field is a stream and
+ *	it's split by @_g_split.
+ *
+ *	Return the number of matches, -1 on error.
+ */
+static int
+_scan_once(http_sig_stream_t *s, int verbose)
+{
+	_sample_t *sample;
+	_field_t *f;
+	size_t pos, n;
+	int nmatch = 0;
+	int ret;
+	int i, j;
+
+	for (i = 0; i < _g_nsample; i++) {
+		sample = &_g_samples[i];
+		for (j = 0; j < sample->nfield; j++) {
+			f = &sample->fields[j];
+			http_sig_stream_reset(s);
+			for (pos = 0; pos < f->len; pos += n) {
+				n = f->len - pos;
+				if (_g_split > 0 && n > (size_t)_g_split)
+					n = _g_split;
+				ret = http_sig_scan(_g_sig, s, f->type,
+						    f->data + pos, n,
+						    verbose ? _match_cb : NULL,
+						    sample->name);
+				if (ret < 0)
+					return -1;
+				nmatch += ret;
+			}
+		}
+	}
+
+	return nmatch;
+}
+
+static size_t
+_sample_bytes(void)
+{
+	size_t bytes = 0;
+	int i, j;
+
+	for (i = 0; i < _g_nsample; i++) {
+		for (j = 0; j < _g_samples[i].nfield; j++)
+			bytes += _g_samples[i].fields[j].len;
+	}
+
+	return bytes;
+}
+
+/**
+ *	Scan the samples @_g_loop_times by the literal prefilter.
+ *
+ * 	Return 0 if success, -1 on error.
+ */
+static int
+_do_scan(void)
+{
+	http_sig_stream_t *s;
+	http_sig_stat_t st;
+	u_int64_t begin, end;
+	double sec;
+	int nmatch;
+	int i;
+
+	s = http_sig_stream_alloc(_g_sig);
+	if (!s)
+		return -1;
+
+	nmatch = _scan_once(s, _g_verbose);
+
+	begin = _cputime();
+	for (i = 0; i < _g_loop_times && nmatch >= 0; i++)
+		_scan_once(s, 0);
+	end = _cputime();
+
+	http_sig_stream_free(s);
+	if (nmatch < 0)
+		return -1;
+
+	http_sig_get_stat(_g_sig, &st);
+	sec = (end - begin) / 1000000000.0;
+	printf("prefilter: scan %lu bytes %d times, %.2f MB/s, "
+	       "%d matches, %.1f regex each loop\n",
+	       (unsigned long)_sample_bytes(), _g_loop_times,
+	       (double)_sample_bytes() * _g_loop_times / sec / 1000000.0,
+	       nmatch, (double)st.ncandidate / (_g_loop_times + 1));
+
+	return 0;
+}
+
+/**
+ *	Scan the samples @_g_loop_times by running each regex on
+ *	each field.
+ *
+ * 	Return 0 if success, -1 on error.
+ */
+static int
+_do_naive(void)
+{
+	http_sig_stat_t st;
+	pcre **res;
+	pcre_extra **extras;
+	int *fields;
+	const char *regex;
+	const char *error;
+	int erroff;
+	int ovector[30];
+	u_int64_t begin, end;
+	double sec;
+	_field_t *f;
+	int nmatch = 0;
+	int i, j, k, r;
+
+	http_sig_get_stat(_g_sig, &st);
+	res = calloc(st.nsig, sizeof(pcre *));
+	extras = calloc(st.nsig, sizeof(pcre_extra *));
+	fields = calloc(st.nsig, sizeof(int));
+	if (!res || !extras || !fields) {
+		free(res);
+		free(extras);
+		free(fields);
+		return -1;
+	}
+
+	for (r = 0; r < st.nsig; r++) {
+		regex = http_sig_regex(_g_sig, r, &fields[r]);
+		res[r] = pcre_compile(regex, PCRE_CASELESS, &error,
+				      &erroff, NULL);
+		if (!res[r])
+			goto out;
+#ifdef	PCRE_STUDY_JIT_COMPILE
+		extras[r] = pcre_study(res[r], PCRE_STUDY_JIT_COMPILE, &error);
+#else
+		extras[r] = pcre_study(res[r], 0, &error);
+#endif
+	}
+
+	begin = _cputime();
+	for (i = 0; i < _g_loop_times; i++) {
+		nmatch = 0;
+		for (j = 0; j < _g_nsample; j++) {
+			for (k = 0; k < _g_samples[j].nfield; k++) {
+				f = &_g_samples[j].fields[k];
+				for (r = 0; r < st.nsig; r++) {
+					if (!(fields[r] & f->type))
+						continue;
+					if (pcre_exec(res[r], extras[r],
+						      f->data, f->len, 0, 0,
+						      ovector, 30) >= 0)
+						nmatch++;
+				}
+			}
+		}
+	}
+	end = _cputime();
+
+	sec = (end - begin) / 1000000000.0;
+	printf("naive: scan %lu bytes %d times, %.2f MB/s, %d matches\n",
+	       (unsigned long)_sample_bytes(), _g_loop_times,
+	       (double)_sample_bytes() * _g_loop_times / sec / 1000000.0,
+	       nmatch);
+
+out:
+	for (r = 0; r < st.nsig; r++) {
+		if (extras[r])
+			pcre_free_study(extras[r]);
+		if (res[r])
+			pcre_free(res[r]);
+	}
+	free(res);
+	free(extras);
+	free(fields);
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	if (_parse_cmd(argc, argv)) {
+		_usage();
+		return -1;
+	}
+
+	if (_initiate(argc - optind, argv + optind)) {
+		_release();
+		return -1;
+	}
+
+	if (_do_scan()) {
+		_release();
+		return -1;
+	}
+
+	if (_g_naive)
+		_do_naive();
+
+	_release();
+
+	return 0;
+}
+
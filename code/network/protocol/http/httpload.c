@@ -0,0 +1,1165 @@
+/**
+ *	@file	httpload.c
+ *
+ *	@brief	The HTTP/HTTPS load generator, each thread runs an epoll
+ *		loop over many connections with keep-alive, pipelining
+ *		and TLS session resumption. In constant rate(open-loop)
+ *		mode the latency is measured from the time the request
+ *		should be sent, so the slow responses are not hidden by
+ *		the waiting requests(coordinated omission).
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#define	_GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "http_parse.h"
+
+#define FZ_THREAD_MAX	64		/* max threads */
+#define FZ_DEPTH_MAX	64		/* max pipeline depth */
+#define FZ_REQ_MAX	16		/* max request files */
+#define FZ_EVENT_MAX	256		/* max events of one epoll_wait */
+#define FZ_RECV_SIZE	16384		/* recv buffer size */
+#define FZ_SEC_MAX	3600		/* max run seconds */
+
+/* latency histogram in us, 32 sub-buckets for each power of 2 */
+#define FZ_HIST_SUB	5
+#define FZ_HIST_EXP	36
+#define FZ_HIST_SIZE	((FZ_HIST_EXP - FZ_HIST_SUB + 2) << FZ_HIST_SUB)
+
+#define	_CONN_CLOSED	0		/* not connected */
+#define	_CONN_CONNECT	1		/* TCP connecting */
+#define	_CONN_SHAKE	2		/* TLS handshake */
+#define	_CONN_READY	3		/* request can be sent */
+
+/**
+ *	The request loaded from file.
+ */
+typedef struct _req {
+	char		*data;
+	size_t		len;
+} _req_t;
+
+struct _worker;
+
+/**
+ *	The connection to server, the requests are queued in @out
+ *	and the time of requests in flight are in @start.
+ */
+typedef struct _conn {
+	int		fd;		/* socket */
+	int		state;		/* _CONN_XXX */
+	int		events;		/* epoll events */
+	SSL		*ssl;		/* TLS connection */
+	SSL_SESSION	*sess;		/* session for resumption */
+	char		*out;		/* pending request bytes */
+	size_t		outlen;		/* length of @out */
+	size_t		outoff;		/* sent bytes of @out */
+	u_int64_t	start[FZ_DEPTH_MAX]; /* request start time */
+	int		head;		/* first request in @start */
+	int		ninflight;	/* requests in flight */
+	int		nsent;		/* requests sent by connection */
+	http_info_t	info;		/* response parser */
+	struct _worker	*w;		/* the owner */
+} _conn_t;
+
+/**
+ *	The worker thread, the counters are read by main thread.
+ */
+typedef struct _worker {
+	pthread_t	tid;		/* thread id */
+	int		index;		/* thread index */
+	int		epoll_fd;	/* epoll fd */
+	int		timer_fd;	/* open-loop timer */
+	_conn_t		*conns;		/* connections */
+	int		cursor;		/* next connection to send */
+	u_int64_t	begin;		/* begin time(ns) */
+	double		interval;	/* open-loop interval(ns) */
+	u_int64_t	nissue;		/* issued requests */
+	unsigned int	reqidx;		/* next request in mix */
+	u_int64_t	nresp;		/* received responses */
+	u_int64_t	nbytes;		/* received bytes */
+	u_int64_t	nconnect;	/* connections */
+	u_int64_t	nresume;	/* resumed TLS sessions */
+	u_int64_t	nerror;		/* errors */
+	u_int64_t	hist[FZ_HIST_SIZE]; /* latency histogram */
+} _worker_t;
+
+static u_int32_t	_g_svr_ip;		/* server IP */
+static u_int16_t	_g_svr_port = 80;	/* server port */
+static int		_g_nworker = 1;		/* thread number */
+static int		_g_nconn = 10;		/* connections per thread */
+static int		_g_depth = 1;		/* pipeline depth */
+static int		_g_keepalive;		/* keep-alive */
+static int		_g_ssl;			/* use TLS */
+static int		_g_resume;		/* TLS session resumption */
+static double		_g_rate;		/* requests/s, 0 is max */
+static int		_g_duration = 10;	/* run seconds */
+static _req_t		_g_reqs[FZ_REQ_MAX];	/* request mix */
+static int		_g_nreq;
+static char		_g_defreq[256];		/* request if no file */
+static size_t		_g_req_max;		/* max request length */
+static SSL_CTX		*_g_ssl_ctx;
+static _worker_t	_g_workers[FZ_THREAD_MAX];
+static volatile int	_g_stop;
+
+
+/**
+ *	Show help message.
+ *
+ *	No return.
+ */
+static void 
+_usage(void)
+{
+	printf("httpload <options>\n");
+	printf("\t-a <ip>\tserver IP address\n");
+	printf("\t-p <port>\tserver port, default 80\n");
+	printf("\t-n <num>\tthreads, default 1\n");
+	printf("\t-c <num>\tconnections per thread, default 10\n");
+	printf("\t-d <num>\tpipeline depth, default 1\n");
+	printf("\t-k\tkeep-alive, default is one request per connection\n");
+	printf("\t-s\tuse TLS\n");
+	printf("\t-S\tTLS session resumption\n");
+	printf("\t-r <num>\tconstant rate requests/s, default is max\n");
+	printf("\t-t <num>\trun seconds, default 10\n");
+	printf("\t-f <file>\trequest file, can be used %d times\n",
+	       FZ_REQ_MAX);
+	printf("\t-h\tshow help message\n");
+}
+
+/**
+ *	Load the request file @file into request mix.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_load_req(const char *file)
+{
+	struct stat st;
+	_req_t *req;
+	int fd;
+
+	if (_g_nreq >= FZ_REQ_MAX) {
+		printf("too many request files\n");
+		return -1;
+	}
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		printf("open request file %s failed\n", file);
+		return -1;
+	}
+
+	if (fstat(fd, &st) || st.st_size < 1) {
+		printf("request file %s is empty\n", file);
+		close(fd);
+		return -1;
+	}
+
+	req = &_g_reqs[_g_nreq];
+	req->len = st.st_size;
+	req->data = malloc(req->len + 4);
+	if (!req->data) {
+		close(fd);
+		return -1;
+	}
+
+	if (read(fd, req->data, req->len) != (ssize_t)req->len) {
+		printf("read request file %s failed\n", file);
+		free(req->data);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	/* the header sample without blank line is ended */
+	if (!memmem(req->data, req->len, "\r\n\r\n", 4) &&
+	    !memmem(req->data, req->len, "\n\n", 2))
+	{
+		if (req->data[req->len - 1] != '\n') {
+			memcpy(req->data + req->len, "\r\n", 2);
+			req->len += 2;
+		}
+		memcpy(req->data + req->len, "\r\n", 2);
+		req->len += 2;
+	}
+
+	if (req->len > _g_req_max)
+		_g_req_max = req->len;
+	_g_nreq++;
+
+	return 0;
+}
+
+/**
+ *	Parse command line arguments.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_parse_cmd(int argc, char **argv)
+{
+	char optstr[] = ":a:p:n:c:d:ksSr:t:f:h";
+	char c;
+	int port;
+
+	opterr = 0;
+	while ( (c = getopt(argc, argv, optstr)) != -1) {
+
+		switch (c) {
+
+		case 'a':
+			_g_svr_ip = inet_addr(optarg);
+			break;
+
+		case 'p':
+			port = atoi(optarg);
+			if (port < 1 || port > 65535) {
+				printf("port(%s) out of 1-65535\n", optarg);
+				return -1;
+			}
+			_g_svr_port = port;
+			break;
+
+		case 'n':
+			_g_nworker = atoi(optarg);
+			if (_g_nworker < 1 || _g_nworker > FZ_THREAD_MAX) {
+				printf("threads(%s) out of 1-%d\n", optarg,
+				       FZ_THREAD_MAX);
+				return -1;
+			}
+			break;
+
+		case 'c':
+			_g_nconn = atoi(optarg);
+			if (_g_nconn < 1) {
+				printf("connections(%s) is invalid\n", optarg);
+				return -1;
+			}
+			break;
+
+		case 'd':
+			_g_depth = atoi(optarg);
+			if (_g_depth < 1 || _g_depth > FZ_DEPTH_MAX) {
+				printf("depth(%s) out of 1-%d\n", optarg,
+				       FZ_DEPTH_MAX);
+				return -1;
+			}
+			break;
+
+		case 'k':
+			_g_keepalive = 1;
+			break;
+
+		case 's':
+			_g_ssl = 1;
+			break;
+
+		case 'S':
+			_g_resume = 1;
+			break;
+
+		case 'r':
+			_g_rate = atof(optarg);
+			if (_g_rate < 0) {
+				printf("rate(%s) is invalid\n", optarg);
+				return -1;
+			}
+			break;
+
+		case 't':
+			_g_duration = atoi(optarg);
+			if (_g_duration < 1 || _g_duration > FZ_SEC_MAX) {
+				printf("seconds(%s) out of 1-%d\n", optarg,
+				       FZ_SEC_MAX);
+				return -1;
+			}
+			break;
+
+		case 'f':
+			if (_load_req(optarg))
+				return -1;
+			break;
+
+		case 'h':
+			return -1;
+
+		case ':':
+			printf("option %c missing argument\n", optopt);
+			return -1;
+
+		case '?':
+			printf("unkowned option %c\n", optopt);
+			return -1;
+		}
+	}
+
+	if (argc != optind)
+		return -1;
+
+	if (!_g_svr_ip) {
+		printf("need set server using -a option\n");
+		return -1;
+	}
+
+	/* the pipeline need keep-alive */
+	if (!_g_keepalive)
+		_g_depth = 1;
+
+	return 0;
+}
+
+static u_int64_t 
+_walltime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *	Get histogram index of latency @us.
+ *
+ *	Return the index.
+ */
+static int 
+_hist_index(u_int64_t us)
+{
+	int e;
+
+	if (us < (1 << FZ_HIST_SUB))
+		return us;
+
+	e = 63 - __builtin_clzll(us);
+	if (e > FZ_HIST_EXP)
+		return FZ_HIST_SIZE - 1;
+
+	return ((e - FZ_HIST_SUB + 1) << FZ_HIST_SUB) +
+		((us >> (e - FZ_HIST_SUB)) & ((1 << FZ_HIST_SUB) - 1));
+}
+
+/**
+ *	Get the lowest latency of histogram index @idx.
+ *
+ *	Return the latency in us.
+ */
+static u_int64_t 
+_hist_value(int idx)
+{
+	int e, sub;
+
+	if (idx < (1 << FZ_HIST_SUB))
+		return idx;
+
+	e = (idx >> FZ_HIST_SUB) + FZ_HIST_SUB - 1;
+	sub = idx & ((1 << FZ_HIST_SUB) - 1);
+
+	return (u_int64_t)((1 << FZ_HIST_SUB) + sub) << (e - FZ_HIST_SUB);
+}
+
+/**
+ *	Init the TLS context and default request.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_initiate(void)
+{
+	struct epoll_event ev;
+	_worker_t *w;
+	_conn_t *c;
+	int i, j;
+
+	if (_g_nreq == 0) {
+		snprintf(_g_defreq, sizeof(_g_defreq),
+			 "GET / HTTP/1.1\r\nHost: %u.%u.%u.%u:%u\r\n\r\n",
+			 ((unsigned char *)&_g_svr_ip)[0],
+			 ((unsigned char *)&_g_svr_ip)[1],
+			 ((unsigned char *)&_g_svr_ip)[2],
+			 ((unsigned char *)&_g_svr_ip)[3], _g_svr_port);
+		_g_reqs[0].data = _g_defreq;
+		_g_reqs[0].len = strlen(_g_defreq);
+		_g_req_max = _g_reqs[0].len;
+		_g_nreq = 1;
+	}
+
+	if (_g_ssl) {
+		SSL_load_error_strings();
+		SSL_library_init();
+
+		_g_ssl_ctx = SSL_CTX_new(SSLv23_client_method());
+		if (!_g_ssl_ctx) {
+			printf("create SSL context failed\n");
+			return -1;
+		}
+
+		/* the @out may be appended before the write is retried */
+		SSL_CTX_set_mode(_g_ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+				 SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < _g_nworker; i++) {
+		w = &_g_workers[i];
+		w->index = i;
+		if (_g_rate > 0)
+			w->interval = 1000000000.0 * _g_nworker / _g_rate;
+
+		w->epoll_fd = epoll_create1(0);
+		if (w->epoll_fd < 0) {
+			printf("create epoll failed: %s\n", strerror(errno));
+			return -1;
+		}
+
+		/* the timer have NULL data */
+		w->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+		if (w->timer_fd < 0) {
+			printf("create timer failed: %s\n", strerror(errno));
+			return -1;
+		}
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->timer_fd, &ev)) {
+			printf("add timer failed: %s\n", strerror(errno));
+			return -1;
+		}
+
+		w->conns = calloc(_g_nconn, sizeof(_conn_t));
+		if (!w->conns)
+			return -1;
+
+		for (j = 0; j < _g_nconn; j++) {
+			c = &w->conns[j];
+			c->fd = -1;
+			c->w = w;
+			c->out = malloc(_g_req_max * _g_depth);
+			if (!c->out)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ *	Release resource alloced by _initiate().
+ *
+ *	No return.
+ */
+static void 
+_release(void)
+{
+	_worker_t *w;
+	_conn_t *c;
+	int i, j;
+
+	for (i = 0; i < _g_nworker; i++) {
+		w = &_g_workers[i];
+		if (w->conns) {
+			for (j = 0; j < _g_nconn; j++) {
+				c = &w->conns[j];
+				if (c->ssl)
+					SSL_free(c->ssl);
+				if (c->sess)
+					SSL_SESSION_free(c->sess);
+				if (c->fd >= 0)
+					close(c->fd);
+				http_free_info(&c->info);
+				free(c->out);
+			}
+			free(w->conns);
+			w->conns = NULL;
+		}
+		if (w->timer_fd > 0)
+			close(w->timer_fd);
+		if (w->epoll_fd > 0)
+			close(w->epoll_fd);
+		w->timer_fd = -1;
+		w->epoll_fd = -1;
+	}
+
+	/* the default request is static */
+	for (i = 0; i < _g_nreq; i++) {
+		if (_g_reqs[i].data != _g_defreq)
+			free(_g_reqs[i].data);
+		_g_reqs[i].data = NULL;
+	}
+	_g_nreq = 0;
+
+	if (_g_ssl_ctx)
+		SSL_CTX_free(_g_ssl_ctx);
+	_g_ssl_ctx = NULL;
+}
+
+/**
+ *	Set epoll events of connection @c to @events.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_conn_events(_conn_t *c, int events)
+{
+	struct epoll_event ev;
+
+	if (c->events == events)
+		return 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = c;
+	if (epoll_ctl(c->w->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev))
+		return -1;
+
+	c->events = events;
+	return 0;
+}
+
+/**
+ *	Close the connection @c, the requests in flight are errors.
+ *	The TLS session is kept for resumption.
+ *
+ *	No return.
+ */
+static void 
+_conn_close(_conn_t *c)
+{
+	if (c->ssl) {
+		if (_g_resume && c->state == _CONN_READY) {
+			if (c->sess)
+				SSL_SESSION_free(c->sess);
+			c->sess = SSL_get1_session(c->ssl);
+		}
+		/* the session is not resumable without close_notify */
+		SSL_shutdown(c->ssl);
+		SSL_free(c->ssl);
+		c->ssl = NULL;
+	}
+
+	if (c->fd >= 0) {
+		epoll_ctl(c->w->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+		close(c->fd);
+		c->fd = -1;
+	}
+
+	c->w->nerror += c->ninflight;
+	c->state = _CONN_CLOSED;
+	c->events = 0;
+	c->outlen = 0;
+	c->outoff = 0;
+	c->head = 0;
+	c->ninflight = 0;
+	c->nsent = 0;
+	http_clear_info(&c->info);
+}
+
+/**
+ *	Start non-blocking connect of @c.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_conn_open(_conn_t *c)
+{
+	struct sockaddr_in addr;
+	struct epoll_event ev;
+	int on = 1;
+
+	c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (c->fd < 0)
+		return -1;
+
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = _g_svr_ip;
+	addr.sin_port = htons(_g_svr_port);
+	if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) &&
+	    errno != EINPROGRESS)
+	{
+		close(c->fd);
+		c->fd = -1;
+		return -1;
+	}
+
+	c->state = _CONN_CONNECT;
+	c->events = EPOLLOUT;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = c->events;
+	ev.data.ptr = c;
+	if (epoll_ctl(c->w->epoll_fd, EPOLL_CTL_ADD, c->fd, &ev)) {
+		close(c->fd);
+		c->fd = -1;
+		c->state = _CONN_CLOSED;
+		return -1;
+	}
+
+	c->w->nconnect++;
+	return 0;
+}
+
+/**
+ *	Queue next request of mix in @c, the latency is from @start.
+ *
+ *	No return.
+ */
+static void 
+_conn_issue(_conn_t *c, u_int64_t start)
+{
+	_worker_t *w = c->w;
+	_req_t *req;
+
+	req = &_g_reqs[w->reqidx++ % _g_nreq];
+
+	/* the sent bytes are dropped */
+	if (c->outoff > 0 && c->outoff == c->outlen) {
+		c->outoff = 0;
+		c->outlen = 0;
+	}
+	else if (c->outoff > 0) {
+		memmove(c->out, c->out + c->outoff, c->outlen - c->outoff);
+		c->outlen -= c->outoff;
+		c->outoff = 0;
+	}
+
+	memcpy(c->out + c->outlen, req->data, req->len);
+	c->outlen += req->len;
+	c->start[(c->head + c->ninflight) % FZ_DEPTH_MAX] = start;
+	c->ninflight++;
+	c->nsent++;
+}
+
+/**
+ *	Check connection @c can take one more request.
+ *
+ *	Return 1 if can, 0 if not.
+ */
+static int 
+_conn_can_issue(_conn_t *c)
+{
+	if (c->state == _CONN_CLOSED || c->ninflight >= _g_depth)
+		return 0;
+
+	/* one request per connection without keep-alive */
+	if (!_g_keepalive && c->nsent > 0)
+		return 0;
+
+	return 1;
+}
+
+/**
+ *	Do the TLS handshake of @c.
+ *
+ *	Return 0 if finished, 1 if need more I/O, -1 on error.
+ */
+static int 
+_conn_shake(_conn_t *c)
+{
+	int ret;
+
+	ret = SSL_connect(c->ssl);
+	if (ret == 1) {
+		if (SSL_session_reused(c->ssl))
+			c->w->nresume++;
+		c->state = _CONN_READY;
+		return 0;
+	}
+
+	switch (SSL_get_error(c->ssl, ret)) {
+	case SSL_ERROR_WANT_READ:
+		return _conn_events(c, EPOLLIN) ? -1 : 1;
+	case SSL_ERROR_WANT_WRITE:
+		return _conn_events(c, EPOLLIN | EPOLLOUT) ? -1 : 1;
+	default:
+		return -1;
+	}
+}
+
+/**
+ *	The TCP connection @c is established, start TLS if need.
+ *
+ *	Return 0 if ready, 1 if need more I/O, -1 on error.
+ */
+static int 
+_conn_established(_conn_t *c)
+{
+	socklen_t len;
+	int err = 0;
+
+	len = sizeof(err);
+	if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err)
+		return -1;
+
+	if (!_g_ssl) {
+		c->state = _CONN_READY;
+		return 0;
+	}
+
+	c->ssl = SSL_new(_g_ssl_ctx);
+	if (!c->ssl)
+		return -1;
+
+	SSL_set_fd(c->ssl, c->fd);
+	if (_g_resume && c->sess)
+		SSL_set_session(c->ssl, c->sess);
+
+	c->state = _CONN_SHAKE;
+	return _conn_shake(c);
+}
+
+/**
+ *	Send the pending requests of @c.
+ *
+ *	Return 0 if all sent, 1 if socket is full, -1 on error.
+ */
+static int 
+_conn_send(_conn_t *c)
+{
+	ssize_t n;
+	int err;
+
+	while (c->outoff < c->outlen) {
+		if (c->ssl) {
+			n = SSL_write(c->ssl, c->out + c->outoff,
+				      c->outlen - c->outoff);
+			if (n <= 0) {
+				err = SSL_get_error(c->ssl, n);
+				if (err == SSL_ERROR_WANT_WRITE ||
+				    err == SSL_ERROR_WANT_READ)
+					return 1;
+				return -1;
+			}
+		}
+		else {
+			n = send(c->fd, c->out + c->outoff,
+				 c->outlen - c->outoff, 0);
+			if (n < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return 1;
+				if (errno == EINTR)
+					continue;
+				return -1;
+			}
+		}
+		c->outoff += n;
+	}
+
+	c->outoff = 0;
+	c->outlen = 0;
+	return 0;
+}
+
+/**
+ *	One response of @c is finished, the latency of first request
+ *	in flight is recorded.
+ *
+ *	Return 0 if success, -1 if no request in flight.
+ */
+static int 
+_conn_done(_conn_t *c, u_int64_t now)
+{
+	_worker_t *w = c->w;
+	u_int64_t start;
+
+	if (c->ninflight < 1)
+		return -1;
+
+	start = c->start[c->head];
+	c->head = (c->head + 1) % FZ_DEPTH_MAX;
+	c->ninflight--;
+
+	w->hist[_hist_index(now > start ? (now - start) / 1000 : 0)]++;
+	__atomic_store_n(&w->nresp, w->nresp + 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/**
+ *	Recv the responses of @c until no data, the responses are
+ *	parsed in stream to find their end.
+ *
+ *	Return 0 if success, 1 if server closed, -1 on error.
+ */
+static int 
+_conn_recv(_conn_t *c)
+{
+	char buf[FZ_RECV_SIZE];
+	u_int64_t now;
+	ssize_t n;
+	size_t pos;
+	int ret;
+	int err;
+
+	for (;;) {
+		if (c->ssl) {
+			n = SSL_read(c->ssl, buf, sizeof(buf));
+			if (n <= 0) {
+				err = SSL_get_error(c->ssl, n);
+				if (err == SSL_ERROR_WANT_READ ||
+				    err == SSL_ERROR_WANT_WRITE)
+					return 0;
+				if (err != SSL_ERROR_ZERO_RETURN &&
+				    err != SSL_ERROR_SYSCALL)
+					return -1;
+				n = 0;
+			}
+		}
+		else {
+			n = recv(c->fd, buf, sizeof(buf), 0);
+			if (n < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return 0;
+				if (errno == EINTR)
+					continue;
+				return -1;
+			}
+		}
+
+		now = _walltime();
+
+		/* the close-delimited response is finished by close */
+		if (n == 0) {
+			ret = http_get_int(&c->info, HTTP_DIR_RESPONSE,
+					   HTTP_INT_STATE);
+			if (ret != HTTP_STE_BEGIN && ret != HTTP_STE_FIN &&
+			    http_parse_eof(&c->info, HTTP_DIR_RESPONSE) == 0 &&
+			    _conn_done(c, now))
+				return -1;
+			return 1;
+		}
+
+		__atomic_store_n(&c->w->nbytes, c->w->nbytes + n,
+				 __ATOMIC_RELAXED);
+
+		pos = 0;
+		while (pos < (size_t)n) {
+			ret = http_parse(&c->info, HTTP_DIR_RESPONSE,
+					 buf + pos, n - pos);
+			if (ret < 0)
+				return -1;
+
+			/* the response may finish at end of @buf */
+			if (ret == 0 &&
+			    http_get_int(&c->info, HTTP_DIR_RESPONSE,
+					 HTTP_INT_STATE) != HTTP_STE_FIN)
+				break;
+
+			if (_conn_done(c, now))
+				return -1;
+
+			pos = n - ret;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ *	Process the event @events of connection @c.
+ *
+ *	Return 0 if success, -1 if @c need be closed.
+ */
+static int 
+_conn_process(_conn_t *c, int events)
+{
+	int ret;
+
+	if (c->state == _CONN_CONNECT) {
+		ret = _conn_established(c);
+		if (ret)
+			return ret < 0 ? -1 : 0;
+	}
+	else if (c->state == _CONN_SHAKE) {
+		ret = _conn_shake(c);
+		if (ret)
+			return ret < 0 ? -1 : 0;
+	}
+	else if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+		ret = _conn_recv(c);
+		if (ret)
+			return -1;
+	}
+
+	/* the one request connection is closed after response */
+	if (!_g_keepalive && c->nsent > 0 && c->ninflight == 0)
+		return -1;
+
+	ret = _conn_send(c);
+	if (ret < 0)
+		return -1;
+
+	return _conn_events(c, ret ? EPOLLIN | EPOLLOUT : EPOLLIN);
+}
+
+/**
+ *	Issue the requests of worker @w, in open-loop mode the
+ *	requests due now are given to the connections have free slot
+ *	with the time they should be sent, otherwise each connection
+ *	is filled to pipeline depth.
+ *
+ *	Return the time of next due request, 0 if no timer.
+ */
+static u_int64_t 
+_do_issue(_worker_t *w, u_int64_t now)
+{
+	u_int64_t due;
+	_conn_t *c = NULL;
+	int i, n;
+
+	if (w->interval <= 0) {
+		for (i = 0; i < _g_nconn; i++) {
+			c = &w->conns[i];
+			if (c->state == _CONN_CLOSED && _conn_open(c))
+				w->nerror++;
+			while (_conn_can_issue(c))
+				_conn_issue(c, now);
+		}
+		return 0;
+	}
+
+	for (;;) {
+		due = w->begin + (u_int64_t)(w->nissue * w->interval);
+		if (due > now)
+			break;
+
+		/* find connection from cursor */
+		for (n = 0; n < _g_nconn; n++) {
+			c = &w->conns[w->cursor];
+			w->cursor = (w->cursor + 1) % _g_nconn;
+			if (c->state == _CONN_CLOSED && _conn_open(c)) {
+				w->nerror++;
+				continue;
+			}
+			if (_conn_can_issue(c))
+				break;
+		}
+
+		/* the request waits and its latency is growing */
+		if (n == _g_nconn)
+			return 0;
+
+		_conn_issue(c, due);
+		w->nissue++;
+	}
+
+	return due;
+}
+
+/**
+ *	The worker thread main loop.
+ *
+ *	Return NULL always.
+ */
+static void * 
+_do_loop(void *arg)
+{
+	struct epoll_event evs[FZ_EVENT_MAX];
+	struct itimerspec its;
+	_worker_t *w = arg;
+	u_int64_t due, val;
+	_conn_t *c;
+	int n, i;
+
+	memset(&its, 0, sizeof(its));
+	w->begin = _walltime();
+	while (!_g_stop) {
+		due = _do_issue(w, _walltime());
+
+		/* the timer is absolute, so it's not delayed by loop */
+		if (due) {
+			its.it_value.tv_sec = due / 1000000000ULL;
+			its.it_value.tv_nsec = due % 1000000000ULL;
+			timerfd_settime(w->timer_fd, TFD_TIMER_ABSTIME,
+					&its, NULL);
+		}
+
+		/* the new requests are sent */
+		for (i = 0; i < _g_nconn; i++) {
+			c = &w->conns[i];
+			if (c->state != _CONN_READY || c->outlen == 0)
+				continue;
+			if (_conn_process(c, 0)) {
+				_conn_close(c);
+			}
+		}
+
+		n = epoll_wait(w->epoll_fd, evs, FZ_EVENT_MAX, 100);
+		for (i = 0; i < n; i++) {
+			c = evs[i].data.ptr;
+			if (!c) {
+				/* the expiration count is not used */
+				if (read(w->timer_fd, &val, sizeof(val)) < 0)
+					val = 0;
+				continue;
+			}
+			if (_conn_process(c, evs[i].events))
+				_conn_close(c);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ *	Show the latency percentile of histogram @hist which have
+ *	@total samples.
+ *
+ *	No return.
+ */
+static void 
+_show_latency(u_int64_t *hist, u_int64_t total)
+{
+	static const double pcts[] = {50, 75, 90, 99, 99.9, 99.99, 100};
+	u_int64_t sum = 0, sum2 = 0;
+	int i, k = 0;
+
+	if (total == 0)
+		return;
+
+	printf("latency(us):\n");
+	for (i = 0; i < FZ_HIST_SIZE && k < 7; i++) {
+		sum += hist[i];
+		sum2 += hist[i] * _hist_value(i);
+		while (k < 7 && sum >= pcts[k] / 100.0 * total && sum > 0) {
+			printf("\t%6.2f%%\t%lu\n", pcts[k],
+			       (unsigned long)_hist_value(i));
+			k++;
+		}
+	}
+	printf("\tmean\t%lu\n", (unsigned long)(sum2 / total));
+}
+
+/**
+ *	Run the workers @_g_duration seconds, the throughput of each
+ *	second and the latency histogram are shown.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_do_run(void)
+{
+	u_int64_t hist[FZ_HIST_SIZE];
+	u_int64_t last = 0, lastbytes = 0;
+	u_int64_t nresp, nbytes, nconnect = 0, nresume = 0, nerror = 0;
+	u_int64_t begin, end;
+	_worker_t *w;
+	double sec;
+	int i, j, n;
+
+	for (n = 0; n < _g_nworker; n++) {
+		w = &_g_workers[n];
+		if (pthread_create(&w->tid, NULL, _do_loop, w)) {
+			printf("create thread %d failed\n", n);
+			_g_stop = 1;
+			break;
+		}
+	}
+
+	begin = _walltime();
+	for (i = 1; i <= _g_duration && !_g_stop; i++) {
+		sleep(1);
+
+		nresp = 0;
+		nbytes = 0;
+		for (j = 0; j < n; j++) {
+			w = &_g_workers[j];
+			nresp += __atomic_load_n(&w->nresp, __ATOMIC_RELAXED);
+			nbytes += __atomic_load_n(&w->nbytes,
+						  __ATOMIC_RELAXED);
+		}
+		printf("%4d: %lu resp/s, %.1f MB/s\n", i,
+		       (unsigned long)(nresp - last),
+		       (nbytes - lastbytes) / 1000000.0);
+		last = nresp;
+		lastbytes = nbytes;
+	}
+
+	_g_stop = 1;
+	for (j = 0; j < n; j++)
+		pthread_join(_g_workers[j].tid, NULL);
+	end = _walltime();
+
+	memset(hist, 0, sizeof(hist));
+	nresp = 0;
+	nbytes = 0;
+	for (j = 0; j < n; j++) {
+		w = &_g_workers[j];
+		for (i = 0; i < FZ_HIST_SIZE; i++)
+			hist[i] += w->hist[i];
+		nresp += w->nresp;
+		nbytes += w->nbytes;
+		nconnect += w->nconnect;
+		nresume += w->nresume;
+		nerror += w->nerror;
+	}
+
+	sec = (end - begin) / 1000000000.0;
+	printf("%lu responses in %.2f seconds, %.0f resp/s, %.1f MB/s\n",
+	       (unsigned long)nresp, sec, nresp / sec,
+	       nbytes / sec / 1000000.0);
+	printf("%lu connections, %lu resumed, %lu errors\n",
+	       (unsigned long)nconnect, (unsigned long)nresume,
+	       (unsigned long)nerror);
+	_show_latency(hist, nresp);
+
+	return 0;
+}
+
+static void 
+_sig_stop(int signo)
+{
+	if (signo == SIGINT)
+		_g_stop = 1;
+}
+
+int 
+main(int argc, char **argv)
+{
+	if (_parse_cmd(argc, argv)) {
+		_usage();
+		return -1;
+	}
+
+	if (_initiate()) {
+		_release();
+		return -1;
+	}
+
+	signal(SIGINT, _sig_stop);
+
+	_do_run();
+
+	_release();
+
+	return 0;
+}
+
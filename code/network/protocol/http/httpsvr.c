@@ -1,11 +1,15 @@
 /**
  *	@file	httpsvr.c
  *
- *	@brief	The simple HTTP server implement.
+ *	@brief	The simple HTTP server implement, each thread has its
+ *		own listen socket(SO_REUSEPORT) and epoll, the clients
+ *		are kept alive and the precomputed response is sent by
+ *		writev() or sendfile().
  *	
  *	@date	2009-07-01
  */
 
+#define	_GNU_SOURCE
 
 #include <unistd.h>
 #include <stdio.h>
@@ -15,29 +19,50 @@
 #include <getopt.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
-#include "http_protocol.h"
-#include "sock.h"
+#include "http_parse.h"
+
+#define FZ_NAME_MAX	63
+#define FZ_THREAD_MAX	64		/* max worker threads */
+#define FZ_EVENT_MAX	256		/* max events of one epoll_wait */
+#define FZ_RECV_SIZE	16384		/* recv buffer size */
 
 /**
- *	convert IP address(uint32_t) to dot-decimal string
- *	like xxx.xxx.xxx.xxx 
+ *	The client connection, the requests are parsed in stream
+ *	and each finished request is responded in order.
  */
-#ifndef NIPQUAD
-#define NIPQUAD(addr) \
-        ((unsigned char *)&addr)[0], \
-        ((unsigned char *)&addr)[1], \
-        ((unsigned char *)&addr)[2], \
-        ((unsigned char *)&addr)[3]
-#define NIPQUAD_FMT "%u.%u.%u.%u"
-#endif
+typedef struct _conn {
+	int		fd;		/* client socket */
+	int		events;		/* epoll events */
+	int		nreq;		/* requests not responded */
+	int		close;		/* close after responded */
+	size_t		off;		/* sent bytes of current response */
+	http_info_t	info;		/* request parser */
+} _conn_t;
 
-#define FZ_NAME_MAX	63
+/**
+ *	The worker thread.
+ */
+typedef struct _worker {
+	pthread_t	tid;		/* thread id */
+	int		index;		/* thread index */
+	int		listen_fd;	/* listen socket */
+	int		epoll_fd;	/* epoll fd */
+	u_int64_t	nconn;		/* accepted connections */
+	u_int64_t	nresp;		/* sent responses */
+	u_int64_t	nbytes;		/* sent bytes */
+} _worker_t;
 
 static u_int32_t	_g_svr_ip = 0;		/* Listen IP */
 static u_int16_t	_g_svr_port = 8080;	/* Listen port */
@@ -47,12 +72,14 @@ static char		_g_body_file[FZ_NAME_MAX + 1];	/* body file */
 static char		*_g_head;		/* HTTP header buffer */
 static int		_g_hlen;		/* HTTP header length */
 static int		_g_head_len;		/* HTTP header buffer length */
-static char		*_g_body;		/* HTTP body buffer */
-static int		_g_blen;		/* HTTP body length */
-static int		_g_body_len;		/* HTTP body buffer length */
-static int		_g_http_ver;		/* HTTP version */
-static int		_g_listen_fd = -1;	/* listen socket fd */
-static int		_g_stop;
+static char		*_g_body;		/* in-memory body */
+static int		_g_body_fd = -1;	/* body file for sendfile() */
+static size_t		_g_blen;		/* HTTP body length */
+static size_t		_g_body_size;		/* in-memory body size */
+static int		_g_http_ver = HTTP_VER_11; /* HTTP version */
+static int		_g_nworker = 1;		/* worker thread number */
+static _worker_t	_g_workers[FZ_THREAD_MAX];
+static volatile int	_g_stop;
 
 
 /**
@@ -67,9 +94,11 @@ _usage(void)
 	printf("\t-a\tListen address\n");
 	printf("\t-p\tport address\n");
 	printf("\t-d\tresponse head\n");
-	printf("\t-b\tresponse body\n");
-	printf("\t-v\thttp version: 0 is HTTP/1.0, 1 is HTTP/1.1\n");
+	printf("\t-b\tresponse body file, it's sent by sendfile()\n");
+	printf("\t-s\tresponse body size, the body is in memory\n");
+	printf("\t-v\thttp version: 0 is HTTP/1.0, 1 is HTTP/1.1(default)\n");
 	printf("\t-r\tresponse code, default 200\n");
+	printf("\t-n\tworker threads, default 1\n");
 	printf("\t-h\tshow help message\n");
 }
 
@@ -82,7 +111,7 @@ static int
 _parse_cmd(int argc, char **argv)
 {
 	char opt;
-	char optstr[] = ":a:p:v:d:b:r:h";
+	char optstr[] = ":a:p:v:d:b:s:r:n:h";
 	int port;
 
 	opterr = 0;
@@ -123,10 +152,27 @@ _parse_cmd(int argc, char **argv)
 			strncpy(_g_body_file, optarg, FZ_NAME_MAX);
 			break;
 
+		case 's':
+			_g_body_size = strtoul(optarg, NULL, 10);
+			if (_g_body_size < 1) {
+				printf("body size %s is invalid\n", optarg);
+				return -1;
+			}
+			break;
+
 		case 'r':
 			_g_ret_code = atoi(optarg);
 			break;
 
+		case 'n':
+			_g_nworker = atoi(optarg);
+			if (_g_nworker < 1 || _g_nworker > FZ_THREAD_MAX) {
+				printf("threads %s out of range(1 - %d)\n",
+				       optarg, FZ_THREAD_MAX);
+				return -1;
+			}
+			break;
+
 		case 'h':		       
 			return -1;
 
@@ -143,6 +189,11 @@ _parse_cmd(int argc, char **argv)
 	if (argc != optind)
 		return -1;
 
+	if (_g_body_size && strlen(_g_body_file) > 0) {
+		printf("the body file and body size can't used together\n");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -155,6 +206,7 @@ static void _sig_stop(int signo)
 	}
 }
 
+
 /**
  *	Return HTTP reponse status code description.
  */
@@ -244,9 +296,9 @@ _create_http_response_line(size_t hlen)
 	char retcode[64] = {0};
 
 	if (_g_http_ver == HTTP_VER_11)
-		strncat(_g_head, "HTTP/1.1 ", hlen - 1);
+		strncat(_g_head, "HTTP/1.1", hlen - 1);
 	else 
-		strncat(_g_head, "HTTP/1.0 ", hlen - 1);
+		strncat(_g_head, "HTTP/1.0", hlen - 1);
 
 	snprintf(retcode, 63, " %d %s", _g_ret_code, 
 		 _get_res_reason(_g_ret_code) );
@@ -293,13 +345,15 @@ _filter_head_file(char *buf, char d)
 }
 
 /**
- *	Create HTTP header into @_g_head.
+ *	Create HTTP header into @_g_head, it's created once and
+ *	sent for each response.
  *
  *	Return 0 if success, -1 on error.
  */
 static int 
 _create_http_head(char *buf, size_t len)
 {
+	char line[128];
 	int hlen = 0;
 
 	if (buf && len > 0) {
@@ -333,14 +387,13 @@ _create_http_head(char *buf, size_t len)
 
 	strncat(_g_head, "Content-Type: text/html\r\n", hlen - 1);
 
-	/* add content-length */
-#if 0
-	if (_g_body && _g_http_ver == HTTP_VER_11) {
-		char clen[128] = {0};
-		snprintf(clen, 127, "Content-Length: %d\r\n", _g_blen);
-		strncat(_g_head, clen, hlen - 1);		
-	}
-#endif
+	/* the client find response end by content-length in keep-alive */
+	snprintf(line, sizeof(line), "Content-Length: %lu\r\n",
+		 (unsigned long)_g_blen);
+	strncat(_g_head, line, hlen - 1);
+
+	if (_g_http_ver == HTTP_VER_10)
+		strncat(_g_head, "Connection: close\r\n", hlen - 1);
 
 	/* Add head/body split line */
 	strncat(_g_head, "\r\n", hlen - 1);
@@ -350,6 +403,48 @@ _create_http_head(char *buf, size_t len)
 	return 0;
 }
 
+/**
+ *	Create the listen socket of one worker, the SO_REUSEPORT
+ *	is set so the kernel balances clients to workers.
+ *
+ *	Return the socket fd if success, -1 on error.
+ */
+static int 
+_create_listen(void)
+{
+	struct sockaddr_in addr;
+	int on = 1;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		printf("create socket failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ||
+	    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)))
+	{
+		printf("set SO_REUSEPORT failed: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = _g_svr_ip;
+	addr.sin_port = htons(_g_svr_port);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(fd, 1024))
+	{
+		printf("listen %s:%u failed: %s\n", inet_ntoa(addr.sin_addr),
+		       _g_svr_port, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
 
 /**
  *	Init some global resource used in program.	
@@ -359,43 +454,42 @@ _create_http_head(char *buf, size_t len)
 static int 
 _initiate(void)
 {
-	int fd;
+	struct epoll_event ev;
 	struct stat st;
+	_worker_t *w;
+	int fd;
 	int len;
+	int i;
 
-	/* read body file */
+	/* the body file is sent by sendfile(), not read */
 	if (strlen(_g_body_file) > 0) {
-		fd = open(_g_body_file, O_RDONLY);
-		if (fd < 0) {
+		_g_body_fd = open(_g_body_file, O_RDONLY);
+		if (_g_body_fd < 0) {
 			printf("open body file %s failed\n", _g_body_file);
 			return -1;
 		}
 
-		if (fstat(fd, &st)) {
+		if (fstat(_g_body_fd, &st)) {
 			printf("stat body file %s failed\n", _g_body_file);
-			close(fd);
 			return -1;
 		}
 
-		len = st.st_size;
-		_g_body_len = len + 1;
-		_g_body = malloc(len + 1);		
+		_g_blen = st.st_size;
+	}
+	/* the synthetic body is in memory */
+	else if (_g_body_size > 0) {
+		_g_body = malloc(_g_body_size);
 		if (!_g_body) {
-			printf("malloc memory for body(%d) failed\n", len);
-			close(fd);
-			return -1;
-		}
-
-		if (read(fd, _g_body, len) != len) {
-			printf("read body file %s failed\n", _g_body_file);
-			close(fd);
+			printf("malloc memory for body(%lu) failed\n",
+			       (unsigned long)_g_body_size);
 			return -1;
 		}
 
-		_g_body[len] = 0;
-		_g_blen = len;
-		close(fd);
+		for (i = 0; i < (int)_g_body_size; i++)
+			_g_body[i] = 'a' + i % 26;
+		_g_blen = _g_body_size;
 	}
+
 	/* read head file */
 	if (strlen(_g_head_file) > 0) {
 		char *buf = NULL;
@@ -437,12 +531,36 @@ _initiate(void)
 		_create_http_head(NULL, 0);
 	}
 
-	signal(SIGINT, _sig_stop);
-	
-	_g_listen_fd = sock_tcpsvr(_g_svr_ip, htons(_g_svr_port));
-	if (_g_listen_fd < 0)
+	if (!_g_head)
 		return -1;
 
+	signal(SIGINT, _sig_stop);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < _g_nworker; i++) {
+		w = &_g_workers[i];
+		w->index = i;
+
+		w->listen_fd = _create_listen();
+		if (w->listen_fd < 0)
+			return -1;
+
+		w->epoll_fd = epoll_create1(0);
+		if (w->epoll_fd < 0) {
+			printf("create epoll failed: %s\n", strerror(errno));
+			return -1;
+		}
+
+		/* the listen socket have NULL data */
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->listen_fd, &ev)) {
+			printf("add listen fd failed: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
@@ -455,6 +573,9 @@ _initiate(void)
 static void 
 _release(void)
 {
+	_worker_t *w;
+	int i;
+
 	if (_g_head) {
 		free(_g_head);
 		_g_hlen = 0;
@@ -463,152 +584,358 @@ _release(void)
 
 	if (_g_body) {
 		free(_g_body);
-		_g_blen = 0;
-		_g_body_len = 0;
+		_g_body = NULL;
 	}
 
-	if (_g_listen_fd >= 0) {
-		close(_g_listen_fd);
-		_g_listen_fd = -1;
+	if (_g_body_fd >= 0) {
+		close(_g_body_fd);
+		_g_body_fd = -1;
+	}
+	_g_blen = 0;
+
+	for (i = 0; i < _g_nworker; i++) {
+		w = &_g_workers[i];
+		if (w->listen_fd > 0)
+			close(w->listen_fd);
+		if (w->epoll_fd > 0)
+			close(w->epoll_fd);
+		w->listen_fd = -1;
+		w->epoll_fd = -1;
 	}
 }
 
+/**
+ *	Close the client connection @c and free it.
+ *
+ *	No return.
+ */
+static void 
+_conn_free(_conn_t *c)
+{
+	close(c->fd);
+	http_free_info(&c->info);
+	free(c);
+}
+
+/**
+ *	Set epoll events of connection @c to @events.
+ *
+ *	Return 0 if success, -1 on error.
+ */
 static int 
-_do_recv(int fd)
+_conn_events(_worker_t *w, _conn_t *c, int events)
 {
-	char buf[1024] = {0};
-	int m, total = 0;
-	int retries = 0;
-	http_info_t info;	
-
-	memset(&info, 0, sizeof(info));
-
-	do {
-		m = recv(fd, buf, 1023, MSG_DONTWAIT);
-		if (m < 0) {
-			if (errno == EAGAIN) {
-				sleep(1);
-				retries++;
-				continue;
-			}
-			if (errno == EINTR)
-				break;
+	struct epoll_event ev;
+
+	if (c->events == events)
+		return 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = c;
+	if (epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev))
+		return -1;
 
-			printf("recv client failed\n");
+	c->events = events;
+	return 0;
+}
 
+/**
+ *	Recv requests of connection @c until no data, the requests
+ *	are parsed in stream and pipelined requests are counted.
+ *
+ *	Return 0 if success, -1 if closed or error.
+ */
+static int 
+_do_recv(_conn_t *c)
+{
+	char buf[FZ_RECV_SIZE];
+	ssize_t n;
+	size_t pos;
+	int ret;
+
+	for (;;) {
+		n = recv(c->fd, buf, sizeof(buf), 0);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			if (errno == EINTR)
+				continue;
 			return -1;
 		}
-		if (m == 0) {
-			printf("\nrecv client closed\n");
-			return 0;
-		}
-		
-		if (http_parse_request(&info, buf, m, 0)) {
-			printf("parse request failed\n");
+		if (n == 0)
 			return -1;
-		}
-		
-		if (info.state.mstate == HTTP_STE_FIN) {
-			printf("request finished:\n%s\n", buf);
-			return 0;
-		}
 
-		buf[m] = 0;
-		total += m;
-		retries++;
+		pos = 0;
+		while (pos < (size_t)n) {
+			ret = http_parse(&c->info, HTTP_DIR_REQUEST,
+					 buf + pos, n - pos);
+			if (ret < 0) {
+				printf("parse request failed: %d\n",
+				       http_get_error(&c->info,
+						      HTTP_DIR_REQUEST));
+				return -1;
+			}
+
+			/* the request may finish at end of @buf */
+			if (ret == 0 &&
+			    http_get_int(&c->info, HTTP_DIR_REQUEST,
+					 HTTP_INT_STATE) != HTTP_STE_FIN)
+				break;
 
-		printf("request non-fin(%d):\n%s\n", info.state.mstate, buf);
+			c->nreq++;
+			if (_g_http_ver == HTTP_VER_10 ||
+			    http_get_int(&c->info, HTTP_DIR_REQUEST,
+					 HTTP_INT_VER) == HTTP_VER_10)
+				c->close = 1;
 
-	} while (retries < 2);
+			pos = n - ret;
+		}
+	}
 
 	return 0;
 }
 
+/**
+ *	Send the responses of finished requests in @c, the header
+ *	and in-memory body are sent by writev(), the body file is
+ *	sent by sendfile() after the header.
+ *
+ *	Return 0 if all sent, 1 if socket is full, -1 on error.
+ */
 static int 
-_do_send(int fd)
+_do_send(_worker_t *w, _conn_t *c)
 {
-	int ret = 0;
+	struct iovec iov[2];
+	size_t total;
+	off_t boff;
+	ssize_t n;
+	int niov;
+
+	total = _g_hlen + _g_blen;
+	while (c->nreq > 0) {
+
+		if (c->off < (size_t)_g_hlen) {
+			iov[0].iov_base = _g_head + c->off;
+			iov[0].iov_len = _g_hlen - c->off;
+			niov = 1;
+			if (_g_body) {
+				iov[1].iov_base = _g_body;
+				iov[1].iov_len = _g_blen;
+				niov = 2;
+			}
 
-# if 0
-	char *buf = NULL;
-	int len;
+			if (_g_body_fd >= 0)
+				n = send(c->fd, iov[0].iov_base,
+					 iov[0].iov_len, MSG_MORE);
+			else
+				n = writev(c->fd, iov, niov);
+		}
+		else if (_g_body) {
+			n = send(c->fd, _g_body + c->off - _g_hlen,
+				 total - c->off, 0);
+		}
+		else {
+			boff = c->off - _g_hlen;
+			n = sendfile(c->fd, _g_body_fd, &boff, total - c->off);
+			if (n == 0) {
+				printf("body file %s is truncated\n",
+				       _g_body_file);
+				return -1;
+			}
+		}
 
-	len = _g_hlen + _g_blen;
-	buf = malloc(len + 1);
-	if (!buf)
-		return -1;
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 1;
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
 
-	if (_g_head)
-		memcpy(buf, _g_head, _g_hlen);
+		c->off += n;
+		w->nbytes += n;
+		if (c->off < total)
+			continue;
 
-	if (_g_body)
-		memcpy(buf + _g_hlen, _g_body, _g_blen);
+		c->off = 0;
+		c->nreq--;
+		w->nresp++;
+	}
 
-	buf[len] = 0;
+	return 0;
+}
 
-	if (_send_fin(fd, buf, len) < 0)
-		return -1;
-#endif
-	
-	if (_g_head) {
-		ret = sock_send(fd, _g_head, _g_hlen);
-		if (ret < 0) {
-			printf("send header failed\n");
-			return -1;
+/**
+ *	Accept all pending clients of worker @w and add them into
+ *	epoll.
+ *
+ *	No return.
+ */
+static void 
+_do_accept(_worker_t *w)
+{
+	struct epoll_event ev;
+	_conn_t *c;
+	int on = 1;
+	int fd;
+
+	for (;;) {
+		fd = accept4(w->listen_fd, NULL, NULL, SOCK_NONBLOCK);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				printf("accept failed: %s\n", strerror(errno));
+			return;
 		}
-		printf("send header (%d): \n%s\n", _g_hlen,  _g_head);
-	}
-	
-	sleep(2);
 
-	if (_g_body) {
-		ret = sock_send(fd, _g_body, _g_blen);
-		if (ret < 0) {
-			printf("send body failed\n");
-			return -1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+		c = calloc(1, sizeof(*c));
+		if (!c) {
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		c->events = EPOLLIN;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = c->events;
+		ev.data.ptr = c;
+		if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+			_conn_free(c);
+			continue;
 		}
-		printf("send body (%d): \n%s\n", _g_blen,  _g_body);
-	}	
 
-	return 0;
+		w->nconn++;
+	}
 }
 
+/**
+ *	Process the event @events of connection @c, the responses
+ *	are sent after all arrived requests are parsed.
+ *
+ *	Return 0 if success, -1 if @c is closed.
+ */
 static int 
-_do_process(int clifd)
+_do_process(_worker_t *w, _conn_t *c, int events)
 {
-	_do_recv(clifd);
-	_do_send(clifd);
-	
-	close(clifd);
-	printf("closed clifd\n");
+	int ret;
 
-	return 0;
+	if ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && _do_recv(c))
+		return -1;
+
+	ret = _do_send(w, c);
+	if (ret < 0)
+		return -1;
+
+	/* wait socket writable if it's full */
+	if (ret > 0)
+		return _conn_events(w, c, EPOLLIN | EPOLLOUT);
+
+	if (c->close)
+		return -1;
+
+	return _conn_events(w, c, EPOLLIN);
 }
 
-static int 
-_do_accept(void)
+/**
+ *	The worker thread main loop, the connections of @arg are
+ *	freed when stopped.
+ *
+ *	Return NULL always.
+ */
+static void * 
+_do_loop(void *arg)
 {
-	int clifd = -1;
-	u_int32_t ip = 0;
-	u_int16_t port = 0;
+	struct epoll_event evs[FZ_EVENT_MAX];
+	_worker_t *w = arg;
+	_conn_t *c;
+	int n, i;
 
-	clifd = sock_accept(_g_listen_fd, &ip, &port);
-	if (clifd >= 0) {
-		printf("accept %u.%u.%u.%u:%u\n", NIPQUAD(ip), ntohs(port));
+	while (!_g_stop) {
+		n = epoll_wait(w->epoll_fd, evs, FZ_EVENT_MAX, 100);
+		for (i = 0; i < n; i++) {
+			c = evs[i].data.ptr;
+			if (!c) {
+				_do_accept(w);
+				continue;
+			}
 
-		_do_process(clifd);
+			if (_do_process(w, c, evs[i].events)) {
+				epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL,
+					  c->fd, NULL);
+				_conn_free(c);
+			}
+		}
 	}
-	
-	return 0;
+
+	return NULL;
 }
 
+static u_int64_t 
+_walltime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *	Run the workers until stopped and show the statistics.
+ *
+ *	Return 0 if success, -1 on error.
+ */
 static int 
-_do_loop(void)
+_do_run(void)
 {
-	while (!_g_stop) {
-		_do_accept();
+	u_int64_t begin, end;
+	u_int64_t nconn = 0, nresp = 0, nbytes = 0;
+	_worker_t *w;
+	double sec;
+	int i;
+
+	printf("listen %u.%u.%u.%u:%u, %d threads, %d bytes header, "
+	       "%lu bytes body(%s)\n",
+	       ((unsigned char *)&_g_svr_ip)[0],
+	       ((unsigned char *)&_g_svr_ip)[1],
+	       ((unsigned char *)&_g_svr_ip)[2],
+	       ((unsigned char *)&_g_svr_ip)[3],
+	       _g_svr_port, _g_nworker, _g_hlen, (unsigned long)_g_blen,
+	       _g_body_fd >= 0 ? "sendfile" : "memory");
+
+	begin = _walltime();
+	for (i = 0; i < _g_nworker; i++) {
+		w = &_g_workers[i];
+		if (pthread_create(&w->tid, NULL, _do_loop, w)) {
+			printf("create thread %d failed\n", i);
+			_g_stop = 1;
+			break;
+		}
 	}
 
+	while (--i >= 0)
+		pthread_join(_g_workers[i].tid, NULL);
+	end = _walltime();
+
+	sec = (end - begin) / 1000000000.0;
+	for (i = 0; i < _g_nworker; i++) {
+		w = &_g_workers[i];
+		printf("thread %d: %lu connections, %lu responses, "
+		       "%lu bytes\n", i, (unsigned long)w->nconn,
+		       (unsigned long)w->nresp, (unsigned long)w->nbytes);
+		nconn += w->nconn;
+		nresp += w->nresp;
+		nbytes += w->nbytes;
+	}
+
+	printf("total: %lu connections, %lu responses in %.2f seconds, "
+	       "%.0f resp/s, %.1f MB/s\n", (unsigned long)nconn,
+	       (unsigned long)nresp, sec, nresp / sec,
+	       nbytes / sec / 1000000.0);
+
 	return 0;
 }
 
@@ -627,10 +954,11 @@ main(int argc, char **argv)
 	}
 
 	if (_initiate()) {
+		_release();
 		return -1;
 	}
 
-	_do_loop();
+	_do_run();
 
 	_release();
 
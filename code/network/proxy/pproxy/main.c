@@ -19,15 +19,24 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <time.h>
+#include <assert.h>
 
 #include "debug.h"
 #include "childproc.h"
 #include "proxy.h"
+#include "shmstat.h"
+#include "sock_util.h"
 
 static proxy_arg_t	_g_arg;		/* the proxy argument */
 static cproc_t		_g_workers[MAX_WORKER];	/* child processes */
 static int		_g_nworker;	/* the number of child process */
 static int		_g_stop;	/* the stop signal */
+static shmstat_t	*_g_shmstat;	/* the shared statistic */
+static int		_g_interval;	/* statistic summary interval */
+static char		*_g_statpath;	/* statistic query socket path */
+static int		_g_statfd = -1;	/* statistic query socket */
 
 static void 
 _usage(void)
@@ -43,6 +52,8 @@ _usage(void)
 	printf("\t-d <0-4>\tthe debug level<0-4>, 0 is disabled\n");
 	printf("\t-s\t\tuse splice\n");
 	printf("\t-n\t\tuse nb_splice\n");
+	printf("\t-i <N>\t\tprint statistic summary every N seconds\n");
+	printf("\t-u <path>\tstatistic query unix socket path\n");
 	printf("\t-h\t\tshow help usage\n");
 }
 
@@ -126,7 +137,7 @@ static int
 _parse_cmd(int argc, char **argv)
 {
 	char c;
-	char optstr[] = ":p:m:w:b:r:d:snh";
+	char optstr[] = ":p:m:w:b:r:d:i:u:snh";
 	char *addr;
 
 	opterr = 0;
@@ -196,6 +207,19 @@ _parse_cmd(int argc, char **argv)
 			}
 			break;
 
+		case 'i':
+			_g_interval = atoi(optarg);
+			if (_g_interval < 1) {
+				printf("invalid statistic interval: %s\n", 
+				       optarg);
+				return -1;
+			}
+			break;
+
+		case 'u':
+			_g_statpath = optarg;
+			break;
+
 		case 's':
 			_g_arg.use_splice = 1;
 			break;
@@ -269,17 +293,59 @@ _initiate(void)
 	/* set stop signal */
 	signal(SIGINT, _sig_stop);
 	signal(SIGCHLD, SIG_IGN);
+	signal(SIGPIPE, SIG_IGN);
+
+	/* alloc shared statistic before fork child */
+	_g_shmstat = shmstat_alloc(_g_nworker);
+	if (!_g_shmstat) {
+		ERR("alloc shared statistic failed\n");
+		return -1;
+	}
+	DBG("alloc shared statistic %d slots(%lu bytes)\n", 
+	    _g_nworker, _g_shmstat->size);
+
+	/* create statistic query socket */
+	if (_g_statpath) {
+		_g_statfd = sk_unix_server(_g_statpath, SOCK_STREAM);
+		if (_g_statfd < 0) {
+			ERR("create statistic socket %s failed\n", 
+			    _g_statpath);
+			return -1;
+		}
+		DBG("statistic query socket %s\n", _g_statpath);
+	}
 
 	return 0;
 }
 
+static void 
+_release(void)
+{
+	if (_g_statfd >= 0) {
+		close(_g_statfd);
+		unlink(_g_statpath);
+		_g_statfd = -1;
+	}
+
+	if (_g_shmstat) {
+		shmstat_free(_g_shmstat);
+		_g_shmstat = NULL;
+	}
+}
+
 static int 
 _create_workers(void)
 {
 	int i;
 
+	shmstat_slot_t *slot;
+
 	for (i = 0; i < _g_nworker; i++) {
+		slot = shmstat_slot(_g_shmstat, i);
+		assert(slot);
 		_g_arg.index = i;
+		_g_arg.stat = &slot->stat;
+		_g_arg.plstat = slot->plstat;
 		cproc_create(&_g_workers[i], &_g_arg);
 	}
 
@@ -299,11 +365,67 @@ _destroy_workers(void)
 	return 0;
 }
 
+/**
+ *	Accept a client from statistic query socket and send 
+ *	the aggregated statistic to it.
+ *
+ *	No return.
+ */
+static void 
+_do_query(void)
+{
+	int fd;
+	int n;
+	char buf[8192];
+
+	fd = accept(_g_statfd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	n = shmstat_print(_g_shmstat, _g_arg.npolicy, buf, sizeof(buf));
+	if (n > 0)
+		sk_send_all(fd, buf, n);
+
+	close(fd);
+}
+
 static int 
 _do_loop(void)
 {
+	int n;
+	time_t last;
+	time_t now;
+	struct pollfd pfd;
+	char buf[8192];
+
+	last = time(NULL);
+	pfd.fd = _g_statfd;
+	pfd.events = POLLIN;
+
 	while (!_g_stop) {
-		sleep(1);
+		
+		/* wait query or 1 second */
+		pfd.revents = 0;
+		if (_g_statfd >= 0) {
+			if (poll(&pfd, 1, 1000) > 0 && (pfd.revents & POLLIN))
+				_do_query();
+		}
+		else
+			sleep(1);
+
+		if (_g_interval < 1)
+			continue;
+
+		/* print periodic summary */
+		now = time(NULL);
+		if (now - last < _g_interval)
+			continue;
+		last = now;
+
+		n = shmstat_print(_g_shmstat, _g_arg.npolicy, 
+				  buf, sizeof(buf));
+		if (n > 0)
+			printf("%s", buf);
 	}
 	
 	return 0;
@@ -316,8 +438,10 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-	if (_initiate())
+	if (_initiate()) {
+		_release();
 		return -1;
+	}
 
 	_create_workers();
 
@@ -325,6 +449,8 @@ int main(int argc, char **argv)
 
 	_destroy_workers();
 
+	_release();
+
 	return 0;
 }
 
@@ -159,22 +159,22 @@ _proxy_stat(proxy_t *py)
 {
 
 	printf("\n-------proxy statistic---------\n");
-	printf("nhttp:        %lu\n", py->stat.nhttp);
-	printf("nhttps:       %lu\n", py->stat.nhttps);
-	printf("naccept:      %lu\n", py->stat.naccept);
-	printf("nhttplive:    %lu\n", py->stat.nhttplive);
-	printf("nhttpslive:   %lu\n", py->stat.nhttpslive);
-	printf("nlive:        %lu\n", py->stat.nlive);
+	printf("nhttp:        %lu\n", py->stat->nhttp);
+	printf("nhttps:       %lu\n", py->stat->nhttps);
+	printf("naccept:      %lu\n", py->stat->naccept);
+	printf("nhttplive:    %lu\n", py->stat->nhttplive);
+	printf("nhttpslive:   %lu\n", py->stat->nhttpslive);
+	printf("nlive:        %lu\n", py->stat->nlive);
 	printf("--------------------------------------\n");
-	printf("nclirecvs:    %lu\n", py->stat.nclirecv);
-	printf("nclisends:    %lu\n", py->stat.nclisend);
-	printf("nsvrrecvs:    %lu\n", py->stat.nsvrrecv);
-	printf("nsvrsends:    %lu\n", py->stat.nsvrsend);
+	printf("nclirecvs:    %lu\n", py->stat->nclirecv);
+	printf("nclisends:    %lu\n", py->stat->nclisend);
+	printf("nsvrrecvs:    %lu\n", py->stat->nsvrrecv);
+	printf("nsvrsends:    %lu\n", py->stat->nsvrsend);
 	printf("--------------------------------------\n");
-	printf("nclicloses:   %lu\n", py->stat.ncliclose);
-	printf("nsvrcloses:   %lu\n", py->stat.nsvrclose);
-	printf("nclierrors:   %lu\n", py->stat.nclierror);
-	printf("nsvrerrors:   %lu\n", py->stat.nsvrerror);
+	printf("nclicloses:   %lu\n", py->stat->ncliclose);
+	printf("nsvrcloses:   %lu\n", py->stat->nsvrclose);
+	printf("nclierrors:   %lu\n", py->stat->nclierror);
+	printf("nsvrerrors:   %lu\n", py->stat->nsvrerror);
 	printf("-------------------------------\n");
 }
 
@@ -192,7 +192,7 @@ proxy_main(proxy_arg_t *arg)
 	char ipstr[IP_STR_LEN];
 	int i, j;
 
-	if (!arg)
+	if (!arg || !arg->stat || !arg->plstat)
 		return -1;
 	
 	py = &g_proxy;
@@ -207,6 +207,8 @@ proxy_main(proxy_arg_t *arg)
 	py->bind_cpu = arg->bind_cpu;
 	py->bind_cpu_algo = arg->bind_cpu_algo;
 	py->bind_cpu_ht = arg->bind_cpu_ht;
+	py->stat = arg->stat;
+	py->plstat = arg->plstat;
 	g_dbglvl = arg->dbglvl;
 
 	for (i = 0; i < arg->npolicy; i++) {
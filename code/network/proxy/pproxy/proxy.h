@@ -42,6 +42,16 @@ typedef struct proxy_stat {
 	u_int64_t       nsvrerror;      /* server error times */
 } proxy_stat_t;
 
+/**
+ *	The policy statistic.
+ */
+typedef struct policy_stat {
+	u_int64_t	naccept;	/* total session number */
+	u_int64_t	nlive;		/* live session number */
+	u_int64_t	nclirecv;	/* recv client bytes */
+	u_int64_t	nsvrrecv;	/* recv server bytes */
+	u_int64_t	nerror;		/* error times */
+} policy_stat_t;
 
 typedef struct policy {
 	int		index;		/* policy index */
@@ -91,7 +101,8 @@ typedef struct proxy {
 	int		bind_cpu_ht;
 
 	int		stop;
-	proxy_stat_t	stat;
+	proxy_stat_t	*stat;		/* statistic in shared slot */
+	policy_stat_t	*plstat;	/* policy statistic in shared slot */
 } proxy_t;
 
 typedef struct	proxy_arg {
@@ -111,6 +122,8 @@ typedef struct	proxy_arg {
 	int		bind_cpu_algo;
 	int		bind_cpu_ht;
 
+	proxy_stat_t	*stat;		/* statistic in shared slot */
+	policy_stat_t	*plstat;	/* policy statistic in shared slot */
 } proxy_arg_t;
 
 extern	proxy_t		g_proxy;
@@ -0,0 +1,194 @@
+/**
+ *	@file	shmstat.c
+ *
+ *	@brief	Shared statistic APIs implement.
+ *	
+ *	@author	Forrest.zhang	
+ *
+ *	@date
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "debug.h"
+#include "shmstat.h"
+
+#define	_SS_SUM(d, s, f)	((d)->f += (s)->f)
+
+shmstat_t * 
+shmstat_alloc(int nslot)
+{
+	shmstat_t *ss;
+	void *ptr;
+
+	if (nslot < 1) {
+		ERR("invalid argument\n");
+		return NULL;
+	}
+
+	ss = calloc(1, sizeof(*ss));
+	if (!ss) {
+		ERR("calloc memory for shmstat failed: %s\n", ERRSTR);
+		return NULL;
+	}
+
+	/* mmap is page aligned, so each slot is cache line aligned */
+	ss->size = nslot * sizeof(shmstat_slot_t);
+	ptr = mmap(NULL, ss->size, PROT_READ | PROT_WRITE, 
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED) {
+		ERR("mmap %lu bytes failed: %s\n", ss->size, ERRSTR);
+		free(ss);
+		return NULL;
+	}
+
+	memset(ptr, 0, ss->size);
+	ss->slots = ptr;
+	ss->nslot = nslot;
+
+	return ss;
+}
+
+int 
+shmstat_free(shmstat_t *ss)
+{
+	if (!ss)
+		return -1;
+
+	if (ss->slots)
+		munmap(ss->slots, ss->size);
+
+	free(ss);
+
+	return 0;
+}
+
+/**
+ *	Add proxy statistic @src into @dst.
+ *
+ *	No return.
+ */
+static void 
+_shmstat_add(proxy_stat_t *dst, const proxy_stat_t *src)
+{
+	_SS_SUM(dst, src, nhttp);
+	_SS_SUM(dst, src, nhttps);
+	_SS_SUM(dst, src, naccept);
+	_SS_SUM(dst, src, nhttplive);
+	_SS_SUM(dst, src, nhttpslive);
+	_SS_SUM(dst, src, nlive);
+	_SS_SUM(dst, src, nclirecv);
+	_SS_SUM(dst, src, nclisend);
+	_SS_SUM(dst, src, nsvrrecv);
+	_SS_SUM(dst, src, nsvrsend);
+	_SS_SUM(dst, src, ncliclose);
+	_SS_SUM(dst, src, nclierror);
+	_SS_SUM(dst, src, nsvrclose);
+	_SS_SUM(dst, src, nsvrerror);
+}
+
+/**
+ *	Add policy statistic @src into @dst.
+ *
+ *	No return.
+ */
+static void 
+_shmstat_add_policy(policy_stat_t *dst, const policy_stat_t *src)
+{
+	_SS_SUM(dst, src, naccept);
+	_SS_SUM(dst, src, nlive);
+	_SS_SUM(dst, src, nclirecv);
+	_SS_SUM(dst, src, nsvrrecv);
+	_SS_SUM(dst, src, nerror);
+}
+
+int 
+shmstat_sum(shmstat_t *ss, proxy_stat_t *stat, 
+	    policy_stat_t *plstat, int npolicy)
+{
+	int i, j;
+	shmstat_slot_t *slot;
+
+	if (!ss || !stat || npolicy < 0 || npolicy > MAX_POLICY)
+		return -1;
+
+	memset(stat, 0, sizeof(*stat));
+	if (plstat)
+		memset(plstat, 0, npolicy * sizeof(*plstat));
+
+	/* the counters is updated by child without lock, 
+	 * 64bit load is atomic so no torn read */
+	for (i = 0; i < ss->nslot; i++) {
+		slot = &ss->slots[i];
+		_shmstat_add(stat, &slot->stat);
+
+		if (!plstat)
+			continue;
+
+		for (j = 0; j < npolicy; j++)
+			_shmstat_add_policy(&plstat[j], &slot->plstat[j]);
+	}
+
+	return 0;
+}
+
+int 
+shmstat_print(shmstat_t *ss, int npolicy, char *buf, size_t len)
+{
+	int i;
+	int n = 0;
+	proxy_stat_t stat;
+	policy_stat_t plstat[MAX_POLICY];
+
+	if (!ss || !buf || len < 1)
+		return -1;
+
+	if (shmstat_sum(ss, &stat, plstat, npolicy))
+		return -1;
+
+#define	_SS_PRINT(fmt, args...)						\
+	if ((size_t)n < len)						\
+		n += snprintf(buf + n, len - n, fmt, ##args)
+
+	_SS_PRINT("\n-------proxy statistic(%d workers)---------\n", 
+		  ss->nslot);
+	_SS_PRINT("nhttp:        %lu\n", stat.nhttp);
+	_SS_PRINT("nhttps:       %lu\n", stat.nhttps);
+	_SS_PRINT("naccept:      %lu\n", stat.naccept);
+	_SS_PRINT("nhttplive:    %lu\n", stat.nhttplive);
+	_SS_PRINT("nhttpslive:   %lu\n", stat.nhttpslive);
+	_SS_PRINT("nlive:        %lu\n", stat.nlive);
+	_SS_PRINT("--------------------------------------\n");
+	_SS_PRINT("nclirecvs:    %lu\n", stat.nclirecv);
+	_SS_PRINT("nclisends:    %lu\n", stat.nclisend);
+	_SS_PRINT("nsvrrecvs:    %lu\n", stat.nsvrrecv);
+	_SS_PRINT("nsvrsends:    %lu\n", stat.nsvrsend);
+	_SS_PRINT("--------------------------------------\n");
+	_SS_PRINT("nclicloses:   %lu\n", stat.ncliclose);
+	_SS_PRINT("nsvrcloses:   %lu\n", stat.nsvrclose);
+	_SS_PRINT("nclierrors:   %lu\n", stat.nclierror);
+	_SS_PRINT("nsvrerrors:   %lu\n", stat.nsvrerror);
+
+	for (i = 0; i < npolicy; i++) {
+		_SS_PRINT("-------policy<%d>---------------------\n", i);
+		_SS_PRINT("naccept:      %lu\n", plstat[i].naccept);
+		_SS_PRINT("nlive:        %lu\n", plstat[i].nlive);
+		_SS_PRINT("nclirecvs:    %lu\n", plstat[i].nclirecv);
+		_SS_PRINT("nsvrrecvs:    %lu\n", plstat[i].nsvrrecv);
+		_SS_PRINT("nerrors:      %lu\n", plstat[i].nerror);
+	}
+	_SS_PRINT("-------------------------------\n");
+
+#undef	_SS_PRINT
+
+	if ((size_t)n >= len)
+		n = len - 1;
+
+	return n;
+}
+
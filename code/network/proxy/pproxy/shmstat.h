@@ -0,0 +1,91 @@
+/**
+ *	@file	shmstat.h
+ *
+ *	@brief	Statistic data shared between parent and child 
+ *		processes in a anonymous shared mapping. Each child 
+ *		process own a cache line aligned slot and update it 
+ *		without lock, parent read all slots and aggregate them.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#ifndef FZ_SHMSTAT_H
+#define FZ_SHMSTAT_H
+
+#include <sys/types.h>
+
+#include "gcc_common.h"
+#include "proxy.h"
+
+/**
+ *	The statistic slot of one child process, only the child 
+ *	write it.
+ */
+typedef struct shmstat_slot {
+	proxy_stat_t	stat;		/* proxy statistic */
+	policy_stat_t	plstat[MAX_POLICY];/* policy statistic */
+} __cacheline_aligned shmstat_slot_t;
+
+/**
+ *	The shared statistic mapping.
+ */
+typedef struct shmstat {
+	shmstat_slot_t	*slots;		/* slots in shared mapping */
+	int		nslot;		/* number of slots */
+	size_t		size;		/* mapping size */
+} shmstat_t;
+
+/**
+ *	Alloc a shared statistic mapping which have @nslot 
+ *	slots, it must be called before fork child process.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+extern shmstat_t * 
+shmstat_alloc(int nslot);
+
+/**
+ *	Unmap and free shared statistic @ss.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+shmstat_free(shmstat_t *ss);
+
+/**
+ *	Return the slot @index in shared statistic @ss.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+static inline shmstat_slot_t * 
+shmstat_slot(shmstat_t *ss, int index)
+{
+	if (unlikely(!ss || index < 0 || index >= ss->nslot))
+		return NULL;
+
+	return &ss->slots[index];
+}
+
+/**
+ *	Aggregate all slots in @ss into @stat, and first @npolicy 
+ *	policy statistic into @plstat if @plstat is not NULL.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+shmstat_sum(shmstat_t *ss, proxy_stat_t *stat, 
+	    policy_stat_t *plstat, int npolicy);
+
+/**
+ *	Print the aggregated statistic of @ss into buffer @buf 
+ *	which size is @len, only first @npolicy policy is printed.
+ *
+ *	Return the string length if success, -1 on error.
+ */
+extern int 
+shmstat_print(shmstat_t *ss, int npolicy, char *buf, size_t len);
+
+#endif /* end of FZ_SHMSTAT_H */
+
@@ -282,8 +282,9 @@ _worker_free_session(session_t *s, session_data_t *sd)
 
 	objpool_put(s);
 
-	g_proxy.stat.nhttplive--;
-	g_proxy.stat.nlive--;
+	g_proxy.stat->nhttplive--;
+	g_proxy.stat->nlive--;
+	g_proxy.plstat[pl->index].nlive--;
 }
 
 /**
@@ -339,8 +340,8 @@ _worker_accept_client(int fd, int events, void *arg1, void *arg2)
 		}
 
 		PROXY_LOCK();
-		g_proxy.stat.naccept++;
-		nlive = g_proxy.stat.nlive;
+		g_proxy.stat->naccept++;
+		nlive = g_proxy.stat->nlive;
 		PROXY_UNLOCK();
 
 		/* check exceed max connection */
@@ -401,9 +402,11 @@ _worker_accept_client(int fd, int events, void *arg1, void *arg2)
 
 		/* update proxy statistic */
 		PROXY_LOCK();
-		g_proxy.stat.nhttp++;
-		g_proxy.stat.nhttplive++;
-		g_proxy.stat.nlive++;
+		g_proxy.stat->nhttp++;
+		g_proxy.stat->nhttplive++;
+		g_proxy.stat->nlive++;
+		g_proxy.plstat[pl->index].naccept++;
+		g_proxy.plstat[pl->index].nlive++;
 		PROXY_UNLOCK();
 	}
 
@@ -609,7 +612,7 @@ _worker_recv_data(int fd, int events, void *arg1, void *arg2)
 		WFLOW(1, "%s %d recv error\n", sd->side, fd);
 		//ERR("recv data epoll error\n");
 		ret = -1;
-		goto out_free;
+		goto out_error;
 	}
 
 	pkt = CBLIST_GET_TAIL(&sd->in, packet_t *, list);
@@ -637,14 +640,28 @@ _worker_recv_data(int fd, int events, void *arg1, void *arg2)
 		WFLOW(1, "%s %d recv error\n", sd->side, fd);
 		ERR("recv data error\n");
 		ret = -1;
-		goto out_free;
+		goto out_error;
 	}
 
 	pkt->len = n;
 
+	/* update statistic */
+	if (sd == &s->clidata) {
+		g_proxy.stat->nclirecv += n;
+		g_proxy.plstat[pl->index].nclirecv += n;
+	}
+	else {
+		g_proxy.stat->nsvrrecv += n;
+		g_proxy.plstat[pl->index].nsvrrecv += n;
+	}
+
 	if (closed || events & EPOLLRDHUP) {
 		WFLOW(1, "%s %d recv read shutdown, events %d\n", 
 		      sd->side, fd, events);
+		if (sd == &s->clidata)
+			g_proxy.stat->ncliclose++;
+		else
+			g_proxy.stat->nsvrclose++;
 		sd->flags |= SESSION_SHUTRD;
 		if (unlikely(fd_epoll_alloc_update(wi->fe, fd, 0, NULL))) {
 			ERR("alloc events failed\n");
@@ -668,6 +685,14 @@ _worker_recv_data(int fd, int events, void *arg1, void *arg2)
 
 	return n;
 
+out_error:
+
+	if (sd == &s->clidata)
+		g_proxy.stat->nclierror++;
+	else
+		g_proxy.stat->nsvrerror++;
+	g_proxy.plstat[pl->index].nerror++;
+
 out_free:
 
 	/* delete session */
@@ -729,12 +754,22 @@ _worker_send_data(int fd, int events, void *arg1, void *arg2)
 		n = sk_send(fd, ptr, len);
 		if (unlikely(n < 0)) {
 			ERR("%d send %lu bytes error\n", fd, len);
+			if (sd == &s->clidata)
+				g_proxy.stat->nclierror++;
+			else
+				g_proxy.stat->nsvrerror++;
+			g_proxy.plstat[pl->index].nerror++;
 			goto out_failed;
 		}
 
 		pkt->sendpos += n;
 		total += n;
 
+		if (sd == &s->clidata)
+			g_proxy.stat->nclisend += n;
+		else
+			g_proxy.stat->nsvrsend += n;
+
 		/* send blocked, add it to event */
 		if (unlikely(n != (int)len)) {
 			sd->flags |= SESSION_BLOCKED;
@@ -0,0 +1 @@
+../../protocol/http/http_buffer.h
\ No newline at end of file
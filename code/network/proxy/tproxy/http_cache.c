@@ -0,0 +1 @@
+../utils/http_cache.c
\ No newline at end of file
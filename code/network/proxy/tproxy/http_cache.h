@@ -0,0 +1 @@
+../utils/http_cache.h
\ No newline at end of file
@@ -0,0 +1 @@
+../utils/http_cache_test.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../protocol/http/http_hash.h
\ No newline at end of file
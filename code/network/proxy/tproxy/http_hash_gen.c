@@ -0,0 +1 @@
+../../protocol/http/http_hash_gen.c
\ No newline at end of file
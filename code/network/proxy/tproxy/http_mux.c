@@ -0,0 +1 @@
+../utils/http_mux.c
\ No newline at end of file
@@ -0,0 +1 @@
+../utils/http_mux.h
\ No newline at end of file
@@ -0,0 +1 @@
+../utils/http_mux_test.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../protocol/http/http_parse.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../protocol/http/http_parse.h
\ No newline at end of file
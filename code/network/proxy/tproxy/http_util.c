@@ -0,0 +1 @@
+../utils/http_util.c
\ No newline at end of file
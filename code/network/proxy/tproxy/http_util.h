@@ -0,0 +1 @@
+../utils/http_util.h
\ No newline at end of file
@@ -0,0 +1 @@
+../utils/http_zip.c
\ No newline at end of file
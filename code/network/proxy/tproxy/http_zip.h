@@ -0,0 +1 @@
+../utils/http_zip.h
\ No newline at end of file
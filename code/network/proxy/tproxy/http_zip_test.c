@@ -0,0 +1 @@
+../utils/http_zip_test.c
\ No newline at end of file
@@ -60,6 +60,15 @@ _py_init_data(proxy_t *py)
 		DBG(1, "proxy(%s) init data\n", pl->cfg.name);
 	}
 
+	/* alloc HTTP response cache shared by workers */
+	if (py->cfg.cache) {
+		py->data.hc = hcache_alloc((size_t)py->cfg.cache_mem << 20,
+					   (size_t)py->cfg.cache_obj << 10);
+		if (!py->data.hc)
+			ERR_RET(-1, "alloc HTTP cache failed\n");
+		DBG(1, "proxy alloc HTTP cache(%p)\n", py->data.hc);
+	}
+
 #if 0
 	if (pycfg->nb_splice) {
 		py->nb_splice_fd = nb_splice_init();
@@ -89,6 +98,7 @@ static int
 _py_free_data(proxy_t *py)
 {
 	policy_t *pl;
+	char buf[256];
 
 	if (!py)
 		ERR_RET(-1, "invalid data\n");
@@ -103,6 +113,15 @@ _py_free_data(proxy_t *py)
 
 	tp_flush_policies();
 
+	/* free HTTP response cache */
+	if (py->data.hc) {
+		hcache_print(py->data.hc, buf, sizeof(buf));
+		DBG(1, "proxy HTTP cache: %s", buf);
+		hcache_free(py->data.hc);
+		DBG(1, "proxy free HTTP cache(%p)\n", py->data.hc);
+		py->data.hc = NULL;
+	}
+
 	return 0;
 }
 
@@ -177,6 +196,14 @@ proxy_alloc(void)
 	
 	py->cfg.nworker = 1;
 	py->cfg.naccept = 1;
+	py->cfg.zerocopy_min = 16384;
+	py->cfg.compress_level = 6;
+	py->cfg.compress_min = 256;
+	py->cfg.compress_cpu = 50;
+	py->cfg.compress_stream = 64;
+	py->cfg.cache_mem = 256;
+	py->cfg.cache_obj = 1024;
+	py->cfg.mux_conn = 32;
 
 	return py;
 }
@@ -233,6 +260,18 @@ proxy_print(const proxy_t *py)
 	printf("\tnaccept:        %d\n", pycfg->naccept);
 	printf("\tuse_splice:     %d\n", pycfg->use_splice);
 	printf("\tuse_nbsplice:   %d\n", pycfg->use_nbsplice);
+	printf("\tzerocopy:       %d\n", pycfg->zerocopy);
+	printf("\tzerocopy_min:   %d\n", pycfg->zerocopy_min);
+	printf("\tcompress:       %d\n", pycfg->compress);
+	printf("\tcompress_level: %d\n", pycfg->compress_level);
+	printf("\tcompress_min:   %d\n", pycfg->compress_min);
+	printf("\tcompress_cpu:   %d\n", pycfg->compress_cpu);
+	printf("\tcompress_strm:  %d\n", pycfg->compress_stream);
+	printf("\tcache:          %d\n", pycfg->cache);
+	printf("\tcache_mem:      %d\n", pycfg->cache_mem);
+	printf("\tcache_obj:      %d\n", pycfg->cache_obj);
+	printf("\tmux:            %d\n", pycfg->mux);
+	printf("\tmux_conn:       %d\n", pycfg->mux_conn);
 	printf("\tmaxconn:        %d\n", pycfg->maxconn);
 	printf("\tbind_cpu:       %d\n", pycfg->bind_cpu);
 	printf("\tbind_cpu_algo:  %d\n", pycfg->bind_cpu_algo);
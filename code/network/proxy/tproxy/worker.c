@@ -38,6 +38,7 @@
 #include "session.h"
 #include "gcc_common.h"
 #include "policy.h"
+#include "connection.h"
 
 /**
  *	Init work thread, alloc resources.
@@ -97,11 +98,59 @@ _worker_init(thread_t *ti)
 	/* init list */
 	CBLIST_INIT(&wi->lfdlist);
 	CBLIST_INIT(&wi->cmdlist);
+	CBLIST_INIT(&wi->zclist);
 
 	wi->naccept = py->cfg.naccept;
 	DBG(2, "worker[%d] naccept is %d\n", 
 	    ti->index, wi->naccept);
 
+	wi->zerocopy = py->cfg.zerocopy;
+	wi->zcmin = py->cfg.zerocopy_min;
+	DBG(2, "worker[%d] zerocopy %d, zerocopy_min %d\n", 
+	    ti->index, wi->zerocopy, wi->zcmin);
+
+	/* alloc compress context */
+	if (py->cfg.compress) {
+		wi->hz = hzip_ctx_alloc(wi->pktpool, py->cfg.compress_level,
+					py->cfg.compress_min, 
+					py->cfg.compress_cpu,
+					py->cfg.compress_stream);
+		if (!wi->hz) {
+			ERR("alloc compress context failed\n");
+			goto err_free;
+		}
+		DBG(2, "worker[%d] alloc compress context(%p)\n", 
+		    ti->index, wi->hz);
+	}
+
+	/* alloc session cache state pool */
+	if (py->data.hc) {
+		wi->hcpool = objpool_alloc(sizeof(hcache_ssn_t), 64, 0);
+		if (!wi->hcpool) {
+			ERR("objpool_alloc for hcpool failed\n");
+			goto err_free;
+		}
+		wi->hc = py->data.hc;
+		DBG(2, "worker[%d] alloc cache state pool(%p)\n", 
+		    ti->index, wi->hcpool);
+	}
+
+	/* alloc request multiplexing context */
+	if (py->cfg.mux) {
+		wi->hm = hmux_alloc(py->cfg.mux_conn);
+		if (!wi->hm) {
+			ERR("alloc multiplexing context failed\n");
+			goto err_free;
+		}
+		wi->hmpool = objpool_alloc(sizeof(hmux_ssn_t), 64, 0);
+		if (!wi->hmpool) {
+			ERR("objpool_alloc for hmpool failed\n");
+			goto err_free;
+		}
+		DBG(2, "worker[%d] alloc multiplexing context(%p)\n", 
+		    ti->index, wi->hm);
+	}
+
 	/* init lock */
 	pthread_mutex_init(&wi->lock, NULL);
 
@@ -111,6 +160,18 @@ _worker_init(thread_t *ti)
 
 err_free:
 		
+	if (wi->hz)
+		hzip_ctx_free(wi->hz);
+
+	if (wi->hcpool)
+		objpool_free(wi->hcpool);
+
+	if (wi->hm)
+		hmux_free(wi->hm);
+
+	if (wi->hmpool)
+		objpool_free(wi->hmpool);
+
 	if (wi->pktpool)
 		objpool_free(wi->pktpool);
 
@@ -137,6 +198,10 @@ _worker_free(thread_t *ti)
 {
 	worker_t *wi;
 	listener_fd_t *lfd, *bk;
+	hmux_srv_t *srv;
+	hmux_bk_t *hb, *hbk;
+	session_t *s;
+	char buf[256];
 
 	assert(ti);
 
@@ -152,6 +217,47 @@ _worker_free(thread_t *ti)
 		    ti->index, lfd);
 	}
 
+	if (wi->hz) {
+		hzip_ctx_print(wi->hz, buf, sizeof(buf));
+		DBG(1, "worker[%d] compress: %s", ti->index, buf);
+		hzip_ctx_free(wi->hz);
+		DBG(2, "worker[%d] free compress context(%p)\n", 
+		    ti->index, wi->hz);
+	}
+
+	if (wi->hcpool) {
+		objpool_free(wi->hcpool);
+		DBG(2, "worker[%d] free cache state pool(%p)\n", 
+		    ti->index, wi->hcpool);
+	}
+
+	/* free the backends after clients freed */
+	if (wi->hm) {
+		CBLIST_FOR_EACH(&wi->hm->srvlist, srv, list) {
+			CBLIST_FOR_EACH_SAFE(&srv->bklist, hb, hbk, list) {
+				s = hb->s;
+				session_free(s, &s->conns[1]);
+			}
+		}
+		hmux_print(wi->hm, buf, sizeof(buf));
+		DBG(1, "worker[%d] multiplexing: %s", ti->index, buf);
+		hmux_free(wi->hm);
+		DBG(2, "worker[%d] free multiplexing context(%p)\n", 
+		    ti->index, wi->hm);
+	}
+
+	if (wi->hmpool) {
+		objpool_free(wi->hmpool);
+		DBG(2, "worker[%d] free multiplexing state pool(%p)\n", 
+		    ti->index, wi->hmpool);
+	}
+
+	/* close lingered sockets before packet pool freed */
+	conn_zc_expire(wi, 1);
+	if (wi->nzcleak)
+		DBG(1, "worker[%d] zerocopy leaked %llu packets\n", 
+		    ti->index, (unsigned long long)wi->nzcleak);
+
 	if (wi->pktpool) {
 		objpool_free(wi->pktpool);
 		DBG(2, "worker[%d] free packet pool(%p)\n", 
@@ -367,6 +473,7 @@ _worker_loop(thread_t *ti)
 		fd_epoll_flush_events(wi->fe);
 		fd_epoll_poll(wi->fe);
 		task_run_queue(wi->taskq);
+		conn_zc_expire(wi, 0);
 	}
 
 	return 0;
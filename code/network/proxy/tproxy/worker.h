@@ -15,6 +15,9 @@
 #include "fd_epoll.h"
 #include "thread.h"
 #include "task.h"
+#include "http_zip.h"
+#include "http_cache.h"
+#include "http_mux.h"
 
 /**
  *	The private data of worker thread.
@@ -22,10 +25,20 @@
 typedef struct worker {
 	u_int32_t	next_sid;	/* the next session id */
 	int		naccept;	/* accept number in one time */
+	int		zerocopy;	/* using MSG_ZEROCOPY send */
+	int		zcmin;		/* min bytes for zerocopy send */
+	cblist_t	zclist;		/* conn_zc_linger_t list */
+	int		nzclinger;	/* number of lingered sockets */
+	u_int64_t	nzcleak;	/* packets leaked by aborted linger */
 	objpool_t	*pktpool;	/* packet_t pool */
 	objpool_t	*ssnpool;	/* session_t pool */
 	fd_epoll_t	*fe;		/* the fd epoll object */
 	task_queue_t	*taskq;		/* the task queue */
+	hzip_ctx_t	*hz;		/* response compress context */
+	hcache_t	*hc;		/* shared HTTP response cache */
+	objpool_t	*hcpool;	/* hcache_ssn_t pool */
+	hmux_t		*hm;		/* request multiplexing context */
+	objpool_t	*hmpool;	/* hmux_ssn_t pool */
 
 	cblist_t	lfdlist;	/* listener_fd_t list */
 	int		nlfd;		/* number of listener_fd_t */
@@ -39,6 +39,9 @@ conn_init(connection_t *c, struct session *s, int dir, const char *side)
 
 	CBLIST_INIT(&c->in);
 	CBLIST_INIT(&c->out);
+	CBLIST_INIT(&c->zcq);
+	c->nzc = 0;
+	c->zcnext = 0;
 
 	task_init(&c->task, c, session_run_task);
 
@@ -47,6 +50,357 @@ conn_init(connection_t *c, struct session *s, int dir, const char *side)
 	return 0;
 }
 
+/**
+ *	Put packet @pkt which all data is sent. If @pkt is referenced 
+ *	by a zerocopy send, add it into @c->zcq until completion 
+ *	notification arrived, or else put it back into packet pool.
+ *
+ *	No return.
+ */
+static void  
+_conn_put_packet(connection_t *c, packet_t *pkt)
+{
+	thread_t *ti;
+	session_t *s;
+
+	s = c->s;
+	ti = s->thread;
+
+	CBLIST_DEL(&pkt->list);
+
+	if (pkt->zcref) {
+		CBLIST_ADD_TAIL(&c->zcq, &pkt->list);
+		c->nzc++;
+		CFLOW(2, "wait zerocopy(%u) packet(%p), nzc %d\n",
+		      pkt->zcid, pkt, c->nzc);
+		return;
+	}
+
+	PKT_FREE(pkt);
+	s->nalloced--;
+	CFLOW(2, "free packet(%p), nalloced %d\n", 
+	      pkt, s->nalloced);
+}
+
+/**
+ *	Read zerocopy completion notifications of socket @fd and 
+ *	free completed packets in @zcq, @nzc is decreased by the 
+ *	freed packets. @copied is set 1 if kernel copied the data.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_conn_zc_reap(int fd, cblist_t *zcq, int *nzc, int *copied)
+{
+	int ret;
+	int copy;
+	u_int32_t lo, hi;
+	packet_t *pkt, *bk;
+
+	while ((ret = sk_recv_zc(fd, &lo, &hi, &copy)) > 0) {
+
+		if (copy)
+			*copied = 1;
+
+		/* TCP completion is in order, @zcq is sorted by id */
+		CBLIST_FOR_EACH_SAFE(zcq, pkt, bk, list) {
+			if ((int32_t)(pkt->zcid - hi) > 0)
+				break;
+
+			CBLIST_DEL(&pkt->list);
+			PKT_FREE(pkt);
+			(*nzc)--;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ *	Read zerocopy completion notifications of connection @c
+ *	and free completed packets in @c->zcq. If kernel copied 
+ *	the data, disable zerocopy send on @c.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_conn_zc_complete(connection_t *c)
+{
+	int ret;
+	int nzc;
+	int copied;
+	thread_t *ti;
+	session_t *s;
+
+	s = c->s;
+	ti = s->thread;
+
+	nzc = c->nzc;
+	copied = 0;
+	ret = _conn_zc_reap(c->fd, &c->zcq, &c->nzc, &copied);
+
+	if (copied && !(c->flags & CONN_F_ZCOFF)) {
+		c->flags |= CONN_F_ZCOFF;
+		CFLOW(1, "zerocopy fallback to copy send\n");
+	}
+
+	if (nzc > c->nzc) {
+		s->nalloced -= nzc - c->nzc;
+		CFLOW(2, "free %d zerocopy packets, nalloced %d\n",
+		      nzc - c->nzc, s->nalloced);
+	}
+
+	return ret;
+}
+
+/**
+ *	Close the lingered socket @zl and free it. If @abort is not 
+ *	zero, the TCP connection is reset to purge the send queue 
+ *	before close, the packets which still not completed after 
+ *	it are leaked, they are never put back into packet pool.
+ *
+ *	No return.
+ */
+static void 
+_conn_zc_close(conn_zc_linger_t *zl, int abort)
+{
+	int copied;
+	worker_t *wi;
+	fd_item_t *fi;
+	packet_t *pkt, *bk;
+	struct sockaddr sa;
+
+	wi = zl->wi;
+
+	/* AF_UNSPEC connect disconnect TCP and free the queued skb, 
+	 * the completion notifications are queued after it */
+	if (abort && zl->nzc > 0) {
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_family = AF_UNSPEC;
+		connect(zl->fd, &sa, sizeof(sa));
+		_conn_zc_reap(zl->fd, &zl->zcq, &zl->nzc, &copied);
+	}
+
+	if (zl->nzc > 0) {
+		CBLIST_FOR_EACH_SAFE(&zl->zcq, pkt, bk, list)
+			CBLIST_DEL(&pkt->list);
+		wi->nzcleak += zl->nzc;
+		ERR("fd %d leaked %d zerocopy packets\n", zl->fd, zl->nzc);
+	}
+
+	fi = fd_epoll_map(wi->fe, zl->fd);
+	assert(fi);
+	memset(fi, 0, sizeof(*fi));
+	close(zl->fd);
+	DBG(2, "fd %d zerocopy linger closed\n", zl->fd);
+
+	CBLIST_DEL(&zl->list);
+	wi->nzclinger--;
+	free(zl);
+}
+
+/**
+ *	The event callback of lingered socket, only EPOLLERR is 
+ *	waited which means completion notification arrived. The 
+ *	socket is closed when all packets are completed.
+ *
+ *	Return 0 always.
+ */
+static int 
+_conn_zc_linger_event(int fd, int events, void *arg)
+{
+	int ret;
+	int copied;
+	conn_zc_linger_t *zl;
+
+	zl = arg;
+	assert(fd == zl->fd);
+
+	ret = _conn_zc_reap(fd, &zl->zcq, &zl->nzc, &copied);
+	if (ret < 0)
+		_conn_zc_close(zl, 1);
+	else if (zl->nzc < 1)
+		_conn_zc_close(zl, 0);
+
+	return 0;
+}
+
+/**
+ *	Move the socket and zerocopy packets of connection @c into 
+ *	worker linger list, the @c->fd is reset to -1 after it. The 
+ *	socket is shutdown as close() do, so peer get FIN after all 
+ *	queued data.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_conn_zc_linger(connection_t *c)
+{
+	worker_t *wi;
+	thread_t *ti;
+	session_t *s;
+	fd_item_t *fi;
+	conn_zc_linger_t *zl;
+
+	s = c->s;
+	wi = s->worker;
+	ti = s->thread;
+
+	zl = malloc(sizeof(*zl));
+	if (unlikely(!zl))
+		ERR_RET(-1, "malloc zerocopy linger failed: %s\n", ERRSTR);
+
+	CBLIST_INIT(&zl->list);
+	CBLIST_INIT(&zl->zcq);
+	CBLIST_JOIN(&zl->zcq, &c->zcq);
+	zl->fd = c->fd;
+	zl->nzc = c->nzc;
+	zl->expire = time(NULL) + CONN_ZC_LINGER;
+	zl->wi = wi;
+
+	/* the packets belong to worker now */
+	s->nalloced -= c->nzc;
+	c->nzc = 0;
+
+	shutdown(c->fd, SHUT_RDWR);
+
+	/* edge trigger, only new notification wakeup it */
+	fi = fd_epoll_map(wi->fe, c->fd);
+	assert(fi);
+	fi->arg = zl;
+	fd_epoll_add_event(wi->fe, c->fd, EPOLLERR | EPOLLET, 
+			   _conn_zc_linger_event);
+
+	CBLIST_ADD_TAIL(&wi->zclist, &zl->list);
+	wi->nzclinger++;
+	CFLOW(1, "linger for %d zerocopy packets\n", zl->nzc);
+
+	c->fd = -1;
+
+	return 0;
+}
+
+/**
+ *	Check @events on connection @c, EPOLLERR is also reported 
+ *	when zerocopy notification is queued in error queue. Read 
+ *	the notification and clear EPOLLERR if socket have no error.
+ *
+ *	Return the events after check.
+ */
+static int 
+_conn_check_events(connection_t *c, int events)
+{
+	if (likely(!(events & EPOLLERR)) || !(c->flags & CONN_F_ZEROCOPY))
+		return events;
+
+	if (_conn_zc_complete(c))
+		return events;
+
+	if (sk_is_connected(c->fd))
+		return events;
+
+	return (events & ~EPOLLERR);
+}
+
+/**
+ *	Send data in @c->out using MSG_ZEROCOPY if pending bytes 
+ *	is large than @wi->zcmin, sent packets are added into 
+ *	@c->zcq by _conn_put_packet(). @total is increased by 
+ *	sent bytes.
+ *
+ *	Return 0 if all data is sent or need send in copy mode, 
+ *	1 if send blocked, -1 on error.
+ */
+static int 
+_conn_zc_send(connection_t *c, int *total)
+{
+	int n;
+	int zc;
+	int len;
+	int want;
+	int niov;
+	int remain;
+	u_int32_t zcid;
+	worker_t *wi;
+	thread_t *ti;
+	session_t *s;
+	packet_t *pkt, *bk;
+	struct iovec iov[CONN_ZC_IOV];
+
+	s = c->s;
+	wi = s->worker;
+	ti = s->thread;
+
+	/* enable SO_ZEROCOPY when first used */
+	if (!(c->flags & CONN_F_ZEROCOPY)) {
+		if (sk_set_zerocopy(c->fd, 1)) {
+			c->flags |= CONN_F_ZCOFF;
+			CFLOW(1, "zerocopy not support, copy send\n");
+			return 0;
+		}
+		c->flags |= CONN_F_ZEROCOPY;
+	}
+
+	while (!CBLIST_IS_EMPTY(&c->out)) {
+
+		niov = 0;
+		len = 0;
+		CBLIST_FOR_EACH(&c->out, pkt, list) {
+			iov[niov].iov_base = PKT_DATA(pkt) + pkt->sendpos;
+			iov[niov].iov_len = pkt->len - pkt->sendpos;
+			len += iov[niov].iov_len;
+			if (++niov >= CONN_ZC_IOV)
+				break;
+		}
+
+		/* small data, copy is cheaper than page pinning */
+		if (len < wi->zcmin)
+			return 0;
+
+		want = len;
+		n = sk_send_zc(c->fd, iov, niov, &zc);
+		if (unlikely(n < 0)) {
+			CFLOW(1, "zerocopy send %d bytes error: %s\n", 
+			      want, ERRSTR);
+			return -1;
+		}
+
+		CFLOW(1, "zerocopy send %d bytes(%d)%s\n", 
+		      want, n, zc ? "" : " copied");
+
+		*total += n;
+		zcid = zc ? c->zcnext++ : 0;
+
+		/* account sent bytes in each packet */
+		remain = n;
+		CBLIST_FOR_EACH_SAFE(&c->out, pkt, bk, list) {
+			if (remain < 1)
+				break;
+
+			len = pkt->len - pkt->sendpos;
+			if (zc) {
+				pkt->zcref = 1;
+				pkt->zcid = zcid;
+			}
+
+			if (remain < len) {
+				pkt->sendpos += remain;
+				break;
+			}
+
+			pkt->sendpos = pkt->len;
+			remain -= len;
+			_conn_put_packet(c, pkt);
+		}
+
+		/* send blocked */
+		if (n < want)
+			return 1;
+	}
+
+	return 0;
+}
+
 int 
 conn_free(connection_t *c)
 {
@@ -70,24 +424,45 @@ conn_free(connection_t *c)
 	if (unlikely(!CBLIST_IS_EMPTY(&c->in))) {
 		CBLIST_FOR_EACH_SAFE(&c->in, pkt, bak, list) {
 			CBLIST_DEL(&pkt->list);
-			objpool_put(pkt);
+			PKT_FREE(pkt);
 			s->nalloced--;
 			CFLOW(2, "free (in)packet(%p), nalloced %d\n", 
 			     pkt, s->nalloced);
 		}
 	}
 
-	/* free output queue */
+	/* free output queue, the partly sent packet maybe pinned 
+	 * by zerocopy send, it wait completion in @c->zcq */
 	if (unlikely(!CBLIST_IS_EMPTY(&c->out))) {
 		CBLIST_FOR_EACH_SAFE(&c->out, pkt, bak, list) {
+			if (pkt->zcref) {
+				_conn_put_packet(c, pkt);
+				continue;
+			}
 			CBLIST_DEL(&pkt->list);
-			objpool_put(pkt);
+			PKT_FREE(pkt);
 			s->nalloced--;
 			CFLOW(2, "free (out)packet(%p), nalloced %d\n", 
 			     pkt, s->nalloced);
 		}
 	}
 
+	/* the packets in zerocopy queue are pinned by kernel until 
+	 * completion, linger the socket if not all completed */
+	if (unlikely(!CBLIST_IS_EMPTY(&c->zcq))) {
+		if (c->fd > 0)
+			_conn_zc_complete(c);
+		if (c->nzc > 0 && (c->fd < 1 || _conn_zc_linger(c))) {
+			CBLIST_FOR_EACH_SAFE(&c->zcq, pkt, bak, list)
+				CBLIST_DEL(&pkt->list);
+			s->nalloced -= c->nzc;
+			wi->nzcleak += c->nzc;
+			CFLOW(1, "leaked %d zerocopy packets, nalloced %d\n",
+			      c->nzc, s->nalloced);
+			c->nzc = 0;
+		}
+	}
+
 	/* close socket fd, not need update event */
 	if (c->fd > 0) {
 		fi = fd_epoll_map(wi->fe, c->fd);
@@ -105,6 +480,25 @@ conn_free(connection_t *c)
 	return 0;
 }
 
+void 
+conn_zc_expire(worker_t *wi, int force)
+{
+	time_t now;
+	conn_zc_linger_t *zl;
+
+	if (unlikely(!wi) || likely(CBLIST_IS_EMPTY(&wi->zclist)))
+		return;
+
+	/* same linger time, the list is sorted by @expire */
+	now = time(NULL);
+	while (!CBLIST_IS_EMPTY(&wi->zclist)) {
+		zl = CBLIST_GET_HEAD(&wi->zclist, conn_zc_linger_t *, list);
+		if (!force && zl->expire > now)
+			break;
+		_conn_zc_close(zl, 1);
+	}
+}
+
 int 
 conn_recv_data(int fd, int events, void *arg)
 {
@@ -132,6 +526,11 @@ conn_recv_data(int fd, int events, void *arg)
 	ti = s->thread;
 	assert(fd == c->fd);
 
+	/* only zerocopy notification */
+	events = _conn_check_events(c, events);
+	if (!events)
+		return 0;
+
 	if (unlikely(events & EPOLLERR)) {
 		//ERR("recv data epoll error\n");
 		c->flags |= CONN_F_ERROR;
@@ -208,7 +607,7 @@ ssl_read:
 		/* empty packet */
 		if (pkt->len == 0) {
 			CBLIST_DEL(&pkt->list);
-			objpool_put(pkt);
+			PKT_FREE(pkt);
 			s->nalloced--;
 			CFLOW(2, "free packet(%p), nalloced %d\n", 
 			      pkt, s->nalloced);
@@ -281,12 +680,31 @@ conn_send_data(int fd, int events, void *arg)
 	if ((c->flags & CONN_F_HSK) || (c->flags & CONN_F_SSLHSK))
 		return 0;
 
+	if (events) {
+		events = _conn_check_events(c, events);
+		if (unlikely(events & EPOLLERR)) {
+			c->flags |= CONN_F_ERROR;
+			goto err_free;
+		}
+	}
+
 	total = 0;
 
+	/* large plaintext data, try zerocopy send */
+	if (wi->zerocopy && !c->ssl && !(c->flags & CONN_F_ZCOFF)) {
+		ret = _conn_zc_send(c, &total);
+		if (unlikely(ret < 0)) {
+			c->flags |= CONN_F_ERROR;
+			goto err_free;
+		}
+		if (ret > 0)
+			goto blocked;
+	}
+
 	/* send all packet out in once if can. */
 	CBLIST_FOR_EACH_SAFE(&c->out, pkt, bk, list) {
 
-		ptr = pkt->data + pkt->sendpos;
+		ptr = PKT_DATA(pkt) + pkt->sendpos;
 		len = pkt->len - pkt->sendpos;
 		n = conn_raw_send(fd, c->ssl, ptr, len);
 		if (unlikely(n < 0)) {
@@ -300,47 +718,13 @@ conn_send_data(int fd, int events, void *arg)
 
 		/* send blocked, add it to event */
 		if (unlikely(n != len)) {
-			
 			CFLOW(1, "send %d bytes blocked(%d)\n", len, n);
-
-			/* already blocked */
-			if (c->flags & CONN_F_BLOCKED)
-				return 0;
-
-			fi = fd_epoll_map(wi->fe, fd);
-			assert(fi);			
-			fi->arg = c;
-
-			/* alloc events update for write */
-			ret = fd_epoll_add_event(wi->fe, fd, FD_OUT, conn_send_data);
-			if (unlikely(ret)) {
-				ERR("alloc update failed\n");
-				goto err_free;
-			}
-			CFLOW(3, "add event(write)\n");
-
-			/* delete events update for peer read */
-			fi = fd_epoll_map(wi->fe, peer->fd);
-			assert(fi);
-			ret = fd_epoll_add_event(wi->fe, peer->fd, 0, NULL);
-			if (unlikely(ret)) {
-				ERR("alloc update failed\n");
-				goto err_free;
-			}
-			FLOW(3, "%s(%04x) %d add event(delete)\n" ,
-			      peer->side, peer->flags, peer->fd);
-
-			c->flags |= CONN_F_BLOCKED;
-			return 0;
+			goto blocked;
 		}
 
 		CFLOW(1, "send %d bytes\n", n);
 
-		CBLIST_DEL(&pkt->list);
-		objpool_put(pkt);
-		s->nalloced--;
-		CFLOW(2, "free packet(%p), nalloced %d\n", 
-		      pkt, s->nalloced);
+		_conn_put_packet(c, pkt);
 	}
 
 	CFLOW(1, "send total %d bytes\n", total);
@@ -360,17 +744,21 @@ conn_send_data(int fd, int events, void *arg)
 		FLOW(3, "%s(%04x) %d add event(read)\n" ,
 				c->side, c->flags, c->fd);
 
-		/* add events update for peer read */
-		fi = fd_epoll_map(wi->fe, peer->fd);
-		assert(fi);
-		fi->arg = peer;
-		ret = fd_epoll_add_event(wi->fe, peer->fd, FD_IN, conn_recv_data);
-		if (unlikely(ret)) {
-			ERR("alloc update failed\n");
-			goto err_free;
+		/* add events update for peer read, the server maybe not 
+		 * connected when all requests hit cache */
+		if (peer->fd > 0) {
+			fi = fd_epoll_map(wi->fe, peer->fd);
+			assert(fi);
+			fi->arg = peer;
+			ret = fd_epoll_add_event(wi->fe, peer->fd, FD_IN, 
+						 conn_recv_data);
+			if (unlikely(ret)) {
+				ERR("alloc update failed\n");
+				goto err_free;
+			}
+			FLOW(3, "%s(%04x) %d add event(read)\n" ,
+			     peer->side, peer->flags, peer->fd);
 		}
-		FLOW(3, "%s(%04x) %d add event(read)\n" ,
-				peer->side, peer->flags, peer->fd);
 
 		c->flags &= ~CONN_F_BLOCKED;
 	}
@@ -395,6 +783,40 @@ conn_send_data(int fd, int events, void *arg)
 
 	return 0;
 
+blocked:
+
+	/* already blocked */
+	if (c->flags & CONN_F_BLOCKED)
+		return 0;
+
+	fi = fd_epoll_map(wi->fe, fd);
+	assert(fi);			
+	fi->arg = c;
+
+	/* alloc events update for write */
+	ret = fd_epoll_add_event(wi->fe, fd, FD_OUT, conn_send_data);
+	if (unlikely(ret)) {
+		ERR("alloc update failed\n");
+		goto err_free;
+	}
+	CFLOW(3, "add event(write)\n");
+
+	/* delete events update for peer read */
+	if (peer->fd > 0) {
+		fi = fd_epoll_map(wi->fe, peer->fd);
+		assert(fi);
+		ret = fd_epoll_add_event(wi->fe, peer->fd, 0, NULL);
+		if (unlikely(ret)) {
+			ERR("alloc update failed\n");
+			goto err_free;
+		}
+		FLOW(3, "%s(%04x) %d add event(delete)\n" ,
+		      peer->side, peer->flags, peer->fd);
+	}
+
+	c->flags |= CONN_F_BLOCKED;
+	return 0;
+
 err_free:
 
 	/* failed need delete session in event callback */
@@ -26,6 +26,8 @@
 #define	CONN_F_ERROR	0x0001		/* recv/send error */
 #define	CONN_F_HSK	0x0002		/* tcp handshake */
 #define	CONN_F_SSLHSK	0x0004		/* ssl handshake */
+#define	CONN_F_ZEROCOPY	0x0010		/* SO_ZEROCOPY enabled */
+#define	CONN_F_ZCOFF	0x0020		/* zerocopy not usable, copy send */
 #define	CONN_F_SHUTRD	0x0100		/* shutdown read */
 #define	CONN_F_SHUTWR	0x0200		/* shutdown write */
 #define	CONN_F_SSLSHUT	0x0400		/* ssl shutdown */
@@ -34,6 +36,9 @@
 
 #define	CONN_IS_CLOSED(c)	(((c)->flags & CONN_F_CLOSED) == CONN_F_CLOSED)
 
+#define	CONN_ZC_IOV	64		/* max packets in one zerocopy send */
+#define	CONN_ZC_LINGER	30		/* seconds wait completion after free */
+
 struct session;
 
 /**
@@ -49,10 +54,28 @@ typedef struct connection {
 	ip_port_t	local;		/* local address */
 	cblist_t	in;		/* input packet queue */
 	cblist_t	out;		/* output packet queue */
+	cblist_t	zcq;		/* packets wait zerocopy completion */
+	int		nzc;		/* number of packets in @zcq */
+	u_int32_t	zcnext;		/* next zerocopy notification id */
 	task_t		task;		/* task */
 	int		flags;		/* flags */
 } connection_t;
 
+/**
+ *	The socket of a freed connection which still have packets 
+ *	pinned by kernel zerocopy send. The packets can't be reused 
+ *	until completion notification arrived, so the fd is kept 
+ *	open in worker until all completed or it's expired.
+ */
+typedef struct conn_zc_linger {
+	cblist_t	list;		/* in worker_t's @zclist */
+	int		fd;		/* socket fd */
+	cblist_t	zcq;		/* packets wait zerocopy completion */
+	int		nzc;		/* number of packets in @zcq */
+	time_t		expire;		/* abort the socket after it */
+	worker_t	*wi;		/* worker it belong */
+} conn_zc_linger_t;
+
 /**
  *	Init onnection @c using session @s. @dir 0 is client,
  *	1 is server, side is "client"/"server" for debug output.
@@ -70,6 +93,17 @@ conn_init(connection_t *c, struct session *s, int dir, const char *side);
 extern int 
 conn_free(connection_t *c);
 
+/**
+ *	Close lingered zerocopy sockets of worker @wi which are
+ *	expired, all sockets are closed if @force is not zero. The 
+ *	socket is aborted before close, the packets still pinned 
+ *	after it are leaked, not put back into packet pool.
+ *
+ *	No return.
+ */
+extern void 
+conn_zc_expire(worker_t *wi, int force);
+
 /**
  *	Recv data in connection @c, it'll just
  *
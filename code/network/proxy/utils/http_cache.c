@@ -0,0 +1,1561 @@
+/**
+ *	@file	http_cache.c
+ *
+ *	@brief	In-memory HTTP response cache implement.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#define	_GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <limits.h>
+#include <time.h>
+
+#include "packet.h"
+#include "proxy_common.h"
+#include "proxy_debug.h"
+#include "http_parse.h"
+#include "http_util.h"
+#include "http_cache.h"
+
+/* Cache-Control directives */
+#define	_HC_CC_NOSTORE	0x01
+#define	_HC_CC_NOCACHE	0x02
+#define	_HC_CC_PRIVATE	0x04
+
+#define	_HC_INIT_BODY	16384	/* init body buffer of chunked response */
+#define	_HC_MAX_ETAG	512	/* max ETag length stored */
+#define	_HC_MAX_PKTREF	0xffff	/* max bytes referenced by one packet */
+
+/* the header of HCACHE_VARY_XXX */
+static const int _hc_vary_ids[HCACHE_NVARY] = {
+	HTTP_HST_ACCEPT,
+	HTTP_HST_ACCEPT_CHARSET,
+	HTTP_HST_ACCEPT_ENCODING,
+	HTTP_HST_ACCEPT_LANGUAGE,
+	HTTP_HST_USER_AGENT,
+};
+
+/* key buffer in stack */
+typedef union _hc_kbuf {
+	hcache_key_t	key;
+	char		buf[sizeof(hcache_key_t) + HCACHE_MAX_KEY];
+} _hc_kbuf_t;
+
+static u_int32_t 
+_hcache_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec;
+}
+
+/**
+ *	Return index of HCACHE_VARY_XXX of header @id, -1 if
+ *	not supported.
+ */
+static int 
+_hcache_vary_index(int id)
+{
+	int i;
+
+	for (i = 0; i < HCACHE_NVARY; i++) {
+		if (_hc_vary_ids[i] == id)
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ *	Parse the decimal number in @val, the @len is length of
+ *	@val, the bytes after digits are ignored.
+ *
+ *	Return the number, -1 if not a number or overflow.
+ */
+static long 
+_hcache_num(const char *val, int len)
+{
+	int i;
+	long n = 0;
+
+	if (len < 1 || !isdigit((unsigned char)*val))
+		return -1;
+
+	for (i = 0; i < len && isdigit((unsigned char)val[i]); i++) {
+		if (n > (LONG_MAX - 9) / 10)
+			return -1;
+		n = n * 10 + val[i] - '0';
+	}
+
+	return n;
+}
+
+/**
+ *	Parse Cache-Control value @val, the max-age and s-maxage
+ *	are returned in @maxage/@smaxage, -1 if not present.
+ *
+ *	Return the _HC_CC_XXX flags.
+ */
+static int 
+_hcache_cc(const char *val, int len, long *maxage, long *smaxage)
+{
+	int n;
+	int flags = 0;
+	const char *ptr;
+	const char *end;
+	const char *next;
+
+	ptr = val;
+	end = val + len;
+	while (ptr < end) {
+		next = memchr(ptr, ',', end - ptr);
+		if (!next)
+			next = end;
+
+		while (ptr < next && (*ptr == ' ' || *ptr == '\t'))
+			ptr++;
+		n = next - ptr;
+
+		if (n >= 8 && strncasecmp(ptr, "no-store", 8) == 0)
+			flags |= _HC_CC_NOSTORE;
+		else if (n >= 8 && strncasecmp(ptr, "no-cache", 8) == 0)
+			flags |= _HC_CC_NOCACHE;
+		else if (n >= 7 && strncasecmp(ptr, "private", 7) == 0)
+			flags |= _HC_CC_PRIVATE;
+		else if (n > 8 && strncasecmp(ptr, "max-age=", 8) == 0)
+			*maxage = _hcache_num(ptr + 8, n - 8);
+		else if (n > 9 && strncasecmp(ptr, "s-maxage=", 9) == 0)
+			*smaxage = _hcache_num(ptr + 9, n - 9);
+
+		ptr = next + 1;
+	}
+
+	return flags;
+}
+
+/**
+ *	Parse HTTP date @val like "Sun, 06 Nov 1994 08:49:37 GMT".
+ *
+ *	Return the time if success, -1 on error.
+ */
+static time_t 
+_hcache_date(const char *val, int len)
+{
+	char buf[64];
+	struct tm tm;
+
+	if (len < 1 || len >= sizeof(buf))
+		return -1;
+
+	memcpy(buf, val, len);
+	buf[len] = 0;
+
+	memset(&tm, 0, sizeof(tm));
+	if (!strptime(buf, "%a, %d %b %Y %H:%M:%S", &tm))
+		return -1;
+
+	return timegm(&tm);
+}
+
+/**
+ *	Check ETag @etag is in If-None-Match list @inm or not, the
+ *	weak comparison is used.
+ *
+ *	Return 1 if matched, 0 if not.
+ */
+static int 
+_hcache_etag_match(const char *inm, int len, const char *etag, int elen)
+{
+	int n;
+	const char *ptr;
+	const char *end;
+	const char *next;
+
+	if (elen > 2 && strncmp(etag, "W/", 2) == 0) {
+		etag += 2;
+		elen -= 2;
+	}
+
+	ptr = inm;
+	end = inm + len;
+	while (ptr < end) {
+		next = memchr(ptr, ',', end - ptr);
+		if (!next)
+			next = end;
+
+		while (ptr < next && (*ptr == ' ' || *ptr == '\t'))
+			ptr++;
+		n = next - ptr;
+		while (n > 0 && (ptr[n - 1] == ' ' || ptr[n - 1] == '\t'))
+			n--;
+
+		if (n == 1 && *ptr == '*')
+			return 1;
+
+		if (n > 2 && strncmp(ptr, "W/", 2) == 0) {
+			ptr += 2;
+			n -= 2;
+		}
+
+		if (n == elen && memcmp(ptr, etag, n) == 0)
+			return 1;
+
+		ptr = next + 1;
+	}
+
+	return 0;
+}
+
+/**
+ *	Get the Vary value @i of @key, the length is returned
+ *	in @len.
+ *
+ *	Return the value pointer.
+ */
+static const char * 
+_hcache_key_vary(const hcache_key_t *key, int i, int *len)
+{
+	int j;
+	int off = key->klen;
+
+	for (j = 0; j < i; j++)
+		off += key->vlen[j];
+
+	*len = key->vlen[i];
+	return key->data + off;
+}
+
+/**
+ *	Check the Host+URL of @obj is same as @key or not.
+ *
+ *	Return 1 if same, 0 if not.
+ */
+static inline int 
+_hcache_key_match(const hcache_obj_t *obj, const hcache_key_t *key)
+{
+	return (obj->key->hash == key->hash &&
+		obj->key->klen == key->klen &&
+		memcmp(obj->key->data, key->data, key->klen) == 0);
+}
+
+/**
+ *	Check the Vary values in @obj->vmask of @obj and @key.
+ *
+ *	Return 1 if same, 0 if not.
+ */
+static int 
+_hcache_vary_match(const hcache_obj_t *obj, const hcache_key_t *key)
+{
+	int i;
+	int len1;
+	int len2;
+	const char *v1;
+	const char *v2;
+
+	for (i = 0; i < HCACHE_NVARY; i++) {
+		if (!(obj->vmask & (1 << i)))
+			continue;
+
+		v1 = _hcache_key_vary(obj->key, i, &len1);
+		v2 = _hcache_key_vary(key, i, &len2);
+		if (len1 != len2 || memcmp(v1, v2, len1))
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ *	Build the key of request @req into @key, the max size of
+ *	key data is HCACHE_MAX_KEY.
+ *
+ *	Return 0 if success, -1 if key is oversize.
+ */
+static int 
+_hcache_build_key(const hcache_req_t *req, hcache_key_t *key)
+{
+	int i;
+	int len;
+	u_int64_t h = 14695981039346656037ULL;
+	char *ptr;
+
+	len = req->hostlen + req->ulen;
+	for (i = 0; i < HCACHE_NVARY; i++)
+		len += req->vlen[i];
+	if (len > HCACHE_MAX_KEY)
+		return -1;
+
+	/* the host is case-insensitive */
+	ptr = key->data;
+	for (i = 0; i < req->hostlen; i++)
+		*ptr++ = tolower((unsigned char)req->host[i]);
+	memcpy(ptr, req->url, req->ulen);
+	ptr += req->ulen;
+	key->klen = ptr - key->data;
+
+	/* FNV-1a */
+	for (i = 0; i < key->klen; i++) {
+		h ^= (unsigned char)key->data[i];
+		h *= 1099511628211ULL;
+	}
+	key->hash = h;
+
+	for (i = 0; i < HCACHE_NVARY; i++) {
+		if (req->vlen[i] > 0)
+			memcpy(ptr, req->vary[i], req->vlen[i]);
+		ptr += req->vlen[i];
+		key->vlen[i] = req->vlen[i];
+	}
+	key->len = ptr - key->data;
+
+	return 0;
+}
+
+static hcache_key_t * 
+_hcache_dup_key(const hcache_key_t *key)
+{
+	hcache_key_t *k;
+
+	k = malloc(sizeof(*k) + key->len);
+	if (!k)
+		ERR_RET(NULL, "malloc memory for hcache_key failed\n");
+
+	memcpy(k, key, sizeof(*k) + key->len);
+
+	return k;
+}
+
+static void 
+_hcache_obj_free(pkt_ref_t *ref)
+{
+	hcache_obj_t *obj;
+
+	obj = (hcache_obj_t *)ref;
+	assert(!obj->linked);
+
+	if (obj->key)
+		free(obj->key);
+	if (obj->buf)
+		free(obj->buf);
+	free(obj);
+}
+
+/**
+ *	Alloc a object with @cap bytes buffer, the key @key is
+ *	owned by object.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+static hcache_obj_t * 
+_hcache_obj_alloc(hcache_key_t *key, u_int32_t cap)
+{
+	hcache_obj_t *obj;
+
+	obj = calloc(1, sizeof(*obj));
+	if (!obj)
+		ERR_RET(NULL, "calloc memory for hcache_obj failed\n");
+
+	obj->buf = malloc(cap);
+	if (!obj->buf) {
+		free(obj);
+		ERR_RET(NULL, "malloc memory for hcache_obj buffer failed\n");
+	}
+	obj->cap = cap;
+	obj->key = key;
+	obj->ref.refcnt = 1;
+	obj->ref.free = _hcache_obj_free;
+	CBLIST_INIT(&obj->hlist);
+	CBLIST_INIT(&obj->lru);
+
+	return obj;
+}
+
+/**
+ *	Append @len bytes in @data into @obj, the buffer is grown
+ *	until @maxobj.
+ *
+ *	Return 0 if success, -1 if oversize or no memory.
+ */
+static int 
+_hcache_obj_append(hcache_obj_t *obj, size_t maxobj,
+		   const char *data, int len)
+{
+	u_int32_t used;
+	u_int32_t cap;
+	char *buf;
+
+	used = obj->hlen + obj->blen;
+	if (used + len > maxobj)
+		return -1;
+
+	if (used + len > obj->cap) {
+		cap = obj->cap * 2;
+		while (cap < used + len)
+			cap *= 2;
+		if (cap > maxobj)
+			cap = maxobj;
+		buf = realloc(obj->buf, cap);
+		if (!buf)
+			return -1;
+		obj->buf = buf;
+		obj->cap = cap;
+	}
+
+	memcpy(obj->buf + used, data, len);
+	obj->blen += len;
+
+	return 0;
+}
+
+/**
+ *	Remove @obj from shard @sh and put the cache reference,
+ *	it's called with @sh->lock held.
+ *
+ *	No return.
+ */
+static void 
+_hcache_unlink(hcache_shard_t *sh, hcache_obj_t *obj)
+{
+	CBLIST_DEL(&obj->hlist);
+	CBLIST_DEL(&obj->lru);
+	sh->stat.mem -= obj->size;
+	sh->stat.nobj--;
+	obj->linked = 0;
+
+	hcache_put(obj);
+}
+
+static inline hcache_shard_t * 
+_hcache_shard(hcache_t *hc, u_int64_t hash)
+{
+	return &hc->shards[hash & (HCACHE_NSHARD - 1)];
+}
+
+static inline cblist_t * 
+_hcache_bucket(hcache_shard_t *sh, u_int64_t hash)
+{
+	return &sh->buckets[(hash >> 4) & sh->mask];
+}
+
+hcache_t * 
+hcache_alloc(size_t maxmem, size_t maxobj)
+{
+	int i;
+	u_int32_t j;
+	u_int32_t nbucket;
+	hcache_t *hc;
+	hcache_shard_t *sh;
+
+	if (maxmem < HCACHE_NSHARD || maxobj < 1)
+		ERR_RET(NULL, "invalid argument\n");
+
+	hc = calloc(1, sizeof(*hc));
+	if (!hc)
+		ERR_RET(NULL, "calloc memory for hcache failed\n");
+
+	hc->maxmem = maxmem;
+	hc->maxobj = maxobj;
+
+	/* about one bucket per 8K memory */
+	nbucket = 64;
+	while (nbucket < (1 << 20) &&
+	       (size_t)nbucket * 8192 * HCACHE_NSHARD < maxmem)
+		nbucket *= 2;
+
+	for (i = 0; i < HCACHE_NSHARD; i++) {
+		sh = &hc->shards[i];
+		sh->buckets = malloc(nbucket * sizeof(cblist_t));
+		if (!sh->buckets) {
+			hcache_free(hc);
+			ERR_RET(NULL, "malloc memory for hcache bucket failed\n");
+		}
+		for (j = 0; j < nbucket; j++)
+			CBLIST_INIT(&sh->buckets[j]);
+		sh->mask = nbucket - 1;
+		sh->maxmem = maxmem / HCACHE_NSHARD;
+		CBLIST_INIT(&sh->lru);
+		pthread_mutex_init(&sh->lock, NULL);
+	}
+
+	return hc;
+}
+
+void 
+hcache_free(hcache_t *hc)
+{
+	int i;
+	hcache_shard_t *sh;
+	hcache_obj_t *obj, *bk;
+
+	if (!hc)
+		return;
+
+	for (i = 0; i < HCACHE_NSHARD; i++) {
+		sh = &hc->shards[i];
+		if (!sh->buckets)
+			continue;
+
+		CBLIST_FOR_EACH_SAFE(&sh->lru, obj, bk, lru)
+			_hcache_unlink(sh, obj);
+
+		free(sh->buckets);
+		pthread_mutex_destroy(&sh->lock);
+	}
+
+	free(hc);
+}
+
+void 
+hcache_get_stat(hcache_t *hc, hcache_stat_t *st)
+{
+	int i;
+	hcache_shard_t *sh;
+
+	memset(st, 0, sizeof(*st));
+	if (!hc)
+		return;
+
+	for (i = 0; i < HCACHE_NSHARD; i++) {
+		sh = &hc->shards[i];
+		pthread_mutex_lock(&sh->lock);
+		st->nhit += sh->stat.nhit;
+		st->nmiss += sh->stat.nmiss;
+		st->nnotmod += sh->stat.nnotmod;
+		st->nstore += sh->stat.nstore;
+		st->nevict += sh->stat.nevict;
+		st->nexpire += sh->stat.nexpire;
+		st->nobj += sh->stat.nobj;
+		st->mem += sh->stat.mem;
+		pthread_mutex_unlock(&sh->lock);
+	}
+}
+
+int 
+hcache_print(hcache_t *hc, char *buf, size_t len)
+{
+	hcache_stat_t st;
+
+	if (!hc || !buf || len < 1)
+		return 0;
+
+	hcache_get_stat(hc, &st);
+	return snprintf(buf, len,
+			"hit %llu, miss %llu, notmod %llu, store %llu, "
+			"evict %llu, expire %llu, objs %llu, mem %llu\n",
+			(unsigned long long)st.nhit,
+			(unsigned long long)st.nmiss,
+			(unsigned long long)st.nnotmod,
+			(unsigned long long)st.nstore,
+			(unsigned long long)st.nevict,
+			(unsigned long long)st.nexpire,
+			(unsigned long long)st.nobj,
+			(unsigned long long)st.mem);
+}
+
+hcache_obj_t * 
+hcache_get(hcache_t *hc, const hcache_key_t *key)
+{
+	u_int32_t now;
+	cblist_t *head;
+	hcache_shard_t *sh;
+	hcache_obj_t *obj, *bk;
+
+	if (unlikely(!hc || !key))
+		ERR_RET(NULL, "invalid argument\n");
+
+	now = _hcache_now();
+	sh = _hcache_shard(hc, key->hash);
+	head = _hcache_bucket(sh, key->hash);
+
+	pthread_mutex_lock(&sh->lock);
+
+	CBLIST_FOR_EACH_SAFE(head, obj, bk, hlist) {
+
+		if (!_hcache_key_match(obj, key))
+			continue;
+
+		if ((int32_t)(now - obj->expire) >= 0) {
+			_hcache_unlink(sh, obj);
+			sh->stat.nexpire++;
+			continue;
+		}
+
+		if (!_hcache_vary_match(obj, key))
+			continue;
+
+		/* move to LRU tail at most once per second */
+		if (obj->atime != now) {
+			obj->atime = now;
+			CBLIST_DEL(&obj->lru);
+			CBLIST_ADD_TAIL(&sh->lru, &obj->lru);
+		}
+
+		PKT_REF_GET(&obj->ref);
+		sh->stat.nhit++;
+		pthread_mutex_unlock(&sh->lock);
+		return obj;
+	}
+
+	sh->stat.nmiss++;
+	pthread_mutex_unlock(&sh->lock);
+
+	return NULL;
+}
+
+int 
+hcache_insert(hcache_t *hc, hcache_obj_t *obj)
+{
+	cblist_t *head;
+	hcache_shard_t *sh;
+	hcache_obj_t *old, *bk;
+
+	if (unlikely(!hc || !obj || !obj->key))
+		ERR_RET(-1, "invalid argument\n");
+
+	sh = _hcache_shard(hc, obj->key->hash);
+	head = _hcache_bucket(sh, obj->key->hash);
+
+	if (obj->size > sh->maxmem) {
+		hcache_put(obj);
+		return -1;
+	}
+
+	pthread_mutex_lock(&sh->lock);
+
+	/* replace the old object of same variant */
+	CBLIST_FOR_EACH_SAFE(head, old, bk, hlist) {
+		if (old->vmask == obj->vmask &&
+		    _hcache_key_match(old, obj->key) &&
+		    _hcache_vary_match(old, obj->key))
+			_hcache_unlink(sh, old);
+	}
+
+	/* evict the oldest objects */
+	while (sh->stat.mem + obj->size > sh->maxmem &&
+	       !CBLIST_IS_EMPTY(&sh->lru))
+	{
+		old = CBLIST_GET_HEAD(&sh->lru, hcache_obj_t *, lru);
+		_hcache_unlink(sh, old);
+		sh->stat.nevict++;
+	}
+
+	obj->linked = 1;
+	obj->atime = obj->stored;
+	CBLIST_ADD_HEAD(head, &obj->hlist);
+	CBLIST_ADD_TAIL(&sh->lru, &obj->lru);
+	sh->stat.mem += obj->size;
+	sh->stat.nobj++;
+	sh->stat.nstore++;
+
+	pthread_mutex_unlock(&sh->lock);
+
+	return 0;
+}
+
+/**
+ *	Count a 304 reply of object @obj in @hc.
+ *
+ *	No return.
+ */
+static void 
+_hcache_count_notmod(hcache_t *hc, hcache_obj_t *obj)
+{
+	hcache_shard_t *sh;
+
+	sh = _hcache_shard(hc, obj->key->hash);
+	__atomic_add_fetch(&sh->stat.nnotmod, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *	Alloc a packet from @pktpool and add it into @out, @len
+ *	bytes in @data is copied into packet.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_hcache_emit(objpool_t *pktpool, cblist_t *out, int *nalloced,
+	     const char *data, int len)
+{
+	packet_t *pkt;
+
+	assert(len <= MAX_PKTLEN);
+
+	pkt = objpool_get(pktpool);
+	if (unlikely(!pkt))
+		ERR_RET(-1, "alloc packet failed\n");
+
+	PKT_INIT(pkt);
+	memcpy(pkt->data, data, len);
+	pkt->len = len;
+	CBLIST_ADD_TAIL(out, &pkt->list);
+	(*nalloced)++;
+
+	return 0;
+}
+
+/**
+ *	Add packets which reference @len bytes begin at @off of
+ *	@obj->buf into @out, each packet hold a reference of @obj.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_hcache_emit_ref(objpool_t *pktpool, cblist_t *out, int *nalloced,
+		 hcache_obj_t *obj, u_int32_t off, u_int32_t len)
+{
+	u_int32_t n;
+	packet_t *pkt;
+
+	while (len > 0) {
+		pkt = objpool_get(pktpool);
+		if (unlikely(!pkt))
+			ERR_RET(-1, "alloc packet failed\n");
+
+		n = len > _HC_MAX_PKTREF ? _HC_MAX_PKTREF : len;
+		PKT_INIT(pkt);
+		pkt->ext = obj->buf + off;
+		pkt->ref = &obj->ref;
+		pkt->max = n;
+		pkt->len = n;
+		PKT_REF_GET(&obj->ref);
+		CBLIST_ADD_TAIL(out, &pkt->list);
+		(*nalloced)++;
+
+		off += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ *	Reply the request @req using cached object @obj, 304 is
+ *	replied if If-None-Match is matched.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_hcache_reply(hcache_t *hc, hcache_obj_t *obj, const hcache_req_t *req,
+	      cblist_t *out, objpool_t *pktpool, int *nalloced)
+{
+	int len;
+	u_int32_t age;
+	char buf[_HC_MAX_ETAG + 128];
+
+	age = obj->age + (_hcache_now() - obj->stored);
+
+	if (req->inm && obj->etaglen &&
+	    _hcache_etag_match(req->inm, req->inmlen,
+			       obj->buf + obj->etag, obj->etaglen))
+	{
+		_hcache_count_notmod(hc, obj);
+		len = snprintf(buf, sizeof(buf),
+			       "HTTP/1.1 304 Not Modified\r\n"
+			       "ETag: %.*s\r\nAge: %u\r\n\r\n",
+			       obj->etaglen, obj->buf + obj->etag, age);
+		return _hcache_emit(pktpool, out, nalloced, buf, len);
+	}
+
+	/* the stored header, length of decoded body, Age, and the body */
+	len = snprintf(buf, sizeof(buf), "Content-Length: %u\r\n"
+		       "Age: %u\r\n\r\n", obj->blen, age);
+	if (_hcache_emit_ref(pktpool, out, nalloced, obj, 0, obj->hlen) ||
+	    _hcache_emit(pktpool, out, nalloced, buf, len) ||
+	    _hcache_emit_ref(pktpool, out, nalloced, obj,
+			     obj->hlen, obj->blen))
+		return -1;
+
+	return 0;
+}
+
+/**
+ *	Disable cache on session @hs, all data is passed since
+ *	then.
+ *
+ *	No return.
+ */
+static void 
+_hcache_off(hcache_ssn_t *hs)
+{
+	hs->off = 1;
+}
+
+/**
+ *	Save @len bytes in @val into @hs->qhdr, the request header
+ *	value is kept until the header is processed.
+ *
+ *	Return the saved value, NULL if @hs->qhdr is full.
+ */
+static const char * 
+_hcache_save(hcache_ssn_t *hs, const char *val, int len)
+{
+	char *ptr;
+
+	if (hs->qlen + len > HCACHE_MAX_HDR)
+		return NULL;
+
+	ptr = hs->qhdr + hs->qlen;
+	memcpy(ptr, val, len);
+	hs->qlen += len;
+
+	return ptr;
+}
+
+/**
+ *	The request header is finished, save the URL and decide
+ *	the connection persistence.
+ *
+ *	No return.
+ */
+static void 
+_hcache_request_end(hcache_ssn_t *hs)
+{
+	size_t len;
+	const char *url;
+	const char *slash;
+	hcache_req_t *req = &hs->req;
+	http_info_t *hi = &hs->hi;
+
+	req->done = 1;
+
+	if (hi->request.method == HTTP_MED_CONNECT)
+		req->tunnel = 1;
+
+	/* HTTP/1.0 close connection by default */
+	if (hi->request.version == HTTP_VER_10 && !req->keepalive)
+		req->close = 1;
+
+	url = http_get_str(hi, HTTP_DIR_REQUEST, HTTP_STR_URL, &len);
+	if (!url)
+		return;
+
+	/* absolute URL, the host in URL is used */
+	if (len > 7 && strncasecmp(url, "http://", 7) == 0) {
+		slash = memchr(url + 7, '/', len - 7);
+		if (!slash)
+			slash = url + len;
+		req->hostlen = slash - url - 7;
+		req->host = _hcache_save(hs, url + 7, req->hostlen);
+		len -= slash - url;
+		url = slash;
+	}
+
+	req->ulen = len;
+	req->url = _hcache_save(hs, url, len);
+	if (!req->url || !req->host)
+		req->nostore = req->nolookup = 1;
+}
+
+/**
+ *	Process the request header @id which value is @val.
+ *
+ *	No return.
+ */
+static void 
+_hcache_request_cb(hcache_ssn_t *hs, int id, const char *val, int len)
+{
+	int i;
+	long maxage;
+	long smaxage;
+	hcache_req_t *req = &hs->req;
+
+	switch (id) {
+
+	case HTTP_HST_END:
+		_hcache_request_end(hs);
+		return;
+
+	case HTTP_HST_HOST:
+		if (req->host)
+			return;
+		req->host = _hcache_save(hs, val, len);
+		req->hostlen = len;
+		val = req->host;
+		break;
+
+	case HTTP_HST_CONNECTION:
+		if (http_token_find(val, len, "close"))
+			req->close = 1;
+		else if (http_token_find(val, len, "keep-alive"))
+			req->keepalive = 1;
+		return;
+
+	case HTTP_HST_CACHE_CONTROL:
+		maxage = smaxage = -1;
+		i = _hcache_cc(val, len, &maxage, &smaxage);
+		if (i & _HC_CC_NOSTORE)
+			req->nostore = 1;
+		if (i || maxage == 0)
+			req->nolookup = 1;
+		return;
+
+	case HTTP_HST_PRAGMA:
+		if (http_token_find(val, len, "no-cache"))
+			req->nolookup = 1;
+		return;
+
+	case HTTP_HST_AUTHORIZATION:
+	case HTTP_HST_RANGE:
+		req->nostore = 1;
+		req->nolookup = 1;
+		return;
+
+	case HTTP_HST_IF_NONE_MATCH:
+		req->inm = _hcache_save(hs, val, len);
+		req->inmlen = len;
+		val = req->inm;
+		break;
+
+	case HTTP_HST_UPGRADE:
+		req->tunnel = 1;
+		return;
+
+	default:
+		i = _hcache_vary_index(id);
+		if (i < 0)
+			return;
+		req->vary[i] = _hcache_save(hs, val, len);
+		req->vlen[i] = req->vary[i] ? len : 0;
+		val = req->vary[i];
+		break;
+	}
+
+	/* the value is lost, the key or reply is not correct */
+	if (!val)
+		req->nostore = req->nolookup = 1;
+}
+
+/**
+ *	Process the complete request header of @hs, the header
+ *	packets are the packets in @in until @last(include).
+ *
+ *	Return 1 if hit, 0 if forwarded, -1 on error.
+ */
+static int 
+_hcache_request_header(hcache_t *hc, hcache_ssn_t *hs, cblist_t *in,
+		       packet_t *last, cblist_t *fwd, cblist_t *out,
+		       objpool_t *pktpool, int *nalloced)
+{
+	int ret = 0;
+	int st;
+	int cacheable;
+	hcache_obj_t *obj = NULL;
+	hcache_pend_t *pend;
+	hcache_req_t *req = &hs->req;
+	http_info_t *hi = &hs->hi;
+	packet_t *pkt, *bk;
+	_hc_kbuf_t kb;
+
+	hs->qpkts = 0;
+	hs->qscan = 0;
+
+	/* the request have body is not cached */
+	cacheable = (hi->request.method == HTTP_MED_GET && 
+		     req->host && req->hostlen > 0 && req->url &&
+		     http_get_int(hi, HTTP_DIR_REQUEST, HTTP_INT_STATE) == 
+		     HTTP_STE_FIN && _hcache_build_key(req, &kb.key) == 0);
+
+	/* lookup only when no response is pending, keep order */
+	st = http_get_int(hi, HTTP_DIR_RESPONSE, HTTP_INT_STATE);
+	if (cacheable && !req->nolookup && !req->close &&
+	    hi->request.version == HTTP_VER_11 && hs->phead == hs->ptail &&
+	    (st == HTTP_STE_BEGIN || st == HTTP_STE_FIN))
+		obj = hcache_get(hc, &kb.key);
+
+	if (obj) {
+		ret = _hcache_reply(hc, obj, req, out, pktpool, nalloced);
+		hcache_put(obj);
+		if (unlikely(ret))
+			return -1;
+
+		/* drop the request */
+		CBLIST_FOR_EACH_SAFE(in, pkt, bk, list) {
+			CBLIST_DEL(&pkt->list);
+			PKT_FREE(pkt);
+			(*nalloced)--;
+			if (pkt == last)
+				break;
+		}
+		return 1;
+	}
+
+	/* forward the request */
+	CBLIST_FOR_EACH_SAFE(in, pkt, bk, list) {
+		CBLIST_DEL(&pkt->list);
+		CBLIST_ADD_TAIL(fwd, &pkt->list);
+		if (pkt == last)
+			break;
+	}
+
+	if (hs->ptail - hs->phead >= HCACHE_MAX_REQ) {
+		_hcache_off(hs);
+		return 0;
+	}
+
+	pend = &hs->pends[hs->ptail % HCACHE_MAX_REQ];
+	pend->head = (hi->request.method == HTTP_MED_HEAD);
+	pend->key = NULL;
+	if (cacheable && !req->nostore)
+		pend->key = _hcache_dup_key(&kb.key);
+	hs->ptail++;
+
+	if (req->tunnel)
+		_hcache_off(hs);
+
+	return 0;
+}
+
+/**
+ *	Record the response header line at @pos which is removed
+ *	from stored object.
+ *
+ *	No return.
+ */
+static void 
+_hcache_drop_line(hcache_res_t *res, u_int64_t pos)
+{
+	if (res->ndrop >= HCACHE_MAX_DROP) {
+		res->nostore = 1;
+		return;
+	}
+
+	res->drop[res->ndrop++] = pos;
+}
+
+/**
+ *	Parse the Vary value @val, the supported headers are set
+ *	in @res->vmask, the others make response can't be stored.
+ *
+ *	No return.
+ */
+static void 
+_hcache_vary(hcache_res_t *res, const char *val, int len)
+{
+	int i;
+	int n;
+	const char *ptr;
+	const char *end;
+	const char *next;
+
+	ptr = val;
+	end = val + len;
+	while (ptr < end) {
+		next = memchr(ptr, ',', end - ptr);
+		if (!next)
+			next = end;
+		while (ptr < next && isspace((unsigned char)*ptr))
+			ptr++;
+		n = next - ptr;
+		while (n > 0 && isspace((unsigned char)ptr[n - 1]))
+			n--;
+		i = _hcache_vary_index(http_header2id(ptr, n));
+		if (i < 0)
+			res->nostore = 1;
+		else
+			res->vmask |= 1 << i;
+		ptr = next + 1;
+	}
+}
+
+/**
+ *	Copy the response header in @hs->hdr until @eoh into @obj,
+ *	the removed lines are skipped, the last empty line is not
+ *	copied.
+ *
+ *	No return.
+ */
+static void 
+_hcache_copy_header(hcache_ssn_t *hs, hcache_obj_t *obj, int eoh)
+{
+	int i = 0;
+	int n;
+	int rpos = 0;
+	const char *line;
+	const char *lf;
+	const char *val;
+	hcache_res_t *res = &hs->res;
+
+	while (rpos < eoh) {
+		line = hs->hdr + rpos;
+		lf = memchr(line, '\n', eoh - rpos);
+		n = lf ? lf - line + 1 : eoh - rpos;
+
+		while (i < res->ndrop && res->drop[i] < rpos)
+			i++;
+		if (i < res->ndrop && res->drop[i] == rpos) {
+			rpos += n;
+			continue;
+		}
+
+		/* the ETag value offset in object */
+		if (rpos == res->etag) {
+			val = memchr(line, ':', n);
+			if (val) {
+				val++;
+				while (*val == ' ' || *val == '\t')
+					val++;
+				obj->etag = obj->hlen + (val - line);
+				obj->etaglen = res->etaglen;
+			}
+		}
+
+		memcpy(obj->buf + obj->hlen, line, n);
+		obj->hlen += n;
+		rpos += n;
+	}
+}
+
+/**
+ *	The response header of @hs is finished, @eoh is the begin
+ *	of last empty line, decide store it or not.
+ *
+ *	No return.
+ */
+static void 
+_hcache_response_header(hcache_ssn_t *hs, int eoh)
+{
+	int code;
+	int chunked;
+	int nobody;
+	long ttl = -1;
+	u_int64_t cap;
+	u_int64_t clen = 0;
+	hcache_t *hc = hs->hc;
+	hcache_res_t *res = &hs->res;
+	http_info_t *hi = &hs->hi;
+
+	res->done = 1;
+	code = hi->response.retcode;
+
+	/* interim response, the final response follow it */
+	if (code >= 100 && code < 200 && code != 101)
+		return;
+
+	/* no request or protocol switched */
+	if (hs->phead == hs->ptail || code == 101) {
+		_hcache_off(hs);
+		return;
+	}
+	hs->cur = hs->pends[hs->phead % HCACHE_MAX_REQ];
+	hs->phead++;
+
+	/* response of HEAD have no body */
+	if (hs->cur.head)
+		http_skip_body(hi, HTTP_DIR_RESPONSE);
+
+	chunked = http_get_int(hi, HTTP_DIR_RESPONSE, HTTP_INT_CHUNKED);
+	if (http_get_int(hi, HTTP_DIR_RESPONSE, HTTP_INT_STATE) == 
+	    HTTP_STE_BODY && !chunked)
+	{
+		/* close-delimited body */
+		if (res->te || !res->clen) {
+			_hcache_off(hs);
+			return;
+		}
+		clen = http_get_len(hi, HTTP_DIR_RESPONSE, HTTP_INT_CLEN);
+	}
+	nobody = (hs->cur.head || code == 204 || code == 304);
+
+	/* the freshness lifetime */
+	if (res->smaxage >= 0)
+		ttl = res->smaxage;
+	else if (res->maxage >= 0)
+		ttl = res->maxage;
+	else if (res->expires)
+		ttl = res->expires - (res->date > 0 ? res->date : time(NULL));
+	ttl -= res->age;
+
+	if (!hs->cur.key || nobody || res->nostore || ttl <= 0 || 
+	    res->age < 0 ||
+	    (res->cc & (_HC_CC_NOSTORE | _HC_CC_NOCACHE | _HC_CC_PRIVATE)) ||
+	    (code != 200 && code != 203 && code != 301 &&
+	     code != 404 && code != 410))
+		return;
+
+	/* the header is oversize */
+	if (eoh + 2 > hs->hlen || eoh >= hc->maxobj)
+		return;
+
+	cap = eoh + (chunked ? _HC_INIT_BODY : clen);
+	if (cap > hc->maxobj) {
+		if (!chunked)
+			return;
+		cap = hc->maxobj;
+	}
+
+	hs->obj = _hcache_obj_alloc(hs->cur.key, cap);
+	if (!hs->obj)
+		return;
+	hs->cur.key = NULL;
+
+	_hcache_copy_header(hs, hs->obj, eoh);
+	hs->obj->vmask = res->vmask;
+	hs->obj->age = res->age;
+	hs->obj->stored = _hcache_now();
+	hs->obj->expire = hs->obj->stored + ttl;
+}
+
+/**
+ *	Process the response header @id at @pos which value is
+ *	@val.
+ *
+ *	No return.
+ */
+static void 
+_hcache_response_cb(hcache_ssn_t *hs, int id, u_int64_t pos,
+		    const char *val, int len)
+{
+	hcache_res_t *res = &hs->res;
+
+	switch (id) {
+
+	case HTTP_HST_END:
+		_hcache_response_header(hs, pos);
+		break;
+
+	/* the length of decoded body is added in reply */
+	case HTTP_HST_CONTENT_LENGTH:
+		res->clen = 1;
+		_hcache_drop_line(res, pos);
+		break;
+
+	case HTTP_HST_TRANSFER_ENCODING:
+		res->te = 1;
+		_hcache_drop_line(res, pos);
+		break;
+
+	case HTTP_HST_CONNECTION:
+	case HTTP_HST_KEEP_ALIVE:
+	case HTTP_HST_PROXY_CONNECTION:
+		_hcache_drop_line(res, pos);
+		break;
+
+	case HTTP_HST_AGE:
+		res->age = _hcache_num(val, len);
+		_hcache_drop_line(res, pos);
+		break;
+
+	case HTTP_HST_CACHE_CONTROL:
+		res->cc |= _hcache_cc(val, len, &res->maxage, &res->smaxage);
+		break;
+
+	case HTTP_HST_PRAGMA:
+		if (http_token_find(val, len, "no-cache"))
+			res->cc |= _HC_CC_NOCACHE;
+		break;
+
+	case HTTP_HST_EXPIRES:
+		res->expires = _hcache_date(val, len);
+		break;
+
+	case HTTP_HST_DATE:
+		res->date = _hcache_date(val, len);
+		break;
+
+	case HTTP_HST_VARY:
+		_hcache_vary(res, val, len);
+		break;
+
+	case HTTP_HST_ETAG:
+		if (len <= _HC_MAX_ETAG) {
+			res->etag = pos;
+			res->etaglen = len;
+		}
+		break;
+
+	/* folded line can't be removed with its header */
+	case HTTP_HST_BEGIN:
+	case HTTP_HST_SET_COOKIE:
+	case HTTP_HST_CONTENT_RANGE:
+		res->nostore = 1;
+		break;
+	}
+}
+
+/**
+ *	The header callback of parser, see http_header_cb.
+ */
+static void 
+_hcache_header_cb(http_info_t *hi, int dir, int id, u_int64_t pos,
+		  const char *val, size_t len, void *arg)
+{
+	hcache_ssn_t *hs = arg;
+
+	if (dir == HTTP_DIR_REQUEST)
+		_hcache_request_cb(hs, id, val, len);
+	else
+		_hcache_response_cb(hs, id, pos, val, len);
+}
+
+/**
+ *	The body callback of parser, the decoded response body is
+ *	added into object in building.
+ */
+static void 
+_hcache_body_cb(http_info_t *hi, int dir, const char *data, size_t len,
+		void *arg)
+{
+	hcache_ssn_t *hs = arg;
+
+	if (dir != HTTP_DIR_RESPONSE || !hs->obj)
+		return;
+
+	if (_hcache_obj_append(hs->obj, hs->hc->maxobj, data, len)) {
+		hcache_put(hs->obj);
+		hs->obj = NULL;
+	}
+}
+
+/**
+ *	The response is finished, store the object if have.
+ *
+ *	No return.
+ */
+static void 
+_hcache_response_end(hcache_t *hc, hcache_ssn_t *hs)
+{
+	char *buf;
+	hcache_obj_t *obj;
+
+	if (hs->cur.key)
+		free(hs->cur.key);
+	hs->cur.key = NULL;
+
+	obj = hs->obj;
+	hs->obj = NULL;
+	if (!obj)
+		return;
+
+	/* shrink the buffer, it's immutable since now */
+	if (obj->cap > obj->hlen + obj->blen) {
+		buf = realloc(obj->buf, obj->hlen + obj->blen);
+		if (buf) {
+			obj->buf = buf;
+			obj->cap = obj->hlen + obj->blen;
+		}
+	}
+	obj->size = sizeof(*obj) + sizeof(hcache_key_t) +
+		obj->key->len + obj->cap;
+
+	hcache_insert(hc, obj);
+}
+
+/**
+ *	Get the packet @n(begin at 0) in @pkts.
+ *
+ *	Return the packet, NULL if not exist.
+ */
+static packet_t * 
+_hcache_nth_packet(cblist_t *pkts, int n)
+{
+	packet_t *pkt;
+
+	CBLIST_FOR_EACH(pkts, pkt, list) {
+		if (n-- == 0)
+			return pkt;
+	}
+
+	return NULL;
+}
+
+void 
+hcache_ssn_init(hcache_ssn_t *hs)
+{
+	if (unlikely(!hs))
+		return;
+
+	/* the @qhdr and @hdr are the last members, needn't clear */
+	memset(hs, 0, offsetof(hcache_ssn_t, qhdr));
+	http_set_header_cb(&hs->hi, _hcache_header_cb, hs);
+	http_set_body_cb(&hs->hi, _hcache_body_cb, hs);
+}
+
+void 
+hcache_ssn_free(hcache_ssn_t *hs)
+{
+	hcache_pend_t *pend;
+
+	if (unlikely(!hs))
+		return;
+
+	while (hs->phead != hs->ptail) {
+		pend = &hs->pends[hs->phead % HCACHE_MAX_REQ];
+		if (pend->key)
+			free(pend->key);
+		pend->key = NULL;
+		hs->phead++;
+	}
+
+	if (hs->cur.key)
+		free(hs->cur.key);
+	hs->cur.key = NULL;
+
+	if (hs->obj)
+		hcache_put(hs->obj);
+	hs->obj = NULL;
+
+	http_free_info(&hs->hi);
+}
+
+int 
+hcache_request(hcache_t *hc, hcache_ssn_t *hs, cblist_t *in,
+	       cblist_t *fwd, cblist_t *out, objpool_t *pktpool,
+	       int *nalloced)
+{
+	int n;
+	int len;
+	int st;
+	int done;
+	int ret;
+	int nhit = 0;
+	packet_t *pkt;
+
+	if (unlikely(!hc || !hs || !in || !fwd || !out ||
+		     !pktpool || !nalloced))
+		ERR_RET(-1, "invalid argument\n");
+
+	while (!CBLIST_IS_EMPTY(in)) {
+
+		if (hs->off) {
+			CBLIST_JOIN(fwd, in);
+			break;
+		}
+
+		/* new request begin */
+		st = http_get_int(&hs->hi, HTTP_DIR_REQUEST, HTTP_INT_STATE);
+		if (st == HTTP_STE_BEGIN || st == HTTP_STE_FIN) {
+			memset(&hs->req, 0, sizeof(hs->req));
+			hs->qpkts = 0;
+			hs->qscan = 0;
+			hs->qlen = 0;
+		}
+
+		/* the header packets are kept in @in until it finished */
+		done = hs->req.done;
+		pkt = _hcache_nth_packet(in, done ? 0 : hs->qpkts);
+		if (!pkt)
+			break;
+
+		len = pkt->len - pkt->sendpos;
+		n = http_parse(&hs->hi, HTTP_DIR_REQUEST, 
+			       PKT_DATA(pkt) + pkt->sendpos, len);
+		if (n < 0) {
+			_hcache_off(hs);
+			continue;
+		}
+
+		/* the next request begin in new packet */
+		if (n > 0 && 
+		    http_split_packet(pkt, pkt->len - n, pktpool, nalloced))
+			return -1;
+
+		/* the request body */
+		if (done) {
+			CBLIST_DEL(&pkt->list);
+			CBLIST_ADD_TAIL(fwd, &pkt->list);
+			continue;
+		}
+
+		if (!hs->req.done) {
+			hs->qpkts++;
+			hs->qscan += len;
+			/* oversize header, give up */
+			if (hs->qscan > HCACHE_MAX_HDR)
+				_hcache_off(hs);
+			continue;
+		}
+
+		ret = _hcache_request_header(hc, hs, in, pkt, fwd,
+					     out, pktpool, nalloced);
+		if (unlikely(ret < 0))
+			return -1;
+		nhit += ret;
+	}
+
+	return nhit;
+}
+
+int 
+hcache_response(hcache_t *hc, hcache_ssn_t *hs, cblist_t *pkts)
+{
+	int n;
+	int len;
+	int st;
+	const char *ptr;
+	packet_t *pkt;
+
+	if (unlikely(!hc || !hs || !pkts))
+		ERR_RET(-1, "invalid argument\n");
+
+	hs->hc = hc;
+
+	CBLIST_FOR_EACH(pkts, pkt, list) {
+
+		ptr = PKT_DATA(pkt) + pkt->sendpos;
+		len = pkt->len - pkt->sendpos;
+
+		while (len > 0 && !hs->off) {
+
+			/* new response begin */
+			st = http_get_int(&hs->hi, HTTP_DIR_RESPONSE, 
+					  HTTP_INT_STATE);
+			if (st == HTTP_STE_BEGIN || st == HTTP_STE_FIN) {
+				memset(&hs->res, 0, sizeof(hs->res));
+				hs->res.maxage = -1;
+				hs->res.smaxage = -1;
+				hs->res.etag = -1;
+				hs->hlen = 0;
+			}
+
+			/* the header is copied for store */
+			if (!hs->res.done) {
+				n = HCACHE_MAX_HDR - hs->hlen;
+				if (n > len)
+					n = len;
+				memcpy(hs->hdr + hs->hlen, ptr, n);
+				hs->hlen += n;
+			}
+
+			n = http_parse(&hs->hi, HTTP_DIR_RESPONSE, ptr, len);
+			if (n < 0) {
+				_hcache_off(hs);
+				break;
+			}
+
+			/* oversize header, give up */
+			if (!hs->res.done && hs->hlen >= HCACHE_MAX_HDR) {
+				_hcache_off(hs);
+				break;
+			}
+
+			if (hs->res.done && 
+			    http_get_int(&hs->hi, HTTP_DIR_RESPONSE, 
+					 HTTP_INT_STATE) == HTTP_STE_FIN)
+				_hcache_response_end(hc, hs);
+
+			ptr += len - n;
+			len = n;
+		}
+
+		if (hs->off)
+			break;
+	}
+
+	/* release the resource when cache disabled */
+	if (hs->off)
+		hcache_ssn_free(hs);
+
+	return 0;
+}
+
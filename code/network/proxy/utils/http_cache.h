@@ -0,0 +1,303 @@
+/**
+ *	@file	http_cache.h
+ *
+ *	@brief	In-memory HTTP response cache for proxy. It's shared
+ *		by all workers, the object is keyed by Host+URL and
+ *		the request headers listed in response Vary.
+ *
+ *		The stored object is immutable and refcounted, the
+ *		cache hit is served by packets which reference the
+ *		object buffer, no data copy. The object is evicted
+ *		by LRU when memory exceed the limit.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#ifndef FZ_HTTP_CACHE_H
+#define FZ_HTTP_CACHE_H
+
+#include <sys/types.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "cblist.h"
+#include "objpool.h"
+#include "packet.h"
+#include "gcc_common.h"
+#include "http_parse.h"
+#include "http_util.h"
+
+#define	HCACHE_NSHARD		16	/* number of shard, power of 2 */
+#define	HCACHE_MAX_HDR		8192	/* max header size */
+#define	HCACHE_MAX_KEY		2048	/* max key(Host+URL+Vary) size */
+#define	HCACHE_MAX_REQ		16	/* max pipelined requests */
+#define	HCACHE_MAX_DROP		8	/* max removed response header lines */
+
+/* the request headers supported in Vary */
+#define	HCACHE_VARY_ACCEPT	0	/* Accept */
+#define	HCACHE_VARY_CHARSET	1	/* Accept-Charset */
+#define	HCACHE_VARY_ENCODING	2	/* Accept-Encoding */
+#define	HCACHE_VARY_LANGUAGE	3	/* Accept-Language */
+#define	HCACHE_VARY_AGENT	4	/* User-Agent */
+#define	HCACHE_NVARY		5
+
+/**
+ *	Cache key: Host+URL and values of request headers
+ *	which can be used in Vary.
+ */
+typedef struct hcache_key {
+	u_int64_t	hash;		/* hash of Host+URL */
+	u_int16_t	klen;		/* length of Host+URL */
+	u_int16_t	vlen[HCACHE_NVARY];/* length of Vary values */
+	u_int16_t	len;		/* bytes in @data */
+	char		data[0];	/* Host+URL, then Vary values */
+} hcache_key_t;
+
+/**
+ *	Cached object, it's immutable after insert into cache.
+ */
+typedef struct hcache_obj {
+	pkt_ref_t	ref;		/* reference count */
+	cblist_t	hlist;		/* list in hash bucket */
+	cblist_t	lru;		/* list in shard LRU */
+	hcache_key_t	*key;		/* key */
+	u_int32_t	vmask;		/* Vary headers, 1 << HCACHE_VARY_XXX */
+	u_int32_t	stored;		/* stored time */
+	u_int32_t	expire;		/* expire time */
+	u_int32_t	atime;		/* last access time */
+	u_int32_t	age;		/* Age when stored */
+	u_int16_t	etag;		/* ETag offset in @buf */
+	u_int16_t	etaglen;	/* ETag length */
+	int		linked;		/* in cache */
+	size_t		size;		/* memory used */
+	u_int32_t	hlen;		/* header bytes without last CRLF */
+	u_int32_t	blen;		/* decoded body bytes */
+	u_int32_t	cap;		/* size of @buf */
+	char		*buf;		/* header and body */
+} hcache_obj_t;
+
+/**
+ *	Cache statistic data.
+ */
+typedef struct hcache_stat {
+	u_int64_t	nhit;		/* cache hit */
+	u_int64_t	nmiss;		/* cache miss */
+	u_int64_t	nnotmod;	/* 304 reply for If-None-Match */
+	u_int64_t	nstore;		/* object stored */
+	u_int64_t	nevict;		/* evicted by LRU */
+	u_int64_t	nexpire;	/* removed because expired */
+	u_int64_t	nobj;		/* objects in cache */
+	u_int64_t	mem;		/* memory used */
+} hcache_stat_t;
+
+/**
+ *	Cache shard, protected by @lock.
+ */
+typedef struct hcache_shard {
+	pthread_mutex_t	lock;		/* lock */
+	cblist_t	lru;		/* LRU list, head is oldest */
+	cblist_t	*buckets;	/* hash buckets */
+	u_int32_t	mask;		/* bucket mask */
+	size_t		maxmem;		/* memory limit */
+	hcache_stat_t	stat;		/* statistic data */
+} __cacheline_aligned hcache_shard_t;
+
+/**
+ *	The shared cache.
+ */
+typedef struct hcache {
+	size_t		maxmem;		/* memory limit */
+	size_t		maxobj;		/* max object size */
+	hcache_shard_t	shards[HCACHE_NSHARD];
+} hcache_t;
+
+/**
+ *	Pending request wait response.
+ */
+typedef struct hcache_pend {
+	int		head;		/* HEAD request */
+	hcache_key_t	*key;		/* key if response can be stored */
+} hcache_pend_t;
+
+/**
+ *	The request infomation used in cache, the values are
+ *	copied into @qhdr of session.
+ */
+typedef struct hcache_req {
+	int		done;		/* header finished */
+	int		close;		/* Connection: close */
+	int		keepalive;	/* Connection: keep-alive */
+	int		tunnel;		/* CONNECT or Upgrade */
+	int		nolookup;	/* can't served from cache */
+	int		nostore;	/* response can't be stored */
+	const char	*url;
+	int		ulen;
+	const char	*host;
+	int		hostlen;
+	const char	*inm;		/* If-None-Match */
+	int		inmlen;
+	const char	*vary[HCACHE_NVARY];
+	int		vlen[HCACHE_NVARY];
+} hcache_req_t;
+
+/**
+ *	The response infomation used in cache.
+ */
+typedef struct hcache_res {
+	int		done;		/* header finished */
+	int		clen;		/* have Content-Length */
+	int		te;		/* have Transfer-Encoding */
+	int		cc;		/* Cache-Control flags */
+	int		nostore;	/* can't be stored */
+	u_int32_t	vmask;		/* Vary headers */
+	long		maxage;		/* max-age, -1 if not present */
+	long		smaxage;	/* s-maxage, -1 if not present */
+	long		age;		/* Age */
+	time_t		expires;	/* Expires */
+	time_t		date;		/* Date */
+	int		etag;		/* ETag line position, -1 if none */
+	int		etaglen;	/* ETag length */
+	int		ndrop;		/* number of @drop */
+	int		drop[HCACHE_MAX_DROP];/* removed line positions */
+} hcache_res_t;
+
+/**
+ *	Per-session cache state, the request and response are
+ *	framed by http_parse.
+ */
+typedef struct hcache_ssn {
+	http_info_t	hi;		/* parser of request and response */
+	hcache_t	*hc;		/* cache of response callback */
+	int		off;		/* not HTTP, pass all data */
+
+	/* request side */
+	hcache_req_t	req;		/* request in parsing */
+	int		qpkts;		/* header packets parsed in input */
+	int		qscan;		/* header bytes parsed in input */
+	int		qlen;		/* bytes in @qhdr */
+	hcache_pend_t	pends[HCACHE_MAX_REQ];/* requests wait response */
+	u_int32_t	phead;		/* pending ring head */
+	u_int32_t	ptail;		/* pending ring tail */
+
+	/* response side */
+	hcache_res_t	res;		/* response in parsing */
+	hcache_pend_t	cur;		/* the request of response */
+	hcache_obj_t	*obj;		/* object in building */
+
+	int		hlen;		/* bytes in @hdr */
+	char		qhdr[HCACHE_MAX_HDR];/* request header values */
+	char		hdr[HCACHE_MAX_HDR];/* response header */
+} hcache_ssn_t;
+
+/**
+ *	Alloc a shared cache, @maxmem is the memory limit, the
+ *	object large than @maxobj is not stored.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+extern hcache_t * 
+hcache_alloc(size_t maxmem, size_t maxobj);
+
+/**
+ *	Free the cache @hc alloced by hcache_alloc(), the object
+ *	still referenced by packet is freed when last reference
+ *	put.
+ *
+ *	No return.
+ */
+extern void 
+hcache_free(hcache_t *hc);
+
+/**
+ *	Get the statistic data of @hc into @st.
+ *
+ *	No return.
+ */
+extern void 
+hcache_get_stat(hcache_t *hc, hcache_stat_t *st);
+
+/**
+ *	Print the statistic data of @hc into @buf, @len is
+ *	size of @buf.
+ *
+ *	Return the length of output.
+ */
+extern int 
+hcache_print(hcache_t *hc, char *buf, size_t len);
+
+/**
+ *	Find object of @key in @hc, the Vary values of @key
+ *	are compared with the object.
+ *
+ *	Return the object with a reference if found, NULL if
+ *	not found.
+ */
+extern hcache_obj_t * 
+hcache_get(hcache_t *hc, const hcache_key_t *key);
+
+/**
+ *	Insert object @obj into @hc, the caller's reference is
+ *	owned by cache. The old object which have same key and
+ *	Vary values is replaced.
+ *
+ *	Return 0 if success, -1 if not stored(@obj is freed).
+ */
+extern int 
+hcache_insert(hcache_t *hc, hcache_obj_t *obj);
+
+/**
+ *	Put a reference of @obj, it's freed when no reference.
+ *
+ *	No return.
+ */
+static inline void 
+hcache_put(hcache_obj_t *obj)
+{
+	PKT_REF_PUT(&obj->ref);
+}
+
+/**
+ *	Init the session cache state @hs.
+ *
+ *	No return.
+ */
+extern void 
+hcache_ssn_init(hcache_ssn_t *hs);
+
+/**
+ *	Release resource in session cache state @hs.
+ *
+ *	No return.
+ */
+extern void 
+hcache_ssn_free(hcache_ssn_t *hs);
+
+/**
+ *	Process the request packets in @in. The complete request
+ *	which need send to server is moved into @fwd, the request
+ *	hit the cache is dropped and the response packets are
+ *	added into @out. The incomplete request header is kept in
+ *	@in. New packet is alloced from @pktpool and counted in
+ *	@nalloced.
+ *
+ *	Return number of cache hit if success, -1 on error.
+ */
+extern int 
+hcache_request(hcache_t *hc, hcache_ssn_t *hs, cblist_t *in,
+	       cblist_t *fwd, cblist_t *out, objpool_t *pktpool,
+	       int *nalloced);
+
+/**
+ *	Parse the response packets in @pkts, the cacheable response
+ *	is stored into @hc when it's finished. The packets are not
+ *	modified.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+hcache_response(hcache_t *hc, hcache_ssn_t *hs, cblist_t *pkts);
+
+#endif /* end of FZ_HTTP_CACHE_H */
+
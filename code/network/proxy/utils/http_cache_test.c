@@ -0,0 +1,576 @@
+/**
+ *	@file	http_cache_test.c
+ *
+ *	@brief	http_cache test program, it stores a generated response
+ *		through hcache_request()/hcache_response(), check the
+ *		Vary/ETag/no-store/chunked cases, then report the hit
+ *		requests per second in multiple threads.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#define	_GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "packet.h"
+#include "proxy_common.h"
+#include "proxy_debug.h"
+#include "http_cache.h"
+
+#define	_MAX_THREAD	64
+
+int		g_timestamp;		/* timestamp in debug output */
+int		g_dbglvl;		/* debug level: 0 disable, 7 max */
+int		g_flowlvl;		/* flow level: 0 disable, 7 max */
+int		g_httplvl;		/* http level: 0 disable, 7 max */
+
+static char _g_optstr[] = ":s:n:t:h";
+static int _g_size = 64;		/* body size in KB */
+static int _g_loop = 1000000;		/* hit requests of each thread */
+static int _g_nthread = 1;		/* number of thread */
+static char *_g_body;			/* response body */
+static char *_g_response;		/* whole response */
+static int _g_reslen;
+static hcache_t *_g_hc;
+
+static const char _g_request[] =
+	"GET /index.html HTTP/1.1\r\n"
+	"Host: WWW.Test.com\r\n"
+	"Accept-Encoding: gzip\r\n"
+	"\r\n";
+
+static const char _g_vary_request[] =
+	"GET /index.html HTTP/1.1\r\n"
+	"Host: www.test.com\r\n"
+	"Accept-Encoding: br\r\n"
+	"\r\n";
+
+static const char _g_inm_request[] =
+	"GET /index.html HTTP/1.1\r\n"
+	"Host: www.test.com\r\n"
+	"Accept-Encoding: gzip\r\n"
+	"If-None-Match: W/\"0815\", \"12345\"\r\n"
+	"\r\n";
+
+static const char _g_nostore_request[] =
+	"GET /private.html HTTP/1.1\r\n"
+	"Host: www.test.com\r\n"
+	"\r\n";
+
+static const char _g_nostore_response[] =
+	"HTTP/1.1 200 OK\r\n"
+	"Cache-Control: no-store\r\n"
+	"Content-Length: 5\r\n"
+	"\r\n"
+	"hello";
+
+static const char _g_chunked_request[] =
+	"GET /chunked.html HTTP/1.1\r\n"
+	"Host: www.test.com\r\n"
+	"\r\n";
+
+static const char _g_chunked_response[] =
+	"HTTP/1.1 200 OK\r\n"
+	"Cache-Control: max-age=60\r\n"
+	"Transfer-Encoding: chunked\r\n"
+	"\r\n"
+	"5;ext=1\r\nhello\r\n6\r\n world\r\n0\r\n\r\n";
+
+/**
+ *	Show help message
+ *
+ *	No return.
+ */
+static void 
+_usage(void)
+{
+	printf("http_cache_test <options>\n");
+	printf("\t-s\tbody size in KB, default is 64\n");
+	printf("\t-n\thit requests of each thread, default is 1000000\n");
+	printf("\t-t\tnumber of thread, default is 1\n");
+	printf("\t-h\tshow help message\n");
+}
+
+/**
+ *	Parse command line argument.
+ *
+ * 	Return 0 if parse success, -1 on error.
+ */
+static int 
+_parse_cmd(int argc, char **argv)
+{
+	char opt;
+
+	opterr = 0;
+	while ( (opt = getopt(argc, argv, _g_optstr)) != -1) {
+
+		switch (opt) {
+
+		case 's':
+			_g_size = atoi(optarg);
+			if (_g_size < 1)
+				return -1;
+			break;
+
+		case 'n':
+			_g_loop = atoi(optarg);
+			if (_g_loop < 1)
+				return -1;
+			break;
+
+		case 't':
+			_g_nthread = atoi(optarg);
+			if (_g_nthread < 1 || _g_nthread > _MAX_THREAD)
+				return -1;
+			break;
+
+		case 'h':
+			return -1;
+
+		case ':':
+			printf("Option %c missing argument\n", optopt);
+			return -1;
+
+		case '?':
+			printf("Unknowed option %c\n", optopt);
+			return -1;
+		}
+	}
+
+	if (argc != optind)
+		return -1;
+
+	return 0;
+}
+
+/**
+ *	Init some global resource used in program.
+ *
+ * 	Return 0 if success, -1 on error.
+ */
+static int 
+_initiate(void)
+{
+	int i;
+	int blen;
+	char *ptr;
+
+	blen = _g_size * 1024;
+	_g_body = malloc(blen);
+	if (!_g_body)
+		return -1;
+
+	for (i = 0; i < blen; i++)
+		_g_body[i] = 'a' + i % 26;
+
+	_g_response = malloc(blen + 1024);
+	if (!_g_response)
+		return -1;
+
+	ptr = _g_response;
+	ptr += sprintf(ptr, "HTTP/1.1 200 OK\r\n"
+		       "Content-Type: text/html\r\n"
+		       "Cache-Control: public, max-age=3600\r\n"
+		       "Vary: Accept-Encoding\r\n"
+		       "ETag: \"12345\"\r\n"
+		       "Connection: keep-alive\r\n"
+		       "Content-Length: %d\r\n\r\n", blen);
+	memcpy(ptr, _g_body, blen);
+	ptr += blen;
+	_g_reslen = ptr - _g_response;
+
+	_g_hc = hcache_alloc(64 << 20, 4 << 20);
+	if (!_g_hc)
+		return -1;
+
+	return 0;
+}
+
+/**
+ *	Release global resource alloced by _initiate().
+ *
+ * 	No return.
+ */
+static void 
+_release(void)
+{
+	if (_g_body)
+		free(_g_body);
+	_g_body = NULL;
+
+	if (_g_response)
+		free(_g_response);
+	_g_response = NULL;
+
+	if (_g_hc)
+		hcache_free(_g_hc);
+	_g_hc = NULL;
+}
+
+static u_int64_t 
+_walltime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *	Put @len bytes in @buf into packet list @pkts, the packet
+ *	is alloced from @pool.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_fill_packets(objpool_t *pool, cblist_t *pkts, const char *buf, int len)
+{
+	int n;
+	packet_t *pkt;
+
+	while (len > 0) {
+		pkt = objpool_get(pool);
+		if (!pkt)
+			return -1;
+		PKT_INIT(pkt);
+		n = len > pkt->max ? pkt->max : len;
+		memcpy(pkt->data, buf, n);
+		pkt->len = n;
+		CBLIST_ADD_TAIL(pkts, &pkt->list);
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ *	Move packets in @pkts into buffer @buf and free them.
+ *
+ *	Return the bytes of packets.
+ */
+static int 
+_drain_packets(cblist_t *pkts, char *buf, int max)
+{
+	int len = 0;
+	packet_t *pkt, *bk;
+
+	CBLIST_FOR_EACH_SAFE(pkts, pkt, bk, list) {
+		CBLIST_DEL(&pkt->list);
+		if (buf && len + pkt->len <= max)
+			memcpy(buf + len, PKT_DATA(pkt), pkt->len);
+		len += pkt->len;
+		PKT_FREE(pkt);
+	}
+
+	return len;
+}
+
+/**
+ *	Send request @req through a new session, the response @res
+ *	is passed to cache if the request is forwarded.
+ *
+ *	Return number of cache hit, -1 on error.
+ */
+static int 
+_do_request(objpool_t *pool, const char *req, const char *res, int reslen,
+	    char *out, int *outlen)
+{
+	int ret;
+	int nalloced = 0;
+	cblist_t in, fwd, resp, obuf;
+	hcache_ssn_t *hs;
+
+	hs = malloc(sizeof(*hs));
+	if (!hs)
+		return -1;
+	hcache_ssn_init(hs);
+
+	CBLIST_INIT(&in);
+	CBLIST_INIT(&fwd);
+	CBLIST_INIT(&resp);
+	CBLIST_INIT(&obuf);
+
+	ret = -1;
+	if (_fill_packets(pool, &in, req, strlen(req)))
+		goto out;
+
+	ret = hcache_request(_g_hc, hs, &in, &fwd, &obuf, pool, &nalloced);
+	if (ret < 0)
+		goto out;
+
+	if (ret == 0 && res) {
+		if (_fill_packets(pool, &resp, res, reslen) ||
+		    hcache_response(_g_hc, hs, &resp))
+			ret = -1;
+	}
+
+out:
+	*outlen = _drain_packets(&obuf, out, *outlen);
+	_drain_packets(&in, NULL, 0);
+	_drain_packets(&fwd, NULL, 0);
+	_drain_packets(&resp, NULL, 0);
+	hcache_ssn_free(hs);
+	free(hs);
+	return ret;
+}
+
+/**
+ *	Verify the cache hit response in @buf.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_verify(const char *buf, int len)
+{
+	int blen;
+	const char *eoh;
+
+	blen = _g_size * 1024;
+	if (len <= blen || strncmp(buf, "HTTP/1.1 200 OK\r\n", 17))
+		return -1;
+
+	eoh = memmem(buf, len, "\r\n\r\n", 4);
+	if (!eoh || eoh + 4 - buf + blen != len)
+		return -1;
+
+	if (!memmem(buf, eoh - buf, "\r\nAge: ", 7) ||
+	    memmem(buf, eoh - buf, "Connection:", 11))
+		return -1;
+
+	if (memcmp(eoh + 4, _g_body, blen))
+		return -1;
+
+	return 0;
+}
+
+/**
+ *	Store the response and check the hit, Vary, ETag, no-store
+ *	and chunked cases.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_test_function(void)
+{
+	int ret;
+	int len;
+	int max;
+	char *buf;
+	objpool_t *pool;
+
+	pool = objpool_alloc(MAX_PKTSIZE, 1024, 0);
+	if (!pool)
+		return -1;
+
+	max = _g_reslen + 1024;
+	buf = malloc(max);
+	if (!buf) {
+		objpool_free(pool);
+		return -1;
+	}
+
+	/* first request is miss, store response */
+	len = max;
+	ret = _do_request(pool, _g_request, _g_response, _g_reslen, buf, &len);
+	if (ret != 0 || len != 0) {
+		printf("store response failed: %d\n", ret);
+		goto err_free;
+	}
+
+	/* second request hit */
+	len = max;
+	ret = _do_request(pool, _g_request, NULL, 0, buf, &len);
+	if (ret != 1 || _verify(buf, len)) {
+		printf("cache hit failed: %d\n", ret);
+		goto err_free;
+	}
+
+	/* different Accept-Encoding is miss */
+	len = max;
+	ret = _do_request(pool, _g_vary_request, NULL, 0, buf, &len);
+	if (ret != 0 || len != 0) {
+		printf("Vary check failed: %d\n", ret);
+		goto err_free;
+	}
+
+	/* ETag match return 304 */
+	len = max;
+	ret = _do_request(pool, _g_inm_request, NULL, 0, buf, &len);
+	if (ret != 1 || len <= 0 ||
+	    strncmp(buf, "HTTP/1.1 304 Not Modified\r\n", 27))
+	{
+		printf("If-None-Match check failed: %d\n", ret);
+		goto err_free;
+	}
+
+	/* no-store response isn't stored */
+	len = max;
+	ret = _do_request(pool, _g_nostore_request, _g_nostore_response,
+			  strlen(_g_nostore_response), buf, &len);
+	len = max;
+	if (ret == 0)
+		ret = _do_request(pool, _g_nostore_request, NULL, 0, buf, &len);
+	if (ret != 0) {
+		printf("no-store check failed: %d\n", ret);
+		goto err_free;
+	}
+
+	/* chunked response is stored decoded */
+	len = max;
+	ret = _do_request(pool, _g_chunked_request, _g_chunked_response,
+			  strlen(_g_chunked_response), buf, &len);
+	len = max;
+	if (ret == 0)
+		ret = _do_request(pool, _g_chunked_request, NULL, 0, buf, &len);
+	if (ret != 1 || len < 11 || memcmp(buf + len - 11, "hello world", 11) ||
+	    !memmem(buf, len, "\r\nContent-Length: 11\r\n", 22) ||
+	    memmem(buf, len, "Transfer-Encoding", 17))
+	{
+		printf("chunked response check failed: %d\n", ret);
+		goto err_free;
+	}
+
+	printf("http_cache function test success\n");
+	free(buf);
+	objpool_free(pool);
+	return 0;
+
+err_free:
+	free(buf);
+	objpool_free(pool);
+	return -1;
+}
+
+/**
+ *	The thread send @_g_loop hit requests.
+ *
+ *	Return NULL if success, (void *)-1 on error.
+ */
+static void * 
+_test_thread(void *arg)
+{
+	int i;
+	int len;
+	int ret;
+	int nalloced = 0;
+	cblist_t in, fwd, out;
+	objpool_t *pool;
+	hcache_ssn_t *hs;
+	void *err = (void *)-1;
+
+	pool = objpool_alloc(MAX_PKTSIZE, 64, 0);
+	hs = malloc(sizeof(*hs));
+	if (!pool || !hs)
+		goto out;
+	hcache_ssn_init(hs);
+
+	CBLIST_INIT(&in);
+	CBLIST_INIT(&fwd);
+	CBLIST_INIT(&out);
+
+	for (i = 0; i < _g_loop; i++) {
+		if (_fill_packets(pool, &in, _g_request, sizeof(_g_request) - 1))
+			goto out;
+		ret = hcache_request(_g_hc, hs, &in, &fwd, &out, pool,
+				     &nalloced);
+		if (ret != 1)
+			goto out;
+		len = _drain_packets(&out, NULL, 0);
+		if (len <= _g_size * 1024)
+			goto out;
+	}
+
+	err = NULL;
+
+out:
+	if (hs) {
+		hcache_ssn_free(hs);
+		free(hs);
+	}
+	if (pool)
+		objpool_free(pool);
+	return err;
+}
+
+/**
+ *	Run hit requests in @_g_nthread threads.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_test_perf(void)
+{
+	int i;
+	int ret = 0;
+	void *err;
+	u_int64_t begin, end;
+	pthread_t tids[_MAX_THREAD];
+	char buf[512];
+
+	begin = _walltime();
+	for (i = 0; i < _g_nthread; i++) {
+		if (pthread_create(&tids[i], NULL, _test_thread, NULL)) {
+			printf("create thread failed: %s\n", strerror(errno));
+			_g_nthread = i;
+			ret = -1;
+			break;
+		}
+	}
+
+	for (i = 0; i < _g_nthread; i++) {
+		pthread_join(tids[i], &err);
+		if (err)
+			ret = -1;
+	}
+	end = _walltime();
+
+	if (ret) {
+		printf("http_cache hit test failed\n");
+		return -1;
+	}
+
+	printf("threads %d, body %dKB: %.0f hit/s, %.2f us/hit\n",
+	       _g_nthread, _g_size,
+	       (double)_g_loop * _g_nthread * 1000000000.0 / (end - begin),
+	       (double)(end - begin) / 1000.0 / _g_loop);
+
+	hcache_print(_g_hc, buf, sizeof(buf));
+	printf("%s", buf);
+
+	return 0;
+}
+
+int 
+main(int argc, char **argv)
+{
+	if (_parse_cmd(argc, argv)) {
+		_usage();
+		return -1;
+	}
+
+	if (_initiate()) {
+		_release();
+		return -1;
+	}
+
+	if (_test_function() || _test_perf()) {
+		_release();
+		return -1;
+	}
+
+	_release();
+
+	return 0;
+}
@@ -0,0 +1,879 @@
+/**
+ *	@file	http_mux.c
+ *
+ *	@brief	HTTP/1.1 request multiplexing implement.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#define	_GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+
+#include "packet.h"
+#include "proxy_common.h"
+#include "proxy_debug.h"
+#include "http_util.h"
+#include "http_mux.h"
+
+/**
+ *	Reset the framing state of @msg for a new message.
+ *
+ *	No return.
+ */
+static void 
+_hmux_msg_reset(hmux_msg_t *msg)
+{
+	msg->hdone = 0;
+	msg->err = 0;
+	msg->close = 0;
+	msg->keepalive = 0;
+	msg->clen = 0;
+	msg->te = 0;
+	msg->eoh = 0;
+	msg->ndrop = 0;
+	msg->hlen = 0;
+}
+
+/**
+ *	Process the header @id of @msg in direction @dir which value
+ *	is @val, the hop-by-hop header line at @pos is recorded and
+ *	removed when header is rewrote.
+ *
+ *	Return 0 if success, -1 if the message can't be multiplexed.
+ */
+static int 
+_hmux_header(hmux_msg_t *msg, int dir, int id, u_int64_t pos,
+	     const char *val, size_t len)
+{
+	switch (id) {
+
+	case HTTP_HST_CONNECTION:
+		if (http_token_find(val, len, "close"))
+			msg->close = 1;
+		if (http_token_find(val, len, "keep-alive"))
+			msg->keepalive = 1;
+		/* protocol switch can't be multiplexed */
+		if (dir == HTTP_DIR_REQUEST && 
+		    http_token_find(val, len, "upgrade"))
+			return -1;
+		break;
+
+	case HTTP_HST_KEEP_ALIVE:
+	case HTTP_HST_PROXY_CONNECTION:
+		break;
+
+	case HTTP_HST_UPGRADE:
+		if (dir == HTTP_DIR_REQUEST)
+			return -1;
+		break;
+
+	case HTTP_HST_CONTENT_LENGTH:
+		msg->clen = 1;
+		return 0;
+
+	case HTTP_HST_TRANSFER_ENCODING:
+		msg->te = 1;
+		return 0;
+
+	/* folded line can't be removed with its header */
+	case HTTP_HST_BEGIN:
+		return -1;
+
+	default:
+		return 0;
+	}
+
+	if (msg->ndrop >= HMUX_MAX_DROP)
+		return -1;
+	msg->drop[msg->ndrop++] = pos;
+
+	return 0;
+}
+
+/**
+ *	Free the packets in @in until @last(include).
+ *
+ *	No return.
+ */
+static void 
+_hmux_drop(cblist_t *in, packet_t *last, int *nalloced)
+{
+	packet_t *pkt, *bk;
+
+	CBLIST_FOR_EACH_SAFE(in, pkt, bk, list) {
+		CBLIST_DEL(&pkt->list);
+		PKT_FREE(pkt);
+		(*nalloced)--;
+		if (pkt == last)
+			break;
+	}
+}
+
+/**
+ *	Add @len bytes in @buf into packets in tail of @out.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_hmux_emit(cblist_t *out, const char *buf, int len, objpool_t *pktpool,
+	   int *nalloced)
+{
+	int n;
+	packet_t *pkt;
+
+	while (len > 0) {
+		pkt = objpool_get(pktpool);
+		if (unlikely(!pkt))
+			ERR_RET(-1, "alloc packet failed\n");
+
+		PKT_INIT(pkt);
+		n = len > pkt->max ? pkt->max : len;
+		memcpy(pkt->data, buf, n);
+		pkt->len = n;
+		CBLIST_ADD_TAIL(out, &pkt->list);
+		(*nalloced)++;
+
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ *	Rewrite the header in @msg->hdr without the empty lines 
+ *	before first line and hop-by-hop header lines, then add it 
+ *	with @extra header line and the empty line into @out.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_hmux_emit_header(hmux_msg_t *msg, const char *extra, cblist_t *out,
+		  objpool_t *pktpool, int *nalloced)
+{
+	int n;
+	int i = 0;
+	int rpos = 0;
+	int wpos = 0;
+	char *hdr = msg->hdr;
+	const char *lf;
+
+	while (rpos < msg->eoh && (hdr[rpos] == '\r' || hdr[rpos] == '\n'))
+		rpos++;
+
+	while (rpos < msg->eoh) {
+		lf = memchr(hdr + rpos, '\n', msg->eoh - rpos);
+		n = lf ? lf - (hdr + rpos) + 1 : msg->eoh - rpos;
+
+		while (i < msg->ndrop && msg->drop[i] < rpos)
+			i++;
+		if (i < msg->ndrop && msg->drop[i] == rpos)
+			i++;
+		else {
+			memmove(hdr + wpos, hdr + rpos, n);
+			wpos += n;
+		}
+		rpos += n;
+	}
+
+	n = extra ? strlen(extra) : 0;
+	if (wpos + n + 2 > HMUX_MAX_HDR)
+		return -1;
+
+	if (n > 0) {
+		memcpy(hdr + wpos, extra, n);
+		wpos += n;
+	}
+	hdr[wpos++] = '\r';
+	hdr[wpos++] = '\n';
+
+	return _hmux_emit(out, hdr, wpos, pktpool, nalloced);
+}
+
+/**
+ *	Parse the packet in head of @in by @msg in direction @dir.
+ *	The header bytes are copied into @msg->hdr and skipped in 
+ *	packet, the packet is split at message end so the next
+ *	message begin in a new packet.
+ *
+ *	Return 1 if header finished in it, 0 if not, -1 on error.
+ */
+static int 
+_hmux_parse(hmux_msg_t *msg, int dir, cblist_t *in, objpool_t *pktpool,
+	    int *nalloced)
+{
+	int n;
+	int len;
+	int used;
+	int hdone;
+	int st;
+	const char *ptr;
+	packet_t *pkt;
+
+	st = http_get_int(&msg->hi, dir, HTTP_INT_STATE);
+	if (st == HTTP_STE_BEGIN || st == HTTP_STE_FIN)
+		_hmux_msg_reset(msg);
+
+	pkt = CBLIST_GET_HEAD(in, packet_t *, list);
+	ptr = PKT_DATA(pkt) + pkt->sendpos;
+	len = pkt->len - pkt->sendpos;
+	if (len < 1)
+		return 0;
+
+	hdone = msg->hdone;
+	n = http_parse(&msg->hi, dir, ptr, len);
+	if (n < 0 || msg->err)
+		return -1;
+	used = len - n;
+
+	if (n > 0 && 
+	    http_split_packet(pkt, pkt->sendpos + used, pktpool, nalloced))
+		return -1;
+
+	if (hdone)
+		return 0;
+
+	/* the header bytes before header end */
+	if (msg->hdone)
+		used = http_get_len(&msg->hi, dir, HTTP_INT_HLEN) - msg->hlen;
+	if (msg->hlen + used > HMUX_MAX_HDR)
+		return -1;
+
+	memcpy(msg->hdr + msg->hlen, ptr, used);
+	msg->hlen += used;
+	pkt->sendpos += used;
+
+	return msg->hdone;
+}
+
+/**
+ *	Move the packet in head of @in into @out if it have body
+ *	bytes, or else free it.
+ *
+ *	No return.
+ */
+static void 
+_hmux_body(cblist_t *in, cblist_t *out, int *nalloced)
+{
+	packet_t *pkt;
+
+	pkt = CBLIST_GET_HEAD(in, packet_t *, list);
+	CBLIST_DEL(&pkt->list);
+
+	if (pkt->sendpos < pkt->len) {
+		CBLIST_ADD_TAIL(out, &pkt->list);
+		return;
+	}
+
+	PKT_FREE(pkt);
+	(*nalloced)--;
+}
+
+
+static hmux_req_t * 
+_hmux_req_alloc(hmux_t *hm, void *s)
+{
+	hmux_req_t *req;
+
+	req = objpool_get(hm->reqpool);
+	if (unlikely(!req))
+		ERR_RET(NULL, "alloc request failed\n");
+
+	memset(req, 0, sizeof(*req));
+	CBLIST_INIT(&req->list);
+	CBLIST_INIT(&req->pkts);
+	CBLIST_INIT(&req->resp);
+	req->s = s;
+
+	return req;
+}
+
+/**
+ *	Free all packets in @pkts.
+ *
+ *	Return the number of packets freed.
+ */
+static int 
+_hmux_free_pkts(cblist_t *pkts)
+{
+	int n = 0;
+	packet_t *pkt, *bk;
+
+	CBLIST_FOR_EACH_SAFE(pkts, pkt, bk, list) {
+		CBLIST_DEL(&pkt->list);
+		PKT_FREE(pkt);
+		n++;
+	}
+
+	return n;
+}
+
+/**
+ *	Free request @req, it's removed from wait queue.
+ *
+ *	Return the number of packets freed.
+ */
+static int 
+_hmux_req_free(hmux_req_t *req)
+{
+	int n;
+
+	n = _hmux_free_pkts(&req->pkts);
+	n += _hmux_free_pkts(&req->resp);
+
+	CBLIST_DEL(&req->list);
+	objpool_put(req);
+
+	return n;
+}
+
+/**
+ *	Drop all requests of @hs which is not responded, the
+ *	request in backend is orphaned and freed by backend.
+ *
+ *	No return.
+ */
+static void 
+_hmux_ssn_drop(hmux_t *hm, hmux_ssn_t *hs, int *nalloced)
+{
+	hmux_req_t *req;
+
+	while (hs->head != hs->tail) {
+		req = hs->reqs[hs->head % HMUX_MAX_REQ];
+		hs->head++;
+
+		if (req->bk) {
+			req->s = NULL;
+			*nalloced -= _hmux_free_pkts(&req->resp);
+		}
+		else
+			*nalloced -= _hmux_req_free(req);
+	}
+	hs->next = hs->tail;
+
+	if (hs->cur)
+		*nalloced -= _hmux_req_free(hs->cur);
+	hs->cur = NULL;
+}
+
+/**
+ *	The header callback of request parser, see http_header_cb.
+ */
+static void 
+_hmux_request_cb(http_info_t *hi, int dir, int id, u_int64_t pos,
+		 const char *val, size_t len, void *arg)
+{
+	int ver;
+	hmux_ssn_t *hs = arg;
+	hmux_msg_t *msg = &hs->msg;
+	hmux_req_t *req = hs->cur;
+
+	if (msg->err)
+		return;
+
+	if (id != HTTP_HST_END) {
+		if (_hmux_header(msg, dir, id, pos, val, len))
+			msg->err = 1;
+		return;
+	}
+
+	/* tunnel can't be multiplexed, the request have both
+	 * Content-Length and Transfer-Encoding is smuggling */
+	ver = hi->request.version;
+	if (hi->request.method == HTTP_MED_CONNECT ||
+	    (ver != HTTP_VER_10 && ver != HTTP_VER_11) ||
+	    (msg->te && msg->clen))
+	{
+		msg->err = 1;
+		return;
+	}
+
+	msg->hdone = 1;
+	msg->eoh = pos;
+
+	/* HTTP/1.0 close connection by default */
+	req->head = (hi->request.method == HTTP_MED_HEAD);
+	req->ver10 = (ver == HTTP_VER_10);
+	req->close = msg->close || (req->ver10 && !msg->keepalive);
+	hs->close = req->close;
+}
+
+/**
+ *	The header callback of response parser, see http_header_cb.
+ */
+static void 
+_hmux_response_cb(http_info_t *hi, int dir, int id, u_int64_t pos,
+		  const char *val, size_t len, void *arg)
+{
+	int code;
+	hmux_bk_t *bk = arg;
+	hmux_msg_t *msg = &bk->msg;
+	hmux_req_t *req = bk->req;
+
+	if (msg->err)
+		return;
+
+	if (id != HTTP_HST_END) {
+		if (_hmux_header(msg, dir, id, pos, val, len))
+			msg->err = 1;
+		return;
+	}
+
+	/* protocol switch not support */
+	code = hi->response.retcode;
+	if (code == 101 || !req) {
+		msg->err = 1;
+		return;
+	}
+
+	msg->hdone = 1;
+	msg->eoh = pos;
+
+	/* interim response is sent as it */
+	if (code >= 100 && code < 200)
+		return;
+
+	/* response of HEAD have no body */
+	if (req->head)
+		http_skip_body(hi, dir);
+
+	bk->reuse = !msg->close && 
+		(hi->response.version >= HTTP_VER_11 || msg->keepalive);
+
+	/* close-delimited body, the client is closed after it */
+	if (http_get_int(hi, dir, HTTP_INT_STATE) == HTTP_STE_BODY &&
+	    !http_get_int(hi, dir, HTTP_INT_CHUNKED) &&
+	    (msg->te || !msg->clen))
+	{
+		bk->reuse = 0;
+		req->close = 1;
+	}
+}
+
+hmux_t * 
+hmux_alloc(int maxconn)
+{
+	hmux_t *hm;
+
+	if (unlikely(maxconn < 1 || maxconn > HMUX_MAX_CONN))
+		ERR_RET(NULL, "invalid argument\n");
+
+	hm = calloc(1, sizeof(*hm));
+	if (!hm)
+		ERR_RET(NULL, "calloc memory failed\n");
+
+	hm->maxconn = maxconn;
+	CBLIST_INIT(&hm->srvlist);
+
+	hm->reqpool = objpool_alloc(sizeof(hmux_req_t), 256, 0);
+	hm->bkpool = objpool_alloc(sizeof(hmux_bk_t), 16, 0);
+	if (!hm->reqpool || !hm->bkpool) {
+		hmux_free(hm);
+		ERR_RET(NULL, "alloc objpool failed\n");
+	}
+
+	return hm;
+}
+
+void 
+hmux_free(hmux_t *hm)
+{
+	hmux_srv_t *srv, *bk;
+
+	if (unlikely(!hm))
+		return;
+
+	CBLIST_FOR_EACH_SAFE(&hm->srvlist, srv, bk, list) {
+		assert(srv->nconn == 0);
+		CBLIST_DEL(&srv->list);
+		free(srv);
+	}
+
+	if (hm->reqpool)
+		objpool_free(hm->reqpool);
+	if (hm->bkpool)
+		objpool_free(hm->bkpool);
+
+	free(hm);
+}
+
+int 
+hmux_print(hmux_t *hm, char *buf, size_t len)
+{
+	if (!hm || !buf || len < 1)
+		return 0;
+
+	return snprintf(buf, len,
+			"request %llu, response %llu, conn %llu, "
+			"reuse %llu, wait %llu, orphan %llu\n",
+			(unsigned long long)hm->stat.nreq,
+			(unsigned long long)hm->stat.nresp,
+			(unsigned long long)hm->stat.nconn,
+			(unsigned long long)hm->stat.nreuse,
+			(unsigned long long)hm->stat.nwait,
+			(unsigned long long)hm->stat.norphan);
+}
+
+hmux_srv_t * 
+hmux_get_srv(hmux_t *hm, const void *server)
+{
+	hmux_srv_t *srv;
+
+	if (unlikely(!hm || !server))
+		ERR_RET(NULL, "invalid argument\n");
+
+	CBLIST_FOR_EACH(&hm->srvlist, srv, list) {
+		if (srv->server == server)
+			return srv;
+	}
+
+	srv = calloc(1, sizeof(*srv));
+	if (!srv)
+		ERR_RET(NULL, "calloc memory failed\n");
+
+	srv->server = server;
+	CBLIST_INIT(&srv->bklist);
+	CBLIST_INIT(&srv->idle);
+	CBLIST_INIT(&srv->wait);
+	CBLIST_ADD_TAIL(&hm->srvlist, &srv->list);
+
+	return srv;
+}
+
+void 
+hmux_ssn_init(hmux_ssn_t *hs, void *s)
+{
+	if (unlikely(!hs))
+		return;
+
+	/* the @msg.hdr is the last member, needn't clear */
+	memset(hs, 0, offsetof(hmux_ssn_t, msg.hdr));
+	hs->s = s;
+	http_set_header_cb(&hs->msg.hi, _hmux_request_cb, hs);
+}
+
+void 
+hmux_ssn_free(hmux_t *hm, hmux_ssn_t *hs, int *nalloced)
+{
+	if (unlikely(!hm || !hs || !nalloced))
+		return;
+
+	_hmux_ssn_drop(hm, hs, nalloced);
+	http_free_info(&hs->msg.hi);
+}
+
+int 
+hmux_request(hmux_t *hm, hmux_ssn_t *hs, cblist_t *in,
+	     objpool_t *pktpool, int *nalloced)
+{
+	int n = 0;
+	int ret;
+	const char *extra;
+	hmux_msg_t *msg;
+
+	if (unlikely(!hm || !hs || !in || !pktpool || !nalloced))
+		ERR_RET(-1, "invalid argument\n");
+
+	msg = &hs->msg;
+
+	while (!CBLIST_IS_EMPTY(in)) {
+
+		/* the data after last request is dropped */
+		if (hs->close && !hs->cur) {
+			_hmux_drop(in, NULL, nalloced);
+			break;
+		}
+
+		if (!hs->cur) {
+			/* too many requests wait response */
+			if (hs->tail - hs->head >= HMUX_MAX_REQ)
+				break;
+
+			hs->cur = _hmux_req_alloc(hm, hs->s);
+			if (!hs->cur)
+				return -1;
+		}
+
+		ret = _hmux_parse(msg, HTTP_DIR_REQUEST, in, pktpool, 
+				  nalloced);
+		if (ret < 0)
+			return -1;
+
+		/* keep the backend connection alive */
+		if (ret) {
+			extra = hs->cur->ver10 ? 
+				"Connection: keep-alive\r\n" : NULL;
+			if (_hmux_emit_header(msg, extra, &hs->cur->pkts,
+					      pktpool, nalloced))
+				return -1;
+		}
+
+		_hmux_body(in, &hs->cur->pkts, nalloced);
+
+		/* the request is complete */
+		if (http_get_int(&msg->hi, HTTP_DIR_REQUEST, 
+				 HTTP_INT_STATE) == HTTP_STE_FIN) 
+		{
+			hs->reqs[hs->tail % HMUX_MAX_REQ] = hs->cur;
+			hs->tail++;
+			hs->cur = NULL;
+			n++;
+		}
+	}
+
+	return n;
+}
+
+void 
+hmux_flush(hmux_t *hm, hmux_ssn_t *hs, cblist_t *out, int *nalloced)
+{
+	hmux_req_t *req;
+
+	if (unlikely(!hm || !hs || !out || !nalloced))
+		return;
+
+	while (hs->head != hs->next) {
+		req = hs->reqs[hs->head % HMUX_MAX_REQ];
+		CBLIST_JOIN(out, &req->resp);
+		if (!req->done)
+			break;
+
+		hs->head++;
+
+		/* the client can't read later responses */
+		if (req->close) {
+			hs->close = 1;
+			_hmux_ssn_drop(hm, hs, nalloced);
+		}
+
+		_hmux_req_free(req);
+	}
+}
+
+hmux_bk_t * 
+hmux_bk_alloc(hmux_t *hm, hmux_srv_t *srv, void *s)
+{
+	hmux_bk_t *bk;
+
+	if (unlikely(!hm || !srv || !s))
+		ERR_RET(NULL, "invalid argument\n");
+
+	bk = objpool_get(hm->bkpool);
+	if (unlikely(!bk))
+		ERR_RET(NULL, "alloc backend failed\n");
+
+	/* the @msg.hdr is the last member, needn't clear */
+	memset(bk, 0, offsetof(hmux_bk_t, msg.hdr));
+	CBLIST_INIT(&bk->list);
+	CBLIST_INIT(&bk->ilist);
+	bk->s = s;
+	bk->srv = srv;
+	bk->reuse = 1;
+	http_set_header_cb(&bk->msg.hi, _hmux_response_cb, bk);
+
+	CBLIST_ADD_TAIL(&srv->bklist, &bk->list);
+	srv->nconn++;
+	hm->stat.nconn++;
+
+	return bk;
+}
+
+void 
+hmux_bk_free(hmux_t *hm, hmux_bk_t *bk)
+{
+	hmux_req_t *req;
+
+	if (unlikely(!hm || !bk))
+		return;
+
+	req = bk->req;
+	if (req) {
+		req->bk = NULL;
+		if (!req->s)
+			_hmux_req_free(req);
+	}
+	bk->req = NULL;
+
+	CBLIST_DEL(&bk->list);
+	CBLIST_DEL(&bk->ilist);
+	bk->srv->nconn--;
+
+	http_free_info(&bk->msg.hi);
+	objpool_put(bk);
+}
+
+hmux_bk_t * 
+hmux_get_idle(hmux_srv_t *srv)
+{
+	hmux_bk_t *bk;
+
+	if (unlikely(!srv))
+		return NULL;
+
+	bk = CBLIST_GET_HEAD(&srv->idle, hmux_bk_t *, ilist);
+	if (bk)
+		CBLIST_DEL(&bk->ilist);
+
+	return bk;
+}
+
+void 
+hmux_put_idle(hmux_bk_t *bk)
+{
+	cblist_t *l;
+
+	if (unlikely(!bk))
+		return;
+
+	/* the last used is reused first, the others can be aged */
+	l = &bk->srv->idle;
+	CBLIST_ADD_HEAD(l, &bk->ilist);
+}
+
+void 
+hmux_wait(hmux_t *hm, hmux_srv_t *srv, hmux_req_t *req)
+{
+	if (unlikely(!hm || !srv || !req))
+		return;
+
+	CBLIST_ADD_TAIL(&srv->wait, &req->list);
+	hm->stat.nwait++;
+}
+
+hmux_req_t * 
+hmux_get_wait(hmux_srv_t *srv)
+{
+	hmux_req_t *req;
+
+	if (unlikely(!srv))
+		return NULL;
+
+	req = CBLIST_GET_HEAD(&srv->wait, hmux_req_t *, list);
+	if (req)
+		CBLIST_DEL(&req->list);
+
+	return req;
+}
+
+int 
+hmux_attach(hmux_t *hm, hmux_bk_t *bk, hmux_req_t *req, cblist_t *out)
+{
+	if (unlikely(!hm || !bk || !req || !out))
+		return 0;
+
+	assert(!bk->req);
+	assert(http_get_int(&bk->msg.hi, HTTP_DIR_RESPONSE, HTTP_INT_STATE) 
+	       == HTTP_STE_BEGIN || 
+	       http_get_int(&bk->msg.hi, HTTP_DIR_RESPONSE, HTTP_INT_STATE) 
+	       == HTTP_STE_FIN);
+
+	bk->req = req;
+	req->bk = bk;
+
+	if (bk->nreq > 0)
+		hm->stat.nreuse++;
+	bk->nreq++;
+	hm->stat.nreq++;
+
+	return hmux_move(out, &req->pkts);
+}
+
+int 
+hmux_response(hmux_t *hm, hmux_bk_t *bk, cblist_t *in, cblist_t *out,
+	      objpool_t *pktpool, int *nalloced)
+{
+	int ret;
+	int code;
+	int interim;
+	const char *extra;
+	hmux_msg_t *msg;
+	hmux_req_t *req;
+
+	if (unlikely(!hm || !bk || !bk->req || !in || !out || 
+		     !pktpool || !nalloced))
+		ERR_RET(-1, "invalid argument\n");
+
+	msg = &bk->msg;
+	req = bk->req;
+
+	while (!CBLIST_IS_EMPTY(in)) {
+
+		ret = _hmux_parse(msg, HTTP_DIR_RESPONSE, in, pktpool, 
+				  nalloced);
+		if (ret < 0)
+			return -1;
+
+		code = msg->hi.response.retcode;
+		interim = (code >= 100 && code < 200);
+
+		if (ret && interim) {
+			if (_hmux_emit(out, msg->hdr, msg->hlen, pktpool, 
+				       nalloced))
+				return -1;
+		}
+		else if (ret) {
+			extra = NULL;
+			if (req->close)
+				extra = "Connection: close\r\n";
+			else if (req->ver10)
+				extra = "Connection: keep-alive\r\n";
+			if (_hmux_emit_header(msg, extra, out, pktpool, 
+					      nalloced))
+				return -1;
+		}
+
+		_hmux_body(in, out, nalloced);
+
+		/* the final response is finished */
+		if (msg->hdone && !interim &&
+		    http_get_int(&msg->hi, HTTP_DIR_RESPONSE, 
+				 HTTP_INT_STATE) == HTTP_STE_FIN)
+			return 1;
+	}
+
+	return 0;
+}
+
+int 
+hmux_response_eof(hmux_t *hm, hmux_bk_t *bk)
+{
+	if (unlikely(!hm || !bk))
+		return 0;
+
+	/* only close-delimited body is finished by close */
+	if (!bk->req || !bk->msg.hdone || 
+	    http_get_int(&bk->msg.hi, HTTP_DIR_RESPONSE, HTTP_INT_STATE) 
+	    != HTTP_STE_BODY)
+		return 0;
+
+	return (http_parse_eof(&bk->msg.hi, HTTP_DIR_RESPONSE) == 0);
+}
+
+void 
+hmux_detach(hmux_t *hm, hmux_bk_t *bk)
+{
+	hmux_req_t *req;
+
+	if (unlikely(!hm || !bk || !bk->req))
+		return;
+
+	req = bk->req;
+	bk->req = NULL;
+	req->bk = NULL;
+	req->done = 1;
+	hm->stat.nresp++;
+
+	/* client closed */
+	if (!req->s) {
+		_hmux_req_free(req);
+		hm->stat.norphan++;
+	}
+}
@@ -0,0 +1,330 @@
+/**
+ *	@file	http_mux.h
+ *
+ *	@brief	HTTP/1.1 request multiplexing for reverse proxy. The
+ *		complete requests of many client connections are sent
+ *		on a small set of persistent backend connections kept
+ *		by each worker, the responses are returned to client
+ *		in request order.
+ *
+ *		It only frames the messages and keeps the backend pool,
+ *		the connection and session are handled by caller.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#ifndef FZ_HTTP_MUX_H
+#define FZ_HTTP_MUX_H
+
+#include <sys/types.h>
+
+#include "cblist.h"
+#include "objpool.h"
+#include "packet.h"
+#include "http_parse.h"
+
+#define	HMUX_MAX_REQ		16	/* max pipelined requests of client */
+#define	HMUX_MAX_HDR		8192	/* max header size */
+#define	HMUX_MAX_CONN		1024	/* max backend connections of server */
+#define	HMUX_MAX_DROP		8	/* max hop-by-hop header lines */
+
+/**
+ *	Multiplexing statistic data.
+ */
+typedef struct hmux_stat {
+	u_int64_t	nreq;		/* requests dispatched */
+	u_int64_t	nresp;		/* responses finished */
+	u_int64_t	nconn;		/* backend connections opened */
+	u_int64_t	nreuse;		/* requests sent on reused connection */
+	u_int64_t	nwait;		/* requests waited free connection */
+	u_int64_t	norphan;	/* responses dropped, client closed */
+} hmux_stat_t;
+
+/**
+ *	Message framing state, used by request and response. The
+ *	message is framed by http_parse(), the header is copied 
+ *	into @hdr and rewrote without hop-by-hop headers.
+ */
+typedef struct hmux_msg {
+	http_info_t	hi;		/* HTTP parser */
+	int		hdone;		/* header finished */
+	int		err;		/* can't be multiplexed */
+	int		close;		/* Connection: close */
+	int		keepalive;	/* Connection: keep-alive */
+	int		clen;		/* have Content-Length */
+	int		te;		/* have Transfer-Encoding */
+	int		eoh;		/* position of last empty line */
+	int		ndrop;		/* number of lines in @drop */
+	int		drop[HMUX_MAX_DROP];/* hop-by-hop line positions */
+	int		hlen;		/* bytes in @hdr */
+	char		hdr[HMUX_MAX_HDR];/* message header */
+} hmux_msg_t;
+
+/**
+ *	The backend connections of a server in worker.
+ */
+typedef struct hmux_srv {
+	cblist_t	list;		/* list in hmux_t @srvlist */
+	const void	*server;	/* server_t, the key */
+	cblist_t	bklist;		/* all backends */
+	cblist_t	idle;		/* idle backends */
+	cblist_t	wait;		/* requests wait free backend */
+	int		nconn;		/* number of backends */
+} hmux_srv_t;
+
+/**
+ *	The multiplexing context of worker.
+ */
+typedef struct hmux {
+	int		maxconn;	/* max backends of each server */
+	objpool_t	*reqpool;	/* hmux_req_t pool */
+	objpool_t	*bkpool;	/* hmux_bk_t pool */
+	cblist_t	srvlist;	/* hmux_srv_t list */
+	hmux_stat_t	stat;		/* statistic data */
+} hmux_t;
+
+/**
+ *	A complete request, it's owned by client until client
+ *	closed, then by backend until response finished.
+ */
+typedef struct hmux_req {
+	cblist_t	list;		/* list in hmux_srv_t @wait */
+	void		*s;		/* client session, NULL if closed */
+	struct hmux_bk	*bk;		/* backend serving it */
+	int		head;		/* HEAD request */
+	int		ver10;		/* HTTP/1.0 request */
+	int		close;		/* close client after response */
+	int		done;		/* response finished */
+	cblist_t	pkts;		/* request packets */
+	cblist_t	resp;		/* response packets wait send */
+} hmux_req_t;
+
+/**
+ *	Per-client multiplexing state.
+ */
+typedef struct hmux_ssn {
+	void		*s;		/* client session */
+	hmux_req_t	*reqs[HMUX_MAX_REQ];/* requests in order */
+	u_int32_t	head;		/* first request wait response */
+	u_int32_t	next;		/* first request not dispatched */
+	u_int32_t	tail;		/* ring tail */
+	int		close;		/* close after last response */
+	hmux_req_t	*cur;		/* request in framing */
+	hmux_msg_t	msg;		/* request framing */
+} hmux_ssn_t;
+
+/**
+ *	Per-backend multiplexing state.
+ */
+typedef struct hmux_bk {
+	cblist_t	list;		/* list in hmux_srv_t @bklist */
+	cblist_t	ilist;		/* list in hmux_srv_t @idle */
+	void		*s;		/* backend session */
+	hmux_srv_t	*srv;		/* server it belong */
+	hmux_req_t	*req;		/* request in serving */
+	int		reuse;		/* keep alive after response */
+	u_int32_t	nreq;		/* requests served */
+	hmux_msg_t	msg;		/* response framing */
+} hmux_bk_t;
+
+/**
+ *	Move all packets in @src to tail of @dst.
+ *
+ *	Return the number of packets moved.
+ */
+static inline int 
+hmux_move(cblist_t *dst, cblist_t *src)
+{
+	int n = 0;
+	packet_t *pkt, *bk;
+
+	CBLIST_FOR_EACH_SAFE(src, pkt, bk, list) {
+		CBLIST_DEL(&pkt->list);
+		CBLIST_ADD_TAIL(dst, &pkt->list);
+		n++;
+	}
+
+	return n;
+}
+
+/**
+ *	Alloc a multiplexing context, @maxconn is the max backend
+ *	connections of each server.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+extern hmux_t * 
+hmux_alloc(int maxconn);
+
+/**
+ *	Free the context @hm alloced by hmux_alloc(), all backends
+ *	must be freed before it.
+ *
+ *	No return.
+ */
+extern void 
+hmux_free(hmux_t *hm);
+
+/**
+ *	Print the statistic data of @hm into @buf, @len is
+ *	size of @buf.
+ *
+ *	Return the length of output.
+ */
+extern int 
+hmux_print(hmux_t *hm, char *buf, size_t len);
+
+/**
+ *	Get the backend group of @server in @hm, it's created if
+ *	not exist.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+extern hmux_srv_t * 
+hmux_get_srv(hmux_t *hm, const void *server);
+
+/**
+ *	Init the multiplexing state @hs of client session @s.
+ *
+ *	No return.
+ */
+extern void 
+hmux_ssn_init(hmux_ssn_t *hs, void *s);
+
+/**
+ *	Release the client state @hs when client closed. The request
+ *	not sent is freed, the request in backend is owned by the
+ *	backend since now. The freed packets are decreased from
+ *	@nalloced.
+ *
+ *	No return.
+ */
+extern void 
+hmux_ssn_free(hmux_t *hm, hmux_ssn_t *hs, int *nalloced);
+
+/**
+ *	Return 1 if all requests of @hs are responded, 0 if not.
+ */
+static inline int 
+hmux_ssn_idle(const hmux_ssn_t *hs)
+{
+	return (hs->head == hs->tail);
+}
+
+/**
+ *	Frame the request packets in @in into complete requests,
+ *	they are added into request ring of @hs and wait dispatch.
+ *	The incomplete request is kept in @hs. New packet is alloced
+ *	from @pktpool and counted in @nalloced. The request can't be
+ *	framed same by all servers(Content-Length with 
+ *	Transfer-Encoding, the last coding isn't chunked, invalid 
+ *	Content-Length or chunk) is an error.
+ *
+ *	Return number of new requests if success, -1 on error.
+ */
+extern int 
+hmux_request(hmux_t *hm, hmux_ssn_t *hs, cblist_t *in,
+	     objpool_t *pktpool, int *nalloced);
+
+/**
+ *	Move the responses of first requests in @hs into @out in
+ *	request order, the request is freed when its response is
+ *	finished and moved. The later requests are dropped after
+ *	a response which close the client, the freed packets are
+ *	decreased from @nalloced.
+ *
+ *	No return.
+ */
+extern void 
+hmux_flush(hmux_t *hm, hmux_ssn_t *hs, cblist_t *out, int *nalloced);
+
+/**
+ *	Alloc a backend of server @srv for session @s.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+extern hmux_bk_t * 
+hmux_bk_alloc(hmux_t *hm, hmux_srv_t *srv, void *s);
+
+/**
+ *	Free the backend @bk. The request in serving is detached,
+ *	it's freed if client closed.
+ *
+ *	No return.
+ */
+extern void 
+hmux_bk_free(hmux_t *hm, hmux_bk_t *bk);
+
+/**
+ *	Get a idle backend of @srv.
+ *
+ *	Return pointer if found, NULL if no idle backend.
+ */
+extern hmux_bk_t * 
+hmux_get_idle(hmux_srv_t *srv);
+
+/**
+ *	Put backend @bk into idle list of its server.
+ *
+ *	No return.
+ */
+extern void 
+hmux_put_idle(hmux_bk_t *bk);
+
+/**
+ *	Add request @req into wait queue of @srv.
+ *
+ *	No return.
+ */
+extern void 
+hmux_wait(hmux_t *hm, hmux_srv_t *srv, hmux_req_t *req);
+
+/**
+ *	Get the first request in wait queue of @srv.
+ *
+ *	Return pointer if have, NULL if no request waiting.
+ */
+extern hmux_req_t * 
+hmux_get_wait(hmux_srv_t *srv);
+
+/**
+ *	Attach request @req to backend @bk, the request packets
+ *	are moved into @out.
+ *
+ *	Return number of packets moved.
+ */
+extern int 
+hmux_attach(hmux_t *hm, hmux_bk_t *bk, hmux_req_t *req, cblist_t *out);
+
+/**
+ *	Frame the response packets in @in of backend @bk, the bytes
+ *	of current response are moved into @out. New packet is
+ *	alloced from @pktpool and counted in @nalloced.
+ *
+ *	Return 1 if response finished, 0 need more data, -1 on error.
+ */
+extern int 
+hmux_response(hmux_t *hm, hmux_bk_t *bk, cblist_t *in, cblist_t *out,
+	      objpool_t *pktpool, int *nalloced);
+
+/**
+ *	Backend @bk is closed by server, the close-delimited
+ *	response is finished by it.
+ *
+ *	Return 1 if response finished, 0 if not.
+ */
+extern int 
+hmux_response_eof(hmux_t *hm, hmux_bk_t *bk);
+
+/**
+ *	The response of backend @bk is finished and moved, detach
+ *	the request. The request is freed if client closed.
+ *
+ *	No return.
+ */
+extern void 
+hmux_detach(hmux_t *hm, hmux_bk_t *bk);
+
+#endif /* end of FZ_HTTP_MUX_H */
@@ -0,0 +1,499 @@
+/**
+ *	@file	http_mux_test.c
+ *
+ *	@brief	http_mux test program, it frames the requests through
+ *		hmux_request() and the responses through hmux_response(),
+ *		check the pipelined, chunked, no body, interim response
+ *		and the smuggling cases.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#define	_GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "packet.h"
+#include "proxy_common.h"
+#include "proxy_debug.h"
+#include "http_mux.h"
+
+#define	_MAX_BUF	4096
+
+int		g_timestamp;		/* timestamp in debug output */
+int		g_dbglvl;		/* debug level: 0 disable, 7 max */
+int		g_flowlvl;		/* flow level: 0 disable, 7 max */
+int		g_httplvl;		/* http level: 0 disable, 7 max */
+
+static hmux_t *_g_hm;
+static objpool_t *_g_pool;
+
+/**
+ *	The request test case, @n is the requests framed or -1 if
+ *	it's rejected, @out is the forwarded requests.
+ */
+typedef struct _req_case {
+	const char	*name;
+	const char	*in;
+	int		n;
+	const char	*out;
+} _req_case_t;
+
+/**
+ *	The response test case for request @req, @ret is return
+ *	value of hmux_response(), @out is the forwarded response.
+ */
+typedef struct _res_case {
+	const char	*name;
+	const char	*req;
+	const char	*in;
+	int		ret;
+	const char	*out;
+} _res_case_t;
+
+static const _req_case_t _g_reqs[] = {
+	{
+		"pipelined",
+		"GET /a HTTP/1.1\r\nHost: test\r\n\r\n"
+		"GET /b HTTP/1.1\r\nHost: test\r\n"
+		"Connection: keep-alive\r\nKeep-Alive: 300\r\n\r\n"
+		"GET /c HTTP/1.0\r\nHost: test\r\n"
+		"Connection: keep-alive\r\n\r\n",
+		3,
+		"GET /a HTTP/1.1\r\nHost: test\r\n\r\n"
+		"GET /b HTTP/1.1\r\nHost: test\r\n\r\n"
+		"GET /c HTTP/1.0\r\nHost: test\r\n"
+		"Connection: keep-alive\r\n\r\n",
+	},
+	{
+		"chunked",
+		"\r\nPOST /a HTTP/1.1\r\nHost: test\r\n"
+		"Transfer-Encoding: chunked\r\n\r\n"
+		"5;ext=1\r\nhello\r\n0\r\nX-Trailer: 1\r\n\r\n"
+		"POST /b HTTP/1.1\r\nHost: test\r\n"
+		"Content-Length: 5\r\n\r\nworld",
+		2,
+		"POST /a HTTP/1.1\r\nHost: test\r\n"
+		"Transfer-Encoding: chunked\r\n\r\n"
+		"5;ext=1\r\nhello\r\n0\r\nX-Trailer: 1\r\n\r\n"
+		"POST /b HTTP/1.1\r\nHost: test\r\n"
+		"Content-Length: 5\r\n\r\nworld",
+	},
+	{
+		"TE and CL",
+		"POST /a HTTP/1.1\r\nHost: test\r\nContent-Length: 4\r\n"
+		"Transfer-Encoding: chunked\r\n\r\n0\r\n\r\n",
+		-1, NULL,
+	},
+	{
+		"TE not chunked",
+		"POST /a HTTP/1.1\r\nHost: test\r\n"
+		"Transfer-Encoding: chunked\r\n"
+		"Transfer-Encoding: gzip\r\n\r\n0\r\n\r\n",
+		-1, NULL,
+	},
+	{
+		"CL not digit",
+		"POST /a HTTP/1.1\r\nHost: test\r\n"
+		"Content-Length: abc\r\n\r\n",
+		-1, NULL,
+	},
+	{
+		"CL negative",
+		"POST /a HTTP/1.1\r\nHost: test\r\n"
+		"Content-Length: -1\r\n\r\n",
+		-1, NULL,
+	},
+	{
+		"CL trailing garbage",
+		"POST /a HTTP/1.1\r\nHost: test\r\n"
+		"Content-Length: 5x\r\n\r\nhello",
+		-1, NULL,
+	},
+	{
+		"CL overflow",
+		"POST /a HTTP/1.1\r\nHost: test\r\n"
+		"Content-Length: 99999999999999999999999\r\n\r\n",
+		-1, NULL,
+	},
+	{
+		"CL conflict",
+		"POST /a HTTP/1.1\r\nHost: test\r\nContent-Length: 5\r\n"
+		"Content-Length: 6\r\n\r\nhello!",
+		-1, NULL,
+	},
+	{
+		"chunk size garbage",
+		"POST /a HTTP/1.1\r\nHost: test\r\n"
+		"Transfer-Encoding: chunked\r\n\r\n"
+		"5zzz\r\nhello\r\n0\r\n\r\n",
+		-1, NULL,
+	},
+	{
+		"upgrade",
+		"GET /a HTTP/1.1\r\nHost: test\r\nConnection: Upgrade\r\n"
+		"Upgrade: websocket\r\n\r\n",
+		-1, NULL,
+	},
+};
+
+static const _res_case_t _g_ress[] = {
+	{
+		"content-length",
+		"GET /a HTTP/1.1\r\nHost: test\r\n\r\n",
+		"HTTP/1.1 200 OK\r\nContent-Length: 5\r\n"
+		"Connection: keep-alive\r\n\r\nhello",
+		1,
+		"HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello",
+	},
+	{
+		"chunked",
+		"GET /a HTTP/1.1\r\nHost: test\r\n\r\n",
+		"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+		"5\r\nhello\r\n0\r\n\r\n",
+		1,
+		"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+		"5\r\nhello\r\n0\r\n\r\n",
+	},
+	{
+		"HEAD",
+		"HEAD /a HTTP/1.1\r\nHost: test\r\n\r\n",
+		"HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n",
+		1,
+		"HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n",
+	},
+	{
+		"204",
+		"DELETE /a HTTP/1.1\r\nHost: test\r\n\r\n",
+		"HTTP/1.1 204 No Content\r\n\r\n",
+		1,
+		"HTTP/1.1 204 No Content\r\n\r\n",
+	},
+	{
+		"304",
+		"GET /a HTTP/1.1\r\nHost: test\r\n\r\n",
+		"HTTP/1.1 304 Not Modified\r\nContent-Length: 100\r\n\r\n",
+		1,
+		"HTTP/1.1 304 Not Modified\r\nContent-Length: 100\r\n\r\n",
+	},
+	{
+		"interim",
+		"POST /a HTTP/1.1\r\nHost: test\r\nExpect: 100-continue\r\n"
+		"Content-Length: 2\r\n\r\nok",
+		"HTTP/1.1 100 Continue\r\n\r\n"
+		"HTTP/1.1 103 Early Hints\r\nLink: </a.css>\r\n\r\n"
+		"HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok",
+		1,
+		"HTTP/1.1 100 Continue\r\n\r\n"
+		"HTTP/1.1 103 Early Hints\r\nLink: </a.css>\r\n\r\n"
+		"HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok",
+	},
+	{
+		"HTTP/1.0 keep-alive",
+		"GET /a HTTP/1.0\r\nHost: test\r\nConnection: keep-alive\r\n\r\n",
+		"HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok",
+		1,
+		"HTTP/1.1 200 OK\r\nContent-Length: 2\r\n"
+		"Connection: keep-alive\r\n\r\nok",
+	},
+	{
+		"close-delimited",
+		"GET /a HTTP/1.1\r\nHost: test\r\n\r\n",
+		"HTTP/1.1 200 OK\r\n\r\nhello",
+		0,
+		"HTTP/1.1 200 OK\r\nConnection: close\r\n\r\nhello",
+	},
+	{
+		"TE not chunked",
+		"GET /a HTTP/1.1\r\nHost: test\r\n\r\n",
+		"HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip\r\n"
+		"Content-Length: 5\r\n\r\nhello",
+		0,
+		"HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip\r\n"
+		"Content-Length: 5\r\nConnection: close\r\n\r\nhello",
+	},
+	{
+		"switching protocol",
+		"GET /a HTTP/1.1\r\nHost: test\r\n\r\n",
+		"HTTP/1.1 101 Switching Protocols\r\n\r\n",
+		-1, NULL,
+	},
+};
+
+/**
+ *	Put @len bytes in @buf into packet list @pkts, the packet
+ *	is alloced from @_g_pool.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_fill_packets(cblist_t *pkts, const char *buf, int len)
+{
+	int n;
+	packet_t *pkt;
+
+	while (len > 0) {
+		pkt = objpool_get(_g_pool);
+		if (!pkt)
+			return -1;
+		PKT_INIT(pkt);
+		n = len > pkt->max ? pkt->max : len;
+		memcpy(pkt->data, buf, n);
+		pkt->len = n;
+		CBLIST_ADD_TAIL(pkts, &pkt->list);
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ *	Move packets in @pkts into buffer @buf and free them, the
+ *	bytes before @sendpos of packet is skipped.
+ *
+ *	Return the bytes of packets.
+ */
+static int 
+_drain_packets(cblist_t *pkts, char *buf, int max)
+{
+	int n;
+	int len = 0;
+	packet_t *pkt, *bk;
+
+	CBLIST_FOR_EACH_SAFE(pkts, pkt, bk, list) {
+		CBLIST_DEL(&pkt->list);
+		n = pkt->len - pkt->sendpos;
+		if (buf && len + n <= max)
+			memcpy(buf + len, PKT_DATA(pkt) + pkt->sendpos, n);
+		len += n;
+		PKT_FREE(pkt);
+	}
+
+	return len;
+}
+
+/**
+ *	Check the @len bytes in @buf is same as @expect.
+ *
+ *	Return 0 if same, -1 if not.
+ */
+static int 
+_compare(const char *name, const char *buf, int len, const char *expect)
+{
+	if (len == strlen(expect) && memcmp(buf, expect, len) == 0)
+		return 0;
+
+	printf("%s: output mismatch\n%.*s\n", name, len, buf);
+	return -1;
+}
+
+/**
+ *	Frame the requests in case @c, each request is passed
+ *	byte by byte if @bytes is not zero.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_test_request(const _req_case_t *c, int bytes)
+{
+	int i;
+	int n = 0;
+	int ret = 0;
+	int len;
+	int step;
+	int nalloced = 0;
+	char buf[_MAX_BUF];
+	cblist_t in, out;
+	hmux_ssn_t *hs;
+
+	hs = malloc(sizeof(*hs));
+	if (!hs)
+		return -1;
+	hmux_ssn_init(hs, hs);
+
+	CBLIST_INIT(&in);
+	CBLIST_INIT(&out);
+
+	len = strlen(c->in);
+	step = bytes ? 1 : len;
+	for (i = 0; i < len && ret >= 0; i += step) {
+		if (_fill_packets(&in, c->in + i, step)) {
+			ret = -1;
+			break;
+		}
+		ret = hmux_request(_g_hm, hs, &in, _g_pool, &nalloced);
+		if (ret > 0)
+			n += ret;
+	}
+
+	for (i = hs->head; i != hs->tail; i++)
+		hmux_move(&out, &hs->reqs[i % HMUX_MAX_REQ]->pkts);
+	len = _drain_packets(&out, buf, sizeof(buf));
+	_drain_packets(&in, NULL, 0);
+	hmux_ssn_free(_g_hm, hs, &nalloced);
+	free(hs);
+
+	if (c->n < 0) {
+		if (ret >= 0) {
+			printf("%s: request isn't rejected\n", c->name);
+			return -1;
+		}
+		return 0;
+	}
+
+	if (ret < 0 || n != c->n) {
+		printf("%s: framed %d requests, expect %d\n",
+		       c->name, n, c->n);
+		return -1;
+	}
+
+	return _compare(c->name, buf, len, c->out);
+}
+
+/**
+ *	Frame the response in case @c of a backend connection, each
+ *	response is passed byte by byte if @bytes is not zero.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_test_response(const _res_case_t *c, int bytes)
+{
+	int i;
+	int len;
+	int step;
+	int ret = -1;
+	int nalloced = 0;
+	char buf[_MAX_BUF];
+	cblist_t in, out;
+	hmux_ssn_t *hs;
+	hmux_srv_t *srv;
+	hmux_bk_t *bk;
+
+	hs = malloc(sizeof(*hs));
+	if (!hs)
+		return -1;
+	hmux_ssn_init(hs, hs);
+
+	CBLIST_INIT(&in);
+	CBLIST_INIT(&out);
+
+	srv = hmux_get_srv(_g_hm, _g_hm);
+	bk = srv ? hmux_bk_alloc(_g_hm, srv, srv) : NULL;
+	if (!bk)
+		goto out;
+
+	if (_fill_packets(&in, c->req, strlen(c->req)) ||
+	    hmux_request(_g_hm, hs, &in, _g_pool, &nalloced) != 1)
+	{
+		printf("%s: request framing failed\n", c->name);
+		goto out;
+	}
+
+	hmux_attach(_g_hm, bk, hs->reqs[hs->head % HMUX_MAX_REQ], &out);
+	_drain_packets(&out, NULL, 0);
+
+	len = strlen(c->in);
+	step = bytes ? 1 : len;
+	for (i = 0; i < len; i += step) {
+		if (_fill_packets(&in, c->in + i, step))
+			goto out;
+		ret = hmux_response(_g_hm, bk, &in, &out, _g_pool, &nalloced);
+		if (ret != 0)
+			break;
+	}
+
+	/* close-delimited response is finished by close */
+	if (ret == 0 && c->ret == 0 && !hmux_response_eof(_g_hm, bk)) {
+		printf("%s: response isn't finished by close\n", c->name);
+		ret = -1;
+	}
+
+	if (ret != c->ret) {
+		printf("%s: return %d, expect %d\n", c->name, ret, c->ret);
+		ret = -1;
+		goto out;
+	}
+
+	ret = 0;
+	if (c->out) {
+		len = _drain_packets(&out, buf, sizeof(buf));
+		ret = _compare(c->name, buf, len, c->out);
+	}
+
+out:
+	_drain_packets(&in, NULL, 0);
+	_drain_packets(&out, NULL, 0);
+	if (bk) {
+		hmux_detach(_g_hm, bk);
+		hmux_bk_free(_g_hm, bk);
+	}
+	hmux_ssn_free(_g_hm, hs, &nalloced);
+	free(hs);
+	return ret;
+}
+
+/**
+ *	Run all request and response cases, the message is passed
+ *	in one packet and byte by byte.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_test_function(void)
+{
+	int i;
+	int bytes;
+	int n = 0;
+	int nreq = sizeof(_g_reqs) / sizeof(_g_reqs[0]);
+	int nres = sizeof(_g_ress) / sizeof(_g_ress[0]);
+
+	for (bytes = 0; bytes < 2; bytes++) {
+		for (i = 0; i < nreq; i++) {
+			if (_test_request(&_g_reqs[i], bytes))
+				n++;
+		}
+
+		for (i = 0; i < nres; i++) {
+			if (_test_response(&_g_ress[i], bytes))
+				n++;
+		}
+	}
+
+	if (n > 0) {
+		printf("http_mux function test %d failed\n", n);
+		return -1;
+	}
+
+	printf("http_mux function test success\n");
+	return 0;
+}
+
+int 
+main(int argc, char **argv)
+{
+	int ret;
+
+	_g_hm = hmux_alloc(HMUX_MAX_CONN);
+	_g_pool = objpool_alloc(MAX_PKTSIZE, 64, 0);
+	if (!_g_hm || !_g_pool) {
+		printf("alloc resource failed\n");
+		ret = -1;
+	}
+	else
+		ret = _test_function();
+
+	if (_g_pool)
+		objpool_free(_g_pool);
+	if (_g_hm)
+		hmux_free(_g_hm);
+
+	return ret;
+}
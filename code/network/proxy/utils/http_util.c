@@ -0,0 +1,86 @@
+/**
+ *	@file	http_util.c
+ *
+ *	@brief	HTTP helper functions implement.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "proxy_common.h"
+#include "proxy_debug.h"
+#include "http_util.h"
+
+int 
+http_token_find(const char *val, int len, const char *tok)
+{
+	int n;
+	const char *ptr;
+	const char *end;
+	const char *next;
+	const char *q;
+
+	n = strlen(tok);
+	ptr = val;
+	end = val + len;
+	while (ptr < end) {
+		next = memchr(ptr, ',', end - ptr);
+		if (!next)
+			next = end;
+
+		while (ptr < next && (*ptr == ' ' || *ptr == '\t'))
+			ptr++;
+
+		if (next - ptr >= n && strncasecmp(ptr, tok, n) == 0 &&
+		    (ptr + n == next || ptr[n] == ';' || ptr[n] == ' '))
+		{
+			/* check q=0, q=0.0 */
+			q = ptr + n;
+			while (q < next && *q != '=')
+				q++;
+			if (q + 1 < next && q[-1] == 'q' && q[1] == '0') {
+				q += 2;
+				while (q < next && (*q == '.' || *q == '0'))
+					q++;
+				if (q == next || *q == ' ' || *q == ';')
+					return 0;
+			}
+			return 1;
+		}
+
+		ptr = next + 1;
+	}
+
+	return 0;
+}
+
+int 
+http_split_packet(packet_t *pkt, int off, objpool_t *pktpool,
+		  int *nalloced)
+{
+	packet_t *npkt;
+	cblist_t *l;
+
+	if (off >= pkt->len)
+		return 0;
+
+	npkt = objpool_get(pktpool);
+	if (unlikely(!npkt))
+		ERR_RET(-1, "alloc packet failed\n");
+
+	PKT_INIT(npkt);
+	npkt->len = pkt->len - off;
+	memcpy(npkt->data, PKT_DATA(pkt) + off, npkt->len);
+	pkt->len = off;
+
+	l = &pkt->list;
+	CBLIST_ADD_HEAD(l, &npkt->list);
+	(*nalloced)++;
+
+	return 0;
+}
@@ -0,0 +1,41 @@
+/**
+ *	@file	http_util.h
+ *
+ *	@brief	Some light-weight HTTP helper used by proxy data
+ *		stages: header value token and packet split, the
+ *		messages are framed by http_parse.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#ifndef FZ_HTTP_UTIL_H
+#define FZ_HTTP_UTIL_H
+
+#include <sys/types.h>
+
+#include "packet.h"
+
+/**
+ *	Find token @tok in comma separated list @val. The parameter
+ *	after token is checked, "q=0" means not acceptable.
+ *
+ *	Return 1 if found and acceptable, 0 if not.
+ */
+extern int 
+http_token_find(const char *val, int len, const char *tok);
+
+/**
+ *	Split packet @pkt at offset @off, the data after @off is
+ *	copied into a new packet from @pktpool which is inserted 
+ *	after @pkt, @*nalloced is increased.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+http_split_packet(packet_t *pkt, int off, objpool_t *pktpool,
+		  int *nalloced);
+
+#endif /* end of FZ_HTTP_UTIL_H */
+
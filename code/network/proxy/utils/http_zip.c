@@ -0,0 +1,932 @@
+/**
+ *	@file	http_zip.c
+ *
+ *	@brief	HTTP response compress stage implement.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#define	_GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "packet.h"
+#include "proxy_common.h"
+#include "proxy_debug.h"
+#include "http_parse.h"
+#include "http_util.h"
+#include "http_zip.h"
+
+/* response state */
+#define	_HZ_S_HTTP	0	/* parse HTTP response */
+#define	_HZ_S_PASS	1	/* pass all data to end of connection */
+
+#define	_HZ_NSEC	1000000000ULL
+
+static u_int64_t 
+_hzip_cputime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * _HZ_NSEC + ts.tv_nsec;
+}
+
+static u_int64_t 
+_hzip_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec * _HZ_NSEC + ts.tv_nsec;
+}
+
+/**
+ *	Check the CPU budget of @ctx in current 1 second window.
+ *
+ *	Return 1 if budget is not exhausted, 0 if exhausted.
+ */
+static int 
+_hzip_budget_ok(hzip_ctx_t *ctx)
+{
+	u_int64_t now;
+
+	if (ctx->cpu >= 100)
+		return 1;
+
+	now = _hzip_now();
+	if (now - ctx->win_start >= _HZ_NSEC) {
+		ctx->win_start = now;
+		ctx->win_used = 0;
+	}
+
+	return ctx->win_used < (u_int64_t)ctx->cpu * (_HZ_NSEC / 100);
+}
+
+static z_stream * 
+_hzip_new_stream(hzip_ctx_t *ctx, int fmt)
+{
+	z_stream *zs;
+	int wbits;
+
+	zs = calloc(1, sizeof(*zs));
+	if (!zs)
+		ERR_RET(NULL, "calloc memory for z_stream failed\n");
+
+	/* windowBits + 16 is gzip header/trailer */
+	wbits = (fmt == HZIP_FMT_GZIP) ? MAX_WBITS + 16 : MAX_WBITS;
+	if (deflateInit2(zs, ctx->level, Z_DEFLATED, wbits,
+			 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		free(zs);
+		ERR_RET(NULL, "deflateInit2 failed\n");
+	}
+
+	ctx->nstream[fmt]++;
+
+	return zs;
+}
+
+/**
+ *	Get a free deflate stream of format @fmt from @ctx, alloc
+ *	new one if no free stream and not exceed @ctx->maxstream.
+ *
+ *	Return pointer if success, NULL if no stream.
+ */
+static z_stream * 
+_hzip_get_stream(hzip_ctx_t *ctx, int fmt)
+{
+	if (ctx->nfree[fmt] > 0)
+		return ctx->streams[fmt][--ctx->nfree[fmt]];
+
+	if (ctx->nstream[fmt] >= ctx->maxstream)
+		return NULL;
+
+	return _hzip_new_stream(ctx, fmt);
+}
+
+/**
+ *	Reset deflate stream @zs and put it back into @ctx.
+ *
+ *	No return.
+ */
+static void 
+_hzip_put_stream(hzip_ctx_t *ctx, int fmt, z_stream *zs)
+{
+	deflateReset(zs);
+
+	assert(ctx->nfree[fmt] < HZIP_MAX_STREAM);
+	ctx->streams[fmt][ctx->nfree[fmt]++] = zs;
+}
+
+/**
+ *	Append @len bytes in @data into tail of packet list @out,
+ *	new packet is alloced from @ctx->pktpool if need.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_hzip_emit(hzip_ctx_t *ctx, cblist_t *out, int *nalloced,
+	   const void *data, int len)
+{
+	int n;
+	packet_t *pkt;
+	const char *ptr = data;
+
+	while (len > 0) {
+		/* the passed packet may be tail, it can't be external */
+		pkt = CBLIST_GET_TAIL(out, packet_t *, list);
+		if (!pkt || pkt->ext || pkt->len >= pkt->max) {
+			pkt = objpool_get(ctx->pktpool);
+			if (unlikely(!pkt))
+				ERR_RET(-1, "alloc packet failed\n");
+			PKT_INIT(pkt);
+			CBLIST_ADD_TAIL(out, &pkt->list);
+			(*nalloced)++;
+		}
+
+		n = pkt->max - pkt->len;
+		if (n > len)
+			n = len;
+		memcpy(pkt->data + pkt->len, ptr, n);
+		pkt->len += n;
+		ptr += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ *	Compress @len bytes in @data using @hz->zs, the output
+ *	is appended into @out as chunks.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_hzip_deflate(hzip_ctx_t *ctx, hzip_t *hz, const char *data, int len,
+	      int flush, cblist_t *out, int *nalloced)
+{
+	int n;
+	int ret;
+	int hlen;
+	z_stream *zs;
+	char hex[16];
+
+	zs = hz->zs;
+	zs->next_in = (Bytef *)data;
+	zs->avail_in = len;
+
+	do {
+		zs->next_out = ctx->obuf;
+		zs->avail_out = HZIP_OBUF;
+
+		ret = deflate(zs, flush);
+		if (unlikely(ret == Z_STREAM_ERROR))
+			ERR_RET(-1, "deflate failed\n");
+
+		n = HZIP_OBUF - zs->avail_out;
+		if (n < 1)
+			continue;
+
+		/* each output block is a chunk */
+		hlen = snprintf(hex, sizeof(hex), "%x\r\n", n);
+		if (_hzip_emit(ctx, out, nalloced, hex, hlen) ||
+		    _hzip_emit(ctx, out, nalloced, ctx->obuf, n) ||
+		    _hzip_emit(ctx, out, nalloced, "\r\n", 2))
+			return -1;
+
+		hz->outbytes += n;
+
+	} while (zs->avail_out == 0 ||
+		 (flush == Z_FINISH && ret != Z_STREAM_END));
+
+	hz->inbytes += len;
+
+	return 0;
+}
+
+/**
+ *	Free the response packet @pkt which isn't output.
+ *
+ *	No return.
+ */
+static void 
+_hzip_drop(hzip_t *hz, packet_t *pkt)
+{
+	PKT_FREE(pkt);
+	(*hz->nalloced)--;
+}
+
+/**
+ *	Move the held header packets of @hz into output, they're
+ *	passed without change.
+ *
+ *	No return.
+ */
+static void 
+_hzip_unhold(hzip_t *hz)
+{
+	CBLIST_JOIN(hz->out, &hz->hold);
+	hz->hlen = 0;
+}
+
+/**
+ *	Output the bytes before @off in @hz->pkt which are not
+ *	output, they're the tail of previous passed response.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_hzip_flush(hzip_t *hz, int off)
+{
+	packet_t *pkt;
+
+	pkt = hz->pkt;
+	if (pkt->sendpos >= (u_int32_t)off)
+		return 0;
+
+	if (_hzip_emit(hz->ctx, hz->out, hz->nalloced, 
+		       PKT_DATA(pkt) + pkt->sendpos, off - pkt->sendpos))
+		return -1;
+
+	pkt->sendpos = off;
+	return 0;
+}
+
+/**
+ *	Record the header line at message position @pos is removed
+ *	if the response is compressed.
+ *
+ *	No return.
+ */
+static void 
+_hzip_drop_line(hzip_t *hz, u_int64_t pos)
+{
+	if (hz->ndrop >= HZIP_MAX_DROP) {
+		hz->nozip = 1;
+		return;
+	}
+
+	hz->drop[hz->ndrop++] = pos;
+}
+
+/**
+ *	Output the header bytes in @ptr which begin at message 
+ *	position @pos, the bytes after @stop and the lines in 
+ *	@hz->drop are removed. @*skip is set when in a removed
+ *	line, @*di is the next index of @hz->drop.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_hzip_emit_lines(hzip_t *hz, const char *ptr, int len, u_int64_t pos,
+		 u_int64_t stop, int *skip, int *di)
+{
+	int n;
+	const char *lf;
+
+	while (len > 0 && pos < stop) {
+
+		if (*skip) {
+			lf = memchr(ptr, '\n', len);
+			n = lf ? lf - ptr + 1 : len;
+			*skip = lf ? 0 : 1;
+		}
+		else if (*di < hz->ndrop && hz->drop[*di] == pos) {
+			(*di)++;
+			*skip = 1;
+			continue;
+		}
+		else {
+			n = len;
+			if ((u_int64_t)n > stop - pos)
+				n = stop - pos;
+			if (*di < hz->ndrop && (u_int64_t)n > hz->drop[*di] - pos)
+				n = hz->drop[*di] - pos;
+			if (_hzip_emit(hz->ctx, hz->out, hz->nalloced, ptr, n))
+				return -1;
+		}
+
+		ptr += n;
+		len -= n;
+		pos += n;
+	}
+
+	return 0;
+}
+
+/**
+ *	Output the header of compressed response, the header is in
+ *	held packets and @hz->pkt before offset @end, @eoh is the 
+ *	position of last empty line. Content-Length and 
+ *	Transfer-Encoding is removed, ETag is changed to weak ETag,
+ *	and Content-Encoding/Transfer-Encoding/Vary is added.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_hzip_emit_header(hzip_t *hz, int end, u_int64_t eoh)
+{
+	int len;
+	int skip = 0;
+	int di = 0;
+	u_int64_t pos = 0;
+	packet_t *pkt, *bk;
+	char buf[HZIP_MAX_ETAG + 128];
+
+	CBLIST_FOR_EACH(&hz->hold, pkt, list) {
+		len = pkt->len - pkt->sendpos;
+		if (_hzip_emit_lines(hz, PKT_DATA(pkt) + pkt->sendpos, len,
+				     pos, eoh, &skip, &di))
+			return -1;
+		pos += len;
+	}
+
+	pkt = hz->pkt;
+	if (_hzip_emit_lines(hz, PKT_DATA(pkt) + pkt->sendpos, 
+			     end - pkt->sendpos, pos, eoh, &skip, &di))
+		return -1;
+
+	len = 0;
+	if (hz->etaglen > 0)
+		len = snprintf(buf, sizeof(buf), "ETag: W/%.*s\r\n",
+			       hz->etaglen, hz->etag);
+	len += snprintf(buf + len, sizeof(buf) - len,
+			"Content-Encoding: %s\r\n"
+			"Transfer-Encoding: chunked\r\n"
+			"Vary: Accept-Encoding\r\n\r\n",
+			hz->fmt == HZIP_FMT_GZIP ? "gzip" : "deflate");
+	if (_hzip_emit(hz->ctx, hz->out, hz->nalloced, buf, len))
+		return -1;
+
+	/* the header is rewrited, free origin packets */
+	CBLIST_FOR_EACH_SAFE(&hz->hold, pkt, bk, list) {
+		CBLIST_DEL(&pkt->list);
+		_hzip_drop(hz, pkt);
+	}
+	hz->hlen = 0;
+	hz->pkt->sendpos = end;
+
+	return 0;
+}
+
+/**
+ *	Process the request header @id which value is @val, the 
+ *	request is queued for response when header end.
+ *
+ *	No return.
+ */
+static void 
+_hzip_request_header(hzip_t *hz, int id, const char *val, size_t len)
+{
+	hzip_req_t *req;
+	http_request_t *r;
+
+	req = &hz->qcur;
+
+	if (id == HTTP_HST_ACCEPT_ENCODING) {
+		if (http_token_find(val, len, "gzip") ||
+		    http_token_find(val, len, "x-gzip"))
+			req->enc |= 1 << HZIP_FMT_GZIP;
+		if (http_token_find(val, len, "deflate"))
+			req->enc |= 1 << HZIP_FMT_DEFLATE;
+		return;
+	}
+
+	if (id != HTTP_HST_END)
+		return;
+
+	if (hz->rtail - hz->rhead >= HZIP_MAX_REQ) {
+		hz->qoff = 1;
+		return;
+	}
+
+	r = &hz->hi.request;
+	req->ver = r->version;
+	req->head = (r->method == HTTP_MED_HEAD);
+	req->connect = (r->method == HTTP_MED_CONNECT);
+
+	hz->reqs[hz->rtail % HZIP_MAX_REQ] = *req;
+	hz->rtail++;
+	memset(req, 0, sizeof(*req));
+}
+
+/**
+ *	The response header is finished, decide compress it or not,
+ *	@eoh is the position of last empty line.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_hzip_response_header(hzip_t *hz, u_int64_t eoh)
+{
+	int code;
+	int end;
+	int chunked;
+	u_int64_t clen;
+	hzip_req_t req;
+	hzip_ctx_t *ctx;
+	http_info_t *hi;
+
+	ctx = hz->ctx;
+	hi = &hz->hi;
+	code = hi->response.retcode;
+
+	/* interim response, the final response follow it */
+	if (code >= 100 && code < 200 && code != 101)
+		goto pass;
+
+	ctx->stat.nresponse++;
+
+	/* no request infomation, the request is not HTTP */
+	if (hz->rhead == hz->rtail) {
+		hz->state = _HZ_S_PASS;
+		goto pass;
+	}
+	req = hz->reqs[hz->rhead % HZIP_MAX_REQ];
+	hz->rhead++;
+
+	/* protocol switched */
+	if (code == 101 || (req.connect && code >= 200 && code < 300)) {
+		hz->state = _HZ_S_PASS;
+		goto pass;
+	}
+
+	/* response of HEAD have no body */
+	if (req.head)
+		http_skip_body(hi, HTTP_DIR_RESPONSE);
+
+	/* no body or close-delimited body */
+	chunked = http_get_int(hi, HTTP_DIR_RESPONSE, HTTP_INT_CHUNKED);
+	clen = http_get_len(hi, HTTP_DIR_RESPONSE, HTTP_INT_CLEN);
+	if (http_get_int(hi, HTTP_DIR_RESPONSE, HTTP_INT_STATE) != 
+	    HTTP_STE_BODY || (!chunked && clen == 0))
+		goto pass;
+
+	/* compress it or not */
+	if (!req.enc || code != 200 || hz->nozip ||
+	    http_get_int(hi, HTTP_DIR_RESPONSE, HTTP_INT_CTYPE) == 
+	    HTTP_CTE_UNKOWNED ||
+	    hi->response.version < HTTP_VER_11 || req.ver < HTTP_VER_11 ||
+	    (!chunked && clen < (u_int64_t)ctx->minlen))
+		goto pass;
+
+	if (!_hzip_budget_ok(ctx)) {
+		ctx->stat.nbudget++;
+		goto pass;
+	}
+
+	hz->fmt = (req.enc & (1 << HZIP_FMT_GZIP)) ?
+		HZIP_FMT_GZIP : HZIP_FMT_DEFLATE;
+	hz->zs = _hzip_get_stream(ctx, hz->fmt);
+	if (!hz->zs) {
+		ctx->stat.nnostream++;
+		goto pass;
+	}
+
+	hz->zip = 1;
+	hz->inbytes = 0;
+	hz->outbytes = 0;
+	hz->pending = 0;
+
+	/* header end offset in current packet */
+	end = hz->off + (http_get_len(hi, HTTP_DIR_RESPONSE, HTTP_INT_HLEN) -
+			 hz->mpos);
+	return _hzip_emit_header(hz, end, eoh);
+
+pass:
+	_hzip_unhold(hz);
+	return 0;
+}
+
+/**
+ *	The header callback of parser, see http_header_cb.
+ */
+static void 
+_hzip_header_cb(http_info_t *hi, int dir, int id, u_int64_t pos,
+		const char *val, size_t len, void *arg)
+{
+	hzip_t *hz = arg;
+
+	if (dir == HTTP_DIR_REQUEST) {
+		if (!hz->qoff)
+			_hzip_request_header(hz, id, val, len);
+		return;
+	}
+
+	switch (id) {
+
+	case HTTP_HST_END:
+		if (_hzip_response_header(hz, pos))
+			hz->ret = -1;
+		break;
+
+	case HTTP_HST_CONTENT_LENGTH:
+		_hzip_drop_line(hz, pos);
+		break;
+
+	case HTTP_HST_TRANSFER_ENCODING:
+		/* other transfer coding is not supported */
+		if (len != 7 || strncasecmp(val, "chunked", 7))
+			hz->nozip = 1;
+		_hzip_drop_line(hz, pos);
+		break;
+
+	case HTTP_HST_ETAG:
+		/* weak ETag is kept */
+		if (len < 1 || *val != '"')
+			break;
+		if (len > HZIP_MAX_ETAG) {
+			hz->nozip = 1;
+			break;
+		}
+		memcpy(hz->etag, val, len);
+		hz->etaglen = len;
+		_hzip_drop_line(hz, pos);
+		break;
+
+	case HTTP_HST_CONTENT_ENCODING:
+		if (len != 8 || strncasecmp(val, "identity", 8))
+			hz->nozip = 1;
+		break;
+
+	case HTTP_HST_CONTENT_RANGE:
+		hz->nozip = 1;
+		break;
+
+	case HTTP_HST_CACHE_CONTROL:
+		if (http_token_find(val, len, "no-transform"))
+			hz->nozip = 1;
+		break;
+
+	/* folded line can't be removed */
+	case HTTP_HST_BEGIN:
+		hz->nozip = 1;
+		break;
+	}
+}
+
+/**
+ *	The body callback of parser, the response body in @hz->pkt
+ *	is compressed.
+ */
+static void 
+_hzip_body_cb(http_info_t *hi, int dir, const char *data, size_t len,
+	      void *arg)
+{
+	hzip_t *hz = arg;
+	packet_t *pkt;
+
+	if (dir != HTTP_DIR_RESPONSE || !hz->zip || hz->ret)
+		return;
+
+	if (!hz->t0)
+		hz->t0 = _hzip_cputime();
+
+	if (_hzip_deflate(hz->ctx, hz, data, len, Z_NO_FLUSH, 
+			  hz->out, hz->nalloced))
+	{
+		hz->ret = -1;
+		return;
+	}
+
+	/* the chunked response maybe streaming, it's flushed */
+	if (http_get_int(hi, dir, HTTP_INT_CHUNKED))
+		hz->pending += len;
+
+	pkt = hz->pkt;
+	pkt->sendpos = data + len - PKT_DATA(pkt);
+}
+
+/**
+ *	The response body is finished, finish the deflate stream
+ *	and put last chunk.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_hzip_response_end(hzip_ctx_t *ctx, hzip_t *hz, cblist_t *out,
+		   int *nalloced)
+{
+	if (!hz->zip)
+		return 0;
+
+	if (_hzip_deflate(ctx, hz, NULL, 0, Z_FINISH, out, nalloced) ||
+	    _hzip_emit(ctx, out, nalloced, "0\r\n\r\n", 5))
+		return -1;
+
+	ctx->stat.nzip++;
+	ctx->stat.inbytes += hz->inbytes;
+	ctx->stat.outbytes += hz->outbytes;
+
+	_hzip_put_stream(ctx, hz->fmt, hz->zs);
+	hz->zs = NULL;
+	hz->zip = 0;
+	hz->pending = 0;
+
+	return 0;
+}
+
+hzip_ctx_t * 
+hzip_ctx_alloc(objpool_t *pktpool, int level, int minlen,
+	       int cpu, int maxstream)
+{
+	int i;
+	int fmt;
+	z_stream *zs;
+	hzip_ctx_t *ctx;
+
+	if (!pktpool || level < 1 || level > 9 || minlen < 0 ||
+	    cpu < 1 || cpu > 100 || maxstream < 1)
+		ERR_RET(NULL, "invalid argument\n");
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		ERR_RET(NULL, "calloc memory for hzip_ctx failed\n");
+
+	ctx->pktpool = pktpool;
+	ctx->level = level;
+	ctx->minlen = minlen;
+	ctx->cpu = cpu;
+	ctx->maxstream = maxstream;
+	if (ctx->maxstream > HZIP_MAX_STREAM)
+		ctx->maxstream = HZIP_MAX_STREAM;
+	ctx->win_start = _hzip_now();
+
+	ctx->hzpool = objpool_alloc(sizeof(hzip_t), 64, 0);
+	if (!ctx->hzpool) {
+		hzip_ctx_free(ctx);
+		ERR_RET(NULL, "objpool_alloc for hzip failed\n");
+	}
+
+	/* pre-init some streams, avoid deflateInit in data path */
+	for (fmt = 0; fmt < HZIP_FMT_MAX; fmt++) {
+		for (i = 0; i < HZIP_INIT_STREAM && i < ctx->maxstream; i++) {
+			zs = _hzip_new_stream(ctx, fmt);
+			if (!zs) {
+				hzip_ctx_free(ctx);
+				return NULL;
+			}
+			ctx->streams[fmt][ctx->nfree[fmt]++] = zs;
+		}
+	}
+
+	return ctx;
+}
+
+void 
+hzip_ctx_free(hzip_ctx_t *ctx)
+{
+	int i;
+	int fmt;
+
+	if (!ctx)
+		return;
+
+	for (fmt = 0; fmt < HZIP_FMT_MAX; fmt++) {
+		for (i = 0; i < ctx->nfree[fmt]; i++) {
+			deflateEnd(ctx->streams[fmt][i]);
+			free(ctx->streams[fmt][i]);
+		}
+	}
+
+	if (ctx->hzpool)
+		objpool_free(ctx->hzpool);
+
+	free(ctx);
+}
+
+int 
+hzip_ctx_print(const hzip_ctx_t *ctx, char *buf, size_t len)
+{
+	const hzip_stat_t *st;
+
+	if (!ctx || !buf || len < 1)
+		return 0;
+
+	st = &ctx->stat;
+	return snprintf(buf, len,
+			"response %llu, zip %llu, budget %llu, nostream %llu, "
+			"in %llu, out %llu, cpu %llu ms\n",
+			(unsigned long long)st->nresponse,
+			(unsigned long long)st->nzip,
+			(unsigned long long)st->nbudget,
+			(unsigned long long)st->nnostream,
+			(unsigned long long)st->inbytes,
+			(unsigned long long)st->outbytes,
+			(unsigned long long)st->cpu_ns / 1000000);
+}
+
+hzip_t * 
+hzip_alloc(hzip_ctx_t *ctx)
+{
+	hzip_t *hz;
+
+	if (unlikely(!ctx))
+		ERR_RET(NULL, "invalid argument\n");
+
+	hz = objpool_get(ctx->hzpool);
+	if (unlikely(!hz))
+		ERR_RET(NULL, "alloc hzip failed\n");
+
+	memset(hz, 0, sizeof(*hz));
+	CBLIST_INIT(&hz->hold);
+	http_set_header_cb(&hz->hi, _hzip_header_cb, hz);
+	http_set_body_cb(&hz->hi, _hzip_body_cb, hz);
+
+	return hz;
+}
+
+void 
+hzip_free(hzip_ctx_t *ctx, hzip_t *hz, int *nalloced)
+{
+	packet_t *pkt, *bk;
+
+	if (unlikely(!ctx || !hz || !nalloced))
+		return;
+
+	if (hz->zs)
+		_hzip_put_stream(ctx, hz->fmt, hz->zs);
+
+	CBLIST_FOR_EACH_SAFE(&hz->hold, pkt, bk, list) {
+		CBLIST_DEL(&pkt->list);
+		PKT_FREE(pkt);
+		(*nalloced)--;
+	}
+
+	http_free_info(&hz->hi);
+
+	objpool_put(hz);
+}
+
+int 
+hzip_request(hzip_t *hz, cblist_t *pkts)
+{
+	int n;
+	int len;
+	const char *ptr;
+	packet_t *pkt;
+
+	if (unlikely(!hz || !pkts))
+		ERR_RET(-1, "invalid argument\n");
+
+	CBLIST_FOR_EACH(pkts, pkt, list) {
+
+		ptr = PKT_DATA(pkt) + pkt->sendpos;
+		len = pkt->len - pkt->sendpos;
+
+		/* the pipelined requests are parsed one by one */
+		while (len > 0 && !hz->qoff) {
+			n = http_parse(&hz->hi, HTTP_DIR_REQUEST, ptr, len);
+			if (n < 0) {
+				hz->qoff = 1;
+				break;
+			}
+			ptr += len - n;
+			len = n;
+		}
+	}
+
+	return 0;
+}
+
+int 
+hzip_response(hzip_ctx_t *ctx, hzip_t *hz, cblist_t *pkts, int *nalloced)
+{
+	int n;
+	int off;
+	int st;
+	int ret = 0;
+	u_int64_t used;
+	cblist_t out;
+	packet_t *pkt, *bk;
+
+	if (unlikely(!ctx || !hz || !pkts || !nalloced))
+		ERR_RET(-1, "invalid argument\n");
+
+	CBLIST_INIT(&out);
+	hz->ctx = ctx;
+	hz->out = &out;
+	hz->nalloced = nalloced;
+	hz->t0 = 0;
+	hz->ret = 0;
+
+	CBLIST_FOR_EACH_SAFE(pkts, pkt, bk, list) {
+
+		CBLIST_DEL(&pkt->list);
+		hz->pkt = pkt;
+		off = pkt->sendpos;
+
+		while (hz->state == _HZ_S_HTTP && off < pkt->len) {
+
+			/* new response begin, output previous one */
+			st = http_get_int(&hz->hi, HTTP_DIR_RESPONSE, 
+					  HTTP_INT_STATE);
+			if (st == HTTP_STE_BEGIN || st == HTTP_STE_FIN) {
+				if (_hzip_flush(hz, off)) {
+					ret = -1;
+					break;
+				}
+				hz->mpos = 0;
+				hz->nozip = 0;
+				hz->ndrop = 0;
+				hz->etaglen = 0;
+			}
+			else
+				hz->mpos = http_get_len(&hz->hi, 
+						HTTP_DIR_RESPONSE, HTTP_INT_MLEN);
+
+			hz->off = off;
+			n = http_parse(&hz->hi, HTTP_DIR_RESPONSE, 
+				       PKT_DATA(pkt) + off, pkt->len - off);
+			if (unlikely(hz->ret)) {
+				ret = -1;
+				break;
+			}
+			if (n < 0) {
+				/* compressed body can't recover */
+				if (hz->zip) {
+					ERR("invalid response body\n");
+					ret = -1;
+					break;
+				}
+				hz->state = _HZ_S_PASS;
+				break;
+			}
+			off = pkt->len - n;
+
+			if (hz->zip && http_get_int(&hz->hi, HTTP_DIR_RESPONSE,
+						    HTTP_INT_STATE) == HTTP_STE_FIN)
+			{
+				if (_hzip_response_end(ctx, hz, &out, nalloced)) {
+					ret = -1;
+					break;
+				}
+				/* the last chunk and trailer is removed */
+				pkt->sendpos = off;
+			}
+		}
+
+		if (unlikely(ret)) {
+			CBLIST_ADD_TAIL(&out, &pkt->list);
+			break;
+		}
+
+		if (hz->state == _HZ_S_PASS) {
+			_hzip_unhold(hz);
+			CBLIST_ADD_TAIL(&out, &pkt->list);
+			continue;
+		}
+
+		st = http_get_int(&hz->hi, HTTP_DIR_RESPONSE, HTTP_INT_STATE);
+		if (st != HTTP_STE_BEGIN && st != HTTP_STE_BODY && 
+		    st != HTTP_STE_FIN) 
+		{
+			/* the header is incomplete, hold it */
+			hz->hlen += pkt->len - pkt->sendpos;
+			CBLIST_ADD_TAIL(&hz->hold, &pkt->list);
+
+			/* oversize header, give up */
+			if (hz->hlen > HZIP_MAX_HDR) {
+				hz->state = _HZ_S_PASS;
+				_hzip_unhold(hz);
+			}
+		}
+		else if (hz->zip || pkt->sendpos >= pkt->len) {
+			/* the remain is chunk size line of compressed body */
+			_hzip_drop(hz, pkt);
+		}
+		else
+			CBLIST_ADD_TAIL(&out, &pkt->list);
+	}
+
+	/* the chunked response maybe streaming, flush it to client */
+	if (!ret && hz->zip && hz->pending) {
+		ret = _hzip_deflate(ctx, hz, NULL, 0, Z_SYNC_FLUSH,
+				    &out, nalloced);
+		hz->pending = 0;
+	}
+
+	if (hz->t0) {
+		used = _hzip_cputime() - hz->t0;
+		ctx->win_used += used;
+		ctx->stat.cpu_ns += used;
+	}
+
+	CBLIST_JOIN(pkts, &out);
+	hz->out = NULL;
+	hz->pkt = NULL;
+
+	if (unlikely(ret))
+		ERR_RET(-1, "compress response failed\n");
+
+	return 0;
+}
@@ -0,0 +1,197 @@
+/**
+ *	@file	http_zip.h
+ *
+ *	@brief	HTTP response compress stage for proxy. The request
+ *		and response are parsed by http_parse(), the request
+ *		Accept-Encoding is recorded and the eligible response
+ *		body is gzip/deflate on the fly, the compressed body
+ *		is re-framed using chunked transfer encoding.
+ *
+ *		The deflate streams are alloced per-worker and reset
+ *		between responses, each worker have a CPU budget, the
+ *		new response isn't compressed when budget exhausted.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#ifndef FZ_HTTP_ZIP_H
+#define FZ_HTTP_ZIP_H
+
+#include <sys/types.h>
+#include <zlib.h>
+
+#include "cblist.h"
+#include "objpool.h"
+#include "packet.h"
+#include "http_parse.h"
+
+#define	HZIP_FMT_GZIP		0	/* gzip format */
+#define	HZIP_FMT_DEFLATE	1	/* deflate(zlib) format */
+#define	HZIP_FMT_MAX		2
+
+#define	HZIP_MAX_STREAM		256	/* max deflate streams per format */
+#define	HZIP_INIT_STREAM	4	/* pre-inited streams per format */
+#define	HZIP_MAX_HDR		8192	/* max response header size */
+#define	HZIP_MAX_REQ		16	/* max pipelined requests */
+#define	HZIP_MAX_DROP		8	/* max header lines removed */
+#define	HZIP_MAX_ETAG		128	/* max ETag value */
+#define	HZIP_OBUF		16384	/* deflate output buffer size */
+
+/**
+ *	Request infomation used by response.
+ */
+typedef struct hzip_req {
+	u_int8_t	enc;		/* accepted encoding, 1 << HZIP_FMT_XXX */
+	u_int8_t	head;		/* HEAD request */
+	u_int8_t	connect;	/* CONNECT request */
+	u_int8_t	ver;		/* HTTP_VER_XX */
+} hzip_req_t;
+
+/**
+ *	Compress statistic data of worker.
+ */
+typedef struct hzip_stat {
+	u_int64_t	nresponse;	/* number of response */
+	u_int64_t	nzip;		/* compressed response */
+	u_int64_t	nbudget;	/* bypass because CPU budget */
+	u_int64_t	nnostream;	/* bypass because no stream */
+	u_int64_t	inbytes;	/* body bytes before compress */
+	u_int64_t	outbytes;	/* body bytes after compress */
+	u_int64_t	cpu_ns;		/* CPU time used in deflate */
+} hzip_stat_t;
+
+/**
+ *	Per-worker compress context, only used in one thread.
+ */
+typedef struct hzip_ctx {
+	objpool_t	*pktpool;	/* packet pool of worker */
+	objpool_t	*hzpool;	/* hzip_t pool */
+	int		level;		/* compress level 1-9 */
+	int		minlen;		/* min Content-Length to compress */
+	int		cpu;		/* CPU budget, percent of one core */
+	int		maxstream;	/* max streams per format */
+
+	u_int64_t	win_start;	/* budget window start(ns) */
+	u_int64_t	win_used;	/* CPU used in window(ns) */
+
+	z_stream	*streams[HZIP_FMT_MAX][HZIP_MAX_STREAM];/* free stream */
+	int		nfree[HZIP_FMT_MAX];	/* number of free stream */
+	int		nstream[HZIP_FMT_MAX];	/* number of alloced stream */
+
+	hzip_stat_t	stat;		/* statistic data */
+	u_int8_t	obuf[HZIP_OBUF];/* deflate output buffer */
+} hzip_ctx_t;
+
+/**
+ *	Per-session compress state.
+ */
+typedef struct hzip {
+	http_info_t	hi;		/* parser of request and response */
+
+	/* request side */
+	int		qoff;		/* request is not HTTP, stop scan */
+	hzip_req_t	qcur;		/* the request in scanning */
+	hzip_req_t	reqs[HZIP_MAX_REQ];/* requests wait response */
+	u_int32_t	rhead;		/* request ring head */
+	u_int32_t	rtail;		/* request ring tail */
+
+	/* response side */
+	int		state;		/* response state */
+	int		zip;		/* current response is compressed */
+	int		fmt;		/* HZIP_FMT_XXX */
+	int		nozip;		/* header forbid compress */
+	u_int64_t	drop[HZIP_MAX_DROP];/* pos of header line removed */
+	int		ndrop;		/* number of @drop */
+	int		etaglen;	/* length of @etag */
+	char		etag[HZIP_MAX_ETAG];/* strong ETag value */
+	cblist_t	hold;		/* packets of incomplete header */
+	int		hlen;		/* header bytes in @hold */
+	z_stream	*zs;		/* deflate stream */
+	u_int64_t	inbytes;	/* body bytes of current response */
+	u_int64_t	outbytes;	/* compressed bytes of current response */
+	u_int32_t	pending;	/* bytes compressed not flushed */
+
+	/* the hzip_response() call, used in parser callback */
+	hzip_ctx_t	*ctx;		/* compress context */
+	cblist_t	*out;		/* output packets */
+	int		*nalloced;	/* packet counter of session */
+	packet_t	*pkt;		/* the packet in parse */
+	int		off;		/* offset of @pkt passed to parser */
+	u_int64_t	mpos;		/* message position of @off */
+	u_int64_t	t0;		/* CPU time when deflate begin */
+	int		ret;		/* error in callback */
+} hzip_t;
+
+/**
+ *	Alloc a compress context for worker, the output packet
+ *	is alloced from @pktpool. @level is compress level(1-9),
+ *	@minlen is min Content-Length which need compress, @cpu is
+ *	CPU budget(percent of one core), @maxstream is max deflate
+ *	streams of each format.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+extern hzip_ctx_t * 
+hzip_ctx_alloc(objpool_t *pktpool, int level, int minlen,
+	       int cpu, int maxstream);
+
+/**
+ *	Free compress context @ctx alloced by hzip_ctx_alloc().
+ *
+ *	No return.
+ */
+extern void 
+hzip_ctx_free(hzip_ctx_t *ctx);
+
+/**
+ *	Print the statistic data of @ctx into @buf, @len is
+ *	size of @buf.
+ *
+ *	Return the length of output.
+ */
+extern int 
+hzip_ctx_print(const hzip_ctx_t *ctx, char *buf, size_t len);
+
+/**
+ *	Alloc a session compress state from @ctx.
+ *
+ *	Return pointer if success, NULL on error.
+ */
+extern hzip_t * 
+hzip_alloc(hzip_ctx_t *ctx);
+
+/**
+ *	Free session compress state @hz, the deflate stream
+ *	is put back to @ctx, the held response header packets
+ *	are freed and @nalloced is updated.
+ *
+ *	No return.
+ */
+extern void 
+hzip_free(hzip_ctx_t *ctx, hzip_t *hz, int *nalloced);
+
+/**
+ *	Parse request packets in @pkts, the packets are not
+ *	modified.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+hzip_request(hzip_t *hz, cblist_t *pkts);
+
+/**
+ *	Compress response packets in @pkts, the packets in @pkts
+ *	are replaced by the output packets, the packets of an
+ *	incomplete response header are held in @hz. @nalloced is
+ *	packet counter of session, it's updated when packet 
+ *	alloced or freed.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+hzip_response(hzip_ctx_t *ctx, hzip_t *hz, cblist_t *pkts, int *nalloced);
+
+#endif /* end of FZ_HTTP_ZIP_H */
+
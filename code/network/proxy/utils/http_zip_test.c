@@ -0,0 +1,572 @@
+/**
+ *	@file	http_zip_test.c
+ *
+ *	@brief	http_zip test program, it compress a generated text
+ *		response through hzip_response(), verify the output
+ *		and report MB/s per core of each compress level.
+ *
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#define	_GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "packet.h"
+#include "proxy_common.h"
+#include "proxy_debug.h"
+#include "http_zip.h"
+
+#define	_MAX_LEVEL	9
+#define	_MAX_BUDGET_LOOP 10000	/* max responses to use up budget */
+
+int		g_timestamp;		/* timestamp in debug output */
+int		g_dbglvl;		/* debug level: 0 disable, 7 max */
+int		g_flowlvl;		/* flow level: 0 disable, 7 max */
+int		g_httplvl;		/* http level: 0 disable, 7 max */
+
+static char _g_optstr[] = ":s:l:n:b:ch";
+static int _g_size = 1024;		/* body size in KB */
+static int _g_levels[_MAX_LEVEL];	/* compress levels */
+static int _g_nlevel;
+static int _g_loop = 10;		/* loop times */
+static int _g_batch = 16;		/* packets in one call */
+static int _g_chunked;			/* chunked response */
+static char *_g_body;			/* response body */
+static char *_g_response;		/* whole response */
+static int _g_reslen;
+static objpool_t *_g_pktpool;
+
+static const char *_g_words[] = {
+	"<div class=\"item\">", "</div>", "<span>", "</span>", "<a href=\"",
+	"/index.html\">", "</a>", "proxy", "server", "client", "session",
+	"connection", "packet", "worker", "compress", "request", "response",
+	"header", "content", "<p>", "</p>", "\n", "the", "of", "and", "to",
+	"value", "table", "<td>", "</td>", "<tr>", "</tr>", "2014", "data",
+};
+
+/**
+ *	Show help message
+ *
+ *	No return.
+ */
+static void 
+_usage(void)
+{
+	printf("http_zip_test <options>\n");
+	printf("\t-s\tbody size in KB, default is 1024\n");
+	printf("\t-l\tcompress level list, like 1,6,9(default)\n");
+	printf("\t-n\tloop times, default is 10\n");
+	printf("\t-b\tpackets in one compress call, default is 16\n");
+	printf("\t-c\tchunked response, default is Content-Length\n");
+	printf("\t-h\tshow help message\n");
+}
+
+/**
+ *	Parse command line argument.
+ *
+ * 	Return 0 if parse success, -1 on error.
+ */
+static int 
+_parse_cmd(int argc, char **argv)
+{
+	char opt;
+	char *ptr;
+	int level;
+
+	opterr = 0;
+	while ( (opt = getopt(argc, argv, _g_optstr)) != -1) {
+
+		switch (opt) {
+
+		case 's':
+			_g_size = atoi(optarg);
+			if (_g_size < 1)
+				return -1;
+			break;
+
+		case 'l':
+			_g_nlevel = 0;
+			ptr = optarg;
+			while (ptr && *ptr && _g_nlevel < _MAX_LEVEL) {
+				level = atoi(ptr);
+				if (level < 1 || level > 9)
+					return -1;
+				_g_levels[_g_nlevel++] = level;
+				ptr = strchr(ptr, ',');
+				if (ptr)
+					ptr++;
+			}
+			break;
+
+		case 'n':
+			_g_loop = atoi(optarg);
+			if (_g_loop < 1)
+				return -1;
+			break;
+
+		case 'b':
+			_g_batch = atoi(optarg);
+			if (_g_batch < 1)
+				return -1;
+			break;
+
+		case 'c':
+			_g_chunked = 1;
+			break;
+
+		case 'h':
+			return -1;
+
+		case ':':
+			printf("Option %c missing argument\n", optopt);
+			return -1;
+
+		case '?':
+			printf("Unknowed option %c\n", optopt);
+			return -1;
+		}
+	}
+
+	if (argc != optind)
+		return -1;
+
+	if (_g_nlevel == 0) {
+		_g_levels[0] = 1;
+		_g_levels[1] = 6;
+		_g_levels[2] = 9;
+		_g_nlevel = 3;
+	}
+
+	return 0;
+}
+
+/**
+ *	Init some global resource used in program.
+ *
+ * 	Return 0 if success, -1 on error.
+ */
+static int 
+_initiate(void)
+{
+	int i;
+	int n;
+	int len;
+	int blen;
+	int nword;
+	char *ptr;
+	const char *w;
+
+	blen = _g_size * 1024;
+	_g_body = malloc(blen);
+	if (!_g_body)
+		return -1;
+
+	/* text body with random words */
+	srand(1);
+	nword = sizeof(_g_words) / sizeof(_g_words[0]);
+	for (i = 0; i < blen; i += len) {
+		w = _g_words[rand() % nword];
+		len = strlen(w);
+		if (len > blen - i)
+			len = blen - i;
+		memcpy(_g_body + i, w, len);
+		if (i + len < blen && rand() % 3 == 0)
+			_g_body[i + len++] = ' ';
+	}
+
+	/* chunked body have 1000 bytes chunk */
+	_g_response = malloc(blen * 2 + 1024);
+	if (!_g_response)
+		return -1;
+
+	ptr = _g_response;
+	ptr += sprintf(ptr, "HTTP/1.1 200 OK\r\n"
+		       "Content-Type: text/html; charset=utf-8\r\n"
+		       "ETag: \"12345\"\r\n");
+	if (_g_chunked) {
+		ptr += sprintf(ptr, "Transfer-Encoding: chunked\r\n\r\n");
+		for (i = 0; i < blen; i += n) {
+			n = blen - i > 1000 ? 1000 : blen - i;
+			ptr += sprintf(ptr, "%x\r\n", n);
+			memcpy(ptr, _g_body + i, n);
+			ptr += n;
+			ptr += sprintf(ptr, "\r\n");
+		}
+		ptr += sprintf(ptr, "0\r\n\r\n");
+	}
+	else {
+		ptr += sprintf(ptr, "Content-Length: %d\r\n\r\n", blen);
+		memcpy(ptr, _g_body, blen);
+		ptr += blen;
+	}
+	_g_reslen = ptr - _g_response;
+
+	_g_pktpool = objpool_alloc(MAX_PKTSIZE, 1024, 0);
+	if (!_g_pktpool)
+		return -1;
+
+	return 0;
+}
+
+/**
+ *	Release global resource alloced by _initiate().
+ *
+ * 	No return.
+ */
+static void 
+_release(void)
+{
+	if (_g_body)
+		free(_g_body);
+	_g_body = NULL;
+
+	if (_g_response)
+		free(_g_response);
+	_g_response = NULL;
+
+	if (_g_pktpool)
+		objpool_free(_g_pktpool);
+	_g_pktpool = NULL;
+}
+
+static u_int64_t 
+_cputime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *	Put @len bytes in @buf into packet list @pkts.
+ *
+ *	Return number of packet if success, -1 on error.
+ */
+static int 
+_fill_packets(cblist_t *pkts, const char *buf, int len)
+{
+	int n;
+	int npkt = 0;
+	packet_t *pkt;
+
+	while (len > 0) {
+		pkt = objpool_get(_g_pktpool);
+		if (!pkt)
+			return -1;
+		PKT_INIT(pkt);
+		n = len > pkt->max ? pkt->max : len;
+		memcpy(pkt->data, buf, n);
+		pkt->len = n;
+		CBLIST_ADD_TAIL(pkts, &pkt->list);
+		buf += n;
+		len -= n;
+		npkt++;
+	}
+
+	return npkt;
+}
+
+/**
+ *	Move packets in @pkts into buffer @buf and free them.
+ *
+ *	Return the bytes in @buf.
+ */
+static int 
+_drain_packets(cblist_t *pkts, char *buf, int max)
+{
+	int len = 0;
+	packet_t *pkt, *bk;
+
+	CBLIST_FOR_EACH_SAFE(pkts, pkt, bk, list) {
+		CBLIST_DEL(&pkt->list);
+		if (buf && len + pkt->len <= max) {
+			memcpy(buf + len, pkt->data, pkt->len);
+			len += pkt->len;
+		}
+		objpool_put(pkt);
+	}
+
+	return len;
+}
+
+/**
+ *	Verify compressed response @buf: de-chunk and inflate
+ *	the body, and compare with origin body.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_verify(char *buf, int len)
+{
+	char *ptr;
+	char *end;
+	char *body;
+	char *zbuf;
+	int zlen = 0;
+	unsigned long n;
+	z_stream zs;
+	int ret;
+
+	end = buf + len;
+	ptr = memmem(buf, len, "\r\n\r\n", 4);
+	if (!ptr || !memmem(buf, ptr - buf, "Content-Encoding: gzip", 22) ||
+	    !memmem(buf, ptr - buf, "ETag: W/\"12345\"", 15) ||
+	    memmem(buf, ptr - buf, "Content-Length", 14))
+	{
+		printf("invalid response header\n");
+		return -1;
+	}
+	ptr += 4;
+
+	/* de-chunk in place */
+	zbuf = ptr;
+	while (ptr < end) {
+		n = strtoul(ptr, &ptr, 16);
+		ptr += 2;
+		if (n == 0)
+			break;
+		memmove(zbuf + zlen, ptr, n);
+		zlen += n;
+		ptr += n + 2;
+	}
+
+	body = malloc(_g_size * 1024 + 1);
+	if (!body)
+		return -1;
+
+	memset(&zs, 0, sizeof(zs));
+	inflateInit2(&zs, MAX_WBITS + 16);
+	zs.next_in = (Bytef *)zbuf;
+	zs.avail_in = zlen;
+	zs.next_out = (Bytef *)body;
+	zs.avail_out = _g_size * 1024 + 1;
+	ret = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+
+	if (ret != Z_STREAM_END || zs.total_out != _g_size * 1024 ||
+	    memcmp(body, _g_body, zs.total_out))
+	{
+		printf("inflate body failed(%d), %lu bytes\n",
+		       ret, zs.total_out);
+		free(body);
+		return -1;
+	}
+
+	free(body);
+	return 0;
+}
+
+/**
+ *	Pass one request and the response through @ctx, the output 
+ *	is stored in @obuf which size is @max, the CPU time used in
+ *	hzip_response() is added into @used.
+ *
+ *	Return the output length if success, -1 on error.
+ */
+static int 
+_run_once(hzip_ctx_t *ctx, char *obuf, int max, u_int64_t *used)
+{
+	int n;
+	int nalloced;
+	char req[] = "GET / HTTP/1.1\r\nHost: www.test.com\r\n"
+		     "Accept-Encoding: gzip, deflate\r\n\r\n";
+	u_int64_t start;
+	hzip_t *hz;
+	cblist_t in, batch, out;
+	packet_t *pkt, *bk;
+
+	CBLIST_INIT(&in);
+	CBLIST_INIT(&out);
+
+	hz = hzip_alloc(ctx);
+	if (!hz)
+		return -1;
+
+	_fill_packets(&in, req, strlen(req));
+	hzip_request(hz, &in);
+	_drain_packets(&in, NULL, 0);
+
+	nalloced = _fill_packets(&in, _g_response, _g_reslen);
+	if (nalloced < 0) {
+		hzip_free(ctx, hz, &nalloced);
+		return -1;
+	}
+
+	/* compress packets in batch like recv */
+	while (!CBLIST_IS_EMPTY(&in)) {
+		CBLIST_INIT(&batch);
+		n = 0;
+		CBLIST_FOR_EACH_SAFE(&in, pkt, bk, list) {
+			if (n++ >= _g_batch)
+				break;
+			CBLIST_DEL(&pkt->list);
+			CBLIST_ADD_TAIL(&batch, &pkt->list);
+		}
+
+		start = _cputime();
+		if (hzip_response(ctx, hz, &batch, &nalloced)) {
+			printf("hzip_response failed\n");
+			_drain_packets(&batch, NULL, 0);
+			_drain_packets(&in, NULL, 0);
+			_drain_packets(&out, NULL, 0);
+			hzip_free(ctx, hz, &nalloced);
+			return -1;
+		}
+		*used += _cputime() - start;
+
+		CBLIST_JOIN(&out, &batch);
+	}
+
+	hzip_free(ctx, hz, &nalloced);
+
+	return _drain_packets(&out, obuf, max);
+}
+
+/**
+ *	Compress the response using level @level.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_test_level(int level)
+{
+	int i;
+	int len;
+	char *obuf;
+	u_int64_t used = 0;
+	hzip_ctx_t *ctx;
+	double mb;
+
+	ctx = hzip_ctx_alloc(_g_pktpool, level, 0, 100, 4);
+	if (!ctx)
+		return -1;
+
+	obuf = malloc(_g_reslen + 65536);
+	if (!obuf) {
+		hzip_ctx_free(ctx);
+		return -1;
+	}
+
+	for (i = 0; i < _g_loop; i++) {
+		len = _run_once(ctx, obuf, _g_reslen + 65536, &used);
+		if (len < 0 || (i == 0 && _verify(obuf, len)))
+			goto err_free;
+	}
+
+	mb = (double)_g_size * _g_loop / 1024;
+	printf("level %d: %8.2f MB/s per core, ratio %5.2f%%, %s\n",
+	       level, mb / (used / 1e9),
+	       ctx->stat.outbytes * 100.0 / ctx->stat.inbytes,
+	       _g_chunked ? "chunked" : "content-length");
+
+	free(obuf);
+	hzip_ctx_free(ctx);
+	return 0;
+
+err_free:
+	free(obuf);
+	hzip_ctx_free(ctx);
+	return -1;
+}
+
+/**
+ *	Compress the response with 1% CPU budget until the budget 
+ *	is used up, the response after it must be passed without
+ *	change.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_test_budget(void)
+{
+	int i;
+	int len = -1;
+	char *obuf;
+	u_int64_t used = 0;
+	hzip_ctx_t *ctx;
+
+	ctx = hzip_ctx_alloc(_g_pktpool, 9, 0, 1, 4);
+	if (!ctx)
+		return -1;
+
+	obuf = malloc(_g_reslen + 65536);
+	if (!obuf) {
+		hzip_ctx_free(ctx);
+		return -1;
+	}
+
+	for (i = 0; i < _MAX_BUDGET_LOOP && ctx->stat.nbudget == 0; i++) {
+		len = _run_once(ctx, obuf, _g_reslen + 65536, &used);
+		if (len < 0)
+			goto err_free;
+	}
+
+	if (ctx->stat.nbudget != 1 || ctx->stat.nzip != (u_int64_t)i - 1) {
+		printf("budget not used up after %d responses\n", i);
+		goto err_free;
+	}
+
+	if (len != _g_reslen || memcmp(obuf, _g_response, len)) {
+		printf("response changed after budget used up\n");
+		goto err_free;
+	}
+
+	printf("budget: %lu compressed, %lu passed, %s\n",
+	       ctx->stat.nzip, ctx->stat.nbudget,
+	       _g_chunked ? "chunked" : "content-length");
+
+	free(obuf);
+	hzip_ctx_free(ctx);
+	return 0;
+
+err_free:
+	free(obuf);
+	hzip_ctx_free(ctx);
+	return -1;
+}
+
+int 
+main(int argc, char **argv)
+{
+	int i;
+
+	if (_parse_cmd(argc, argv)) {
+		_usage();
+		return -1;
+	}
+
+	if (_initiate()) {
+		_release();
+		return -1;
+	}
+
+	for (i = 0; i < _g_nlevel; i++) {
+		if (_test_level(_g_levels[i])) {
+			printf("http_zip test level %d failed\n", _g_levels[i]);
+			_release();
+			return -1;
+		}
+	}
+
+	if (_test_budget()) {
+		printf("http_zip test budget failed\n");
+		_release();
+		return -1;
+	}
+
+	_release();
+
+	return 0;
+}
+
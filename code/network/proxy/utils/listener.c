@@ -140,6 +140,32 @@ _ltn_accept(int fd, listener_fd_t *lfd, listener_data_t *ltndata)
 	s->policy = policy_clone(lfd->policy);
 	CBLIST_ADD_TAIL(&lfd->ssnlist, &s->lfd);
 
+	/* the requests are multiplexed on backend connections in
+	 * reverse proxy, no multiplexing if alloc failed */
+	if (wi->hmpool && pl->cfg.mode == PL_MODE_REVERSE) {
+		s->hm = objpool_get(wi->hmpool);
+		if (s->hm)
+			hmux_ssn_init(s->hm, s);
+		FLOW(2, "client(%04x) %d alloc multiplexing state(%p)\n", 
+		     flags, clifd, s->hm);
+	}
+
+	/* no compress if alloc failed, it's not fatal */
+	if (wi->hz && !s->hm) {
+		s->hz = hzip_alloc(wi->hz);
+		FLOW(2, "client(%04x) %d alloc hzip(%p)\n", 
+		     flags, clifd, s->hz);
+	}
+
+	/* no cache if alloc failed, it's not fatal */
+	if (wi->hcpool && !s->hm) {
+		s->hc = objpool_get(wi->hcpool);
+		if (s->hc)
+			hcache_ssn_init(s->hc);
+		FLOW(2, "client(%04x) %d alloc cache state(%p)\n", 
+		     flags, clifd, s->hc);
+	}
+
 	return 0;
 
 	
@@ -14,9 +14,29 @@
 #include <sys/types.h>
 
 #include "cblist.h"
+#include "objpool.h"
 
 /**
- *	Packet struct, each packet is used to recv data
+ *	Reference count of the external data in packet, the
+ *	@free is called when last reference is put.
+ */
+typedef struct pkt_ref {
+	int		refcnt;		/* reference count */
+	void		(*free)(struct pkt_ref *ref);
+} pkt_ref_t;
+
+#define	PKT_REF_GET(r)						\
+	__atomic_add_fetch(&(r)->refcnt, 1, __ATOMIC_RELAXED)
+
+#define	PKT_REF_PUT(r)						\
+({								\
+	if (__atomic_sub_fetch(&(r)->refcnt, 1, __ATOMIC_ACQ_REL) == 0) \
+		(r)->free(r);					\
+})
+
+/**
+ *	Packet struct, each packet is used to recv data, or 
+ *	reference a immutable external buffer using @ext/@ref.
  */
 typedef struct packet {
 	cblist_t	list;		/* packet in list */
@@ -24,6 +44,10 @@ typedef struct packet {
 	u_int16_t	recvpos;	/* recv position */
 	u_int32_t	sendpos;	/* send position */
 	u_int16_t	len;		/* bytes in packet */
+	u_int16_t	zcref;		/* referenced by zerocopy send */
+	u_int32_t	zcid;		/* zerocopy notification id */
+	const char	*ext;		/* external data, NULL if in @data */
+	pkt_ref_t	*ref;		/* reference of @ext */
 	char		data[0];	/* ata in packet */
 } packet_t;
 
@@ -34,6 +58,21 @@ typedef struct packet {
 	(p)->sendpos = 0;		\
 	(p)->recvpos = 0;		\
 	(p)->len = 0;			\
+	(p)->zcref = 0;			\
+	(p)->zcid = 0;			\
+	(p)->ext = NULL;		\
+	(p)->ref = NULL;		\
+})
+
+/* the data of packet */
+#define	PKT_DATA(p)	((p)->ext ? (char *)(p)->ext : (p)->data)
+
+/* put packet back to pool, release the external data */
+#define	PKT_FREE(p)			\
+({					\
+	if ((p)->ref)			\
+		PKT_REF_PUT((p)->ref);	\
+	objpool_put(p);			\
 })
 
 
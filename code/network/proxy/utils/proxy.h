@@ -16,6 +16,7 @@
 #include "svrpool.h"
 #include "policy.h"
 #include "proxy_common.h"
+#include "http_cache.h"
 
 /**
  *	Proxy config.
@@ -26,6 +27,18 @@ typedef struct proxy_cfg {
 	int		naccept;	/* number of accept in one time */
 	int		use_splice;	/* using splice */
 	int		use_nbsplice;	/* using nbsplice */
+	int		zerocopy;	/* using MSG_ZEROCOPY send */
+	int		zerocopy_min;	/* min bytes for zerocopy send */
+	int		compress;	/* gzip/deflate response */
+	int		compress_level;	/* compress level 1-9 */
+	int		compress_min;	/* min Content-Length to compress */
+	int		compress_cpu;	/* compress CPU budget, percent */
+	int		compress_stream;/* max deflate streams of worker */
+	int		cache;		/* HTTP response cache */
+	int		cache_mem;	/* cache memory limit(MB) */
+	int		cache_obj;	/* max cached object size(KB) */
+	int		mux;		/* multiplex requests to backend */
+	int		mux_conn;	/* max backend connections of server */
 	int		bind_cpu;	/* enable bind cpu */
 	int		bind_cpu_algo;	/* bind cpu algo: rr | odd | even */
 	int		bind_cpu_ht;	/* bind cpu HT: full | low | high */
@@ -44,6 +57,7 @@ typedef struct proxy_data {
 	thread_t	status;		/* status thread */
 	int		nbsplice_fd;	/* nb_splice fd */
 	int		maxfd;		/* max fd */
+	hcache_t	*hc;		/* HTTP response cache */
 } proxy_data_t;
 
 /**
@@ -15,6 +15,8 @@
 #include "svrpool.h"
 #include "proxy_debug.h"
 #include "proxy_config.h"
+#include "http_zip.h"
+#include "http_mux.h"
 
 typedef enum cfg_section {
 	CFG_PROXY,
@@ -245,6 +247,146 @@ _cfg_parse_proxy(cfg_pctx_t *pctx, proxy_t *py,
 			ERR_RET(-1, "line %d: argument must be yes|no\n", 
 				pctx->lineno);				
 	}
+	else if (strcmp(kw, "zerocopy") == 0) {
+		if (narg != 1)
+			ERR_RET(-1, "line %d: too many arguments for <zerocopy>\n",
+				pctx->lineno);
+
+		if (strcmp(args[0], "yes") == 0)
+			pycfg->zerocopy = 1;
+		else if (strcmp(args[0], "no") == 0)
+			pycfg->zerocopy = 0;
+		else 
+			ERR_RET(-1, "line %d: argument must be yes|no\n", 
+				pctx->lineno);				
+	}
+	else if (strcmp(kw, "zerocopy_min") == 0) {
+		if (narg != 1) 
+			ERR_RET(-1, "line %d: too many arguments for <zerocopy_min>\n", 
+				pctx->lineno);
+		
+		val = _cfg_atoi(args[0]);
+		if (val < 1 || val > 1048576) 
+			ERR_RET(-1, "line %d: argument exceed range(1-1048576)\n", 
+				pctx->lineno);
+		pycfg->zerocopy_min = val;
+	}
+	else if (strcmp(kw, "compress") == 0) {
+		if (narg != 1)
+			ERR_RET(-1, "line %d: too many arguments for <compress>\n",
+				pctx->lineno);
+
+		if (strcmp(args[0], "yes") == 0)
+			pycfg->compress = 1;
+		else if (strcmp(args[0], "no") == 0)
+			pycfg->compress = 0;
+		else 
+			ERR_RET(-1, "line %d: argument must be yes|no\n", 
+				pctx->lineno);				
+	}
+	else if (strcmp(kw, "compress_level") == 0) {
+		if (narg != 1) 
+			ERR_RET(-1, "line %d: too many arguments for <compress_level>\n", 
+				pctx->lineno);
+		
+		val = _cfg_atoi(args[0]);
+		if (val < 1 || val > 9) 
+			ERR_RET(-1, "line %d: argument exceed range(1-9)\n", 
+				pctx->lineno);
+		pycfg->compress_level = val;
+	}
+	else if (strcmp(kw, "compress_min") == 0) {
+		if (narg != 1) 
+			ERR_RET(-1, "line %d: too many arguments for <compress_min>\n", 
+				pctx->lineno);
+		
+		val = _cfg_atoi(args[0]);
+		if (val < 0 || val > 1048576) 
+			ERR_RET(-1, "line %d: argument exceed range(0-1048576)\n", 
+				pctx->lineno);
+		pycfg->compress_min = val;
+	}
+	else if (strcmp(kw, "compress_cpu") == 0) {
+		if (narg != 1) 
+			ERR_RET(-1, "line %d: too many arguments for <compress_cpu>\n", 
+				pctx->lineno);
+		
+		val = _cfg_atoi(args[0]);
+		if (val < 1 || val > 100) 
+			ERR_RET(-1, "line %d: argument exceed range(1-100)\n", 
+				pctx->lineno);
+		pycfg->compress_cpu = val;
+	}
+	else if (strcmp(kw, "compress_stream") == 0) {
+		if (narg != 1) 
+			ERR_RET(-1, "line %d: too many arguments for <compress_stream>\n", 
+				pctx->lineno);
+		
+		val = _cfg_atoi(args[0]);
+		if (val < 1 || val > HZIP_MAX_STREAM) 
+			ERR_RET(-1, "line %d: argument exceed range(1-%d)\n", 
+				pctx->lineno, HZIP_MAX_STREAM);
+		pycfg->compress_stream = val;
+	}
+	else if (strcmp(kw, "cache") == 0) {
+		if (narg != 1)
+			ERR_RET(-1, "line %d: too many arguments for <cache>\n",
+				pctx->lineno);
+
+		if (strcmp(args[0], "yes") == 0)
+			pycfg->cache = 1;
+		else if (strcmp(args[0], "no") == 0)
+			pycfg->cache = 0;
+		else 
+			ERR_RET(-1, "line %d: argument must be yes|no\n", 
+				pctx->lineno);				
+	}
+	else if (strcmp(kw, "cache_mem") == 0) {
+		if (narg != 1) 
+			ERR_RET(-1, "line %d: too many arguments for <cache_mem>\n", 
+				pctx->lineno);
+		
+		val = _cfg_atoi(args[0]);
+		if (val < 1 || val > 65536) 
+			ERR_RET(-1, "line %d: argument exceed range(1-65536)\n", 
+				pctx->lineno);
+		pycfg->cache_mem = val;
+	}
+	else if (strcmp(kw, "cache_obj") == 0) {
+		if (narg != 1) 
+			ERR_RET(-1, "line %d: too many arguments for <cache_obj>\n", 
+				pctx->lineno);
+		
+		val = _cfg_atoi(args[0]);
+		if (val < 1 || val > 65536) 
+			ERR_RET(-1, "line %d: argument exceed range(1-65536)\n", 
+				pctx->lineno);
+		pycfg->cache_obj = val;
+	}
+	else if (strcmp(kw, "mux") == 0) {
+		if (narg != 1)
+			ERR_RET(-1, "line %d: too many arguments for <mux>\n",
+				pctx->lineno);
+
+		if (strcmp(args[0], "yes") == 0)
+			pycfg->mux = 1;
+		else if (strcmp(args[0], "no") == 0)
+			pycfg->mux = 0;
+		else 
+			ERR_RET(-1, "line %d: argument must be yes|no\n", 
+				pctx->lineno);				
+	}
+	else if (strcmp(kw, "mux_conn") == 0) {
+		if (narg != 1) 
+			ERR_RET(-1, "line %d: too many arguments for <mux_conn>\n", 
+				pctx->lineno);
+		
+		val = _cfg_atoi(args[0]);
+		if (val < 1 || val > HMUX_MAX_CONN) 
+			ERR_RET(-1, "line %d: argument exceed range(1-%d)\n", 
+				pctx->lineno, HMUX_MAX_CONN);
+		pycfg->mux_conn = val;
+	}
 	else if (strcmp(kw, "maxconn") == 0) {
 		if (narg != 1) 
 			ERR_RET(-1, "line %d: too many arguments for <maxconn>\n", 
@@ -15,6 +15,9 @@
 #include "proxy.h"
 #include "trapt_util.h"
 #include "proxy_debug.h"
+#include "http_zip.h"
+#include "http_cache.h"
+#include "http_mux.h"
 
 #define	SFLOW(level, fmt, args...)		\
 	FLOW(level, "%s(%04x) %d "fmt,		\
@@ -30,6 +33,10 @@ session_init(session_t *s)
 	s->thread = NULL;
 	s->policy = NULL;
 	s->svrdata = NULL;
+	s->hz = NULL;
+	s->hc = NULL;
+	s->hm = NULL;
+	s->hb = NULL;
 
 	conn_init(&s->conns[0], s, 0, "client");
 	conn_init(&s->conns[1], s, 1, "server");
@@ -48,10 +55,386 @@ session_init(session_t *s)
 	return 0;
 }
 
+/**
+ *	Delete connection @c of other session, it's deleted in
+ *	its task.
+ *
+ *	No return.
+ */
+static void 
+_session_mux_kill(connection_t *c)
+{
+	worker_t *wi;
+	session_t *s;
+
+	s = c->s;
+	wi = s->worker;
+
+	c->flags |= CONN_F_ERROR;
+	c->task.task = TASK_DELETE;
+	if (!task_in_queue(&c->task))
+		task_add_queue(wi->taskq, &c->task);
+}
+
+/**
+ *	Open a backend connection to server @svrdata for client
+ *	session @s, the @svrdata is owned by backend session.
+ *
+ *	Return the backend if success, NULL on error.
+ */
+static hmux_bk_t * 
+_session_mux_connect(session_t *s, server_data_t *svrdata, hmux_srv_t *srv)
+{
+	worker_t *wi;
+	session_t *bs;
+
+	wi = s->worker;
+
+	bs = objpool_get(wi->ssnpool);
+	if (unlikely(!bs)) {
+		server_free_data(svrdata);
+		ERR_RET(NULL, "alloc session failed\n");
+	}
+
+	session_init(bs);
+	bs->sid = wi->next_sid;
+	wi->next_sid++;
+	bs->worker = wi;
+	bs->thread = s->thread;
+	bs->policy = policy_clone(s->policy);
+	bs->svrdata = svrdata;
+
+	bs->hb = hmux_bk_alloc(wi->hm, srv, bs);
+	if (unlikely(!bs->hb)) {
+		session_free(bs, &bs->conns[1]);
+		return NULL;
+	}
+
+	if (session_forward(bs, &bs->conns[1])) {
+		session_free(bs, &bs->conns[1]);
+		return NULL;
+	}
+
+	return bs->hb;
+}
+
+/**
+ *	Send request @req on backend @bk, the connecting backend
+ *	send it after handshake.
+ *
+ *	No return.
+ */
+static void 
+_session_mux_attach(hmux_bk_t *bk, hmux_req_t *req)
+{
+	int n;
+	worker_t *wi;
+	session_t *s;
+	session_t *bs;
+	connection_t *c;
+
+	s = req->s;
+	bs = bk->s;
+	wi = bs->worker;
+	c = &bs->conns[1];
+
+	n = hmux_attach(wi->hm, bk, req, &c->out);
+	s->nalloced -= n;
+	bs->nalloced += n;
+
+	if (conn_send_data(c->fd, 0, c))
+		_session_mux_kill(c);
+}
+
+/**
+ *	Dispatch request @req of client session @s to a backend of
+ *	server choosed by svrpool, it wait in server if all backends
+ *	are busy.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_session_mux_dispatch(session_t *s, hmux_req_t *req)
+{
+	thread_t *ti;
+	worker_t *wi;
+	policy_t *pl;
+	hmux_bk_t *bk;
+	hmux_srv_t *srv;
+	server_data_t *svrdata;
+	svrpool_data_t *spdata;
+
+	ti = s->thread;
+	wi = s->worker;
+	pl = s->policy;
+
+	/* choose a server for each request */
+	spdata = policy_clone_spdata(pl);
+	if (!spdata)
+		ERR_RET(-1, "get svrpool data failed\n");
+
+	svrdata = svrpool_get_rp_server(spdata);
+	svrpool_free_data(spdata);
+	if (!svrdata)
+		ERR_RET(-1, "svrpool get server failed\n");
+
+	srv = hmux_get_srv(wi->hm, svrdata->server);
+	if (!srv) {
+		server_free_data(svrdata);
+		return -1;
+	}
+
+	bk = hmux_get_idle(srv);
+	if (bk)
+		server_free_data(svrdata);
+	else if (srv->nconn >= wi->hm->maxconn) {
+		server_free_data(svrdata);
+		hmux_wait(wi->hm, srv, req);
+		FLOW(2, "request wait backend\n");
+		return 0;
+	}
+	else {
+		bk = _session_mux_connect(s, svrdata, srv);
+		if (!bk)
+			return -1;
+	}
+
+	FLOW(2, "request dispatched to backend %u\n", 
+	     ((session_t *)bk->s)->sid);
+	_session_mux_attach(bk, req);
+
+	return 0;
+}
+
+/**
+ *	Frame the requests of client session @s and dispatch them,
+ *	then send the finished responses in request order.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_session_mux_client(session_t *s)
+{
+	thread_t *ti;
+	worker_t *wi;
+	hmux_ssn_t *hs;
+	hmux_req_t *req;
+	connection_t *c;
+	connection_t *peer;
+
+	ti = s->thread;
+	wi = s->worker;
+	hs = s->hm;
+	c = &s->conns[0];
+	peer = &s->conns[1];
+
+	if (c->flags & CONN_F_ERROR)
+		return -1;
+
+	if (hmux_request(wi->hm, hs, &c->in, wi->pktpool, 
+			 &s->nalloced) < 0) 
+	{
+		SFLOW(1, "request can't be multiplexed\n");
+		return -1;
+	}
+
+	while (hs->next != hs->tail) {
+		req = hs->reqs[hs->next % HMUX_MAX_REQ];
+		hs->next++;
+		if (_session_mux_dispatch(s, req))
+			return -1;
+	}
+
+	hmux_flush(wi->hm, hs, &c->out, &s->nalloced);
+
+	/* all responses are sent, close client */
+	if (hmux_ssn_idle(hs) && 
+	    ((hs->close && !hs->cur) || (c->flags & CONN_F_SHUTRD)))
+		peer->flags |= CONN_F_CLOSED;
+
+	return conn_send_data(c->fd, 0, c);
+}
+
+/**
+ *	The response on backend @bk is finished, send the next
+ *	waiting request on it or make it idle.
+ *
+ *	Return 0 if success, -1 if backend need close.
+ */
+static int 
+_session_mux_done(worker_t *wi, hmux_bk_t *bk)
+{
+	hmux_req_t *req;
+
+	hmux_detach(wi->hm, bk);
+	if (!bk->reuse)
+		return -1;
+
+	req = hmux_get_wait(bk->srv);
+	if (req)
+		_session_mux_attach(bk, req);
+	else
+		hmux_put_idle(bk);
+
+	return 0;
+}
+
+/**
+ *	Move the response packets @resp of backend session @bs to
+ *	client, @done means the response is finished.
+ *
+ *	Return 0 if success, -1 if backend need close.
+ */
+static int 
+_session_mux_deliver(session_t *bs, cblist_t *resp, int done)
+{
+	int n;
+	int ret = 0;
+	worker_t *wi;
+	session_t *s;
+	hmux_bk_t *bk;
+	packet_t *pkt, *bak;
+
+	wi = bs->worker;
+	bk = bs->hb;
+	s = bk->req->s;
+
+	/* client closed, drop the response */
+	if (!s) {
+		CBLIST_FOR_EACH_SAFE(resp, pkt, bak, list) {
+			CBLIST_DEL(&pkt->list);
+			PKT_FREE(pkt);
+			bs->nalloced--;
+		}
+	}
+	else {
+		n = hmux_move(&bk->req->resp, resp);
+		bs->nalloced -= n;
+		s->nalloced += n;
+	}
+
+	if (done)
+		ret = _session_mux_done(wi, bk);
+
+	/* send responses in order, the waiting requests is framed */
+	if (s) {
+		if (_session_mux_client(s) || 
+		    (CONN_IS_CLOSED(&s->conns[0]) && 
+		     CONN_IS_CLOSED(&s->conns[1])))
+			_session_mux_kill(&s->conns[0]);
+	}
+
+	return ret;
+}
+
+/**
+ *	Frame the responses on backend session @s and send them
+ *	to clients.
+ *
+ *	Return 0 if success, -1 if backend need close.
+ */
+static int 
+_session_mux_server(session_t *s, connection_t *c)
+{
+	int ret;
+	thread_t *ti;
+	worker_t *wi;
+	hmux_bk_t *bk;
+	cblist_t resp;
+
+	ti = s->thread;
+	wi = s->worker;
+	bk = s->hb;
+
+	if (c->flags & CONN_F_ERROR)
+		return -1;
+
+	while (!CBLIST_IS_EMPTY(&c->in)) {
+		if (!bk->req) {
+			SFLOW(1, "unexpected data on idle backend\n");
+			return -1;
+		}
+
+		CBLIST_INIT(&resp);
+		ret = hmux_response(wi->hm, bk, &c->in, &resp, wi->pktpool, 
+				    &s->nalloced);
+		if (_session_mux_deliver(s, &resp, ret > 0)) {
+			SFLOW(1, "backend not keep alive\n");
+			return -1;
+		}
+		if (ret < 0) {
+			SFLOW(1, "invalid response from backend\n");
+			return -1;
+		}
+		if (ret == 0)
+			break;
+	}
+
+	/* close-delimited response is finished */
+	if (c->flags & CONN_F_SHUTRD) {
+		if (bk->req && hmux_response_eof(wi->hm, bk)) {
+			CBLIST_INIT(&resp);
+			_session_mux_deliver(s, &resp, 1);
+		}
+		SFLOW(1, "backend closed\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ *	Release the multiplexing state of client or backend
+ *	session @s.
+ *
+ *	No return.
+ */
+static void 
+_session_mux_free(session_t *s)
+{
+	worker_t *wi;
+	hmux_bk_t *bk;
+	hmux_srv_t *srv;
+	hmux_req_t *req;
+	server_data_t *svrdata;
+
+	wi = s->worker;
+
+	/* the requests in backend are orphaned */
+	if (s->hm) {
+		hmux_ssn_free(wi->hm, s->hm, &s->nalloced);
+		objpool_put(s->hm);
+		s->hm = NULL;
+		return;
+	}
+
+	bk = s->hb;
+	srv = bk->srv;
+	s->hb = NULL;
+
+	/* the response is broken, close the client */
+	if (bk->req && bk->req->s)
+		_session_mux_kill(&((session_t *)bk->req->s)->conns[0]);
+	hmux_bk_free(wi->hm, bk);
+
+	/* open new backend for the waiting request */
+	while (srv->nconn < wi->hm->maxconn && 
+	       (req = hmux_get_wait(srv))) 
+	{
+		svrdata = server_clone_data(s->svrdata);
+		bk = svrdata ? _session_mux_connect(req->s, svrdata, srv) : NULL;
+		if (bk)
+			_session_mux_attach(bk, req);
+		else
+			_session_mux_kill(&((session_t *)req->s)->conns[0]);
+	}
+}
+
 int 
 session_free(session_t *s, connection_t *c)
 {
 	thread_t *ti;
+	worker_t *wi;
 	policy_t *pl;
 	connection_t *peer;
 
@@ -63,6 +446,7 @@ session_free(session_t *s, connection_t *c)
 	assert(s->policy);
 
 	ti = s->thread;
+	wi = s->worker;
 	pl = s->policy;
 	peer = &s->conns[(c->dir + 1) % 2];
 
@@ -78,7 +462,17 @@ session_free(session_t *s, connection_t *c)
 	}
 	else
 		conn_free(peer);
+
+	/* delete multiplexing state */
+	if (s->hm || s->hb)
+		_session_mux_free(s);
 	
+	/* delete compress state, it may hold response header */
+	if (s->hz) {
+		hzip_free(wi->hz, s->hz, &s->nalloced);
+		s->hz = NULL;
+	}
+
 	assert(s->nalloced == 0);
 
 	/* delete policy */
@@ -92,6 +486,13 @@ session_free(session_t *s, connection_t *c)
 	if (s->svrdata)
 		server_free_data(s->svrdata);
 
+	/* delete cache state */
+	if (s->hc) {
+		hcache_ssn_free(s->hc);
+		objpool_put(s->hc);
+		s->hc = NULL;
+	}
+
 	/* delete session from session pool */
 	FLOW(1, "deleted\n");
 
@@ -131,12 +532,46 @@ session_run_task(task_t *t)
 
 	case TASK_PARSE:
 
+		/* the requests are multiplexed on backend connections */
+		if (s->hm || s->hb) {
+			if (s->hm ? _session_mux_client(s) : 
+			    _session_mux_server(s, c)) 
+			{
+				session_free(s, c);
+				return -1;
+			}
+			break;
+		}
+
 		/* parse data */
 		if (session_fparse(s, c)) {
 			session_free(s, c);
 			return -1;
 		}
 
+		/* all requests are served by cache, not connect server */
+		if (s->hc && c->dir == 0 && peer->fd < 0 && 
+		    CBLIST_IS_EMPTY(&s->request)) 
+		{
+			/* client closed, no server side need close */
+			if (c->flags & CONN_F_SHUTRD)
+				peer->flags |= CONN_F_CLOSED;
+
+			if (conn_send_data(c->fd, 0, c)) {
+				session_free(s, c);
+				return -1;
+			}
+			break;
+		}
+
+		/* send the cache hit response to client */
+		if (c->dir == 0 && !CBLIST_IS_EMPTY(&c->out)) {
+			if (conn_send_data(c->fd, 0, c)) {
+				session_free(s, c);
+				return -1;
+			}
+		}
+
 		/* forward data */
 		if (session_forward(s, peer)) {
 			session_free(s, c);
@@ -177,18 +612,52 @@ session_run_task(task_t *t)
 int 
 session_fparse(session_t *s, connection_t *c)
 {
+	int ret;
 	thread_t *ti;	
+	worker_t *wi;
+	cblist_t fwd;
 
 	if (!s || !c)
 		ERR_RET(-1, "invalid argument\n");
 
 	assert(s->thread);
 	ti = s->thread;
+	wi = s->worker;
 
-	if (c->dir)
+	if (c->dir) {
 		CBLIST_JOIN(&s->response, &c->in);
-	else
-		CBLIST_JOIN(&s->request, &c->in);
+		if (s->hz && hzip_response(wi->hz, s->hz, &s->response, 
+					   &s->nalloced))
+		{
+			SFLOW(1, "compress response failed\n");
+			return -1;
+		}
+		if (s->hc)
+			hcache_response(wi->hc, s->hc, &s->response);
+	}
+	else {
+		CBLIST_INIT(&fwd);
+
+		/* the hit response is added into @c->out, the 
+		 * incomplete request header is kept in @c->in */
+		if (s->hc) {
+			ret = hcache_request(wi->hc, s->hc, &c->in, &fwd, 
+					     &c->out, wi->pktpool, 
+					     &s->nalloced);
+			if (ret < 0) {
+				SFLOW(1, "cache request failed\n");
+				return -1;
+			}
+			if (ret > 0)
+				SFLOW(1, "%d requests hit cache\n", ret);
+		}
+		else
+			CBLIST_JOIN(&fwd, &c->in);
+
+		if (s->hz)
+			hzip_request(s->hz, &fwd);
+		CBLIST_JOIN(&s->request, &fwd);
+	}
 
 	SFLOW(1, "run fast parse\n");
 
@@ -229,6 +698,12 @@ session_get_server(session_t *s, connection_t *c)
 	ti = s->thread;
 	pl = s->policy;
 
+	/* the server is choosed for multiplexed backend */
+	if (s->svrdata) {
+		svrdata = s->svrdata;
+		goto found;
+	}
+
 	/* choose a server */
 	spdata = policy_clone_spdata(pl);
 	if (!spdata)
@@ -253,6 +728,8 @@ session_get_server(session_t *s, connection_t *c)
 
 	assert(svrdata->server);
 	s->svrdata = svrdata;
+
+found:
 	svrcfg = &svrdata->server->cfg;
 	SFLOW(1, "get server %s\n",  
 	     ip_port_to_str(&svrcfg->address, ipstr, IP_STR_LEN));
@@ -43,6 +43,10 @@ typedef struct session {
 	void		*thread;	/* thread */
 	void		*policy;	/* policy */
 	void		*svrdata;	/* server data */
+	void		*hz;		/* hzip_t for response compress */
+	void		*hc;		/* hcache_ssn_t for response cache */
+	void		*hm;		/* hmux_ssn_t of multiplexed client */
+	void		*hb;		/* hmux_bk_t of multiplexed backend */
 
 	session_func	fparse_func;	/* fast parse function */
 	session_func	getsvr_func;	/* server loadbalance function */
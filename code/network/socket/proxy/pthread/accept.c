@@ -24,6 +24,8 @@
 
 #define	NDEBUG		1
 
+#define	ACCEPT_BATCH	64	/* max client accepted in one poll */
+
 /**
  *	Alloc and initate accept thread global resource
  *
@@ -46,7 +48,7 @@ _accept_init(thread_t*info)
 	}
 	memset(ai, 0, sizeof(accept_t));
 
-	ai->httpfd = sk_tcp_server(&g_proxy.httpaddr);
+	ai->httpfd = sk_tcp_server(&g_proxy.httpaddr, 0, 0);
 	if (ai->httpfd < 0) {
 		ERR("can't creat HTTP listen socket\n");
 		return -1;
@@ -55,7 +57,7 @@ _accept_init(thread_t*info)
 	DBG("accept(%d) create HTTP socket %d\n", info->index, ai->httpfd);
 
 #if 0
-	ai->httpsfd = sk_tcp_server(&g_proxy.httpsaddr);
+	ai->httpsfd = sk_tcp_server(&g_proxy.httpsaddr, 0, 0);
 	if (ai->httpsfd < 0) {
 		ERR("can't create HTTPS listen socket\n");
 		return -1;
@@ -102,7 +104,7 @@ _accept_release(thread_t *info)
 /**
  *	Accept a client connect, and assign it to a work thread.
  *
- *	Return 0 if success, -1 on error.
+ *	Return 0 if success, 1 if no more client, -1 on error.
  */
 static int 
 _accept_client(thread_t *info, int fd, int ssl, ip_port_t *dip)
@@ -119,8 +121,10 @@ _accept_client(thread_t *info, int fd, int ssl, ip_port_t *dip)
 
 	ai = info->priv;
 
-	clifd = sk_accept(fd, &ip); 
+	clifd = sk_tcp_accept_nb(fd, &ip, NULL);
 	if (clifd < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 1;
 		ERR("accept client error: %s\n", ERRSTR);
 		return -1;
 	}
@@ -143,6 +147,7 @@ _accept_client(thread_t *info, int fd, int ssl, ip_port_t *dip)
 	/* assigned client to recv thread */
 	wfd.fd = clifd;
 	wfd.is_ssl = ssl ? 1 : 0;
+	wfd.ts = stage_now();
 	if (work_add_session(ai->index, &wfd)) {
 		ERR("accept[%d] client %d add to work %d failed\n", 
 		    info->index, clifd, ai->index);
@@ -172,6 +177,24 @@ _accept_client(thread_t *info, int fd, int ssl, ip_port_t *dip)
 
 
 
+/**
+ *	Accept at most ACCEPT_BATCH clients from listen socket 
+ *	@fd, the work threads are waked after all listen sockets 
+ *	are processed.
+ *
+ *	No return.
+ */
+static void 
+_accept_batch(thread_t *info, int fd, int ssl, ip_port_t *dip)
+{
+	int i;
+
+	for (i = 0; i < ACCEPT_BATCH; i++) {
+		if (_accept_client(info, fd, ssl, dip) > 0)
+			break;
+	}
+}
+
 /**
  *	Accept connection from client, and assign the client 
  *	fd to work thread.
@@ -218,19 +241,26 @@ _accept_loop(thread_t*info)
 			continue;
 		}
 
-		for (i = 0; i < n; i++) {
+		for (i = 0; i < npfd; i++) {
+			if (!(pfds[i].revents & POLLIN))
+				continue;
+
 			if (pfds[i].fd == ai->httpfd) {
-				_accept_client(info, ai->httpfd, 0, 
-					       &g_proxy.httpaddr);
+				_accept_batch(info, ai->httpfd, 0, 
+					      &g_proxy.httpaddr);
 			}
 			else if (pfds[i].fd == ai->httpsfd) {
-				_accept_client(info, ai->httpsfd, 1, 
-					       &g_proxy.httpsaddr);
+				_accept_batch(info, ai->httpsfd, 1, 
+					      &g_proxy.httpsaddr);
 			}
 			else {
 				ERR("unknowed fd %d in poll\n", pfds[i].fd);
 			}
 		}
+
+		/* wakeup work threads which have new sessions */
+		for (i = 0; i < g_proxy.nwork; i++)
+			work_notify(i);
 	}
 	
 	return 0;
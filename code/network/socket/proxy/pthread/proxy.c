@@ -183,6 +183,10 @@ _proxy_stat(proxy_t *ctx)
 	printf("nsvrcloses: %lu\n", ctx->stat.nsvrclose);
 	printf("nclierrors: %lu\n", ctx->stat.nclierror);
 	printf("nsvrerrors: %lu\n", ctx->stat.nsvrerror);
+	printf("-------stage latency-----------\n");
+	stage_lat_print("accept", &ctx->stat.lat[STAGE_ACCEPT]);
+	stage_lat_print("recv", &ctx->stat.lat[STAGE_RECV]);
+	stage_lat_print("send", &ctx->stat.lat[STAGE_SEND]);
 	printf("-------------------------------\n");
 }
 
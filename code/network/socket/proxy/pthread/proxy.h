@@ -42,6 +42,9 @@ typedef struct proxy_stat {
 	u_int64_t	nclierror;	/* client error times */
 	u_int64_t	nsvrclose;	/* server close times */
 	u_int64_t	nsvrerror;	/* server error times */
+
+	/* the stage latency of all work threads */
+	stage_lat_t	lat[STAGE_MAX];	/* merged when work thread exit */
 } proxy_stat_t;
 
 
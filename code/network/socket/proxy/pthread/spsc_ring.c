@@ -0,0 +1,15 @@
+/**
+ *	@file	
+ *
+ *	@brief
+ *	
+ *	@author	Forrest.zhang	
+ *
+ *	@date
+ */
+
+#include "../../../../basic/datastruct/spsc_ring.c"
+
+
+
+
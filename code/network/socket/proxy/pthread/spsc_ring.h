@@ -0,0 +1,13 @@
+/**
+ *	@file	spsc_ring.h
+ *
+ *	@brief
+ *	
+ *	@author	Forrest.zhang
+ *
+ *	@date
+ */
+
+#include "../../../../basic/datastruct/spsc_ring.h"
+
+
@@ -4,6 +4,7 @@
  *	author:		forrest.zhang
  */
 
+#include <stdio.h>
 #include <string.h>
 #include <errno.h>
 
@@ -56,3 +57,75 @@ thread_join(thread_t *info)
 
 	return 0;
 }
+
+
+/**
+ *	Return the upper bound(ns) of latency slot @slot.
+ */
+static u_int64_t 
+_stage_slot_ns(int slot)
+{
+	int bit;
+
+	if (slot < 4)
+		return slot;
+
+	bit = slot / 4;
+	return (1ULL << bit) + ((u_int64_t)(slot % 4 + 1) << (bit - 2)) - 1;
+}
+
+/**
+ *	Return the latency(ns) of percent @pct in @lat.
+ */
+static u_int64_t 
+_stage_percent(const stage_lat_t *lat, int pct)
+{
+	u_int64_t want;
+	u_int64_t n;
+	int i;
+
+	want = (lat->n * pct + 99) / 100;
+	n = 0;
+	for (i = 0; i < STAGE_NSLOT; i++) {
+		n += lat->slot[i];
+		if (n >= want)
+			return _stage_slot_ns(i);
+	}
+
+	return lat->max;
+}
+
+void 
+stage_lat_merge(stage_lat_t *dst, const stage_lat_t *src)
+{
+	int i;
+
+	if (!dst || !src)
+		return;
+
+	dst->n += src->n;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	for (i = 0; i < STAGE_NSLOT; i++)
+		dst->slot[i] += src->slot[i];
+}
+
+void 
+stage_lat_print(const char *name, const stage_lat_t *lat)
+{
+	if (!name || !lat)
+		return;
+
+	if (lat->n == 0) {
+		printf("%-8s    0\n", name);
+		return;
+	}
+
+	printf("%-8s %8lu avg %.1fus p50 %.1fus p99 %.1fus max %.1fus\n",
+	       name, lat->n, 
+	       (double)lat->sum / lat->n / 1000.0,
+	       _stage_percent(lat, 50) / 1000.0,
+	       _stage_percent(lat, 99) / 1000.0,
+	       lat->max / 1000.0);
+}
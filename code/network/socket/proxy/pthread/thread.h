@@ -13,14 +13,24 @@
 
 #include <sys/types.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "ip_addr.h"
 #include "packet.h"
 #include "session.h"
 #include "objpool.h"
+#include "spsc_ring.h"
 
 #define	ACCEPT_TIMEOUT	100
 #define	WORK_TIMEOUT	100
+#define	WORK_BATCH	64	/* max sessions get from input ring once */
+
+/* the session stages timed by work thread */
+#define	STAGE_ACCEPT	0	/* accepted -> work thread got it */
+#define	STAGE_RECV	1	/* work thread got it -> client data recved */
+#define	STAGE_SEND	2	/* client data recved -> sent to server */
+#define	STAGE_MAX	3	/* the max stage value, session finished */
+#define	STAGE_NSLOT	256	/* latency slots, 4 slots each power of 2 */
 
 /* thread type */
 #define THREAD_ACCEPT	1	/* accept thread */
@@ -52,17 +62,25 @@ typedef struct _accept {
 typedef struct _workfd {
 	int		fd;		/* client fd */
 	u_int32_t	is_ssl:1;	/* is ssl */
+	u_int64_t	ts;		/* accept time(ns) */
 } workfd_t;
 
+/**
+ *	The latency of a session stage.
+ */
+typedef struct _stage_lat {
+	u_int64_t	n;		/* number of sessions */
+	u_int64_t	sum;		/* total latency(ns) */
+	u_int64_t	max;		/* max latency(ns) */
+	u_int64_t	slot[STAGE_NSLOT];/* latency histogram */
+} stage_lat_t;
+
 /**
  *	The private data of work_epoll thread.
  */
 typedef struct _work {
-	workfd_t	*inq;		/* input queue for accept */
-	workfd_t	*inq2;		/* secondary input queue */
-	pthread_mutex_t	lock;		/* lock for input queue */
-	int		ninq;		/* number of objs in input queue */
-	int		max;		/* max obj in input queue */
+	spsc_ring_t	*inq;		/* input ring for accept(workfd_t) */
+	int		max;		/* max obj in input ring */
 
 //	objpool_t	*pktpool;	/* packet_t pool */
 //	objpool_t	*ssnpool;	/* session_t pool */
@@ -72,6 +90,10 @@ typedef struct _work {
 	struct epoll_event *events;	/* events for epoll */
 	int		nevent;		/* number of event */
 	int		nblocked;	/* number of blocked */
+
+	u_int64_t	*stamp;		/* stage start time(ns) of session */
+	u_int8_t	*stage;		/* current stage of session */
+	stage_lat_t	lat[STAGE_MAX];	/* latency of each stage */
 } work_t;
 
 /**
@@ -106,6 +128,63 @@ typedef struct _send {
 	struct epoll_event *events;
 } send_t;
 
+/**
+ *	Return the monotonic time in nanoseconds.
+ */
+static inline u_int64_t 
+stage_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *	Add latency @ns into @lat, the slot is the power of 2 of 
+ *	@ns and next 2 bits, so each slot is at most 25% wide.
+ *
+ *	No return.
+ */
+static inline void 
+stage_lat_add(stage_lat_t *lat, u_int64_t ns)
+{
+	int bit;
+	int slot;
+
+	if (ns < 4)
+		slot = ns;
+	else {
+		bit = 63 - __builtin_clzll(ns);
+		slot = bit * 4 + ((ns >> (bit - 2)) & 3);
+	}
+	if (slot >= STAGE_NSLOT)
+		slot = STAGE_NSLOT - 1;
+
+	lat->n++;
+	lat->sum += ns;
+	if (ns > lat->max)
+		lat->max = ns;
+	lat->slot[slot]++;
+}
+
+/**
+ *	Add all latency in @src into @dst.
+ *
+ *	No return.
+ */
+extern void 
+stage_lat_merge(stage_lat_t *dst, const stage_lat_t *src);
+
+/**
+ *	Print latency @lat of stage @name: count, average, p50, 
+ *	p99 and max in microseconds.
+ *
+ *	No return.
+ */
+extern void 
+stage_lat_print(const char *name, const stage_lat_t *lat);
+
 /**
  *	Create a new thread, the new thread function is @func, 
  *	the @func's argument is @info, the @type see above.
@@ -140,14 +219,24 @@ extern void *
 work_run(void *arg);
 
 /**
- *	Add a new session into work thread.
- *
+ *	Add a new session into work thread. The work thread 
+ *	isn't waked until work_notify() is called, so accept 
+ *	thread can hand off a batch of sessions at once.
  *
  *	Return 0 if success, -1 on error.
  */
 extern int 
 work_add_session(int index, workfd_t *wfd);
 
+/**
+ *	Wakeup work thread @index if it's sleep and input 
+ *	ring have sessions.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+work_notify(int index);
+
 /**
  *	The main function of work thread
  */
@@ -42,6 +42,8 @@ static int
 _work_init(thread_t *info)
 {
 	work_t *wi;
+	struct epoll_event e;
+	int *pair;
 	int maxfds = 0;
 
 	assert(info);
@@ -56,27 +58,15 @@ _work_init(thread_t *info)
 
 	maxfds = (g_proxy.max / g_proxy.nwork) + 1;
 
-	/* alloc memory for input queue */
-	wi->inq = malloc(sizeof(session_t *) * maxfds);
+	/* alloc input ring, the eventfd wakeup idle work thread */
+	wi->inq = spsc_ring_alloc(maxfds, sizeof(workfd_t), 1);
 	if (!wi->inq) {
-		ERR("malloc error %s\n", ERRSTR);
-		return -1;
-	}
-	memset(wi->inq, 0, sizeof(session_t *) * maxfds);
-	
-	/* alloc memory for secondary input queue */
-	wi->inq2 = malloc(sizeof(session_t *) * maxfds);
-	if (!wi->inq2) {
-		ERR("malloc error %s\n", ERRSTR);
+		ERR("spsc_ring_alloc failed\n");
 		return -1;
 	}
-	memset(wi->inq2, 0, sizeof(session_t *) * maxfds);
-
-	wi->ninq = 0;
-	wi->max = maxfds;
-	pthread_mutex_init(&wi->lock, NULL);
+	wi->max = wi->inq->size;
 
-	DBG("work(%d) alloc %d input queue\n", info->index, maxfds);
+	DBG("work(%d) alloc %d input ring\n", info->index, wi->max);
 	
 	/* alloc memory for epoll event */
 	wi->events = malloc(maxfds * sizeof(struct epoll_event) * 2);
@@ -115,6 +105,15 @@ _work_init(thread_t *info)
 		return -1;
 	}
 
+	/* alloc stage time of each session, indexed by session id */
+	wi->stamp = calloc(g_proxy.max, sizeof(u_int64_t));
+	wi->stage = malloc(g_proxy.max);
+	if (!wi->stamp || !wi->stage) {
+		ERR("malloc error %s\n", ERRSTR);
+		return -1;
+	}
+	memset(wi->stage, STAGE_MAX, g_proxy.max);
+
 	DBG("work(%d) alloc %d epoll event\n", info->index, maxfds * 2);
 	
 	/* create send epoll fd */
@@ -135,6 +134,18 @@ _work_init(thread_t *info)
 	
 	DBG("work(%d) create recv epoll fd %d\n", info->index, wi->recv_epfd);
 
+	/* add input ring eventfd into recv epoll, session id is -1 */
+	memset(&e, 0, sizeof(e));
+	pair = (int *)&e.data.u64;
+	pair[0] = wi->inq->evfd;
+	pair[1] = -1;
+	e.events = EPOLLIN;
+	if (epoll_ctl(wi->recv_epfd, EPOLL_CTL_ADD, wi->inq->evfd, &e)) {
+		ERR("epoll add eventfd %d error %s\n", 
+		    wi->inq->evfd, ERRSTR);
+		return -1;
+	}
+
 	info->priv = wi;
 
 	return 0;
@@ -149,6 +160,7 @@ static void
 _work_free(thread_t *info)
 {
 	work_t *wi;
+	int i;
 
 	assert(info);
 
@@ -157,15 +169,9 @@ _work_free(thread_t *info)
 		return;
 
 	if (wi->inq) {
-		free(wi->inq);
+		spsc_ring_free(wi->inq);
 		wi->inq = NULL;
-		DBG("work(%d) freed input queue\n", info->index);
-	}
-
-	if (wi->inq2) {
-		free(wi->inq2);
-		wi->inq2 = NULL;
-		DBG("work(%d) freed second input queue\n", info->index);
+		DBG("work(%d) freed input ring\n", info->index);
 	}
 
 	if (wi->events) {
@@ -196,6 +202,17 @@ _work_free(thread_t *info)
 		DBG("work(%d) free session table\n", info->index);
 	}
 
+	/* merge stage latency into proxy statistic */
+	proxy_stat_lock();
+	for (i = 0; i < STAGE_MAX; i++)
+		stage_lat_merge(&g_proxy.stat.lat[i], &wi->lat[i]);
+	proxy_stat_unlock();
+
+	if (wi->stamp)
+		free(wi->stamp);
+	if (wi->stage)
+		free(wi->stage);
+
 	if (wi->send_epfd >= 0) {
 		close(wi->send_epfd);
 		DBG("work(%d) close send epoll %d\n", 
@@ -212,6 +229,26 @@ _work_free(thread_t *info)
 	free(wi);
 }
 
+/**
+ *	Finish stage @stage of session @s and start the next stage, 
+ *	it's ignored if @s is not in @stage.
+ *
+ *	No return.
+ */
+static inline void 
+_work_stage(work_t *wi, session_t *s, int stage)
+{
+	u_int64_t now;
+
+	if (wi->stage[s->id] != stage)
+		return;
+
+	now = stage_now();
+	stage_lat_add(&wi->lat[stage], now - wi->stamp[s->id]);
+	wi->stamp[s->id] = now;
+	wi->stage[s->id] = stage + 1;
+}
+
 /**
  *	Get a packet from pktpool if need, and put it to @q->pkt.
  *
@@ -283,7 +320,7 @@ _work_get_server(thread_t *info, session_t *s)
 		return 0;
 
 	proxy_stat_lock();
-	fd = sk_tcp_client_nb(&g_proxy.rsaddrs[i], &wait);
+	fd = sk_tcp_client_nb(&g_proxy.rsaddrs[i], NULL, 0, &wait);
 	if (fd < 0) {
 		proxy_stat_unlock();
 		s->is_svrerror = 1;
@@ -509,6 +546,7 @@ _work_get_session(thread_t *info)
 	work_t *wi;
 	struct epoll_event e;
 	session_t *s;
+	workfd_t wfds[WORK_BATCH];
 	workfd_t *wfd;
 	int ninq;
 	int *pair;
@@ -520,22 +558,14 @@ _work_get_session(thread_t *info)
 
 	wi = info->priv;
 
-	/* get session from input queue */
-	pthread_mutex_lock(&wi->lock);
-	ninq = wi->ninq;
-	if (ninq > 0) {
-		memcpy(wi->inq2, wi->inq, ninq * sizeof(workfd_t));
-		memset(wi->inq, 0, ninq * sizeof(workfd_t));
-		wi->ninq = 0;
-	}
-	pthread_mutex_unlock(&wi->lock);
-
+	/* get a batch of session from input ring */
+	ninq = spsc_ring_dequeue(wi->inq, wfds, WORK_BATCH);
 	if (ninq < 1)
 		return 0;
 
 	for (i = 0; i < ninq; i++) {
 	
-		wfd = &wi->inq2[i];
+		wfd = &wfds[i];
 		assert(wfd->fd > 0);
 		
 		s = _work_alloc_session(info);
@@ -558,6 +588,11 @@ _work_get_session(thread_t *info)
 		
 		s->clifd = wfd->fd;
 
+		/* the hand-off from accept thread is the first stage */
+		wi->stamp[s->id] = wfd->ts;
+		wi->stage[s->id] = STAGE_ACCEPT;
+		_work_stage(wi, s, STAGE_ACCEPT);
+
 		if (g_proxy.use_splice || g_proxy.use_nb_splice) {
 			if (_work_get_server(info, s)) {
 				_work_free_session(info, s);
@@ -602,7 +637,7 @@ _work_check_server(thread_t *info, session_t *s)
 	fd = s->svrfd;
 
 	ret = sk_is_connected(fd);
-	if (ret <= 0) {
+	if (ret < 0) {
 		FLOW(1, "work[%d]: ssn[%d] server %d connect failed\n", 
 		     info->index, s->id, fd);
 		return -1;
@@ -668,6 +703,9 @@ _work_recvfrom_client(thread_t *info, session_t *s)
 	
 	pkt->len += n;
 
+	if (n > 0)
+		_work_stage(wi, s, STAGE_RECV);
+
 	FLOW(1, "work[%d]: ssn[%d] client %d recv %d bytes\n", 
 	     info->index, s->id, fd, n);
 
@@ -1097,6 +1135,10 @@ _work_sendto_server(thread_t *info, session_t *s)
 		pkt = pktq_out(&s->cliq.outq);
 	}
 
+	/* all client data is sent */
+	if (!s->cliq.blkpkt)
+		_work_stage(wi, s, STAGE_SEND);
+
 	return 0;
 }
 
@@ -1347,6 +1389,7 @@ _work_recv_data(thread_t *info)
 	int fd;
 	int id;
 	int nfds;
+	int timeout;
 	int i;
 
 	assert(info);
@@ -1354,8 +1397,16 @@ _work_recv_data(thread_t *info)
 
 	wi = info->priv;
 
+	/* don't sleep if input ring have sessions */
+	timeout = WORK_TIMEOUT;
+	if (spsc_ring_prepare_wait(wi->inq))
+		timeout = 0;
+
 	nfds = epoll_wait(wi->recv_epfd, wi->events, 
-			  wi->nevent, WORK_TIMEOUT);
+			  wi->nevent, timeout);
+
+	if (timeout)
+		spsc_ring_finish_wait(wi->inq);
 	
 	if (nfds < 0) {
 		if (errno == EINTR)
@@ -1374,6 +1425,11 @@ _work_recv_data(thread_t *info)
 		pair = (int *)&e->data.u64;
 		fd = pair[0];
 		id = pair[1];
+
+		/* input ring wakeup, get session in next loop */
+		if (id < 0)
+			continue;
+
 		s = session_table_find(wi->sesstbl, id);
 		if (!s) {
 			continue;
@@ -1537,7 +1593,6 @@ int
 work_add_session(int index, workfd_t *wfd)
 {
 	work_t *wi;
-	int ninq = 0;
 
 	if (unlikely(index < 0 || index >= g_proxy.nwork))
 		return -1;
@@ -1546,31 +1601,37 @@ work_add_session(int index, workfd_t *wfd)
 		return -1;
 
 	wi = g_proxy.works[index].priv;
-	if (unlikely(!wi))
+	if (unlikely(!wi || !wi->inq))
 		return -1;
 
-	/* locked */
-	pthread_mutex_lock(&wi->lock);
-
-	/* check array parameter */
-	if (!wi->inq || wi->max < 1 || 
-	    wi->ninq < 0 || wi->ninq >= wi->max) 
-	{
-		ERR("the work(%d) inq have problem\n", index);
-		pthread_mutex_unlock(&wi->lock);
+	/* only accept thread put client infomation, no lock */
+	if (spsc_ring_enqueue(wi->inq, wfd, 1) != 1) {
+		ERR("the work(%d) input ring is full\n", index);
 		return -1;
 	}
 
-	/* put client infomation */
-	ninq = wi->ninq;
-	wi->inq[ninq].fd = wfd->fd;
-	wi->inq[ninq].is_ssl = wfd->is_ssl;
-	wi->ninq++;
+	return 0;
+}
+
+/**
+ *	Wakeup work thread @index, it's called by accept 
+ *	thread after a batch of work_add_session().
+ *
+ *	Return 0 if success, -1 on error.
+ */
+int 
+work_notify(int index)
+{
+	work_t *wi;
 
-	/* unlock */
-	pthread_mutex_unlock(&wi->lock);
+	if (unlikely(index < 0 || index >= g_proxy.nwork))
+		return -1;
 
-	return 0;
+	wi = g_proxy.works[index].priv;
+	if (unlikely(!wi || !wi->inq))
+		return -1;
+
+	return spsc_ring_notify(wi->inq);
 }
 
 
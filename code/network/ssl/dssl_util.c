@@ -2,19 +2,53 @@
  *	@file	packet_ssl.c
  *
  *	@brief	SSL packet decode functions.
- *	
- *	@author	Forrest.zhang	
+ *
+ *		The RSA key exchange is decrypted by worker threads of
+ *		context, the records of session after key exchange are
+ *		kept in order until the master secret is known. The
+ *		master secret is cached by session id and session
+ *		ticket in a sharded LRU cache shared by all threads.
+ *
+ *	@author	Forrest.zhang
  *
  *	@date	2014-12-25
  */
 
+#include <sched.h>
 #include <openssl/ssl.h>
+#include <openssl/hmac.h>
+#include <openssl/rsa.h>
+#include <openssl/crypto.h>
 
 #include "gcc_common.h"
 #include "dbg_common.h"
 
+#include "jhash.h"
 #include "dssl_util.h"
 
+#define	_TLS10			0x0301
+#define	_TLS11			0x0302
+#define	_TLS12			0x0303
+
+#define	_REC_HLEN		5	/* record header length */
+#define	_HSK_HLEN		4	/* handshake header length */
+#define	_GCM_NONCE		8	/* GCM explicit nonce length */
+#define	_GCM_TAG		16	/* GCM tag length */
+
+#define	_GET16(p)		(((p)[0] << 8) | (p)[1])
+#define	_GET24(p)		(((p)[0] << 16) | ((p)[1] << 8) | (p)[2])
+
+/* the RSA key exchange cipher suites can be decoded */
+static const dssl_cipher_t	_dssl_ciphers[] = {
+	{0x000a, 24, 8, 20, 8, 0, EVP_des_ede3_cbc},	/* DES-CBC3-SHA */
+	{0x002f, 16, 16, 20, 16, 0, EVP_aes_128_cbc},	/* AES128-SHA */
+	{0x0035, 32, 16, 20, 16, 0, EVP_aes_256_cbc},	/* AES256-SHA */
+	{0x003c, 16, 16, 32, 16, 0, EVP_aes_128_cbc},	/* AES128-SHA256 */
+	{0x003d, 32, 16, 32, 16, 0, EVP_aes_256_cbc},	/* AES256-SHA256 */
+	{0x009c, 16, 4, 0, 0, 0, EVP_aes_128_gcm},	/* AES128-GCM-SHA256 */
+	{0x009d, 32, 4, 0, 0, 1, EVP_aes_256_gcm},	/* AES256-GCM-SHA384 */
+};
+
 /**
  *	PEM format cert/privatekey file password callback function
  *
@@ -39,9 +73,1182 @@ _dssl_pem_password_cb(char *buf, int size, int rwflag, void *u)
         return plen;
 }
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+
+static pthread_mutex_t	*_dssl_locks;	/* OpenSSL locks */
+
+static void 
+_dssl_lock_cb(int mode, int n, const char *file, int line)
+{
+	if (mode & CRYPTO_LOCK)
+		pthread_mutex_lock(&_dssl_locks[n]);
+	else
+		pthread_mutex_unlock(&_dssl_locks[n]);
+}
+
+static unsigned long 
+_dssl_id_cb(void)
+{
+	return (unsigned long)pthread_self();
+}
+
+/**
+ *	Set the lock callbacks of OpenSSL, the private key is used
+ *	by many threads. It's not need after OpenSSL 1.1.0.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_dssl_lock_init(void)
+{
+	int i;
+	int n;
+
+	if (_dssl_locks || CRYPTO_get_locking_callback())
+		return 0;
+
+	n = CRYPTO_num_locks();
+	_dssl_locks = calloc(n, sizeof(pthread_mutex_t));
+	if (!_dssl_locks)
+		ERR_RET(-1, "calloc locks failed: %s\n", ERRSTR);
+
+	for (i = 0; i < n; i++)
+		pthread_mutex_init(&_dssl_locks[i], NULL);
+
+	CRYPTO_set_id_callback(_dssl_id_cb);
+	CRYPTO_set_locking_callback(_dssl_lock_cb);
+
+	return 0;
+}
+
+#else
+
+static inline int 
+_dssl_lock_init(void)
+{
+	return 0;
+}
+
+#endif
+
+/**
+ *	Append @len bytes @data into @buf, the @buf is doubled if
+ *	no space.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_dssl_buf_put(dbuf_t *buf, const u_int8_t *data, u_int32_t len)
+{
+	u_int32_t n;
+
+	if (buf->max - buf->len < len) {
+		n = buf->max ? buf->max : 4096;
+		while (n < buf->len + len)
+			n *= 2;
+		if (buf->buf ? dbuf_resize(buf, n) : dbuf_init(buf, n))
+			ERR_RET(-1, "resize buffer to %u failed\n", n);
+	}
+
+	return dbuf_put(buf, data, len);
+}
+
+/**
+ *	Drop @n bytes from head of @buf.
+ *
+ *	No return.
+ */
+static void 
+_dssl_buf_drop(dbuf_t *buf, u_int32_t n)
+{
+	if (n >= buf->len) {
+		buf->len = 0;
+		return;
+	}
+
+	memmove(buf->buf, buf->buf + n, buf->len - n);
+	buf->len -= n;
+}
+
+/**
+ *	The P_hash of TLS PRF, the output is XORed into @out.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_dssl_p_hash(const EVP_MD *md, const u_int8_t *sec, int slen,
+	     const u_int8_t *seed, int seedlen, u_int8_t *out, int olen)
+{
+	int i;
+	int n;
+	unsigned int alen;
+	unsigned int hlen;
+	u_int8_t a[EVP_MAX_MD_SIZE];
+	u_int8_t h[EVP_MAX_MD_SIZE];
+	u_int8_t buf[EVP_MAX_MD_SIZE + 128];
+
+	if (seedlen > 128)
+		return -1;
+
+	/* A(1) = HMAC(secret, seed) */
+	if (!HMAC(md, sec, slen, seed, seedlen, a, &alen))
+		return -1;
+
+	while (olen > 0) {
+		memcpy(buf, a, alen);
+		memcpy(buf + alen, seed, seedlen);
+		if (!HMAC(md, sec, slen, buf, alen + seedlen, h, &hlen))
+			return -1;
+
+		n = olen < hlen ? olen : hlen;
+		for (i = 0; i < n; i++)
+			out[i] ^= h[i];
+		out += n;
+		olen -= n;
+
+		memcpy(buf, a, alen);
+		if (!HMAC(md, sec, slen, buf, alen, a, &alen))
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ *	The PRF hash of TLS1.2 session @s.
+ *
+ *	Return the hash.
+ */
+static inline const EVP_MD * 
+_dssl_prf_md(dssl_t *s)
+{
+	return s->cipher->sha384 ? EVP_sha384() : EVP_sha256();
+}
+
+/**
+ *	The TLS PRF of session @s, seed is @label + @s1 + @s2.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_dssl_prf(dssl_t *s, const u_int8_t *sec, int slen, const char *label,
+	  const u_int8_t *s1, int l1, const u_int8_t *s2, int l2,
+	  u_int8_t *out, int olen)
+{
+	int n;
+	int half;
+	u_int8_t seed[128];
+
+	n = strlen(label);
+	if (n + l1 + l2 > sizeof(seed))
+		return -1;
+	memcpy(seed, label, n);
+	memcpy(seed + n, s1, l1);
+	memcpy(seed + n + l1, s2, l2);
+	n += l1 + l2;
+
+	memset(out, 0, olen);
+
+	if (s->version >= _TLS12)
+		return _dssl_p_hash(_dssl_prf_md(s), sec, slen, seed, n,
+				    out, olen);
+
+	/* TLS1.0/1.1 use MD5 and SHA1 on two halves of secret */
+	half = (slen + 1) / 2;
+	if (_dssl_p_hash(EVP_md5(), sec, half, seed, n, out, olen) ||
+	    _dssl_p_hash(EVP_sha1(), sec + slen - half, half, seed, n,
+			 out, olen))
+		return -1;
+
+	return 0;
+}
+
+/**
+ *	Hash the cache key @key which length is @klen.
+ *
+ *	Return the hash value.
+ */
+static u_int32_t 
+_dssl_ssn_hash(const u_int8_t *key, u_int32_t klen)
+{
+	u_int32_t h;
+	u_int32_t w[3];
+
+	h = klen;
+	while (klen >= sizeof(w)) {
+		memcpy(w, key, sizeof(w));
+		h = jhash_3words(w[0] ^ h, w[1], w[2]);
+		key += sizeof(w);
+		klen -= sizeof(w);
+	}
+
+	if (klen) {
+		memset(w, 0, sizeof(w));
+		memcpy(w, key, klen);
+		h = jhash_3words(w[0] ^ h, w[1], w[2]);
+	}
+
+	return h;
+}
+
+static int 
+_dssl_ssn_cmp(const void *d1, const void *d2)
+{
+	const dssl_ssn_t *s1 = d1;
+	const dssl_ssn_t *s2 = d2;
+
+	if (s1->klen != s2->klen)
+		return 1;
+
+	return memcmp(s1->key, s2->key, s1->klen);
+}
+
+/**
+ *	Free the session cache of @ctx.
+ *
+ *	No return.
+ */
+static void 
+_dssl_cache_free(dssl_ctx_t *ctx)
+{
+	u_int32_t i;
+	dssl_shard_t *sh;
+
+	if (!ctx->shards)
+		return;
+
+	for (i = 0; i < ctx->nshard; i++) {
+		sh = &ctx->shards[i];
+		if (sh->hash)
+			shash_free(sh->hash);
+		pthread_mutex_destroy(&sh->lock);
+	}
+
+	free(ctx->shards);
+	ctx->shards = NULL;
+	ctx->nshard = 0;
+}
+
+/**
+ *	Alloc the session cache of @ctx which has @max sessions, the
+ *	sessions are hashed to DSSL_CACHE_SHARD shards.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_dssl_cache_alloc(dssl_ctx_t *ctx, u_int32_t max)
+{
+	u_int32_t i;
+	u_int32_t n;
+	dssl_shard_t *sh;
+
+	if (posix_memalign((void **)&ctx->shards, CACHE_LINE_SIZE,
+			   DSSL_CACHE_SHARD * sizeof(dssl_shard_t)))
+		ERR_RET(-1, "alloc cache shards failed\n");
+	memset(ctx->shards, 0, DSSL_CACHE_SHARD * sizeof(dssl_shard_t));
+	ctx->nshard = DSSL_CACHE_SHARD;
+
+	n = (max + DSSL_CACHE_SHARD - 1) / DSSL_CACHE_SHARD;
+	for (i = 0; i < ctx->nshard; i++) {
+		sh = &ctx->shards[i];
+		pthread_mutex_init(&sh->lock, NULL);
+		CBLIST_INIT(&sh->lru);
+		sh->max = n;
+		sh->hash = shash_alloc(n < 64 ? 64 : n, _dssl_ssn_cmp, free);
+		if (!sh->hash) {
+			_dssl_cache_free(ctx);
+			ERR_RET(-1, "shash_alloc failed\n");
+		}
+	}
+
+	return 0;
+}
+
+/**
+ *	Get the shard of hash value @hval, the high bits are used, the
+ *	low bits index the bucket.
+ *
+ *	Return the shard.
+ */
+static inline dssl_shard_t * 
+_dssl_cache_shard(dssl_ctx_t *ctx, u_int32_t hval)
+{
+	return &ctx->shards[((u_int64_t)hval * ctx->nshard) >> 32];
+}
+
+/**
+ *	Add master secret @ms into cache of @ctx, the key is @type
+ *	and @key. The existed one is updated, the least recently
+ *	used one is evicted if shard is full.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_dssl_cache_add(dssl_ctx_t *ctx, int type, const u_int8_t *key,
+		u_int32_t klen, const u_int8_t *ms)
+{
+	dssl_ssn_t *ssn;
+	dssl_ssn_t *old;
+	dssl_shard_t *sh;
+
+	if (!ctx->shards || klen < 1 || klen > DSSL_TICKET_MAX)
+		return -1;
+
+	ssn = malloc(sizeof(dssl_ssn_t) + klen + 1);
+	if (!ssn)
+		ERR_RET(-1, "malloc session failed: %s\n", ERRSTR);
+	ssn->key[0] = type;
+	memcpy(ssn->key + 1, key, klen);
+	ssn->klen = klen + 1;
+	ssn->hval = _dssl_ssn_hash(ssn->key, ssn->klen);
+	memcpy(ssn->ms, ms, DSSL_MS_LEN);
+
+	sh = _dssl_cache_shard(ctx, ssn->hval);
+	pthread_mutex_lock(&sh->lock);
+
+	old = shash_find(sh->hash, ssn, ssn->hval);
+	if (old) {
+		memcpy(old->ms, ms, DSSL_MS_LEN);
+		CBLIST_DEL(&old->lru);
+		CBLIST_ADD_TAIL(&sh->lru, &old->lru);
+		pthread_mutex_unlock(&sh->lock);
+		free(ssn);
+		return 0;
+	}
+
+	if (sh->count >= sh->max) {
+		old = CBLIST_GET_HEAD(&sh->lru, dssl_ssn_t *, lru);
+		CBLIST_DEL(&old->lru);
+		shash_del(sh->hash, old, old->hval);
+		free(old);
+		sh->count--;
+		sh->nevict++;
+	}
+
+	if (shash_add(sh->hash, ssn, ssn->hval, 0)) {
+		pthread_mutex_unlock(&sh->lock);
+		free(ssn);
+		return -1;
+	}
+	CBLIST_ADD_TAIL(&sh->lru, &ssn->lru);
+	sh->count++;
+	sh->nadd++;
+
+	pthread_mutex_unlock(&sh->lock);
+
+	return 0;
+}
+
+/**
+ *	Find master secret of key @type and @key in cache of @ctx,
+ *	it's copied into @ms.
+ *
+ *	Return 0 if found, -1 if not found.
+ */
+static int 
+_dssl_cache_find(dssl_ctx_t *ctx, int type, const u_int8_t *key,
+		 u_int32_t klen, u_int8_t *ms)
+{
+	int ret;
+	dssl_ssn_t *ssn;
+	dssl_shard_t *sh;
+	union {
+		dssl_ssn_t	ssn;
+		u_int8_t	buf[sizeof(dssl_ssn_t) + DSSL_TICKET_MAX + 1];
+	} probe;
+
+	if (!ctx->shards || klen < 1 || klen > DSSL_TICKET_MAX)
+		return -1;
+
+	probe.ssn.key[0] = type;
+	memcpy(probe.ssn.key + 1, key, klen);
+	probe.ssn.klen = klen + 1;
+	probe.ssn.hval = _dssl_ssn_hash(probe.ssn.key, probe.ssn.klen);
+
+	ret = -1;
+	sh = _dssl_cache_shard(ctx, probe.ssn.hval);
+	pthread_mutex_lock(&sh->lock);
+
+	ssn = shash_find(sh->hash, &probe.ssn, probe.ssn.hval);
+	if (ssn) {
+		memcpy(ms, ssn->ms, DSSL_MS_LEN);
+		CBLIST_DEL(&ssn->lru);
+		CBLIST_ADD_TAIL(&sh->lru, &ssn->lru);
+		sh->nhit++;
+		ret = 0;
+	}
+	else
+		sh->nmiss++;
+
+	pthread_mutex_unlock(&sh->lock);
+
+	return ret;
+}
+
+/**
+ *	Put a reference of @job, it's freed by the last one.
+ *
+ *	No return.
+ */
+static inline void 
+_dssl_job_put(dssl_job_t *job)
+{
+	if (__atomic_sub_fetch(&job->ref, 1, __ATOMIC_ACQ_REL) == 0)
+		free(job);
+}
+
+/**
+ *	Decrypt the pre master secret of @job by private key of @ctx.
+ *
+ *	No return.
+ */
+static void 
+_dssl_rsa(dssl_ctx_t *ctx, dssl_job_t *job)
+{
+	int done;
+	size_t len;
+	EVP_PKEY_CTX *pctx;
+	u_int8_t out[1024];
+
+	done = -1;
+	len = sizeof(out);
+	pctx = EVP_PKEY_CTX_new(ctx->pkey, NULL);
+	if (pctx &&
+	    EVP_PKEY_decrypt_init(pctx) > 0 &&
+	    EVP_PKEY_CTX_set_rsa_padding(pctx, RSA_PKCS1_PADDING) > 0 &&
+	    EVP_PKEY_decrypt(pctx, out, &len, job->data, job->len) > 0 &&
+	    len == DSSL_MS_LEN) {
+		memcpy(job->pms, out, DSSL_MS_LEN);
+		done = 1;
+	}
+	if (pctx)
+		EVP_PKEY_CTX_free(pctx);
+	OPENSSL_cleanse(out, sizeof(out));
+
+	if (done > 0)
+		__atomic_add_fetch(&ctx->stat.nrsa, 1, __ATOMIC_RELAXED);
+	else
+		__atomic_add_fetch(&ctx->stat.nrsa_fail, 1, __ATOMIC_RELAXED);
+
+	/* the @pms is visible before @done */
+	__atomic_store_n(&job->done, done, __ATOMIC_RELEASE);
+}
+
+/**
+ *	The key exchange decrypt thread of context @arg.
+ *
+ *	Return NULL always.
+ */
+static void * 
+_dssl_worker(void *arg)
+{
+	dssl_job_t *job;
+	dssl_ctx_t *ctx = arg;
+
+	while (1) {
+		pthread_mutex_lock(&ctx->lock);
+		while (CBLIST_IS_EMPTY(&ctx->jobs) && !ctx->stop)
+			pthread_cond_wait(&ctx->cond, &ctx->lock);
+		if (ctx->stop) {
+			pthread_mutex_unlock(&ctx->lock);
+			break;
+		}
+		job = CBLIST_GET_HEAD(&ctx->jobs, dssl_job_t *, list);
+		CBLIST_DEL(&job->list);
+		pthread_mutex_unlock(&ctx->lock);
+
+		/* the session is freed, no need decrypt */
+		if (__atomic_load_n(&job->ref, __ATOMIC_ACQUIRE) > 1)
+			_dssl_rsa(ctx, job);
+
+		_dssl_job_put(job);
+	}
+
+	return NULL;
+}
+
+/**
+ *	Stop the workers of @ctx and free the jobs not decrypted.
+ *
+ *	No return.
+ */
+static void 
+_dssl_worker_stop(dssl_ctx_t *ctx)
+{
+	int i;
+	dssl_job_t *job;
+
+	if (ctx->workers) {
+		pthread_mutex_lock(&ctx->lock);
+		ctx->stop = 1;
+		pthread_cond_broadcast(&ctx->cond);
+		pthread_mutex_unlock(&ctx->lock);
+
+		for (i = 0; i < ctx->nworker; i++)
+			pthread_join(ctx->workers[i], NULL);
+
+		free(ctx->workers);
+		ctx->workers = NULL;
+		ctx->nworker = 0;
+	}
+
+	while (!CBLIST_IS_EMPTY(&ctx->jobs)) {
+		job = CBLIST_GET_HEAD(&ctx->jobs, dssl_job_t *, list);
+		CBLIST_DEL(&job->list);
+		_dssl_job_put(job);
+	}
+}
+
+/**
+ *	Stop decode session @s, the kept records are dropped.
+ *
+ *	Return -1 always.
+ */
+static int 
+_dssl_error(dssl_t *s)
+{
+	if (!(s->flags & DSSL_F_ERROR)) {
+		s->flags |= DSSL_F_ERROR;
+		__atomic_add_fetch(&s->ctx->stat.nerror, 1, __ATOMIC_RELAXED);
+	}
+
+	dbuf_free(&s->recs[0]);
+	dbuf_free(&s->recs[1]);
+	dbuf_free(&s->hsks[0]);
+	dbuf_free(&s->hsks[1]);
+	dbuf_free(&s->hlog);
+
+	return -1;
+}
+
+/**
+ *	Cache the master secret of @s by server session id and the
+ *	ticket issued by server.
+ *
+ *	No return.
+ */
+static void 
+_dssl_cache_session(dssl_t *s)
+{
+	if (s->sidlen)
+		_dssl_cache_add(s->ctx, DSSL_KEY_SID, s->sid, s->sidlen, s->ms);
 
+	if (DBUF_LEN(&s->newticket))
+		_dssl_cache_add(s->ctx, DSSL_KEY_TICKET,
+				DBUF_DATA(&s->newticket),
+				DBUF_LEN(&s->newticket), s->ms);
+}
+
+/**
+ *	Get master secret of @s from the pre master secret @pms.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_dssl_master(dssl_t *s, const u_int8_t *pms)
+{
+	int ret;
+
+	if (s->flags & DSSL_F_EMS)
+		ret = _dssl_prf(s, pms, DSSL_MS_LEN, "extended master secret",
+				s->hash, s->hashlen, NULL, 0, s->ms,
+				DSSL_MS_LEN);
+	else
+		ret = _dssl_prf(s, pms, DSSL_MS_LEN, "master secret",
+				s->randoms[0], DSSL_RANDOM_LEN, s->randoms[1],
+				DSSL_RANDOM_LEN, s->ms, DSSL_MS_LEN);
+	if (ret)
+		return -1;
+
+	s->flags |= DSSL_F_MS;
+	__atomic_add_fetch(&s->ctx->stat.nfull, 1, __ATOMIC_RELAXED);
+	_dssl_cache_session(s);
+
+	return 0;
+}
+
+/**
+ *	Check the key exchange job of @s is done, the master secret
+ *	is got if it's decrypted.
+ *
+ *	Return 1 if done, 0 if pending.
+ */
+static int 
+_dssl_job_check(dssl_t *s)
+{
+	int done;
+
+	done = __atomic_load_n(&s->job->done, __ATOMIC_ACQUIRE);
+	if (done == 0)
+		return 0;
+
+	if (done > 0)
+		_dssl_master(s, s->job->pms);
+	OPENSSL_cleanse(s->job->pms, DSSL_MS_LEN);
+
+	_dssl_job_put(s->job);
+	s->job = NULL;
+
+	return 1;
+}
+
+/**
+ *	Get master secret of resumed session @s from cache, the
+ *	session id is tried first, then the ticket.
+ *
+ *	Return 0 if success, -1 if not found.
+ */
+static int 
+_dssl_resume(dssl_t *s)
+{
+	dssl_ctx_t *ctx = s->ctx;
+
+	if (s->sidlen &&
+	    _dssl_cache_find(ctx, DSSL_KEY_SID, s->sid, s->sidlen, s->ms) == 0)
+		__atomic_add_fetch(&ctx->stat.nresume_sid, 1, __ATOMIC_RELAXED);
+	else if (DBUF_LEN(&s->ticket) &&
+		 _dssl_cache_find(ctx, DSSL_KEY_TICKET, DBUF_DATA(&s->ticket),
+				  DBUF_LEN(&s->ticket), s->ms) == 0)
+		__atomic_add_fetch(&ctx->stat.nresume_ticket, 1,
+				   __ATOMIC_RELAXED);
+	else {
+		__atomic_add_fetch(&ctx->stat.nresume_miss, 1,
+				   __ATOMIC_RELAXED);
+		return -1;
+	}
 
-dssl_ctx_t *
+	s->flags |= DSSL_F_MS | DSSL_F_RESUMED;
+
+	/* the new ticket of resumed session has same master secret */
+	_dssl_cache_session(s);
+
+	return 0;
+}
+
+/**
+ *	Create the decrypt keys of both directions of @s from master
+ *	secret.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_dssl_keys(dssl_t *s)
+{
+	int d;
+	int n;
+	int ret;
+	u_int8_t *key;
+	u_int8_t *iv;
+	const dssl_cipher_t *c;
+	u_int8_t kb[2 * (32 + 32 + 16)];
+
+	c = s->cipher;
+	n = 2 * (c->maclen + c->keylen + c->ivlen);
+	if (_dssl_prf(s, s->ms, DSSL_MS_LEN, "key expansion", s->randoms[1],
+		      DSSL_RANDOM_LEN, s->randoms[0], DSSL_RANDOM_LEN, kb, n))
+		return -1;
+
+	/* the handshake log is not needed after keys */
+	dbuf_free(&s->hlog);
+
+	ret = 0;
+	for (d = 0; d < 2; d++) {
+		key = kb + 2 * c->maclen + d * c->keylen;
+		iv = kb + 2 * (c->maclen + c->keylen) + d * c->ivlen;
+
+		s->keys[d] = EVP_CIPHER_CTX_new();
+		if (!s->keys[d] ||
+		    !EVP_DecryptInit_ex(s->keys[d], c->evp(), NULL, key,
+					c->blklen ? iv : NULL)) {
+			ret = -1;
+			break;
+		}
+		EVP_CIPHER_CTX_set_padding(s->keys[d], 0);
+
+		/* the AEAD nonce is fixed IV + explicit nonce */
+		if (!c->blklen)
+			memcpy(s->ivs[d], iv, sizeof(s->ivs[d]));
+	}
+
+	OPENSSL_cleanse(kb, sizeof(kb));
+
+	return ret;
+}
+
+/**
+ *	Check the keys of @s is ready to decrypt records after
+ *	change cipher spec.
+ *
+ *	Return 1 if ready, 0 if key exchange pending, -1 on error.
+ */
+static int 
+_dssl_keys_ready(dssl_t *s)
+{
+	if (!s->cipher)
+		return -1;
+
+	if (s->job && !_dssl_job_check(s))
+		return 0;
+
+	/* no key exchange, it's resumed session */
+	if (!(s->flags & DSSL_F_MS)) {
+		if ((s->flags & DSSL_F_KEYEXG) || _dssl_resume(s))
+			return -1;
+	}
+
+	if (!s->keys[0] && _dssl_keys(s))
+		return -1;
+
+	return 1;
+}
+
+/**
+ *	Parse the client hello of @s, the random, session id and
+ *	session ticket are saved.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_dssl_cli_hello(dssl_t *s, const u_int8_t *p, u_int32_t len)
+{
+	u_int32_t off;
+	u_int32_t end;
+	u_int16_t type;
+	u_int16_t n;
+
+	if (len < 2 + DSSL_RANDOM_LEN + 1)
+		return -1;
+
+	memcpy(s->randoms[0], p + 2, DSSL_RANDOM_LEN);
+	off = 2 + DSSL_RANDOM_LEN;
+
+	s->sidlen = p[off++];
+	if (s->sidlen > DSSL_SID_MAX || off + s->sidlen > len)
+		return -1;
+	memcpy(s->sid, p + off, s->sidlen);
+	off += s->sidlen;
+
+	/* cipher suites and compression methods */
+	if (off + 2 > len)
+		return -1;
+	off += 2 + _GET16(p + off);
+	if (off + 1 > len)
+		return -1;
+	off += 1 + p[off];
+
+	s->flags |= DSSL_F_CLI_HELLO;
+	DBUF_RESET(&s->ticket);
+
+	if (off + 2 > len)
+		return 0;
+	end = off + 2 + _GET16(p + off);
+	if (end > len)
+		end = len;
+	off += 2;
+
+	while (off + 4 <= end) {
+		type = _GET16(p + off);
+		n = _GET16(p + off + 2);
+		off += 4;
+		if (off + n > end)
+			break;
+		if (type == DSSL_EXT_TICKET && n > 0 && n <= DSSL_TICKET_MAX)
+			_dssl_buf_put(&s->ticket, p + off, n);
+		off += n;
+	}
+
+	return 0;
+}
+
+/**
+ *	Parse the server hello of @s, the version and cipher suite
+ *	are negotiated.
+ *
+ *	Return 0 if success, -1 on error or cipher not supported.
+ */
+static int 
+_dssl_svr_hello(dssl_t *s, const u_int8_t *p, u_int32_t len)
+{
+	int i;
+	u_int32_t off;
+	u_int32_t end;
+	u_int16_t suite;
+	u_int16_t type;
+	u_int16_t n;
+	u_int8_t sidlen;
+
+	if (!(s->flags & DSSL_F_CLI_HELLO) || len < 2 + DSSL_RANDOM_LEN + 1)
+		return -1;
+
+	s->version = _GET16(p);
+	if (s->version < _TLS10 || s->version > _TLS12)
+		return -1;
+
+	memcpy(s->randoms[1], p + 2, DSSL_RANDOM_LEN);
+	off = 2 + DSSL_RANDOM_LEN;
+
+	/* the server session id is cached after full handshake */
+	sidlen = p[off++];
+	if (sidlen > DSSL_SID_MAX || off + sidlen + 2 > len)
+		return -1;
+	s->sidlen = sidlen;
+	memcpy(s->sid, p + off, sidlen);
+	off += sidlen;
+
+	suite = _GET16(p + off);
+	for (i = 0; i < sizeof(_dssl_ciphers) / sizeof(_dssl_ciphers[0]); i++) {
+		if (_dssl_ciphers[i].suite == suite) {
+			s->cipher = &_dssl_ciphers[i];
+			break;
+		}
+	}
+	if (!s->cipher)
+		return -1;
+
+	s->flags |= DSSL_F_SVR_HELLO;
+
+	/* compression method, then extensions */
+	off += 3;
+	if (off + 2 > len)
+		return 0;
+	end = off + 2 + _GET16(p + off);
+	if (end > len)
+		end = len;
+	off += 2;
+
+	while (off + 4 <= end) {
+		type = _GET16(p + off);
+		n = _GET16(p + off + 2);
+		off += 4;
+		if (off + n > end)
+			break;
+		/* encrypt then MAC is only for CBC */
+		if (type == DSSL_EXT_ETM && s->cipher->blklen)
+			s->flags |= DSSL_F_ETM;
+		else if (type == DSSL_EXT_EMS)
+			s->flags |= DSSL_F_EMS;
+		off += n;
+	}
+
+	return 0;
+}
+
+/**
+ *	Get the session hash of @s for extended master secret, it's
+ *	the hash of handshake messages until client key exchange.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_dssl_session_hash(dssl_t *s)
+{
+	unsigned int n;
+	const u_int8_t *p;
+	u_int32_t len;
+
+	p = DBUF_DATA(&s->hlog);
+	len = DBUF_LEN(&s->hlog);
+
+	if (s->version >= _TLS12) {
+		if (!EVP_Digest(p, len, s->hash, &n, _dssl_prf_md(s), NULL))
+			return -1;
+		s->hashlen = n;
+	}
+	else {
+		if (!EVP_Digest(p, len, s->hash, &n, EVP_md5(), NULL) ||
+		    !EVP_Digest(p, len, s->hash + 16, &n, EVP_sha1(), NULL))
+			return -1;
+		s->hashlen = 16 + 20;
+	}
+
+	dbuf_free(&s->hlog);
+
+	return 0;
+}
+
+/**
+ *	Parse the RSA client key exchange of @s, the pre master
+ *	secret is decrypted by worker, or in place if no worker.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_dssl_keyexg(dssl_t *s, const u_int8_t *p, u_int32_t len)
+{
+	u_int32_t n;
+	dssl_job_t *job;
+	dssl_ctx_t *ctx = s->ctx;
+
+	if (!(s->flags & DSSL_F_SVR_HELLO) || s->job || !ctx->pkey)
+		return -1;
+
+	if (len < 2)
+		return -1;
+	n = _GET16(p);
+	if (n + 2 != len)
+		return -1;
+
+	s->flags |= DSSL_F_KEYEXG;
+
+	if ((s->flags & DSSL_F_EMS) && _dssl_session_hash(s))
+		return -1;
+
+	job = malloc(sizeof(dssl_job_t) + n);
+	if (!job)
+		ERR_RET(-1, "malloc job failed: %s\n", ERRSTR);
+	job->ref = 1;
+	job->done = 0;
+	job->len = n;
+	memcpy(job->data, p + 2, n);
+	s->job = job;
+
+	if (ctx->nworker < 1) {
+		_dssl_rsa(ctx, job);
+		_dssl_job_check(s);
+		return 0;
+	}
+
+	job->ref = 2;
+	pthread_mutex_lock(&ctx->lock);
+	CBLIST_ADD_TAIL(&ctx->jobs, &job->list);
+	pthread_cond_signal(&ctx->cond);
+	pthread_mutex_unlock(&ctx->lock);
+
+	return 0;
+}
+
+/**
+ *	Parse the new session ticket of @s, it's cached when master
+ *	secret is known.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_dssl_new_ticket(dssl_t *s, const u_int8_t *p, u_int32_t len)
+{
+	u_int16_t n;
+
+	if (len < 6)
+		return -1;
+	n = _GET16(p + 4);
+	if (n + 6 > len)
+		return -1;
+
+	DBUF_RESET(&s->newticket);
+	if (n < 1 || n > DSSL_TICKET_MAX)
+		return 0;
+	if (_dssl_buf_put(&s->newticket, p + 6, n))
+		return -1;
+
+	if (s->flags & DSSL_F_MS)
+		_dssl_cache_add(s->ctx, DSSL_KEY_TICKET, p + 6, n, s->ms);
+
+	return 0;
+}
+
+/**
+ *	Parse plain handshake messages in @data of direction @dir,
+ *	the message may span records.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_dssl_handshake(dssl_t *s, int dir, const u_int8_t *data, u_int32_t len)
+{
+	int ret;
+	u_int8_t type;
+	u_int32_t n;
+	u_int32_t off;
+	dbuf_t *buf;
+	const u_int8_t *p;
+
+	buf = &s->hsks[dir];
+	if (_dssl_buf_put(buf, data, len))
+		return -1;
+
+	ret = 0;
+	off = 0;
+	p = DBUF_DATA(buf);
+	while (ret == 0 && off + _HSK_HLEN <= DBUF_LEN(buf)) {
+		type = p[off];
+		n = _GET24(p + off + 1);
+		if (off + _HSK_HLEN + n > DBUF_LEN(buf))
+			break;
+
+		/* the messages until key exchange are hashed for EMS */
+		if (type != DSSL_HT_HELLO_REQ &&
+		    !(s->flags & (DSSL_F_KEYEXG | DSSL_F_MS)) &&
+		    _dssl_buf_put(&s->hlog, p + off, _HSK_HLEN + n))
+			return -1;
+
+		if (dir == DSSL_DIR_CLI && type == DSSL_HT_CLI_HELLO)
+			ret = _dssl_cli_hello(s, p + off + _HSK_HLEN, n);
+		else if (dir == DSSL_DIR_SVR && type == DSSL_HT_SVR_HELLO)
+			ret = _dssl_svr_hello(s, p + off + _HSK_HLEN, n);
+		else if (dir == DSSL_DIR_CLI && type == DSSL_HT_CLI_KEYEXG)
+			ret = _dssl_keyexg(s, p + off + _HSK_HLEN, n);
+		else if (dir == DSSL_DIR_SVR && type == DSSL_HT_NEW_TICKET)
+			ret = _dssl_new_ticket(s, p + off + _HSK_HLEN, n);
+
+		off += _HSK_HLEN + n;
+	}
+
+	_dssl_buf_drop(buf, off);
+	if (DBUF_LEN(buf) > DSSL_PENDING_MAX ||
+	    DBUF_LEN(&s->hlog) > DSSL_PENDING_MAX)
+		return -1;
+
+	return ret;
+}
+
+/**
+ *	Decrypt record @in of direction @dir into @out.
+ *
+ *	Return the offset of plain data in @out, -1 on error.
+ */
+static int 
+_dssl_decrypt(dssl_t *s, int dir, const u_int8_t *in, int len,
+	      u_int8_t *out, int *olen)
+{
+	int n;
+	int pad;
+	int mac;
+	int skip;
+	EVP_CIPHER_CTX *ctx;
+	const dssl_cipher_t *c;
+	u_int8_t nonce[4 + _GCM_NONCE];
+
+	c = s->cipher;
+	ctx = s->keys[dir];
+
+	/* AEAD, the tag is not verified */
+	if (!c->blklen) {
+		if (len < _GCM_NONCE + _GCM_TAG)
+			return -1;
+		memcpy(nonce, s->ivs[dir], 4);
+		memcpy(nonce + 4, in, _GCM_NONCE);
+		if (!EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, nonce) ||
+		    !EVP_DecryptUpdate(ctx, out, &n, in + _GCM_NONCE,
+				       len - _GCM_NONCE - _GCM_TAG))
+			return -1;
+		*olen = n;
+		return 0;
+	}
+
+	/* CBC, the MAC is not verified, it's after cipher text if ETM */
+	mac = c->maclen;
+	if (s->flags & DSSL_F_ETM) {
+		len -= mac;
+		mac = 0;
+	}
+	if (len < c->blklen || len % c->blklen)
+		return -1;
+	if (!EVP_DecryptUpdate(ctx, out, &n, in, len) || n != len)
+		return -1;
+
+	/* TLS1.1+ has explicit IV, the first block is garbage */
+	skip = s->version >= _TLS11 ? c->blklen : 0;
+	pad = out[n - 1];
+	if (skip + pad + 1 + mac > n)
+		return -1;
+
+	*olen = n - skip - pad - 1 - mac;
+	return skip;
+}
+
+/**
+ *	Decode one record @data which type is @type of direction @dir.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+static int 
+_dssl_record(dssl_t *s, int dir, u_int8_t type, const u_int8_t *data,
+	     int len)
+{
+	int off;
+	u_int8_t out[DSSL_REC_MAX + 16];
+
+	if (s->ccs[dir]) {
+		off = _dssl_decrypt(s, dir, data, len, out, &len);
+		if (off < 0)
+			return -1;
+		data = out + off;
+		__atomic_add_fetch(&s->ctx->stat.nrec, 1, __ATOMIC_RELAXED);
+	}
+
+	switch (type) {
+	case DSSL_RT_CCS:
+		s->ccs[dir] = 1;
+		return 0;
+
+	/* the encrypted handshake is finished */
+	case DSSL_RT_HSK:
+		if (s->ccs[dir])
+			return 0;
+		return _dssl_handshake(s, dir, data, len);
+
+	case DSSL_RT_APP:
+		if (!s->ccs[dir] || len < 1)
+			return 0;
+		if (DBUF_LEN(&s->bufs[dir]) + len > DSSL_PENDING_MAX)
+			return -1;
+		return _dssl_buf_put(&s->bufs[dir], data, len);
+
+	default:
+		return 0;
+	}
+}
+
+/**
+ *	Decode the complete records of direction @dir, the records
+ *	after change cipher spec are kept until keys are ready.
+ *
+ *	Return bytes of plain data in @dir, -1 on error.
+ */
+static int 
+_dssl_process(dssl_t *s, int dir)
+{
+	int ret;
+	u_int8_t type;
+	u_int32_t len;
+	u_int32_t off;
+	dbuf_t *buf;
+	const u_int8_t *p;
+
+	buf = &s->recs[dir];
+	p = DBUF_DATA(buf);
+	off = 0;
+	while (off + _REC_HLEN <= DBUF_LEN(buf)) {
+		type = p[off];
+		len = _GET16(p + off + 3);
+		if (type < DSSL_RT_CCS || type > DSSL_RT_APP ||
+		    p[off + 1] != 3 || len > DSSL_REC_MAX)
+			return _dssl_error(s);
+		if (off + _REC_HLEN + len > DBUF_LEN(buf))
+			break;
+
+		if (s->ccs[dir] && !s->keys[dir]) {
+			ret = _dssl_keys_ready(s);
+			if (ret < 0)
+				return _dssl_error(s);
+			if (ret == 0)
+				break;
+		}
+
+		if (_dssl_record(s, dir, type, p + off + _REC_HLEN, len))
+			return _dssl_error(s);
+
+		off += _REC_HLEN + len;
+	}
+
+	_dssl_buf_drop(buf, off);
+	if (DBUF_LEN(buf) > DSSL_PENDING_MAX)
+		return _dssl_error(s);
+
+	return DBUF_LEN(&s->bufs[dir]);
+}
+
+dssl_ctx_t * 
 dssl_ctx_new(void)
 {
 	dssl_ctx_t *ctx;
@@ -52,6 +1259,15 @@ dssl_ctx_new(void)
 
 	memset(ctx, 0, sizeof(*ctx));
 
+	pthread_mutex_init(&ctx->lock, NULL);
+	pthread_cond_init(&ctx->cond, NULL);
+	CBLIST_INIT(&ctx->jobs);
+
+	if (_dssl_cache_alloc(ctx, DSSL_CACHE_MAX)) {
+		free(ctx);
+		return NULL;
+	}
+
 	return ctx;
 }
 
@@ -68,7 +1284,12 @@ dssl_ctx_free(dssl_ctx_t *ctx)
 	refcnt = __sync_fetch_and_sub(&ctx->refcnt, 1);
 	if (refcnt > 0)
 		return;
-	
+
+	_dssl_worker_stop(ctx);
+	_dssl_cache_free(ctx);
+	pthread_cond_destroy(&ctx->cond);
+	pthread_mutex_destroy(&ctx->lock);
+
 	if (ctx->pkey)
 		EVP_PKEY_free(ctx->pkey);
 
@@ -81,7 +1302,7 @@ dssl_ctx_load_pkey(dssl_ctx_t *ctx, const char *keyfile, const char *pw)
 	FILE *fp;
 	EVP_PKEY *pkey;
 	pem_password_cb *cb = NULL;
-	
+
 	if (unlikely(!ctx || !keyfile))
 		ERR_RET(-1, "invalid argument @keyfile\n");
 
@@ -90,7 +1311,7 @@ dssl_ctx_load_pkey(dssl_ctx_t *ctx, const char *keyfile, const char *pw)
 
 	fp = fopen(keyfile, "r");
 	if (unlikely(!fp))
-		ERR_RET(-1, "open keyfile %s failed: %s\n", 
+		ERR_RET(-1, "open keyfile %s failed: %s\n",
 			keyfile, ERRSTR);
 
 	/* try to read PEM format private key file */
@@ -107,7 +1328,7 @@ dssl_ctx_load_pkey(dssl_ctx_t *ctx, const char *keyfile, const char *pw)
 
 	fclose(fp);
 
-	if (!pkey) 
+	if (!pkey)
 		ERR_RET(-1, "load private key %s failed\n", keyfile);
 
 	ctx->pkey = pkey;
@@ -116,20 +1337,172 @@ dssl_ctx_load_pkey(dssl_ctx_t *ctx, const char *keyfile, const char *pw)
 }
 
 int 
-dssl_decode(dssl_t *s, const u_int8_t *buf, size_t len, int dir)
+dssl_ctx_start(dssl_ctx_t *ctx, int nworker, u_int32_t maxssn)
 {
-	if (unlikely(!s || !buf || len < 1))
+	int i;
+
+	if (unlikely(!ctx || nworker < 0))
 		ERR_RET(-1, "invalid argument\n");
 
-	
+	if (ctx->workers)
+		ERR_RET(-1, "workers already started\n");
+
+	if (_dssl_lock_init())
+		return -1;
+
+	if (maxssn) {
+		_dssl_cache_free(ctx);
+		if (_dssl_cache_alloc(ctx, maxssn))
+			return -1;
+	}
+
+	if (nworker < 1)
+		return 0;
+
+	ctx->workers = calloc(nworker, sizeof(pthread_t));
+	if (!ctx->workers)
+		ERR_RET(-1, "calloc workers failed: %s\n", ERRSTR);
+
+	for (i = 0; i < nworker; i++) {
+		if (pthread_create(&ctx->workers[i], NULL, _dssl_worker, ctx))
+			ERR_RET(-1, "create worker %d failed\n", i);
+		ctx->nworker++;
+	}
+
+	return 0;
+}
+
+void 
+dssl_ctx_print(dssl_ctx_t *ctx, const char *prefix)
+{
+	u_int32_t i;
+	u_int32_t count;
+	u_int64_t nhit, nmiss, nadd, nevict;
+	dssl_shard_t *sh;
+
+	if (unlikely(!ctx))
+		return;
+
+	count = 0;
+	nhit = nmiss = nadd = nevict = 0;
+	for (i = 0; i < ctx->nshard; i++) {
+		sh = &ctx->shards[i];
+		pthread_mutex_lock(&sh->lock);
+		count += sh->count;
+		nhit += sh->nhit;
+		nmiss += sh->nmiss;
+		nadd += sh->nadd;
+		nevict += sh->nevict;
+		pthread_mutex_unlock(&sh->lock);
+	}
+
+	printf("%snworker:         %d\n", prefix, ctx->nworker);
+	printf("%snfull:           %llu\n", prefix,
+	       (unsigned long long)ctx->stat.nfull);
+	printf("%snresume_sid:     %llu\n", prefix,
+	       (unsigned long long)ctx->stat.nresume_sid);
+	printf("%snresume_ticket:  %llu\n", prefix,
+	       (unsigned long long)ctx->stat.nresume_ticket);
+	printf("%snresume_miss:    %llu\n", prefix,
+	       (unsigned long long)ctx->stat.nresume_miss);
+	printf("%snrsa:            %llu\n", prefix,
+	       (unsigned long long)ctx->stat.nrsa);
+	printf("%snrsa_fail:       %llu\n", prefix,
+	       (unsigned long long)ctx->stat.nrsa_fail);
+	printf("%snrec:            %llu\n", prefix,
+	       (unsigned long long)ctx->stat.nrec);
+	printf("%snerror:          %llu\n", prefix,
+	       (unsigned long long)ctx->stat.nerror);
+	printf("%scache:           %u, nhit %llu, nmiss %llu, "
+	       "nadd %llu, nevict %llu\n", prefix, count,
+	       (unsigned long long)nhit, (unsigned long long)nmiss,
+	       (unsigned long long)nadd, (unsigned long long)nevict);
+}
+
+dssl_t * 
+dssl_new(dssl_ctx_t *ctx)
+{
+	dssl_t *s;
+
+	if (unlikely(!ctx))
+		ERR_RET(NULL, "invalid argument\n");
+
+	s = calloc(1, sizeof(dssl_t));
+	if (unlikely(!s))
+		ERR_RET(NULL, "calloc failed: %s\n", ERRSTR);
+
+	/* the session hold a reference of context */
+	__sync_fetch_and_add(&ctx->refcnt, 1);
+	s->ctx = ctx;
+
+	return s;
+}
+
+int 
+dssl_free(dssl_t *s)
+{
+	int i;
+
+	if (unlikely(!s))
+		ERR_RET(-1, "invalid argument\n");
+
+	/* the worker free the job if it's not done */
+	if (s->job)
+		_dssl_job_put(s->job);
+
+	for (i = 0; i < 2; i++) {
+		if (s->keys[i])
+			EVP_CIPHER_CTX_free(s->keys[i]);
+		dbuf_free(&s->recs[i]);
+		dbuf_free(&s->hsks[i]);
+		dbuf_free(&s->bufs[i]);
+	}
+	dbuf_free(&s->hlog);
+	dbuf_free(&s->ticket);
+	dbuf_free(&s->newticket);
+	OPENSSL_cleanse(s->ms, DSSL_MS_LEN);
+
+	dssl_ctx_free(s->ctx);
+	free(s);
+
 	return 0;
 }
 
-u_int8_t *
+int 
+dssl_decode(dssl_t *s, const u_int8_t *buf, size_t len, int dir)
+{
+	if (unlikely(!s || !buf || len < 1 || dir < 0 || dir > 1))
+		ERR_RET(-1, "invalid argument\n");
+
+	if (s->flags & DSSL_F_ERROR)
+		return -1;
+
+	if (_dssl_buf_put(&s->recs[dir], buf, len))
+		return _dssl_error(s);
+
+	return _dssl_process(s, dir);
+}
+
+int 
+dssl_flush(dssl_t *s, int dir)
+{
+	if (unlikely(!s || dir < 0 || dir > 1))
+		ERR_RET(-1, "invalid argument\n");
+
+	if (s->flags & DSSL_F_ERROR)
+		return -1;
+
+	while (s->job && !_dssl_job_check(s))
+		sched_yield();
+
+	return _dssl_process(s, dir);
+}
+
+u_int8_t * 
 dssl_data(dssl_t *s, int dir)
 {
 	dbuf_t *buf;
-	
+
 	if (unlikely(!s))
 		ERR_RET(NULL, "invalid argument\n");
 
@@ -140,8 +1513,11 @@ dssl_data(dssl_t *s, int dir)
 int 
 dssl_drop_data(dssl_t *s, int n, int dir)
 {
-	return 0;
-}
+	if (unlikely(!s || n < 0 || dir < 0 || dir > 1))
+		ERR_RET(-1, "invalid argument\n");
 
+	_dssl_buf_drop(&s->bufs[dir], n);
 
+	return 0;
+}
 
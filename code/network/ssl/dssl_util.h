@@ -11,9 +11,12 @@
 #ifndef FZ_DSSL_UTIL_H
 #define FZ_DSSL_UTIL_H
 
+#include <pthread.h>
 #include <sys/types.h>
 #include <openssl/evp.h>
 
+#include "gcc_common.h"
+#include "cblist.h"
 #include "shash.h"
 #include "dbuffer.h"
 
@@ -62,35 +65,132 @@ typedef struct dssl_hsk {
 	u_int16_t	len;		/* payload length excluding header */
 } dssl_hsk_t;
 
-/* SSL session for session reuse */
+/* session resumption cache */
+#define	DSSL_CACHE_SHARD	16		/* shards, power of 2 */
+#define	DSSL_CACHE_MAX		65536		/* default cached sessions */
+#define	DSSL_SID_MAX		32		/* max session id length */
+#define	DSSL_TICKET_MAX		2048		/* max ticket length cached */
+#define	DSSL_RANDOM_LEN		32		/* hello random length */
+#define	DSSL_MS_LEN		48		/* master secret length */
+#define	DSSL_PENDING_MAX	(256 * 1024)	/* bytes buffered in key exchange */
+
+/* the key of cached session */
+#define	DSSL_KEY_SID		1
+#define	DSSL_KEY_TICKET		2
+
+/* new session ticket handshake and extensions */
+#define	DSSL_HT_NEW_TICKET	0x4
+#define	DSSL_EXT_ETM		0x16		/* encrypt then MAC */
+#define	DSSL_EXT_EMS		0x17		/* extended master secret */
+#define	DSSL_EXT_TICKET		0x23
+
+/* session flags */
+#define	DSSL_F_CLI_HELLO	0x01		/* client hello seen */
+#define	DSSL_F_SVR_HELLO	0x02		/* server hello seen */
+#define	DSSL_F_KEYEXG		0x04		/* client key exchange seen */
+#define	DSSL_F_MS		0x08		/* master secret is known */
+#define	DSSL_F_RESUMED		0x10		/* resumed session */
+#define	DSSL_F_ERROR		0x20		/* can't decode any more */
+#define	DSSL_F_ETM		0x40		/* encrypt then MAC */
+#define	DSSL_F_EMS		0x80		/* extended master secret */
+
+/* SSL session for session reuse, key is session id or ticket */
 typedef struct dssl_ssn {
-	dbuf_t		sid;
-	dbuf_t		pms;
+	cblist_t	lru;		/* in shard LRU list */
+	u_int32_t	hval;		/* hash value of @key */
+	u_int8_t	ms[DSSL_MS_LEN];/* master secret */
+	u_int16_t	klen;		/* length of @key */
+	u_int8_t	key[0];		/* type + session id/ticket */
 } dssl_ssn_t;
 
+/* shard of session cache, it's locked by @lock */
+typedef struct dssl_shard {
+	pthread_mutex_t	lock;		/* lock of shard */
+	shash_t		*hash;		/* sessions */
+	cblist_t	lru;		/* sessions sorted by last used */
+	u_int32_t	count;		/* sessions in shard */
+	u_int32_t	max;		/* max sessions of shard */
+	u_int64_t	nhit;		/* find success */
+	u_int64_t	nmiss;		/* find failed */
+	u_int64_t	nadd;		/* sessions added */
+	u_int64_t	nevict;		/* sessions evicted by LRU */
+} __cacheline_aligned dssl_shard_t;
+
+/* key exchange decrypt job, freed by the last of session/worker */
+typedef struct dssl_job {
+	cblist_t	list;		/* in context job list */
+	int		ref;		/* reference count */
+	int		done;		/* 1 success, -1 failed, 0 pending */
+	u_int8_t	pms[DSSL_MS_LEN];/* pre master secret */
+	u_int32_t	len;		/* length of @data */
+	u_int8_t	data[0];	/* encrypted pre master secret */
+} dssl_job_t;
+
+/* SSL decode statistic data, updated atomically */
+typedef struct dssl_stat {
+	u_int64_t	nfull;		/* full handshakes */
+	u_int64_t	nresume_sid;	/* resumed by session id */
+	u_int64_t	nresume_ticket;	/* resumed by session ticket */
+	u_int64_t	nresume_miss;	/* resumed session not cached */
+	u_int64_t	nrsa;		/* RSA key exchange decrypted */
+	u_int64_t	nrsa_fail;	/* RSA key exchange decrypt failed */
+	u_int64_t	nrec;		/* records decrypted */
+	u_int64_t	nerror;		/* sessions stop decode by error */
+} dssl_stat_t;
+
 /* SSL decode context */
 typedef struct dssl_ctx {
 	EVP_PKEY	*pkey;		/* server private key */
 	u_int32_t	refcnt;		/* reference count */
-	shash_t		*ssnhash;	/* session hash */
+	dssl_shard_t	*shards;	/* session cache shards */
+	u_int32_t	nshard;		/* number of @shards */
+	pthread_t	*workers;	/* key exchange decrypt threads */
+	int		nworker;	/* number of @workers */
+	pthread_mutex_t	lock;		/* lock of @jobs */
+	pthread_cond_t	cond;		/* signal @jobs not empty */
+	cblist_t	jobs;		/* pending key exchange jobs */
+	int		stop;		/* stop workers */
+	dssl_stat_t	stat;		/* statistic data */
 } dssl_ctx_t;
 
-/* SSL session */
+/* cipher suite parameters */
+typedef struct dssl_cipher {
+	u_int16_t	suite;		/* cipher suite */
+	u_int8_t	keylen;		/* key length */
+	u_int8_t	ivlen;		/* IV length in key block */
+	u_int8_t	maclen;		/* MAC length */
+	u_int8_t	blklen;		/* block size, 0 is AEAD */
+	u_int8_t	sha384;		/* TLS1.2 PRF use SHA384 */
+	const EVP_CIPHER *(*evp)(void);	/* cipher */
+} dssl_cipher_t;
+
+/* SSL session, it's used by one thread */
 typedef struct dssl {
 	dssl_ctx_t	*ctx;		/* the context of this session */
-	dbuf_t		domain;		/* client domain name */
-	dbuf_t		sid;		/* client session id */
-	dbuf_t		randoms[2];	/* client random */
-	dbuf_t		pms;		/* pre master security */
-	dbuf_t		ms;		/* master security */
-	EVP_CIPHER_CTX	*keys[2];	/* client decrypt key */
-	EVP_MD_CTX	*mds[2];	/* client message digest */
+	u_int32_t	flags;		/* DSSL_F_XXX */
+	u_int16_t	version;	/* protocol version */
+	const dssl_cipher_t *cipher;	/* cipher suite */
+	u_int8_t	sidlen;		/* length of @sid */
+	u_int8_t	sid[DSSL_SID_MAX];/* session id */
+	u_int8_t	randoms[2][DSSL_RANDOM_LEN];/* client/server random */
+	u_int8_t	ms[DSSL_MS_LEN];/* master secret */
+	u_int8_t	hash[DSSL_MS_LEN];/* session hash of EMS */
+	u_int8_t	hashlen;	/* length of @hash */
+	u_int8_t	ivs[2][4];	/* AEAD fixed IV */
+	int		ccs[2];		/* change cipher spec seen */
+	dbuf_t		ticket;		/* ticket sent by client */
+	dbuf_t		newticket;	/* ticket issued by server */
+	EVP_CIPHER_CTX	*keys[2];	/* client/server decrypt key */
+	dssl_job_t	*job;		/* pending key exchange job */
 	dbuf_t		recs[2];	/* SSL record buffer */
+	dbuf_t		hsks[2];	/* handshake message buffer */
+	dbuf_t		hlog;		/* handshake messages for EMS */
 	dbuf_t		bufs[2];	/* SSL plain data */
 } dssl_t;
 
 /**
- *	Alloc a new dssl_ctx_t object.
+ *	Alloc a new dssl_ctx_t object, the session cache has
+ *	DSSL_CACHE_MAX sessions and no worker.
  *
  *	Return pointer if success, NULL on error.
  */
@@ -115,6 +215,25 @@ dssl_ctx_free(dssl_ctx_t *ctx);
 extern int 
 dssl_ctx_load_pkey(dssl_ctx_t *ctx, const char *pkey, const char *pw);
 
+/**
+ *	Start @nworker threads to decrypt the key exchange of @ctx,
+ *	0 is decrypt in caller thread. The session cache is resized
+ *	to @maxssn sessions if @maxssn is not 0. It's called before
+ *	any session alloced.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+dssl_ctx_start(dssl_ctx_t *ctx, int nworker, u_int32_t maxssn);
+
+/**
+ *	Print the statistic data of @ctx.
+ *
+ *	No return.
+ */
+extern void 
+dssl_ctx_print(dssl_ctx_t *ctx, const char *prefix);
+
 /**
  *	Alloc a new DSSL object.
  *
@@ -124,7 +243,7 @@ extern dssl_t *
 dssl_new(dssl_ctx_t *ctx);
 
 /**
- *	Free DSSL object @ssl
+ *	Free DSSL object @ssl, the pending key exchange is dropped.
  *
  *	Return 0 if success, -1 on error.
  */
@@ -132,16 +251,39 @@ extern int
 dssl_free(dssl_t *ssl);
 
 /**
- *	Decode SSL data in @buf, @buf length is @siz.
+ *	Decode SSL data in @buf of direction @dir, @buf length is
+ *	@siz. The records after key exchange are kept in order
+ *	until the pre master secret is decrypted by worker.
  *
- * 	Return >0 if success, -1 on error.
+ * 	Return bytes of plain data in @dir, -1 on error.
  */
 extern int 
 dssl_decode(dssl_t *s, const u_int8_t *buf, size_t siz, int dir);
 
+/**
+ *	Wait the pending key exchange of @s and decode the kept
+ *	records of @dir, it's called before session closed.
+ *
+ * 	Return bytes of plain data in @dir, -1 on error.
+ */
+extern int 
+dssl_flush(dssl_t *s, int dir);
+
+/**
+ *	Get the plain data of @dir.
+ *
+ *	Return the data pointer, NULL on error.
+ */
 extern u_int8_t * 
 dssl_data(dssl_t *s, int dir);
 
-#endif /* end of FZ_DSSL_UTIL_H */
+/**
+ *	Drop @n bytes plain data of @dir, the data is consumed.
+ *
+ *	Return 0 if success, -1 on error.
+ */
+extern int 
+dssl_drop_data(dssl_t *s, int n, int dir);
 
+#endif /* end of FZ_DSSL_UTIL_H */
 